@@ -17,6 +17,7 @@
 //
 #define TOUCH_POOL_TAG                  (ULONG)'cuoT'
 #define TOUCH_POOL_TAG_MSG              (ULONG)'gsmT'
+#define TOUCH_POOL_TAG_F12              (ULONG)'21FT'
 #define TOUCH_POWER_POOL_TAG            (ULONG)'PuoT'
 
 //
@@ -83,7 +83,6 @@ typedef struct _DEVICE_EXTENSION
     //
     // Test related
     //
-    WDFQUEUE TestQueue;
     volatile LONG TestSessionRefCnt;
     BOOLEAN DiagnosticMode;
 
@@ -133,6 +133,20 @@ typedef struct _RMI4_F01_QUERY_REGISTERS
 	BYTE Reserved31;
 } RMI4_F01_QUERY_REGISTERS;
 
+//
+// Identifies the firmware and configuration the function table was
+// built for: the F01 query registers up to the product ID, which hold
+// the firmware revision and date, and the F34 customer config ID
+//
+#define RMI4_IDENTITY_QUERY_SIZE	20
+#define RMI4_CONFIG_ID_SIZE			4
+
+typedef struct _RMI4_IDENTITY
+{
+	BYTE Query[RMI4_IDENTITY_QUERY_SIZE];
+	BYTE ConfigId[RMI4_CONFIG_ID_SIZE];
+} RMI4_IDENTITY;
+
 //
 // Logical structure for getting registry config settings
 //
@@ -222,12 +236,22 @@ typedef struct _RMI4_DETECTED_BUTTONS
 #define RMI_REG_DESC_PRESENSE_BITS	(32 * BITS_PER_BYTE)
 #define RMI_REG_DESC_SUBPACKET_BITS	(37 * BITS_PER_BYTE)
 
+//
+// Largest Data1 object record, 3D position with width
+//
+#define RMI4_F12_MAX_OBJECT_SIZE	8
+
+//
+// The maps are in the words of the bitops helpers, unsigned long, which
+// is wider than ULONG outside Windows
+//
+
 /* describes a single packet register */
 typedef struct _RMI_REGISTER_DESC_ITEM {
 	USHORT Register;
 	ULONG RegisterSize;
 	BYTE NumSubPackets;
-	ULONG SubPacketMap[BITS_TO_LONGS(RMI_REG_DESC_SUBPACKET_BITS)];
+	unsigned long SubPacketMap[BITS_TO_LONGS(RMI_REG_DESC_SUBPACKET_BITS)];
 } RMI_REGISTER_DESC_ITEM, * PRMI_REGISTER_DESC_ITEM;
 
 /*
@@ -236,7 +260,7 @@ typedef struct _RMI_REGISTER_DESC_ITEM {
 */
 typedef struct _RMI_REGISTER_DESCRIPTOR {
 	ULONG StructSize;
-	ULONG PresenceMap[BITS_TO_LONGS(RMI_REG_DESC_PRESENSE_BITS)];
+	unsigned long PresenceMap[BITS_TO_LONGS(RMI_REG_DESC_PRESENSE_BITS)];
 	UINT8 NumRegisters;
 	RMI_REGISTER_DESC_ITEM* Registers;
 } RMI_REGISTER_DESCRIPTOR, * PRMI_REGISTER_DESCRIPTOR;
@@ -245,6 +269,42 @@ typedef struct _RMI_REGISTER_DESCRIPTOR {
 // Function $XX - Add new support functions here
 //
 
+//
+// Registers read on every interrupt, planned once the functions and the
+// F12 register descriptors are known. Registers next to each other on a
+// page are merged into one block read and sliced out of Buffer.
+//
+
+#define RMI4_READ_PLAN_MAX_GAP		16
+#define RMI4_READ_PLAN_MAX_LENGTH	256
+
+typedef enum _RMI4_READ_PLAN_ITEM_ID
+{
+	RMI4_READ_F01_STATUS = 0,
+	RMI4_READ_F12_DATA1,
+	RMI4_READ_F12_DATA4,
+	RMI4_READ_F12_DATA6,
+	RMI4_READ_F12_DATA15,
+	RMI4_READ_PLAN_MAX_ITEMS
+} RMI4_READ_PLAN_ITEM_ID;
+
+typedef struct _RMI4_READ_PLAN_ITEM
+{
+	BYTE Page;
+	BYTE Address;
+	USHORT Length;
+	USHORT Offset;
+} RMI4_READ_PLAN_ITEM;
+
+typedef struct _RMI4_READ_PLAN
+{
+	BOOLEAN Fresh;
+	ULONG SpanCount;
+	RMI4_READ_PLAN_ITEM Spans[RMI4_READ_PLAN_MAX_ITEMS];
+	RMI4_READ_PLAN_ITEM Items[RMI4_READ_PLAN_MAX_ITEMS];
+	BYTE Buffer[RMI4_READ_PLAN_MAX_LENGTH];
+} RMI4_READ_PLAN;
+
 
 //
 // Driver structures
@@ -286,6 +346,17 @@ typedef struct _RMI4_CONTROLLER_CONTEXT
 	UCHAR FunctionInterruptMasks[RMI4_MAX_FUNCTIONS];
 	int CurrentPage;
 
+	//
+	// The function table and the F12 register descriptors are kept
+	// across resets and resumes as long as the controller reports
+	// the same identity
+	//
+	BOOLEAN FunctionsCached;
+	BOOLEAN F12DescriptorsCached;
+	RMI4_IDENTITY Identity;
+	ULONG CacheHits;
+	ULONG CacheMisses;
+
 	ULONG InterruptStatus;
 	BOOLEAN HasButtons;
 	BOOLEAN ResetOccurred;
@@ -321,8 +392,11 @@ typedef struct _RMI4_CONTROLLER_CONTEXT
 	size_t PacketSize;
 
 	BYTE MaxFingers;
+	BYTE F12ObjectData[MAX_TOUCHES * RMI4_F12_MAX_OBJECT_SIZE];
 
 	BOOLEAN GesturesEnabled;
+
+	RMI4_READ_PLAN ReadPlan;
 } RMI4_CONTROLLER_CONTEXT;
 
 NTSTATUS
@@ -345,6 +419,11 @@ RmiChangePage(
 	IN int DesiredPage
 );
 
+VOID
+RmiInvalidateFunctionsTable(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
+
 NTSTATUS
 RmiReadRegisterDescriptor(
 	IN SPB_CONTEXT* Context,
@@ -352,12 +431,17 @@ RmiReadRegisterDescriptor(
 	IN PRMI_REGISTER_DESCRIPTOR Rdesc
 );
 
+VOID
+RmiFreeRegisterDescriptor(
+	IN PRMI_REGISTER_DESCRIPTOR Rdesc
+);
+
 size_t
 RmiRegisterDescriptorCalcSize(
 	IN PRMI_REGISTER_DESCRIPTOR Rdesc
 );
 
-const PRMI_REGISTER_DESC_ITEM RmiGetRegisterDescItem(
+PRMI_REGISTER_DESC_ITEM RmiGetRegisterDescItem(
 	PRMI_REGISTER_DESCRIPTOR Rdesc,
 	USHORT reg
 );
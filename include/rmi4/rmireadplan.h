@@ -0,0 +1,23 @@
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include <rmi4\rmiinternal.h>
+
+VOID
+RmiBuildReadPlan(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
+
+NTSTATUS
+RmiExecuteReadPlan(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+PVOID
+RmiGetReadPlanData(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN RMI4_READ_PLAN_ITEM_ID Item,
+	OUT ULONG* Length
+);
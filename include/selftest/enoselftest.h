@@ -37,6 +37,7 @@ DEFINE_GUID(GUID_TOUCH_ENOSELFTEST_INTERFACE,
 #define IOCTL_TOUCH_ENOSELFTEST_WRITE          TOUCH_ENOTEST_BUFFER_CTL_CODE(101)
 #define IOCTL_TOUCH_ENOSELFTEST_MODE           TOUCH_ENOTEST_BUFFER_CTL_CODE(102)
 #define IOCTL_TOUCH_ENOSELFTEST_CHANGE_PAGE    TOUCH_ENOTEST_BUFFER_CTL_CODE(103)
+#define IOCTL_TOUCH_ENOSELFTEST_STATS          TOUCH_ENOTEST_BUFFER_CTL_CODE(109)
 
 typedef struct _TOUCH_ENOTEST_I2C_HEADER
 {
@@ -45,14 +46,9 @@ typedef struct _TOUCH_ENOTEST_I2C_HEADER
     ULONG RequestedTransferLength;
 } TOUCH_ENOTEST_I2C_HEADER;
 
-EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL TchEnoSelfTestOnDeviceControl;
-
-EVT_WDF_DEVICE_FILE_CREATE TchEnoSelfTestOnCreate;
-
-EVT_WDF_FILE_CLOSE TchEnoSelfTestOnClose;
-
-NTSTATUS
-TchEnoSelfTestInitialize(
-    IN WDFDEVICE Device
-);
+//
+// IOCTL_TOUCH_ENOSELFTEST_STATS returns the TOUCH_TEST_STATS layout from
+// selftest.h. This interface is served by the self-test engine in
+// selftest.c, TchSelfTestInitialize creates its device as well.
+//
 
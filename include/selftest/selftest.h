@@ -33,10 +33,26 @@ DEFINE_GUID(GUID_TOUCH_SELFTEST_INTERFACE,
 #define TOUCH_TEST_BUFFER_CTL_CODE(id)  \
     CTL_CODE(FILE_DEVICE_KEYBOARD, (id), METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+//
+// For IOCTLs that expose bus traffic or change how the bus behaves,
+// the handle must have been opened for writing
+//
+#define TOUCH_TEST_WRITE_CTL_CODE(id)  \
+    CTL_CODE(FILE_DEVICE_KEYBOARD, (id), METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
 #define IOCTL_TOUCH_SELFTEST_READ           TOUCH_TEST_BUFFER_CTL_CODE(100)
 #define IOCTL_TOUCH_SELFTEST_WRITE          TOUCH_TEST_BUFFER_CTL_CODE(101)
 #define IOCTL_TOUCH_SELFTEST_MODE           TOUCH_TEST_BUFFER_CTL_CODE(102)
 #define IOCTL_TOUCH_SELFTEST_CHANGE_PAGE    TOUCH_TEST_BUFFER_CTL_CODE(103)
+#define IOCTL_TOUCH_SELFTEST_DYNAMIC_CONFIG_SCHEMA TOUCH_TEST_BUFFER_CTL_CODE(104)
+#define IOCTL_TOUCH_SELFTEST_IMAGE_STREAM   \
+    CTL_CODE(FILE_DEVICE_KEYBOARD, 105, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+#define IOCTL_TOUCH_SELFTEST_IMAGE_STREAM_STOP TOUCH_TEST_BUFFER_CTL_CODE(106)
+#define IOCTL_TOUCH_SELFTEST_PRODUCTION_TEST TOUCH_TEST_BUFFER_CTL_CODE(107)
+#define IOCTL_TOUCH_SELFTEST_BATCH          TOUCH_TEST_BUFFER_CTL_CODE(108)
+#define IOCTL_TOUCH_SELFTEST_STATS          TOUCH_TEST_BUFFER_CTL_CODE(109)
+#define IOCTL_TOUCH_SELFTEST_BUS_CAPTURE    TOUCH_TEST_WRITE_CTL_CODE(110)
+#define IOCTL_TOUCH_SELFTEST_FAULT_INJECTION TOUCH_TEST_WRITE_CTL_CODE(111)
 
 typedef struct _TOUCH_TEST_I2C_HEADER
 {
@@ -45,6 +61,250 @@ typedef struct _TOUCH_TEST_I2C_HEADER
     ULONG RequestedTransferLength;
 } TOUCH_TEST_I2C_HEADER;
 
+//
+// IOCTL_TOUCH_SELFTEST_DYNAMIC_CONFIG_SCHEMA output, followed by
+// FieldCount TOUCH_TEST_DYNAMIC_CONFIG_FIELD entries
+//
+typedef struct _TOUCH_TEST_DYNAMIC_CONFIG_SCHEMA
+{
+    ULONG BuildId;
+    ULONG FieldCount;
+} TOUCH_TEST_DYNAMIC_CONFIG_SCHEMA;
+
+typedef struct _TOUCH_TEST_DYNAMIC_CONFIG_FIELD
+{
+    UCHAR Id;
+    UCHAR Size;
+    USHORT Offset;
+} TOUCH_TEST_DYNAMIC_CONFIG_FIELD;
+
+//
+// IOCTL_TOUCH_SELFTEST_IMAGE_STREAM input. The output buffer becomes a
+// ring of image frames shared with the driver for as long as the
+// request stays pending; it completes on
+// IOCTL_TOUCH_SELFTEST_IMAGE_STREAM_STOP, cancellation or handle close.
+//
+#define TOUCH_TEST_IMAGE_STREAM_COMPRESS 0x01
+
+typedef struct _TOUCH_TEST_IMAGE_STREAM_CONFIG
+{
+    UCHAR ReportType;   // TCM_REPORT_RAW or TCM_REPORT_DELTA
+    UCHAR Flags;        // TOUCH_TEST_IMAGE_STREAM_*
+} TOUCH_TEST_IMAGE_STREAM_CONFIG;
+
+//
+// Layout of the shared ring: a TOUCH_TEST_IMAGE_RING header followed by
+// SlotCount slots of SlotSize bytes, each a TOUCH_TEST_IMAGE_FRAME
+// followed by Rows * Cols little endian 16-bit samples.
+//
+// Frame n (n >= 1) lives in slot n % SlotCount. The driver zeroes the
+// slot Sequence while the frame is written and then sets it to n, so a
+// reader copies a slot and keeps it only if Sequence was the same
+// non-zero value before and after the copy. WriteSequence is the last
+// frame completed; a reader more than SlotCount frames behind lost
+// frames.
+//
+// Frames without TOUCH_TEST_IMAGE_FRAME_COMPRESSED hold Length bytes of
+// samples as-is. Compressed frames hold a token stream covering all
+// Rows * Cols samples in order:
+//
+//   - each sample is coded as d = sample - reference (16-bit wrapping),
+//     the reference being the previous frame of the stream, or zero
+//     for a TOUCH_TEST_IMAGE_FRAME_KEY frame
+//   - d is zig-zag mapped to z = (d << 1) ^ (d >> 15)
+//   - a run of n zero values (1 <= n <= 65536) is the token (n - 1) << 1,
+//     any other value is the token (z << 1) | 1
+//   - tokens are written as little endian base-128 varints
+//
+// Delta frames only decode on top of the frame right before them; a
+// reader that lost a frame waits for the next key frame. Uncompressed
+// frames are always key frames.
+//
+#define TOUCH_TEST_IMAGE_RING_VERSION 2
+
+#define TOUCH_TEST_IMAGE_FRAME_COMPRESSED 0x01
+#define TOUCH_TEST_IMAGE_FRAME_KEY        0x02
+
+typedef struct _TOUCH_TEST_IMAGE_RING
+{
+    ULONG Version;
+    ULONG ReportType;
+    ULONG Rows;
+    ULONG Cols;
+    ULONG SlotSize;
+    ULONG SlotCount;
+    volatile ULONG WriteSequence;
+    volatile ULONG Truncated;
+} TOUCH_TEST_IMAGE_RING;
+
+typedef struct _TOUCH_TEST_IMAGE_FRAME
+{
+    volatile ULONG Sequence;
+    ULONG Length;
+    ULONG64 Timestamp;
+    ULONG Flags;
+    ULONG Reserved;
+} TOUCH_TEST_IMAGE_FRAME;
+
+//
+// IOCTL_TOUCH_SELFTEST_BATCH input: a batch header, OpCount operations,
+// then the data of all write operations. Write DataOffset is relative to
+// the end of the operation array in the input, read DataOffset relative
+// to the end of the status array in the output.
+//
+// Output: a batch result, OpCount NTSTATUS values, then the read data.
+// All operations run back to back without the ISR touching the bus in
+// between; TOUCH_TEST_BATCH_STOP_ON_ERROR skips the rest of the batch
+// after the first failure (skipped operations report STATUS_CANCELLED).
+//
+#define TOUCH_TEST_BATCH_MAX_OPS        256
+#define TOUCH_TEST_BATCH_STOP_ON_ERROR  0x01
+
+#define TOUCH_TEST_BATCH_OP_WRITE       0x01
+#define TOUCH_TEST_BATCH_OP_PAGE        0x02    // select Page first (RMI4 page select register)
+
+typedef struct _TOUCH_TEST_BATCH_HEADER
+{
+    ULONG OpCount;
+    ULONG Flags;
+} TOUCH_TEST_BATCH_HEADER;
+
+typedef struct _TOUCH_TEST_BATCH_OP
+{
+    UCHAR Flags;
+    UCHAR Address;
+    UCHAR Page;
+    UCHAR Reserved;
+    ULONG Length;
+    ULONG DataOffset;
+} TOUCH_TEST_BATCH_OP;
+
+typedef struct _TOUCH_TEST_BATCH_RESULT
+{
+    ULONG OpsCompleted;
+    ULONG OpsFailed;
+} TOUCH_TEST_BATCH_RESULT;
+
+//
+// IOCTL_TOUCH_SELFTEST_PRODUCTION_TEST input. Tests is a mask of
+// TOUCH_TEST_PT_* bits; only tests enabled in the vendor's registry
+// limits run.
+//
+#define TOUCH_TEST_PT_SHORTS        0x01
+#define TOUCH_TEST_PT_BASELINE      0x02
+#define TOUCH_TEST_PT_HIGH_RES      0x04
+#define TOUCH_TEST_PT_ABS_RAW_CAP   0x08
+
+typedef struct _TOUCH_TEST_PRODUCTION_TEST
+{
+    ULONG Vendor;       // 0 - 3, selects the Vendor0x registry limits
+    ULONG Tests;
+} TOUCH_TEST_PRODUCTION_TEST;
+
+//
+// IOCTL_TOUCH_SELFTEST_PRODUCTION_TEST output: a result header, then
+// TestCount entries, then the images the entries point at (as far as
+// the output buffer allows).
+//
+// RxFail/TxFail have bit n set if receiver/transmitter n failed. For
+// the short test they hold the failing TRX pins 0-63 and 64-127.
+//
+#define TOUCH_TEST_PT_PASS      0
+#define TOUCH_TEST_PT_FAIL      1
+#define TOUCH_TEST_PT_ERROR     2
+
+typedef struct _TOUCH_TEST_PRODUCTION_RESULT
+{
+    ULONG Rows;
+    ULONG Cols;
+    ULONG TestCount;
+    ULONG FailedCount;
+} TOUCH_TEST_PRODUCTION_RESULT;
+
+typedef struct _TOUCH_TEST_PRODUCTION_ENTRY
+{
+    UCHAR TestItem;
+    UCHAR Status;
+    USHORT FailedPixels;
+    LONG Min;
+    LONG Max;
+    ULONG ImageOffset;  // from the start of the output, 0 if not stored
+    ULONG ImageLength;
+    ULONG Reserved;
+    ULONG64 RxFail;
+    ULONG64 TxFail;
+} TOUCH_TEST_PRODUCTION_ENTRY;
+
+//
+// IOCTL_TOUCH_SELFTEST_STATS output: a stats header followed by one
+// entry per IOCTL of the interface the request was sent to. Latency is
+// measured from dispatch until the request completes or is pended.
+//
+typedef struct _TOUCH_TEST_STATS
+{
+    ULONG IoctlCount;
+    ULONG Reserved;
+} TOUCH_TEST_STATS;
+
+typedef struct _TOUCH_TEST_IOCTL_STATS
+{
+    ULONG IoControlCode;
+    ULONG Calls;
+    ULONG Failures;
+    ULONG Reserved;
+    ULONG64 TotalLatencyUs;
+    ULONG64 MaxLatencyUs;
+} TOUCH_TEST_IOCTL_STATS;
+
+//
+// IOCTL_TOUCH_SELFTEST_BUS_CAPTURE output, followed by Length bytes
+// holding RecordCount bus transactions in the SPB_CAPTURE_RECORD layout
+// of spb.h, oldest first. Records returned are removed from the capture
+// ring, Lost counts those overwritten since the previous request.
+//
+typedef struct _TOUCH_TEST_BUS_CAPTURE
+{
+    ULONG RecordCount;
+    ULONG Lost;
+    ULONG Length;
+    ULONG Reserved;
+} TOUCH_TEST_BUS_CAPTURE;
+
+//
+// IOCTL_TOUCH_SELFTEST_FAULT_INJECTION input, optional. Sets up bus
+// fault injection as described for SPB_FAULT_CONFIG in spb.h, Faults
+// takes its SPB_FAULT_* flags, and resets the counters below. Without
+// input the request only returns them.
+//
+typedef struct _TOUCH_TEST_FAULT_INJECTION
+{
+    ULONG Faults;
+    ULONG Rate;
+    ULONG Period;
+    ULONG Count;
+    ULONG DelayUs;
+    ULONG Seed;
+} TOUCH_TEST_FAULT_INJECTION;
+
+//
+// IOCTL_TOUCH_SELFTEST_FAULT_INJECTION output. A recovery is a run of
+// FramesLost messages the driver could not read ending with a valid
+// one, timed from the first lost message. FramesLost is non-zero while
+// the driver is out of sync.
+//
+typedef struct _TOUCH_TEST_FAULT_STATS
+{
+    ULONG Transfers;
+    ULONG Injected;
+    ULONG LostMessages;
+    ULONG Recoveries;
+    ULONG FramesLost;
+    ULONG MaxFramesLost;
+    ULONG LastRecoveryUs;
+    ULONG MaxRecoveryUs;
+    ULONG64 TotalRecoveryUs;
+} TOUCH_TEST_FAULT_STATS;
+
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL TchSelfTestOnDeviceControl;
 
 EVT_WDF_DEVICE_FILE_CREATE TchSelfTestOnCreate;
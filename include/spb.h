@@ -24,9 +24,126 @@
 #include <wdf.h>
 
 #define DEFAULT_SPB_BUFFER_SIZE 64
+#define SPB_MAX_SEQUENCE_READS 8
 
 //
-// SPB (I2C) context
+// Called after every read of a chained read with all data read so far,
+// returns the length of the next read or 0 when the chain is done. Runs
+// at IRQL <= DISPATCH_LEVEL.
+//
+
+typedef ULONG
+SPB_READ_CHAIN_NEXT(
+    IN PVOID Context,
+    IN PUCHAR Data,
+    IN ULONG Length
+    );
+
+typedef SPB_READ_CHAIN_NEXT *PSPB_READ_CHAIN_NEXT;
+
+typedef struct _SPB_READ_CHAIN
+{
+    PSPB_READ_CHAIN_NEXT Next;
+    PVOID Context;
+    ULONG Length;
+    ULONG Pending;
+    ULONG Fault;
+    NTSTATUS Status;
+    KEVENT Done;
+} SPB_READ_CHAIN;
+
+//
+// Bus capture. Every transaction is recorded into a ring as an
+// SPB_CAPTURE_RECORD followed by Length bytes of data, padded to 8 bytes.
+// Reads with SPB_CAPTURE_CONTINUED carry on from the address pointer
+// latched by the device and have no Address. Records with
+// SPB_CAPTURE_TRUNCATED hold only the start of the data transferred.
+//
+
+#define SPB_CAPTURE_READ        0x01
+#define SPB_CAPTURE_WRITE       0x02
+#define SPB_CAPTURE_CONTINUED   0x04
+#define SPB_CAPTURE_SEQUENCE    0x08
+#define SPB_CAPTURE_TRUNCATED   0x10
+#define SPB_CAPTURE_FAULT       0x20
+#define SPB_CAPTURE_WRAP        0x80
+
+#define SPB_CAPTURE_RECORD_SIZE(Length) \
+    ALIGN_UP_BY(sizeof(SPB_CAPTURE_RECORD) + (Length), sizeof(ULONG64))
+
+typedef struct _SPB_CAPTURE_RECORD
+{
+    ULONG64 TimeUs;
+    ULONG Sequence;
+    NTSTATUS Status;
+    ULONG Length;
+    UCHAR Flags;
+    UCHAR Address;
+    USHORT Reserved;
+} SPB_CAPTURE_RECORD;
+
+typedef struct _SPB_CAPTURE
+{
+    PUCHAR Ring;
+    ULONG Size;
+    ULONG Head;
+    ULONG Tail;
+    ULONG Sequence;
+    ULONG Lost;
+} SPB_CAPTURE;
+
+//
+// Fault injection. Transfers are picked every Period transfers, or at
+// random with a chance of Rate parts per million when Period is 0, and
+// get one of the enabled faults:
+//
+//   NAK      - the transfer is not sent and fails as if not acknowledged
+//   TRUNCATE - a read returns half the data asked for
+//   MARKER   - the first byte read is flipped, the marker of a TCM
+//              message header or continued read
+//   PADDING  - the last byte read is flipped, the padding byte of a
+//              TCM message payload
+//   DELAY    - the transfer is sent DelayUs late. Only transfers sent
+//              at PASSIVE_LEVEL are delayed.
+//
+// The same Seed replays the same faults for the same bus traffic.
+// Injection stops after Count faults, unless Count is 0.
+//
+
+#define SPB_FAULT_NAK           0x01
+#define SPB_FAULT_TRUNCATE      0x02
+#define SPB_FAULT_MARKER        0x04
+#define SPB_FAULT_PADDING       0x08
+#define SPB_FAULT_DELAY         0x10
+
+#define SPB_FAULT_READ_FAULTS \
+    (SPB_FAULT_NAK | SPB_FAULT_TRUNCATE | SPB_FAULT_MARKER | SPB_FAULT_PADDING | SPB_FAULT_DELAY)
+#define SPB_FAULT_WRITE_FAULTS \
+    (SPB_FAULT_NAK | SPB_FAULT_DELAY)
+
+typedef struct _SPB_FAULT_CONFIG
+{
+    ULONG Faults;
+    ULONG Rate;
+    ULONG Period;
+    ULONG Count;
+    ULONG DelayUs;
+    ULONG Seed;
+} SPB_FAULT_CONFIG;
+
+typedef struct _SPB_FAULT
+{
+    SPB_FAULT_CONFIG Config;
+    ULONG Random;
+    ULONG Transfers;
+    ULONG Injected;
+} SPB_FAULT;
+
+//
+// SPB (I2C) context. Holding the SpbLock owns the bus, the SpbDo*
+// routines expect the caller to hold it already. A touch controller
+// may use the same lock as its own so that it owns the bus for whole
+// message transactions.
 //
 
 typedef struct _SPB_CONTEXT
@@ -35,9 +152,27 @@ typedef struct _SPB_CONTEXT
     LARGE_INTEGER I2cResHubId;
     WDFMEMORY WriteMemory;
     WDFMEMORY ReadMemory;
+    ULONG WriteMemorySize;
+    ULONG ReadMemorySize;
     WDFWAITLOCK SpbLock;
+    WDFREQUEST ReadRequest;
+    SPB_READ_CHAIN ReadChain;
+    SPB_CAPTURE Capture;
+    SPB_FAULT Fault;
+    BOOLEAN SequenceUnsupported;
 } SPB_CONTEXT;
 
+//
+// One register read of a multi-register sequence
+//
+
+typedef struct _SPB_REGISTER_READ
+{
+    UCHAR Address;
+    PVOID Data;
+    ULONG Length;
+} SPB_REGISTER_READ;
+
 NTSTATUS 
 SpbReadDataSynchronously(
     _In_ SPB_CONTEXT *SpbContext,
@@ -46,6 +181,13 @@ SpbReadDataSynchronously(
     _In_ ULONG Length
     );
 
+NTSTATUS
+SpbReadRegisters(
+    IN SPB_CONTEXT *SpbContext,
+    IN SPB_REGISTER_READ *Reads,
+    IN ULONG Count
+    );
+
 NTSTATUS
 SpbReadContinuedData(
     _In_ SPB_CONTEXT* SpbContext,
@@ -53,6 +195,73 @@ SpbReadContinuedData(
     _In_ ULONG Length
 );
 
+NTSTATUS
+SpbReserveTransferBuffers(
+    IN SPB_CONTEXT *SpbContext,
+    IN ULONG ReadLength,
+    IN ULONG WriteLength
+    );
+
+NTSTATUS
+SpbCaptureRead(
+    IN SPB_CONTEXT *SpbContext,
+    _Out_writes_bytes_(BufferLength) PVOID Buffer,
+    IN ULONG BufferLength,
+    OUT ULONG *Length,
+    OUT ULONG *Records,
+    OUT ULONG *Lost
+    );
+
+VOID
+SpbFaultConfigure(
+    IN SPB_CONTEXT *SpbContext,
+    IN SPB_FAULT_CONFIG *Config
+    );
+
+VOID
+SpbFaultQuery(
+    IN SPB_CONTEXT *SpbContext,
+    OUT ULONG *Transfers,
+    OUT ULONG *Injected
+    );
+
+NTSTATUS
+SpbReadContinuedDataChained(
+    IN SPB_CONTEXT *SpbContext,
+    IN ULONG Length,
+    IN PSPB_READ_CHAIN_NEXT Next,
+    IN PVOID NextContext,
+    _Out_writes_bytes_(DataSize) PVOID Data,
+    IN ULONG DataSize,
+    OUT ULONG *DataLength
+    );
+
+NTSTATUS
+SpbDoReadContinuedDataChained(
+    IN SPB_CONTEXT *SpbContext,
+    IN ULONG Length,
+    IN PSPB_READ_CHAIN_NEXT Next,
+    IN PVOID NextContext,
+    _Out_writes_bytes_(DataSize) PVOID Data,
+    IN ULONG DataSize,
+    OUT ULONG *DataLength
+    );
+
+NTSTATUS
+SpbDoReadRegisters(
+    IN SPB_CONTEXT *SpbContext,
+    IN SPB_REGISTER_READ *Reads,
+    IN ULONG Count
+    );
+
+NTSTATUS
+SpbDoWriteDataSynchronously(
+    IN SPB_CONTEXT *SpbContext,
+    IN UCHAR Address,
+    IN PVOID Data,
+    IN ULONG Length
+    );
+
 VOID
 SpbTargetDeinitialize(
     IN WDFDEVICE FxDevice,
@@ -0,0 +1,85 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		soft_touch_detect.h
+
+	Abstract:
+
+		Host side touch detection from delta images. Plain C with no
+		kernel or WDF headers, the same source is built into the driver
+		and into the Linux benchmark and tests.
+
+	Environment:
+
+		Kernel mode and user mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <stdint.h>
+
+#define SOFT_TOUCH_MAX_PIXELS 4096
+#define SOFT_TOUCH_MAX_CONTACTS 10
+#define SOFT_TOUCH_THRESHOLD 200
+#define SOFT_TOUCH_MIN_PIXELS 2
+#define SOFT_TOUCH_LABEL_ACTIVE 0xFF
+#define SOFT_TOUCH_LABEL_DROPPED 0xFE
+
+typedef struct _TCM_SOFT_TOUCH_BLOB
+{
+	int64_t Weight;
+	int64_t SumX;
+	int64_t SumY;
+	uint32_t Pixels;
+	int16_t Peak;
+} TCM_SOFT_TOUCH_BLOB;
+
+//
+// A contact in panel coordinates. Contacts are kept in slots, a contact
+// stays in its slot for as long as it is tracked.
+//
+typedef struct _TCM_SOFT_TOUCH_CONTACT
+{
+	int32_t Present;
+	int32_t X;
+	int32_t Y;
+} TCM_SOFT_TOUCH_CONTACT;
+
+typedef struct _TCM_SOFT_TOUCH_DETECTOR
+{
+	int16_t Threshold;
+	uint8_t Transpose;
+	uint32_t MinPixels;
+	TCM_SOFT_TOUCH_CONTACT Contacts[SOFT_TOUCH_MAX_CONTACTS];
+	TCM_SOFT_TOUCH_BLOB Blobs[SOFT_TOUCH_MAX_CONTACTS];
+	uint8_t Labels[SOFT_TOUCH_MAX_PIXELS];
+	uint16_t Stack[SOFT_TOUCH_MAX_PIXELS];
+} TCM_SOFT_TOUCH_DETECTOR;
+
+void
+TcmSoftTouchDetectorInitialize(
+	TCM_SOFT_TOUCH_DETECTOR* Detector,
+	int16_t Threshold,
+	int Transpose
+);
+
+void
+TcmSoftTouchDetectorReset(
+	TCM_SOFT_TOUCH_DETECTOR* Detector
+);
+
+uint32_t
+TcmSoftTouchDetect(
+	TCM_SOFT_TOUCH_DETECTOR* Detector,
+	const int16_t* Image,
+	uint32_t Rows,
+	uint32_t Cols,
+	uint32_t MaxX,
+	uint32_t MaxY,
+	TCM_SOFT_TOUCH_CONTACT* Contacts
+);
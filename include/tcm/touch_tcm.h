@@ -2,20 +2,58 @@
 #define _TOUCH_TCM_H_
 
 #include <report.h>
+#include <tcm/soft_touch_detect.h>
 
 #define MESSAGE_MARKER			0xA5
 #define MESSAGE_PADDING			0x5A
 #define MESSAGE_HEADER_SIZE		4
-#define MESSAGE_BUFFER_SIZE		512
+#define MESSAGE_BUFFER_SIZE		(4096 + 256)	// production test images up to 32x64
 
 #define MAX_FINGER 10
 
+#define REPORT_CONFIG_INDEX_BITS		4
+#define REPORT_CONFIG_CLASSIFICATION_BITS	4
+#define REPORT_CONFIG_POSITION_BITS		16
+#define REPORT_CONFIG_ACTIVE_OBJECTS_BITS	4
+#define REPORT_CONFIG_GESTURE_BITS		8
+
 #define DEFAULT_CHUNK_SIZE 1024
 
 #define RESPONSE_TIMEOUT 200
 #define RESPONSE_TIMEOUT_LONG 600
 
-#define STATUS_POLL_INTERVAL -10*1000*100
+#define RESPONSE_POLL_INTERVAL -10*1000
+
+#define COMMAND_HANDOFF_TIMEOUT 5
+
+#define SERVICING_MODE_ISR		0
+#define SERVICING_MODE_THREAD	1
+#define SERVICING_MODE_POLL		2
+
+#define SERVICING_POLL_RATE 120
+#define SERVICING_STORM_THRESHOLD 500
+#define SERVICING_HANDOFF_TIMEOUT 20
+#define SERVICING_WATCHDOG_INTERVAL 1000
+#define SERVICING_RETRY_INTERVAL 5000
+#define SERVICING_MAX_DRAIN 4
+
+#define TCM_MAX_COMMAND_POLICIES 48
+
+#define REPORT_RATE_IDLE_TIMEOUT 1000
+
+#define WAKE_GESTURE_INFO_SIZE 40
+#define WAKE_GESTURE_FAIL_REASON_SIZE 16
+
+#define IMAGE_STREAM_KEYFRAME_INTERVAL 30
+
+#define FIRMWARE_IMAGE_MAGIC 0x4818472b
+#define FIRMWARE_AREA_MAGIC 0x7c05e516
+#define FIRMWARE_IMAGE_MAX_SIZE (512 * 1024)
+#define FIRMWARE_MAX_AREAS 8
+#define FIRMWARE_MAX_ERASE_PAGES 16
+#define FIRMWARE_READ_CHUNK 2048
+
+#define MAX_DYNAMIC_CONFIG_FIELDS 64
 
 enum tcm_status_code {
 	TCM_STATUS_IDLE = 0x00,
@@ -105,6 +143,20 @@ enum gesture_detected_data {
 	DETECT_ONE_TAP = 0x40,
 };
 
+enum lge_gesture_mode {
+	LGE_GESTURE_KNOCK_ON = 0x01,
+	LGE_GESTURE_SWIPE = 0x02,
+	LGE_GESTURE_LONG_PRESS = 0x04,
+};
+
+enum wake_gesture_state {
+	WAKE_GESTURE_DISARMED = 0,
+	WAKE_GESTURE_ARMED,
+	WAKE_GESTURE_LONG_PRESS,
+	WAKE_GESTURE_WAKE_PENDING,
+	WAKE_GESTURE_TRIGGERED,
+};
+
 enum {
 	TCM_POWER_OFF = 0,
 	TCM_POWER_SLEEP,
@@ -117,6 +169,15 @@ enum {
 	TCM_POWER_DSV_ALWAYS_ON,
 };
 
+enum production_test_item {
+	TCM_PT_TRX_TRX_SHORTS = 0x01,
+	TCM_PT_TRX_SENSOR_OPENS = 0x02,
+	TCM_PT_TRX_GROUND_SHORTS = 0x03,
+	TCM_PT_FULL_RAW_CAP = 0x05,
+	TCM_PT_HIGH_RESISTANCE = 0x08,
+	TCM_PT_HYBRID_ABS_RAW = 0x12,
+};
+
 enum firmware_mode {
 	MODE_APPLICATION_FIRMWARE = 0x01,
 	MODE_HOSTDOWNLOAD_FIRMWARE = 0x02,
@@ -171,6 +232,29 @@ enum command {
 	CMD_GET_LGE_GESTURE_FAILREASON = 0xc1,
 };
 
+enum dynamic_config_id {
+	DC_UNKNOWN = 0x00,
+	DC_NO_DOZE,
+	DC_DISABLE_NOISE_MITIGATION,
+	DC_INHIBIT_FREQUENCY_SHIFT,
+	DC_REQUESTED_FREQUENCY,
+	DC_DISABLE_HSYNC,
+	DC_REZERO_ON_EXIT_DEEP_SLEEP,
+	DC_CHARGER_CONNECTED,
+	DC_NO_BASELINE_RELAXATION,
+	DC_IN_WAKEUP_GESTURE_MODE,
+	DC_STIMULUS_FINGERS,
+	DC_GRIP_SUPPRESSION_ENABLED,
+	DC_ENABLE_THICK_GLOVE,
+	DC_ENABLE_GLOVE,
+};
+
+enum report_rate {
+	REPORT_RATE_UNKNOWN = 0,
+	REPORT_RATE_IDLE,
+	REPORT_RATE_ACTIVE,
+};
+
 enum command_status {
 	CMD_IDLE = 0,
 	CMD_BUSY = 1,
@@ -182,7 +266,7 @@ typedef struct _TCM_STATE
 	BOOLEAN Init;
 	BOOLEAN Config;
 	BOOLEAN EsdRecovery;
-	BOOLEAN Power;
+	UINT8 Power;
 } TCM_STATE;
 
 #pragma pack(push)
@@ -261,6 +345,45 @@ typedef struct _TCM_ROMBOOT_INFO
 	UINT16 PcAtTimeOfLastReset;
 } TCM_ROMBOOT_INFO;
 
+typedef struct _TCM_IMAGE_HEADER
+{
+	UINT32 Magic;
+	UINT32 NumOfAreas;
+} TCM_IMAGE_HEADER;
+
+typedef struct _TCM_AREA_DESCRIPTOR
+{
+	UINT32 Magic;
+	UINT8 IdString[16];
+	UINT32 Flags;
+	UINT32 FlashAddressWords;
+	UINT32 Length;
+	UINT32 Checksum;
+} TCM_AREA_DESCRIPTOR;
+
+//
+// One entry of the CMD_DESCRIBE_DYNAMIC_CONFIG response. Offset is where
+// the field sits in the dynamic config blob. GET/SET_DYNAMIC_CONFIG
+// address fields by id, so the driver only checks it against the blob
+// size and reports it through the self-test interface.
+//
+typedef struct _TCM_DYNAMIC_CONFIG_FIELD
+{
+	UINT8 Id;
+	UINT8 Size;
+	UINT16 Offset;
+} TCM_DYNAMIC_CONFIG_FIELD;
+
+typedef struct _TCM_LGE_GESTURE_CONFIG
+{
+	UINT8 Enable;
+	UINT8 Modes;
+	UINT8 TapCount;
+	UINT8 Reserved;
+	UINT16 MaxIntertapTime;
+	UINT16 TapDistance;
+} TCM_LGE_GESTURE_CONFIG;
+
 typedef struct _TCM_PRODUCT_INFO
 {
 	UINT8 ProductID[6];
@@ -285,11 +408,294 @@ typedef struct _TCM_SIGNAL_OBJ
 	KEVENT Event;
 } TCM_SIGNAL_OBJ;
 
+//
+// A command handed over to whoever owns the bus next. The submitter
+// keeps it alive until Written is signaled.
+//
+typedef struct _TCM_COMMAND_SUBMIT
+{
+	SPB_CONTEXT* SpbContext;
+	UINT8 Command;
+	UINT8* Buffer;
+	ULONG Length;
+	NTSTATUS Status;
+	KEVENT Written;
+} TCM_COMMAND_SUBMIT;
+
+typedef struct _TCM_DYNAMIC_CONFIG_SCHEMA
+{
+	BOOLEAN Described;
+	UINT32 BuildId;
+	ULONG Count;
+	UINT8 FieldIndex[256];
+	TCM_DYNAMIC_CONFIG_FIELD Fields[MAX_DYNAMIC_CONFIG_FIELDS];
+} TCM_DYNAMIC_CONFIG_SCHEMA;
+
+typedef struct _TCM_REPORT_RATE
+{
+	WDFWORKITEM WorkItem;
+	WDFTIMER IdleTimer;
+	volatile LONG RequestedRate;
+	LONG CurrentRate;
+	ULONG IdleTimeout;
+	ULONG Transitions;
+	BOOLEAN Unsupported;
+	UINT32 LastObjectMask;
+	DETECTED_OBJECT_POSITION LastPositions[MAX_FINGER];
+} TCM_REPORT_RATE;
+
+//
+// Optional servicing of the controller from a dedicated real-time
+// thread. The ISR hands every interrupt to the thread, which falls
+// back to polling at the frame rate while interrupts are unreliable.
+//
+typedef struct _TCM_SERVICING
+{
+	ULONG Mode;
+	ULONG PollInterval;
+	ULONG StormThreshold;
+	PKTHREAD Thread;
+	KEVENT Interrupt;
+	KEVENT Serviced;
+	volatile LONG Stop;
+	volatile LONG Polling;
+	BOOLEAN TimerResolutionSet;
+	ULONGLONG PollingSince;
+	ULONG PollingIsrCount;
+	ULONGLONG WindowStart;
+	ULONG WindowEmpty;
+	ULONGLONG SignalTime;
+	volatile LONG HandoffPending;
+	ULONG Handoffs;
+	ULONG HandoffTimeouts;
+	ULONG EmptyInterrupts;
+	ULONG MissedInterrupts;
+	ULONG Fallbacks;
+	ULONG Polls;
+	ULONG PolledMessages;
+	ULONG MaxWakeUs;
+	ULONG64 TotalWakeUs;
+	ULONG MaxPollLateUs;
+	ULONG64 TotalPollLateUs;
+} TCM_SERVICING;
+
+typedef struct _TCM_WAKE_GESTURE
+{
+	WDFWORKITEM FailReasonWorkItem;
+	volatile LONG State;
+	UINT8 Modes;
+	UINT8 LastGesture;
+	ULONG InfoLength;
+	UINT8 Info[WAKE_GESTURE_INFO_SIZE];
+	ULONG Wakeups;
+	ULONG Rejected;
+	ULONG FailReasonLength;
+	UINT8 FailReason[WAKE_GESTURE_FAIL_REASON_SIZE];
+} TCM_WAKE_GESTURE;
+
+typedef struct _TCM_IMAGE_STREAM
+{
+	WDFREQUEST Request;
+	WDFREQUEST CancelledRequest;
+	WDFWORKITEM CancelWorkItem;
+	UINT8 ReportType;
+	BOOLEAN Compress;
+	PVOID Ring;
+	UINT16* Reference;
+	BOOLEAN ReferenceValid;
+	ULONG KeyFrameCountdown;
+	ULONG64 RawBytes;
+	ULONG64 EncodedBytes;
+	ULONG SlotSize;
+	ULONG SlotCount;
+	ULONG FrameLength;
+	ULONG Sequence;
+} TCM_IMAGE_STREAM;
+
+typedef struct _TCM_FIRMWARE_AREA
+{
+	UINT8* Data;
+	ULONG Length;
+	ULONG Address;
+} TCM_FIRMWARE_AREA;
+
+typedef struct _TCM_HOST_DOWNLOAD
+{
+	UINT8* Image;
+	ULONG ImageLength;
+	TCM_FIRMWARE_AREA Areas[FIRMWARE_MAX_AREAS];
+	ULONG AreaCount;
+	UINT8* Payload;
+	ULONG PayloadSize;
+	ULONG Downloads;
+	ULONG LastDownloadMs;
+} TCM_HOST_DOWNLOAD;
+
+//
+// Device bring-up after the identify report, run from a work item so
+// prepare hardware does not wait on the controller. Touch reports are
+// dispatched from TCM_START_OPTIONAL on.
+//
+typedef enum _TCM_START_STATE
+{
+	TCM_START_IDLE = 0,
+	TCM_START_FIRMWARE,
+	TCM_START_REPORT_CONFIG,
+	TCM_START_OPTIONAL,
+	TCM_START_DONE,
+	TCM_START_FAILED
+} TCM_START_STATE;
+
+typedef struct _TCM_DEVICE_START
+{
+	WDFWORKITEM WorkItem;
+	volatile LONG State;
+	volatile LONG Cancel;
+	NTSTATUS Status;
+	BOOLEAN ReportsEnabled;
+	volatile LONG FirstTouchPending;
+	ULONGLONG StartTime;
+	ULONG ReadyMs;
+	ULONG FirstTouchMs;
+} TCM_DEVICE_START;
+
+typedef struct _TCM_SOFT_TOUCH
+{
+	BOOLEAN Enabled;
+	ULONG Frames;
+	TCM_SOFT_TOUCH_DETECTOR Detector;
+} TCM_SOFT_TOUCH;
+
+//
+// One vendor's block of test limits in TOUCH_SCREEN_SETTINGS, the
+// Vendor00..03 blocks share this layout
+//
+typedef struct _TCM_VENDOR_TEST_LIMITS
+{
+	UINT32 IncludeHighResTest;
+	UINT32 HighResMaxRxLimit;
+	UINT32 HighResMaxTxLimit;
+	UINT32 HighResMinImageLimit;
+	UINT32 IncludeBaselineMinMaxTest;
+	UINT32 BaselineMinMaxMinPixelLimit;
+	UINT32 BaselineMinMaxMaxPixelLimit;
+	UINT32 IncludeFullBaselineTest;
+	UINT32 RxAmount;
+	UINT32 TxAmount;
+	UINT32 RxElectrodeMaskTouch2D;
+	UINT32 TxElectrodeMaskTouch2D;
+	UINT32 RxElectrodeMaskButtons;
+	UINT32 TxElectrodeMaskButtons;
+	UINT32 FullBaselineButton0Min;
+	UINT32 FullBaselineButton1Min;
+	UINT32 FullBaselineButton2Min;
+	UINT32 FullBaselineButton0Max;
+	UINT32 FullBaselineButton1Max;
+	UINT32 FullBaselineButton2Max;
+	UINT32 IncludeAbsSenseRawCapTest;
+	UINT32 AbsSenseRawCapTxRxStart;
+	UINT32 AbsSenseRawCapTxRxEnd;
+	UINT32 AbsSenseRawCapMinLimit;
+	UINT32 AbsSenseRawCapMaxLimit;
+	UINT32 IncludeShortTest;
+} TCM_VENDOR_TEST_LIMITS;
+
+//
+// How a command is retried. Each attempt waits Timeout ms for the
+// response; retries are delayed by Backoff ms, doubling per retry up to
+// BackoffMax. Only the conditions in Flags are retried.
+//
+#define TCM_RETRY_BUSY      0x01    // TCM_STATUS_BUSY
+#define TCM_RETRY_PENDING   0x02    // TCM_STATUS_PREVIOUS_COMMAND_PENDING
+#define TCM_RETRY_TIMEOUT   0x04    // no response, only for commands safe to resend
+
+typedef struct _TCM_COMMAND_POLICY
+{
+	UINT8 Command;
+	UINT8 Retries;
+	UINT8 Flags;
+	UINT16 Timeout;
+	UINT16 Backoff;
+	UINT16 BackoffMax;
+} TCM_COMMAND_POLICY;
+
+typedef struct _TCM_COMMAND_STATS
+{
+	ULONG Sent;
+	ULONG Failed;
+	ULONG Retries;
+	ULONG Busy;
+	ULONG Pending;
+	ULONG Timeouts;
+	ULONG LateResponses;
+	ULONG MaxLatencyUs;
+	ULONG64 TotalLatencyUs;
+} TCM_COMMAND_STATS;
+
+//
+// How the driver gets back in sync after messages it could not read.
+// A run of lost messages ends with the next valid one, and its length
+// and the time from its first lost message are kept.
+//
+typedef struct _TCM_RECOVERY_STATS
+{
+	ULONG LostMessages;
+	ULONG Recoveries;
+	ULONG FramesLost;
+	ULONG MaxFramesLost;
+	ULONG LastRecoveryUs;
+	ULONG MaxRecoveryUs;
+	ULONG64 TotalRecoveryUs;
+	ULONG64 FirstLostTime;
+} TCM_RECOVERY_STATS;
+
+//
+// Time spent on one side of a lock. Bucket i of the histogram counts
+// the times under 2^i us, the last bucket everything longer.
+//
+#define TCM_LOCK_HISTOGRAM_BUCKETS 16
+
+typedef struct _TCM_LOCK_TIME_STATS
+{
+	ULONG Count;
+	ULONG MaxUs;
+	ULONG64 TotalUs;
+	ULONG Histogram[TCM_LOCK_HISTOGRAM_BUCKETS];
+} TCM_LOCK_TIME_STATS;
+
+//
+// How long a message read holds the ControllerLock, from the ISR or a
+// submitter polling for its response, and how long command submitters
+// wait for the CommandLock. The first covers the bus transfers and the
+// dispatch of one message, the second the commands queued ahead.
+//
+typedef struct _TCM_LOCK_STATS
+{
+	TCM_LOCK_TIME_STATS IsrHold;
+	TCM_LOCK_TIME_STATS CommandWait;
+} TCM_LOCK_STATS;
+
 typedef struct _TCM_CONTROLLER_CONTEXT
 {
 	WDFDEVICE FxDevice;
+
+	//
+	// The SpbLock of the controller's SPB context. Whoever holds it owns
+	// the bus and the controller state, and writes the posted command
+	// before letting go of it.
+	//
 	WDFWAITLOCK ControllerLock;
 	TCM_SIGNAL_OBJ *ResponseSignal;
+	TCM_COMMAND_SUBMIT* volatile PostedCommand;
+
+	//
+	// Held from posting a command until its response has been copied
+	// out of ResponseData, one command is in flight at a time. Taken
+	// before the ControllerLock, never while holding it.
+	//
+	WDFWAITLOCK CommandLock;
+	PKTHREAD CommandOwner;
+	ULONG CommandDepth;
 
 	DEVICE_POWER_STATE DevicePowerState;
 	UINT8 DeviceAddr;
@@ -302,6 +708,8 @@ typedef struct _TCM_CONTROLLER_CONTEXT
 	TCM_STATE ControllerState;
 	TCM_ID_INFO IDInfo;
 	TCM_APP_INFO AppInfo;
+	TCM_BOOT_INFO BootInfo;
+	TCM_ROMBOOT_INFO RomBootInfo;
 
 	INT8 CommandStatus;
 	UINT8 CurrentCommand;
@@ -309,10 +717,33 @@ typedef struct _TCM_CONTROLLER_CONTEXT
 	UINT8 ReportCode;
 	UINT8 ResponseCode;
 	BOOLEAN ReportReady;
+	BOOLEAN PollForResponse;
+
+	//
+	// Set when an attempt timed out without any response, the
+	// controller may still answer it. It answers in order, so the next
+	// response after a retry was written is that one and is dropped.
+	//
+	BOOLEAN ResponseOwed;
+	ULONG LateResponses;
 
 	TCM_BUFFER ResponseData;
 	TCM_BUFFER ConfigData;
+	UINT8 MessageBuffer[MESSAGE_HEADER_SIZE + MESSAGE_BUFFER_SIZE + 3];
 	ULONG ISRCount;
+	ULONG MessageCount;
+	TCM_COMMAND_STATS CommandStats[TCM_MAX_COMMAND_POLICIES];
+	TCM_RECOVERY_STATS RecoveryStats;
+	TCM_LOCK_STATS LockStats;
+
+	TCM_DEVICE_START DeviceStart;
+	TCM_REPORT_RATE ReportRate;
+	TCM_WAKE_GESTURE WakeGesture;
+	TCM_IMAGE_STREAM ImageStream;
+	TCM_SOFT_TOUCH SoftTouch;
+	TCM_HOST_DOWNLOAD HostDownload;
+	TCM_DYNAMIC_CONFIG_SCHEMA DynamicConfigSchema;
+	TCM_SERVICING Servicing;
 } TCM_CONTROLLER_CONTEXT;
 
 typedef struct _TCM_MSG_HEADER
@@ -356,6 +787,43 @@ TcmWriteMessage(
 	IN ULONG* ResponseLength
 );
 
+VOID
+TcmLockCommands(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmUnlockCommands(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmReleaseController(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmLockStatsTrace(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+ULONG
+TcmGetCommandPolicy(
+	IN UINT8 Command,
+	OUT const TCM_COMMAND_POLICY** Policy
+);
+
+VOID
+TcmCommandBackoff(
+	IN const TCM_COMMAND_POLICY* Policy,
+	IN ULONG Retry
+);
+
+VOID
+TcmCommandStatsTrace(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
 NTSTATUS
 TcmDispatchReport(
 	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
@@ -414,5 +882,278 @@ TcmGetAppInfo(
 	IN SPB_CONTEXT* SpbContext
 );
 
+NTSTATUS
+TcmEnterDeepSleep(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+NTSTATUS
+TcmExitDeepSleep(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+NTSTATUS
+TcmGetDynamicConfig(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN UINT8 Id,
+	OUT UINT16* Value
+);
+
+NTSTATUS
+TcmSetDynamicConfig(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN UINT8 Id,
+	IN UINT16 Value
+);
+
+NTSTATUS
+TcmParseDynamicConfigSchema(
+	_In_reads_bytes_(Length) UINT8* Descriptor,
+	IN ULONG Length,
+	IN ULONG DynamicConfigSize,
+	OUT TCM_DYNAMIC_CONFIG_SCHEMA* Schema
+);
+
+NTSTATUS
+TcmDescribeDynamicConfig(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+TCM_DYNAMIC_CONFIG_FIELD*
+TcmFindDynamicConfigField(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN UINT8 Id
+);
+
+NTSTATUS
+TcmImageStreamInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmImageStreamDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+NTSTATUS
+TcmImageStreamStart(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN WDFREQUEST Request,
+	IN UINT8 ReportType,
+	IN BOOLEAN Compress
+);
+
+ULONG
+TcmImageEncode(
+	_In_reads_(Samples) UINT16* Frame,
+	_In_reads_opt_(Samples) UINT16* Reference,
+	IN ULONG Samples,
+	_Out_writes_bytes_(Capacity) UINT8* Output,
+	IN ULONG Capacity
+);
+
+NTSTATUS
+TcmImageStreamStop(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+VOID
+TcmImageStreamDispatch(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN UINT8 ReportType,
+	_In_reads_bytes_(PayloadLength) UINT8* Payload,
+	IN ULONG PayloadLength
+);
+
+NTSTATUS
+TcmProductionTestRun(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN ULONG Vendor,
+	IN ULONG Tests,
+	_Out_writes_bytes_(OutputLength) PVOID Output,
+	IN ULONG OutputLength,
+	OUT ULONG* BytesWritten
+);
+
+NTSTATUS
+TcmLoadFirmwareImage(
+	IN PCWSTR Path,
+	OUT UINT8** Image,
+	OUT ULONG* Length
+);
+
+NTSTATUS
+TcmParseFirmwareImage(
+	_In_reads_bytes_(Length) UINT8* Image,
+	IN ULONG Length,
+	_In_reads_(IdCount) const CHAR* const* Ids,
+	IN ULONG IdCount,
+	OUT TCM_FIRMWARE_AREA* Areas,
+	OUT ULONG* AreaCount
+);
+
+NTSTATUS
+TcmGetRomBootInfo(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+NTSTATUS
+TcmHostDownload(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+VOID
+TcmHostDownloadDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+NTSTATUS
+TcmFirmwareUpdate(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	OUT BOOLEAN* Updated
+);
+
+NTSTATUS
+TcmDeviceStartInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmDeviceStartDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+NTSTATUS
+TcmDeviceStartBegin(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+BOOLEAN
+TcmDeviceStartPending(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmDeviceStartResume(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmDeviceStartStop(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmDeviceStartTouchReported(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN DETECTED_OBJECTS* Data
+);
+
+VOID
+TcmSoftTouchInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+NTSTATUS
+TcmSoftTouchStart(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+VOID
+TcmSoftTouchDispatch(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN PREPORT_CONTEXT ReportContext,
+	_In_reads_bytes_(PayloadLength) UINT8* Payload,
+	IN ULONG PayloadLength
+);
+
+NTSTATUS
+TcmWakeGestureInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmWakeGestureDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+NTSTATUS
+TcmWakeGestureArm(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+NTSTATUS
+TcmWakeGestureDisarm(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+BOOLEAN
+TcmWakeGestureDispatch(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN PREPORT_CONTEXT ReportContext,
+	IN UINT8 Gesture,
+	_In_reads_bytes_(InfoLength) UINT8* Info,
+	IN ULONG InfoLength
+);
+
+VOID
+TcmWakeGestureDeliver(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN PREPORT_CONTEXT ReportContext
+);
+
+NTSTATUS
+TcmServicingInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmServicingDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+NTSTATUS
+TcmServicingHandoff(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN PREPORT_CONTEXT ReportContext
+);
+
+NTSTATUS
+TcmReportRateInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmReportRateDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TcmReportRateUpdate(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN DETECTED_OBJECTS* Data
+);
+
+VOID
+TcmReportRateStop(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+);
+
 
 #endif
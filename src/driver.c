@@ -25,6 +25,7 @@
 #include <device.h>
 #include <hid.h>
 #include <queue.h>
+#include <selftest\selftest.h>
 #include <driver.h>
 #include <driver.tmh>
 
@@ -292,7 +293,6 @@ Return Value:
     //
     // Initialize driver path for self-test
     //
-    /*
     status = TchSelfTestInitialize(fxDevice);
 
     if (!NT_SUCCESS(status))
@@ -306,23 +306,6 @@ Return Value:
         goto exit;
     }
 
-    //
-    // Initialize driver path for self-test
-    //
-    status = TchEnoSelfTestInitialize(fxDevice);
-
-    if (!NT_SUCCESS(status))
-    {
-        Trace(
-            TRACE_LEVEL_ERROR,
-            TRACE_INIT,
-            "Error initializing Eno self-test functionality - %!STATUS!",
-            status);
-
-        goto exit;
-    }
-    */
-
 exit:
 
     return status;
@@ -20,6 +20,7 @@
 --*/
 
 #include <Cross Platform Shim\compat.h>
+#include <internal.h>
 #include <spb.h>
 #include <tcm/touch_tcm.h>
 #include <init.tmh>
@@ -34,7 +35,8 @@ TchStartDevice(
   Routine Description:
 
 	This routine is called in response to the KMDF prepare hardware call
-	to initialize the touch controller for use.
+	to initialize the touch controller for use. Only the identify report
+	is read here, the rest of the bring-up runs asynchronously.
 
   Arguments:
 
@@ -56,6 +58,8 @@ TchStartDevice(
 		return STATUS_INVALID_PARAMETER;
 	}
 
+	controller->DeviceStart.StartTime = KeQueryInterruptTime();
+
 	status = TcmReadMessage(controller,
 						SpbContext,
 						(PREPORT_CONTEXT)NULL);
@@ -71,27 +75,13 @@ TchStartDevice(
 	controller->ControllerState.Power = TCM_POWER_ON;
 	controller->ControllerState.Init = TRUE;
 
-	status = TcmGetIcInfo(controller,
-		SpbContext);
+	//
+	// Everything else waits on the controller and is left to bring-up,
+	// so prepare hardware does not hold up the rest of the stack
+	//
+	status = TcmDeviceStartBegin(controller, SpbContext);
 
 	if (!NT_SUCCESS(status)) {
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_INIT,
-			"Failed to get ic info - 0x%08lX",
-			status);
-		return STATUS_UNSUCCESSFUL;
-	}
-
-	status = TcmGetReportConfig(controller,
-		SpbContext);
-
-	if (!NT_SUCCESS(status) || controller->ConfigData.DataLength == 0) {
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_INIT,
-			"Failed to get report config - 0x%08lX",
-			status);
 		return STATUS_UNSUCCESSFUL;
 	}
 
@@ -120,13 +110,17 @@ Return Value:
 	NTSTATUS indicating sucess or failure
 --*/
 {
-	(void*)ControllerContext;
-	(void*)SpbContext;
-	// TCM_CONTROLLER_CONTEXT* controller;
+	TCM_CONTROLLER_CONTEXT* controller;
 
-	// UNREFERENCED_PARAMETER(SpbContext);
+	UNREFERENCED_PARAMETER(SpbContext);
 
-	// controller = (TCM_CONTROLLER_CONTEXT*)ControllerContext;
+	controller = (TCM_CONTROLLER_CONTEXT*)ControllerContext;
+
+	if (controller != NULL) {
+		TcmDeviceStartStop(controller);
+		TcmCommandStatsTrace(controller);
+		TcmLockStatsTrace(controller);
+	}
 
 	return STATUS_SUCCESS;
 }
@@ -153,6 +147,7 @@ Return Value:
 --*/
 {
 	TCM_CONTROLLER_CONTEXT* context;
+	WDF_OBJECT_ATTRIBUTES lockAttributes;
 	NTSTATUS status;
 	
 	context = ExAllocatePoolWithTag(
@@ -177,27 +172,33 @@ Return Value:
 	//
 	// Get Touch settings and populate context
 	//
-	//TchGetTouchSettings(&context->TouchSettings);
+	TchGetTouchSettings(&context->TouchSettings);
+
+	//
+	// Guard access to the controller HW and driver controller context
+	// with the lock of the bus, so that the ISR takes a single lock for
+	// a whole message. The SPB context owns it.
+	//
+	context->ControllerLock = GetDeviceContext(FxDevice)->I2CContext.SpbLock;
 
 	//
-	// Allocate a WDFWAITLOCK for guarding access to the
-	// controller HW and driver controller context
+	// Commands are serialized among themselves by a lock of their own,
+	// the ISR only needs the bus
 	//
-	status = WdfWaitLockCreate(
-		WDF_NO_OBJECT_ATTRIBUTES,
-		&context->ControllerLock);
+	WDF_OBJECT_ATTRIBUTES_INIT(&lockAttributes);
+	lockAttributes.ParentObject = FxDevice;
+
+	status = WdfWaitLockCreate(&lockAttributes, &context->CommandLock);
 
 	if (!NT_SUCCESS(status))
 	{
 		Trace(
 			TRACE_LEVEL_ERROR,
 			TRACE_INIT,
-			"Could not create lock - 0x%08lX",
+			"Could not create command lock - 0x%08lX",
 			status);
 
-		TchFreeContext(context);
 		goto exit;
-
 	}
 
 	context->ResponseSignal = ExAllocatePoolWithTag(
@@ -222,6 +223,87 @@ Return Value:
 	context->MaxFingers = MAX_FINGER;
 	context->GesturesEnabled = FALSE;
 
+	//
+	// Decides whether gesture fields go into the report config, so it
+	// has to be known before the device is started
+	//
+	status = TcmWakeGestureInitialize(context);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_INIT,
+			"Wake gestures unavailable - 0x%08lX",
+			status);
+
+		status = STATUS_SUCCESS;
+	}
+
+	TcmSoftTouchInitialize(context);
+
+	status = TcmImageStreamInitialize(context);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_INIT,
+			"Image streaming unavailable - 0x%08lX",
+			status);
+
+		status = STATUS_SUCCESS;
+	}
+
+	//
+	// Activity driven report rate scheduling is optional, the
+	// controller just stays at its firmware default rate without it
+	//
+	status = TcmReportRateInitialize(context);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_INIT,
+			"Report rate scheduling unavailable - 0x%08lX",
+			status);
+
+		status = STATUS_SUCCESS;
+	}
+
+	//
+	// Interrupts are serviced inline by the ISR without the thread
+	//
+	status = TcmServicingInitialize(context);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_INIT,
+			"Servicing thread unavailable - 0x%08lX",
+			status);
+
+		status = STATUS_SUCCESS;
+	}
+
+	//
+	// Bring-up falls back to running inside prepare hardware
+	//
+	status = TcmDeviceStartInitialize(context);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_INIT,
+			"Asynchronous device start unavailable - 0x%08lX",
+			status);
+
+		status = STATUS_SUCCESS;
+	}
+
 	*ControllerContext = context;
 
 exit:
@@ -254,11 +336,12 @@ Return Value:
 
 	if (controller != NULL)
 	{
-
-		if (controller->ControllerLock != NULL)
-		{
-			WdfObjectDelete(controller->ControllerLock);
-		}
+		TcmDeviceStartDeinitialize(controller);
+		TcmServicingDeinitialize(controller);
+		TcmReportRateDeinitialize(controller);
+		TcmWakeGestureDeinitialize(controller);
+		TcmImageStreamDeinitialize(controller);
+		TcmHostDownloadDeinitialize(controller);
 
 		ExFreePoolWithTag(controller, TOUCH_POOL_TAG);
 	}
@@ -188,34 +188,22 @@ TchPowerSettingCallback(
                 &GestureEnabled,
                 sizeof(DWORD))) && GestureEnabled == 1)
             {
-                // status = RmiSetReportingFlagsF12(
-                //     ControllerContext,
-                //     SpbContext,
-                //     RMI4_F12_REPORTING_WAKEUP_GESTURE_MODE,
-                //     NULL
-                // );
-
-                // if (!NT_SUCCESS(status))
-                // {
-                //     Trace(
-                //         TRACE_LEVEL_ERROR,
-                //         TRACE_POWER,
-                //         "Error Changing Reporting Mode for F12 - 0x%08lX",
-                //         status);
-                //     goto exit;
-                // }
+                status = TcmWakeGestureArm(
+                    ControllerContext,
+                    SpbContext
+                );
+
+                if (!NT_SUCCESS(status))
+                {
+                    Trace(
+                        TRACE_LEVEL_ERROR,
+                        TRACE_POWER,
+                        "Error arming wake gestures - 0x%08lX",
+                        status);
+                    goto exit;
+                }
             }
 
-            // if (!NT_SUCCESS(status))
-            // {
-            //     Trace(
-            //         TRACE_LEVEL_ERROR,
-            //         TRACE_POWER,
-            //         "Error Changing Reporting Mode for F12 - 0x%08lX",
-            //         status);
-            //     goto exit;
-            // }
-
             break;
         case 1:
             Trace(
@@ -235,22 +223,20 @@ TchPowerSettingCallback(
                 goto exit;
             }
 
-            // status = RmiSetReportingFlagsF12(
-            //     ControllerContext,
-            //     SpbContext,
-            //     RMI4_F12_REPORTING_CONTINUOUS_MODE,
-            //     NULL
-            // );
-
-            // if (!NT_SUCCESS(status))
-            // {
-            //     Trace(
-            //         TRACE_LEVEL_ERROR,
-            //         TRACE_POWER,
-            //         "Error Changing Reporting Mode for F12 - 0x%08lX",
-            //         status);
-            //     goto exit;
-            // }
+            status = TcmWakeGestureDisarm(
+                ControllerContext,
+                SpbContext
+            );
+
+            if (!NT_SUCCESS(status))
+            {
+                Trace(
+                    TRACE_LEVEL_ERROR,
+                    TRACE_POWER,
+                    "Error disarming wake gestures - 0x%08lX",
+                    status);
+                goto exit;
+            }
             break;
         case 2:
             Trace(
@@ -272,6 +258,97 @@ TchPowerSettingCallback(
     return status;
 }
 
+static NTSTATUS
+TchReinitializeDevice(
+   IN TCM_CONTROLLER_CONTEXT* Controller,
+   IN SPB_CONTEXT* SpbContext
+   )
+/*++
+
+Routine Description:
+
+   Resets the controller and restores the state set up at start,
+   used when the controller lost its configuration while asleep
+
+Arguments:
+
+   Controller - Touch controller context
+
+   SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+   NTSTATUS indicating success or failure
+
+--*/
+{
+    NTSTATUS status;
+
+    status = TcmWriteMessage(
+        Controller,
+        SpbContext,
+        CMD_RESET,
+        NULL,
+        0,
+        NULL,
+        NULL);
+
+    if (!NT_SUCCESS(status))
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_POWER,
+            "Error resetting touch controller - 0x%08lX",
+            status);
+        goto exit;
+    }
+
+    Controller->ControllerState.Power = TCM_POWER_ON;
+
+    status = TcmGetIcInfo(Controller, SpbContext);
+
+    if (NT_SUCCESS(status) && Controller->IDInfo.Mode == MODE_ROMBOOTLOADER)
+    {
+        //
+        // The reset dropped the downloaded firmware, the cached image
+        // goes back in without touching the disk
+        //
+        status = TcmHostDownload(Controller, SpbContext);
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        goto exit;
+    }
+
+    status = TcmGetReportConfig(Controller, SpbContext);
+
+    if (!NT_SUCCESS(status))
+    {
+        goto exit;
+    }
+
+    if (!NT_SUCCESS(TcmSetReportConfig(Controller, SpbContext)))
+    {
+        Trace(
+            TRACE_LEVEL_WARNING,
+            TRACE_POWER,
+            "Using default report config after reset");
+    }
+
+    //
+    // Only now is the controller configured, if anything above failed
+    // the next D0 entry resets it again
+    //
+    Controller->ControllerState.Init = TRUE;
+
+    TcmSoftTouchStart(Controller, SpbContext);
+
+exit:
+
+    return status;
+}
+
 NTSTATUS 
 TchWakeDevice(
    IN VOID *ControllerContext,
@@ -281,7 +358,9 @@ TchWakeDevice(
 
 Routine Description:
 
-   Enables multi-touch scanning
+   Enables multi-touch scanning. A controller that kept its state in
+   deep sleep is resumed without being identified and configured
+   again, anything else falls back to a reset.
 
 Arguments:
 
@@ -296,8 +375,7 @@ Return Value:
 --*/
 {    
     TCM_CONTROLLER_CONTEXT* controller;
-    //NTSTATUS status;
-    (void*)SpbContext;
+    NTSTATUS status;
 
     controller = (TCM_CONTROLLER_CONTEXT*) ControllerContext;
 
@@ -309,24 +387,73 @@ Return Value:
         goto exit;
     }
 
-    controller->DevicePowerState = PowerDeviceD0;
+    //
+    // Bring-up has not finished yet, it configures the controller
+    // for D0 itself
+    //
+    if (TcmDeviceStartPending(controller))
+    {
+        //
+        // Bring-up stops polling for responses once it sees D0, set it
+        // before resuming
+        //
+        controller->DevicePowerState = PowerDeviceD0;
+        TcmDeviceStartResume(controller);
+        goto exit;
+    }
+
+    //
+    // Interrupts are not enabled until D0 entry completes
+    //
+    controller->PollForResponse = TRUE;
+
+    //
+    // With interrupts off nothing has read the identify report of a
+    // reset while asleep. Read as the response to the exit command it
+    // would fail it, and the real response would then be taken for
+    // that of the next command.
+    //
+    if (controller->ControllerState.Power == TCM_POWER_SLEEP)
+    {
+        TcmReadMessage(controller, SpbContext, NULL);
+    }
+
+    if (controller->ControllerState.Power == TCM_POWER_SLEEP)
+    {
+        status = TcmExitDeepSleep(controller, SpbContext);
+
+        if (!NT_SUCCESS(status))
+        {
+            Trace(
+                TRACE_LEVEL_ERROR,
+                TRACE_POWER,
+                "Error waking touch controller - 0x%08lX",
+                status);
+        }
+    }
 
     //
-    // Attempt to put the controller into operating mode 
+    // An identify report seen while asleep means the controller
+    // reset and dropped our configuration
     //
-    // status = RmiChangeSleepState(
-    //     controller,
-    //     SpbContext,
-    //     RMI4_F01_DEVICE_CONTROL_SLEEP_MODE_OPERATING);
-
-    // if (!NT_SUCCESS(status))
-    // {
-    //     Trace(
-    //         TRACE_LEVEL_ERROR,
-    //         TRACE_POWER,
-    //         "Error waking touch controller - 0x%08lX",
-    //         status);
-    // }
+    if (controller->ControllerState.Power != TCM_POWER_ON ||
+        controller->ControllerState.Init != TRUE)
+    {
+        status = TchReinitializeDevice(controller, SpbContext);
+
+        if (!NT_SUCCESS(status))
+        {
+            Trace(
+                TRACE_LEVEL_ERROR,
+                TRACE_POWER,
+                "Error reinitializing touch controller - 0x%08lX",
+                status);
+        }
+    }
+
+    controller->PollForResponse = FALSE;
+
+    controller->DevicePowerState = PowerDeviceD0;
 
 exit:
 
@@ -358,11 +485,46 @@ Return Value:
 --*/
 {
     TCM_CONTROLLER_CONTEXT* controller;
-    // NTSTATUS status;
-    (void*)SpbContext;
+    NTSTATUS status;
 
     controller = (TCM_CONTROLLER_CONTEXT*) ControllerContext;
 
+    //
+    // Bring-up is resumed on the next D0 entry
+    //
+    TcmDeviceStartStop(controller);
+
+    //
+    // Drop any pending report rate change, it would otherwise race
+    // with the controller going to sleep
+    //
+    TcmReportRateStop(controller);
+
+    //
+    // Put the chip in deep sleep. This takes the controller lock
+    // itself, and the response has to be polled for since interrupts
+    // are already disabled. An armed controller is left scanning for
+    // wake gestures instead.
+    //
+    if (controller->ControllerState.Init == TRUE &&
+        controller->WakeGesture.State == WAKE_GESTURE_DISARMED)
+    {
+        controller->PollForResponse = TRUE;
+
+        status = TcmEnterDeepSleep(controller, SpbContext);
+
+        if (!NT_SUCCESS(status))
+        {
+            Trace(
+                TRACE_LEVEL_ERROR,
+                TRACE_POWER,
+                "Error sleeping touch controller - 0x%08lX",
+                status);
+        }
+
+        controller->PollForResponse = FALSE;
+    }
+
     //
     // Interrupts are now disabled but the ISR may still be
     // executing, so grab the controller lock to ensure ISR
@@ -370,23 +532,6 @@ Return Value:
     //
     WdfWaitLockAcquire(controller->ControllerLock, NULL);
 
-    //
-    // Put the chip in sleep mode
-    //
-    // status = RmiChangeSleepState(
-    //     ControllerContext,
-    //     SpbContext,
-    //     RMI4_F01_DEVICE_CONTROL_SLEEP_MODE_SLEEPING);
-
-    // if (!NT_SUCCESS(status))
-    // {
-    //     Trace(
-    //         TRACE_LEVEL_ERROR,
-    //         TRACE_POWER,
-    //         "Error sleeping touch controller - 0x%08lX",
-    //         status);
-    // }
-
     controller->DevicePowerState = PowerDeviceD3;
 
     //
@@ -6,6 +6,7 @@
 #include <spb.h>
 #include <rmi4\rmiinternal.h>
 #include <rmi4\f01\function01.h>
+#include <rmi4\rmireadplan.h>
 #include <function01.tmh>
 
 
@@ -26,13 +27,10 @@ RmiChangeChargerConnectedState(
 	IN UCHAR ChargerConnectedState
 )
 {
-	RMI4_F01_CTRL_REGISTERS* controlF01;
-	UCHAR deviceControl = { 0 };
+	RMI4_F01_CTRL_REGISTERS controlF01 = { 0 };
 	int index;
 	NTSTATUS status;
 
-	controlF01 = (RMI4_F01_CTRL_REGISTERS*)&deviceControl;
-
 	//
 	// Find RMI device control function housing charger connected settings
 	// 
@@ -73,8 +71,8 @@ RmiChangeChargerConnectedState(
 	status = SpbReadDataSynchronously(
 		SpbContext,
 		ControllerContext->Descriptors[index].ControlBase,
-		&deviceControl,
-		sizeof(deviceControl)
+		&controlF01.DeviceControl.All,
+		sizeof(controlF01.DeviceControl.All)
 	);
 
 	if (!NT_SUCCESS(status))
@@ -91,7 +89,7 @@ RmiChangeChargerConnectedState(
 	//
 	// Assign new sleep state
 	//
-	controlF01->DeviceControl.ChargerConnected = ChargerConnectedState;
+	controlF01.DeviceControl.ChargerConnected = ChargerConnectedState;
 
 	//
 	// Write setting back to the controller
@@ -99,8 +97,8 @@ RmiChangeChargerConnectedState(
 	status = SpbWriteDataSynchronously(
 		SpbContext,
 		ControllerContext->Descriptors[index].ControlBase,
-		&deviceControl,
-		sizeof(deviceControl)
+		&controlF01.DeviceControl.All,
+		sizeof(controlF01.DeviceControl.All)
 	);
 
 	if (!NT_SUCCESS(status))
@@ -146,13 +144,10 @@ Return Value:
 
 --*/
 {
-	RMI4_F01_CTRL_REGISTERS* controlF01;
-	UCHAR deviceControl = { 0 };
+	RMI4_F01_CTRL_REGISTERS controlF01 = { 0 };
 	int index;
 	NTSTATUS status;
 
-	controlF01 = (RMI4_F01_CTRL_REGISTERS*)&deviceControl;
-
 	//
 	// Find RMI device control function housing sleep settings
 	// 
@@ -193,8 +188,8 @@ Return Value:
 	status = SpbReadDataSynchronously(
 		SpbContext,
 		ControllerContext->Descriptors[index].ControlBase,
-		&deviceControl,
-		sizeof(deviceControl)
+		&controlF01.DeviceControl.All,
+		sizeof(controlF01.DeviceControl.All)
 	);
 
 	if (!NT_SUCCESS(status))
@@ -211,7 +206,7 @@ Return Value:
 	//
 	// Assign new sleep state
 	//
-	controlF01->DeviceControl.SleepMode = SleepState;
+	controlF01.DeviceControl.SleepMode = SleepState;
 
 	//
 	// Write setting back to the controller
@@ -219,8 +214,8 @@ Return Value:
 	status = SpbWriteDataSynchronously(
 		SpbContext,
 		ControllerContext->Descriptors[index].ControlBase,
-		&deviceControl,
-		sizeof(deviceControl)
+		&controlF01.DeviceControl.All,
+		sizeof(controlF01.DeviceControl.All)
 	);
 
 	if (!NT_SUCCESS(status))
@@ -246,13 +241,10 @@ RmiSetInterruptEnable(
 	IN UCHAR InterruptEnable
 )
 {
-	RMI4_F01_CTRL_REGISTERS* controlF01;
-	UCHAR deviceControl = { 0 };
+	RMI4_F01_CTRL_REGISTERS controlF01 = { 0 };
 	int index;
 	NTSTATUS status;
 
-	controlF01 = (RMI4_F01_CTRL_REGISTERS*)&deviceControl;
-
 	//
 	// Find RMI device control function housing sleep settings
 	// 
@@ -293,8 +285,8 @@ RmiSetInterruptEnable(
 	status = SpbReadDataSynchronously(
 		SpbContext,
 		ControllerContext->Descriptors[index].ControlBase,
-		&deviceControl,
-		sizeof(deviceControl)
+		&controlF01,
+		FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS, DozeInterval)
 	);
 
 	if (!NT_SUCCESS(status))
@@ -309,9 +301,10 @@ RmiSetInterruptEnable(
 	}
 
 	//
-	// Assign new sleep state
+	// Assign new interrupt enable mask, the register follows the device
+	// control register
 	//
-	controlF01->InterruptEnable = InterruptEnable;
+	controlF01.InterruptEnable = InterruptEnable;
 
 	//
 	// Write setting back to the controller
@@ -319,8 +312,8 @@ RmiSetInterruptEnable(
 	status = SpbWriteDataSynchronously(
 		SpbContext,
 		ControllerContext->Descriptors[index].ControlBase,
-		&deviceControl,
-		sizeof(deviceControl)
+		&controlF01,
+		FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS, DozeInterval)
 	);
 
 	if (!NT_SUCCESS(status))
@@ -433,6 +426,27 @@ RmiCheckInterrupts(
 	RtlZeroMemory(&data, sizeof(data));
 	*InterruptStatus = 0;
 
+	//
+	// The planned read fetches the F12 data of this interrupt along
+	// with the status
+	//
+	if (ControllerContext->ReadPlan.Items[RMI4_READ_F01_STATUS].Length != 0)
+	{
+		status = RmiExecuteReadPlan(ControllerContext, SpbContext);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		RtlCopyMemory(
+			&data,
+			&ControllerContext->ReadPlan.Buffer[ControllerContext->ReadPlan.Items[RMI4_READ_F01_STATUS].Offset],
+			sizeof(data));
+
+		goto decode;
+	}
+
 	//
 	// Locate RMI data base address
 	//
@@ -487,6 +501,7 @@ RmiCheckInterrupts(
 		goto exit;
 	}
 
+decode:
 	//
 	// Check for catastrophic failures, simply store in context for
 	// debugging should these errors occur.
@@ -62,6 +62,191 @@ RmiGetObjectCountFromControllerF12(
 	return FingerCount;
 }
 
+static VOID
+RmiDecodeObjectF12(
+	IN DETECTED_OBJECTS* Data,
+	IN int Index,
+	IN BYTE ObjectTypeAndStatus,
+	IN BYTE X_LSB,
+	IN BYTE X_MSB,
+	IN BYTE Y_LSB,
+	IN BYTE Y_MSB
+)
+{
+	switch (ObjectTypeAndStatus)
+	{
+	case RMI4_F12_OBJECT_FINGER:
+		Data->States[Index] = OBJECT_STATE_FINGER_PRESENT_WITH_ACCURATE_POS;
+		break;
+	case RMI4_F12_OBJECT_PALM:
+		Data->States[Index] = OBJECT_STATE_NOT_PRESENT;
+		break;
+	case RMI4_F12_OBJECT_HOVERING_FINGER:
+		Data->States[Index] = OBJECT_STATE_FINGER_PRESENT_WITH_INACCURATE_POS;
+		break;
+	case RMI4_F12_OBJECT_GLOVED_FINGER:
+		Data->States[Index] = OBJECT_STATE_FINGER_PRESENT_WITH_ACCURATE_POS;
+		break;
+	case RMI4_F12_OBJECT_ACTIVE_STYLUS:
+		Data->States[Index] = OBJECT_STATE_PEN_PRESENT_WITH_TIP;
+		break;
+	case RMI4_F12_OBJECT_STYLUS:
+		Data->States[Index] = OBJECT_STATE_PEN_PRESENT_WITH_TIP;
+		break;
+	case RMI4_F12_OBJECT_ERASER:
+		Data->States[Index] = OBJECT_STATE_PEN_PRESENT_WITH_ERASER;
+		break;
+	case RMI4_F12_OBJECT_NONE:
+		Data->States[Index] = OBJECT_STATE_NOT_PRESENT;
+		break;
+	default:
+		Data->States[Index] = OBJECT_STATE_NOT_PRESENT;
+		break;
+	}
+
+	Data->Positions[Index].X = (X_MSB << 8) | X_LSB;
+	Data->Positions[Index].Y = (Y_MSB << 8) | Y_LSB;
+}
+
+//
+// One decoder per Data1 object layout, so that the layout is chosen
+// once per report and not for every object
+//
+
+static VOID
+RmiDecodeSimpleObjectsF12(
+	IN PVOID ControllerData,
+	IN int Count,
+	IN DETECTED_OBJECTS* Data
+)
+{
+	PRMI4_F12_FINGER_SIMPLE_DATA_REGISTER fingers = ControllerData;
+	int i;
+
+	for (i = 0; i < Count; i++)
+	{
+		RmiDecodeObjectF12(Data, i, fingers[i].ObjectTypeAndStatus,
+			fingers[i].X_LSB, fingers[i].X_MSB, fingers[i].Y_LSB, fingers[i].Y_MSB);
+	}
+}
+
+static VOID
+RmiDecode3DObjectsF12(
+	IN PVOID ControllerData,
+	IN int Count,
+	IN DETECTED_OBJECTS* Data
+)
+{
+	PRMI4_F12_FINGER_3D_DATA_REGISTER fingers = ControllerData;
+	int i;
+
+	for (i = 0; i < Count; i++)
+	{
+		RmiDecodeObjectF12(Data, i, fingers[i].ObjectTypeAndStatus,
+			fingers[i].X_LSB, fingers[i].X_MSB, fingers[i].Y_LSB, fingers[i].Y_MSB);
+	}
+}
+
+static VOID
+RmiDecodeWObjectsF12(
+	IN PVOID ControllerData,
+	IN int Count,
+	IN DETECTED_OBJECTS* Data
+)
+{
+	PRMI4_F12_FINGER_W_DATA_REGISTER fingers = ControllerData;
+	int i;
+
+	for (i = 0; i < Count; i++)
+	{
+		RmiDecodeObjectF12(Data, i, fingers[i].ObjectTypeAndStatus,
+			fingers[i].X_LSB, fingers[i].X_MSB, fingers[i].Y_LSB, fingers[i].Y_MSB);
+	}
+}
+
+static VOID
+RmiDecode3DWObjectsF12(
+	IN PVOID ControllerData,
+	IN int Count,
+	IN DETECTED_OBJECTS* Data
+)
+{
+	PRMI4_F12_FINGER_3D_W_DATA_REGISTER fingers = ControllerData;
+	int i;
+
+	for (i = 0; i < Count; i++)
+	{
+		RmiDecodeObjectF12(Data, i, fingers[i].ObjectTypeAndStatus,
+			fingers[i].X_LSB, fingers[i].X_MSB, fingers[i].Y_LSB, fingers[i].Y_MSB);
+	}
+}
+
+static int
+RmiGetActiveObjectCountF12(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN int MaxObjects
+)
+/*++
+
+Routine Description:
+
+	Uses the object attention bits of Data15 to find how many object
+	records are worth reading: every object after the last one with
+	its bit set is not present.
+
+Return Value:
+
+	Number of leading object records to read, MaxObjects if the
+	controller does not report attention
+
+--*/
+{
+	NTSTATUS status;
+	BYTE attention[BITS_TO_LONGS(MAX_TOUCHES) * sizeof(ULONG)];
+	ULONG attentionSize;
+	UINT8 Data15Offset;
+	int i;
+
+	if (!ControllerContext->HasRegisterDescriptors)
+	{
+		return MaxObjects;
+	}
+
+	Data15Offset = RmiGetRegisterIndex(&ControllerContext->F12DataRegDesc, 15);
+	if (Data15Offset == ControllerContext->F12DataRegDesc.NumRegisters)
+	{
+		return MaxObjects;
+	}
+
+	attentionSize = min(ControllerContext->F12DataRegDesc.Registers[Data15Offset].RegisterSize,
+		sizeof(attention));
+
+	status = RmiReadDataRegister(
+		ControllerContext,
+		SpbContext,
+		15,
+		attention,
+		attentionSize
+	);
+
+	if (!NT_SUCCESS(status))
+	{
+		return MaxObjects;
+	}
+
+	for (i = MaxObjects; i > 0; i--)
+	{
+		if ((ULONG)(i - 1) / 8 < attentionSize &&
+			(attention[(i - 1) / 8] & (1 << ((i - 1) % 8))))
+		{
+			break;
+		}
+	}
+
+	return i;
+}
+
 NTSTATUS
 RmiGetObjectStatusFromControllerF12(
 	IN VOID* ControllerContext,
@@ -75,6 +260,8 @@ Routine Description:
 	This routine reads raw touch messages from hardware. If there is
 	no touch data available (if a non-touch interrupt fired), the
 	function will not return success and no touch data was transferred.
+	Only the object records up to the last active object are read,
+	the ones after it are reported as not present.
 
 Arguments:
 
@@ -91,17 +278,19 @@ Return Value:
 	NTSTATUS status;
 	RMI4_CONTROLLER_CONTEXT* controller;
 
-	int i, x, y;
-	PVOID controllerData = NULL;
+	int i, maxObjects, activeObjects;
+	ULONG objectSize;
 	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
 
-	if (controller->MaxFingers == 0)
+	maxObjects = min(controller->MaxFingers, MAX_TOUCHES);
+
+	if (maxObjects == 0)
 	{
 		status = STATUS_SUCCESS;
 		goto exit;
 	}
 
-	USHORT Data1Size = controller->MaxFingers * sizeof(RMI4_F12_FINGER_3D_W_DATA_REGISTER);
+	USHORT Data1Size = (USHORT)(maxObjects * sizeof(RMI4_F12_FINGER_3D_W_DATA_REGISTER));
 
 	if (controller->HasRegisterDescriptors)
 	{
@@ -114,15 +303,30 @@ Return Value:
 		Data1Size = (USHORT)controller->F12DataRegDesc.Registers[Data1Offset].RegisterSize;
 	}
 
-	controllerData = ExAllocatePoolWithTag(
-		NonPagedPoolNx,
-		Data1Size,
-		TOUCH_POOL_TAG_F12
-	);
+	objectSize = Data1Size / controller->MaxFingers;
 
-	if (controllerData == NULL)
+	if (objectSize > RMI4_F12_MAX_OBJECT_SIZE)
 	{
-		status = STATUS_INSUFFICIENT_RESOURCES;
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INTERRUPT,
+			"Unexpected - Data 1 object size is not as expected: %d",
+			objectSize);
+
+		status = STATUS_SUCCESS;
+		goto exit;
+	}
+
+	activeObjects = RmiGetActiveObjectCountF12(controller, SpbContext, maxObjects);
+
+	for (i = activeObjects; i < maxObjects; i++)
+	{
+		Data->States[i] = OBJECT_STATE_NOT_PRESENT;
+	}
+
+	if (activeObjects == 0)
+	{
+		status = STATUS_SUCCESS;
 		goto exit;
 	}
 
@@ -133,8 +337,8 @@ Return Value:
 		controller,
 		SpbContext,
 		1,
-		controllerData,
-		Data1Size
+		controller->F12ObjectData,
+		activeObjects * objectSize
 	);
 
 	if (!NT_SUCCESS(status))
@@ -145,109 +349,25 @@ Return Value:
 			"Error reading finger status data - 0x%08lX",
 			status);
 
-		goto free_buffer;
+		goto exit;
 	}
 
-	BYTE ObjectTypeAndStatus = 0;
-	BYTE X_MSB = 0;
-	BYTE X_LSB = 0;
-	BYTE Y_MSB = 0;
-	BYTE Y_LSB = 0;
-
-	for (i = 0; i < controller->MaxFingers; i++)
+	switch (objectSize)
 	{
-		switch (Data1Size / controller->MaxFingers)
-		{
-			case sizeof(RMI4_F12_FINGER_SIMPLE_DATA_REGISTER) :
-			{
-				PRMI4_F12_FINGER_SIMPLE_DATA_REGISTER controllerFingerData = (PRMI4_F12_FINGER_SIMPLE_DATA_REGISTER)controllerData;
-
-				ObjectTypeAndStatus = controllerFingerData[i].ObjectTypeAndStatus;
-				X_MSB = controllerFingerData[i].X_MSB;
-				X_LSB = controllerFingerData[i].X_LSB;
-				Y_MSB = controllerFingerData[i].Y_MSB;
-				Y_LSB = controllerFingerData[i].Y_LSB;
-				break;
-			}
-			case sizeof(RMI4_F12_FINGER_3D_DATA_REGISTER) :
-			{
-				PRMI4_F12_FINGER_3D_DATA_REGISTER controllerFingerData = (PRMI4_F12_FINGER_3D_DATA_REGISTER)controllerData;
-
-				ObjectTypeAndStatus = controllerFingerData[i].ObjectTypeAndStatus;
-				X_MSB = controllerFingerData[i].X_MSB;
-				X_LSB = controllerFingerData[i].X_LSB;
-				Y_MSB = controllerFingerData[i].Y_MSB;
-				Y_LSB = controllerFingerData[i].Y_LSB;
-				break;
-			}
-			case sizeof(RMI4_F12_FINGER_W_DATA_REGISTER) :
-			{
-				PRMI4_F12_FINGER_W_DATA_REGISTER controllerFingerData = (PRMI4_F12_FINGER_W_DATA_REGISTER)controllerData;
-
-				ObjectTypeAndStatus = controllerFingerData[i].ObjectTypeAndStatus;
-				X_MSB = controllerFingerData[i].X_MSB;
-				X_LSB = controllerFingerData[i].X_LSB;
-				Y_MSB = controllerFingerData[i].Y_MSB;
-				Y_LSB = controllerFingerData[i].Y_LSB;
-				break;
-			}
-			case sizeof(RMI4_F12_FINGER_3D_W_DATA_REGISTER) :
-			{
-				PRMI4_F12_FINGER_3D_W_DATA_REGISTER controllerFingerData = (PRMI4_F12_FINGER_3D_W_DATA_REGISTER)controllerData;
-
-				ObjectTypeAndStatus = controllerFingerData[i].ObjectTypeAndStatus;
-				X_MSB = controllerFingerData[i].X_MSB;
-				X_LSB = controllerFingerData[i].X_LSB;
-				Y_MSB = controllerFingerData[i].Y_MSB;
-				Y_LSB = controllerFingerData[i].Y_LSB;
-				break;
-			}
-		}
-
-		switch (ObjectTypeAndStatus)
-		{
-		case RMI4_F12_OBJECT_FINGER:
-			Data->States[i] = OBJECT_STATE_FINGER_PRESENT_WITH_ACCURATE_POS;
-			break;
-		case RMI4_F12_OBJECT_PALM:
-			Data->States[i] = OBJECT_STATE_NOT_PRESENT;
-			break;
-		case RMI4_F12_OBJECT_HOVERING_FINGER:
-			Data->States[i] = OBJECT_STATE_FINGER_PRESENT_WITH_INACCURATE_POS;
-			break;
-		case RMI4_F12_OBJECT_GLOVED_FINGER:
-			Data->States[i] = OBJECT_STATE_FINGER_PRESENT_WITH_ACCURATE_POS;
-			break;
-		case RMI4_F12_OBJECT_ACTIVE_STYLUS:
-			Data->States[i] = OBJECT_STATE_PEN_PRESENT_WITH_TIP;
-			break;
-		case RMI4_F12_OBJECT_STYLUS:
-			Data->States[i] = OBJECT_STATE_PEN_PRESENT_WITH_TIP;
-			break;
-		case RMI4_F12_OBJECT_ERASER:
-			Data->States[i] = OBJECT_STATE_PEN_PRESENT_WITH_ERASER;
-			break;
-		case RMI4_F12_OBJECT_NONE:
-			Data->States[i] = OBJECT_STATE_NOT_PRESENT;
-			break;
-		default:
-			Data->States[i] = OBJECT_STATE_NOT_PRESENT;
-			break;
-		}
-
-		x = (X_MSB << 8) | X_LSB;
-		y = (Y_MSB << 8) | Y_LSB;
-
-		Data->Positions[i].X = x;
-		Data->Positions[i].Y = y;
+	case sizeof(RMI4_F12_FINGER_SIMPLE_DATA_REGISTER):
+		RmiDecodeSimpleObjectsF12(controller->F12ObjectData, activeObjects, Data);
+		break;
+	case sizeof(RMI4_F12_FINGER_3D_DATA_REGISTER):
+		RmiDecode3DObjectsF12(controller->F12ObjectData, activeObjects, Data);
+		break;
+	case sizeof(RMI4_F12_FINGER_W_DATA_REGISTER):
+		RmiDecodeWObjectsF12(controller->F12ObjectData, activeObjects, Data);
+		break;
+	case sizeof(RMI4_F12_FINGER_3D_W_DATA_REGISTER):
+		RmiDecode3DWObjectsF12(controller->F12ObjectData, activeObjects, Data);
+		break;
 	}
 
-free_buffer:
-	ExFreePoolWithTag(
-		controllerData,
-		TOUCH_POOL_TAG_F12
-	);
-
 exit:
 	return status;
-}
\ No newline at end of file
+}
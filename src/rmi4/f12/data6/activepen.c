@@ -7,6 +7,7 @@
 #include <HidCommon.h>
 #include <spb.h>
 #include <rmi4\rmiinternal.h>
+#include <rmi4\f12\registers.h>
 #include <rmi4\f12\controlregisters.h>
 #include <rmi4\f12\data6\activepen.h>
 #include <activepen.tmh>
@@ -21,7 +22,6 @@ RmiGetPenStatusFromControllerF12(
 	NTSTATUS status;
 	RMI4_CONTROLLER_CONTEXT* controller;
 
-	int index;
 	PVOID controllerData = NULL;
 	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
 
@@ -44,40 +44,6 @@ RmiGetPenStatusFromControllerF12(
 		return STATUS_SUCCESS;
 	}
 
-	//
-	// Locate RMI data base address of 2D touch function
-	//
-	index = RmiGetFunctionIndex(
-		controller->Descriptors,
-		controller->FunctionCount,
-		RMI4_F12_2D_TOUCHPAD_SENSOR);
-
-	if (index == controller->FunctionCount)
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_INIT,
-			"Unexpected - RMI Function 12 missing");
-
-		status = STATUS_INVALID_DEVICE_STATE;
-		goto exit;
-	}
-
-	status = RmiChangePage(
-		ControllerContext,
-		SpbContext,
-		controller->FunctionOnPage[index]);
-
-	if (!NT_SUCCESS(status))
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_INIT,
-			"Could not change register page");
-
-		goto exit;
-	}
-
 	controllerData = ExAllocatePoolWithTag(
 		NonPagedPoolNx,
 		Data6Size,
@@ -91,11 +57,13 @@ RmiGetPenStatusFromControllerF12(
 	}
 
 	// 
-	// Packets we need is determined by context
+	// Packets we need is determined by context, the interrupt read
+	// plan may have fetched them already
 	//
-	status = SpbReadDataSynchronously(
+	status = RmiReadDataRegister(
+		controller,
 		SpbContext,
-		controller->Descriptors[index].DataBase + (BYTE)Data6Offset,
+		6,
 		controllerData,
 		Data6Size
 	);
@@ -594,6 +594,20 @@ RmiConfigureF12(
 		goto exit;
 	}
 
+	//
+	// Register descriptors are kept with the function table across
+	// resets, they are only read again after the table was rebuilt
+	//
+	if (ControllerContext->F12DescriptorsCached)
+	{
+		if (!ControllerContext->HasRegisterDescriptors)
+		{
+			goto exit;
+		}
+
+		goto discover;
+	}
+
 	Trace(
 		TRACE_LEVEL_INFORMATION,
 		TRACE_INIT,
@@ -629,6 +643,7 @@ RmiConfigureF12(
 		);
 
 		ControllerContext->MaxFingers = 10;
+		ControllerContext->F12DescriptorsCached = TRUE;
 
 		goto exit;
 	}
@@ -690,6 +705,9 @@ RmiConfigureF12(
 		goto exit;
 	}
 
+	ControllerContext->F12DescriptorsCached = TRUE;
+
+discover:
 	// Retrieve the total size we need to query to get all of the data with every interrupt
 	ControllerContext->PacketSize = RmiRegisterDescriptorCalcSize(
 		&ControllerContext->F12DataRegDesc
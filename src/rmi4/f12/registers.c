@@ -9,6 +9,7 @@
 #include <rmi4\rmiinternal.h>
 #include <rmi4\rmiregisters.h>
 #include <rmi4\f12\registers.h>
+#include <rmi4\rmireadplan.h>
 #include <registers.tmh>
 
 NTSTATUS
@@ -40,6 +41,37 @@ RmiReadDataRegister(
 	IN ULONG BufferLength
 )
 {
+	PVOID planned = NULL;
+	ULONG plannedLength = 0;
+
+	//
+	// Registers the interrupt read plan already fetched are not read
+	// a second time
+	//
+	switch (DataRegister)
+	{
+	case 1:
+		planned = RmiGetReadPlanData(ControllerContext, RMI4_READ_F12_DATA1, &plannedLength);
+		break;
+	case 4:
+		planned = RmiGetReadPlanData(ControllerContext, RMI4_READ_F12_DATA4, &plannedLength);
+		break;
+	case 6:
+		planned = RmiGetReadPlanData(ControllerContext, RMI4_READ_F12_DATA6, &plannedLength);
+		break;
+	case 15:
+		planned = RmiGetReadPlanData(ControllerContext, RMI4_READ_F12_DATA15, &plannedLength);
+		break;
+	}
+
+	if (planned != NULL)
+	{
+		RtlZeroMemory(Buffer, BufferLength);
+		RtlCopyMemory(Buffer, planned, min(plannedLength, BufferLength));
+
+		return STATUS_SUCCESS;
+	}
+
 	return RmiReadFunctionDataRegister(
 		ControllerContext,
 		SpbContext,
@@ -24,8 +24,11 @@
 #include <rmi4\f12\function12.h>
 #include <rmi4\f1a\function1a.h>
 #include <rmi4\rmiinternal.h>
+#include <rmi4\rmireadplan.h>
 #include <rmiinternal.tmh>
 
+C_ASSERT(RMI4_IDENTITY_QUERY_SIZE == FIELD_OFFSET(RMI4_F01_QUERY_REGISTERS, ProductID10));
+
 NTSTATUS
 RmiServiceInterrupts(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
@@ -150,6 +153,8 @@ RmiServiceInterrupts(
 
 exit:
 
+	controller->ReadPlan.Fresh = FALSE;
+
 	WdfWaitLockRelease(controller->ControllerLock);
 
 	return status;
@@ -364,10 +369,202 @@ RmiConfigureFunctions(
 		}
 	}
 
+	//
+	// Functions and F12 registers are known now, plan the reads of
+	// the interrupt path
+	//
+	RmiBuildReadPlan(ControllerContext);
+
+exit:
+	return status;
+}
+
+static NTSTATUS
+RmiReadIdentity(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	OUT RMI4_IDENTITY* Identity
+)
+/*++
+
+  Routine Description:
+
+	Reads the firmware identity from the F01 query registers and the
+	customer config ID from the F34 control registers. Both are read
+	in one sequence when they share a page, which they do on every
+	controller seen so far.
+
+  Arguments:
+
+	ControllerContext - A pointer to the current touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+	Identity - Receives the identity
+
+  Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	SPB_REGISTER_READ reads[2];
+	ULONG count = 0;
+	int f01, f34;
+	NTSTATUS status;
+
+	RtlZeroMemory(Identity, sizeof(RMI4_IDENTITY));
+
+	f01 = RmiGetFunctionIndex(
+		ControllerContext->Descriptors,
+		ControllerContext->FunctionCount,
+		RMI4_F01_RMI_DEVICE_CONTROL);
+
+	f34 = RmiGetFunctionIndex(
+		ControllerContext->Descriptors,
+		ControllerContext->FunctionCount,
+		RMI4_F34_FLASH_MEMORY_MANAGEMENT);
+
+	if (f01 == ControllerContext->FunctionCount)
+	{
+		status = STATUS_INVALID_DEVICE_STATE;
+		goto exit;
+	}
+
+	status = RmiChangePage(
+		ControllerContext,
+		SpbContext,
+		ControllerContext->FunctionOnPage[f01]);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	reads[count].Address = ControllerContext->Descriptors[f01].QueryBase;
+	reads[count].Data = Identity->Query;
+	reads[count].Length = sizeof(Identity->Query);
+	count++;
+
+	if (f34 != ControllerContext->FunctionCount &&
+		ControllerContext->FunctionOnPage[f34] == ControllerContext->FunctionOnPage[f01])
+	{
+		reads[count].Address = ControllerContext->Descriptors[f34].ControlBase;
+		reads[count].Data = Identity->ConfigId;
+		reads[count].Length = sizeof(Identity->ConfigId);
+		count++;
+	}
+
+	status = SpbReadRegisters(SpbContext, reads, count);
+
+	if (!NT_SUCCESS(status) ||
+		f34 == ControllerContext->FunctionCount ||
+		count == 2)
+	{
+		goto exit;
+	}
+
+	status = RmiChangePage(
+		ControllerContext,
+		SpbContext,
+		ControllerContext->FunctionOnPage[f34]);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = SpbReadDataSynchronously(
+		SpbContext,
+		ControllerContext->Descriptors[f34].ControlBase,
+		Identity->ConfigId,
+		sizeof(Identity->ConfigId));
+
 exit:
 	return status;
 }
 
+VOID
+RmiInvalidateFunctionsTable(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+  Routine Description:
+
+	Drops the cached function table and F12 register descriptors, the
+	next configuration reads them from the controller again.
+
+  Arguments:
+
+	ControllerContext - A pointer to the current touch controller context
+
+  Return Value:
+
+	None
+
+--*/
+{
+	ControllerContext->FunctionsCached = FALSE;
+	ControllerContext->F12DescriptorsCached = FALSE;
+
+	RmiFreeRegisterDescriptor(&ControllerContext->F12QueryRegDesc);
+	RmiFreeRegisterDescriptor(&ControllerContext->F12ControlRegDesc);
+	RmiFreeRegisterDescriptor(&ControllerContext->F12DataRegDesc);
+}
+
+static BOOLEAN
+RmiValidateFunctionsTable(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+  Routine Description:
+
+	Checks whether the cached function table still describes the
+	controller after a reset or resume: the identity is read where the
+	cached table places it and compared with the one the table was
+	built for. A different firmware or configuration moves or changes
+	those registers, either way the comparison fails.
+
+  Arguments:
+
+	ControllerContext - A pointer to the current touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+  Return Value:
+
+	TRUE if the cached table can be used
+
+--*/
+{
+	RMI4_IDENTITY identity;
+	NTSTATUS status;
+
+	status = RmiReadIdentity(ControllerContext, SpbContext, &identity);
+
+	if (NT_SUCCESS(status) &&
+		RtlEqualMemory(&identity, &ControllerContext->Identity, sizeof(RMI4_IDENTITY)))
+	{
+		ControllerContext->CacheHits++;
+		return TRUE;
+	}
+
+	ControllerContext->CacheMisses++;
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_INIT,
+		"Controller identity changed, rebuilding function table (%d hits, %d misses) - 0x%08lX",
+		ControllerContext->CacheHits,
+		ControllerContext->CacheMisses,
+		status);
+
+	return FALSE;
+}
+
 NTSTATUS
 RmiBuildFunctionsTable(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
@@ -382,6 +579,9 @@ RmiBuildFunctionsTable(
 	with the chip, a driver must build a table of available functions,
 	as is done in this routine.
 
+	The table is kept across resets and resumes, it is only scanned
+	again if the controller reports a different firmware or config ID.
+
   Arguments:
 
 	ControllerContext - A pointer to the current touch controller context
@@ -400,6 +600,36 @@ RmiBuildFunctionsTable(
 	int page;
 	NTSTATUS status;
 
+	//
+	// The page select register is back to its default after a reset,
+	// whatever page was selected last
+	//
+	ControllerContext->CurrentPage = -1;
+
+	if (ControllerContext->FunctionsCached &&
+		RmiValidateFunctionsTable(ControllerContext, SpbContext))
+	{
+		status = STATUS_SUCCESS;
+		goto exit;
+	}
+
+	RmiInvalidateFunctionsTable(ControllerContext);
+
+	status = RmiChangePage(
+		ControllerContext,
+		SpbContext,
+		0);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"RmiBuildFunctionsTable: Error attempting to change page - 0x%08lX",
+			status);
+		goto exit;
+	}
+
 	// Make sure we don't have any previous descriptor data available.
 	RtlZeroMemory(
 		ControllerContext->Descriptors,
@@ -582,6 +812,17 @@ RmiBuildFunctionsTable(
 		"Discovered %d RMI functions total",
 		function);
 
+	//
+	// Remember which firmware and configuration the table belongs to
+	//
+	if (NT_SUCCESS(RmiReadIdentity(
+		ControllerContext,
+		SpbContext,
+		&ControllerContext->Identity)))
+	{
+		ControllerContext->FunctionsCached = TRUE;
+	}
+
 exit:
 
 	return status;
@@ -606,6 +847,12 @@ RmiReadRegisterDescriptor(
 	int i;
 	int b;
 
+	//
+	// Drop what an earlier read left, the presence and subpacket maps
+	// are accumulated bit by bit
+	//
+	RmiFreeRegisterDescriptor(Rdesc);
+
 	Status = SpbReadDataSynchronously(
 		Context,
 		Address,
@@ -675,6 +922,10 @@ RmiReadRegisterDescriptor(
 		goto exit;
 	}
 
+	RtlZeroMemory(
+		Rdesc->Registers,
+		Rdesc->NumRegisters * sizeof(RMI_REGISTER_DESC_ITEM));
+
 	/*
 	* Allocate a temporary buffer to hold the register structure.
 	* I'm not using devm_kzalloc here since it will not be retained
@@ -774,6 +1025,22 @@ i2c_read_fail:
 	goto exit;
 }
 
+VOID
+RmiFreeRegisterDescriptor(
+	IN PRMI_REGISTER_DESCRIPTOR Rdesc
+)
+{
+	if (Rdesc->Registers != NULL)
+	{
+		ExFreePoolWithTag(
+			Rdesc->Registers,
+			TOUCH_POOL_TAG_F12
+		);
+	}
+
+	RtlZeroMemory(Rdesc, sizeof(RMI_REGISTER_DESCRIPTOR));
+}
+
 size_t
 RmiRegisterDescriptorCalcSize(
 	IN PRMI_REGISTER_DESCRIPTOR Rdesc
@@ -791,7 +1058,7 @@ RmiRegisterDescriptorCalcSize(
 	return size;
 }
 
-const PRMI_REGISTER_DESC_ITEM RmiGetRegisterDescItem(
+PRMI_REGISTER_DESC_ITEM RmiGetRegisterDescItem(
 	PRMI_REGISTER_DESCRIPTOR Rdesc,
 	USHORT reg
 )
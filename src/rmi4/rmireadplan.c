@@ -0,0 +1,416 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		rmireadplan.c
+
+	Abstract:
+
+		Plans the register reads every interrupt needs, the F01 status
+		and the F12 object, gesture and pen data, so that registers
+		adjacent on a page are fetched with one block read. Packet
+		registers occupy one address each but stream all of their
+		bytes, a block read starting at one continues into the next.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <spb.h>
+#include <rmi4\f01\function01.h>
+#include <rmi4\rmiinternal.h>
+#include <rmi4\rmireadplan.h>
+#include <rmireadplan.tmh>
+
+//
+// Data area of one function: the addresses it spans on its page and
+// the bytes a block read over all of them returns
+//
+typedef struct _RMI4_READ_REGION
+{
+	BYTE Page;
+	BYTE Address;
+	BYTE AddressSpan;
+	USHORT Length;
+} RMI4_READ_REGION;
+
+typedef struct _RMI4_READ_CANDIDATE
+{
+	RMI4_READ_PLAN_ITEM_ID Item;
+	RMI4_READ_REGION* Region;
+	BYTE AddressIndex;
+	USHORT RegionOffset;
+	USHORT Length;
+} RMI4_READ_CANDIDATE;
+
+static BOOLEAN
+RmiReadCandidateBefore(
+	IN RMI4_READ_CANDIDATE* A,
+	IN RMI4_READ_CANDIDATE* B
+)
+{
+	if (A->Region->Page != B->Region->Page)
+	{
+		return A->Region->Page < B->Region->Page;
+	}
+
+	if (A->Region != B->Region)
+	{
+		return A->Region->Address < B->Region->Address;
+	}
+
+	return A->RegionOffset < B->RegionOffset;
+}
+
+static BOOLEAN
+RmiReadCandidateGap(
+	IN RMI4_READ_CANDIDATE* A,
+	IN RMI4_READ_CANDIDATE* B,
+	OUT ULONG* Gap
+)
+/*++
+
+  Routine Description:
+
+	Computes how many bytes a block read starting at A streams before
+	it reaches B.
+
+  Return Value:
+
+	FALSE if a block read from A cannot reach B
+
+--*/
+{
+	ULONG end = A->RegionOffset + A->Length;
+
+	if (A->Region == B->Region)
+	{
+		if (B->RegionOffset < end)
+		{
+			return FALSE;
+		}
+
+		*Gap = B->RegionOffset - end;
+		return TRUE;
+	}
+
+	if (A->Region->Page != B->Region->Page ||
+		A->Region->Address + A->Region->AddressSpan != B->Region->Address ||
+		A->Region->Length < end)
+	{
+		return FALSE;
+	}
+
+	*Gap = (A->Region->Length - end) + B->RegionOffset;
+	return TRUE;
+}
+
+static VOID
+RmiAddReadCandidateF12(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN RMI4_READ_REGION* Region,
+	IN RMI4_READ_PLAN_ITEM_ID Item,
+	IN USHORT DataRegister,
+	IN OUT RMI4_READ_CANDIDATE* Candidates,
+	IN OUT ULONG* Count
+)
+{
+	PRMI_REGISTER_DESCRIPTOR desc = &ControllerContext->F12DataRegDesc;
+	RMI4_READ_CANDIDATE* candidate;
+	UINT8 index;
+	ULONG offset = 0;
+	UINT8 i;
+
+	index = RmiGetRegisterIndex(desc, DataRegister);
+	if (index == desc->NumRegisters)
+	{
+		return;
+	}
+
+	for (i = 0; i < index; i++)
+	{
+		offset += desc->Registers[i].RegisterSize;
+	}
+
+	if (offset + desc->Registers[index].RegisterSize > Region->Length)
+	{
+		return;
+	}
+
+	candidate = &Candidates[(*Count)++];
+	candidate->Item = Item;
+	candidate->Region = Region;
+	candidate->AddressIndex = index;
+	candidate->RegionOffset = (USHORT)offset;
+	candidate->Length = (USHORT)desc->Registers[index].RegisterSize;
+}
+
+VOID
+RmiBuildReadPlan(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+  Routine Description:
+
+	Builds the read plan of the interrupt path. Registers are ordered
+	by page and address and merged into one span as long as the bytes
+	read in between stay below RMI4_READ_PLAN_MAX_GAP. Registers that
+	do not fit the plan buffer are left out and read on their own.
+
+  Arguments:
+
+	ControllerContext - A pointer to the current touch controller context
+
+  Return Value:
+
+	None. An empty plan leaves every register to its own read.
+
+--*/
+{
+	RMI4_READ_PLAN* plan = &ControllerContext->ReadPlan;
+	RMI4_READ_REGION regions[2];
+	RMI4_READ_CANDIDATE candidates[RMI4_READ_PLAN_MAX_ITEMS];
+	RMI4_READ_CANDIDATE sorted;
+	RMI4_READ_CANDIDATE* last = NULL;
+	RMI4_READ_PLAN_ITEM* span = NULL;
+	RMI4_READ_PLAN_ITEM* item;
+	ULONG count = 0, used = 0, gap, irqCount = 0;
+	int index, i, j;
+
+	RtlZeroMemory(plan, sizeof(RMI4_READ_PLAN));
+	RtlZeroMemory(regions, sizeof(regions));
+
+	index = RmiGetFunctionIndex(
+		ControllerContext->Descriptors,
+		ControllerContext->FunctionCount,
+		RMI4_F01_RMI_DEVICE_CONTROL);
+
+	if (index == ControllerContext->FunctionCount)
+	{
+		return;
+	}
+
+	//
+	// Device status followed by one interrupt status byte per eight
+	// interrupt sources of all functions
+	//
+	for (i = 0; i < ControllerContext->FunctionCount; i++)
+	{
+		irqCount += ControllerContext->Descriptors[i].VersionIrq.IrqCount;
+	}
+
+	regions[0].Page = (BYTE)ControllerContext->FunctionOnPage[index];
+	regions[0].Address = ControllerContext->Descriptors[index].DataBase;
+	regions[0].AddressSpan = (BYTE)(1 + (irqCount + 7) / 8);
+	regions[0].Length = regions[0].AddressSpan;
+
+	candidates[count].Item = RMI4_READ_F01_STATUS;
+	candidates[count].Region = &regions[0];
+	candidates[count].AddressIndex = 0;
+	candidates[count].RegionOffset = 0;
+	candidates[count].Length = sizeof(RMI4_F01_DATA_REGISTERS);
+	count++;
+
+	index = RmiGetFunctionIndex(
+		ControllerContext->Descriptors,
+		ControllerContext->FunctionCount,
+		RMI4_F12_2D_TOUCHPAD_SENSOR);
+
+	if (index != ControllerContext->FunctionCount &&
+		ControllerContext->HasRegisterDescriptors)
+	{
+		regions[1].Page = (BYTE)ControllerContext->FunctionOnPage[index];
+		regions[1].Address = ControllerContext->Descriptors[index].DataBase;
+		regions[1].AddressSpan = ControllerContext->F12DataRegDesc.NumRegisters;
+		regions[1].Length = (USHORT)ControllerContext->PacketSize;
+
+		//
+		// With object attention the Data1 read depends on it and is
+		// left out, only the objects up to the last active one are read
+		//
+		if (RmiGetRegisterIndex(&ControllerContext->F12DataRegDesc, 15) ==
+			ControllerContext->F12DataRegDesc.NumRegisters)
+		{
+			RmiAddReadCandidateF12(ControllerContext, &regions[1], RMI4_READ_F12_DATA1, 1, candidates, &count);
+		}
+
+		RmiAddReadCandidateF12(ControllerContext, &regions[1], RMI4_READ_F12_DATA4, 4, candidates, &count);
+		RmiAddReadCandidateF12(ControllerContext, &regions[1], RMI4_READ_F12_DATA6, 6, candidates, &count);
+		RmiAddReadCandidateF12(ControllerContext, &regions[1], RMI4_READ_F12_DATA15, 15, candidates, &count);
+	}
+
+	for (i = 1; i < (int)count; i++)
+	{
+		sorted = candidates[i];
+
+		for (j = i - 1; j >= 0 && RmiReadCandidateBefore(&sorted, &candidates[j]); j--)
+		{
+			candidates[j + 1] = candidates[j];
+		}
+
+		candidates[j + 1] = sorted;
+	}
+
+	for (i = 0; i < (int)count; i++)
+	{
+		item = &plan->Items[candidates[i].Item];
+
+		if (span != NULL &&
+			RmiReadCandidateGap(last, &candidates[i], &gap) &&
+			gap <= RMI4_READ_PLAN_MAX_GAP &&
+			used + gap + candidates[i].Length <= RMI4_READ_PLAN_MAX_LENGTH)
+		{
+			used += gap;
+			span->Length += (USHORT)(gap + candidates[i].Length);
+		}
+		else if (used + candidates[i].Length <= RMI4_READ_PLAN_MAX_LENGTH)
+		{
+			span = &plan->Spans[plan->SpanCount++];
+			span->Page = candidates[i].Region->Page;
+			span->Address = candidates[i].Region->Address + candidates[i].AddressIndex;
+			span->Length = 0;
+			span->Offset = (USHORT)used;
+		}
+		else
+		{
+			continue;
+		}
+
+		item->Page = candidates[i].Region->Page;
+		item->Address = candidates[i].Region->Address + candidates[i].AddressIndex;
+		item->Length = candidates[i].Length;
+		item->Offset = (USHORT)used;
+
+		if (span->Length == 0)
+		{
+			span->Length = candidates[i].Length;
+		}
+
+		used += candidates[i].Length;
+		last = &candidates[i];
+	}
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_INIT,
+		"Interrupt read plan: %d registers in %d transfers, %d bytes",
+		count,
+		plan->SpanCount,
+		used);
+}
+
+NTSTATUS
+RmiExecuteReadPlan(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+  Routine Description:
+
+	Reads every span of the plan, one sequence per register page.
+	The data stays valid for the interrupt being serviced.
+
+  Arguments:
+
+	ControllerContext - A pointer to the current touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+  Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_READ_PLAN* plan = &ControllerContext->ReadPlan;
+	SPB_REGISTER_READ reads[RMI4_READ_PLAN_MAX_ITEMS];
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG first, count;
+
+	plan->Fresh = FALSE;
+
+	for (first = 0; first < plan->SpanCount; first += count)
+	{
+		status = RmiChangePage(
+			ControllerContext,
+			SpbContext,
+			plan->Spans[first].Page);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_INTERRUPT,
+				"Could not change register page");
+
+			goto exit;
+		}
+
+		for (count = 0;
+			first + count < plan->SpanCount &&
+			plan->Spans[first + count].Page == plan->Spans[first].Page;
+			count++)
+		{
+			reads[count].Address = plan->Spans[first + count].Address;
+			reads[count].Data = &plan->Buffer[plan->Spans[first + count].Offset];
+			reads[count].Length = plan->Spans[first + count].Length;
+		}
+
+		status = SpbReadRegisters(SpbContext, reads, count);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_INTERRUPT,
+				"Error reading interrupt registers - 0x%08lX",
+				status);
+
+			goto exit;
+		}
+	}
+
+	plan->Fresh = TRUE;
+
+exit:
+	return status;
+}
+
+PVOID
+RmiGetReadPlanData(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN RMI4_READ_PLAN_ITEM_ID Item,
+	OUT ULONG* Length
+)
+/*++
+
+  Routine Description:
+
+	Returns the data of a planned register read for the interrupt
+	being serviced.
+
+  Return Value:
+
+	NULL if the register is not in the plan or no planned read was
+	made for this interrupt, the caller reads the register itself
+
+--*/
+{
+	RMI4_READ_PLAN* plan = &ControllerContext->ReadPlan;
+
+	if (!plan->Fresh || plan->Items[Item].Length == 0)
+	{
+		return NULL;
+	}
+
+	*Length = plan->Items[Item].Length;
+	return &plan->Buffer[plan->Items[Item].Offset];
+}
@@ -11,7 +11,9 @@
 
         Implements internal interfaces exposing functionality needed for 
         controller self-tests, which can be used to run HW testing 
-        on a device in the manufacturing line, etc.
+        on a device in the manufacturing line, etc. Every test interface
+        is described by a table of IOCTL handlers and served by the same
+        dispatch engine.
 
     Environment:
 
@@ -23,246 +25,1208 @@
 
 #include <internal.h>
 #include <controller.h>
-#include <rmi4\rmiinternal.h>
+#include <tcm\touch_tcm.h>
 #include <spb.h>
 #include <initguid.h>
 #include <devguid.h>
 #include <selftest\selftest.h>
+#include <selftest\enoselftest.h>
 #include <selftest.tmh>
 
-VOID
-TchSelfTestOnDeviceControl(
-    IN WDFQUEUE Queue,
+//
+// Page select register of RMI4 controllers. The page is written
+// directly, the RMI4 page cache belongs to an RMI4 TouchContext.
+//
+#define RMI4_PAGE_SELECT_REGISTER 0xFF
+
+#define TCH_SELFTEST_MAX_IOCTLS 16
+
+//
+// A self-test IOCTL: the buffer sizes the engine checks before the
+// handler runs, and the handler itself. Input and output point to the
+// same memory for METHOD_BUFFERED codes, so handlers copy whatever
+// input they still need before writing results.
+//
+typedef NTSTATUS
+TCH_SELFTEST_HANDLER(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    );
+
+typedef struct _TCH_SELFTEST_IOCTL
+{
+    ULONG IoControlCode;
+    size_t MinInputLength;
+    size_t MaxInputLength;      // 0 for no upper bound
+    size_t MinOutputLength;     // 0 if the handler maps the output itself
+    TCH_SELFTEST_HANDLER *Handler;
+} TCH_SELFTEST_IOCTL;
+
+//
+// A self-test device interface and the IOCTLs it accepts
+//
+typedef struct _TCH_SELFTEST_INTERFACE
+{
+    const GUID *InterfaceGuid;
+    PCUNICODE_STRING DeviceId;
+    PCUNICODE_STRING HardwareId;
+    PCUNICODE_STRING Security;  // NULL for the default security
+    const TCH_SELFTEST_IOCTL *Ioctls;
+    ULONG IoctlCount;
+} TCH_SELFTEST_INTERFACE;
+
+typedef struct _TCH_SELFTEST_IOCTL_STATS
+{
+    volatile LONG Calls;
+    volatile LONG Failures;
+    volatile LONG64 TotalTicks;
+    volatile LONG64 MaxTicks;
+} TCH_SELFTEST_IOCTL_STATS;
+
+//
+// Context of a test PDO; Stats is indexed like Interface->Ioctls
+//
+typedef struct _TCH_SELFTEST_DEVICE_CONTEXT
+{
+    const TCH_SELFTEST_INTERFACE *Interface;
+    WDFQUEUE Queue;
+    TCH_SELFTEST_IOCTL_STATS Stats[TCH_SELFTEST_MAX_IOCTLS];
+} TCH_SELFTEST_DEVICE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(TCH_SELFTEST_DEVICE_CONTEXT, GetSelfTestDeviceContext);
+
+//
+// Both test interfaces share the I2C header layout
+//
+C_ASSERT(sizeof(TOUCH_TEST_I2C_HEADER) == sizeof(TOUCH_ENOTEST_I2C_HEADER));
+C_ASSERT(IOCTL_TOUCH_SELFTEST_READ == IOCTL_TOUCH_ENOSELFTEST_READ);
+C_ASSERT(IOCTL_TOUCH_SELFTEST_WRITE == IOCTL_TOUCH_ENOSELFTEST_WRITE);
+C_ASSERT(IOCTL_TOUCH_SELFTEST_MODE == IOCTL_TOUCH_ENOSELFTEST_MODE);
+C_ASSERT(IOCTL_TOUCH_SELFTEST_CHANGE_PAGE == IOCTL_TOUCH_ENOSELFTEST_CHANGE_PAGE);
+C_ASSERT(IOCTL_TOUCH_SELFTEST_STATS == IOCTL_TOUCH_ENOSELFTEST_STATS);
+
+static TCH_SELFTEST_HANDLER TchSelfTestRead;
+static TCH_SELFTEST_HANDLER TchSelfTestWrite;
+static TCH_SELFTEST_HANDLER TchSelfTestMode;
+static TCH_SELFTEST_HANDLER TchSelfTestChangePage;
+static TCH_SELFTEST_HANDLER TchSelfTestDynamicConfigSchema;
+static TCH_SELFTEST_HANDLER TchSelfTestImageStream;
+static TCH_SELFTEST_HANDLER TchSelfTestImageStreamStop;
+static TCH_SELFTEST_HANDLER TchSelfTestProductionTest;
+static TCH_SELFTEST_HANDLER TchSelfTestBatch;
+static TCH_SELFTEST_HANDLER TchSelfTestStats;
+static TCH_SELFTEST_HANDLER TchSelfTestBusCapture;
+static TCH_SELFTEST_HANDLER TchSelfTestFaultInjection;
+
+static const TCH_SELFTEST_IOCTL TchSelfTestIoctls[] =
+{
+    {
+        IOCTL_TOUCH_SELFTEST_READ,
+        sizeof(TOUCH_TEST_I2C_HEADER),
+        sizeof(TOUCH_TEST_I2C_HEADER),
+        1,
+        TchSelfTestRead
+    },
+    {
+        IOCTL_TOUCH_SELFTEST_WRITE,
+        sizeof(TOUCH_TEST_I2C_HEADER),
+        0,
+        0,
+        TchSelfTestWrite
+    },
+    {
+        IOCTL_TOUCH_SELFTEST_MODE,
+        sizeof(BOOLEAN),
+        sizeof(BOOLEAN),
+        0,
+        TchSelfTestMode
+    },
+    {
+        IOCTL_TOUCH_SELFTEST_CHANGE_PAGE,
+        sizeof(UCHAR),
+        sizeof(UCHAR),
+        0,
+        TchSelfTestChangePage
+    },
+    {
+        IOCTL_TOUCH_SELFTEST_DYNAMIC_CONFIG_SCHEMA,
+        0,
+        0,
+        sizeof(TOUCH_TEST_DYNAMIC_CONFIG_SCHEMA),
+        TchSelfTestDynamicConfigSchema
+    },
+    {
+        IOCTL_TOUCH_SELFTEST_IMAGE_STREAM,
+        sizeof(TOUCH_TEST_IMAGE_STREAM_CONFIG),
+        sizeof(TOUCH_TEST_IMAGE_STREAM_CONFIG),
+        0,
+        TchSelfTestImageStream
+    },
+    {
+        IOCTL_TOUCH_SELFTEST_IMAGE_STREAM_STOP,
+        0,
+        0,
+        0,
+        TchSelfTestImageStreamStop
+    },
+    {
+        IOCTL_TOUCH_SELFTEST_PRODUCTION_TEST,
+        sizeof(TOUCH_TEST_PRODUCTION_TEST),
+        sizeof(TOUCH_TEST_PRODUCTION_TEST),
+        sizeof(TOUCH_TEST_PRODUCTION_RESULT),
+        TchSelfTestProductionTest
+    },
+    {
+        IOCTL_TOUCH_SELFTEST_BATCH,
+        sizeof(TOUCH_TEST_BATCH_HEADER),
+        0,
+        sizeof(TOUCH_TEST_BATCH_RESULT),
+        TchSelfTestBatch
+    },
+    {
+        IOCTL_TOUCH_SELFTEST_STATS,
+        0,
+        0,
+        sizeof(TOUCH_TEST_STATS),
+        TchSelfTestStats
+    },
+    {
+        IOCTL_TOUCH_SELFTEST_BUS_CAPTURE,
+        0,
+        0,
+        sizeof(TOUCH_TEST_BUS_CAPTURE),
+        TchSelfTestBusCapture
+    },
+    {
+        IOCTL_TOUCH_SELFTEST_FAULT_INJECTION,
+        0,
+        sizeof(TOUCH_TEST_FAULT_INJECTION),
+        sizeof(TOUCH_TEST_FAULT_STATS),
+        TchSelfTestFaultInjection
+    },
+};
+
+static const TCH_SELFTEST_IOCTL TchEnoSelfTestIoctls[] =
+{
+    {
+        IOCTL_TOUCH_ENOSELFTEST_READ,
+        sizeof(TOUCH_ENOTEST_I2C_HEADER),
+        sizeof(TOUCH_ENOTEST_I2C_HEADER),
+        1,
+        TchSelfTestRead
+    },
+    {
+        IOCTL_TOUCH_ENOSELFTEST_WRITE,
+        sizeof(TOUCH_ENOTEST_I2C_HEADER),
+        0,
+        0,
+        TchSelfTestWrite
+    },
+    {
+        IOCTL_TOUCH_ENOSELFTEST_MODE,
+        sizeof(BOOLEAN),
+        sizeof(BOOLEAN),
+        0,
+        TchSelfTestMode
+    },
+    {
+        IOCTL_TOUCH_ENOSELFTEST_CHANGE_PAGE,
+        sizeof(UCHAR),
+        sizeof(UCHAR),
+        0,
+        TchSelfTestChangePage
+    },
+    {
+        IOCTL_TOUCH_ENOSELFTEST_STATS,
+        0,
+        0,
+        sizeof(TOUCH_TEST_STATS),
+        TchSelfTestStats
+    },
+};
+
+C_ASSERT(RTL_NUMBER_OF(TchSelfTestIoctls) <= TCH_SELFTEST_MAX_IOCTLS);
+C_ASSERT(RTL_NUMBER_OF(TchEnoSelfTestIoctls) <= TCH_SELFTEST_MAX_IOCTLS);
+
+DECLARE_CONST_UNICODE_STRING(TchSelfTestDeviceId, L"{3a0ac59a-4d8a-4875-b7ea-304771ff9b9a}\\NokiaTouch\0");
+DECLARE_CONST_UNICODE_STRING(TchSelfTestHardwareId, L"NOKIA_TOUCH");
+DECLARE_CONST_UNICODE_STRING(TchEnoSelfTestDeviceId, L"{1ED875DA-D851-42BE-9DFD-527D97178147}\\Touch Test\0");
+DECLARE_CONST_UNICODE_STRING(TchEnoSelfTestHardwareId, L"NOKIA_ENOTOUCHTEST");
+
+//
+// Either interface reaches the bus, only the system and administrators
+// may open them
+//
+DECLARE_CONST_UNICODE_STRING(TchSelfTestSecurity, L"D:P(A;;GA;;;SY)(A;;GA;;;BA)");
+
+static const TCH_SELFTEST_INTERFACE TchSelfTestInterfaces[] =
+{
+    {
+        &GUID_TOUCH_SELFTEST_INTERFACE,
+        &TchSelfTestDeviceId,
+        &TchSelfTestHardwareId,
+        &TchSelfTestSecurity,
+        TchSelfTestIoctls,
+        RTL_NUMBER_OF(TchSelfTestIoctls)
+    },
+    {
+        &GUID_TOUCH_ENOSELFTEST_INTERFACE,
+        &TchEnoSelfTestDeviceId,
+        &TchEnoSelfTestHardwareId,
+        &TchSelfTestSecurity,
+        TchEnoSelfTestIoctls,
+        RTL_NUMBER_OF(TchEnoSelfTestIoctls)
+    },
+};
+
+static NTSTATUS
+TchSelfTestRead(
+    IN PDEVICE_EXTENSION DevContext,
     IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
     IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    )
+{
+    TOUCH_TEST_I2C_HEADER headerTemp;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    //
+    // Create a copy of the header since in and out buffers point to the
+    // same memory and so SpbReadDataSync will overwrite it
+    //
+    headerTemp = *(TOUCH_TEST_I2C_HEADER*)InputBuffer;
+
+    if ((headerTemp.AddressLength != sizeof(headerTemp.Address)) ||
+        (headerTemp.RequestedTransferLength < 1) ||
+        (headerTemp.RequestedTransferLength > OutputBufferLength))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // Perform read
+    //
+    status = SpbReadDataSynchronously(
+        &DevContext->I2CContext,
+        headerTemp.Address,
+        OutputBuffer,
+        headerTemp.RequestedTransferLength);
+
+    if (NT_SUCCESS(status))
+    {
+        *BytesReturned = headerTemp.RequestedTransferLength;
+    }
+
+    return status;
+}
+
+static NTSTATUS
+TchSelfTestWrite(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
     IN size_t InputBufferLength,
-    IN ULONG IoControlCode
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    )
+{
+    TOUCH_TEST_I2C_HEADER* headerIn = InputBuffer;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(OutputBuffer);
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+
+    if ((headerIn->AddressLength != sizeof(headerIn->Address)) ||
+        (InputBufferLength != (sizeof(TOUCH_TEST_I2C_HEADER) + headerIn->RequestedTransferLength)))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // Perform write
+    //
+    status = SpbWriteDataSynchronously(
+        &DevContext->I2CContext,
+        headerIn->Address,
+        (PVOID) (headerIn+1),
+        headerIn->RequestedTransferLength);
+
+    if (NT_SUCCESS(status))
+    {
+        *BytesReturned = headerIn->RequestedTransferLength;
+    }
+
+    return status;
+}
+
+static NTSTATUS
+TchSelfTestMode(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    )
+{
+    BOOLEAN *requestedDiagnosticMode = InputBuffer;
+
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+    UNREFERENCED_PARAMETER(OutputBuffer);
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+
+    if (*requestedDiagnosticMode != DevContext->DiagnosticMode)
+    {
+        DevContext->DiagnosticMode = *requestedDiagnosticMode;
+    }
+
+    *BytesReturned = sizeof(*requestedDiagnosticMode);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+TchSelfTestChangePage(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    )
+{
+    UCHAR *requestedPage = InputBuffer;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+    UNREFERENCED_PARAMETER(OutputBuffer);
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+
+    status = SpbWriteDataSynchronously(
+        &DevContext->I2CContext,
+        RMI4_PAGE_SELECT_REGISTER,
+        requestedPage,
+        sizeof(*requestedPage));
+
+    if (NT_SUCCESS(status))
+    {
+        *BytesReturned = sizeof(*requestedPage);
+    }
+
+    return status;
+}
+
+static NTSTATUS
+TchSelfTestDynamicConfigSchema(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    )
+{
+    TCM_CONTROLLER_CONTEXT *tcmContext;
+    TOUCH_TEST_DYNAMIC_CONFIG_SCHEMA *schemaOut = OutputBuffer;
+    size_t schemaLength;
+    NTSTATUS status;
+    ULONG i;
+
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(InputBuffer);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    tcmContext = (TCM_CONTROLLER_CONTEXT*)DevContext->TouchContext;
+
+    //
+    // Served from the per-build cache after the first call
+    //
+    status = TcmDescribeDynamicConfig(
+        tcmContext,
+        &DevContext->I2CContext);
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    schemaLength = sizeof(TOUCH_TEST_DYNAMIC_CONFIG_SCHEMA) +
+        tcmContext->DynamicConfigSchema.Count * sizeof(TOUCH_TEST_DYNAMIC_CONFIG_FIELD);
+
+    if (OutputBufferLength < schemaLength)
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    schemaOut->BuildId = tcmContext->DynamicConfigSchema.BuildId;
+    schemaOut->FieldCount = tcmContext->DynamicConfigSchema.Count;
+
+    for (i = 0; i < tcmContext->DynamicConfigSchema.Count; i++)
+    {
+        TOUCH_TEST_DYNAMIC_CONFIG_FIELD* fieldOut =
+            (TOUCH_TEST_DYNAMIC_CONFIG_FIELD*)(schemaOut + 1) + i;
+
+        fieldOut->Id = tcmContext->DynamicConfigSchema.Fields[i].Id;
+        fieldOut->Size = tcmContext->DynamicConfigSchema.Fields[i].Size;
+        fieldOut->Offset = tcmContext->DynamicConfigSchema.Fields[i].Offset;
+    }
+
+    *BytesReturned = schemaLength;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+TchSelfTestImageStream(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    )
+{
+    TOUCH_TEST_IMAGE_STREAM_CONFIG *streamConfig = InputBuffer;
+
+    UNREFERENCED_PARAMETER(InputBufferLength);
+    UNREFERENCED_PARAMETER(OutputBuffer);
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+    UNREFERENCED_PARAMETER(BytesReturned);
+
+    //
+    // On STATUS_PENDING the request holds the frame ring and is
+    // completed when the stream stops
+    //
+    return TcmImageStreamStart(
+        (TCM_CONTROLLER_CONTEXT*)DevContext->TouchContext,
+        &DevContext->I2CContext,
+        Request,
+        streamConfig->ReportType,
+        (streamConfig->Flags & TOUCH_TEST_IMAGE_STREAM_COMPRESS) != 0);
+}
+
+static NTSTATUS
+TchSelfTestImageStreamStop(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    )
+{
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(InputBuffer);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+    UNREFERENCED_PARAMETER(OutputBuffer);
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+    UNREFERENCED_PARAMETER(BytesReturned);
+
+    return TcmImageStreamStop(
+        (TCM_CONTROLLER_CONTEXT*)DevContext->TouchContext,
+        &DevContext->I2CContext);
+}
+
+static NTSTATUS
+TchSelfTestProductionTest(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    )
+{
+    TOUCH_TEST_PRODUCTION_TEST productionTemp;
+    ULONG productionLength;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    //
+    // In and out buffers are the same memory
+    //
+    productionTemp = *(TOUCH_TEST_PRODUCTION_TEST*)InputBuffer;
+
+    status = TcmProductionTestRun(
+        (TCM_CONTROLLER_CONTEXT*)DevContext->TouchContext,
+        &DevContext->I2CContext,
+        productionTemp.Vendor,
+        productionTemp.Tests,
+        OutputBuffer,
+        (ULONG)OutputBufferLength,
+        &productionLength);
+
+    if (NT_SUCCESS(status))
+    {
+        *BytesReturned = productionLength;
+    }
+
+    return status;
+}
+
+static NTSTATUS
+TchSelfTestBatch(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
     )
 /*++
 
 Routine Description:
 
-    This dispatch routine allows a user-mode application to issue test
-    requests to the driver for execution on the chip and reporting of 
-    results. 
+    Validates a batch of register operations and then runs all of them
+    under a single hold of the controller lock, so the interrupt path
+    cannot issue its own transfers halfway through a sequence.
 
 Arguments:
 
-    Queue - Framework queue object handle
+    DevContext - Touch device context
     Request - Framework request object handle
-    OutputBufferLength - self-explanatory
+    InputBuffer - Batch header, operations and write data
     InputBufferLength - self-explanatory
-    IoControlCode - Specifies what is being requested
+    OutputBuffer - Receives the batch result, statuses and read data
+    OutputBufferLength - self-explanatory
+    BytesReturned - Receives the number of output bytes to return
 
 Return Value:
 
-    NTSTATUS indicating success or failure
+    NTSTATUS indicating whether the batch was run; the status of each
+    operation is returned in the output buffer
 
 --*/
 {
-    PDEVICE_EXTENSION devContext;
-    UCHAR* readBuffer = NULL;
-    TOUCH_TEST_I2C_HEADER* headerIn = NULL;
-    TOUCH_TEST_I2C_HEADER headerTemp = {0};
-    size_t bytesReturned;
-    NTSTATUS status = STATUS_INVALID_PARAMETER;
-    BOOLEAN *requestedDiagnosticMode;
-    UCHAR *requestedPage;
+    TCM_CONTROLLER_CONTEXT* tcmContext;
+    TOUCH_TEST_BATCH_HEADER* batch = NULL;
+    TOUCH_TEST_BATCH_OP* ops;
+    TOUCH_TEST_BATCH_RESULT* result;
+    SPB_REGISTER_READ read;
+    NTSTATUS* opStatus;
+    UCHAR* writeData;
+    UCHAR* readData;
+    size_t opsLength;
+    size_t statusLength;
+    size_t writeDataLength;
+    size_t readDataLength;
+    size_t readEnd = 0;
+    UCHAR currentPage = 0;
+    BOOLEAN pageKnown = FALSE;
+    BOOLEAN stop = FALSE;
+    NTSTATUS status;
+    ULONG i;
 
+    UNREFERENCED_PARAMETER(Request);
 
-    devContext = GetDeviceContext(WdfPdoGetParent(WdfIoQueueGetDevice(Queue)));
+    tcmContext = (TCM_CONTROLLER_CONTEXT*)DevContext->TouchContext;
 
     //
-    // Ensure we're in a test session (framework should prevent this)
+    // In and out buffers are the same memory, keep the operations and
+    // the write data aside before any result is stored
     //
-    ASSERT(0 != devContext->TestSessionRefCnt);
+    batch = ExAllocatePoolWithTag(
+        NonPagedPoolNx,
+        InputBufferLength,
+        TOUCH_POOL_TAG);
+
+    if (batch == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlCopyMemory(batch, InputBuffer, InputBufferLength);
+
+    if (batch->OpCount == 0 || batch->OpCount > TOUCH_TEST_BATCH_MAX_OPS)
+    {
+        status = STATUS_INVALID_PARAMETER;
+        goto exit;
+    }
+
+    opsLength = sizeof(TOUCH_TEST_BATCH_HEADER) + batch->OpCount * sizeof(TOUCH_TEST_BATCH_OP);
+    statusLength = sizeof(TOUCH_TEST_BATCH_RESULT) + batch->OpCount * sizeof(NTSTATUS);
+
+    if (InputBufferLength < opsLength)
+    {
+        status = STATUS_INVALID_PARAMETER;
+        goto exit;
+    }
+
+    if (OutputBufferLength < statusLength)
+    {
+        status = STATUS_BUFFER_TOO_SMALL;
+        goto exit;
+    }
+
+    ops = (TOUCH_TEST_BATCH_OP*)(batch + 1);
+    writeData = (UCHAR*)batch + opsLength;
+    writeDataLength = InputBufferLength - opsLength;
+    readDataLength = OutputBufferLength - statusLength;
 
     //
-    // Process the test request
+    // Nothing goes out on the bus unless the whole batch is valid
     //
-    switch (IoControlCode)
+    for (i = 0; i < batch->OpCount; i++)
     {
-        case IOCTL_TOUCH_SELFTEST_READ:
+        size_t limit = (ops[i].Flags & TOUCH_TEST_BATCH_OP_WRITE) ?
+            writeDataLength : readDataLength;
+
+        if (ops[i].Length == 0 ||
+            ops[i].Length > limit ||
+            ops[i].DataOffset > limit - ops[i].Length)
         {
-            //
-            // Validate parameters and memory
-            //
-            if (InputBufferLength != sizeof(TOUCH_TEST_I2C_HEADER))
-            {
-                status = STATUS_INVALID_PARAMETER;
-                goto exit;
-            }
+            status = STATUS_INVALID_PARAMETER;
+            goto exit;
+        }
 
-            status = WdfRequestRetrieveInputBuffer(
-                Request,
-                sizeof(TOUCH_TEST_I2C_HEADER),
-                (PVOID) &headerIn,
-                NULL);
+        if (!(ops[i].Flags & TOUCH_TEST_BATCH_OP_WRITE))
+        {
+            readEnd = MAX(readEnd, (size_t)ops[i].DataOffset + ops[i].Length);
+        }
+    }
 
-            if ((!NT_SUCCESS(status)) || 
-                (headerIn->AddressLength != sizeof(headerIn->Address)) ||
-                (headerIn->RequestedTransferLength < 1))
-            {
-                status = STATUS_INVALID_PARAMETER;
-                goto exit;
-            }
+    result = (TOUCH_TEST_BATCH_RESULT*)OutputBuffer;
+    opStatus = (NTSTATUS*)(result + 1);
+    readData = (UCHAR*)OutputBuffer + statusLength;
+
+    RtlZeroMemory(result, sizeof(TOUCH_TEST_BATCH_RESULT));
 
-            //
-            // Create a copy of headerIn since in and out buffers point to the
-            // same memory and so SpbReadDataSync will overwrite it
-            //
-            headerTemp = *headerIn;
+    //
+    // The ControllerLock is the bus lock as well, the operations below
+    // must not take it again
+    //
+    WdfWaitLockAcquire(tcmContext->ControllerLock, NULL);
 
-            status = WdfRequestRetrieveOutputBuffer(
-                Request,
-                headerTemp.RequestedTransferLength,
-                (PVOID) &readBuffer,
-                NULL);
+    for (i = 0; i < batch->OpCount; i++)
+    {
+        if (stop)
+        {
+            opStatus[i] = STATUS_CANCELLED;
+            continue;
+        }
 
-            if ((!NT_SUCCESS(status)) ||
-                (headerTemp.RequestedTransferLength > OutputBufferLength))
+        status = STATUS_SUCCESS;
+
+        if ((ops[i].Flags & TOUCH_TEST_BATCH_OP_PAGE) &&
+            (!pageKnown || ops[i].Page != currentPage))
+        {
+            status = SpbDoWriteDataSynchronously(
+                &DevContext->I2CContext,
+                RMI4_PAGE_SELECT_REGISTER,
+                &ops[i].Page,
+                sizeof(ops[i].Page));
+
+            pageKnown = NT_SUCCESS(status);
+            currentPage = ops[i].Page;
+        }
+
+        if (NT_SUCCESS(status))
+        {
+            if (ops[i].Flags & TOUCH_TEST_BATCH_OP_WRITE)
             {
-                status = STATUS_INVALID_PARAMETER;
-                goto exit;
+                status = SpbDoWriteDataSynchronously(
+                    &DevContext->I2CContext,
+                    ops[i].Address,
+                    writeData + ops[i].DataOffset,
+                    ops[i].Length);
             }
-
-            //
-            // Perform read
-            //
-            status = SpbReadDataSynchronously(
-                &devContext->I2CContext,
-                headerTemp.Address,
-                readBuffer,
-                headerTemp.RequestedTransferLength);
-            if (!NT_SUCCESS(status))
+            else
             {
-                goto exit;
+                read.Address = ops[i].Address;
+                read.Data = readData + ops[i].DataOffset;
+                read.Length = ops[i].Length;
+
+                status = SpbDoReadRegisters(
+                    &DevContext->I2CContext,
+                    &read,
+                    1);
             }
+        }
 
-            WdfRequestSetInformation(Request, headerTemp.RequestedTransferLength);
+        opStatus[i] = status;
+        result->OpsCompleted++;
 
-            break;
+        if (!NT_SUCCESS(status))
+        {
+            result->OpsFailed++;
+            stop = (batch->Flags & TOUCH_TEST_BATCH_STOP_ON_ERROR) != 0;
         }
+    }
+
+    //
+    // A command posted while the batch held the bus goes out now
+    //
+    TcmReleaseController(tcmContext);
+
+    Trace(
+        TRACE_LEVEL_VERBOSE,
+        TRACE_OTHER,
+        "Self-test batch ran %d of %d operations, %d failed",
+        result->OpsCompleted,
+        batch->OpCount,
+        result->OpsFailed);
+
+    *BytesReturned = statusLength + readEnd;
+    status = STATUS_SUCCESS;
+
+exit:
+
+    ExFreePoolWithTag(batch, TOUCH_POOL_TAG);
+
+    return status;
+}
+
+static ULONG64
+TchSelfTestTicksToMicroseconds(
+    IN LONG64 Ticks,
+    IN LONG64 Frequency
+    )
+{
+    return (ULONG64)(Ticks / Frequency) * 1000000 +
+        (ULONG64)(Ticks % Frequency) * 1000000 / Frequency;
+}
+
+static NTSTATUS
+TchSelfTestStats(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    )
+/*++
+
+Routine Description:
+
+    Returns the call count, failure count and latency of every IOCTL of
+    the interface the request came in on.
+
+Arguments:
+
+    DevContext - Touch device context, unused here
+    Request - Framework request object handle
+    InputBuffer - Unused here
+    InputBufferLength - Unused here
+    OutputBuffer - Receives the statistics
+    OutputBufferLength - self-explanatory
+    BytesReturned - Receives the number of output bytes to return
+
+Return Value:
+
+    NTSTATUS indicating success or failure
+
+--*/
+{
+    TCH_SELFTEST_DEVICE_CONTEXT *testContext;
+    TOUCH_TEST_STATS *statsOut = OutputBuffer;
+    TOUCH_TEST_IOCTL_STATS *entryOut;
+    LARGE_INTEGER frequency;
+    size_t statsLength;
+    ULONG i;
+
+    UNREFERENCED_PARAMETER(DevContext);
+    UNREFERENCED_PARAMETER(InputBuffer);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    testContext = GetSelfTestDeviceContext(
+        WdfIoQueueGetDevice(WdfRequestGetIoQueue(Request)));
+
+    statsLength = sizeof(TOUCH_TEST_STATS) +
+        testContext->Interface->IoctlCount * sizeof(TOUCH_TEST_IOCTL_STATS);
+
+    if (OutputBufferLength < statsLength)
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    KeQueryPerformanceCounter(&frequency);
+
+    statsOut->IoctlCount = testContext->Interface->IoctlCount;
+    statsOut->Reserved = 0;
+
+    entryOut = (TOUCH_TEST_IOCTL_STATS*)(statsOut + 1);
+
+    for (i = 0; i < testContext->Interface->IoctlCount; i++)
+    {
+        TCH_SELFTEST_IOCTL_STATS *stats = &testContext->Stats[i];
+
+        entryOut[i].IoControlCode = testContext->Interface->Ioctls[i].IoControlCode;
+        entryOut[i].Calls = (ULONG)stats->Calls;
+        entryOut[i].Failures = (ULONG)stats->Failures;
+        entryOut[i].Reserved = 0;
+        entryOut[i].TotalLatencyUs = TchSelfTestTicksToMicroseconds(
+            stats->TotalTicks,
+            frequency.QuadPart);
+        entryOut[i].MaxLatencyUs = TchSelfTestTicksToMicroseconds(
+            stats->MaxTicks,
+            frequency.QuadPart);
+    }
+
+    *BytesReturned = statsLength;
+
+    return STATUS_SUCCESS;
+}
 
-        case IOCTL_TOUCH_SELFTEST_WRITE:
+static NTSTATUS
+TchSelfTestBusCapture(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    )
+/*++
+
+Routine Description:
+
+    Drains the bus transactions captured by the SPB layer into the
+    output buffer, as many as fit.
+
+Arguments:
+
+    DevContext - Touch device context
+    Request - Framework request object handle, unused here
+    InputBuffer - Unused here
+    InputBufferLength - Unused here
+    OutputBuffer - Receives the capture header and records
+    OutputBufferLength - self-explanatory
+    BytesReturned - Receives the number of output bytes to return
+
+Return Value:
+
+    NTSTATUS indicating success or failure, STATUS_NOT_SUPPORTED if
+    capture is turned off
+
+--*/
+{
+    TOUCH_TEST_BUS_CAPTURE *captureOut = OutputBuffer;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(InputBuffer);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    status = SpbCaptureRead(
+        &DevContext->I2CContext,
+        captureOut + 1,
+        (ULONG)min(OutputBufferLength - sizeof(TOUCH_TEST_BUS_CAPTURE), MAXULONG),
+        &captureOut->Length,
+        &captureOut->RecordCount,
+        &captureOut->Lost);
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    captureOut->Reserved = 0;
+
+    *BytesReturned = sizeof(TOUCH_TEST_BUS_CAPTURE) + captureOut->Length;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+TchSelfTestFaultInjection(
+    IN PDEVICE_EXTENSION DevContext,
+    IN WDFREQUEST Request,
+    IN PVOID InputBuffer,
+    IN size_t InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN size_t OutputBufferLength,
+    OUT size_t *BytesReturned
+    )
+/*++
+
+Routine Description:
+
+    Sets up bus fault injection if asked to, and returns the injection
+    counters along with how the driver recovered from the faults.
+
+Arguments:
+
+    DevContext - Touch device context
+    Request - Framework request object handle, unused here
+    InputBuffer - Fault injection setup, optional
+    InputBufferLength - self-explanatory
+    OutputBuffer - Receives the statistics
+    OutputBufferLength - Unused here
+    BytesReturned - Receives the number of output bytes to return
+
+Return Value:
+
+    NTSTATUS indicating success or failure
+
+--*/
+{
+    TCM_CONTROLLER_CONTEXT *tcmContext;
+    TOUCH_TEST_FAULT_INJECTION *injectionIn = InputBuffer;
+    TOUCH_TEST_FAULT_STATS *statsOut = OutputBuffer;
+    TCM_RECOVERY_STATS recovery;
+    SPB_FAULT_CONFIG config;
+
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+
+    tcmContext = (TCM_CONTROLLER_CONTEXT*)DevContext->TouchContext;
+
+    if (InputBufferLength != 0)
+    {
+        if (InputBufferLength != sizeof(TOUCH_TEST_FAULT_INJECTION))
         {
-            //
-            // Validate parameters and memory
-            //
-            if (InputBufferLength < sizeof(TOUCH_TEST_I2C_HEADER))
-            {
-                status = STATUS_INVALID_PARAMETER;
-                goto exit;
-            }
+            return STATUS_INVALID_PARAMETER;
+        }
 
-            status = WdfRequestRetrieveInputBuffer(
-                Request,
-                sizeof(TOUCH_TEST_I2C_HEADER),
-                (PVOID) &headerIn,
-                &bytesReturned);
+        config.Faults = injectionIn->Faults;
+        config.Rate = injectionIn->Rate;
+        config.Period = injectionIn->Period;
+        config.Count = injectionIn->Count;
+        config.DelayUs = injectionIn->DelayUs;
+        config.Seed = injectionIn->Seed;
 
-            if ((!NT_SUCCESS(status)) ||
-                (headerIn->AddressLength != sizeof(headerIn->Address)) ||
-                (bytesReturned != (sizeof(TOUCH_TEST_I2C_HEADER) + headerIn->RequestedTransferLength)))
-            {
-                status = STATUS_INVALID_PARAMETER;
-                goto exit;
-            }
+        WdfWaitLockAcquire(tcmContext->ControllerLock, NULL);
+        RtlZeroMemory(&tcmContext->RecoveryStats, sizeof(TCM_RECOVERY_STATS));
+        TcmReleaseController(tcmContext);
 
-            //
-            // Perform write
-            //
-            status = SpbWriteDataSynchronously(
-                &devContext->I2CContext,
-                headerIn->Address,
-                (PVOID) (headerIn+1),
-                headerIn->RequestedTransferLength);
+        SpbFaultConfigure(&DevContext->I2CContext, &config);
+    }
 
-            if (!NT_SUCCESS(status))
-            {
-                goto exit;
-            }
+    WdfWaitLockAcquire(tcmContext->ControllerLock, NULL);
+    recovery = tcmContext->RecoveryStats;
+    TcmReleaseController(tcmContext);
 
-            WdfRequestSetInformation(Request, headerIn->RequestedTransferLength);
+    //
+    // The output buffer overlays the input, which is consumed by now
+    //
+    RtlZeroMemory(statsOut, sizeof(TOUCH_TEST_FAULT_STATS));
+
+    SpbFaultQuery(
+        &DevContext->I2CContext,
+        &statsOut->Transfers,
+        &statsOut->Injected);
+
+    statsOut->LostMessages = recovery.LostMessages;
+    statsOut->Recoveries = recovery.Recoveries;
+    statsOut->FramesLost = recovery.FramesLost;
+    statsOut->MaxFramesLost = recovery.MaxFramesLost;
+    statsOut->LastRecoveryUs = recovery.LastRecoveryUs;
+    statsOut->MaxRecoveryUs = recovery.MaxRecoveryUs;
+    statsOut->TotalRecoveryUs = recovery.TotalRecoveryUs;
+
+    *BytesReturned = sizeof(TOUCH_TEST_FAULT_STATS);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID
+TchSelfTestRecordLatency(
+    IN TCH_SELFTEST_IOCTL_STATS *Stats,
+    IN LONG64 Ticks,
+    IN NTSTATUS Status
+    )
+{
+    LONG64 maxTicks;
+
+    InterlockedIncrement(&Stats->Calls);
+
+    if (!NT_SUCCESS(Status))
+    {
+        InterlockedIncrement(&Stats->Failures);
+    }
+
+    InterlockedAdd64(&Stats->TotalTicks, Ticks);
+
+    maxTicks = Stats->MaxTicks;
+    while (Ticks > maxTicks)
+    {
+        LONG64 previous = InterlockedCompareExchange64(&Stats->MaxTicks, Ticks, maxTicks);
 
+        if (previous == maxTicks)
+        {
             break;
         }
 
-        case IOCTL_TOUCH_SELFTEST_MODE:
-        {
-            //
-            // Validate parameters and memory
-            //
-            if (InputBufferLength != sizeof(BOOLEAN))
-            {
-                status = STATUS_INVALID_PARAMETER;
-                goto exit;
-            }
+        maxTicks = previous;
+    }
+}
 
-            status = WdfRequestRetrieveInputBuffer(
-                Request,
-                sizeof(BOOLEAN),
-                (PVOID) &requestedDiagnosticMode,
-                NULL);
+VOID
+TchSelfTestOnDeviceControl(
+    IN WDFQUEUE Queue,
+    IN WDFREQUEST Request,
+    IN size_t OutputBufferLength,
+    IN size_t InputBufferLength,
+    IN ULONG IoControlCode
+    )
+/*++
 
-            if (!NT_SUCCESS(status))
-            {
-                status = STATUS_INVALID_PARAMETER;
-                goto exit;
-            }
+Routine Description:
 
-            if (*requestedDiagnosticMode != devContext->DiagnosticMode)
-            {
-                devContext->DiagnosticMode = *requestedDiagnosticMode;
-            }
+    This dispatch routine allows a user-mode application to issue test
+    requests to the driver for execution on the chip and reporting of
+    results. Both test interfaces dispatch here; the IOCTL is looked up
+    in the table of the interface the request came in on, its buffers
+    are validated against the table entry and its latency is recorded.
+
+Arguments:
+
+    Queue - Framework queue object handle
+    Request - Framework request object handle
+    OutputBufferLength - self-explanatory
+    InputBufferLength - self-explanatory
+    IoControlCode - Specifies what is being requested
 
-            WdfRequestSetInformation(Request, sizeof(*requestedDiagnosticMode));
+Return Value:
 
+    NTSTATUS indicating success or failure
+
+--*/
+{
+    PDEVICE_EXTENSION devContext;
+    TCH_SELFTEST_DEVICE_CONTEXT *testContext;
+    const TCH_SELFTEST_IOCTL *ioctl = NULL;
+    PVOID inputBuffer = NULL;
+    PVOID outputBuffer = NULL;
+    size_t bytesReturned = 0;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    NTSTATUS status = STATUS_INVALID_PARAMETER;
+    ULONG i;
+
+    devContext = GetDeviceContext(WdfPdoGetParent(WdfIoQueueGetDevice(Queue)));
+    testContext = GetSelfTestDeviceContext(WdfIoQueueGetDevice(Queue));
+
+    //
+    // Ensure we're in a test session (framework should prevent this)
+    //
+    ASSERT(0 != devContext->TestSessionRefCnt);
+
+    for (i = 0; i < testContext->Interface->IoctlCount; i++)
+    {
+        if (testContext->Interface->Ioctls[i].IoControlCode == IoControlCode)
+        {
+            ioctl = &testContext->Interface->Ioctls[i];
             break;
         }
-        
-        case IOCTL_TOUCH_SELFTEST_CHANGE_PAGE:
-        {
-            //
-            // Validate parameters and memory
-            //
-            if (InputBufferLength != sizeof(UCHAR))
-            {
-                status = STATUS_INVALID_PARAMETER;
-                goto exit;
-            }
+    }
 
-            status = WdfRequestRetrieveInputBuffer(
-                Request,
-                sizeof(UCHAR),
-                (PVOID) &requestedPage,
-                NULL);
+    if (ioctl == NULL)
+    {
+        status = STATUS_NOT_IMPLEMENTED;
+        goto exit;
+    }
 
-            if (!NT_SUCCESS(status))
-            {
-                status = STATUS_INVALID_PARAMETER;
-                goto exit;
-            }
+    start = KeQueryPerformanceCounter(NULL);
 
-            status = RmiChangePage(
-                devContext->TouchContext,
-                &devContext->I2CContext,
-                *requestedPage);
-            if (!NT_SUCCESS(status))
-            {
-                goto exit;
-            }
+    //
+    // Validate parameters and memory
+    //
+    if ((InputBufferLength < ioctl->MinInputLength) ||
+        (ioctl->MaxInputLength != 0 && InputBufferLength > ioctl->MaxInputLength))
+    {
+        status = STATUS_INVALID_PARAMETER;
+        goto record;
+    }
 
-            WdfRequestSetInformation(Request, sizeof(*requestedPage));
+    if (OutputBufferLength < ioctl->MinOutputLength)
+    {
+        status = STATUS_BUFFER_TOO_SMALL;
+        goto record;
+    }
 
-            break;
+    //
+    // Some IOCTLs take optional input, retrieve it whenever there is any
+    //
+    if (InputBufferLength != 0)
+    {
+        status = WdfRequestRetrieveInputBuffer(
+            Request,
+            ioctl->MinInputLength,
+            &inputBuffer,
+            NULL);
+
+        if (!NT_SUCCESS(status))
+        {
+            status = STATUS_INVALID_PARAMETER;
+            goto record;
         }
+    }
+
+    if (ioctl->MinOutputLength != 0)
+    {
+        status = WdfRequestRetrieveOutputBuffer(
+            Request,
+            ioctl->MinOutputLength,
+            &outputBuffer,
+            NULL);
 
-        default:
+        if (!NT_SUCCESS(status))
         {
-            status = STATUS_NOT_IMPLEMENTED;
-            break;
-        } 
+            status = STATUS_BUFFER_TOO_SMALL;
+            goto record;
+        }
+    }
+
+    //
+    // Process the test request
+    //
+    status = ioctl->Handler(
+        devContext,
+        Request,
+        inputBuffer,
+        InputBufferLength,
+        outputBuffer,
+        OutputBufferLength,
+        &bytesReturned);
+
+record:
+
+    end = KeQueryPerformanceCounter(NULL);
+
+    TchSelfTestRecordLatency(
+        &testContext->Stats[ioctl - testContext->Interface->Ioctls],
+        end.QuadPart - start.QuadPart,
+        status);
+
+    //
+    // The handler kept the request and completes it later
+    //
+    if (status == STATUS_PENDING)
+    {
+        return;
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        WdfRequestSetInformation(Request, bytesReturned);
     }
 
 exit:
@@ -300,12 +1264,11 @@ Return Value:
 
 {
     PDEVICE_EXTENSION devContext;
-    LONG testSessionCount;
 
     UNREFERENCED_PARAMETER(FileObject);
 
     devContext = GetDeviceContext(WdfPdoGetParent(Device));
-    testSessionCount = InterlockedIncrement(&(devContext->TestSessionRefCnt));
+    InterlockedIncrement(&(devContext->TestSessionRefCnt));
 
     WdfRequestComplete(
         Request,
@@ -336,16 +1299,16 @@ Return Value:
 
 {
     PDEVICE_EXTENSION devContext;
-    LONG testSessionCount;
 
     devContext = GetDeviceContext(WdfPdoGetParent(WdfFileObjectGetDevice(FileObject)));
 
-    testSessionCount = InterlockedDecrement(&(devContext->TestSessionRefCnt));
+    InterlockedDecrement(&(devContext->TestSessionRefCnt));
 }
 
-NTSTATUS
-TchSelfTestInitialize(
-    IN WDFDEVICE Device
+static NTSTATUS
+TchSelfTestCreateDevice(
+    IN WDFDEVICE Device,
+    IN const TCH_SELFTEST_INTERFACE *Interface
     )
 /*++
 
@@ -364,6 +1327,7 @@ Routine Description:
 Arguments:
 
     Device - Framework device object representing the actual touch device
+    Interface - Identity and IOCTL table of the test device
 
 Return Value:
 
@@ -372,19 +1336,15 @@ Return Value:
 --*/
 {
     NTSTATUS status;
-    PDEVICE_EXTENSION devContext;
+    TCH_SELFTEST_DEVICE_CONTEXT *testContext;
     PWDFDEVICE_INIT deviceInit = NULL;
     WDF_FILEOBJECT_CONFIG fileConfig;
     WDFDEVICE childDevice = NULL;
     WDF_OBJECT_ATTRIBUTES objectAttributes;
     WDF_IO_QUEUE_CONFIG queueConfig;
 
-    DECLARE_CONST_UNICODE_STRING(deviceId, L"{3a0ac59a-4d8a-4875-b7ea-304771ff9b9a}\\NokiaTouch\0");
-    DECLARE_CONST_UNICODE_STRING(hardwareId, L"NOKIA_TOUCH");
     DECLARE_CONST_UNICODE_STRING(instanceId, L"0\0");
 
-    devContext = GetDeviceContext(Device);
-
     //
     // Create a child test PDO, the touch device is the parent
     //
@@ -403,8 +1363,25 @@ Return Value:
     }
 
     //
-    // NOTE: Default driver security should suffice for this interface
+    // Assign security for this interface, if it asks for any
     //
+    if (Interface->Security != NULL)
+    {
+        status = WdfDeviceInitAssignSDDLString(
+            deviceInit,
+            Interface->Security);
+
+        if (!NT_SUCCESS(status))
+        {
+            Trace(
+                TRACE_LEVEL_ERROR,
+                TRACE_INIT,
+                "Error assigning test device object security - %!STATUS!",
+                status);
+
+            goto exit;
+        }
+    }
 
     //
     // Indicate this PDO runs in "raw mode", so the framework doesn't
@@ -431,7 +1408,7 @@ Return Value:
     //
     status = WdfPdoInitAssignDeviceID(
         deviceInit,
-        &deviceId);
+        Interface->DeviceId);
 
     if (!NT_SUCCESS(status))
     {
@@ -446,7 +1423,7 @@ Return Value:
 
     status = WdfPdoInitAddHardwareID(
         deviceInit,
-        &hardwareId);
+        Interface->HardwareId);
 
     if (!NT_SUCCESS(status))
     {
@@ -493,7 +1470,9 @@ Return Value:
     //
     // Create the touch test device
     //
-    WDF_OBJECT_ATTRIBUTES_INIT(&objectAttributes);
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(
+        &objectAttributes,
+        TCH_SELFTEST_DEVICE_CONTEXT);
 
     status = WdfDeviceCreate(
         &deviceInit,
@@ -511,6 +1490,9 @@ Return Value:
         goto exit;
     }
 
+    testContext = GetSelfTestDeviceContext(childDevice);
+    testContext->Interface = Interface;
+
     //
     // Set up an I/O request queue so that calling application
     // may send test requests to the device.
@@ -525,7 +1507,7 @@ Return Value:
         childDevice,
         &queueConfig,
         WDF_NO_OBJECT_ATTRIBUTES,
-        &devContext->TestQueue);
+        &testContext->Queue);
 
     if (!NT_SUCCESS(status))
     {
@@ -544,7 +1526,7 @@ Return Value:
     //
     status = WdfDeviceCreateDeviceInterface(
         childDevice,
-        &GUID_TOUCH_SELFTEST_INTERFACE,
+        Interface->InterfaceGuid,
         NULL);
 
     if (!NT_SUCCESS(status))
@@ -593,3 +1575,40 @@ exit:
 
     return status;
 }
+
+NTSTATUS
+TchSelfTestInitialize(
+    IN WDFDEVICE Device
+    )
+/*++
+
+Routine Description:
+
+    Creates one test PDO for each self-test interface. They share the
+    dispatch engine and differ only in identity and IOCTL table.
+
+Arguments:
+
+    Device - Framework device object representing the actual touch device
+
+Return Value:
+
+    NTSTATUS indicating success or failure
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG i;
+
+    for (i = 0; i < RTL_NUMBER_OF(TchSelfTestInterfaces); i++)
+    {
+        status = TchSelfTestCreateDevice(Device, &TchSelfTestInterfaces[i]);
+
+        if (!NT_SUCCESS(status))
+        {
+            break;
+        }
+    }
+
+    return status;
+}
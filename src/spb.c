@@ -22,9 +22,415 @@
 #include <internal.h>
 #include <controller.h>
 #include "spb.h"
+
+//
+// include\spb.h shadows the WDK header of the same name, which defines
+// the sequence IOCTL and transfer lists. Reach it through its directory.
+//
+#include <..\km\spb.h>
 #include <spb.tmh>
 
-#define I2C_VERBOSE_LOGGING 0
+#define SPB_REG_KEY L"\\Registry\\Machine\\SYSTEM\\TOUCH\\Settings"
+
+#define SPB_CAPTURE_DEFAULT_SIZE 0
+#define SPB_CAPTURE_MAX_SIZE (4 * 1024 * 1024)
+
+static SPB_CAPTURE_RECORD*
+SpbCaptureAdvance(
+    IN SPB_CAPTURE* Capture
+)
+/*++
+
+  Routine Description:
+
+    Moves the tail of the capture ring past its oldest entry. The ring
+    is reset to its start once it runs empty.
+
+  Arguments:
+
+    Capture - The capture ring, not empty
+
+  Return Value:
+
+    The record passed, NULL if the tail wrapped to the start of the
+    ring instead. The record stays valid until the next one is added.
+
+--*/
+{
+    SPB_CAPTURE_RECORD* record = (SPB_CAPTURE_RECORD*)(Capture->Ring + Capture->Tail);
+
+    if (Capture->Size - Capture->Tail < sizeof(SPB_CAPTURE_RECORD) ||
+        (record->Flags & SPB_CAPTURE_WRAP) != 0)
+    {
+        record = NULL;
+        Capture->Tail = 0;
+    }
+    else
+    {
+        Capture->Tail += SPB_CAPTURE_RECORD_SIZE(record->Length);
+    }
+
+    if (Capture->Tail == Capture->Head)
+    {
+        Capture->Head = 0;
+        Capture->Tail = 0;
+    }
+
+    return record;
+}
+
+static VOID
+SpbCaptureRecord(
+    IN SPB_CONTEXT* SpbContext,
+    IN UCHAR Flags,
+    IN UCHAR Address,
+    _In_reads_bytes_opt_(Length) PVOID Data,
+    IN ULONG Length,
+    IN NTSTATUS Status
+)
+/*++
+
+  Routine Description:
+
+    Appends a transaction to the capture ring, dropping the oldest
+    records if there is no room left. Must be called with the SpbLock
+    held, or from the completion of a chained read.
+
+  Arguments:
+
+    SpbContext - Pointer to the current device context
+    Flags      - SPB_CAPTURE_* flags of the transaction
+    Address    - Register address, if the transaction has one
+    Data       - Bytes transferred, NULL if the transfer failed
+    Length     - The amount of data transferred
+    Status     - Status of the transaction
+
+  Return Value:
+
+    None
+
+--*/
+{
+    SPB_CAPTURE* capture = &SpbContext->Capture;
+    SPB_CAPTURE_RECORD* record;
+    LARGE_INTEGER frequency, counter;
+    ULONG recordSize;
+    ULONG maxLength;
+
+    if (capture->Ring == NULL)
+    {
+        return;
+    }
+
+    if (Data == NULL)
+    {
+        Length = 0;
+    }
+
+    //
+    // A record never takes more than half of the ring
+    //
+    maxLength = capture->Size / 2 - sizeof(SPB_CAPTURE_RECORD);
+
+    if (Length > maxLength)
+    {
+        Flags |= SPB_CAPTURE_TRUNCATED;
+        Length = maxLength;
+    }
+
+    recordSize = SPB_CAPTURE_RECORD_SIZE(Length);
+
+    //
+    // Records are contiguous. The head never catches up with the tail,
+    // so that the ring is empty exactly when both are at its start.
+    //
+    for (;;)
+    {
+        if (capture->Head >= capture->Tail)
+        {
+            if (capture->Size - capture->Head >= recordSize)
+            {
+                break;
+            }
+
+            if (capture->Tail > recordSize)
+            {
+                if (capture->Size - capture->Head >= sizeof(SPB_CAPTURE_RECORD))
+                {
+                    record = (SPB_CAPTURE_RECORD*)(capture->Ring + capture->Head);
+                    RtlZeroMemory(record, sizeof(SPB_CAPTURE_RECORD));
+                    record->Flags = SPB_CAPTURE_WRAP;
+                }
+
+                capture->Head = 0;
+                break;
+            }
+        }
+        else if (capture->Tail - capture->Head > recordSize)
+        {
+            break;
+        }
+
+        if (SpbCaptureAdvance(capture) != NULL)
+        {
+            capture->Lost++;
+        }
+    }
+
+    counter = KeQueryPerformanceCounter(&frequency);
+
+    record = (SPB_CAPTURE_RECORD*)(capture->Ring + capture->Head);
+    record->TimeUs = (ULONG64)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+        (ULONG64)(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+    record->Sequence = ++capture->Sequence;
+    record->Status = Status;
+    record->Length = Length;
+    record->Flags = Flags;
+    record->Address = Address;
+    record->Reserved = 0;
+
+    if (Length != 0)
+    {
+        RtlCopyMemory(record + 1, Data, Length);
+    }
+
+    capture->Head += recordSize;
+}
+
+static ULONG
+SpbFaultRandom(
+    IN SPB_FAULT* Fault
+)
+{
+    ULONG x = Fault->Random;
+
+    //
+    // xorshift32, deterministic for a given seed
+    //
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    Fault->Random = x;
+
+    return x;
+}
+
+static NTSTATUS
+SpbFaultBegin(
+    IN SPB_CONTEXT* SpbContext,
+    IN ULONG Allowed,
+    OUT ULONG* Fault
+)
+/*++
+
+  Routine Description:
+
+    Decides whether a transfer about to be sent gets a fault, and which
+    one. Delays are served here. Must be called with the SpbLock held,
+    or from the completion of a chained read.
+
+  Arguments:
+
+    SpbContext - Pointer to the current device context
+    Allowed    - SPB_FAULT_* flags that apply to the transfer
+    Fault      - Receives the SPB_FAULT_* flag picked, 0 for none
+
+  Return Value:
+
+    STATUS_NO_SUCH_DEVICE if the transfer must not be sent, as if the
+    controller did not acknowledge it, STATUS_SUCCESS otherwise
+
+--*/
+{
+    SPB_FAULT* fault = &SpbContext->Fault;
+    LARGE_INTEGER delay;
+    ULONG faults;
+    ULONG pick;
+    ULONG count;
+
+    *Fault = 0;
+
+    if (fault->Config.Faults == 0)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    fault->Transfers++;
+
+    faults = fault->Config.Faults & Allowed;
+
+    if (faults == 0 ||
+        (fault->Config.Count != 0 && fault->Injected >= fault->Config.Count))
+    {
+        return STATUS_SUCCESS;
+    }
+
+    if (fault->Config.Period != 0)
+    {
+        if (fault->Transfers % fault->Config.Period != 0)
+        {
+            return STATUS_SUCCESS;
+        }
+    }
+    else if (SpbFaultRandom(fault) % 1000000 >= fault->Config.Rate)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Pick one of the faults enabled for the transfer
+    //
+    for (count = 0, pick = faults; pick != 0; pick &= pick - 1)
+    {
+        count++;
+    }
+
+    pick = SpbFaultRandom(fault) % count;
+
+    for (*Fault = 1; (faults & *Fault) == 0 || pick-- != 0; *Fault <<= 1);
+
+    fault->Injected++;
+
+    if (*Fault == SPB_FAULT_NAK)
+    {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    if (*Fault == SPB_FAULT_DELAY &&
+        KeGetCurrentIrql() == PASSIVE_LEVEL)
+    {
+        delay.QuadPart = -10 * (LONGLONG)fault->Config.DelayUs;
+        KeDelayExecutionThread(KernelMode, FALSE, &delay);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static VOID
+SpbFaultEnd(
+    IN ULONG Fault,
+    IN NTSTATUS Status,
+    _Inout_updates_bytes_(*Transferred) PUCHAR Data,
+    IN OUT ULONG_PTR* Transferred
+)
+/*++
+
+  Routine Description:
+
+    Applies the fault picked for a read to the data it returned.
+
+  Arguments:
+
+    Fault       - SPB_FAULT_* flag picked by SpbFaultBegin
+    Status      - Status of the read
+    Data        - The data read
+    Transferred - The amount of data read
+
+  Return Value:
+
+    None
+
+--*/
+{
+    if (!NT_SUCCESS(Status) || *Transferred == 0)
+    {
+        return;
+    }
+
+    switch (Fault)
+    {
+    case SPB_FAULT_TRUNCATE:
+        *Transferred /= 2;
+        break;
+    case SPB_FAULT_MARKER:
+        Data[0] ^= 0xFF;
+        break;
+    case SPB_FAULT_PADDING:
+        Data[*Transferred - 1] ^= 0xFF;
+        break;
+    default:
+        break;
+    }
+}
+
+static NTSTATUS
+SpbGrowBuffer(
+    IN OUT WDFMEMORY* Memory,
+    IN OUT ULONG* Size,
+    IN ULONG Length
+)
+/*++
+
+  Routine Description:
+
+    Makes sure a transfer buffer holds at least Length bytes, replacing
+    it with a larger one if it does not. The contents are carried over,
+    so a chained read can grow the buffer it is reading into. Buffers
+    only ever grow, so the occasional large transfer pays for the
+    allocation once and every later one reuses it. Must be called with
+    the SpbLock held, or from the completion of a chained read.
+
+  Arguments:
+
+    Memory - The transfer buffer, replaced on growth
+    Size   - Size of the transfer buffer, updated on growth
+    Length - The number of bytes the buffer must hold
+
+  Return Value:
+
+    NTSTATUS Status indicating success or failure
+
+--*/
+{
+    PUCHAR buffer;
+    WDFMEMORY memory;
+    NTSTATUS status;
+
+    if (Length <= *Size)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    Length = ALIGN_UP_BY(Length, DEFAULT_SPB_BUFFER_SIZE);
+
+    status = WdfMemoryCreate(
+        WDF_NO_OBJECT_ATTRIBUTES,
+        NonPagedPool,
+        TOUCH_POOL_TAG,
+        Length,
+        &memory,
+        (PVOID*)&buffer);
+
+    if (!NT_SUCCESS(status))
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_SPB,
+            "Error growing Spb buffer to %d bytes - 0x%08lX",
+            Length,
+            status);
+        return status;
+    }
+
+    if (NULL != *Memory)
+    {
+        RtlCopyMemory(buffer, WdfMemoryGetBuffer(*Memory, NULL), *Size);
+        WdfObjectDelete(*Memory);
+    }
+
+    Trace(
+        TRACE_LEVEL_INFORMATION,
+        TRACE_SPB,
+        "Spb buffer grown from %d to %d bytes",
+        *Size,
+        Length);
+
+    *Memory = memory;
+    *Size = Length;
+
+    return STATUS_SUCCESS;
+}
 
 NTSTATUS
 SpbDoWriteDataSynchronously(
@@ -54,8 +460,8 @@ SpbDoWriteDataSynchronously(
 --*/
 {
     PUCHAR buffer;
+    ULONG fault;
     ULONG length;
-    WDFMEMORY memory;
     WDF_MEMORY_DESCRIPTOR memoryDescriptor;
     NTSTATUS status;
 
@@ -64,43 +470,24 @@ SpbDoWriteDataSynchronously(
     // into one contiguous buffer representing the write transaction.
     //
     length = Length + 1;
-    memory = NULL;
 
-    if (length > DEFAULT_SPB_BUFFER_SIZE)
-    {
-        status = WdfMemoryCreate(
-            WDF_NO_OBJECT_ATTRIBUTES,
-            NonPagedPool,
-            TOUCH_POOL_TAG,
-            length,
-            &memory,
-            &buffer);
-
-        if (!NT_SUCCESS(status))
-        {
-            Trace(
-                TRACE_LEVEL_ERROR,
-                TRACE_SPB,
-                "Error allocating memory for Spb write - 0x%08lX",
-                status);
-            goto exit;
-        }
+    status = SpbGrowBuffer(
+        &SpbContext->WriteMemory,
+        &SpbContext->WriteMemorySize,
+        length);
 
-        WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
-            &memoryDescriptor,
-            memory,
-            NULL);
-    }
-    else
+    if (!NT_SUCCESS(status))
     {
-        buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->WriteMemory, NULL);
-
-        WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
-            &memoryDescriptor,
-            (PVOID)buffer,
-            length);
+        goto exit;
     }
 
+    buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->WriteMemory, NULL);
+
+    WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
+        &memoryDescriptor,
+        (PVOID)buffer,
+        length);
+
     //
     // Transaction starts by specifying the address bytes
     //
@@ -111,22 +498,650 @@ SpbDoWriteDataSynchronously(
     //
     RtlCopyMemory((buffer + sizeof(Address)), Data, length - sizeof(Address));
 
-#if I2C_VERBOSE_LOGGING
-    DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "I2CWRITE: LENGTH=%d", length);
-    for (ULONG j = 0; j < length; j++)
+    status = SpbFaultBegin(SpbContext, SPB_FAULT_WRITE_FAULTS, &fault);
+
+    if (NT_SUCCESS(status))
+    {
+        status = WdfIoTargetSendWriteSynchronously(
+            SpbContext->SpbIoTarget,
+            NULL,
+            &memoryDescriptor,
+            NULL,
+            NULL,
+            NULL);
+    }
+
+    SpbCaptureRecord(
+        SpbContext,
+        SPB_CAPTURE_WRITE | (fault != 0 ? SPB_CAPTURE_FAULT : 0),
+        Address,
+        buffer + sizeof(Address),
+        Length,
+        status);
+
+    if (!NT_SUCCESS(status))
     {
-        UCHAR byte = *(buffer + j);
-        DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, " %02hhX", byte);
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_SPB,
+            "Error writing to Spb - 0x%08lX",
+            status);
+        goto exit;
     }
-    DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "\n");
-#endif
 
-    status = WdfIoTargetSendWriteSynchronously(
+exit:
+
+    return status;
+}
+
+NTSTATUS
+SpbWriteDataSynchronously(
+    IN SPB_CONTEXT* SpbContext,
+    IN UCHAR Address,
+    IN PVOID Data,
+    IN ULONG Length
+)
+/*++
+
+  Routine Description:
+
+    This routine abstracts creating and sending an I/O
+    request (I2C Write) to the Spb I/O target and utilizes
+    a helper routine to do work inside of locked code.
+
+  Arguments:
+
+    SpbContext - Pointer to the current device context
+    Address    - The I2C register address to write to
+    Data       - A buffer to receive the data at at the above address
+    Length     - The amount of data to be read from the above address
+
+  Return Value:
+
+    NTSTATUS Status indicating success or failure
+
+--*/
+{
+    NTSTATUS status;
+
+    WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+
+    status = SpbDoWriteDataSynchronously(
+        SpbContext,
+        Address,
+        Data,
+        Length);
+
+    WdfWaitLockRelease(SpbContext->SpbLock);
+
+    return status;
+}
+
+static NTSTATUS
+SpbDoReadDataSynchronously(
+    IN SPB_CONTEXT* SpbContext,
+    _In_reads_bytes_(Length) PVOID Data,
+    IN ULONG Length
+)
+/*++
+
+  Routine Description:
+
+    This helper routine abstracts creating and sending an I/O
+    request (I2C Read) to the Spb I/O target. The read continues
+    from the address pointer the controller last latched.
+
+  Arguments:
+
+    SpbContext - Pointer to the current device context
+    Data       - A buffer to receive the data
+    Length     - The amount of data to be read
+
+  Return Value:
+
+    NTSTATUS Status indicating success or failure
+
+--*/
+{
+    PUCHAR buffer;
+    WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+    NTSTATUS status;
+    ULONG_PTR bytesRead;
+    ULONG fault;
+
+    bytesRead = 0;
+
+    status = SpbGrowBuffer(
+        &SpbContext->ReadMemory,
+        &SpbContext->ReadMemorySize,
+        Length);
+
+    if (!NT_SUCCESS(status))
+    {
+        goto exit;
+    }
+
+    buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->ReadMemory, NULL);
+
+    WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
+        &memoryDescriptor,
+        (PVOID)buffer,
+        Length);
+
+    status = SpbFaultBegin(SpbContext, SPB_FAULT_READ_FAULTS, &fault);
+
+    if (NT_SUCCESS(status))
+    {
+        status = WdfIoTargetSendReadSynchronously(
+            SpbContext->SpbIoTarget,
+            NULL,
+            &memoryDescriptor,
+            NULL,
+            NULL,
+            &bytesRead);
+
+        SpbFaultEnd(fault, status, buffer, &bytesRead);
+    }
+
+    if (NT_SUCCESS(status) &&
+        bytesRead != Length)
+    {
+        status = STATUS_DEVICE_PROTOCOL_ERROR;
+    }
+
+    SpbCaptureRecord(
+        SpbContext,
+        SPB_CAPTURE_READ | SPB_CAPTURE_CONTINUED | (fault != 0 ? SPB_CAPTURE_FAULT : 0),
+        0,
+        NT_SUCCESS(status) ? buffer : NULL,
+        Length,
+        status);
+
+    if (!NT_SUCCESS(status))
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_SPB,
+            "Error reading from Spb - 0x%08lX",
+            status);
+        goto exit;
+    }
+
+    //
+    // Copy back to the caller's buffer
+    //
+    RtlCopyMemory(Data, buffer, Length);
+
+exit:
+
+    return status;
+}
+
+NTSTATUS
+SpbDoReadRegisters(
+    IN SPB_CONTEXT* SpbContext,
+    IN SPB_REGISTER_READ* Reads,
+    IN ULONG Count
+)
+/*++
+
+  Routine Description:
+
+    This helper routine performs register reads as one SPB sequence.
+    Each read writes its address pointer and reads the register back
+    after a repeated start, and all of them share a single bus
+    transaction. Controllers that cannot execute sequences fall back
+    to a separate write and read per register. Must be called with
+    the SpbLock held.
+
+  Arguments:
+
+    SpbContext - Pointer to the current device context
+    Reads      - The register reads to perform, in bus order
+    Count      - Number of reads, at most SPB_MAX_SEQUENCE_READS
+
+  Return Value:
+
+    NTSTATUS Status indicating success or failure
+
+--*/
+{
+    SPB_TRANSFER_LIST_AND_ENTRIES(SPB_MAX_SEQUENCE_READS * 2) sequence;
+    SPB_TRANSFER_LIST_ENTRY* transfers;
+    WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+    NTSTATUS status;
+    ULONG_PTR bytesTransferred;
+    ULONG expected;
+    ULONG fault;
+    ULONG i;
+
+    if (!SpbContext->SequenceUnsupported)
+    {
+        SPB_TRANSFER_LIST_INIT(&(sequence.List), Count * 2);
+
+        //
+        // The entries run on past the one the list declares into
+        // MoreEntries, they are reached through a pointer so that the
+        // compiler does not hold the index to the declared bound
+        //
+        transfers = sequence.List.Transfers;
+
+        expected = 0;
+
+        for (i = 0; i < Count; i++)
+        {
+            transfers[i * 2] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+                SpbTransferDirectionToDevice,
+                0,
+                &Reads[i].Address,
+                sizeof(Reads[i].Address));
+
+            transfers[i * 2 + 1] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+                SpbTransferDirectionFromDevice,
+                0,
+                Reads[i].Data,
+                Reads[i].Length);
+
+            expected += sizeof(Reads[i].Address) + Reads[i].Length;
+        }
+
+        WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
+            &memoryDescriptor,
+            (PVOID)&sequence,
+            sizeof(sequence));
+
+        bytesTransferred = 0;
+
+        status = SpbFaultBegin(SpbContext, SPB_FAULT_NAK | SPB_FAULT_DELAY, &fault);
+
+        if (NT_SUCCESS(status))
+        {
+            status = WdfIoTargetSendIoctlSynchronously(
+                SpbContext->SpbIoTarget,
+                NULL,
+                IOCTL_SPB_EXECUTE_SEQUENCE,
+                &memoryDescriptor,
+                NULL,
+                NULL,
+                &bytesTransferred);
+        }
+
+        if (status != STATUS_NOT_SUPPORTED &&
+            status != STATUS_INVALID_DEVICE_REQUEST)
+        {
+            if (NT_SUCCESS(status) &&
+                bytesTransferred != expected)
+            {
+                status = STATUS_DEVICE_PROTOCOL_ERROR;
+            }
+
+            for (i = 0; i < Count; i++)
+            {
+                SpbCaptureRecord(
+                    SpbContext,
+                    SPB_CAPTURE_READ | SPB_CAPTURE_SEQUENCE | (fault != 0 ? SPB_CAPTURE_FAULT : 0),
+                    Reads[i].Address,
+                    NT_SUCCESS(status) ? Reads[i].Data : NULL,
+                    Reads[i].Length,
+                    status);
+            }
+
+            if (!NT_SUCCESS(status))
+            {
+                Trace(
+                    TRACE_LEVEL_ERROR,
+                    TRACE_SPB,
+                    "Error executing Spb read sequence of %d registers - 0x%08lX",
+                    Count,
+                    status);
+            }
+
+            return status;
+        }
+
+        Trace(
+            TRACE_LEVEL_WARNING,
+            TRACE_SPB,
+            "Spb controller does not support sequences, using separate transfers - 0x%08lX",
+            status);
+
+        SpbContext->SequenceUnsupported = TRUE;
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        //
+        // Read transactions start by writing an address pointer
+        //
+        status = SpbDoWriteDataSynchronously(
+            SpbContext,
+            Reads[i].Address,
+            NULL,
+            0);
+
+        if (!NT_SUCCESS(status))
+        {
+            Trace(
+                TRACE_LEVEL_ERROR,
+                TRACE_SPB,
+                "Error setting address pointer for Spb read - 0x%08lX",
+                status);
+            return status;
+        }
+
+        status = SpbDoReadDataSynchronously(
+            SpbContext,
+            Reads[i].Data,
+            Reads[i].Length);
+
+        if (!NT_SUCCESS(status))
+        {
+            return status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SpbReadDataSynchronously(
+    IN SPB_CONTEXT* SpbContext,
+    IN UCHAR Address,
+    _In_reads_bytes_(Length) PVOID Data,
+    IN ULONG Length
+)
+/*++
+
+  Routine Description:
+
+    This routine reads a register as a write of its address followed
+    by a read after a repeated start, in one Spb transaction.
+
+  Arguments:
+
+    SpbContext - Pointer to the current device context
+    Address    - The I2C register address to read from
+    Data       - A buffer to receive the data at at the above address
+    Length     - The amount of data to be read from the above address
+
+  Return Value:
+
+    NTSTATUS Status indicating success or failure
+
+--*/
+{
+    SPB_REGISTER_READ read;
+    NTSTATUS status;
+
+    read.Address = Address;
+    read.Data = Data;
+    read.Length = Length;
+
+    WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+
+    status = SpbDoReadRegisters(SpbContext, &read, 1);
+
+    WdfWaitLockRelease(SpbContext->SpbLock);
+
+    return status;
+}
+
+NTSTATUS
+SpbReadRegisters(
+    IN SPB_CONTEXT* SpbContext,
+    IN SPB_REGISTER_READ* Reads,
+    IN ULONG Count
+)
+/*++
+
+  Routine Description:
+
+    This routine reads several registers in one Spb transaction, so
+    that reads the caller needs together cost a single bus transfer.
+
+  Arguments:
+
+    SpbContext - Pointer to the current device context
+    Reads      - The register reads to perform, in bus order
+    Count      - Number of reads, at most SPB_MAX_SEQUENCE_READS
+
+  Return Value:
+
+    NTSTATUS Status indicating success or failure
+
+--*/
+{
+    NTSTATUS status;
+
+    if (Count == 0 || Count > SPB_MAX_SEQUENCE_READS)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+
+    status = SpbDoReadRegisters(SpbContext, Reads, Count);
+
+    WdfWaitLockRelease(SpbContext->SpbLock);
+
+    return status;
+}
+
+NTSTATUS
+SpbReadContinuedData(
+    IN SPB_CONTEXT* SpbContext,
+    _In_reads_bytes_(Length) PVOID Data,
+    IN ULONG Length
+)
+/*++
+
+  Routine Description:
+
+    This routine reads from the Spb I/O target without writing an
+    address pointer first, for devices that stream their data.
+
+  Arguments:
+
+    SpbContext - Pointer to the current device context
+    Data       - A buffer to receive the data
+    Length     - The amount of data to be read
+
+  Return Value:
+
+    NTSTATUS Status indicating success or failure
+
+--*/
+{
+    NTSTATUS status;
+
+    WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+
+    status = SpbDoReadDataSynchronously(
+        SpbContext,
+        Data,
+        Length);
+
+    WdfWaitLockRelease(SpbContext->SpbLock);
+
+    return status;
+}
+
+
+static NTSTATUS
+SpbSendChainedRead(
+    IN SPB_CONTEXT* SpbContext,
+    IN ULONG Length
+);
+
+EVT_WDF_REQUEST_COMPLETION_ROUTINE SpbChainedReadComplete;
+
+VOID
+SpbChainedReadComplete(
+    IN WDFREQUEST Request,
+    IN WDFIOTARGET Target,
+    IN PWDF_REQUEST_COMPLETION_PARAMS Params,
+    IN WDFCONTEXT Context
+)
+/*++
+
+  Routine Description:
+
+    Completion of one read of a chained read. Asks the chain owner how
+    much to read next and sends that read straight from here, so the
+    waiting thread only wakes up once the whole chain is done.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+  Arguments:
+
+    Request - The context's reusable read request
+    Target  - The Spb I/O target
+    Params  - Completion parameters of the read
+    Context - Pointer to the current device context
+
+  Return Value:
+
+    None
+
+--*/
+{
+    SPB_CONTEXT* SpbContext = (SPB_CONTEXT*)Context;
+    SPB_READ_CHAIN* chain = &SpbContext->ReadChain;
+    PUCHAR buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->ReadMemory, NULL);
+    ULONG_PTR bytesRead;
+    NTSTATUS status;
+    ULONG next;
+
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(Target);
+
+    status = Params->IoStatus.Status;
+    bytesRead = Params->IoStatus.Information;
+
+    SpbFaultEnd(chain->Fault, status, buffer + chain->Length, &bytesRead);
+
+    if (NT_SUCCESS(status) &&
+        bytesRead != chain->Pending)
+    {
+        status = STATUS_DEVICE_PROTOCOL_ERROR;
+    }
+
+    SpbCaptureRecord(
+        SpbContext,
+        SPB_CAPTURE_READ | SPB_CAPTURE_CONTINUED | (chain->Fault != 0 ? SPB_CAPTURE_FAULT : 0),
+        0,
+        NT_SUCCESS(status) ? buffer + chain->Length : NULL,
+        chain->Pending,
+        status);
+
+    if (NT_SUCCESS(status))
+    {
+        chain->Length += chain->Pending;
+        chain->Pending = 0;
+
+        next = chain->Next(
+            chain->Context,
+            buffer,
+            chain->Length);
+
+        if (next != 0)
+        {
+            status = SpbSendChainedRead(SpbContext, next);
+
+            if (NT_SUCCESS(status))
+            {
+                return;
+            }
+        }
+    }
+    else
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_SPB,
+            "Error reading from Spb after %d chained bytes - 0x%08lX",
+            chain->Length,
+            status);
+    }
+
+    chain->Status = status;
+    KeSetEvent(&chain->Done, IO_NO_INCREMENT, FALSE);
+}
+
+static NTSTATUS
+SpbSendChainedRead(
+    IN SPB_CONTEXT* SpbContext,
+    IN ULONG Length
+)
+/*++
+
+  Routine Description:
+
+    Sends the next read of a chained read on the context's reusable
+    request. The data lands in the read buffer right after what the
+    chain has read so far.
+
+  Arguments:
+
+    SpbContext - Pointer to the current device context
+    Length     - The amount of data to be read
+
+  Return Value:
+
+    NTSTATUS Status indicating success or failure. On success the
+    completion routine runs once the read is done.
+
+--*/
+{
+    SPB_READ_CHAIN* chain = &SpbContext->ReadChain;
+    WDF_REQUEST_REUSE_PARAMS reuseParams;
+    WDFMEMORY_OFFSET offset;
+    NTSTATUS status;
+
+    WDF_REQUEST_REUSE_PARAMS_INIT(
+        &reuseParams,
+        WDF_REQUEST_REUSE_NO_FLAGS,
+        STATUS_SUCCESS);
+
+    status = WdfRequestReuse(SpbContext->ReadRequest, &reuseParams);
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    status = SpbFaultBegin(SpbContext, SPB_FAULT_READ_FAULTS, &chain->Fault);
+
+    if (!NT_SUCCESS(status))
+    {
+        SpbCaptureRecord(
+            SpbContext,
+            SPB_CAPTURE_READ | SPB_CAPTURE_CONTINUED | SPB_CAPTURE_FAULT,
+            0,
+            NULL,
+            Length,
+            status);
+        return status;
+    }
+
+    status = SpbGrowBuffer(
+        &SpbContext->ReadMemory,
+        &SpbContext->ReadMemorySize,
+        chain->Length + Length);
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    offset.BufferOffset = chain->Length;
+    offset.BufferLength = Length;
+
+    status = WdfIoTargetFormatRequestForRead(
         SpbContext->SpbIoTarget,
-        NULL,
-        &memoryDescriptor,
-        NULL,
-        NULL,
+        SpbContext->ReadRequest,
+        SpbContext->ReadMemory,
+        &offset,
         NULL);
 
     if (!NT_SUCCESS(status))
@@ -134,42 +1149,145 @@ SpbDoWriteDataSynchronously(
         Trace(
             TRACE_LEVEL_ERROR,
             TRACE_SPB,
-            "Error writing to Spb - 0x%08lX",
+            "Error formatting Spb read - 0x%08lX",
             status);
-        goto exit;
+        return status;
     }
 
-exit:
+    WdfRequestSetCompletionRoutine(
+        SpbContext->ReadRequest,
+        SpbChainedReadComplete,
+        SpbContext);
+
+    chain->Pending = Length;
+
+    if (!WdfRequestSend(
+        SpbContext->ReadRequest,
+        SpbContext->SpbIoTarget,
+        WDF_NO_SEND_OPTIONS))
+    {
+        chain->Pending = 0;
+        status = WdfRequestGetStatus(SpbContext->ReadRequest);
+
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_SPB,
+            "Error sending Spb read - 0x%08lX",
+            status);
+        return status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SpbDoReadContinuedDataChained(
+    IN SPB_CONTEXT* SpbContext,
+    IN ULONG Length,
+    IN PSPB_READ_CHAIN_NEXT Next,
+    IN PVOID NextContext,
+    _Out_writes_bytes_(DataSize) PVOID Data,
+    IN ULONG DataSize,
+    OUT ULONG* DataLength
+)
+/*++
+
+  Routine Description:
+
+    This routine reads a message whose length is only known once its
+    first part has been read. The first read is sent asynchronously on
+    the context's reusable request, and every following one is sent
+    from the completion of the one before, as decided by Next. The
+    caller blocks once for the whole chain instead of once per read.
+    Must be called with the SpbLock held.
+
+  Arguments:
+
+    SpbContext  - Pointer to the current device context
+    Length      - The amount of data to be read first
+    Next        - Called with all data read so far after every read,
+                  returns the length of the next read or 0 when done
+    NextContext - Context passed to Next
+    Data        - A buffer to receive all data read
+    DataSize    - Size of the above buffer
+    DataLength  - Receives the amount of data read
+
+  Return Value:
+
+    NTSTATUS Status indicating success or failure, STATUS_BUFFER_OVERFLOW
+    if the data read did not fit into the caller's buffer.
+
+--*/
+{
+    SPB_READ_CHAIN* chain = &SpbContext->ReadChain;
+    NTSTATUS status;
+
+    *DataLength = 0;
+
+    chain->Next = Next;
+    chain->Context = NextContext;
+    chain->Length = 0;
+    chain->Pending = 0;
+    chain->Status = STATUS_SUCCESS;
+    KeClearEvent(&chain->Done);
+
+    status = SpbSendChainedRead(SpbContext, Length);
+
+    if (NT_SUCCESS(status))
+    {
+        KeWaitForSingleObject(
+            &chain->Done,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL);
 
-    if (NULL != memory)
+        status = chain->Status;
+    }
+
+    if (NT_SUCCESS(status))
     {
-        WdfObjectDelete(memory);
+        *DataLength = chain->Length;
+
+        RtlCopyMemory(
+            Data,
+            WdfMemoryGetBuffer(SpbContext->ReadMemory, NULL),
+            min(chain->Length, DataSize));
+
+        if (chain->Length > DataSize)
+        {
+            status = STATUS_BUFFER_OVERFLOW;
+        }
     }
 
     return status;
 }
 
 NTSTATUS
-SpbWriteDataSynchronously(
+SpbReadContinuedDataChained(
     IN SPB_CONTEXT* SpbContext,
-    IN UCHAR Address,
-    IN PVOID Data,
-    IN ULONG Length
+    IN ULONG Length,
+    IN PSPB_READ_CHAIN_NEXT Next,
+    IN PVOID NextContext,
+    _Out_writes_bytes_(DataSize) PVOID Data,
+    IN ULONG DataSize,
+    OUT ULONG* DataLength
 )
 /*++
 
   Routine Description:
 
-    This routine abstracts creating and sending an I/O
-    request (I2C Write) to the Spb I/O target and utilizes
-    a helper routine to do work inside of locked code.
+    Performs a chained read, see SpbDoReadContinuedDataChained.
 
   Arguments:
 
-    SpbContext - Pointer to the current device context
-    Address    - The I2C register address to write to
-    Data       - A buffer to receive the data at at the above address
-    Length     - The amount of data to be read from the above address
+    SpbContext  - Pointer to the current device context
+    Length      - The amount of data to be read first
+    Next        - Decides the length of every following read
+    NextContext - Context passed to Next
+    Data        - A buffer to receive all data read
+    DataSize    - Size of the above buffer
+    DataLength  - Receives the amount of data read
 
   Return Value:
 
@@ -181,11 +1299,14 @@ SpbWriteDataSynchronously(
 
     WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
 
-    status = SpbDoWriteDataSynchronously(
+    status = SpbDoReadContinuedDataChained(
         SpbContext,
-        Address,
+        Length,
+        Next,
+        NextContext,
         Data,
-        Length);
+        DataSize,
+        DataLength);
 
     WdfWaitLockRelease(SpbContext->SpbLock);
 
@@ -193,25 +1314,30 @@ SpbWriteDataSynchronously(
 }
 
 NTSTATUS
-SpbReadDataSynchronously(
+SpbCaptureRead(
     IN SPB_CONTEXT* SpbContext,
-    IN UCHAR Address,
-    _In_reads_bytes_(Length) PVOID Data,
-    IN ULONG Length
+    _Out_writes_bytes_(BufferLength) PVOID Buffer,
+    IN ULONG BufferLength,
+    OUT ULONG* Length,
+    OUT ULONG* Records,
+    OUT ULONG* Lost
 )
 /*++
 
   Routine Description:
 
-    This helper routine abstracts creating and sending an I/O
-    request (I2C Read) to the Spb I/O target.
+    Moves the oldest captured transactions into the caller's buffer,
+    as many whole records as fit.
 
   Arguments:
 
-    SpbContext - Pointer to the current device context
-    Address    - The I2C register address to read from
-    Data       - A buffer to receive the data at at the above address
-    Length     - The amount of data to be read from the above address
+    SpbContext   - Pointer to the current device context
+    Buffer       - A buffer to receive the records
+    BufferLength - Size of the above buffer
+    Length       - Receives the amount of data copied
+    Records      - Receives the number of records copied
+    Lost         - Receives the number of records dropped since the
+                   last call because the ring was full
 
   Return Value:
 
@@ -219,230 +1345,174 @@ SpbReadDataSynchronously(
 
 --*/
 {
-    PUCHAR buffer;
-    WDFMEMORY memory;
-    WDF_MEMORY_DESCRIPTOR memoryDescriptor;
-    NTSTATUS status;
-    ULONG_PTR bytesRead;
-
-    WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+    SPB_CAPTURE* capture = &SpbContext->Capture;
+    SPB_CAPTURE_RECORD* record;
+    ULONG recordSize;
+    NTSTATUS status = STATUS_SUCCESS;
 
-    memory = NULL;
-    status = STATUS_INVALID_PARAMETER;
-    bytesRead = 0;
+    *Length = 0;
+    *Records = 0;
+    *Lost = 0;
 
-    //
-    // Read transactions start by writing an address pointer
-    //
-    status = SpbDoWriteDataSynchronously(
-        SpbContext,
-        Address,
-        NULL,
-        0);
+    WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
 
-    if (!NT_SUCCESS(status))
+    if (capture->Ring == NULL)
     {
-        Trace(
-            TRACE_LEVEL_ERROR,
-            TRACE_SPB,
-            "Error setting address pointer for Spb read - 0x%08lX",
-            status);
+        status = STATUS_NOT_SUPPORTED;
         goto exit;
     }
 
-    if (Length > DEFAULT_SPB_BUFFER_SIZE)
+    while (capture->Head != capture->Tail)
     {
-        status = WdfMemoryCreate(
-            WDF_NO_OBJECT_ATTRIBUTES,
-            NonPagedPool,
-            TOUCH_POOL_TAG,
-            Length,
-            &memory,
-            &buffer);
+        record = (SPB_CAPTURE_RECORD*)(capture->Ring + capture->Tail);
 
-        if (!NT_SUCCESS(status))
+        if (capture->Size - capture->Tail >= sizeof(SPB_CAPTURE_RECORD) &&
+            (record->Flags & SPB_CAPTURE_WRAP) == 0)
         {
-            Trace(
-                TRACE_LEVEL_ERROR,
-                TRACE_SPB,
-                "Error allocating memory for Spb read - 0x%08lX",
-                status);
-            goto exit;
+            recordSize = SPB_CAPTURE_RECORD_SIZE(record->Length);
+
+            if (BufferLength - *Length < recordSize)
+            {
+                break;
+            }
+
+            RtlCopyMemory((PUCHAR)Buffer + *Length, record, recordSize);
+            *Length += recordSize;
+            (*Records)++;
         }
 
-        WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
-            &memoryDescriptor,
-            memory,
-            NULL);
+        SpbCaptureAdvance(capture);
     }
-    else
-    {
-        buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->ReadMemory, NULL);
 
-        WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
-            &memoryDescriptor,
-            (PVOID)buffer,
-            Length);
-    }
+    *Lost = capture->Lost;
+    capture->Lost = 0;
 
+exit:
+    WdfWaitLockRelease(SpbContext->SpbLock);
 
-    status = WdfIoTargetSendReadSynchronously(
-        SpbContext->SpbIoTarget,
-        NULL,
-        &memoryDescriptor,
-        NULL,
-        NULL,
-        &bytesRead);
+    return status;
+}
 
-    if (!NT_SUCCESS(status) ||
-        bytesRead != Length)
-    {
-        Trace(
-            TRACE_LEVEL_ERROR,
-            TRACE_SPB,
-            "Error reading from Spb - 0x%08lX",
-            status);
-        goto exit;
-    }
+VOID
+SpbFaultConfigure(
+    IN SPB_CONTEXT* SpbContext,
+    IN SPB_FAULT_CONFIG* Config
+)
+/*++
 
-#if I2C_VERBOSE_LOGGING
-    DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "I2CREAD: LENGTH=%d", Length);
-    for (ULONG j = 0; j < Length; j++)
-    {
-        UCHAR byte = *(buffer + j);
-        DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, " %02hhX", byte);
-    }
-    DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "\n");
-#endif
+  Routine Description:
 
-    //
-    // Copy back to the caller's buffer
-    //
-    RtlCopyMemory(Data, buffer, Length);
+    Sets up fault injection into bus transfers and resets its counters.
+    Faults set to 0 turns injection off.
 
-exit:
-    if (NULL != memory)
-    {
-        WdfObjectDelete(memory);
-    }
+  Arguments:
+
+    SpbContext - Pointer to the current device context
+    Config     - The faults to inject and when
+
+  Return Value:
+
+    None
+
+--*/
+{
+    SPB_FAULT* fault = &SpbContext->Fault;
+
+    WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+
+    fault->Config = *Config;
+    fault->Random = Config->Seed != 0 ? Config->Seed : 0x2545F491;
+    fault->Transfers = 0;
+    fault->Injected = 0;
 
     WdfWaitLockRelease(SpbContext->SpbLock);
 
-    return status;
+    Trace(
+        TRACE_LEVEL_WARNING,
+        TRACE_SPB,
+        "Spb fault injection set to 0x%02x, rate %d ppm, period %d, count %d, delay %d us, seed 0x%08x",
+        Config->Faults,
+        Config->Rate,
+        Config->Period,
+        Config->Count,
+        Config->DelayUs,
+        Config->Seed);
 }
 
-NTSTATUS
-SpbReadContinuedData(
+VOID
+SpbFaultQuery(
     IN SPB_CONTEXT* SpbContext,
-    _In_reads_bytes_(Length) PVOID Data,
-    IN ULONG Length
+    OUT ULONG* Transfers,
+    OUT ULONG* Injected
 )
 /*++
 
   Routine Description:
 
-    This helper routine abstracts creating and sending an I/O
-    request (I2C Read) to the Spb I/O target.
+    Returns the fault injection counters.
 
   Arguments:
 
     SpbContext - Pointer to the current device context
-    Address    - The I2C register address to read from
-    Data       - A buffer to receive the data at at the above address
-    Length     - The amount of data to be read from the above address
+    Transfers  - Receives the number of transfers seen since injection
+                 was set up
+    Injected   - Receives the number of faults injected into them
 
   Return Value:
 
-    NTSTATUS Status indicating success or failure
+    None
 
 --*/
 {
-    PUCHAR buffer;
-    WDFMEMORY memory;
-    WDF_MEMORY_DESCRIPTOR memoryDescriptor;
-    NTSTATUS status;
-    ULONG_PTR bytesRead;
-
     WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
 
-    memory = NULL;
-    status = STATUS_INVALID_PARAMETER;
-    bytesRead = 0;
+    *Transfers = SpbContext->Fault.Transfers;
+    *Injected = SpbContext->Fault.Injected;
 
-    if (Length > DEFAULT_SPB_BUFFER_SIZE)
-    {
-        status = WdfMemoryCreate(
-            WDF_NO_OBJECT_ATTRIBUTES,
-            NonPagedPool,
-            TOUCH_POOL_TAG,
-            Length,
-            &memory,
-            &buffer);
+    WdfWaitLockRelease(SpbContext->SpbLock);
+}
 
-        if (!NT_SUCCESS(status))
-        {
-            Trace(
-                TRACE_LEVEL_ERROR,
-                TRACE_SPB,
-                "Error allocating memory for Spb read - 0x%08lX",
-                status);
-            goto exit;
-        }
+NTSTATUS
+SpbReserveTransferBuffers(
+    IN SPB_CONTEXT* SpbContext,
+    IN ULONG ReadLength,
+    IN ULONG WriteLength
+)
+/*++
 
-        WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
-            &memoryDescriptor,
-            memory,
-            NULL);
-    }
-    else
-    {
-        buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->ReadMemory, NULL);
+  Routine Description:
 
-        WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
-            &memoryDescriptor,
-            (PVOID)buffer,
-            Length);
-    }
+    Sizes the read and write buffers for the largest transfers the
+    controller is expected to make, so that regular traffic never
+    allocates. Larger transfers still grow the buffers on demand.
 
+  Arguments:
 
-    status = WdfIoTargetSendReadSynchronously(
-        SpbContext->SpbIoTarget,
-        NULL,
-        &memoryDescriptor,
-        NULL,
-        NULL,
-        &bytesRead);
+    SpbContext  - Pointer to the current device context
+    ReadLength  - Largest expected read, in bytes
+    WriteLength - Largest expected write, without the address byte
 
-    if (!NT_SUCCESS(status) ||
-        bytesRead != Length)
-    {
-        Trace(
-            TRACE_LEVEL_ERROR,
-            TRACE_SPB,
-            "Error reading from Spb - 0x%08lX",
-            status);
-        goto exit;
-    }
+  Return Value:
 
-#if I2C_VERBOSE_LOGGING
-    DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "I2CREAD: LENGTH=%d", Length);
-    for (ULONG j = 0; j < Length; j++)
-    {
-        UCHAR byte = *(buffer + j);
-        DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, " %02hhX", byte);
-    }
-    DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "\n");
-#endif
+    NTSTATUS Status indicating success or failure
 
-    //
-    // Copy back to the caller's buffer
-    //
-    RtlCopyMemory(Data, buffer, Length);
+--*/
+{
+    NTSTATUS status;
 
-exit:
-    if (NULL != memory)
+    WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+
+    status = SpbGrowBuffer(
+        &SpbContext->ReadMemory,
+        &SpbContext->ReadMemorySize,
+        ReadLength);
+
+    if (NT_SUCCESS(status))
     {
-        WdfObjectDelete(memory);
+        status = SpbGrowBuffer(
+            &SpbContext->WriteMemory,
+            &SpbContext->WriteMemorySize,
+            WriteLength + 1);
     }
 
     WdfWaitLockRelease(SpbContext->SpbLock);
@@ -450,7 +1520,6 @@ exit:
     return status;
 }
 
-
 VOID
 SpbTargetDeinitialize(
     IN WDFDEVICE FxDevice,
@@ -481,6 +1550,11 @@ SpbTargetDeinitialize(
     //
     // Free any SPB_CONTEXT allocations here
     //
+    if (SpbContext->ReadRequest != NULL)
+    {
+        WdfObjectDelete(SpbContext->ReadRequest);
+    }
+
     if (SpbContext->SpbLock != NULL)
     {
         WdfObjectDelete(SpbContext->SpbLock);
@@ -495,6 +1569,20 @@ SpbTargetDeinitialize(
     {
         WdfObjectDelete(SpbContext->WriteMemory);
     }
+
+    if (SpbContext->Capture.Ring != NULL)
+    {
+        ExFreePoolWithTag(SpbContext->Capture.Ring, TOUCH_POOL_TAG);
+    }
+
+    RtlZeroMemory(&SpbContext->Capture, sizeof(SPB_CAPTURE));
+    RtlZeroMemory(&SpbContext->Fault, sizeof(SPB_FAULT));
+    SpbContext->ReadRequest = NULL;
+    SpbContext->SpbLock = NULL;
+    SpbContext->ReadMemory = NULL;
+    SpbContext->ReadMemorySize = 0;
+    SpbContext->WriteMemory = NULL;
+    SpbContext->WriteMemorySize = 0;
 }
 
 NTSTATUS
@@ -525,6 +1613,7 @@ SpbTargetInitialize(
     WDF_IO_TARGET_OPEN_PARAMS openParams;
     UNICODE_STRING spbDeviceName;
     WCHAR spbDeviceNameBuffer[RESOURCE_HUB_PATH_SIZE];
+    DWORD captureSize;
     NTSTATUS status;
 
     WDF_OBJECT_ATTRIBUTES_INIT(&objectAttributes);
@@ -589,8 +1678,8 @@ SpbTargetInitialize(
     }
 
     //
-    // Allocate some fixed-size buffers from NonPagedPool for typical
-    // Spb transaction sizes to avoid pool fragmentation in most cases
+    // Allocate some buffers from NonPagedPool for typical Spb transaction
+    // sizes, they are grown once the controller reports its capabilities
     //
     status = WdfMemoryCreate(
         WDF_NO_OBJECT_ATTRIBUTES,
@@ -610,6 +1699,8 @@ SpbTargetInitialize(
         goto exit;
     }
 
+    SpbContext->WriteMemorySize = DEFAULT_SPB_BUFFER_SIZE;
+
     status = WdfMemoryCreate(
         WDF_NO_OBJECT_ATTRIBUTES,
         NonPagedPool,
@@ -628,8 +1719,10 @@ SpbTargetInitialize(
         goto exit;
     }
 
+    SpbContext->ReadMemorySize = DEFAULT_SPB_BUFFER_SIZE;
+
     //
-    // Allocate a waitlock to guard access to the default buffers
+    // Allocate a waitlock to guard access to the transfer buffers
     //
     status = WdfWaitLockCreate(
         WDF_NO_OBJECT_ATTRIBUTES,
@@ -645,6 +1738,67 @@ SpbTargetInitialize(
         goto exit;
     }
 
+    //
+    // Chained reads reuse one request instead of having the framework
+    // allocate one for every transfer
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT(&objectAttributes);
+    objectAttributes.ParentObject = SpbContext->SpbIoTarget;
+
+    status = WdfRequestCreate(
+        &objectAttributes,
+        SpbContext->SpbIoTarget,
+        &SpbContext->ReadRequest);
+
+    if (!NT_SUCCESS(status))
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_SPB,
+            "Error creating Spb read request - 0x%08lX",
+            status);
+        goto exit;
+    }
+
+    KeInitializeEvent(&SpbContext->ReadChain.Done, NotificationEvent, FALSE);
+
+    //
+    // Record bus traffic for offline replay. The capture holds touch
+    // data, so it stays off unless BusCaptureSize asks for a ring of
+    // that many bytes.
+    //
+    captureSize = SPB_CAPTURE_DEFAULT_SIZE;
+
+    RtlReadRegistryValue(
+        SPB_REG_KEY,
+        L"BusCaptureSize",
+        REG_DWORD,
+        &captureSize,
+        sizeof(DWORD));
+
+    captureSize = ALIGN_DOWN_BY(min(captureSize, SPB_CAPTURE_MAX_SIZE), sizeof(ULONG64));
+
+    if (captureSize >= 2 * SPB_CAPTURE_RECORD_SIZE(DEFAULT_SPB_BUFFER_SIZE))
+    {
+        SpbContext->Capture.Ring = ExAllocatePoolWithTag(
+            NonPagedPoolNx,
+            captureSize,
+            TOUCH_POOL_TAG);
+
+        if (SpbContext->Capture.Ring != NULL)
+        {
+            SpbContext->Capture.Size = captureSize;
+        }
+        else
+        {
+            Trace(
+                TRACE_LEVEL_WARNING,
+                TRACE_SPB,
+                "Could not allocate %d byte bus capture ring, capture is off",
+                captureSize);
+        }
+    }
+
 exit:
 
     if (!NT_SUCCESS(status))
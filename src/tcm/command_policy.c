@@ -0,0 +1,182 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		command_policy.c
+
+	Abstract:
+
+		Per-command response timeouts and retry policies for TCM
+		commands, and the statistics TcmWriteMessage keeps for them.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <controller.h>
+#include <spb.h>
+#include <tcm/touch_tcm.h>
+#include <command_policy.tmh>
+
+#define RETRY_NOT_EXECUTED	(TCM_RETRY_BUSY | TCM_RETRY_PENDING)
+#define RETRY_ALL			(TCM_RETRY_BUSY | TCM_RETRY_PENDING | TCM_RETRY_TIMEOUT)
+
+//
+// Commands that change state in a way that cannot be repeated blindly
+// (reset, flash erase and write, production test) are never resent
+// after a timeout, the controller may have executed them. The last
+// entry is used for commands not listed.
+//
+static const TCM_COMMAND_POLICY TcmCommandPolicies[] =
+{
+	// Command                              Retries Flags               Timeout                 Backoff BackoffMax
+	{ CMD_IDENTIFY,                         2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_RESET,                            1,      RETRY_NOT_EXECUTED, RESPONSE_TIMEOUT,       10,     10 },
+	{ CMD_ENABLE_REPORT,                    2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_DISABLE_REPORT,                   2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_GET_BOOT_INFO,                    2,      RETRY_ALL,          RESPONSE_TIMEOUT_LONG,  10,     40 },
+	{ CMD_ERASE_FLASH,                      2,      RETRY_NOT_EXECUTED, RESPONSE_TIMEOUT_LONG,  20,     80 },
+	{ CMD_WRITE_FLASH,                      2,      RETRY_NOT_EXECUTED, RESPONSE_TIMEOUT_LONG,  10,     40 },
+	{ CMD_READ_FLASH,                       2,      RETRY_ALL,          RESPONSE_TIMEOUT_LONG,  10,     40 },
+	{ CMD_RUN_APPLICATION_FIRMWARE,         1,      RETRY_NOT_EXECUTED, RESPONSE_TIMEOUT,       10,     10 },
+	{ CMD_RUN_BOOTLOADER_FIRMWARE,          1,      RETRY_NOT_EXECUTED, RESPONSE_TIMEOUT,       10,     10 },
+	{ CMD_GET_APPLICATION_INFO,             4,      RETRY_ALL,          RESPONSE_TIMEOUT_LONG,  10,     80 },
+	{ CMD_GET_STATIC_CONFIG,                2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_SET_STATIC_CONFIG,                2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_GET_DYNAMIC_CONFIG,               2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_SET_DYNAMIC_CONFIG,               2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_GET_TOUCH_REPORT_CONFIG,          2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_SET_TOUCH_REPORT_CONFIG,          2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_REZERO,                           2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_DESCRIBE_DYNAMIC_CONFIG,          2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_PRODUCTION_TEST,                  1,      RETRY_NOT_EXECUTED, RESPONSE_TIMEOUT_LONG,  20,     20 },
+	{ CMD_ENTER_DEEP_SLEEP,                 2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_EXIT_DEEP_SLEEP,                  2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_GET_TOUCH_INFO,                   2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_GET_FEATURES,                     2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_ENTER_PRODUCTION_TEST_MODE,       1,      RETRY_NOT_EXECUTED, RESPONSE_TIMEOUT,       10,     10 },
+	{ CMD_GET_ROMBOOT_INFO,                 2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_WRITE_PROGRAM_RAM,                2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_ROMBOOT_RUN_BOOTLOADER_FIRMWARE,  1,      RETRY_NOT_EXECUTED, RESPONSE_TIMEOUT,       10,     10 },
+	{ CMD_SET_LGE_GESTURE_CONFIG,           2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_GET_LGE_GESTURE_FAILREASON,       2,      RETRY_ALL,          RESPONSE_TIMEOUT,       5,      20 },
+	{ CMD_NONE,                             1,      RETRY_NOT_EXECUTED, RESPONSE_TIMEOUT,       5,      20 },
+};
+
+C_ASSERT(ARRAYSIZE(TcmCommandPolicies) <= TCM_MAX_COMMAND_POLICIES);
+
+ULONG
+TcmGetCommandPolicy(
+	IN UINT8 Command,
+	OUT const TCM_COMMAND_POLICY** Policy
+)
+/*++
+
+Routine Description:
+
+	Looks up the policy of a command.
+
+Arguments:
+
+	Command - TCM command id
+
+	Policy - Receives the policy, the default one if the command has
+	no entry of its own
+
+Return Value:
+
+	Index of the policy, which is also the index of the command's
+	entry in the controller's CommandStats
+
+--*/
+{
+	ULONG i;
+
+	for (i = 0; i < ARRAYSIZE(TcmCommandPolicies) - 1; i++) {
+		if (TcmCommandPolicies[i].Command == Command) {
+			break;
+		}
+	}
+
+	*Policy = &TcmCommandPolicies[i];
+	return i;
+}
+
+VOID
+TcmCommandBackoff(
+	IN const TCM_COMMAND_POLICY* Policy,
+	IN ULONG Retry
+)
+/*++
+
+Routine Description:
+
+	Waits before a retry. The first retry waits Backoff ms, every
+	further one twice as long as the one before, up to BackoffMax.
+
+Arguments:
+
+	Policy - Policy of the command being retried
+
+	Retry - Number of the retry about to be made, starting at 1
+
+Return Value:
+
+	None
+
+--*/
+{
+	LARGE_INTEGER Delay;
+	ULONG Ms = Policy->Backoff;
+
+	while (--Retry > 0 && Ms < Policy->BackoffMax) {
+		Ms *= 2;
+	}
+
+	Ms = MIN(Ms, Policy->BackoffMax);
+
+	if (Ms == 0) {
+		return;
+	}
+
+	Delay.QuadPart = -10 * 1000 * (LONGLONG)Ms;
+	KeDelayExecutionThread(KernelMode, FALSE, &Delay);
+}
+
+VOID
+TcmCommandStatsTrace(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	TCM_COMMAND_STATS* Stats;
+	ULONG i;
+
+	for (i = 0; i < ARRAYSIZE(TcmCommandPolicies); i++) {
+		Stats = &ControllerContext->CommandStats[i];
+
+		if (Stats->Sent == 0) {
+			continue;
+		}
+
+		Trace(
+			TRACE_LEVEL_INFORMATION,
+			TRACE_DRIVER,
+			"Command 0x%02x: %d sent, %d failed, %d retries (%d busy, %d pending, %d timeouts, %d late), avg %d us, max %d us",
+			TcmCommandPolicies[i].Command,
+			Stats->Sent,
+			Stats->Failed,
+			Stats->Retries,
+			Stats->Busy,
+			Stats->Pending,
+			Stats->Timeouts,
+			Stats->LateResponses,
+			(ULONG)(Stats->TotalLatencyUs / Stats->Sent),
+			Stats->MaxLatencyUs);
+	}
+}
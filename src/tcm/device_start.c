@@ -0,0 +1,581 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		device_start.c
+
+	Abstract:
+
+		Brings the controller up after prepare hardware has returned.
+		Only the identify report is read synchronously, everything that
+		waits on the controller (IC info, firmware update, report config)
+		runs as a state machine on a work item. Touch reports flow as
+		soon as the report config is in place; the optional setup after
+		that no longer delays the first touch.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <internal.h>
+#include <controller.h>
+#include <spb.h>
+#include <tcm/touch_tcm.h>
+#include <device_start.tmh>
+
+#define DEVICE_START_REG_KEY L"\\Registry\\Machine\\SYSTEM\\TOUCH\\Settings"
+
+typedef struct _DEVICE_START_OBJECT_CONTEXT
+{
+	TCM_CONTROLLER_CONTEXT* ControllerContext;
+} DEVICE_START_OBJECT_CONTEXT, *PDEVICE_START_OBJECT_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_START_OBJECT_CONTEXT, GetDeviceStartObjectContext)
+
+EVT_WDF_WORKITEM TcmDeviceStartWorkItem;
+
+static ULONG
+TcmDeviceStartElapsedMs(
+	IN TCM_DEVICE_START* Start
+)
+{
+	return (ULONG)((KeQueryInterruptTime() - Start->StartTime) / 10000);
+}
+
+static NTSTATUS
+TcmDeviceStartStep(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Runs the current bring-up state and moves on to the next one.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure, a failure ends bring-up
+
+--*/
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	NTSTATUS fwStatus;
+	TCM_DEVICE_START* Start = &ControllerContext->DeviceStart;
+	BOOLEAN updated = FALSE;
+
+	switch (Start->State) {
+		case TCM_START_FIRMWARE:
+			status = TcmGetIcInfo(ControllerContext,
+				SpbContext);
+
+			//
+			// Parts without application flash wait in ROM boot for the host
+			//
+			if (NT_SUCCESS(status) && ControllerContext->IDInfo.Mode == MODE_ROMBOOTLOADER) {
+				status = TcmHostDownload(ControllerContext, SpbContext);
+
+				//
+				// As after an update, the identify report of the downloaded
+				// firmware marked the controller as reset
+				//
+				if (NT_SUCCESS(status)) {
+					ControllerContext->ControllerState.Init = TRUE;
+				}
+			}
+
+			//
+			// Also picks up a controller left in its bootloader by an update
+			// that did not finish
+			//
+			fwStatus = TcmFirmwareUpdate(ControllerContext, SpbContext, &updated);
+
+			//
+			// Stopped by a D0 exit. The update is run again when bring-up
+			// resumes, and skips the pages already written.
+			//
+			if (fwStatus == STATUS_CANCELLED) {
+				break;
+			}
+
+			if (!NT_SUCCESS(fwStatus)) {
+				Trace(
+					TRACE_LEVEL_WARNING,
+					TRACE_INIT,
+					"Firmware update failed, keeping the current firmware");
+			}
+
+			if (updated) {
+				status = TcmGetIcInfo(ControllerContext,
+					SpbContext);
+
+				//
+				// The identify reports of the mode switches marked the
+				// controller as reset, bring-up configures it from here on
+				//
+				ControllerContext->ControllerState.Init = TRUE;
+			}
+
+			if (!NT_SUCCESS(status)) {
+				Trace(
+					TRACE_LEVEL_ERROR,
+					TRACE_INIT,
+					"Failed to get ic info - 0x%08lX",
+					status);
+				break;
+			}
+
+			Start->State = TCM_START_REPORT_CONFIG;
+			break;
+
+		case TCM_START_REPORT_CONFIG:
+			status = TcmGetReportConfig(ControllerContext,
+				SpbContext);
+
+			if (!NT_SUCCESS(status) || ControllerContext->ConfigData.DataLength == 0) {
+				Trace(
+					TRACE_LEVEL_ERROR,
+					TRACE_INIT,
+					"Failed to get report config - 0x%08lX",
+					status);
+				status = STATUS_UNSUCCESSFUL;
+				break;
+			}
+
+			//
+			// Trim the per-frame payload down to the fields we consume. The
+			// default config is kept if the firmware does not accept ours.
+			//
+			status = TcmSetReportConfig(ControllerContext,
+				SpbContext);
+
+			if (!NT_SUCCESS(status)) {
+				Trace(
+					TRACE_LEVEL_WARNING,
+					TRACE_INIT,
+					"Using default report config - 0x%08lX",
+					status);
+
+				if (ControllerContext->ConfigData.DataLength == 0) {
+					status = STATUS_UNSUCCESSFUL;
+					break;
+				}
+
+				status = STATUS_SUCCESS;
+			}
+
+			//
+			// The ISR parses touch reports against the config from here on
+			//
+			WdfWaitLockAcquire(ControllerContext->ControllerLock, NULL);
+			Start->ReportsEnabled = TRUE;
+			WdfWaitLockRelease(ControllerContext->ControllerLock);
+
+			Start->ReadyMs = TcmDeviceStartElapsedMs(Start);
+			InterlockedExchange(&Start->FirstTouchPending, TRUE);
+
+			Trace(
+				TRACE_LEVEL_INFORMATION,
+				TRACE_INIT,
+				"Touch reports enabled %d ms after start",
+				Start->ReadyMs);
+
+			Start->State = TCM_START_OPTIONAL;
+			break;
+
+		case TCM_START_OPTIONAL:
+			//
+			// Cached per firmware build, so this only costs a command the
+			// first time a given build is seen
+			//
+			if (!NT_SUCCESS(TcmDescribeDynamicConfig(ControllerContext, SpbContext))) {
+				Trace(
+					TRACE_LEVEL_WARNING,
+					TRACE_INIT,
+					"Dynamic config schema unavailable, using fixed ids");
+			}
+
+			if (!NT_SUCCESS(TcmSoftTouchStart(ControllerContext, SpbContext))) {
+				Trace(
+					TRACE_LEVEL_WARNING,
+					TRACE_INIT,
+					"Host side touch detection unavailable, using firmware reports");
+			}
+
+			Start->State = TCM_START_DONE;
+
+			Trace(
+				TRACE_LEVEL_INFORMATION,
+				TRACE_INIT,
+				"Device start completed in %d ms",
+				TcmDeviceStartElapsedMs(Start));
+			break;
+
+		default:
+			break;
+	}
+
+	return status;
+}
+
+static BOOLEAN
+TcmDeviceStartPolling(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	return ControllerContext->DevicePowerState != PowerDeviceD0;
+}
+
+static NTSTATUS
+TcmDeviceStartRun(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	TCM_DEVICE_START* Start = &ControllerContext->DeviceStart;
+
+	//
+	// Interrupts are not connected before D0 entry, read responses
+	// ourselves until then
+	//
+	ControllerContext->PollForResponse = TcmDeviceStartPolling(ControllerContext);
+
+	//
+	// A D0 exit in the middle of bring-up may have put the controller
+	// to sleep, wake it before carrying on where it stopped
+	//
+	if (ControllerContext->ControllerState.Power == TCM_POWER_SLEEP) {
+		status = TcmExitDeepSleep(ControllerContext, SpbContext);
+	}
+
+	while (NT_SUCCESS(status) &&
+		Start->Cancel == FALSE &&
+		TcmDeviceStartPending(ControllerContext)) {
+		//
+		// Once the ISR runs, polling would read the touch reports that
+		// come in between responses and drop them
+		//
+		ControllerContext->PollForResponse = TcmDeviceStartPolling(ControllerContext);
+		status = TcmDeviceStartStep(ControllerContext, SpbContext);
+	}
+
+	ControllerContext->PollForResponse = FALSE;
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Device start failed in state %d - 0x%08lX",
+			Start->State,
+			status);
+
+		Start->Status = status;
+		Start->State = TCM_START_FAILED;
+	}
+
+	return status;
+}
+
+VOID
+TcmDeviceStartWorkItem(
+	IN WDFWORKITEM WorkItem
+)
+/*++
+
+Routine Description:
+
+	Runs bring-up until it completes, fails or is stopped by a D0
+	exit. A failed bring-up fails the device, as a failed prepare
+	hardware did before.
+
+Arguments:
+
+	WorkItem - Handle to a WDF workitem object
+
+Return Value:
+
+	None
+
+--*/
+{
+	TCM_CONTROLLER_CONTEXT* controller;
+	PDEVICE_EXTENSION devContext;
+
+	controller = GetDeviceStartObjectContext(WorkItem)->ControllerContext;
+	devContext = GetDeviceContext(controller->FxDevice);
+
+	if (!TcmDeviceStartPending(controller)) {
+		return;
+	}
+
+	if (!NT_SUCCESS(TcmDeviceStartRun(controller, &devContext->I2CContext))) {
+		WdfDeviceSetFailed(controller->FxDevice, WdfDeviceFailedNoRestart);
+	}
+}
+
+NTSTATUS
+TcmDeviceStartBegin(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Starts bring-up once the identify report has been read. Without a
+	work item (AsynchronousStart set to 0, or creating it failed)
+	bring-up runs to completion before this returns.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure. Failures of asynchronous
+	bring-up are reported by failing the device instead.
+
+--*/
+{
+	TCM_DEVICE_START* Start = &ControllerContext->DeviceStart;
+
+	Start->State = TCM_START_FIRMWARE;
+	Start->Cancel = FALSE;
+
+	if (Start->WorkItem == NULL) {
+		return TcmDeviceStartRun(ControllerContext, SpbContext);
+	}
+
+	WdfWorkItemEnqueue(Start->WorkItem);
+
+	return STATUS_SUCCESS;
+}
+
+BOOLEAN
+TcmDeviceStartPending(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	LONG State = ControllerContext->DeviceStart.State;
+
+	return State != TCM_START_IDLE &&
+		State != TCM_START_DONE &&
+		State != TCM_START_FAILED;
+}
+
+VOID
+TcmDeviceStartResume(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Continues a bring-up stopped by a D0 exit. Called on D0 entry
+	instead of reinitializing the controller, bring-up configures it
+	anyway.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None
+
+--*/
+{
+	TCM_DEVICE_START* Start = &ControllerContext->DeviceStart;
+
+	if (Start->WorkItem == NULL || !TcmDeviceStartPending(ControllerContext)) {
+		return;
+	}
+
+	InterlockedExchange(&Start->Cancel, FALSE);
+
+	//
+	// Enqueueing a work item that is still running runs it once more,
+	// which returns right away if bring-up completed in the meantime
+	//
+	WdfWorkItemEnqueue(Start->WorkItem);
+}
+
+VOID
+TcmDeviceStartStop(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Stops bring-up after the step in progress, before the controller
+	leaves D0 or the device is stopped. Bring-up keeps its state and
+	is resumed on the next D0 entry.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None
+
+--*/
+{
+	TCM_DEVICE_START* Start = &ControllerContext->DeviceStart;
+
+	if (Start->WorkItem == NULL) {
+		return;
+	}
+
+	InterlockedExchange(&Start->Cancel, TRUE);
+	WdfWorkItemFlush(Start->WorkItem);
+}
+
+VOID
+TcmDeviceStartTouchReported(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN DETECTED_OBJECTS* Data
+)
+/*++
+
+Routine Description:
+
+	Called for every touch frame reported to HID. Records the time
+	from device start to the first frame with a contact, which
+	includes however long it took for someone to touch the panel.
+	Frames read while polling for a response are dropped and do not
+	count.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	Data - Decoded touch frame
+
+Return Value:
+
+	None
+
+--*/
+{
+	TCM_DEVICE_START* Start = &ControllerContext->DeviceStart;
+	int i;
+
+	if (Start->FirstTouchPending == FALSE) {
+		return;
+	}
+
+	for (i = 0; i < MAX_FINGER; i++) {
+		if (Data->States[i] != OBJECT_STATE_NOT_PRESENT) {
+			break;
+		}
+	}
+
+	if (i == MAX_FINGER ||
+		InterlockedExchange(&Start->FirstTouchPending, FALSE) == FALSE) {
+		return;
+	}
+
+	Start->FirstTouchMs = TcmDeviceStartElapsedMs(Start);
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_INIT,
+		"First touch %d ms after start (reports enabled after %d ms)",
+		Start->FirstTouchMs,
+		Start->ReadyMs);
+}
+
+NTSTATUS
+TcmDeviceStartInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Creates the bring-up work item. Setting the AsynchronousStart
+	registry value to 0 keeps the whole bring-up in prepare hardware.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	NTSTATUS status;
+	TCM_DEVICE_START* Start = &ControllerContext->DeviceStart;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDF_WORKITEM_CONFIG workItemConfig;
+	DWORD asynchronous = 1;
+
+	RtlReadRegistryValue(
+		DEVICE_START_REG_KEY,
+		L"AsynchronousStart",
+		REG_DWORD,
+		&asynchronous,
+		sizeof(DWORD));
+
+	if (asynchronous == 0) {
+		return STATUS_SUCCESS;
+	}
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, DEVICE_START_OBJECT_CONTEXT);
+	attributes.ParentObject = ControllerContext->FxDevice;
+
+	WDF_WORKITEM_CONFIG_INIT(&workItemConfig, TcmDeviceStartWorkItem);
+
+	status = WdfWorkItemCreate(
+		&workItemConfig,
+		&attributes,
+		&Start->WorkItem);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Error creating device start work item - 0x%08lX",
+			status);
+		Start->WorkItem = NULL;
+		return status;
+	}
+
+	GetDeviceStartObjectContext(Start->WorkItem)->ControllerContext = ControllerContext;
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+TcmDeviceStartDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	TCM_DEVICE_START* Start = &ControllerContext->DeviceStart;
+
+	if (Start->WorkItem != NULL) {
+		InterlockedExchange(&Start->Cancel, TRUE);
+		WdfWorkItemFlush(Start->WorkItem);
+		WdfObjectDelete(Start->WorkItem);
+		Start->WorkItem = NULL;
+	}
+}
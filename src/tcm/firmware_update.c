@@ -0,0 +1,883 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		firmware_update.c
+
+	Abstract:
+
+		Brings the controller flash in line with the firmware image of
+		the panel vendor. Every erase page of the image is compared with
+		the flash by CRC, and only pages that differ are erased, written
+		and read back.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <controller.h>
+#include <spb.h>
+#include <tcm/touch_tcm.h>
+#include <firmware_update.tmh>
+
+#define FIRMWARE_REG_KEY L"\\Registry\\Machine\\SYSTEM\\TOUCH\\Settings"
+
+C_ASSERT(FIELD_OFFSET(TOUCH_SCREEN_SETTINGS, Vendor03) -
+	FIELD_OFFSET(TOUCH_SCREEN_SETTINGS, Vendor00) == 3 * sizeof(UINT32));
+C_ASSERT(FIELD_OFFSET(TOUCH_SCREEN_SETTINGS, ReprogramFw03) -
+	FIELD_OFFSET(TOUCH_SCREEN_SETTINGS, ReprogramFw00) == 3 * sizeof(UINT32));
+
+static const PCWSTR FirmwareImagePaths[] = {
+	L"\\SystemRoot\\System32\\Drivers\\SynapticsTouchFw00.img",
+	L"\\SystemRoot\\System32\\Drivers\\SynapticsTouchFw01.img",
+	L"\\SystemRoot\\System32\\Drivers\\SynapticsTouchFw02.img",
+	L"\\SystemRoot\\System32\\Drivers\\SynapticsTouchFw03.img",
+};
+
+typedef struct _TCM_FIRMWARE_STATS
+{
+	ULONG PagesChecked;
+	ULONG PagesWritten;
+} TCM_FIRMWARE_STATS;
+
+static BOOLEAN
+TcmFwFindVendor(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	OUT ULONG* Vendor
+)
+{
+	TOUCH_SCREEN_SETTINGS* Settings = &ControllerContext->TouchSettings;
+	UINT32* Vendors = &Settings->Vendor00;
+	UINT32* Reprogram = &Settings->ReprogramFw00;
+	ULONG Count = MIN(Settings->VendorCount, ARRAYSIZE(FirmwareImagePaths));
+	ULONG i;
+
+	//
+	// The running application tells us the panel supplier. Without one
+	// (bootloader only, or a bad config) fall back to the first vendor
+	// that may be reprogrammed, which is what an earlier interrupted
+	// update of this device was flashing.
+	//
+	if (ControllerContext->IDInfo.Mode == MODE_APPLICATION_FIRMWARE &&
+		ControllerContext->AppInfo.Status == APP_STATUS_OK) {
+		for (i = 0; i < Count; i++) {
+			if (Vendors[i] == ControllerContext->AppInfo.CustomerConfigID.Supplier) {
+				*Vendor = i;
+				return Reprogram[i] != 0;
+			}
+		}
+
+		return FALSE;
+	}
+
+	for (i = 0; i < Count; i++) {
+		if (Reprogram[i] != 0) {
+			*Vendor = i;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+NTSTATUS
+TcmLoadFirmwareImage(
+	IN PCWSTR Path,
+	OUT UINT8** Image,
+	OUT ULONG* Length
+)
+/*++
+
+Routine Description:
+
+	Reads a firmware image file into non paged memory, which the
+	caller frees with ExFreePoolWithTag(TOUCH_POOL_TAG).
+
+Arguments:
+
+	Path - NT path of the image file
+
+	Image - Receives the image
+
+	Length - Receives the size of the image in bytes
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	NTSTATUS status;
+	UNICODE_STRING FileName;
+	OBJECT_ATTRIBUTES Attributes;
+	IO_STATUS_BLOCK IoStatus;
+	FILE_STANDARD_INFORMATION Info;
+	HANDLE File = NULL;
+	UINT8* Buffer = NULL;
+
+	*Image = NULL;
+	*Length = 0;
+
+	RtlInitUnicodeString(&FileName, Path);
+	InitializeObjectAttributes(&Attributes,
+		&FileName,
+		OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+		NULL,
+		NULL);
+
+	status = ZwCreateFile(&File,
+		GENERIC_READ,
+		&Attributes,
+		&IoStatus,
+		NULL,
+		FILE_ATTRIBUTE_NORMAL,
+		FILE_SHARE_READ,
+		FILE_OPEN,
+		FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE,
+		NULL,
+		0);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_INIT,
+			"No firmware image at %ws - 0x%08lX",
+			Path,
+			status);
+		goto exit;
+	}
+
+	status = ZwQueryInformationFile(File,
+		&IoStatus,
+		&Info,
+		sizeof(Info),
+		FileStandardInformation);
+
+	if (!NT_SUCCESS(status)) {
+		goto exit;
+	}
+
+	if (Info.EndOfFile.QuadPart < sizeof(TCM_IMAGE_HEADER) ||
+		Info.EndOfFile.QuadPart > FIRMWARE_IMAGE_MAX_SIZE) {
+		status = STATUS_INVALID_IMAGE_FORMAT;
+		goto exit;
+	}
+
+	Buffer = ExAllocatePoolWithTag(
+		NonPagedPoolNx,
+		Info.EndOfFile.LowPart,
+		TOUCH_POOL_TAG);
+
+	if (Buffer == NULL) {
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto exit;
+	}
+
+	status = ZwReadFile(File,
+		NULL,
+		NULL,
+		NULL,
+		&IoStatus,
+		Buffer,
+		Info.EndOfFile.LowPart,
+		NULL,
+		NULL);
+
+	if (!NT_SUCCESS(status) || IoStatus.Information != Info.EndOfFile.LowPart) {
+		status = NT_SUCCESS(status) ? STATUS_END_OF_FILE : status;
+		goto exit;
+	}
+
+	*Image = Buffer;
+	*Length = Info.EndOfFile.LowPart;
+	Buffer = NULL;
+
+exit:
+	if (Buffer != NULL) {
+		ExFreePoolWithTag(Buffer, TOUCH_POOL_TAG);
+	}
+
+	if (File != NULL) {
+		ZwClose(File);
+	}
+
+	return status;
+}
+
+NTSTATUS
+TcmParseFirmwareImage(
+	_In_reads_bytes_(Length) UINT8* Image,
+	IN ULONG Length,
+	_In_reads_(IdCount) const CHAR* const* Ids,
+	IN ULONG IdCount,
+	OUT TCM_FIRMWARE_AREA* Areas,
+	OUT ULONG* AreaCount
+)
+/*++
+
+Routine Description:
+
+	Picks the areas with the given ids out of a firmware image. Every
+	offset and length in the image is checked against the image size
+	before it is used.
+
+Arguments:
+
+	Image - Firmware image file contents
+
+	Length - Size of Image in bytes
+
+	Ids - Area ids to pick, such as "APP_CODE"
+
+	IdCount - Number of entries in Ids
+
+	Areas - Receives up to FIRMWARE_MAX_AREAS areas
+
+	AreaCount - Receives the number of areas found
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	TCM_IMAGE_HEADER* Header = (TCM_IMAGE_HEADER*)Image;
+	TCM_AREA_DESCRIPTOR* Descriptor;
+	ULONG Offset, Count = 0, i, j;
+
+	*AreaCount = 0;
+
+	if (Length < sizeof(TCM_IMAGE_HEADER) || Header->Magic != FIRMWARE_IMAGE_MAGIC) {
+		return STATUS_INVALID_IMAGE_FORMAT;
+	}
+
+	if (Header->NumOfAreas > (Length - sizeof(TCM_IMAGE_HEADER)) / sizeof(UINT32)) {
+		return STATUS_INVALID_IMAGE_FORMAT;
+	}
+
+	for (i = 0; i < Header->NumOfAreas; i++) {
+		RtlCopyMemory(&Offset,
+			Image + sizeof(TCM_IMAGE_HEADER) + i * sizeof(UINT32),
+			sizeof(UINT32));
+
+		if (Offset > Length || Length - Offset < sizeof(TCM_AREA_DESCRIPTOR)) {
+			return STATUS_INVALID_IMAGE_FORMAT;
+		}
+
+		Descriptor = (TCM_AREA_DESCRIPTOR*)(Image + Offset);
+		if (Descriptor->Magic != FIRMWARE_AREA_MAGIC) {
+			continue;
+		}
+
+		for (j = 0; j < IdCount; j++) {
+			size_t IdLength = strlen(Ids[j]);
+
+			if (RtlCompareMemory(Descriptor->IdString, Ids[j], IdLength) == IdLength &&
+				(IdLength == sizeof(Descriptor->IdString) || Descriptor->IdString[IdLength] == 0)) {
+				break;
+			}
+		}
+
+		if (j == IdCount) {
+			continue;
+		}
+
+		if (Descriptor->Length == 0 || (Descriptor->Length & 1) ||
+			Descriptor->Length > Length - Offset - sizeof(TCM_AREA_DESCRIPTOR) ||
+			Descriptor->FlashAddressWords > MAXULONG / 2 ||
+			Count == FIRMWARE_MAX_AREAS) {
+			return STATUS_INVALID_IMAGE_FORMAT;
+		}
+
+		Areas[Count].Data = (UINT8*)(Descriptor + 1);
+		Areas[Count].Length = Descriptor->Length;
+		Areas[Count].Address = Descriptor->FlashAddressWords * 2;
+		Count++;
+	}
+
+	if (Count == 0) {
+		return STATUS_INVALID_IMAGE_FORMAT;
+	}
+
+	*AreaCount = Count;
+
+	return STATUS_SUCCESS;
+}
+
+static BOOLEAN
+TcmFwIsCurrent(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN ULONG ImageCrc
+)
+{
+	DWORD FlashedCrc = ~ImageCrc;
+	DWORD FlashedBuildId = ~ControllerContext->IDInfo.BuildId;
+
+	if (ControllerContext->IDInfo.Mode != MODE_APPLICATION_FIRMWARE ||
+		ControllerContext->AppInfo.Status != APP_STATUS_OK) {
+		return FALSE;
+	}
+
+	RtlReadRegistryValue(
+		FIRMWARE_REG_KEY,
+		L"FirmwareImageCrc",
+		REG_DWORD,
+		&FlashedCrc,
+		sizeof(DWORD));
+
+	RtlReadRegistryValue(
+		FIRMWARE_REG_KEY,
+		L"FirmwareBuildId",
+		REG_DWORD,
+		&FlashedBuildId,
+		sizeof(DWORD));
+
+	return FlashedCrc == ImageCrc && FlashedBuildId == ControllerContext->IDInfo.BuildId;
+}
+
+static VOID
+TcmFwSetCurrent(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN ULONG ImageCrc
+)
+{
+	DWORD BuildId = ControllerContext->IDInfo.BuildId;
+
+	RtlWriteRegistryValue(
+		RTL_REGISTRY_ABSOLUTE,
+		FIRMWARE_REG_KEY,
+		L"FirmwareImageCrc",
+		REG_DWORD,
+		&ImageCrc,
+		sizeof(DWORD));
+
+	RtlWriteRegistryValue(
+		RTL_REGISTRY_ABSOLUTE,
+		FIRMWARE_REG_KEY,
+		L"FirmwareBuildId",
+		REG_DWORD,
+		&BuildId,
+		sizeof(DWORD));
+}
+
+static NTSTATUS
+TcmFwGetBootInfo(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+{
+	NTSTATUS status;
+	TCM_BOOT_INFO* Info = &ControllerContext->BootInfo;
+
+	TcmLockCommands(ControllerContext);
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_GET_BOOT_INFO,
+		NULL,
+		0,
+		NULL,
+		NULL);
+
+	if (NT_SUCCESS(status)) {
+		RtlZeroMemory(Info, sizeof(TCM_BOOT_INFO));
+		RtlCopyMemory(Info,
+			ControllerContext->ResponseData.Buffer,
+			MIN(sizeof(TCM_BOOT_INFO), ControllerContext->ResponseData.DataLength));
+	}
+
+	TcmUnlockCommands(ControllerContext);
+
+	if (!NT_SUCCESS(status)) {
+		return status;
+	}
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_INIT,
+		"Boot info: write block %d words, erase page %d words, max write payload %d",
+		Info->WriteBlockSizeWords,
+		Info->ErasePageSizeWords,
+		Info->MaxWritePayloadSize);
+
+	if (Info->WriteBlockSizeWords == 0 || Info->ErasePageSizeWords == 0 ||
+		Info->MaxWritePayloadSize < Info->WriteBlockSizeWords * 2) {
+		return STATUS_DEVICE_CONFIGURATION_ERROR;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+TcmFwReadFlashCrc(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN ULONG Address,
+	IN ULONG Length,
+	OUT ULONG* Crc
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	UINT8 Payload[6];
+	ULONG Chunk, AddressWords, LengthWords;
+
+	*Crc = 0;
+
+	while (Length != 0) {
+		Chunk = MIN(Length, FIRMWARE_READ_CHUNK);
+		AddressWords = Address / 2;
+		LengthWords = Chunk / 2;
+
+		Payload[0] = (UINT8)AddressWords;
+		Payload[1] = (UINT8)(AddressWords >> 8);
+		Payload[2] = (UINT8)(AddressWords >> 16);
+		Payload[3] = (UINT8)(AddressWords >> 24);
+		Payload[4] = (UINT8)LengthWords;
+		Payload[5] = (UINT8)(LengthWords >> 8);
+
+		TcmLockCommands(ControllerContext);
+
+		status = TcmWriteMessage(ControllerContext,
+			SpbContext,
+			CMD_READ_FLASH,
+			Payload,
+			sizeof(Payload),
+			NULL,
+			NULL);
+
+		if (NT_SUCCESS(status)) {
+			if (ControllerContext->ResponseData.DataLength < Chunk) {
+				status = STATUS_DEVICE_PROTOCOL_ERROR;
+			}
+			else {
+				*Crc = RtlComputeCrc32(*Crc, ControllerContext->ResponseData.Buffer, Chunk);
+			}
+		}
+
+		TcmUnlockCommands(ControllerContext);
+
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		Address += Chunk;
+		Length -= Chunk;
+	}
+
+	return status;
+}
+
+static NTSTATUS
+TcmFwErase(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN ULONG Address,
+	IN ULONG Pages
+)
+{
+	ULONG PageSize = ControllerContext->BootInfo.ErasePageSizeWords * 2;
+	ULONG Page = Address / PageSize;
+	UINT8 Payload[4];
+	ULONG PayloadLength;
+
+	if (Page > 0xFF || Pages > 0xFF) {
+		Payload[0] = (UINT8)Page;
+		Payload[1] = (UINT8)(Page >> 8);
+		Payload[2] = (UINT8)Pages;
+		Payload[3] = (UINT8)(Pages >> 8);
+		PayloadLength = 4;
+	} else {
+		Payload[0] = (UINT8)Page;
+		Payload[1] = (UINT8)Pages;
+		PayloadLength = 2;
+	}
+
+	return TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_ERASE_FLASH,
+		Payload,
+		PayloadLength,
+		NULL,
+		NULL);
+}
+
+static NTSTATUS
+TcmFwWrite(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN ULONG Address,
+	_In_reads_bytes_(Length) UINT8* Data,
+	IN ULONG Length
+)
+/*++
+
+Routine Description:
+
+	Writes erased flash back to back in the largest chunks the
+	bootloader and the bus allow, a whole number of write blocks
+	each. Verification is left to the caller, once per erase run.
+
+--*/
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG BlockSize = ControllerContext->BootInfo.WriteBlockSizeWords * 2;
+	ULONG MaxChunk = ControllerContext->BootInfo.MaxWritePayloadSize;
+	ULONG Chunk, Block;
+	UINT8* Payload;
+
+	//
+	// Command, length and block address take 5 bytes of each bus write
+	//
+	if (ControllerContext->ChunkSize > 5) {
+		MaxChunk = MIN(MaxChunk, ControllerContext->ChunkSize - 5);
+	}
+
+	MaxChunk -= MaxChunk % BlockSize;
+	if (MaxChunk == 0) {
+		return STATUS_DEVICE_CONFIGURATION_ERROR;
+	}
+
+	Payload = ExAllocatePoolWithTag(
+		NonPagedPoolNx,
+		MaxChunk + 2,
+		TOUCH_POOL_TAG);
+
+	if (Payload == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	while (Length != 0) {
+		Chunk = MIN(Length, MaxChunk);
+		Block = Address / BlockSize;
+
+		Payload[0] = (UINT8)Block;
+		Payload[1] = (UINT8)(Block >> 8);
+		RtlCopyMemory(&Payload[2], Data, Chunk);
+
+		status = TcmWriteMessage(ControllerContext,
+			SpbContext,
+			CMD_WRITE_FLASH,
+			Payload,
+			Chunk + 2,
+			NULL,
+			NULL);
+
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		Address += Chunk;
+		Data += Chunk;
+		Length -= Chunk;
+	}
+
+	ExFreePoolWithTag(Payload, TOUCH_POOL_TAG);
+
+	return status;
+}
+
+static NTSTATUS
+TcmFwFlushRun(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN TCM_FIRMWARE_AREA* Area,
+	IN ULONG FirstPage,
+	IN ULONG Pages
+)
+{
+	NTSTATUS status;
+	ULONG PageSize = ControllerContext->BootInfo.ErasePageSizeWords * 2;
+	ULONG Offset = FirstPage * PageSize;
+	ULONG Length = MIN(Pages * PageSize, Area->Length - Offset);
+	ULONG PageLength, Crc, i;
+
+	status = TcmFwErase(ControllerContext,
+		SpbContext,
+		Area->Address + Offset,
+		Pages);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Failed to erase %d pages at 0x%08x - 0x%08lX",
+			Pages,
+			Area->Address + Offset,
+			status);
+		return status;
+	}
+
+	status = TcmFwWrite(ControllerContext,
+		SpbContext,
+		Area->Address + Offset,
+		Area->Data + Offset,
+		Length);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Failed to write 0x%x bytes at 0x%08x - 0x%08lX",
+			Length,
+			Area->Address + Offset,
+			status);
+		return status;
+	}
+
+	for (i = 0; i < Pages; i++, Offset += PageSize) {
+		PageLength = MIN(PageSize, Area->Length - Offset);
+
+		status = TcmFwReadFlashCrc(ControllerContext,
+			SpbContext,
+			Area->Address + Offset,
+			PageLength,
+			&Crc);
+
+		if (NT_SUCCESS(status) && Crc != RtlComputeCrc32(0, Area->Data + Offset, PageLength)) {
+			status = STATUS_DEVICE_DATA_ERROR;
+		}
+
+		if (!NT_SUCCESS(status)) {
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_INIT,
+				"Verify failed at 0x%08x - 0x%08lX",
+				Area->Address + Offset,
+				status);
+			return status;
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+TcmFwUpdateArea(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN TCM_FIRMWARE_AREA* Area,
+	IN BOOLEAN Force,
+	IN OUT TCM_FIRMWARE_STATS* Stats
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG PageSize = ControllerContext->BootInfo.ErasePageSizeWords * 2;
+	ULONG PageCount, PageLength, Crc, Page;
+	ULONG RunStart = 0, RunPages = 0;
+
+	if (Area->Address % PageSize != 0) {
+		return STATUS_INVALID_IMAGE_FORMAT;
+	}
+
+	PageCount = ceil_div(Area->Length, PageSize);
+
+	for (Page = 0; Page < PageCount; Page++) {
+		//
+		// A D0 exit stops bring-up, and with it the update, between
+		// pages. The run in progress is left unwritten, the next
+		// attempt finds those pages still differ.
+		//
+		if (ControllerContext->DeviceStart.Cancel) {
+			return STATUS_CANCELLED;
+		}
+
+		PageLength = MIN(PageSize, Area->Length - Page * PageSize);
+		Stats->PagesChecked++;
+
+		if (!Force) {
+			status = TcmFwReadFlashCrc(ControllerContext,
+				SpbContext,
+				Area->Address + Page * PageSize,
+				PageLength,
+				&Crc);
+
+			if (!NT_SUCCESS(status)) {
+				return status;
+			}
+
+			if (Crc == RtlComputeCrc32(0, Area->Data + Page * PageSize, PageLength)) {
+				//
+				// Unchanged, close the pending run
+				//
+				if (RunPages != 0) {
+					status = TcmFwFlushRun(ControllerContext, SpbContext, Area, RunStart, RunPages);
+					if (!NT_SUCCESS(status)) {
+						return status;
+					}
+					RunPages = 0;
+				}
+				continue;
+			}
+		}
+
+		if (RunPages == 0) {
+			RunStart = Page;
+		}
+
+		RunPages++;
+		Stats->PagesWritten++;
+
+		if (RunPages == FIRMWARE_MAX_ERASE_PAGES) {
+			status = TcmFwFlushRun(ControllerContext, SpbContext, Area, RunStart, RunPages);
+			if (!NT_SUCCESS(status)) {
+				return status;
+			}
+			RunPages = 0;
+		}
+	}
+
+	if (RunPages != 0) {
+		status = TcmFwFlushRun(ControllerContext, SpbContext, Area, RunStart, RunPages);
+	}
+
+	return status;
+}
+
+NTSTATUS
+TcmFirmwareUpdate(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	OUT BOOLEAN* Updated
+)
+/*++
+
+Routine Description:
+
+	Updates the controller flash from the firmware image of the panel
+	vendor if ReprogramFw0x is set for it. Only erase pages whose CRC
+	differs from the flash are rewritten, unless ForceFlash is set.
+	Checking the flash takes the controller through its bootloader,
+	so it is skipped when this image was the last one verified and
+	the controller still runs the build it produced.
+	The controller is left in application mode after an update, or in
+	its bootloader if the update failed so the next start retries.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+	Updated - Set if the controller went through its bootloader and
+	the caller needs to refresh the IC info
+
+Return Value:
+
+	NTSTATUS indicating success or failure. Having nothing to update
+	is success.
+
+--*/
+{
+	static const CHAR* const FlashAreas[] = { "APP_CODE", "APP_CONFIG" };
+	NTSTATUS status;
+	TCM_FIRMWARE_AREA Areas[FIRMWARE_MAX_AREAS];
+	TCM_FIRMWARE_STATS Stats = { 0 };
+	BOOLEAN Force = ControllerContext->TouchSettings.ForceFlash != 0;
+	UINT8* Image = NULL;
+	ULONG ImageLength, ImageCrc, AreaCount, Vendor, i;
+	ULONGLONG Start;
+
+	*Updated = FALSE;
+
+	//
+	// Host download parts have no application flash
+	//
+	if (ControllerContext->IDInfo.Mode == MODE_HOSTDOWNLOAD_FIRMWARE) {
+		return STATUS_SUCCESS;
+	}
+
+	if (!TcmFwFindVendor(ControllerContext, &Vendor)) {
+		return STATUS_SUCCESS;
+	}
+
+	status = TcmLoadFirmwareImage(FirmwareImagePaths[Vendor], &Image, &ImageLength);
+	if (!NT_SUCCESS(status)) {
+		return status;
+	}
+
+	status = TcmParseFirmwareImage(Image,
+		ImageLength,
+		FlashAreas,
+		ARRAYSIZE(FlashAreas),
+		Areas,
+		&AreaCount);
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Firmware image for vendor %d is invalid - 0x%08lX",
+			Vendor,
+			status);
+		goto exit;
+	}
+
+	ImageCrc = RtlComputeCrc32(0, Image, ImageLength);
+	if (!Force && TcmFwIsCurrent(ControllerContext, ImageCrc)) {
+		goto exit;
+	}
+
+	Start = KeQueryInterruptTime();
+	*Updated = TRUE;
+
+	if (ControllerContext->IDInfo.Mode != MODE_BOOTLOADER &&
+		ControllerContext->IDInfo.Mode != MODE_TDDI_BOOTLOADER) {
+		status = TcmSwitchMode(ControllerContext, SpbContext, MODE_BOOTLOADER);
+		if (!NT_SUCCESS(status)) {
+			goto exit;
+		}
+
+		if (ControllerContext->IDInfo.Mode != MODE_BOOTLOADER &&
+			ControllerContext->IDInfo.Mode != MODE_TDDI_BOOTLOADER) {
+			status = STATUS_DEVICE_NOT_READY;
+			goto exit;
+		}
+	}
+
+	status = TcmFwGetBootInfo(ControllerContext, SpbContext);
+	if (!NT_SUCCESS(status)) {
+		goto exit;
+	}
+
+	for (i = 0; i < AreaCount; i++) {
+		status = TcmFwUpdateArea(ControllerContext, SpbContext, &Areas[i], Force, &Stats);
+		if (!NT_SUCCESS(status)) {
+			goto exit;
+		}
+	}
+
+	status = TcmSwitchMode(ControllerContext, SpbContext, MODE_APPLICATION_FIRMWARE);
+	if (NT_SUCCESS(status)) {
+		TcmFwSetCurrent(ControllerContext, ImageCrc);
+	}
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_INIT,
+		"Firmware update for vendor %d: %d of %d pages written in %d ms - 0x%08lX",
+		Vendor,
+		Stats.PagesWritten,
+		Stats.PagesChecked,
+		(ULONG)((KeQueryInterruptTime() - Start) / 10000),
+		status);
+
+exit:
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Firmware update for vendor %d failed after %d pages - 0x%08lX",
+			Vendor,
+			Stats.PagesWritten,
+			status);
+	}
+
+	ExFreePoolWithTag(Image, TOUCH_POOL_TAG);
+
+	return status;
+}
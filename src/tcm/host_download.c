@@ -0,0 +1,306 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		host_download.c
+
+	Abstract:
+
+		Boots controllers that have no application flash. They come up
+		in their ROM bootloader after every power up or reset, and the
+		firmware is written into program RAM from the host before it is
+		started. The image is read from disk once and kept for the
+		lifetime of the device, so later resets only pay for the bus
+		transfers.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <controller.h>
+#include <spb.h>
+#include <tcm/touch_tcm.h>
+#include <host_download.tmh>
+
+#define HOST_DOWNLOAD_IMAGE_PATH L"\\SystemRoot\\System32\\Drivers\\SynapticsTouchHdl.img"
+
+NTSTATUS
+TcmGetRomBootInfo(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+{
+	NTSTATUS status;
+	TCM_ROMBOOT_INFO* Info = &ControllerContext->RomBootInfo;
+
+	TcmLockCommands(ControllerContext);
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_GET_ROMBOOT_INFO,
+		NULL,
+		0,
+		NULL,
+		NULL);
+
+	if (NT_SUCCESS(status)) {
+		RtlZeroMemory(Info, sizeof(TCM_ROMBOOT_INFO));
+		RtlCopyMemory(Info,
+			ControllerContext->ResponseData.Buffer,
+			MIN(sizeof(TCM_ROMBOOT_INFO), ControllerContext->ResponseData.DataLength));
+	}
+
+	TcmUnlockCommands(ControllerContext);
+
+	if (!NT_SUCCESS(status)) {
+		return status;
+	}
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_INIT,
+		"ROM boot info: ASIC 0x%04x, write block %d words, max write payload %d",
+		Info->ASICID,
+		Info->WriteBlockSizeWords,
+		Info->MaxWritePayloadSize);
+
+	if (Info->WriteBlockSizeWords == 0 ||
+		Info->MaxWritePayloadSize < Info->WriteBlockSizeWords * 2) {
+		return STATUS_DEVICE_CONFIGURATION_ERROR;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+TcmHostDownloadPrepare(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Loads and parses the host download image on first use, and sizes
+	the payload buffer for the largest transfer the ROM bootloader
+	and the bus allow. Both are kept across resets.
+
+--*/
+{
+	static const CHAR* const DownloadAreas[] = { "ROMBOOT_APP_CODE" };
+	NTSTATUS status;
+	TCM_HOST_DOWNLOAD* Download = &ControllerContext->HostDownload;
+	ULONG BlockSize = ControllerContext->RomBootInfo.WriteBlockSizeWords * 2;
+	ULONG MaxChunk = ControllerContext->RomBootInfo.MaxWritePayloadSize;
+
+	if (Download->Image == NULL) {
+		status = TcmLoadFirmwareImage(HOST_DOWNLOAD_IMAGE_PATH,
+			&Download->Image,
+			&Download->ImageLength);
+
+		if (!NT_SUCCESS(status)) {
+			return status;
+		}
+
+		status = TcmParseFirmwareImage(Download->Image,
+			Download->ImageLength,
+			DownloadAreas,
+			ARRAYSIZE(DownloadAreas),
+			Download->Areas,
+			&Download->AreaCount);
+
+		if (!NT_SUCCESS(status)) {
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_INIT,
+				"Host download image is invalid - 0x%08lX",
+				status);
+			TcmHostDownloadDeinitialize(ControllerContext);
+			return status;
+		}
+	}
+
+	//
+	// Command, length and block address take 5 bytes of each bus write
+	//
+	if (ControllerContext->ChunkSize > 5) {
+		MaxChunk = MIN(MaxChunk, ControllerContext->ChunkSize - 5);
+	}
+
+	MaxChunk -= MaxChunk % BlockSize;
+	if (MaxChunk == 0) {
+		return STATUS_DEVICE_CONFIGURATION_ERROR;
+	}
+
+	if (Download->Payload != NULL && Download->PayloadSize != MaxChunk) {
+		ExFreePoolWithTag(Download->Payload, TOUCH_POOL_TAG);
+		Download->Payload = NULL;
+	}
+
+	if (Download->Payload == NULL) {
+		Download->Payload = ExAllocatePoolWithTag(
+			NonPagedPoolNx,
+			MaxChunk + 2,
+			TOUCH_POOL_TAG);
+
+		if (Download->Payload == NULL) {
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		Download->PayloadSize = MaxChunk;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+TcmHostDownload(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Writes the firmware into program RAM of a controller waiting in
+	its ROM bootloader and starts it. Every transfer carries as much
+	of the image as the ROM bootloader accepts.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure. The IC info is refreshed
+	for the downloaded firmware on success.
+
+--*/
+{
+	NTSTATUS status;
+	TCM_HOST_DOWNLOAD* Download = &ControllerContext->HostDownload;
+	TCM_FIRMWARE_AREA* Area;
+	ULONG BlockSize, Offset, Chunk, Block, Bytes = 0, i;
+	ULONGLONG Start = KeQueryInterruptTime();
+
+	if (ControllerContext->IDInfo.Mode != MODE_ROMBOOTLOADER) {
+		return STATUS_SUCCESS;
+	}
+
+	status = TcmHostDownloadPrepare(ControllerContext);
+	if (!NT_SUCCESS(status)) {
+		goto exit;
+	}
+
+	BlockSize = ControllerContext->RomBootInfo.WriteBlockSizeWords * 2;
+
+	for (i = 0; i < Download->AreaCount; i++) {
+		Area = &Download->Areas[i];
+
+		if (Area->Address % BlockSize != 0) {
+			status = STATUS_INVALID_IMAGE_FORMAT;
+			goto exit;
+		}
+
+		for (Offset = 0; Offset < Area->Length; Offset += Chunk) {
+			Chunk = MIN(Area->Length - Offset, Download->PayloadSize);
+			Block = (Area->Address + Offset) / BlockSize;
+
+			Download->Payload[0] = (UINT8)Block;
+			Download->Payload[1] = (UINT8)(Block >> 8);
+			RtlCopyMemory(&Download->Payload[2], Area->Data + Offset, Chunk);
+
+			status = TcmWriteMessage(ControllerContext,
+				SpbContext,
+				CMD_WRITE_PROGRAM_RAM,
+				Download->Payload,
+				Chunk + 2,
+				NULL,
+				NULL);
+
+			if (!NT_SUCCESS(status)) {
+				Trace(
+					TRACE_LEVEL_ERROR,
+					TRACE_INIT,
+					"Failed to write program RAM at 0x%08x - 0x%08lX",
+					Area->Address + Offset,
+					status);
+				goto exit;
+			}
+
+			Bytes += Chunk;
+		}
+	}
+
+	//
+	// Completed by the identify report of the downloaded firmware
+	//
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_ROMBOOT_RUN_BOOTLOADER_FIRMWARE,
+		NULL,
+		0,
+		NULL,
+		NULL);
+
+	if (!NT_SUCCESS(status)) {
+		goto exit;
+	}
+
+	if (ControllerContext->IDInfo.Mode != MODE_HOSTDOWNLOAD_FIRMWARE &&
+		ControllerContext->IDInfo.Mode != MODE_APPLICATION_FIRMWARE) {
+		status = STATUS_DEVICE_NOT_READY;
+		goto exit;
+	}
+
+	status = TcmGetIcInfo(ControllerContext, SpbContext);
+
+	Download->Downloads++;
+	Download->LastDownloadMs = (ULONG)((KeQueryInterruptTime() - Start) / 10000);
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_INIT,
+		"Host download #%d: %d bytes in %d ms - 0x%08lX",
+		Download->Downloads,
+		Bytes,
+		Download->LastDownloadMs,
+		status);
+
+exit:
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Host download failed after %d bytes - 0x%08lX",
+			Bytes,
+			status);
+	}
+
+	return status;
+}
+
+VOID
+TcmHostDownloadDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	TCM_HOST_DOWNLOAD* Download = &ControllerContext->HostDownload;
+
+	if (Download->Payload != NULL) {
+		ExFreePoolWithTag(Download->Payload, TOUCH_POOL_TAG);
+	}
+
+	if (Download->Image != NULL) {
+		ExFreePoolWithTag(Download->Image, TOUCH_POOL_TAG);
+	}
+
+	RtlZeroMemory(Download, sizeof(TCM_HOST_DOWNLOAD));
+}
@@ -0,0 +1,148 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		image_codec.c
+
+	Abstract:
+
+		Encoder for the compressed capacitance image stream. Samples are
+		coded against the previous frame, zig-zag mapped and written as
+		varints, with runs of unchanged samples collapsed into a single
+		token. The container format is documented in selftest.h.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <tcm/touch_tcm.h>
+
+#define IMAGE_CODEC_MAX_RUN 65536
+
+static __forceinline ULONG
+TcmImagePutVarint(
+	_Out_writes_bytes_(Capacity) UINT8* Output,
+	IN ULONG Length,
+	IN ULONG Capacity,
+	IN ULONG Value
+)
+{
+	do {
+		if (Length >= Capacity) {
+			return 0;
+		}
+
+		Output[Length++] = (UINT8)((Value & 0x7F) | (Value > 0x7F ? 0x80 : 0));
+		Value >>= 7;
+	} while (Value != 0);
+
+	return Length;
+}
+
+static __forceinline UINT64
+TcmImageLoad64(
+	IN UINT16* Samples
+)
+{
+	UINT64 Value;
+
+	RtlCopyMemory(&Value, Samples, sizeof(Value));
+
+	return Value;
+}
+
+ULONG
+TcmImageEncode(
+	_In_reads_(Samples) UINT16* Frame,
+	_In_reads_opt_(Samples) UINT16* Reference,
+	IN ULONG Samples,
+	_Out_writes_bytes_(Capacity) UINT8* Output,
+	IN ULONG Capacity
+)
+/*++
+
+Routine Description:
+
+	Encodes one frame against a reference frame, or against zero for a
+	key frame. Unchanged samples are skipped four at a time, which is
+	where nearly all of the time goes on a quiet panel.
+
+Arguments:
+
+	Frame - Samples of the frame to encode
+
+	Reference - Samples of the previous frame, NULL for a key frame
+
+	Samples - Number of samples in both frames
+
+	Output - Receives the token stream
+
+	Capacity - Size of Output in bytes
+
+Return Value:
+
+	Number of bytes written, 0 if the encoded frame does not fit
+
+--*/
+{
+	ULONG Index = 0;
+	ULONG Run = 0;
+	ULONG Length = 0;
+	INT16 Delta;
+	UINT32 ZigZag;
+
+	while (Index < Samples) {
+		if (Run == IMAGE_CODEC_MAX_RUN) {
+			Length = TcmImagePutVarint(Output, Length, Capacity, (Run - 1) << 1);
+			if (Length == 0) {
+				return 0;
+			}
+			Run = 0;
+		}
+
+		while (Index + 4 <= Samples && Run + 4 <= IMAGE_CODEC_MAX_RUN &&
+			TcmImageLoad64(&Frame[Index]) == (Reference ? TcmImageLoad64(&Reference[Index]) : 0)) {
+			Index += 4;
+			Run += 4;
+		}
+
+		if (Index >= Samples) {
+			break;
+		}
+
+		Delta = (INT16)(Frame[Index] - (Reference ? Reference[Index] : 0));
+		Index++;
+
+		if (Delta == 0) {
+			Run++;
+			continue;
+		}
+
+		if (Run != 0) {
+			Length = TcmImagePutVarint(Output, Length, Capacity, (Run - 1) << 1);
+			if (Length == 0) {
+				return 0;
+			}
+			Run = 0;
+		}
+
+		ZigZag = (((UINT32)(UINT16)Delta << 1) ^ (UINT32)(Delta >> 15)) & 0xFFFF;
+
+		Length = TcmImagePutVarint(Output, Length, Capacity, (ZigZag << 1) | 1);
+		if (Length == 0) {
+			return 0;
+		}
+	}
+
+	if (Run != 0) {
+		Length = TcmImagePutVarint(Output, Length, Capacity, (Run - 1) << 1);
+	}
+
+	return Length;
+}
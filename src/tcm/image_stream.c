@@ -0,0 +1,547 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		image_stream.c
+
+	Abstract:
+
+		Streams raw and delta capacitance images to a user mode ring
+		buffer for panel tuning. The ring is the locked output buffer of
+		a pending self-test request, so frames are written by the ISR
+		straight into memory the application reads.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <internal.h>
+#include <controller.h>
+#include <spb.h>
+#include <tcm/touch_tcm.h>
+#include <selftest\selftest.h>
+#include <image_stream.tmh>
+
+typedef struct _IMAGE_STREAM_OBJECT_CONTEXT
+{
+	TCM_CONTROLLER_CONTEXT* ControllerContext;
+} IMAGE_STREAM_OBJECT_CONTEXT, *PIMAGE_STREAM_OBJECT_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(IMAGE_STREAM_OBJECT_CONTEXT, GetImageStreamObjectContext)
+
+EVT_WDF_WORKITEM TcmImageStreamCancelWorkItem;
+EVT_WDF_REQUEST_CANCEL TcmImageStreamOnCancel;
+
+//
+// Detaches the stream from its request and returns the request, if
+// the stream belongs to Expected or Expected is NULL
+//
+static WDFREQUEST
+TcmImageStreamDetach(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN WDFREQUEST Expected
+)
+{
+	TCM_IMAGE_STREAM* Stream = &ControllerContext->ImageStream;
+	WDFREQUEST Request = NULL;
+	UINT16* Reference = NULL;
+
+	WdfWaitLockAcquire(ControllerContext->ControllerLock, NULL);
+
+	if (Expected == NULL || Stream->Request == Expected) {
+		Request = Stream->Request;
+		Reference = Stream->Reference;
+		Stream->Request = NULL;
+		Stream->Ring = NULL;
+		Stream->Reference = NULL;
+	}
+
+	WdfWaitLockRelease(ControllerContext->ControllerLock);
+
+	if (Reference != NULL) {
+		ExFreePoolWithTag(Reference, TOUCH_POOL_TAG);
+	}
+
+	if (Request != NULL && Stream->RawBytes != 0) {
+		Trace(
+			TRACE_LEVEL_INFORMATION,
+			TRACE_REPORTING,
+			"Image stream stopped after %d frames, %I64u bytes encoded as %I64u",
+			Stream->Sequence,
+			Stream->RawBytes,
+			Stream->EncodedBytes);
+	}
+
+	return Request;
+}
+
+static VOID
+TcmImageStreamDisableReport(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN UINT8 ReportType
+)
+{
+	NTSTATUS status;
+
+	if (ControllerContext->DevicePowerState != PowerDeviceD0) {
+		return;
+	}
+
+	//
+	// Host side detection keeps consuming delta images
+	//
+	if (ReportType == TCM_REPORT_DELTA && ControllerContext->SoftTouch.Enabled) {
+		return;
+	}
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_DISABLE_REPORT,
+		&ReportType,
+		sizeof(ReportType),
+		NULL,
+		NULL);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_REPORTING,
+			"Error disabling image report 0x%02x - 0x%08lX",
+			ReportType,
+			status);
+	}
+}
+
+NTSTATUS
+TcmImageStreamStart(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN WDFREQUEST Request,
+	IN UINT8 ReportType,
+	IN BOOLEAN Compress
+)
+/*++
+
+Routine Description:
+
+	Turns the request output buffer into the frame ring and enables
+	the image report. On success the request stays pending until the
+	stream is stopped or the request is cancelled.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+	Request - IOCTL_TOUCH_SELFTEST_IMAGE_STREAM request
+
+	ReportType - TCM_REPORT_RAW or TCM_REPORT_DELTA
+
+	Compress - Store frames with the inter-frame codec
+
+Return Value:
+
+	STATUS_PENDING if the stream started, otherwise the error the
+	request has to be completed with
+
+--*/
+{
+	NTSTATUS status;
+	TCM_IMAGE_STREAM* Stream = &ControllerContext->ImageStream;
+	TOUCH_TEST_IMAGE_RING* Ring;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	PMDL Mdl;
+	UINT16* Reference = NULL;
+	ULONG RingLength;
+	ULONG Rows = ControllerContext->AppInfo.NumOfImageRows;
+	ULONG Cols = ControllerContext->AppInfo.NumOfImageCols;
+	ULONG FrameLength = Rows * Cols * sizeof(UINT16);
+	ULONG SlotSize = ALIGN_UP_BY(sizeof(TOUCH_TEST_IMAGE_FRAME) + FrameLength, 8);
+
+	if (ReportType != TCM_REPORT_RAW && ReportType != TCM_REPORT_DELTA) {
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	if (FrameLength == 0 || Stream->CancelWorkItem == NULL ||
+		ControllerContext->DevicePowerState != PowerDeviceD0) {
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	status = WdfRequestRetrieveOutputWdmMdl(Request, &Mdl);
+
+	if (!NT_SUCCESS(status)) {
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	RingLength = MmGetMdlByteCount(Mdl);
+
+	if (RingLength < sizeof(TOUCH_TEST_IMAGE_RING) + 2 * SlotSize) {
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	Ring = MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority | MdlMappingNoExecute);
+
+	if (Ring == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, IMAGE_STREAM_OBJECT_CONTEXT);
+
+	status = WdfObjectAllocateContext(Request, &attributes, NULL);
+
+	if (!NT_SUCCESS(status)) {
+		return status;
+	}
+
+	GetImageStreamObjectContext(Request)->ControllerContext = ControllerContext;
+
+	if (Compress) {
+		Reference = ExAllocatePoolWithTag(
+			NonPagedPoolNx,
+			FrameLength,
+			TOUCH_POOL_TAG);
+
+		if (Reference == NULL) {
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+	}
+
+	RtlZeroMemory(Ring, sizeof(TOUCH_TEST_IMAGE_RING));
+	Ring->Version = TOUCH_TEST_IMAGE_RING_VERSION;
+	Ring->ReportType = ReportType;
+	Ring->Rows = Rows;
+	Ring->Cols = Cols;
+	Ring->SlotSize = SlotSize;
+	Ring->SlotCount = (RingLength - sizeof(TOUCH_TEST_IMAGE_RING)) / SlotSize;
+
+	WdfWaitLockAcquire(ControllerContext->ControllerLock, NULL);
+
+	if (Stream->Request != NULL) {
+		status = STATUS_DEVICE_BUSY;
+	}
+	else {
+		status = WdfRequestMarkCancelableEx(Request, TcmImageStreamOnCancel);
+	}
+
+	if (!NT_SUCCESS(status)) {
+		WdfWaitLockRelease(ControllerContext->ControllerLock);
+
+		if (Reference != NULL) {
+			ExFreePoolWithTag(Reference, TOUCH_POOL_TAG);
+		}
+
+		return status;
+	}
+
+	Stream->Request = Request;
+	Stream->Ring = Ring;
+	Stream->Compress = Compress;
+	Stream->Reference = Reference;
+	Stream->ReferenceValid = FALSE;
+	Stream->KeyFrameCountdown = 0;
+	Stream->RawBytes = 0;
+	Stream->EncodedBytes = 0;
+	Stream->ReportType = ReportType;
+	Stream->SlotSize = SlotSize;
+	Stream->SlotCount = Ring->SlotCount;
+	Stream->FrameLength = FrameLength;
+	Stream->Sequence = 0;
+
+	WdfWaitLockRelease(ControllerContext->ControllerLock);
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_ENABLE_REPORT,
+		&ReportType,
+		sizeof(ReportType),
+		NULL,
+		NULL);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_REPORTING,
+			"Error enabling image report 0x%02x - 0x%08lX",
+			ReportType,
+			status);
+
+		//
+		// If cancellation already owns the request it completes it
+		//
+		if (TcmImageStreamDetach(ControllerContext, Request) == Request &&
+			WdfRequestUnmarkCancelable(Request) != STATUS_CANCELLED) {
+			WdfRequestComplete(Request, status);
+		}
+
+		return STATUS_PENDING;
+	}
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_REPORTING,
+		"Image stream 0x%02x started, %dx%d, %d slots",
+		ReportType,
+		Rows,
+		Cols,
+		Ring->SlotCount);
+
+	return STATUS_PENDING;
+}
+
+NTSTATUS
+TcmImageStreamStop(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Disables the image report and completes the pending stream request.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	TCM_IMAGE_STREAM* Stream = &ControllerContext->ImageStream;
+	UINT8 ReportType = Stream->ReportType;
+	WDFREQUEST Request;
+
+	Request = TcmImageStreamDetach(ControllerContext, NULL);
+
+	if (Request == NULL) {
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	TcmImageStreamDisableReport(ControllerContext, SpbContext, ReportType);
+
+	if (WdfRequestUnmarkCancelable(Request) != STATUS_CANCELLED) {
+		WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, sizeof(TOUCH_TEST_IMAGE_RING));
+	}
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+TcmImageStreamOnCancel(
+	IN WDFREQUEST Request
+)
+{
+	TCM_CONTROLLER_CONTEXT* controller = GetImageStreamObjectContext(Request)->ControllerContext;
+
+	//
+	// May run at dispatch level, the controller lock and the disable
+	// command need a work item
+	//
+	controller->ImageStream.CancelledRequest = Request;
+	WdfWorkItemEnqueue(controller->ImageStream.CancelWorkItem);
+}
+
+VOID
+TcmImageStreamCancelWorkItem(
+	IN WDFWORKITEM WorkItem
+)
+{
+	TCM_CONTROLLER_CONTEXT* controller;
+	PDEVICE_EXTENSION devContext;
+	UINT8 ReportType;
+	WDFREQUEST Request;
+
+	controller = GetImageStreamObjectContext(WorkItem)->ControllerContext;
+	devContext = GetDeviceContext(controller->FxDevice);
+	ReportType = controller->ImageStream.ReportType;
+
+	Request = controller->ImageStream.CancelledRequest;
+	controller->ImageStream.CancelledRequest = NULL;
+
+	if (Request == NULL) {
+		return;
+	}
+
+	//
+	// A stop racing with the cancel has already detached the stream
+	// but leaves completion to us
+	//
+	if (TcmImageStreamDetach(controller, Request) == Request) {
+		TcmImageStreamDisableReport(controller, &devContext->I2CContext, ReportType);
+	}
+
+	WdfRequestComplete(Request, STATUS_CANCELLED);
+}
+
+VOID
+TcmImageStreamDispatch(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN UINT8 ReportType,
+	_In_reads_bytes_(PayloadLength) UINT8* Payload,
+	IN ULONG PayloadLength
+)
+/*++
+
+Routine Description:
+
+	Called from the ISR with the controller lock held for every raw or
+	delta report, copies the image into the next ring slot.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	ReportType - Report code of the message
+
+	Payload - Image samples
+
+	PayloadLength - Payload length in bytes
+
+Return Value:
+
+	None
+
+--*/
+{
+	TCM_IMAGE_STREAM* Stream = &ControllerContext->ImageStream;
+	TOUCH_TEST_IMAGE_RING* Ring = (TOUCH_TEST_IMAGE_RING*)Stream->Ring;
+	TOUCH_TEST_IMAGE_FRAME* Frame;
+	ULONG Length;
+	ULONG Encoded = 0;
+	BOOLEAN KeyFrame = TRUE;
+
+	if (Ring == NULL || ReportType != Stream->ReportType) {
+		return;
+	}
+
+	if (++Stream->Sequence == 0) {
+		Stream->Sequence = 1;
+	}
+
+	Frame = (TOUCH_TEST_IMAGE_FRAME*)((UINT8*)(Ring + 1) +
+		(Stream->Sequence % Stream->SlotCount) * Stream->SlotSize);
+
+	Length = min(PayloadLength, Stream->FrameLength);
+
+	if (Length != Stream->FrameLength) {
+		Ring->Truncated++;
+	}
+
+	Frame->Sequence = 0;
+	KeMemoryBarrier();
+
+	if (Stream->Compress && Length == Stream->FrameLength) {
+		KeyFrame = !Stream->ReferenceValid || Stream->KeyFrameCountdown == 0;
+
+		Encoded = TcmImageEncode(
+			(UINT16*)Payload,
+			KeyFrame ? NULL : Stream->Reference,
+			Length / sizeof(UINT16),
+			(UINT8*)(Frame + 1),
+			Stream->SlotSize - sizeof(TOUCH_TEST_IMAGE_FRAME));
+	}
+
+	if (Encoded != 0) {
+		Frame->Flags = TOUCH_TEST_IMAGE_FRAME_COMPRESSED | (KeyFrame ? TOUCH_TEST_IMAGE_FRAME_KEY : 0);
+		Frame->Length = Encoded;
+	}
+	else {
+		//
+		// Frames that do not compress are stored as they are and
+		// restart the delta chain
+		//
+		Frame->Flags = TOUCH_TEST_IMAGE_FRAME_KEY;
+		Frame->Length = Length;
+		RtlCopyMemory(Frame + 1, Payload, Length);
+		KeyFrame = TRUE;
+	}
+
+	Frame->Timestamp = KeQueryInterruptTime();
+
+	if (Stream->Compress) {
+		Stream->ReferenceValid = Length == Stream->FrameLength;
+		Stream->KeyFrameCountdown = KeyFrame ? IMAGE_STREAM_KEYFRAME_INTERVAL : Stream->KeyFrameCountdown - 1;
+		Stream->RawBytes += Length;
+		Stream->EncodedBytes += Frame->Length;
+
+		if (Stream->ReferenceValid) {
+			RtlCopyMemory(Stream->Reference, Payload, Length);
+		}
+	}
+
+	KeMemoryBarrier();
+	Frame->Sequence = Stream->Sequence;
+	Ring->WriteSequence = Stream->Sequence;
+}
+
+NTSTATUS
+TcmImageStreamInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	NTSTATUS status;
+	TCM_IMAGE_STREAM* Stream = &ControllerContext->ImageStream;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDF_WORKITEM_CONFIG workItemConfig;
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, IMAGE_STREAM_OBJECT_CONTEXT);
+	attributes.ParentObject = ControllerContext->FxDevice;
+
+	WDF_WORKITEM_CONFIG_INIT(&workItemConfig, TcmImageStreamCancelWorkItem);
+
+	status = WdfWorkItemCreate(
+		&workItemConfig,
+		&attributes,
+		&Stream->CancelWorkItem);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Error creating image stream work item - 0x%08lX",
+			status);
+		Stream->CancelWorkItem = NULL;
+		return status;
+	}
+
+	GetImageStreamObjectContext(Stream->CancelWorkItem)->ControllerContext = ControllerContext;
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+TcmImageStreamDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	TCM_IMAGE_STREAM* Stream = &ControllerContext->ImageStream;
+	WDFREQUEST Request;
+
+	if (Stream->CancelWorkItem != NULL) {
+		WdfWorkItemFlush(Stream->CancelWorkItem);
+	}
+
+	Request = TcmImageStreamDetach(ControllerContext, NULL);
+
+	if (Request != NULL && WdfRequestUnmarkCancelable(Request) != STATUS_CANCELLED) {
+		WdfRequestComplete(Request, STATUS_DEVICE_REMOVED);
+	}
+
+	if (Stream->CancelWorkItem != NULL) {
+		WdfWorkItemFlush(Stream->CancelWorkItem);
+		WdfObjectDelete(Stream->CancelWorkItem);
+		Stream->CancelWorkItem = NULL;
+	}
+}
@@ -0,0 +1,389 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		production_test.c
+
+	Abstract:
+
+		Runs the controller's production tests and judges the results
+		against the per vendor limits in TOUCH_SCREEN_SETTINGS. Images
+		are laid out with transmitters as rows and receivers as columns.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <controller.h>
+#include <spb.h>
+#include <tcm/touch_tcm.h>
+#include <selftest\selftest.h>
+#include <production_test.tmh>
+
+#define PT_MAX_ELECTRODES 64
+
+C_ASSERT(FIELD_OFFSET(TOUCH_SCREEN_SETTINGS, Vendor01IncludeHighResTest) -
+	FIELD_OFFSET(TOUCH_SCREEN_SETTINGS, Vendor00IncludeHighResTest) == sizeof(TCM_VENDOR_TEST_LIMITS));
+C_ASSERT(FIELD_OFFSET(TOUCH_SCREEN_SETTINGS, Vendor03IncludeShortTest) -
+	FIELD_OFFSET(TOUCH_SCREEN_SETTINGS, Vendor00IncludeHighResTest) ==
+	4 * sizeof(TCM_VENDOR_TEST_LIMITS) - sizeof(UINT32));
+
+static __forceinline LONG
+TcmPtSample(
+	IN UINT8* Data,
+	IN ULONG Index,
+	IN BOOLEAN Signed
+)
+{
+	UINT16 Value = (UINT16)(Data[Index * 2] | (Data[Index * 2 + 1] << 8));
+
+	return Signed ? (LONG)(INT16)Value : (LONG)Value;
+}
+
+static VOID
+TcmPtCheckImage(
+	IN UINT8* Data,
+	IN ULONG Rows,
+	IN ULONG Cols,
+	IN BOOLEAN Signed,
+	IN UINT64 TxMask,
+	IN UINT64 RxMask,
+	IN LONG Min,
+	IN LONG Max,
+	IN OUT TOUCH_TEST_PRODUCTION_ENTRY* Entry
+)
+/*++
+
+Routine Description:
+
+	Compares every pixel of the enabled transmitter/receiver pairs
+	against [Min, Max]. The per pixel work is branch free (min/max and
+	a compare folded into the fail masks) so it vectorizes.
+
+--*/
+{
+	ULONG Row, Col;
+	LONG Value, Fail;
+	LONG ImageMin = MAXLONG, ImageMax = MINLONG;
+	ULONG Failed = 0;
+	UINT64 RowFail;
+
+	for (Row = 0; Row < Rows; Row++) {
+		if (!(TxMask & (1ULL << Row))) {
+			continue;
+		}
+
+		RowFail = 0;
+
+		for (Col = 0; Col < Cols; Col++) {
+			Value = TcmPtSample(Data, Row * Cols + Col, Signed);
+			Fail = ((Value < Min) | (Value > Max)) & (LONG)((RxMask >> Col) & 1);
+
+			ImageMin = min(ImageMin, Value);
+			ImageMax = max(ImageMax, Value);
+			RowFail |= (UINT64)Fail << Col;
+			Failed += Fail;
+		}
+
+		Entry->RxFail |= RowFail;
+		Entry->TxFail |= (UINT64)(RowFail != 0) << Row;
+	}
+
+	Entry->Min = ImageMin;
+	Entry->Max = ImageMax;
+	Entry->FailedPixels = (USHORT)min(Failed, MAXUSHORT);
+}
+
+static VOID
+TcmPtEvaluate(
+	IN TCM_VENDOR_TEST_LIMITS* Limits,
+	IN UINT8* Data,
+	IN ULONG Length,
+	IN ULONG Rows,
+	IN ULONG Cols,
+	IN OUT TOUCH_TEST_PRODUCTION_ENTRY* Entry
+)
+{
+	UINT64 RxMask = Limits->RxElectrodeMaskTouch2D ? Limits->RxElectrodeMaskTouch2D : MAXULONG64;
+	UINT64 TxMask = Limits->TxElectrodeMaskTouch2D ? Limits->TxElectrodeMaskTouch2D : MAXULONG64;
+	ULONG Pixels = Rows * Cols;
+	ULONG i;
+	LONG Value;
+
+	switch (Entry->TestItem) {
+		case TCM_PT_TRX_TRX_SHORTS:
+			//
+			// One bit per TRX pin, set if the pin is shorted
+			//
+			for (i = 0; i < Length && i < 16; i++) {
+				if (i < 8)
+					Entry->RxFail |= (UINT64)Data[i] << (i * 8);
+				else
+					Entry->TxFail |= (UINT64)Data[i] << ((i - 8) * 8);
+			}
+			break;
+
+		case TCM_PT_FULL_RAW_CAP:
+			if (Length < Pixels * sizeof(UINT16)) {
+				Entry->Status = TOUCH_TEST_PT_ERROR;
+				return;
+			}
+			TcmPtCheckImage(Data, Rows, Cols, FALSE, TxMask, RxMask,
+				(LONG)Limits->BaselineMinMaxMinPixelLimit,
+				(LONG)Limits->BaselineMinMaxMaxPixelLimit,
+				Entry);
+			break;
+
+		case TCM_PT_HIGH_RESISTANCE:
+			if (Length < Pixels * sizeof(UINT16)) {
+				Entry->Status = TOUCH_TEST_PT_ERROR;
+				return;
+			}
+			TcmPtCheckImage(Data, Rows, Cols, TRUE, TxMask, RxMask,
+				(LONG)Limits->HighResMinImageLimit,
+				MAXLONG,
+				Entry);
+
+			//
+			// Per receiver and per transmitter results follow the image
+			// on firmware that reports them
+			//
+			if (Length >= (Pixels + Cols + Rows) * sizeof(UINT16)) {
+				for (i = 0; i < Cols; i++) {
+					Value = TcmPtSample(Data, Pixels + i, TRUE);
+					Entry->RxFail |= (UINT64)(Value > (LONG)Limits->HighResMaxRxLimit &&
+						(RxMask >> i) & 1) << i;
+				}
+				for (i = 0; i < Rows; i++) {
+					Value = TcmPtSample(Data, Pixels + Cols + i, TRUE);
+					Entry->TxFail |= (UINT64)(Value > (LONG)Limits->HighResMaxTxLimit &&
+						(TxMask >> i) & 1) << i;
+				}
+			}
+			break;
+
+		case TCM_PT_HYBRID_ABS_RAW:
+			//
+			// One 32-bit value per receiver, then per transmitter
+			//
+			if (Length < (Rows + Cols) * sizeof(UINT32)) {
+				Entry->Status = TOUCH_TEST_PT_ERROR;
+				return;
+			}
+			Entry->Min = MAXLONG;
+			Entry->Max = MINLONG;
+			for (i = Limits->AbsSenseRawCapTxRxStart;
+				i <= Limits->AbsSenseRawCapTxRxEnd && i < Rows + Cols; i++) {
+				Value = (LONG)(Data[i * 4] | (Data[i * 4 + 1] << 8) |
+					(Data[i * 4 + 2] << 16) | ((UINT32)Data[i * 4 + 3] << 24));
+				Entry->Min = min(Entry->Min, Value);
+				Entry->Max = max(Entry->Max, Value);
+				if (Value >= (LONG)Limits->AbsSenseRawCapMinLimit &&
+					Value <= (LONG)Limits->AbsSenseRawCapMaxLimit) {
+					continue;
+				}
+				Entry->FailedPixels++;
+				if (i < Cols)
+					Entry->RxFail |= 1ULL << i;
+				else
+					Entry->TxFail |= 1ULL << (i - Cols);
+			}
+			break;
+
+		default:
+			Entry->Status = TOUCH_TEST_PT_ERROR;
+			return;
+	}
+
+	Entry->Status = (Entry->RxFail | Entry->TxFail) ? TOUCH_TEST_PT_FAIL : TOUCH_TEST_PT_PASS;
+}
+
+NTSTATUS
+TcmProductionTestRun(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN ULONG Vendor,
+	IN ULONG Tests,
+	_Out_writes_bytes_(OutputLength) PVOID Output,
+	IN ULONG OutputLength,
+	OUT ULONG* BytesWritten
+)
+/*++
+
+Routine Description:
+
+	Runs the requested production tests that are enabled for the
+	vendor and fills Output with a result entry per test, followed by
+	the test images as far as they fit.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+	Vendor - Index of the Vendor0x limits to use
+
+	Tests - TOUCH_TEST_PT_* mask
+
+	Output - Result buffer
+
+	OutputLength - Size of Output in bytes
+
+	BytesWritten - Receives the number of bytes written to Output
+
+Return Value:
+
+	NTSTATUS indicating success or failure. A failing panel is not an
+	error, see the result entries.
+
+--*/
+{
+	static const struct {
+		ULONG Test;
+		UINT8 Item;
+		ULONG IncludeOffset;
+	} TestTable[] = {
+		{ TOUCH_TEST_PT_SHORTS, TCM_PT_TRX_TRX_SHORTS,
+			FIELD_OFFSET(TCM_VENDOR_TEST_LIMITS, IncludeShortTest) },
+		{ TOUCH_TEST_PT_BASELINE, TCM_PT_FULL_RAW_CAP,
+			FIELD_OFFSET(TCM_VENDOR_TEST_LIMITS, IncludeBaselineMinMaxTest) },
+		{ TOUCH_TEST_PT_HIGH_RES, TCM_PT_HIGH_RESISTANCE,
+			FIELD_OFFSET(TCM_VENDOR_TEST_LIMITS, IncludeHighResTest) },
+		{ TOUCH_TEST_PT_ABS_RAW_CAP, TCM_PT_HYBRID_ABS_RAW,
+			FIELD_OFFSET(TCM_VENDOR_TEST_LIMITS, IncludeAbsSenseRawCapTest) },
+	};
+	NTSTATUS status = STATUS_SUCCESS;
+	TCM_VENDOR_TEST_LIMITS* Limits;
+	TOUCH_TEST_PRODUCTION_RESULT* Result = (TOUCH_TEST_PRODUCTION_RESULT*)Output;
+	TOUCH_TEST_PRODUCTION_ENTRY* Entry;
+	ULONG Rows = ControllerContext->AppInfo.NumOfImageRows;
+	ULONG Cols = ControllerContext->AppInfo.NumOfImageCols;
+	ULONG Written, ImageLength, i;
+	UINT8 Item;
+
+	*BytesWritten = 0;
+
+	if (Vendor > 3) {
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	if (Rows == 0 || Cols == 0 || Rows > PT_MAX_ELECTRODES || Cols > PT_MAX_ELECTRODES) {
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	if (OutputLength < sizeof(TOUCH_TEST_PRODUCTION_RESULT) +
+		ARRAYSIZE(TestTable) * sizeof(TOUCH_TEST_PRODUCTION_ENTRY)) {
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	Limits = (TCM_VENDOR_TEST_LIMITS*)&ControllerContext->TouchSettings.Vendor00IncludeHighResTest + Vendor;
+
+	RtlZeroMemory(Result, sizeof(*Result));
+	Result->Rows = Rows;
+	Result->Cols = Cols;
+
+	Entry = (TOUCH_TEST_PRODUCTION_ENTRY*)(Result + 1);
+	Written = sizeof(*Result);
+
+	for (i = 0; i < ARRAYSIZE(TestTable); i++) {
+		if (!(Tests & TestTable[i].Test) ||
+			*(UINT32*)((UINT8*)Limits + TestTable[i].IncludeOffset) == 0) {
+			continue;
+		}
+
+		Item = TestTable[i].Item;
+
+		RtlZeroMemory(&Entry[Result->TestCount], sizeof(*Entry));
+		Entry[Result->TestCount].TestItem = Item;
+		Written += sizeof(*Entry);
+
+		//
+		// The image is judged and copied out of ResponseData before
+		// another command can replace it
+		//
+		TcmLockCommands(ControllerContext);
+
+		status = TcmWriteMessage(ControllerContext,
+			SpbContext,
+			CMD_PRODUCTION_TEST,
+			&Item,
+			sizeof(Item),
+			NULL,
+			NULL);
+
+		if (!NT_SUCCESS(status)) {
+			TcmUnlockCommands(ControllerContext);
+
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_OTHER,
+				"Production test 0x%02x failed to run - 0x%08lX",
+				Item,
+				status);
+			Entry[Result->TestCount].Status = TOUCH_TEST_PT_ERROR;
+			Result->FailedCount++;
+			Result->TestCount++;
+			status = STATUS_SUCCESS;
+			continue;
+		}
+
+		//
+		// The response length includes the trailing padding byte
+		//
+		ImageLength = ControllerContext->ResponseData.DataLength;
+		if (ImageLength != 0)
+			ImageLength--;
+
+		TcmPtEvaluate(Limits,
+			ControllerContext->ResponseData.Buffer,
+			ImageLength,
+			Rows,
+			Cols,
+			&Entry[Result->TestCount]);
+
+		Trace(
+			TRACE_LEVEL_INFORMATION,
+			TRACE_OTHER,
+			"Production test 0x%02x: status %d, min %d, max %d, rx fail 0x%I64x, tx fail 0x%I64x",
+			Item,
+			Entry[Result->TestCount].Status,
+			Entry[Result->TestCount].Min,
+			Entry[Result->TestCount].Max,
+			Entry[Result->TestCount].RxFail,
+			Entry[Result->TestCount].TxFail);
+
+		if (Entry[Result->TestCount].Status != TOUCH_TEST_PT_PASS) {
+			Result->FailedCount++;
+		}
+
+		Result->TestCount++;
+
+		//
+		// Images go after the largest possible entry table, so entries
+		// never move once an image is stored
+		//
+		if (Written < sizeof(*Result) + ARRAYSIZE(TestTable) * sizeof(*Entry)) {
+			Written = sizeof(*Result) + ARRAYSIZE(TestTable) * sizeof(*Entry);
+		}
+
+		if (ImageLength != 0 && OutputLength - Written >= ImageLength) {
+			RtlCopyMemory((UINT8*)Output + Written, ControllerContext->ResponseData.Buffer, ImageLength);
+			Entry[Result->TestCount - 1].ImageOffset = Written;
+			Entry[Result->TestCount - 1].ImageLength = ImageLength;
+			Written += ImageLength;
+		}
+
+		TcmUnlockCommands(ControllerContext);
+	}
+
+	*BytesWritten = Written;
+
+	return status;
+}
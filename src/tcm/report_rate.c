@@ -0,0 +1,378 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		report_rate.c
+
+	Abstract:
+
+		Activity driven scan/report rate scheduling for TCM controllers.
+		Contacts moving keep the controller out of doze, a quiet period
+		lets the firmware fall back to its low-rate idle scan.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <internal.h>
+#include <controller.h>
+#include <spb.h>
+#include <tcm/touch_tcm.h>
+#include <report_rate.tmh>
+
+#define REPORT_RATE_REG_KEY L"\\Registry\\Machine\\SYSTEM\\TOUCH\\Settings"
+
+typedef struct _REPORT_RATE_OBJECT_CONTEXT
+{
+	TCM_CONTROLLER_CONTEXT* ControllerContext;
+} REPORT_RATE_OBJECT_CONTEXT, *PREPORT_RATE_OBJECT_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(REPORT_RATE_OBJECT_CONTEXT, GetReportRateObjectContext)
+
+EVT_WDF_WORKITEM TcmReportRateWorkItem;
+EVT_WDF_TIMER TcmReportRateIdleTimerFunc;
+
+static VOID
+TcmReportRateRequest(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN LONG Rate
+)
+{
+	TCM_REPORT_RATE* ReportRate = &ControllerContext->ReportRate;
+
+	if (ReportRate->WorkItem == NULL || ReportRate->Unsupported) {
+		return;
+	}
+
+	if (InterlockedExchange(&ReportRate->RequestedRate, Rate) == Rate) {
+		return;
+	}
+
+	//
+	// Enqueueing an already queued work item is a no-op, the work
+	// item always applies the latest requested rate
+	//
+	WdfWorkItemEnqueue(ReportRate->WorkItem);
+}
+
+VOID
+TcmReportRateWorkItem(
+	IN WDFWORKITEM WorkItem
+)
+/*++
+
+Routine Description:
+
+	Applies the most recently requested report rate with a single
+	dynamic config write. Runs outside of the ISR since the write
+	waits on a response serviced by the ISR.
+
+	The request is read under the CommandLock, so rate changes made
+	while another command sequence held it (firmware update, self
+	test) are applied once, as the latest request, and not at all if
+	they cancel out.
+
+Arguments:
+
+	WorkItem - Handle to a WDF workitem object
+
+Return Value:
+
+	None
+
+--*/
+{
+	NTSTATUS status;
+	TCM_CONTROLLER_CONTEXT* controller;
+	PDEVICE_EXTENSION devContext;
+	LONG requested;
+
+	controller = GetReportRateObjectContext(WorkItem)->ControllerContext;
+	devContext = GetDeviceContext(controller->FxDevice);
+
+	TcmLockCommands(controller);
+
+	requested = controller->ReportRate.RequestedRate;
+
+	if (requested == controller->ReportRate.CurrentRate ||
+		controller->DevicePowerState != PowerDeviceD0 ||
+		controller->ControllerState.Init != TRUE) {
+		goto exit;
+	}
+
+	status = TcmSetDynamicConfig(
+		controller,
+		&devContext->I2CContext,
+		DC_NO_DOZE,
+		requested == REPORT_RATE_ACTIVE ? 1 : 0);
+
+	if (status == STATUS_NOT_SUPPORTED) {
+		Trace(
+			TRACE_LEVEL_INFORMATION,
+			TRACE_POWER,
+			"Firmware has no doze control, report rate left to the firmware");
+
+		//
+		// Stop requesting until the next D0 entry rather than on every
+		// frame
+		//
+		controller->ReportRate.Unsupported = TRUE;
+		goto exit;
+	}
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_POWER,
+			"Error changing report rate to %d - 0x%08lX",
+			requested,
+			status);
+
+		//
+		// Allow the next frame to retry the request
+		//
+		InterlockedCompareExchange(&controller->ReportRate.RequestedRate,
+			controller->ReportRate.CurrentRate,
+			requested);
+		goto exit;
+	}
+
+	controller->ReportRate.CurrentRate = requested;
+	controller->ReportRate.Transitions++;
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_POWER,
+		"Report rate changed to %s (%d transitions)",
+		requested == REPORT_RATE_ACTIVE ? "active" : "idle",
+		controller->ReportRate.Transitions);
+
+exit:
+	TcmUnlockCommands(controller);
+}
+
+VOID
+TcmReportRateIdleTimerFunc(
+	IN WDFTIMER Timer
+)
+{
+	TcmReportRateRequest(
+		GetReportRateObjectContext(Timer)->ControllerContext,
+		REPORT_RATE_IDLE);
+}
+
+VOID
+TcmReportRateUpdate(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN DETECTED_OBJECTS* Data
+)
+/*++
+
+Routine Description:
+
+	Called from the ISR for every decoded touch frame. Any contact
+	appearing, lifting or moving requests the active rate and pushes
+	back the idle timer. Never blocks.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	Data - Decoded touch frame
+
+Return Value:
+
+	None
+
+--*/
+{
+	TCM_REPORT_RATE* Rate = &ControllerContext->ReportRate;
+	UINT32 ObjectMask = 0;
+	BOOLEAN Moving = FALSE;
+	int i;
+
+	if (Rate->IdleTimer == NULL) {
+		return;
+	}
+
+	for (i = 0; i < MAX_FINGER; i++) {
+		if (Data->States[i] == OBJECT_STATE_NOT_PRESENT) {
+			continue;
+		}
+
+		ObjectMask |= (1 << i);
+
+		if (Data->Positions[i].X != Rate->LastPositions[i].X ||
+			Data->Positions[i].Y != Rate->LastPositions[i].Y) {
+			Rate->LastPositions[i] = Data->Positions[i];
+			Moving = TRUE;
+		}
+	}
+
+	if (ObjectMask != Rate->LastObjectMask) {
+		Rate->LastObjectMask = ObjectMask;
+		Moving = TRUE;
+	}
+
+	if (!Moving) {
+		return;
+	}
+
+	TcmReportRateRequest(ControllerContext, REPORT_RATE_ACTIVE);
+
+	WdfTimerStart(Rate->IdleTimer, WDF_REL_TIMEOUT_IN_MS(Rate->IdleTimeout));
+}
+
+VOID
+TcmReportRateStop(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Cancels pending rate changes before the controller leaves D0. The
+	rate is re-learned from the frame stream after the next wake, and
+	doze control is tried again in case the firmware changed.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None
+
+--*/
+{
+	TCM_REPORT_RATE* Rate = &ControllerContext->ReportRate;
+
+	if (Rate->IdleTimer != NULL) {
+		WdfTimerStop(Rate->IdleTimer, TRUE);
+	}
+
+	if (Rate->WorkItem != NULL) {
+		WdfWorkItemFlush(Rate->WorkItem);
+	}
+
+	Rate->RequestedRate = REPORT_RATE_UNKNOWN;
+	Rate->CurrentRate = REPORT_RATE_UNKNOWN;
+	Rate->LastObjectMask = 0;
+	Rate->Unsupported = FALSE;
+}
+
+NTSTATUS
+TcmReportRateInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Creates the idle timer and the work item used to apply rate
+	changes. The quiet period before dropping to the idle rate is
+	read from the IdleScanTimeout registry value (milliseconds).
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	NTSTATUS status;
+	TCM_REPORT_RATE* Rate = &ControllerContext->ReportRate;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDF_WORKITEM_CONFIG workItemConfig;
+	WDF_TIMER_CONFIG timerConfig;
+	DWORD idleTimeout = REPORT_RATE_IDLE_TIMEOUT;
+
+	RtlReadRegistryValue(
+		REPORT_RATE_REG_KEY,
+		L"IdleScanTimeout",
+		REG_DWORD,
+		&idleTimeout,
+		sizeof(DWORD));
+
+	Rate->IdleTimeout = idleTimeout != 0 ? idleTimeout : REPORT_RATE_IDLE_TIMEOUT;
+	Rate->RequestedRate = REPORT_RATE_UNKNOWN;
+	Rate->CurrentRate = REPORT_RATE_UNKNOWN;
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, REPORT_RATE_OBJECT_CONTEXT);
+	attributes.ParentObject = ControllerContext->FxDevice;
+
+	WDF_WORKITEM_CONFIG_INIT(&workItemConfig, TcmReportRateWorkItem);
+
+	status = WdfWorkItemCreate(
+		&workItemConfig,
+		&attributes,
+		&Rate->WorkItem);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Error creating report rate work item - 0x%08lX",
+			status);
+		goto exit;
+	}
+
+	GetReportRateObjectContext(Rate->WorkItem)->ControllerContext = ControllerContext;
+
+	WDF_TIMER_CONFIG_INIT(&timerConfig, TcmReportRateIdleTimerFunc);
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, REPORT_RATE_OBJECT_CONTEXT);
+	attributes.ParentObject = ControllerContext->FxDevice;
+
+	status = WdfTimerCreate(
+		&timerConfig,
+		&attributes,
+		&Rate->IdleTimer);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Error creating report rate idle timer - 0x%08lX",
+			status);
+		goto exit;
+	}
+
+	GetReportRateObjectContext(Rate->IdleTimer)->ControllerContext = ControllerContext;
+
+exit:
+	if (!NT_SUCCESS(status)) {
+		TcmReportRateDeinitialize(ControllerContext);
+	}
+
+	return status;
+}
+
+VOID
+TcmReportRateDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	TCM_REPORT_RATE* Rate = &ControllerContext->ReportRate;
+
+	if (Rate->IdleTimer != NULL) {
+		WdfTimerStop(Rate->IdleTimer, TRUE);
+		WdfObjectDelete(Rate->IdleTimer);
+		Rate->IdleTimer = NULL;
+	}
+
+	if (Rate->WorkItem != NULL) {
+		WdfWorkItemFlush(Rate->WorkItem);
+		WdfObjectDelete(Rate->WorkItem);
+		Rate->WorkItem = NULL;
+	}
+}
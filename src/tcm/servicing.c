@@ -0,0 +1,543 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		servicing.c
+
+	Abstract:
+
+		Optional servicing of TCM messages from a dedicated thread
+		running at real-time priority. The passive-level ISR only hands
+		the interrupt to the thread and waits for it to drain the
+		message. While the interrupt line looks unreliable, storming
+		with empty interrupts or missing messages, the thread polls the
+		controller at the expected frame rate instead.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <internal.h>
+#include <controller.h>
+#include <spb.h>
+#include <tcm/touch_tcm.h>
+#include <servicing.tmh>
+
+#define SERVICING_REG_KEY L"\\Registry\\Machine\\SYSTEM\\TOUCH\\Settings"
+
+//
+// Timer resolution requested while polling, in 100ns units
+//
+#define SERVICING_TIMER_RESOLUTION 10000
+
+KSTART_ROUTINE TcmServicingThread;
+
+static BOOLEAN
+TcmServicingCanRead(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	PDEVICE_EXTENSION devContext = GetDeviceContext(ControllerContext->FxDevice);
+
+	return ControllerContext->DevicePowerState == PowerDeviceD0 &&
+		ControllerContext->ControllerState.Init == TRUE &&
+		devContext->DiagnosticMode == FALSE;
+}
+
+static BOOLEAN
+TcmServicingRead(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Reads one message from the controller.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	TRUE if the controller had a message other than IDLE pending
+
+--*/
+{
+	PDEVICE_EXTENSION devContext = GetDeviceContext(ControllerContext->FxDevice);
+	ULONG Messages = ControllerContext->MessageCount;
+
+	TcmReadMessage(ControllerContext,
+		&devContext->I2CContext,
+		&devContext->ReportContext);
+
+	return ControllerContext->MessageCount != Messages;
+}
+
+static VOID
+TcmServicingSetPolling(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN BOOLEAN Polling
+)
+{
+	TCM_SERVICING* Servicing = &ControllerContext->Servicing;
+
+	//
+	// Frame periods are a few ms, the default clock tick is too coarse
+	// to wait for them. Only hold the finer resolution while polling.
+	//
+	if (Polling && !Servicing->TimerResolutionSet) {
+		ExSetTimerResolution(SERVICING_TIMER_RESOLUTION, TRUE);
+		Servicing->TimerResolutionSet = TRUE;
+	} else if (!Polling && Servicing->TimerResolutionSet) {
+		ExSetTimerResolution(0, FALSE);
+		Servicing->TimerResolutionSet = FALSE;
+	}
+
+	Servicing->PollingSince = KeQueryInterruptTime();
+	Servicing->PollingIsrCount = ControllerContext->ISRCount;
+	InterlockedExchange(&Servicing->Polling, Polling);
+}
+
+static VOID
+TcmServicingFallback(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN PCSTR Reason
+)
+{
+	TCM_SERVICING* Servicing = &ControllerContext->Servicing;
+
+	Servicing->Fallbacks++;
+	TcmServicingSetPolling(ControllerContext, TRUE);
+
+	Trace(
+		TRACE_LEVEL_WARNING,
+		TRACE_INTERRUPT,
+		"Interrupts unreliable (%s), polling every %d us",
+		Reason,
+		Servicing->PollInterval / 10);
+}
+
+static VOID
+TcmServicingInterrupt(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Services an interrupt handed off by the ISR and releases the ISR.
+	Empty interrupts are counted over one second windows, too many of
+	them switch the thread to polling. A handoff the ISR took back
+	after timing out is left alone, the message is gone already.
+
+--*/
+{
+	TCM_SERVICING* Servicing = &ControllerContext->Servicing;
+	ULONGLONG Now = KeQueryInterruptTime();
+	ULONG WakeUs = (ULONG)((Now - Servicing->SignalTime) / 10);
+	BOOLEAN Message = FALSE;
+
+	if (!InterlockedExchange(&Servicing->HandoffPending, FALSE)) {
+		return;
+	}
+
+	Servicing->Handoffs++;
+	Servicing->TotalWakeUs += WakeUs;
+	Servicing->MaxWakeUs = MAX(Servicing->MaxWakeUs, WakeUs);
+
+	if (TcmServicingCanRead(ControllerContext)) {
+		Message = TcmServicingRead(ControllerContext);
+	}
+
+	KeSetEvent(&Servicing->Serviced, LOW_REALTIME_PRIORITY, FALSE);
+
+	if (Now - Servicing->WindowStart >= 1000 * 10000) {
+		Servicing->WindowStart = Now;
+		Servicing->WindowEmpty = 0;
+	}
+
+	if (!Message) {
+		Servicing->EmptyInterrupts++;
+
+		if (++Servicing->WindowEmpty > Servicing->StormThreshold &&
+			Servicing->Mode == SERVICING_MODE_THREAD) {
+			TcmServicingFallback(ControllerContext, "storm");
+		}
+	}
+}
+
+static VOID
+TcmServicingPoll(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN ULONGLONG Due
+)
+/*++
+
+Routine Description:
+
+	Drains the controller at a frame deadline. The lateness against
+	the deadline is kept as the polling jitter.
+
+--*/
+{
+	TCM_SERVICING* Servicing = &ControllerContext->Servicing;
+	ULONG LateUs = (ULONG)((KeQueryInterruptTime() - Due) / 10);
+	ULONG i;
+
+	Servicing->Polls++;
+	Servicing->TotalPollLateUs += LateUs;
+	Servicing->MaxPollLateUs = MAX(Servicing->MaxPollLateUs, LateUs);
+
+	for (i = 0; i < SERVICING_MAX_DRAIN; i++) {
+		if (!TcmServicingRead(ControllerContext)) {
+			break;
+		}
+
+		Servicing->PolledMessages++;
+	}
+}
+
+VOID
+TcmServicingThread(
+	IN PVOID Context
+)
+{
+	TCM_CONTROLLER_CONTEXT* ControllerContext = Context;
+	TCM_SERVICING* Servicing = &ControllerContext->Servicing;
+	LARGE_INTEGER Timeout;
+	ULONGLONG Now, Due;
+	ULONG IsrCount;
+	NTSTATUS status;
+
+	KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY);
+
+	Due = KeQueryInterruptTime() + Servicing->PollInterval;
+
+	while (!Servicing->Stop) {
+		Now = KeQueryInterruptTime();
+
+		if (Servicing->Polling) {
+			Timeout.QuadPart = Due > Now ? -(LONGLONG)(Due - Now) : 0;
+		} else {
+			Timeout.QuadPart = -10 * 1000 * (LONGLONG)SERVICING_WATCHDOG_INTERVAL;
+		}
+
+		status = KeWaitForSingleObject(&Servicing->Interrupt,
+			Executive,
+			KernelMode,
+			FALSE,
+			&Timeout);
+
+		if (Servicing->Stop) {
+			break;
+		}
+
+		if (status == STATUS_SUCCESS) {
+			TcmServicingInterrupt(ControllerContext);
+			continue;
+		}
+
+		if (!TcmServicingCanRead(ControllerContext)) {
+			Due = KeQueryInterruptTime() + Servicing->PollInterval;
+			continue;
+		}
+
+		if (!Servicing->Polling) {
+			//
+			// Watchdog read, a pending message means an interrupt
+			// never reached us. One that came in while we read is
+			// there for the same message.
+			//
+			IsrCount = ControllerContext->ISRCount;
+			if (TcmServicingRead(ControllerContext) &&
+				ControllerContext->ISRCount == IsrCount) {
+				Servicing->MissedInterrupts++;
+				TcmServicingFallback(ControllerContext, "missed");
+				Due = KeQueryInterruptTime();
+			}
+			continue;
+		}
+
+		TcmServicingPoll(ControllerContext, Due);
+
+		//
+		// Skip the deadlines we could not keep instead of bursting
+		//
+		Now = KeQueryInterruptTime();
+		Due += Servicing->PollInterval;
+		if (Due <= Now) {
+			Due = Now + Servicing->PollInterval - (Now - Due) % Servicing->PollInterval;
+		}
+
+		if (Servicing->Mode != SERVICING_MODE_THREAD ||
+			Now - Servicing->PollingSince < 10000 * (ULONGLONG)SERVICING_RETRY_INTERVAL) {
+			continue;
+		}
+
+		//
+		// A line that stayed silent the whole time is still dead, keep
+		// polling rather than losing another watchdog interval to it
+		//
+		if (ControllerContext->ISRCount == Servicing->PollingIsrCount) {
+			Servicing->PollingSince = Now;
+			continue;
+		}
+
+		Servicing->WindowStart = Now;
+		Servicing->WindowEmpty = 0;
+		TcmServicingSetPolling(ControllerContext, FALSE);
+	}
+
+	TcmServicingSetPolling(ControllerContext, FALSE);
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+NTSTATUS
+TcmServicingHandoff(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN PREPORT_CONTEXT ReportContext
+)
+/*++
+
+Routine Description:
+
+	Called by the ISR to have the servicing thread read the message.
+	The ISR has to stay until the message is read, the interrupt is
+	level triggered. If the thread does not get to it in time the
+	handoff is taken back and the message read here, unless the thread
+	is reading it already.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+	ReportContext - A pointer to the current report context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	TCM_SERVICING* Servicing = &ControllerContext->Servicing;
+	LARGE_INTEGER Timeout;
+	NTSTATUS status;
+
+	KeClearEvent(&Servicing->Serviced);
+	Servicing->SignalTime = KeQueryInterruptTime();
+	InterlockedExchange(&Servicing->HandoffPending, TRUE);
+	KeSetEvent(&Servicing->Interrupt, LOW_REALTIME_PRIORITY, FALSE);
+
+	Timeout.QuadPart = -10 * 1000 * (LONGLONG)SERVICING_HANDOFF_TIMEOUT;
+
+	status = KeWaitForSingleObject(&Servicing->Serviced,
+		Executive,
+		KernelMode,
+		FALSE,
+		&Timeout);
+
+	if (status == STATUS_SUCCESS) {
+		return STATUS_SUCCESS;
+	}
+
+	Servicing->HandoffTimeouts++;
+
+	//
+	// Reading along with the thread would leave one of the two reads
+	// empty, and counted towards a storm
+	//
+	if (!InterlockedExchange(&Servicing->HandoffPending, FALSE)) {
+		KeWaitForSingleObject(&Servicing->Serviced,
+			Executive,
+			KernelMode,
+			FALSE,
+			NULL);
+		return STATUS_SUCCESS;
+	}
+
+	if (ControllerContext->ControllerState.Init != TRUE) {
+		return STATUS_SUCCESS;
+	}
+
+	return TcmReadMessage(ControllerContext, SpbContext, ReportContext);
+}
+
+NTSTATUS
+TcmServicingInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Starts the servicing thread when the ServicingMode registry value
+	asks for it. ServicingPollRate (Hz) is the expected frame rate
+	polled at, ServicingStormThreshold the number of empty interrupts
+	per second that makes the thread stop trusting the interrupt.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	NTSTATUS indicating success or failure. The ISR services the
+	controller inline without the thread.
+
+--*/
+{
+	NTSTATUS status;
+	TCM_SERVICING* Servicing = &ControllerContext->Servicing;
+	OBJECT_ATTRIBUTES attributes;
+	HANDLE thread;
+	DWORD mode = SERVICING_MODE_ISR;
+	DWORD pollRate = SERVICING_POLL_RATE;
+	DWORD stormThreshold = SERVICING_STORM_THRESHOLD;
+
+	RtlZeroMemory(Servicing, sizeof(TCM_SERVICING));
+
+	RtlReadRegistryValue(
+		SERVICING_REG_KEY,
+		L"ServicingMode",
+		REG_DWORD,
+		&mode,
+		sizeof(DWORD));
+
+	RtlReadRegistryValue(
+		SERVICING_REG_KEY,
+		L"ServicingPollRate",
+		REG_DWORD,
+		&pollRate,
+		sizeof(DWORD));
+
+	RtlReadRegistryValue(
+		SERVICING_REG_KEY,
+		L"ServicingStormThreshold",
+		REG_DWORD,
+		&stormThreshold,
+		sizeof(DWORD));
+
+	if (mode != SERVICING_MODE_THREAD && mode != SERVICING_MODE_POLL) {
+		return STATUS_SUCCESS;
+	}
+
+	if (pollRate == 0 || pollRate > 1000) {
+		pollRate = SERVICING_POLL_RATE;
+	}
+
+	Servicing->Mode = mode;
+	Servicing->PollInterval = 10000000 / pollRate;
+	Servicing->StormThreshold = stormThreshold;
+	Servicing->WindowStart = KeQueryInterruptTime();
+
+	KeInitializeEvent(&Servicing->Interrupt, SynchronizationEvent, FALSE);
+	KeInitializeEvent(&Servicing->Serviced, SynchronizationEvent, FALSE);
+
+	if (mode == SERVICING_MODE_POLL) {
+		TcmServicingSetPolling(ControllerContext, TRUE);
+	}
+
+	InitializeObjectAttributes(&attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+	status = PsCreateSystemThread(&thread,
+		THREAD_ALL_ACCESS,
+		&attributes,
+		NULL,
+		NULL,
+		TcmServicingThread,
+		ControllerContext);
+
+	if (!NT_SUCCESS(status)) {
+		goto exit;
+	}
+
+	status = ObReferenceObjectByHandle(thread,
+		THREAD_ALL_ACCESS,
+		*PsThreadType,
+		KernelMode,
+		(PVOID*)&Servicing->Thread,
+		NULL);
+
+	if (!NT_SUCCESS(status)) {
+		//
+		// Without the object we cannot wait for the thread to exit,
+		// stop it before the handle goes away
+		//
+		InterlockedExchange(&Servicing->Stop, TRUE);
+		KeSetEvent(&Servicing->Interrupt, IO_NO_INCREMENT, FALSE);
+		ZwWaitForSingleObject(thread, FALSE, NULL);
+	}
+
+	ZwClose(thread);
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_INIT,
+		"Servicing thread started, mode %d, poll rate %d Hz - 0x%08lX",
+		mode,
+		pollRate,
+		status);
+
+exit:
+	if (!NT_SUCCESS(status)) {
+		TcmServicingSetPolling(ControllerContext, FALSE);
+		Servicing->Thread = NULL;
+	}
+
+	return status;
+}
+
+VOID
+TcmServicingDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	TCM_SERVICING* Servicing = &ControllerContext->Servicing;
+
+	if (Servicing->Thread == NULL) {
+		return;
+	}
+
+	InterlockedExchange(&Servicing->Stop, TRUE);
+	KeSetEvent(&Servicing->Interrupt, IO_NO_INCREMENT, FALSE);
+
+	KeWaitForSingleObject(Servicing->Thread,
+		Executive,
+		KernelMode,
+		FALSE,
+		NULL);
+
+	ObDereferenceObject(Servicing->Thread);
+	Servicing->Thread = NULL;
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"Servicing: %d handoffs (%d timed out, %d empty), wake avg %d us, max %d us",
+		Servicing->Handoffs,
+		Servicing->HandoffTimeouts,
+		Servicing->EmptyInterrupts,
+		Servicing->Handoffs != 0 ? (ULONG)(Servicing->TotalWakeUs / Servicing->Handoffs) : 0,
+		Servicing->MaxWakeUs);
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"Servicing: %d fallbacks (%d missed), %d polls read %d messages, late avg %d us, max %d us",
+		Servicing->Fallbacks,
+		Servicing->MissedInterrupts,
+		Servicing->Polls,
+		Servicing->PolledMessages,
+		Servicing->Polls != 0 ? (ULONG)(Servicing->TotalPollLateUs / Servicing->Polls) : 0,
+		Servicing->MaxPollLateUs);
+}
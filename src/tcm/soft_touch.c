@@ -0,0 +1,249 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		soft_touch.c
+
+	Abstract:
+
+		Host side touch detection from delta images, used to debug the
+		firmware touch engine and on panels whose firmware config does
+		not report usable contacts. The detector itself is in
+		soft_touch_detect.c, this feeds it the delta reports and reports
+		its contacts.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <internal.h>
+#include <controller.h>
+#include <spb.h>
+#include <report.h>
+#include <tcm/touch_tcm.h>
+#include <soft_touch.tmh>
+
+#define SOFT_TOUCH_REG_KEY L"\\Registry\\Machine\\SYSTEM\\TOUCH\\Settings"
+
+C_ASSERT(SOFT_TOUCH_MAX_CONTACTS <= MAX_TOUCHES);
+
+VOID
+TcmSoftTouchDispatch(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN PREPORT_CONTEXT ReportContext,
+	_In_reads_bytes_(PayloadLength) UINT8* Payload,
+	IN ULONG PayloadLength
+)
+/*++
+
+Routine Description:
+
+	Called from the ISR for every delta report while host side
+	detection is enabled, reports the detected contacts.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	ReportContext - Report context contacts are sent to
+
+	Payload - Delta image
+
+	PayloadLength - Payload length in bytes
+
+Return Value:
+
+	None
+
+--*/
+{
+	NTSTATUS status;
+	TCM_SOFT_TOUCH* SoftTouch = &ControllerContext->SoftTouch;
+	TCM_SOFT_TOUCH_CONTACT Contacts[SOFT_TOUCH_MAX_CONTACTS];
+	DETECTED_OBJECTS data;
+	ULONG Rows = ControllerContext->AppInfo.NumOfImageRows;
+	ULONG Cols = ControllerContext->AppInfo.NumOfImageCols;
+	ULONG Count, i;
+
+	if (!SoftTouch->Enabled || ReportContext == NULL) {
+		return;
+	}
+
+	if (PayloadLength < Rows * Cols * sizeof(INT16)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_SAMPLES,
+			"Delta image too short for %dx%d: %d bytes",
+			Rows,
+			Cols,
+			PayloadLength);
+		return;
+	}
+
+	Count = TcmSoftTouchDetect(&SoftTouch->Detector,
+		(INT16*)Payload,
+		Rows,
+		Cols,
+		ControllerContext->AppInfo.MaxX,
+		ControllerContext->AppInfo.MaxY,
+		Contacts);
+
+	RtlZeroMemory(&data, sizeof(data));
+
+	for (i = 0; i < SOFT_TOUCH_MAX_CONTACTS; i++) {
+		if (Contacts[i].Present) {
+			data.States[i] = OBJECT_STATE_FINGER_PRESENT_WITH_ACCURATE_POS;
+			data.Positions[i].X = Contacts[i].X;
+			data.Positions[i].Y = Contacts[i].Y;
+		}
+	}
+
+	SoftTouch->Frames++;
+
+	Trace(
+		TRACE_LEVEL_VERBOSE,
+		TRACE_SAMPLES,
+		"Soft touch frame %d: %d contacts",
+		SoftTouch->Frames,
+		Count);
+
+	TcmReportRateUpdate(ControllerContext, &data);
+	TcmDeviceStartTouchReported(ControllerContext, &data);
+
+	status = ReportObjects(ReportContext, data);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_VERBOSE,
+			TRACE_SAMPLES,
+			"Error while reporting objects - 0x%08lX",
+			status);
+	}
+}
+
+NTSTATUS
+TcmSoftTouchStart(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Enables the delta report host side detection runs on. Called once
+	the app info is known, after start and after a controller reset.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	NTSTATUS status;
+	TCM_SOFT_TOUCH* SoftTouch = &ControllerContext->SoftTouch;
+	UINT8 ReportType = TCM_REPORT_DELTA;
+
+	if (!SoftTouch->Enabled) {
+		return STATUS_SUCCESS;
+	}
+
+	if (ControllerContext->AppInfo.NumOfImageRows * ControllerContext->AppInfo.NumOfImageCols >
+		SOFT_TOUCH_MAX_PIXELS) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Image %dx%d too large for host side detection",
+			ControllerContext->AppInfo.NumOfImageRows,
+			ControllerContext->AppInfo.NumOfImageCols);
+		SoftTouch->Enabled = FALSE;
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	TcmSoftTouchDetectorReset(&SoftTouch->Detector);
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_ENABLE_REPORT,
+		&ReportType,
+		sizeof(ReportType),
+		NULL,
+		NULL);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Error enabling delta report - 0x%08lX",
+			status);
+		SoftTouch->Enabled = FALSE;
+	}
+
+	return status;
+}
+
+VOID
+TcmSoftTouchInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Reads the SoftwareTouch, SoftwareTouchThreshold and
+	SoftwareTouchTranspose registry values. Host side detection is off
+	unless SoftwareTouch is 1.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None
+
+--*/
+{
+	TCM_SOFT_TOUCH* SoftTouch = &ControllerContext->SoftTouch;
+	DWORD enabled = 0;
+	DWORD threshold = SOFT_TOUCH_THRESHOLD;
+	DWORD transpose = 0;
+
+	RtlReadRegistryValue(
+		SOFT_TOUCH_REG_KEY,
+		L"SoftwareTouch",
+		REG_DWORD,
+		&enabled,
+		sizeof(DWORD));
+
+	RtlReadRegistryValue(
+		SOFT_TOUCH_REG_KEY,
+		L"SoftwareTouchThreshold",
+		REG_DWORD,
+		&threshold,
+		sizeof(DWORD));
+
+	RtlReadRegistryValue(
+		SOFT_TOUCH_REG_KEY,
+		L"SoftwareTouchTranspose",
+		REG_DWORD,
+		&transpose,
+		sizeof(DWORD));
+
+	SoftTouch->Enabled = enabled == 1;
+
+	TcmSoftTouchDetectorInitialize(&SoftTouch->Detector,
+		(INT16)max(1, min(threshold, MAXSHORT)),
+		transpose == 1);
+}
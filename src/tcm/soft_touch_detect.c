@@ -0,0 +1,302 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		soft_touch_detect.c
+
+	Abstract:
+
+		Finds contacts in delta images: thresholding, 4-connected
+		components and a weighted centroid, then matching to the previous
+		frame to keep contact slots stable.
+
+		All state lives in the detector, nothing is allocated per frame.
+		Only the C library is used, see soft_touch_detect.h.
+
+	Environment:
+
+		Kernel mode and user mode
+
+	Revision History:
+
+--*/
+
+#include <string.h>
+#include <tcm/soft_touch_detect.h>
+
+#define SOFT_TOUCH_SUBPIXEL_SHIFT 8
+
+static uint32_t
+TcmSoftTouchLabel(
+	TCM_SOFT_TOUCH_DETECTOR* Detector,
+	const int16_t* Image,
+	uint32_t Rows,
+	uint32_t Cols,
+	uint32_t Seed,
+	uint8_t Label,
+	TCM_SOFT_TOUCH_BLOB* Blob
+)
+{
+	uint16_t* Stack = Detector->Stack;
+	uint8_t* Labels = Detector->Labels;
+	uint32_t Top = 0;
+	uint32_t Index, Row, Col;
+	int64_t Weight;
+
+	memset(Blob, 0, sizeof(*Blob));
+
+	//
+	// Pixels are labelled when pushed, so each one is pushed once and
+	// the stack never holds more than Rows * Cols entries
+	//
+	Labels[Seed] = Label;
+	Stack[Top++] = (uint16_t)Seed;
+
+	while (Top != 0) {
+		Index = Stack[--Top];
+		Row = Index / Cols;
+		Col = Index % Cols;
+
+		Weight = (int64_t)Image[Index] - Detector->Threshold + 1;
+		Blob->Weight += Weight;
+		Blob->SumX += Weight * Col;
+		Blob->SumY += Weight * Row;
+		Blob->Pixels++;
+
+		if (Image[Index] > Blob->Peak) {
+			Blob->Peak = Image[Index];
+		}
+
+		if (Col > 0 && Labels[Index - 1] == SOFT_TOUCH_LABEL_ACTIVE) {
+			Labels[Index - 1] = Label;
+			Stack[Top++] = (uint16_t)(Index - 1);
+		}
+		if (Col + 1 < Cols && Labels[Index + 1] == SOFT_TOUCH_LABEL_ACTIVE) {
+			Labels[Index + 1] = Label;
+			Stack[Top++] = (uint16_t)(Index + 1);
+		}
+		if (Row > 0 && Labels[Index - Cols] == SOFT_TOUCH_LABEL_ACTIVE) {
+			Labels[Index - Cols] = Label;
+			Stack[Top++] = (uint16_t)(Index - Cols);
+		}
+		if (Row + 1 < Rows && Labels[Index + Cols] == SOFT_TOUCH_LABEL_ACTIVE) {
+			Labels[Index + Cols] = Label;
+			Stack[Top++] = (uint16_t)(Index + Cols);
+		}
+	}
+
+	return Blob->Pixels;
+}
+
+void
+TcmSoftTouchDetectorInitialize(
+	TCM_SOFT_TOUCH_DETECTOR* Detector,
+	int16_t Threshold,
+	int Transpose
+)
+/*++
+
+Routine Description:
+
+	Sets up a detector with no contacts tracked
+
+Arguments:
+
+	Detector - Detector state and scratch buffers
+
+	Threshold - Lowest delta that belongs to a contact, at least 1
+
+	Transpose - Nonzero if image rows map to X
+
+Return Value:
+
+	None
+
+--*/
+{
+	memset(Detector, 0, sizeof(*Detector));
+
+	Detector->Threshold = Threshold > 0 ? Threshold : 1;
+	Detector->Transpose = Transpose != 0;
+	Detector->MinPixels = SOFT_TOUCH_MIN_PIXELS;
+}
+
+void
+TcmSoftTouchDetectorReset(
+	TCM_SOFT_TOUCH_DETECTOR* Detector
+)
+/*++
+
+Routine Description:
+
+	Forgets the contacts of the previous frame, the next contacts take
+	new slots
+
+Arguments:
+
+	Detector - Detector state and scratch buffers
+
+Return Value:
+
+	None
+
+--*/
+{
+	memset(Detector->Contacts, 0, sizeof(Detector->Contacts));
+}
+
+uint32_t
+TcmSoftTouchDetect(
+	TCM_SOFT_TOUCH_DETECTOR* Detector,
+	const int16_t* Image,
+	uint32_t Rows,
+	uint32_t Cols,
+	uint32_t MaxX,
+	uint32_t MaxY,
+	TCM_SOFT_TOUCH_CONTACT* Contacts
+)
+/*++
+
+Routine Description:
+
+	Finds contacts in one delta image and assigns them to the slots of
+	the nearest contacts of the previous frame. Image columns map to X
+	unless the panel is transposed.
+
+Arguments:
+
+	Detector - Detector state and scratch buffers
+
+	Image - Rows * Cols delta samples
+
+	Rows, Cols - Image dimensions
+
+	MaxX, MaxY - Panel coordinate range
+
+	Contacts - Receives SOFT_TOUCH_MAX_CONTACTS slots
+
+Return Value:
+
+	Number of contacts found
+
+--*/
+{
+	uint8_t* Labels = Detector->Labels;
+	TCM_SOFT_TOUCH_CONTACT* Previous = Detector->Contacts;
+	TCM_SOFT_TOUCH_CONTACT Found[SOFT_TOUCH_MAX_CONTACTS];
+	TCM_SOFT_TOUCH_BLOB Dropped;
+	uint8_t Taken[SOFT_TOUCH_MAX_CONTACTS];
+	uint32_t Pixels = Rows * Cols;
+	uint32_t Count = 0;
+	uint32_t Index, i, j, Best;
+	int64_t Distance, BestDistance, MaxJump;
+	int64_t X, Y;
+	int16_t Threshold = Detector->Threshold;
+
+	memset(Contacts, 0, sizeof(Found));
+
+	if (Pixels == 0 || Pixels > SOFT_TOUCH_MAX_PIXELS) {
+		return 0;
+	}
+
+	//
+	// Branch free so the compiler can vectorize it, this is the only
+	// pass that touches every pixel on a quiet panel
+	//
+	for (Index = 0; Index < Pixels; Index++) {
+		Labels[Index] = (uint8_t)(-(Image[Index] >= Threshold) & SOFT_TOUCH_LABEL_ACTIVE);
+	}
+
+	for (Index = 0; Index < Pixels; Index++) {
+		if (Labels[Index] != SOFT_TOUCH_LABEL_ACTIVE) {
+			continue;
+		}
+
+		if (Count == SOFT_TOUCH_MAX_CONTACTS) {
+			TcmSoftTouchLabel(Detector, Image, Rows, Cols, Index,
+				SOFT_TOUCH_LABEL_DROPPED, &Dropped);
+			continue;
+		}
+
+		if (TcmSoftTouchLabel(Detector, Image, Rows, Cols, Index,
+			(uint8_t)(Count + 1), &Detector->Blobs[Count]) < Detector->MinPixels) {
+			continue;
+		}
+
+		//
+		// Sub-pixel centroid, the panel range spans the full cells
+		//
+		X = ((Detector->Blobs[Count].SumX << SOFT_TOUCH_SUBPIXEL_SHIFT) / Detector->Blobs[Count].Weight) +
+			(1 << (SOFT_TOUCH_SUBPIXEL_SHIFT - 1));
+		Y = ((Detector->Blobs[Count].SumY << SOFT_TOUCH_SUBPIXEL_SHIFT) / Detector->Blobs[Count].Weight) +
+			(1 << (SOFT_TOUCH_SUBPIXEL_SHIFT - 1));
+
+		if (Detector->Transpose) {
+			Found[Count].X = (int32_t)((Y * MaxX) / ((int64_t)Rows << SOFT_TOUCH_SUBPIXEL_SHIFT));
+			Found[Count].Y = (int32_t)((X * MaxY) / ((int64_t)Cols << SOFT_TOUCH_SUBPIXEL_SHIFT));
+		}
+		else {
+			Found[Count].X = (int32_t)((X * MaxX) / ((int64_t)Cols << SOFT_TOUCH_SUBPIXEL_SHIFT));
+			Found[Count].Y = (int32_t)((Y * MaxY) / ((int64_t)Rows << SOFT_TOUCH_SUBPIXEL_SHIFT));
+		}
+
+		Count++;
+	}
+
+	//
+	// Keep a contact in its slot while it moves less than an eighth of
+	// the panel per frame, new contacts take the first free slot
+	//
+	memset(Taken, 0, sizeof(Taken));
+	MaxJump = ((int64_t)MaxX + MaxY) / 8;
+	MaxJump *= MaxJump;
+
+	for (i = 0; i < Count; i++) {
+		Best = SOFT_TOUCH_MAX_CONTACTS;
+		BestDistance = MaxJump;
+
+		for (j = 0; j < SOFT_TOUCH_MAX_CONTACTS; j++) {
+			if (Taken[j] || !Previous[j].Present) {
+				continue;
+			}
+
+			X = (int64_t)Found[i].X - Previous[j].X;
+			Y = (int64_t)Found[i].Y - Previous[j].Y;
+			Distance = X * X + Y * Y;
+
+			if (Distance <= BestDistance) {
+				BestDistance = Distance;
+				Best = j;
+			}
+		}
+
+		if (Best == SOFT_TOUCH_MAX_CONTACTS) {
+			for (j = 0; j < SOFT_TOUCH_MAX_CONTACTS; j++) {
+				if (!Taken[j] && !Previous[j].Present) {
+					Best = j;
+					break;
+				}
+			}
+		}
+
+		//
+		// Fall back to any slot left over, e.g. when every contact
+		// lifted and landed elsewhere within one frame
+		//
+		for (j = 0; Best == SOFT_TOUCH_MAX_CONTACTS && j < SOFT_TOUCH_MAX_CONTACTS; j++) {
+			if (!Taken[j]) {
+				Best = j;
+			}
+		}
+
+		Taken[Best] = 1;
+		Contacts[Best].Present = 1;
+		Contacts[Best].X = Found[i].X;
+		Contacts[Best].Y = Found[i].Y;
+	}
+
+	memcpy(Previous, Contacts, sizeof(Found));
+
+	return Count;
+}
@@ -27,6 +27,268 @@ static void SignalEvent(PKEVENT event)
 	}
 }
 
+static void PollForResponse(
+	TCM_CONTROLLER_CONTEXT* ControllerContext,
+	SPB_CONTEXT* SpbContext,
+	LONGLONG timeout_ms)
+{
+	LARGE_INTEGER PollInterval;
+	LONGLONG Elapsed;
+
+	PollInterval.QuadPart = RESPONSE_POLL_INTERVAL;
+
+	for (Elapsed = 0; Elapsed < timeout_ms; Elapsed++) {
+		TcmReadMessage(ControllerContext, SpbContext, NULL);
+
+		if (ControllerContext->CommandStatus != CMD_BUSY)
+			break;
+
+		KeDelayExecutionThread(KernelMode, FALSE, &PollInterval);
+	}
+}
+
+static VOID
+TcmWritePostedCommand(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Writes the command posted by a submitter, if there is one. Must be
+	called with the ControllerLock held.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None. The submitter finds the status of the write in its submission.
+
+--*/
+{
+	TCM_COMMAND_SUBMIT* Submit;
+
+	Submit = InterlockedExchangePointer(&ControllerContext->PostedCommand, NULL);
+
+	if (Submit == NULL) {
+		return;
+	}
+
+	ControllerContext->CurrentCommand = Submit->Command;
+	ControllerContext->CommandStatus = CMD_BUSY;
+	ControllerContext->ResponseCode = TCM_STATUS_INVALID;
+
+	//
+	// Drop a late response to an earlier attempt
+	//
+	KeClearEvent(&ControllerContext->ResponseSignal->Event);
+
+	Submit->Status = SpbDoWriteDataSynchronously(
+		Submit->SpbContext,
+		Submit->Command,
+		Submit->Buffer,
+		Submit->Length
+	);
+
+	//
+	// The submission belongs to the submitter again from here on
+	//
+	KeSetEvent(&Submit->Written, IO_NO_INCREMENT, FALSE);
+}
+
+VOID
+TcmReleaseController(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Writes any posted command and releases the ControllerLock. A command
+	posted after the write is picked up again if the lock is still free,
+	otherwise its new owner writes it.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None
+
+--*/
+{
+	LONGLONG NoWait = 0;
+
+	do {
+		TcmWritePostedCommand(ControllerContext);
+		WdfWaitLockRelease(ControllerContext->ControllerLock);
+
+		if (InterlockedCompareExchangePointer(&ControllerContext->PostedCommand, NULL, NULL) == NULL) {
+			break;
+		}
+	} while (WdfWaitLockAcquire(ControllerContext->ControllerLock, &NoWait) == STATUS_SUCCESS);
+}
+
+static VOID
+TcmLockTimeRecord(
+	IN TCM_LOCK_TIME_STATS* Stats,
+	IN LARGE_INTEGER Start,
+	IN LARGE_INTEGER Frequency
+)
+/*++
+
+Routine Description:
+
+	Accounts the time from Start to now. Called with the lock the
+	statistics belong to held.
+
+--*/
+{
+	LARGE_INTEGER End = KeQueryPerformanceCounter(NULL);
+	ULONG Us = (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+	ULONG Bucket = 0;
+
+	while (Bucket < TCM_LOCK_HISTOGRAM_BUCKETS - 1 && Us >= (1UL << Bucket)) {
+		Bucket++;
+	}
+
+	Stats->Count++;
+	Stats->MaxUs = MAX(Stats->MaxUs, Us);
+	Stats->TotalUs += Us;
+	Stats->Histogram[Bucket]++;
+}
+
+VOID
+TcmLockCommands(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Takes the CommandLock for the current thread. Callers that read
+	ResponseData after TcmWriteMessage hold it across both, so that the
+	response they read is the one to their own command. The lock may be
+	taken again by its owner.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None
+
+--*/
+{
+	LARGE_INTEGER Start, Frequency;
+
+	if (ControllerContext->CommandOwner == KeGetCurrentThread()) {
+		ControllerContext->CommandDepth++;
+		return;
+	}
+
+	Start = KeQueryPerformanceCounter(&Frequency);
+
+	WdfWaitLockAcquire(ControllerContext->CommandLock, NULL);
+
+	ControllerContext->CommandOwner = KeGetCurrentThread();
+	ControllerContext->CommandDepth = 1;
+
+	TcmLockTimeRecord(&ControllerContext->LockStats.CommandWait, Start, Frequency);
+}
+
+VOID
+TcmUnlockCommands(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Releases a hold on the CommandLock taken by TcmLockCommands
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None
+
+--*/
+{
+	if (--ControllerContext->CommandDepth != 0) {
+		return;
+	}
+
+	ControllerContext->CommandOwner = NULL;
+	WdfWaitLockRelease(ControllerContext->CommandLock);
+}
+
+static VOID
+TcmLockTimeTrace(
+	IN PCSTR Name,
+	IN TCM_LOCK_TIME_STATS* Stats
+)
+{
+	ULONG i;
+
+	if (Stats->Count == 0) {
+		return;
+	}
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"%s: %d times, avg %d us, max %d us",
+		Name,
+		Stats->Count,
+		(ULONG)(Stats->TotalUs / Stats->Count),
+		Stats->MaxUs);
+
+	for (i = 0; i < TCM_LOCK_HISTOGRAM_BUCKETS; i++) {
+		if (Stats->Histogram[i] != 0) {
+			Trace(
+				TRACE_LEVEL_INFORMATION,
+				TRACE_DRIVER,
+				"%s: %d under %d us",
+				Name,
+				Stats->Histogram[i],
+				1 << i);
+		}
+	}
+}
+
+VOID
+TcmLockStatsTrace(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Traces how long message reads held the ControllerLock and how long
+	submitters waited for the CommandLock. The last histogram bucket
+	also counts everything longer.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None
+
+--*/
+{
+	TcmLockTimeTrace("ControllerLock hold", &ControllerContext->LockStats.IsrHold);
+	TcmLockTimeTrace("CommandLock wait", &ControllerContext->LockStats.CommandWait);
+}
+
 NTSTATUS
 TcmServiceInterrupts(
 	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
@@ -41,14 +303,136 @@ TcmServiceInterrupts(
 		TRACE_INTERRUPT,
 		"ISRCount = %d",
 		ControllerContext->ISRCount);
-	if(ControllerContext->ControllerState.Init == TRUE)
+
+	//
+	// The servicing thread reads the message while we wait, unless it
+	// polls because interrupts cannot be trusted right now
+	//
+	if (ControllerContext->Servicing.Thread != NULL &&
+		!ControllerContext->Servicing.Polling) {
+		status = TcmServicingHandoff(ControllerContext,
+			SpbContext,
+			ReportContext);
+	}
+	else if(ControllerContext->ControllerState.Init == TRUE)
 		status = TcmReadMessage(ControllerContext,
 							SpbContext,
 							ReportContext);
 
+	//
+	// A wake gesture read by a polled command response waits for us
+	//
+	TcmWakeGestureDeliver(ControllerContext, ReportContext);
+
 	return status;
 }
 
+static ULONG
+TcmReadMessageNext(
+	IN PVOID Context,
+	IN PUCHAR Data,
+	IN ULONG Length
+)
+/*++
+
+Routine Description:
+
+	Decides from a message header whether a payload follows and how
+	long it is. Called from the completion of the header read.
+
+Arguments:
+
+	Context - Unused
+
+	Data - The message read so far
+
+	Length - Number of bytes read so far
+
+Return Value:
+
+	Length of the payload read, 0 if there is none or the payload has
+	been read already
+
+--*/
+{
+	TCM_MSG_HEADER* Header = (TCM_MSG_HEADER*)Data;
+
+	UNREFERENCED_PARAMETER(Context);
+
+	if (Length != MESSAGE_HEADER_SIZE || Header->Marker != MESSAGE_MARKER) {
+		return 0;
+	}
+
+	switch (Header->Code) {
+	case TCM_STATUS_IDLE:
+	case TCM_STATUS_BUSY:
+	case TCM_STATUS_CONTINUED_READ:
+	case TCM_STATUS_INVALID:
+		return 0;
+	default:
+		break;
+	}
+
+	//
+	// The payload comes back behind a continued read marker and code,
+	// and is followed by a padding byte
+	//
+	return Header->Length == 0 ? 0 : Header->Length + 3;
+}
+
+static VOID
+TcmRecoveryMessageLost(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	TCM_RECOVERY_STATS* Stats = &ControllerContext->RecoveryStats;
+
+	if (Stats->FramesLost == 0) {
+		Stats->FirstLostTime = KeQueryInterruptTime();
+	}
+
+	Stats->FramesLost++;
+	Stats->LostMessages++;
+}
+
+static VOID
+TcmRecoveryMessageValid(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Ends a run of lost messages, if there is one, and accounts how long
+	it took to get a valid message again.
+
+--*/
+{
+	TCM_RECOVERY_STATS* Stats = &ControllerContext->RecoveryStats;
+	ULONG RecoveryUs;
+
+	if (Stats->FramesLost == 0) {
+		return;
+	}
+
+	RecoveryUs = (ULONG)((KeQueryInterruptTime() - Stats->FirstLostTime) / 10);
+
+	Stats->Recoveries++;
+	Stats->LastRecoveryUs = RecoveryUs;
+	Stats->MaxRecoveryUs = MAX(Stats->MaxRecoveryUs, RecoveryUs);
+	Stats->MaxFramesLost = MAX(Stats->MaxFramesLost, Stats->FramesLost);
+	Stats->TotalRecoveryUs += RecoveryUs;
+
+	Trace(
+		TRACE_LEVEL_WARNING,
+		TRACE_SAMPLES,
+		"Back in sync after %d lost messages in %d us",
+		Stats->FramesLost,
+		RecoveryUs);
+
+	Stats->FramesLost = 0;
+}
+
 NTSTATUS
 TcmReadMessage(
 	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
@@ -57,6 +441,7 @@ TcmReadMessage(
 )
 {
 	NTSTATUS status = STATUS_NO_DATA_DETECTED;
+	LARGE_INTEGER HoldStart, Frequency;
 
 	//
 	// Grab a waitlock to ensure the ISR executes serially and is 
@@ -64,26 +449,26 @@ TcmReadMessage(
 	//
 	WdfWaitLockAcquire(ControllerContext->ControllerLock, NULL);
 
-	TCM_MSG_HEADER* messageHeader = NULL;
-	UINT8 *payloadPtr = NULL, *payloadData = NULL;
-	int readLength = 0;
-
-	messageHeader = ExAllocatePoolWithTag(
-		NonPagedPoolNx,
-		MESSAGE_HEADER_SIZE,
-		TOUCH_POOL_TAG_MSG
-	);
+	HoldStart = KeQueryPerformanceCounter(&Frequency);
 
-	if (messageHeader == NULL)
-	{
-		status = STATUS_INSUFFICIENT_RESOURCES;
-		goto exit;
-	}
+	TCM_MSG_HEADER* messageHeader = (TCM_MSG_HEADER*)ControllerContext->MessageBuffer;
+	UINT8 *payloadPtr = NULL;
+	ULONG messageLength = 0;
+	int readLength = 0;
 
-	status = SpbReadContinuedData(
+	//
+	// The payload read is sent from the completion of the header read,
+	// so the whole message costs a single wait. The ControllerLock is
+	// also the SpbLock, the bus is ours already.
+	//
+	status = SpbDoReadContinuedDataChained(
 		SpbContext,
-		messageHeader,
-		MESSAGE_HEADER_SIZE
+		MESSAGE_HEADER_SIZE,
+		TcmReadMessageNext,
+		NULL,
+		ControllerContext->MessageBuffer,
+		sizeof(ControllerContext->MessageBuffer),
+		&messageLength
 	);
 
 	if (!NT_SUCCESS(status))
@@ -91,10 +476,11 @@ TcmReadMessage(
 		Trace(
 			TRACE_LEVEL_ERROR,
 			TRACE_SAMPLES,
-			"Could not read message header- %X",
+			"Could not read message - %X",
 			status);
 
-		goto free_buffer;
+		TcmRecoveryMessageLost(ControllerContext);
+		goto exit;
 	}
 
 	if (messageHeader->Marker != MESSAGE_MARKER) {
@@ -104,7 +490,8 @@ TcmReadMessage(
 			"Invalid message header marker- 0x%x",
 			messageHeader->Marker);
 		status = STATUS_NO_DATA_DETECTED;
-		goto free_buffer;
+		TcmRecoveryMessageLost(ControllerContext);
+		goto exit;
 	}
 
 	Trace(
@@ -124,9 +511,19 @@ TcmReadMessage(
 				TRACE_LEVEL_VERBOSE,
 				TRACE_SAMPLES,
 				"Out-of-sync continued read");
+			TcmRecoveryMessageLost(ControllerContext);
 		case TCM_STATUS_IDLE:
+			goto exit;
+			break;
 		case TCM_STATUS_BUSY:
-			goto free_buffer;
+			//
+			// The controller turned down the command in flight, the
+			// retry policy decides what happens to it. Out of a command
+			// there is nothing to read yet.
+			//
+			if (ControllerContext->CommandStatus != CMD_BUSY) {
+				goto exit;
+			}
 			break;
 		default:
 			if(messageHeader->Code == TCM_STATUS_INVALID) {
@@ -137,41 +534,22 @@ TcmReadMessage(
 	}
 
 	readLength = messageHeader->Length + 3;
-
-	payloadData = ExAllocatePoolWithTag(
-		NonPagedPoolNx,
-		readLength + 4,
-		TOUCH_POOL_TAG_MSG
-	);
-
-	if (payloadData == NULL)
-	{
-		status = STATUS_INSUFFICIENT_RESOURCES;
-		goto free_buffer;
-	}
-	RtlZeroMemory(payloadData, readLength + 4);
-	RtlCopyMemory(payloadData, messageHeader, MESSAGE_HEADER_SIZE);
-	payloadPtr = &(payloadData[4]);
+	payloadPtr = &ControllerContext->MessageBuffer[MESSAGE_HEADER_SIZE];
 
 	if (messageHeader->Length == 0) {
+		RtlZeroMemory(payloadPtr, readLength);
 		payloadPtr[readLength - 1] = MESSAGE_PADDING;
 	}
 	else {
-		status = SpbReadContinuedData(
-			SpbContext,
-			payloadPtr,
-			readLength
-		);
-
-		if (!NT_SUCCESS(status))
-		{
+		if (messageLength != MESSAGE_HEADER_SIZE + readLength) {
 			Trace(
 				TRACE_LEVEL_ERROR,
 				TRACE_SAMPLES,
-				"Could not read message payload- %X",
-				status);
-
-			goto free_buffer;
+				"Message payload missing, read %d bytes",
+				messageLength);
+			status = STATUS_NO_DATA_DETECTED;
+			TcmRecoveryMessageLost(ControllerContext);
+			goto exit;
 		}
 
 		if (payloadPtr[0] != MESSAGE_MARKER || payloadPtr[1] != TCM_STATUS_CONTINUED_READ) {
@@ -181,7 +559,8 @@ TcmReadMessage(
 				"Incorrect continued read header marker/code(0x%02x/0x%02x)",
 				payloadPtr[0], payloadPtr[1]);
 			status = STATUS_NO_DATA_DETECTED;
-			goto free_buffer;
+			TcmRecoveryMessageLost(ControllerContext);
+			goto exit;
 		}
 
 		payloadPtr += 2;
@@ -197,14 +576,23 @@ TcmReadMessage(
 			"Incorrect message padding byte: 0x%02x",
 			temp);
 		status = STATUS_NO_DATA_DETECTED;
-		goto free_buffer;
+		TcmRecoveryMessageLost(ControllerContext);
+		goto exit;
 	}
 
+	TcmRecoveryMessageValid(ControllerContext);
+	ControllerContext->MessageCount++;
+
 	if (messageHeader->Code >= TCM_REPORT_IDENTIFY) {
 		ControllerContext->ReportCode = messageHeader->Code;
 		switch(messageHeader->Code) {
 			case TCM_REPORT_TOUCH:
-				if(ControllerContext->ControllerState.Init == TRUE) {
+				if(ControllerContext->SoftTouch.Enabled) {
+					// Contacts come from the delta images instead
+					break;
+				}
+				if(ControllerContext->ControllerState.Init == TRUE &&
+					ControllerContext->DeviceStart.ReportsEnabled) {
 					status = TcmDispatchReport(ControllerContext,
 											ReportContext,
 											messageHeader,
@@ -227,7 +615,7 @@ TcmReadMessage(
 						TRACE_SAMPLES,
 						"Received ID Info smaller than buffer");
 					status = STATUS_INVALID_PARAMETER;
-					goto free_buffer;
+					goto exit;
 				}
 				RtlCopyMemory(&ControllerContext->IDInfo, payloadPtr, sizeof(TCM_ID_INFO));
 				ControllerContext->ChunkSize = MIN(ControllerContext->IDInfo.MaxWriteSize, DEFAULT_CHUNK_SIZE);
@@ -245,8 +633,14 @@ TcmReadMessage(
 						case CMD_RUN_APPLICATION_FIRMWARE:
 						case CMD_ENTER_PRODUCTION_TEST_MODE:
 						case CMD_ROMBOOT_RUN_BOOTLOADER_FIRMWARE:
+							//
+							// The identify report is the response to these
+							//
 							ControllerContext->CurrentResponse = TCM_STATUS_OK;
+							ControllerContext->ResponseCode = TCM_STATUS_OK;
+							ControllerContext->ResponseData.DataLength = 0;
 							ControllerContext->CommandStatus = CMD_IDLE;
+							SignalEvent(&ControllerContext->ResponseSignal->Event);
 							break;
 						default:
 							ControllerContext->CommandStatus = CMD_ERROR;
@@ -260,15 +654,51 @@ TcmReadMessage(
 						"Received identify report with Init done state (IC reset occured, need reinit)");
 					ControllerContext->ControllerState.Init = FALSE;
 				}
+
+				//
+				// Whatever was still being worked on is gone
+				//
+				ControllerContext->ResponseOwed = FALSE;
 				break;
 			case TCM_REPORT_RAW:
 			case TCM_REPORT_DELTA:
-				// TODO
+				TcmImageStreamDispatch(ControllerContext,
+									messageHeader->Code,
+									payloadPtr,
+									readLength - 1);
+				if(messageHeader->Code == TCM_REPORT_DELTA) {
+					TcmSoftTouchDispatch(ControllerContext,
+										ReportContext,
+										payloadPtr,
+										readLength - 1);
+				}
+				break;
 			default:
 				break;
 		}
 	}
 	else { // Response
+		//
+		// Busy and pending are answers to the attempt just written,
+		// anything else is the answer to the one that timed out. Out
+		// of a command it is dropped below like any other.
+		//
+		if (ControllerContext->ResponseOwed &&
+			messageHeader->Code != TCM_STATUS_BUSY &&
+			messageHeader->Code != TCM_STATUS_PREVIOUS_COMMAND_PENDING) {
+			ControllerContext->ResponseOwed = FALSE;
+
+			if (ControllerContext->CommandStatus == CMD_BUSY) {
+				Trace(
+					TRACE_LEVEL_WARNING,
+					TRACE_SAMPLES,
+					"Dropped late response 0x%02x to an earlier attempt",
+					messageHeader->Code);
+				ControllerContext->LateResponses++;
+				goto exit;
+			}
+		}
+
 		ControllerContext->ResponseCode = messageHeader->Code;
 		status = TcmDispatchResponse(ControllerContext,
 								ReportContext,
@@ -285,16 +715,15 @@ TcmReadMessage(
 		}
 	}
 
-free_buffer:
-	if (messageHeader != NULL) {
-		ExFreePoolWithTag(
-			messageHeader,
-			TOUCH_POOL_TAG_MSG
-		);
-	}
-
 exit:
-	WdfWaitLockRelease(ControllerContext->ControllerLock);
+	//
+	// The hold includes writing a command posted meanwhile, the lock is
+	// not let go before that
+	//
+	TcmWritePostedCommand(ControllerContext);
+	TcmLockTimeRecord(&ControllerContext->LockStats.IsrHold, HoldStart, Frequency);
+
+	TcmReleaseController(ControllerContext);
 	return status;
 }
 
@@ -317,6 +746,9 @@ TcmDispatchReport(
 	UINT8 Code = 0;
 	INT32 DataInt = 0;
 	BOOLEAN ActiveOnly = FALSE, NeedReport = FALSE;
+	UINT8 GestureDetected = DETECT_NORMAL_TOUCH;
+	UINT8 GestureInfo[WAKE_GESTURE_INFO_SIZE] = { 0 };
+	ULONG GestureInfoLength = 0;
 	
 	(void*)MessageHeader;
 	(void*)ControllerContext;
@@ -388,6 +820,7 @@ TcmDispatchReport(
 				if(DataByte == DETECT_NORMAL_TOUCH) {
 					NeedReport = TRUE;
 				}
+				GestureDetected = (UINT8)DataByte;
 				BitsOffset += BitsToRead;
 				break;
 
@@ -406,11 +839,11 @@ TcmDispatchReport(
 							"Failed to get customer gesture Detected");
 						goto exit;
 					}
-					//read into lpwg data buf here
-					// lpwg_data.buf[buf_idx] = DataByte;
+					GestureInfo[BufIdx] = (UINT8)DataByte;
 					BitsOffset += 8;
 					BitsToRead -= 8;
 					BufIdx++;
+					GestureInfoLength = MAX(GestureInfoLength, BufIdx);
 				}
 				break;
 
@@ -429,11 +862,11 @@ TcmDispatchReport(
 							"Failed to get customer gesture Detected");
 						goto exit;
 					}
-					//read into lpwg data buf here
-					// lpwg_data.buf[buf_idx] = DataByte;
+					GestureInfo[BufIdx] = (UINT8)DataByte;
 					BitsOffset += 8;
 					BitsToRead -= 8;
 					BufIdx++;
+					GestureInfoLength = MAX(GestureInfoLength, BufIdx);
 				}
 				break;
 
@@ -595,6 +1028,19 @@ TcmDispatchReport(
 	
 	}
 exit:
+	//
+	// Gesture reports wake the system and never reach the touch path
+	//
+	if (TcmWakeGestureDispatch(ControllerContext,
+			ReportContext,
+			GestureDetected,
+			GestureInfo,
+			GestureInfoLength)) {
+		return Status;
+	}
+
+	TcmReportRateUpdate(ControllerContext, &data);
+
 	// if(NeedReport && ReportContext != NULL) {
 	if(ReportContext != NULL) {
 		Status = ReportObjects(
@@ -609,6 +1055,10 @@ exit:
 				"Error while reporting objects - 0x%08lX",
 				Status);
 		}
+		else
+		{
+			TcmDeviceStartTouchReported(ControllerContext, &data);
+		}
 	}
 
 	return Status;
@@ -637,10 +1087,21 @@ TcmDispatchResponse(
 			TRACE_LEVEL_ERROR,
 			TRACE_SAMPLES,
 			"TcmDispatchResponse: PayloadLength = 0");
+		ControllerContext->ResponseData.DataLength = 0;
 		ControllerContext->CommandStatus = CMD_IDLE;
+		SignalEvent(&ControllerContext->ResponseSignal->Event);
 		return status;
 	}
 
+	if (PayloadLength > sizeof(ControllerContext->ResponseData.Buffer)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_SAMPLES,
+			"TcmDispatchResponse: truncating %d byte response",
+			PayloadLength);
+		PayloadLength = sizeof(ControllerContext->ResponseData.Buffer);
+	}
+
 	RtlZeroMemory(ControllerContext->ResponseData.Buffer, sizeof(ControllerContext->ResponseData.Buffer));
 	ControllerContext->ResponseData.DataLength = PayloadLength;
 	RtlCopyMemory(ControllerContext->ResponseData.Buffer, PayloadData, PayloadLength);
@@ -734,32 +1195,181 @@ TcmParseSingleByte(
 	return STATUS_SUCCESS;
 }
 
-NTSTATUS
-TcmWriteMessage(
+static NTSTATUS
+TcmSendCommand(
 	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
 	IN SPB_CONTEXT* SpbContext,
 	IN UINT8 Command,
-	_In_reads_bytes_(PayloadLength) PVOID Payload,
-	IN ULONG PayloadLength,
-	IN UINT8 *ResponseBuffer,
-	IN ULONG *ResponseLength
+	_In_reads_bytes_(WriteLength) UINT8* Buffer,
+	IN ULONG WriteLength,
+	IN LONGLONG Timeout
 )
-{
-	NTSTATUS status = STATUS_SUCCESS;
-	ULONG WriteLength = 0;
-	UINT8 *PayloadData = (UINT8*)Payload;
-	UINT8* Buffer = NULL;
-	LONGLONG Timeout;
+/*++
 
-	WdfWaitLockAcquire(ControllerContext->ControllerLock, NULL);
+Routine Description:
 
-	Trace(
-		TRACE_LEVEL_ERROR,
-		TRACE_DRIVER,
-		"TcmWriteMessage: command=0x%x, payload=%d, length=%d",
-		Command, (Payload!=NULL) ? 1 : 0, PayloadLength);
+	Makes a single attempt at a command: writes it and waits for the
+	response for up to Timeout ms.
 
-	WriteLength = PayloadLength + 2;
+Return Value:
+
+	STATUS_IO_TIMEOUT if no response arrived, STATUS_SUCCESS once a
+	response of any status code did. Bus errors are passed on.
+
+--*/
+{
+	NTSTATUS status;
+	TCM_COMMAND_SUBMIT Submit;
+	LARGE_INTEGER HandoffTimeout;
+	LONGLONG NoWait = 0;
+
+	Submit.SpbContext = SpbContext;
+	Submit.Command = Command;
+	Submit.Buffer = Buffer;
+	Submit.Length = WriteLength;
+	Submit.Status = STATUS_PENDING;
+	KeInitializeEvent(&Submit.Written, NotificationEvent, FALSE);
+
+	//
+	// Hand the command to the owner of the bus instead of queueing up
+	// for it behind the ISR. The caller holds the CommandLock, so this
+	// is the only command posted or waiting for a response.
+	//
+	NT_ASSERT(ControllerContext->CommandOwner == KeGetCurrentThread());
+
+	InterlockedExchangePointer(&ControllerContext->PostedCommand, &Submit);
+
+	if (WdfWaitLockAcquire(ControllerContext->ControllerLock, &NoWait) == STATUS_SUCCESS) {
+		TcmReleaseController(ControllerContext);
+	}
+
+	//
+	// The ISR writes it as it lets go of the bus. Holders of the lock
+	// that do not touch the bus leave it to us.
+	//
+	HandoffTimeout.QuadPart = WDF_REL_TIMEOUT_IN_MS(COMMAND_HANDOFF_TIMEOUT);
+
+	if (KeWaitForSingleObject(&Submit.Written,
+		Executive,
+		KernelMode,
+		FALSE,
+		&HandoffTimeout) == STATUS_TIMEOUT) {
+		WdfWaitLockAcquire(ControllerContext->ControllerLock, NULL);
+		TcmReleaseController(ControllerContext);
+
+		KeWaitForSingleObject(&Submit.Written,
+			Executive,
+			KernelMode,
+			FALSE,
+			NULL);
+	}
+
+	status = Submit.Status;
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"TcmWriteMessage: failed to write command 0x%02x - 0x%08lX",
+			Command,
+			status);
+		return status;
+	}
+
+	//
+	// Interrupts are not serviced around D0 transitions, nor after an
+	// identify report until the controller is initialized again. Read
+	// the response ourselves instead of waiting out the full timeout.
+	//
+	if (ControllerContext->PollForResponse ||
+		ControllerContext->ControllerState.Init == FALSE)
+		PollForResponse(ControllerContext, SpbContext, Timeout);
+	else
+		WaitForEvent(&ControllerContext->ResponseSignal->Event, Timeout);
+
+	if (ControllerContext->CommandStatus != CMD_IDLE) {
+		//
+		// The response may be waiting without an interrupt having
+		// been serviced for it
+		//
+		TcmReadMessage(ControllerContext,
+			SpbContext,
+			NULL);
+
+		if (ControllerContext->CommandStatus != CMD_IDLE) {
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_DRIVER,
+				"TcmWriteMessage: timed out waiting for response: Command = 0x%02x, CommandStatus = 0x%02x",
+				Command, ControllerContext->CommandStatus);
+			return STATUS_IO_TIMEOUT;
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+TcmWriteMessage(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN UINT8 Command,
+	_In_reads_bytes_(PayloadLength) PVOID Payload,
+	IN ULONG PayloadLength,
+	IN UINT8 *ResponseBuffer,
+	IN ULONG *ResponseLength
+)
+/*++
+
+Routine Description:
+
+	Sends a command and waits for its response. Timeouts and retries
+	follow the command's policy (command_policy.c), latency and retries
+	are recorded in the controller's CommandStats.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+	Command - TCM command id
+
+	Payload - Command payload, may be NULL
+
+	PayloadLength - Length of the payload in bytes
+
+	ResponseBuffer - Optional buffer receiving a copy of the response
+
+	ResponseLength - Receives the response length if ResponseBuffer is used
+
+Return Value:
+
+	NTSTATUS indicating success or failure. STATUS_DEVICE_NOT_READY if
+	the controller did not execute the command because it is in deep
+	sleep.
+
+--*/
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG WriteLength = 0;
+	UINT8 *PayloadData = (UINT8*)Payload;
+	UINT8* Buffer = NULL;
+	const TCM_COMMAND_POLICY* Policy;
+	TCM_COMMAND_STATS* Stats;
+	LARGE_INTEGER Start, End, Frequency;
+	ULONG Attempt, LatencyUs, LateResponses;
+	UINT8 Flag;
+
+	Stats = &ControllerContext->CommandStats[TcmGetCommandPolicy(Command, &Policy)];
+
+	Trace(
+		TRACE_LEVEL_ERROR,
+		TRACE_DRIVER,
+		"TcmWriteMessage: command=0x%x, payload=%d, length=%d",
+		Command, (Payload!=NULL) ? 1 : 0, PayloadLength);
+
+	WriteLength = PayloadLength + 2;
 
 	Buffer = ExAllocatePoolWithTag(
 		NonPagedPoolNx,
@@ -768,13 +1378,9 @@ TcmWriteMessage(
 	);
 
 	if (Buffer == NULL) {
-		status = STATUS_INSUFFICIENT_RESOURCES;
-		goto exit;
+		return STATUS_INSUFFICIENT_RESOURCES;
 	}
 
-	ControllerContext->CurrentCommand = Command;
-	ControllerContext->CommandStatus = CMD_BUSY;
-
 	// Buffer[0] = Command;
 	Buffer[0] = (UINT8)PayloadLength;
 	Buffer[1] = (UINT8)(PayloadLength >> 8);
@@ -783,56 +1389,89 @@ TcmWriteMessage(
 		RtlCopyMemory(&Buffer[2], PayloadData, PayloadLength);
 	}
 
-	if (Command == CMD_GET_BOOT_INFO ||
-		Command == CMD_GET_APPLICATION_INFO ||
-		Command == CMD_READ_FLASH ||
-		Command == CMD_WRITE_FLASH ||
-		Command == CMD_ERASE_FLASH ||
-		Command == CMD_PRODUCTION_TEST) {
-		Timeout = RESPONSE_TIMEOUT_LONG;
-	}
-	else Timeout = RESPONSE_TIMEOUT;
-
-	status = SpbWriteDataSynchronously(
-		SpbContext,
-		Command,
-		Buffer,
-		WriteLength
-	);
+	//
+	// CurrentCommand, CommandStatus, ResponseCode and ResponseData belong
+	// to this command until its response has been copied out
+	//
+	TcmLockCommands(ControllerContext);
 
-	WdfWaitLockRelease(ControllerContext->ControllerLock);
+	Start = KeQueryPerformanceCounter(&Frequency);
 
-	WaitForEvent(&ControllerContext->ResponseSignal->Event, Timeout);
+	for (Attempt = 0; ; Attempt++) {
+		LateResponses = ControllerContext->LateResponses;
 
-	if (ControllerContext->CommandStatus != CMD_IDLE) {
-		status = TcmReadMessage(ControllerContext,
+		status = TcmSendCommand(ControllerContext,
 			SpbContext,
-			NULL);
+			Command,
+			Buffer,
+			WriteLength,
+			Policy->Timeout);
+
+		Stats->LateResponses += ControllerContext->LateResponses - LateResponses;
+
+		if (status == STATUS_IO_TIMEOUT) {
+			Stats->Timeouts++;
+			Flag = TCM_RETRY_TIMEOUT;
+
+			//
+			// An attempt that saw a late response dropped did hear from
+			// the controller, its own write may have been lost. Owing
+			// another response then would drop every answer that
+			// follows.
+			//
+			if (ControllerContext->LateResponses == LateResponses) {
+				ControllerContext->ResponseOwed = TRUE;
+			}
+		}
+		else if (!NT_SUCCESS(status)) {
+			break;
+		}
+		else if (ControllerContext->ResponseCode == TCM_STATUS_BUSY) {
+			Stats->Busy++;
+			Flag = TCM_RETRY_BUSY;
+		}
+		else if (ControllerContext->ResponseCode == TCM_STATUS_PREVIOUS_COMMAND_PENDING) {
+			Stats->Pending++;
+			Flag = TCM_RETRY_PENDING;
+		}
+		else {
+			break;
+		}
 
-		if (!NT_SUCCESS(status)) {
-			Trace(
-				TRACE_LEVEL_ERROR,
-				TRACE_DRIVER,
-				"TcmWriteMessage: timed out waiting for response");
-			status = STATUS_UNSUCCESSFUL;
-			goto free_buffer;
+		if ((Policy->Flags & Flag) == 0 || Attempt >= Policy->Retries) {
+			break;
 		}
 
-		if (ControllerContext->CommandStatus != CMD_IDLE) {
+		Stats->Retries++;
+
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_DRIVER,
+			"TcmWriteMessage: retrying command 0x%02x (%d/%d), response 0x%02x",
+			Command,
+			Attempt + 1,
+			Policy->Retries,
+			ControllerContext->ResponseCode);
+
+		TcmCommandBackoff(Policy, Attempt + 1);
+	}
+
+	if (!NT_SUCCESS(status)) {
+		status = STATUS_UNSUCCESSFUL;
+		goto free_buffer;
+	}
+
+	if (ControllerContext->ResponseCode != TCM_STATUS_OK) {
+		if (ControllerContext->ResponseCode == TCM_STATUS_NOT_EXECUTED_IN_DEEP_SLEEP) {
 			Trace(
 				TRACE_LEVEL_ERROR,
 				TRACE_DRIVER,
-				"TcmWriteMessage: CommandStatus is not CMD_IDLE: Command = 0x%02x, CommandStatus = 0x%02x",
-				Command, ControllerContext->CommandStatus);
-			status = STATUS_UNSUCCESSFUL;
+				"TcmWriteMessage: command 0x%02x not executed in deep sleep",
+				Command);
+			ControllerContext->ControllerState.Power = TCM_POWER_SLEEP;
+			status = STATUS_DEVICE_NOT_READY;
 			goto free_buffer;
 		}
-	}
-
-	if (ControllerContext->ResponseCode != TCM_STATUS_OK) {
-		if (ControllerContext->ResponseData.DataLength != 0) {
-
-		}
 		status = STATUS_UNSUCCESSFUL;
 		goto free_buffer;
 	}
@@ -844,14 +1483,24 @@ TcmWriteMessage(
 	}
 
 free_buffer:
-	if (Buffer != NULL) {
-		ExFreePoolWithTag(
-			Buffer,
-			TOUCH_POOL_TAG_MSG
-		);
+	End = KeQueryPerformanceCounter(NULL);
+	LatencyUs = (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+
+	Stats->Sent++;
+	Stats->TotalLatencyUs += LatencyUs;
+	Stats->MaxLatencyUs = MAX(Stats->MaxLatencyUs, LatencyUs);
+
+	if (!NT_SUCCESS(status)) {
+		Stats->Failed++;
 	}
 
-exit:
+	TcmUnlockCommands(ControllerContext);
+
+	ExFreePoolWithTag(
+		Buffer,
+		TOUCH_POOL_TAG_MSG
+	);
+
 	return status;
 }
 
@@ -939,14 +1588,14 @@ TcmGetIcInfo(
 				TRACE_LEVEL_ERROR,
 				TRACE_DRIVER,
 				"Current FW Mode: ROM Bootloader mode");
-			/*status = TcmGetROMBootInfo(ControllerContext, SpbContext);
+			status = TcmGetRomBootInfo(ControllerContext, SpbContext);
 			if (!NT_SUCCESS(status)) {
 				Trace(
 					TRACE_LEVEL_ERROR,
 					TRACE_DRIVER,
 					"Failed to get romboot_info");
 				goto error;
-			}*/
+			}
 			break;
 		case MODE_BOOTLOADER:
 		case MODE_TDDI_BOOTLOADER:
@@ -965,7 +1614,7 @@ TcmGetIcInfo(
 			break;
 	}
 
-//error:
+error:
 	return status;
 }
 
@@ -976,14 +1625,17 @@ TcmGetAppInfo(
 )
 {
 	NTSTATUS status = STATUS_SUCCESS;
-	INT RetryCount = 0;
+	ULONG RetryCount = 0;
+	ULONG ReadLength, WriteLength;
 	TCM_APP_INFO* Info;
-	LARGE_INTEGER PollInterval;
+	const TCM_COMMAND_POLICY* Policy;
+	TCM_COMMAND_STATS* Stats;
 
-	PollInterval.QuadPart = STATUS_POLL_INTERVAL;
+	Stats = &ControllerContext->CommandStats[TcmGetCommandPolicy(CMD_GET_APPLICATION_INFO, &Policy)];
 
 retry:
-	RetryCount++;
+	TcmLockCommands(ControllerContext);
+
 	status = TcmWriteMessage(ControllerContext,
 		SpbContext,
 		CMD_GET_APPLICATION_INFO,
@@ -992,6 +1644,14 @@ retry:
 		NULL,
 		NULL);
 
+	if (NT_SUCCESS(status)) {
+		RtlCopyMemory(&ControllerContext->AppInfo,
+			ControllerContext->ResponseData.Buffer,
+			MIN(sizeof(TCM_APP_INFO), ControllerContext->ResponseData.DataLength));
+	}
+
+	TcmUnlockCommands(ControllerContext);
+
 	if (!NT_SUCCESS(status)) {
 		Trace(
 			TRACE_LEVEL_ERROR,
@@ -1000,18 +1660,19 @@ retry:
 		goto exit;
 	}
 
-	RtlCopyMemory(&ControllerContext->AppInfo,
-		ControllerContext->ResponseData.Buffer,
-		MIN(sizeof(TCM_APP_INFO), ControllerContext->ResponseData.DataLength));
-
+	//
+	// The firmware is still coming up, poll on the command's backoff
+	//
 	if (ControllerContext->AppInfo.Status != APP_STATUS_OK) {
-		if (RetryCount < 5)
+		if (RetryCount < Policy->Retries)
 		{
+			RetryCount++;
+			Stats->Retries++;
 			Trace(
 				TRACE_LEVEL_ERROR,
 				TRACE_DRIVER,
 				"Retry reading App info, RetryCount = %d", RetryCount);
-			KeDelayExecutionThread(KernelMode, TRUE, &PollInterval);
+			TcmCommandBackoff(Policy, RetryCount);
 			goto retry;
 		}
 		else {
@@ -1026,6 +1687,28 @@ retry:
 
 	Info = &ControllerContext->AppInfo;
 
+	//
+	// Size the bus buffers for the largest report, config response and
+	// write the controller accepts, so that touch frames and regular
+	// commands reuse them. Flash reads and test images grow them on demand.
+	//
+	ReadLength = MAX(Info->MaxTouchReportPayloadSize, Info->MaxTouchReportConfigSize);
+	ReadLength = MAX(ReadLength, Info->StaticConfigSize);
+	ReadLength = MAX(ReadLength, Info->DynamicConfigSize);
+	ReadLength = MAX(ReadLength, sizeof(TCM_APP_INFO));
+	WriteLength = MAX(ReadLength + 2, ControllerContext->ChunkSize);
+
+	status = SpbReserveTransferBuffers(SpbContext, MESSAGE_HEADER_SIZE + ReadLength + 3, WriteLength);
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"Failed to reserve Spb buffers for %d byte reads - 0x%08lX",
+			ReadLength,
+			status);
+		goto exit;
+	}
+
 	Trace(
 		TRACE_LEVEL_ERROR,
 		TRACE_DRIVER,
@@ -1062,4 +1745,564 @@ TcmGetReportConfig(
 	}
 
 	return status;
-}
\ No newline at end of file
+}
+
+static UINT8
+TcmFindReportConfigBits(
+	IN UINT8* Config,
+	IN ULONG ConfigLength,
+	IN UINT8 Code,
+	IN UINT8 DefaultBits
+)
+{
+	ULONG Index = 0;
+
+	while (Index < ConfigLength) {
+		switch (Config[Index]) {
+			case TOUCH_END:
+				return DefaultBits;
+			case TOUCH_FOREACH_ACTIVE_OBJECT:
+			case TOUCH_FOREACH_OBJECT:
+			case TOUCH_FOREACH_END:
+			case TOUCH_PAD_TO_NEXT_BYTE:
+				Index++;
+				break;
+			default:
+				if (Index + 1 >= ConfigLength)
+					return DefaultBits;
+				if (Config[Index] == Code && Config[Index + 1] != 0)
+					return Config[Index + 1];
+				Index += 2;
+				break;
+		}
+	}
+
+	return DefaultBits;
+}
+
+static ULONG
+TcmGetReportPayloadSize(
+	IN UINT8* Config,
+	IN ULONG ConfigLength,
+	IN ULONG ActiveObjects
+)
+{
+	ULONG Index = 0, Bits = 0, ObjectBits = 0, Objects = 0;
+	BOOLEAN InForeach = FALSE;
+
+	while (Index < ConfigLength) {
+		switch (Config[Index]) {
+			case TOUCH_END:
+				goto exit;
+			case TOUCH_FOREACH_ACTIVE_OBJECT:
+				InForeach = TRUE;
+				Objects = ActiveObjects;
+				Index++;
+				break;
+			case TOUCH_FOREACH_OBJECT:
+				InForeach = TRUE;
+				Objects = MAX_FINGER;
+				Index++;
+				break;
+			case TOUCH_FOREACH_END:
+				InForeach = FALSE;
+				Bits += ObjectBits * Objects;
+				ObjectBits = 0;
+				Index++;
+				break;
+			case TOUCH_PAD_TO_NEXT_BYTE:
+				Bits = ceil_div(Bits, 8) * 8;
+				Index++;
+				break;
+			default:
+				if (Index + 1 >= ConfigLength)
+					goto exit;
+				if (InForeach)
+					ObjectBits += Config[Index + 1];
+				else
+					Bits += Config[Index + 1];
+				Index += 2;
+				break;
+		}
+	}
+
+exit:
+	return ceil_div(Bits, 8);
+}
+
+NTSTATUS
+TcmSetReportConfig(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+  Routine Description:
+
+	Replaces the firmware default touch report config with the smallest
+	config covering the fields TcmDispatchReport consumes. Bit widths are
+	taken from the default config so positions keep the firmware's
+	resolution. If the firmware rejects the new config the default one
+	is read back and kept.
+
+	TcmGetReportConfig must have been called first.
+
+--*/
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	UINT8 Config[32];
+	ULONG Length = 0;
+	UINT8* Default = ControllerContext->ConfigData.Buffer;
+	ULONG DefaultLength = ControllerContext->ConfigData.DataLength;
+
+	if (DefaultLength == 0) {
+		return STATUS_INVALID_DEVICE_STATE;
+	}
+
+	//
+	// Gesture reports carry no objects and parsing ends at a zero
+	// object count, so the gesture fields have to come before it
+	//
+	if (ControllerContext->GesturesEnabled) {
+		Config[Length++] = TOUCH_CUSTOMER_GESTURE_DETECTED;
+		Config[Length++] = TcmFindReportConfigBits(Default, DefaultLength,
+			TOUCH_CUSTOMER_GESTURE_DETECTED, REPORT_CONFIG_GESTURE_BITS);
+
+		//
+		// Gesture coordinates are only kept if the firmware reports them
+		//
+		if (TcmFindReportConfigBits(Default, DefaultLength,
+				TOUCH_CUSTOMER_GESTURE_INFO, 0) != 0) {
+			Config[Length++] = TOUCH_CUSTOMER_GESTURE_INFO;
+			Config[Length++] = TcmFindReportConfigBits(Default, DefaultLength,
+				TOUCH_CUSTOMER_GESTURE_INFO, 0);
+		}
+	}
+
+	Config[Length++] = TOUCH_NUM_OF_ACTIVE_OBJECTS;
+	Config[Length++] = TcmFindReportConfigBits(Default, DefaultLength,
+		TOUCH_NUM_OF_ACTIVE_OBJECTS, REPORT_CONFIG_ACTIVE_OBJECTS_BITS);
+
+	Config[Length++] = TOUCH_FOREACH_ACTIVE_OBJECT;
+	Config[Length++] = TOUCH_OBJECT_N_INDEX;
+	Config[Length++] = TcmFindReportConfigBits(Default, DefaultLength,
+		TOUCH_OBJECT_N_INDEX, REPORT_CONFIG_INDEX_BITS);
+	Config[Length++] = TOUCH_OBJECT_N_CLASSIFICATION;
+	Config[Length++] = TcmFindReportConfigBits(Default, DefaultLength,
+		TOUCH_OBJECT_N_CLASSIFICATION, REPORT_CONFIG_CLASSIFICATION_BITS);
+	Config[Length++] = TOUCH_OBJECT_N_X_POSITION;
+	Config[Length++] = TcmFindReportConfigBits(Default, DefaultLength,
+		TOUCH_OBJECT_N_X_POSITION, REPORT_CONFIG_POSITION_BITS);
+	Config[Length++] = TOUCH_OBJECT_N_Y_POSITION;
+	Config[Length++] = TcmFindReportConfigBits(Default, DefaultLength,
+		TOUCH_OBJECT_N_Y_POSITION, REPORT_CONFIG_POSITION_BITS);
+	Config[Length++] = TOUCH_FOREACH_END;
+	Config[Length++] = TOUCH_END;
+
+	if (ControllerContext->AppInfo.MaxTouchReportConfigSize != 0 &&
+		Length > ControllerContext->AppInfo.MaxTouchReportConfigSize) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"TcmSetReportConfig: config size %d exceeds max %d",
+			Length,
+			ControllerContext->AppInfo.MaxTouchReportConfigSize);
+		return STATUS_BUFFER_OVERFLOW;
+	}
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"TcmSetReportConfig: payload bytes (1 / %d objects) default = %d / %d, minimal = %d / %d",
+		MAX_FINGER,
+		TcmGetReportPayloadSize(Default, DefaultLength, 1),
+		TcmGetReportPayloadSize(Default, DefaultLength, MAX_FINGER),
+		TcmGetReportPayloadSize(Config, Length, 1),
+		TcmGetReportPayloadSize(Config, Length, MAX_FINGER));
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_SET_TOUCH_REPORT_CONFIG,
+		Config,
+		Length,
+		NULL,
+		NULL);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"TcmSetReportConfig: firmware rejected config (Response: 0x%x), using default",
+			ControllerContext->ResponseCode);
+
+		//
+		// Re-read what the firmware is actually using so parsing stays
+		// in sync with the payload layout
+		//
+		status = TcmGetReportConfig(ControllerContext, SpbContext);
+		if (NT_SUCCESS(status)) {
+			status = STATUS_NOT_SUPPORTED;
+		}
+		return status;
+	}
+
+	RtlZeroMemory(ControllerContext->ConfigData.Buffer, sizeof(ControllerContext->ConfigData.Buffer));
+	RtlCopyMemory(ControllerContext->ConfigData.Buffer, Config, Length);
+	ControllerContext->ConfigData.DataLength = Length;
+
+	return status;
+}
+
+NTSTATUS
+TcmGetDynamicConfig(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN UINT8 Id,
+	OUT UINT16* Value
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	TCM_DYNAMIC_CONFIG_FIELD* Field = NULL;
+	ULONG Size = sizeof(UINT16);
+
+	//
+	// The command takes the id, not the Offset of the field. The schema
+	// tells which ids exist and how many bytes of the value are valid.
+	//
+	if (ControllerContext->DynamicConfigSchema.Count != 0) {
+		Field = TcmFindDynamicConfigField(ControllerContext, Id);
+		if (Field == NULL) {
+			status = STATUS_NOT_SUPPORTED;
+			goto exit;
+		}
+		Size = Field->Size;
+	}
+
+	TcmLockCommands(ControllerContext);
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_GET_DYNAMIC_CONFIG,
+		&Id,
+		sizeof(Id),
+		NULL,
+		NULL);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"TcmGetDynamicConfig: failed to read config 0x%02x",
+			Id);
+		goto unlock;
+	}
+
+	if (ControllerContext->ResponseData.DataLength < Size) {
+		status = STATUS_INVALID_DEVICE_STATE;
+		goto unlock;
+	}
+
+	*Value = ControllerContext->ResponseData.Buffer[0];
+
+	if (Size == sizeof(UINT16)) {
+		*Value |= (UINT16)(ControllerContext->ResponseData.Buffer[1] << 8);
+	}
+
+unlock:
+	TcmUnlockCommands(ControllerContext);
+
+exit:
+	return status;
+}
+
+NTSTATUS
+TcmSetDynamicConfig(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN UINT8 Id,
+	IN UINT16 Value
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	TCM_DYNAMIC_CONFIG_FIELD* Field = NULL;
+	UINT8 Payload[3];
+
+	//
+	// With a described schema, reject ids and values the firmware
+	// does not know about instead of sending them. The value always
+	// goes out as 16 bits, addressed by id rather than Offset.
+	//
+	if (ControllerContext->DynamicConfigSchema.Count != 0) {
+		Field = TcmFindDynamicConfigField(ControllerContext, Id);
+		if (Field == NULL) {
+			return STATUS_NOT_SUPPORTED;
+		}
+		if (Field->Size == 1 && Value > 0xff) {
+			return STATUS_INVALID_PARAMETER;
+		}
+	}
+
+	Payload[0] = Id;
+	Payload[1] = (UINT8)Value;
+	Payload[2] = (UINT8)(Value >> 8);
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_SET_DYNAMIC_CONFIG,
+		Payload,
+		sizeof(Payload),
+		NULL,
+		NULL);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"TcmSetDynamicConfig: failed to write config 0x%02x = %d",
+			Id,
+			Value);
+	}
+
+	return status;
+}
+
+NTSTATUS
+TcmParseDynamicConfigSchema(
+	_In_reads_bytes_(Length) UINT8* Descriptor,
+	IN ULONG Length,
+	IN ULONG DynamicConfigSize,
+	OUT TCM_DYNAMIC_CONFIG_SCHEMA* Schema
+)
+/*++
+
+  Routine Description:
+
+	Parses a CMD_DESCRIBE_DYNAMIC_CONFIG response into an id indexed
+	table. The response is a list of packed TCM_DYNAMIC_CONFIG_FIELD
+	entries (id, size in bytes, byte offset in the dynamic config
+	blob), optionally followed by the message padding byte.
+
+	BuildId and Described are left to the caller.
+
+--*/
+{
+	ULONG Index, Count;
+	TCM_DYNAMIC_CONFIG_FIELD Field;
+
+	RtlZeroMemory(Schema->FieldIndex, sizeof(Schema->FieldIndex));
+	Schema->Count = 0;
+
+	Count = Length / sizeof(TCM_DYNAMIC_CONFIG_FIELD);
+
+	if (Count > MAX_DYNAMIC_CONFIG_FIELDS) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"TcmParseDynamicConfigSchema: %d fields, only %d kept",
+			Count,
+			MAX_DYNAMIC_CONFIG_FIELDS);
+		Count = MAX_DYNAMIC_CONFIG_FIELDS;
+	}
+
+	for (Index = 0; Index < Count; Index++) {
+		RtlCopyMemory(&Field,
+			&Descriptor[Index * sizeof(TCM_DYNAMIC_CONFIG_FIELD)],
+			sizeof(TCM_DYNAMIC_CONFIG_FIELD));
+
+		if (Field.Id == DC_UNKNOWN || Field.Size == 0 || Field.Size > sizeof(UINT16)) {
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_DRIVER,
+				"TcmParseDynamicConfigSchema: invalid field id 0x%02x size %d",
+				Field.Id,
+				Field.Size);
+			return STATUS_INVALID_PARAMETER;
+		}
+
+		if (DynamicConfigSize != 0 &&
+			(ULONG)Field.Offset + Field.Size > DynamicConfigSize) {
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_DRIVER,
+				"TcmParseDynamicConfigSchema: field 0x%02x at %d outside config (%d bytes)",
+				Field.Id,
+				Field.Offset,
+				DynamicConfigSize);
+			return STATUS_INVALID_PARAMETER;
+		}
+
+		if (Schema->FieldIndex[Field.Id] != 0) {
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_DRIVER,
+				"TcmParseDynamicConfigSchema: duplicate field id 0x%02x",
+				Field.Id);
+			return STATUS_INVALID_PARAMETER;
+		}
+
+		Schema->Fields[Schema->Count] = Field;
+		Schema->Count++;
+		Schema->FieldIndex[Field.Id] = (UINT8)Schema->Count;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+TcmDescribeDynamicConfig(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+  Routine Description:
+
+	Fetches the dynamic config description once per firmware build.
+	A firmware that does not implement the command is remembered too,
+	so the command is not retried until the build changes.
+
+--*/
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	TCM_DYNAMIC_CONFIG_SCHEMA* Schema = &ControllerContext->DynamicConfigSchema;
+
+	if (Schema->Described && Schema->BuildId == ControllerContext->IDInfo.BuildId) {
+		return Schema->Count != 0 ? STATUS_SUCCESS : STATUS_NOT_SUPPORTED;
+	}
+
+	Schema->Described = FALSE;
+	Schema->Count = 0;
+
+	TcmLockCommands(ControllerContext);
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_DESCRIBE_DYNAMIC_CONFIG,
+		NULL,
+		0,
+		NULL,
+		NULL);
+
+	if (NT_SUCCESS(status)) {
+		status = TcmParseDynamicConfigSchema(
+			ControllerContext->ResponseData.Buffer,
+			ControllerContext->ResponseData.DataLength,
+			ControllerContext->AppInfo.DynamicConfigSize,
+			Schema);
+	}
+	else if (ControllerContext->ResponseCode == TCM_STATUS_NOT_IMPLEMENTED) {
+		status = STATUS_NOT_SUPPORTED;
+	}
+	else {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"TcmDescribeDynamicConfig: command failed (Response: 0x%x)",
+			ControllerContext->ResponseCode);
+		TcmUnlockCommands(ControllerContext);
+		return status;
+	}
+
+	TcmUnlockCommands(ControllerContext);
+
+	if (!NT_SUCCESS(status)) {
+		Schema->Count = 0;
+	}
+
+	Schema->BuildId = ControllerContext->IDInfo.BuildId;
+	Schema->Described = TRUE;
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_DRIVER,
+		"TcmDescribeDynamicConfig: %d fields for build %d",
+		Schema->Count,
+		Schema->BuildId);
+
+	return status;
+}
+
+TCM_DYNAMIC_CONFIG_FIELD*
+TcmFindDynamicConfigField(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN UINT8 Id
+)
+{
+	TCM_DYNAMIC_CONFIG_SCHEMA* Schema = &ControllerContext->DynamicConfigSchema;
+	UINT8 Slot = Schema->FieldIndex[Id];
+
+	if (Slot == 0 || Slot > Schema->Count) {
+		return NULL;
+	}
+
+	return &Schema->Fields[Slot - 1];
+}
+
+NTSTATUS
+TcmEnterDeepSleep(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+
+	if (ControllerContext->ControllerState.Power == TCM_POWER_SLEEP) {
+		return STATUS_SUCCESS;
+	}
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_ENTER_DEEP_SLEEP,
+		NULL,
+		0,
+		NULL,
+		NULL);
+
+	//
+	// A controller that reports the command as not executed in deep
+	// sleep is already where we want it
+	//
+	if (NT_SUCCESS(status) || status == STATUS_DEVICE_NOT_READY) {
+		ControllerContext->ControllerState.Power = TCM_POWER_SLEEP;
+		status = STATUS_SUCCESS;
+	}
+	else {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"TcmEnterDeepSleep: failed (Response: 0x%x)",
+			ControllerContext->ResponseCode);
+	}
+
+	return status;
+}
+
+NTSTATUS
+TcmExitDeepSleep(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_EXIT_DEEP_SLEEP,
+		NULL,
+		0,
+		NULL,
+		NULL);
+
+	if (NT_SUCCESS(status)) {
+		ControllerContext->ControllerState.Power = TCM_POWER_ON;
+	}
+	else {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_DRIVER,
+			"TcmExitDeepSleep: failed (Response: 0x%x)",
+			ControllerContext->ResponseCode);
+	}
+
+	return status;
+}
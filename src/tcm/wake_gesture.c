@@ -0,0 +1,535 @@
+/*++
+	Copyright (c) LumiaWoA authors. All Rights Reserved.
+
+	Module Name:
+
+		wake_gesture.c
+
+	Abstract:
+
+		Low power wake gesture (knock-on, swipe, long press) support for
+		TCM controllers. The controller is armed through the LGE gesture
+		config while the display is off, and gesture reports are turned
+		into a wake key press straight from the interrupt path.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <Cross Platform Shim\compat.h>
+#include <internal.h>
+#include <controller.h>
+#include <spb.h>
+#include <report.h>
+#include <tcm/touch_tcm.h>
+#include <wake_gesture.tmh>
+
+#define WAKE_GESTURE_REG_KEY L"\\Registry\\Machine\\SOFTWARE\\OEM\\Nokia\\Touch\\WakeupGesture"
+
+#define WAKE_GESTURE_TAP_COUNT 2
+#define WAKE_GESTURE_MAX_INTERTAP_TIME 500
+#define WAKE_GESTURE_TAP_DISTANCE 200
+
+typedef struct _WAKE_GESTURE_OBJECT_CONTEXT
+{
+	TCM_CONTROLLER_CONTEXT* ControllerContext;
+} WAKE_GESTURE_OBJECT_CONTEXT, *PWAKE_GESTURE_OBJECT_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(WAKE_GESTURE_OBJECT_CONTEXT, GetWakeGestureObjectContext)
+
+EVT_WDF_WORKITEM TcmWakeGestureFailReasonWorkItem;
+
+static NTSTATUS
+TcmWakeGestureConfigure(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN BOOLEAN Enable
+)
+{
+	NTSTATUS status;
+	TCM_LGE_GESTURE_CONFIG config;
+
+	RtlZeroMemory(&config, sizeof(config));
+
+	config.Enable = Enable ? 1 : 0;
+	config.Modes = Enable ? ControllerContext->WakeGesture.Modes : 0;
+	config.TapCount = WAKE_GESTURE_TAP_COUNT;
+	config.MaxIntertapTime = WAKE_GESTURE_MAX_INTERTAP_TIME;
+	config.TapDistance = WAKE_GESTURE_TAP_DISTANCE;
+
+	status = TcmWriteMessage(ControllerContext,
+		SpbContext,
+		CMD_SET_LGE_GESTURE_CONFIG,
+		&config,
+		sizeof(config),
+		NULL,
+		NULL);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_POWER,
+			"Error setting gesture config (enable = %d) - 0x%08lX",
+			Enable,
+			status);
+		return status;
+	}
+
+	//
+	// Older firmware gates gesture detection on the dynamic config
+	// as well, not every build exposes it
+	//
+	if (!NT_SUCCESS(TcmSetDynamicConfig(ControllerContext,
+		SpbContext,
+		DC_IN_WAKEUP_GESTURE_MODE,
+		Enable ? 1 : 0))) {
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_POWER,
+			"Wakeup gesture mode dynamic config not set");
+	}
+
+	return status;
+}
+
+NTSTATUS
+TcmWakeGestureArm(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Configures the controller for gesture detection. Called when the
+	display turns off.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	NTSTATUS status;
+	TCM_WAKE_GESTURE* Gesture = &ControllerContext->WakeGesture;
+
+	if (!ControllerContext->GesturesEnabled) {
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	if (ControllerContext->DevicePowerState != PowerDeviceD0 ||
+		ControllerContext->ControllerState.Init != TRUE) {
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	status = TcmWakeGestureConfigure(ControllerContext, SpbContext, TRUE);
+
+	if (NT_SUCCESS(status)) {
+		Gesture->FailReasonLength = 0;
+		InterlockedExchange(&Gesture->State, WAKE_GESTURE_ARMED);
+	}
+
+	return status;
+}
+
+NTSTATUS
+TcmWakeGestureDisarm(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Returns the controller to normal touch reporting. Called when the
+	display turns back on.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	TCM_WAKE_GESTURE* Gesture = &ControllerContext->WakeGesture;
+
+	if (InterlockedExchange(&Gesture->State, WAKE_GESTURE_DISARMED) == WAKE_GESTURE_DISARMED) {
+		return STATUS_SUCCESS;
+	}
+
+	if (ControllerContext->DevicePowerState != PowerDeviceD0) {
+		return STATUS_SUCCESS;
+	}
+
+	return TcmWakeGestureConfigure(ControllerContext, SpbContext, FALSE);
+}
+
+BOOLEAN
+TcmWakeGestureDispatch(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN PREPORT_CONTEXT ReportContext,
+	IN UINT8 Detected,
+	_In_reads_bytes_(InfoLength) UINT8* Info,
+	IN ULONG InfoLength
+)
+/*++
+
+Routine Description:
+
+	Called for every report carrying a gesture, from the ISR or from a
+	polled command response. Knock-on, swipe and a completed long press
+	wake the system; anything else is rejected and its fail reason
+	fetched later.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	ReportContext - Report context used to send the wake key press, NULL
+	when polled, which leaves the wake pending for the next ISR pass
+
+	Detected - Value of the customer gesture detected field
+
+	Info - Gesture info bytes (tap or swipe coordinates)
+
+	InfoLength - Number of valid bytes in Info
+
+Return Value:
+
+	TRUE if the report was a gesture and must not be reported as touch
+
+--*/
+{
+	TCM_WAKE_GESTURE* Gesture = &ControllerContext->WakeGesture;
+	LONG State = Gesture->State;
+	BOOLEAN Wake = FALSE;
+	ULONG i;
+
+	if (Detected == DETECT_NORMAL_TOUCH) {
+		return FALSE;
+	}
+
+	Gesture->LastGesture = Detected;
+	Gesture->InfoLength = min(InfoLength, WAKE_GESTURE_INFO_SIZE);
+	RtlCopyMemory(Gesture->Info, Info, Gesture->InfoLength);
+
+	for (i = 0; i + 4 <= Gesture->InfoLength; i += 4) {
+		Trace(
+			TRACE_LEVEL_VERBOSE,
+			TRACE_REPORTING,
+			"Gesture 0x%02x point %d: (%d, %d)",
+			Detected,
+			i / 4,
+			Info[i] | (Info[i + 1] << 8),
+			Info[i + 2] | (Info[i + 3] << 8));
+	}
+
+	if (State == WAKE_GESTURE_DISARMED ||
+		State == WAKE_GESTURE_WAKE_PENDING ||
+		State == WAKE_GESTURE_TRIGGERED) {
+		Trace(
+			TRACE_LEVEL_INFORMATION,
+			TRACE_REPORTING,
+			"Ignoring gesture 0x%02x in state %d",
+			Detected,
+			State);
+		return TRUE;
+	}
+
+	switch (Detected) {
+		case DETECT_KNOCK_ON:
+			Wake = (Gesture->Modes & LGE_GESTURE_KNOCK_ON) != 0;
+			break;
+		case DETECT_SWIPE:
+			Wake = (Gesture->Modes & LGE_GESTURE_SWIPE) != 0;
+			break;
+		case DETECT_LONG_PRESS:
+			Wake = (Gesture->Modes & LGE_GESTURE_LONG_PRESS) != 0;
+			break;
+		case DETECT_LONG_PRESS_DOWN:
+			if (Gesture->Modes & LGE_GESTURE_LONG_PRESS) {
+				InterlockedExchange(&Gesture->State, WAKE_GESTURE_LONG_PRESS);
+				return TRUE;
+			}
+			break;
+		case DETECT_LONG_PRESS_UP:
+			Wake = State == WAKE_GESTURE_LONG_PRESS;
+			break;
+		default:
+			break;
+	}
+
+	if (!Wake) {
+		Gesture->Rejected++;
+
+		Trace(
+			TRACE_LEVEL_INFORMATION,
+			TRACE_REPORTING,
+			"Rejected gesture 0x%02x (%d rejected)",
+			Detected,
+			Gesture->Rejected);
+
+		if (State == WAKE_GESTURE_LONG_PRESS) {
+			InterlockedExchange(&Gesture->State, WAKE_GESTURE_ARMED);
+		}
+
+		if (Gesture->FailReasonWorkItem != NULL) {
+			WdfWorkItemEnqueue(Gesture->FailReasonWorkItem);
+		}
+
+		return TRUE;
+	}
+
+	//
+	// Only the first gesture wakes, the rest are swallowed until the
+	// display comes back on and disarms. The wake stays pending until
+	// an interrupt pass with a report context can send it.
+	//
+	if (InterlockedCompareExchange(&Gesture->State, WAKE_GESTURE_WAKE_PENDING, State) != State) {
+		return TRUE;
+	}
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_REPORTING,
+		"Wake gesture 0x%02x detected",
+		Detected);
+
+	TcmWakeGestureDeliver(ControllerContext, ReportContext);
+
+	return TRUE;
+}
+
+VOID
+TcmWakeGestureDeliver(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext,
+	IN PREPORT_CONTEXT ReportContext
+)
+/*++
+
+Routine Description:
+
+	Sends the wake key press for a pending wake gesture. A gesture read
+	by a polled command response has no report context to send it with,
+	so the ISR calls this after every pass to deliver it late.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	ReportContext - Report context used to send the wake key press,
+	nothing is sent if NULL
+
+Return Value:
+
+	None
+
+--*/
+{
+	TCM_WAKE_GESTURE* Gesture = &ControllerContext->WakeGesture;
+	NTSTATUS status;
+
+	if (ReportContext == NULL ||
+		InterlockedCompareExchange(&Gesture->State, WAKE_GESTURE_TRIGGERED, WAKE_GESTURE_WAKE_PENDING) != WAKE_GESTURE_WAKE_PENDING) {
+		return;
+	}
+
+	status = ReportWakeup(ReportContext);
+
+	if (!NT_SUCCESS(status)) {
+		InterlockedCompareExchange(&Gesture->State, WAKE_GESTURE_WAKE_PENDING, WAKE_GESTURE_TRIGGERED);
+		return;
+	}
+
+	Gesture->Wakeups++;
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_REPORTING,
+		"Wake key press sent (%d wakeups)",
+		Gesture->Wakeups);
+}
+
+VOID
+TcmWakeGestureFailReasonWorkItem(
+	IN WDFWORKITEM WorkItem
+)
+/*++
+
+Routine Description:
+
+	Reads why the controller rejected the last gesture, for
+	diagnostics only. Runs outside of the ISR since the command waits
+	on a response serviced by the ISR.
+
+Arguments:
+
+	WorkItem - Handle to a WDF workitem object
+
+Return Value:
+
+	None
+
+--*/
+{
+	NTSTATUS status;
+	TCM_CONTROLLER_CONTEXT* controller;
+	PDEVICE_EXTENSION devContext;
+	TCM_WAKE_GESTURE* Gesture;
+	ULONG i;
+
+	controller = GetWakeGestureObjectContext(WorkItem)->ControllerContext;
+	devContext = GetDeviceContext(controller->FxDevice);
+	Gesture = &controller->WakeGesture;
+
+	if (controller->DevicePowerState != PowerDeviceD0 ||
+		Gesture->State == WAKE_GESTURE_DISARMED) {
+		return;
+	}
+
+	TcmLockCommands(controller);
+
+	status = TcmWriteMessage(controller,
+		&devContext->I2CContext,
+		CMD_GET_LGE_GESTURE_FAILREASON,
+		NULL,
+		0,
+		NULL,
+		NULL);
+
+	//
+	// The response length includes the trailing padding byte
+	//
+	if (NT_SUCCESS(status) && controller->ResponseData.DataLength != 0) {
+		Gesture->FailReasonLength = min(controller->ResponseData.DataLength - 1, WAKE_GESTURE_FAIL_REASON_SIZE);
+		RtlCopyMemory(Gesture->FailReason, controller->ResponseData.Buffer, Gesture->FailReasonLength);
+	}
+
+	TcmUnlockCommands(controller);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_REPORTING,
+			"Error reading gesture fail reason - 0x%08lX",
+			status);
+		return;
+	}
+
+	for (i = 0; i < Gesture->FailReasonLength; i++) {
+		Trace(
+			TRACE_LEVEL_INFORMATION,
+			TRACE_REPORTING,
+			"Gesture 0x%02x fail reason[%d] = 0x%02x",
+			Gesture->LastGesture,
+			i,
+			Gesture->FailReason[i]);
+	}
+}
+
+NTSTATUS
+TcmWakeGestureInitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Reads the WakeupGesture registry settings and creates the fail
+	reason work item. Gesture fields are only added to the report
+	config when gestures are enabled, so this has to run before
+	TchStartDevice.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	NTSTATUS status;
+	TCM_WAKE_GESTURE* Gesture = &ControllerContext->WakeGesture;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDF_WORKITEM_CONFIG workItemConfig;
+	DWORD enabled = 0;
+	DWORD modes = LGE_GESTURE_KNOCK_ON | LGE_GESTURE_SWIPE | LGE_GESTURE_LONG_PRESS;
+
+	Gesture->State = WAKE_GESTURE_DISARMED;
+
+	if (!NT_SUCCESS(RtlReadRegistryValue(
+		WAKE_GESTURE_REG_KEY,
+		L"Enabled",
+		REG_DWORD,
+		&enabled,
+		sizeof(DWORD))) || enabled != 1) {
+		ControllerContext->GesturesEnabled = FALSE;
+		return STATUS_SUCCESS;
+	}
+
+	RtlReadRegistryValue(
+		WAKE_GESTURE_REG_KEY,
+		L"Modes",
+		REG_DWORD,
+		&modes,
+		sizeof(DWORD));
+
+	Gesture->Modes = (UINT8)modes;
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, WAKE_GESTURE_OBJECT_CONTEXT);
+	attributes.ParentObject = ControllerContext->FxDevice;
+
+	WDF_WORKITEM_CONFIG_INIT(&workItemConfig, TcmWakeGestureFailReasonWorkItem);
+
+	status = WdfWorkItemCreate(
+		&workItemConfig,
+		&attributes,
+		&Gesture->FailReasonWorkItem);
+
+	if (!NT_SUCCESS(status)) {
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_INIT,
+			"Error creating gesture fail reason work item - 0x%08lX",
+			status);
+		Gesture->FailReasonWorkItem = NULL;
+		return status;
+	}
+
+	GetWakeGestureObjectContext(Gesture->FailReasonWorkItem)->ControllerContext = ControllerContext;
+
+	ControllerContext->GesturesEnabled = Gesture->Modes != 0;
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+TcmWakeGestureDeinitialize(
+	IN TCM_CONTROLLER_CONTEXT* ControllerContext
+)
+{
+	TCM_WAKE_GESTURE* Gesture = &ControllerContext->WakeGesture;
+
+	if (Gesture->FailReasonWorkItem != NULL) {
+		WdfWorkItemFlush(Gesture->FailReasonWorkItem);
+		WdfObjectDelete(Gesture->FailReasonWorkItem);
+		Gesture->FailReasonWorkItem = NULL;
+	}
+}
@@ -0,0 +1,243 @@
+/*++
+	Module Name:
+
+		bus_capture.c
+
+	Abstract:
+
+		A bus capture drained through the self-test device and replayed
+		through a second driver instance: the capture must hold every
+		message the controller sent, and the replayed touch reports must
+		come out of the driver as the same HID reports.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "hid_sink.h"
+#include "registry.h"
+#include "bus_capture.h"
+#include <selftest\selftest.h>
+#include <unistd.h>
+
+#define CAPTURE_SIZE (256 * 1024)
+#define TOUCH_FRAMES 40
+
+typedef struct _HID_LOG
+{
+	HID_INPUT_REPORT Reports[TOUCH_FRAMES * 2];
+	ULONG Count;
+} HID_LOG;
+
+static VOID
+LogReport(
+	const HID_INPUT_REPORT* Report,
+	PVOID Context
+)
+{
+	HID_LOG* Log = Context;
+
+	if (Log->Count < RTL_NUMBER_OF(Log->Reports)) {
+		Log->Reports[Log->Count] = *Report;
+	}
+
+	Log->Count++;
+}
+
+//
+// Drains the capture through the device into Buffer, one request of
+// at most 4 KiB at a time, as a capture file would be written
+//
+static ULONG
+DrainCapture(
+	WDFFILEOBJECT File,
+	UINT8* Buffer,
+	ULONG Length
+)
+{
+	TOUCH_TEST_BUS_CAPTURE* Header;
+	WDFREQUEST Request;
+	ULONG Offset = 0;
+	NTSTATUS status;
+
+	for (;;) {
+		Header = (TOUCH_TEST_BUS_CAPTURE*)(Buffer + Offset);
+
+		Request = ShimRequestCreate(IOCTL_TOUCH_SELFTEST_BUS_CAPTURE,
+			NULL,
+			0,
+			Header,
+			min(Length - Offset, 4096));
+
+		status = ShimDeviceIoControl(File, Request);
+		CHECK_SUCCESS(status);
+		CHECK_EQ(ShimRequest(Request)->Information, sizeof(TOUCH_TEST_BUS_CAPTURE) + Header->Length);
+		WdfObjectDelete(Request);
+
+		if (!NT_SUCCESS(status) || Header->RecordCount == 0) {
+			return Offset;
+		}
+
+		Offset += sizeof(TOUCH_TEST_BUS_CAPTURE) + Header->Length;
+	}
+}
+
+static VOID
+TestCaptureReplay(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	static HID_LOG Captured, Replayed;
+	static UINT8 Buffer[CAPTURE_SIZE * 2];
+	FAKE_TCM_OBJECT Object = { 0, 1, 0, 0 };
+	BUS_CAPTURE Capture;
+	WDFDEVICE Device;
+	WDFFILEOBJECT File = NULL;
+	ULONG Length, Touches = 0, i;
+
+	//
+	// A finger moving across the panel and lifting, on a driver with
+	// capture turned on
+	//
+	ShimRegistrySetDword(L"BusCaptureSize", CAPTURE_SIZE);
+
+	TcmHarnessInitialize(&Harness);
+	Harness.Tcm.IdInfo.BuildId = 0x4321;
+	Harness.Tcm.AppInfo.MaxX = 1079;
+	Harness.Tcm.AppInfo.MaxY = 2159;
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+	CHECK_SUCCESS(TchSelfTestInitialize(Harness.Device));
+
+	FakeHidReset();
+	FakeHidSetCallback(LogReport, &Captured);
+
+	for (i = 0; i < TOUCH_FRAMES; i++) {
+		Object.X = (UINT16)(100 + i * 20);
+		Object.Y = (UINT16)(300 + i * 40);
+		FakeTcmQueueTouch(&Harness.Tcm, &Object, 1);
+		usleep(2000);
+	}
+
+	FakeTcmQueueTouch(&Harness.Tcm, NULL, 0);
+	CHECK(TcmHarnessDrain(&Harness, 1000));
+	FakeHidReset();
+
+	Device = ShimDeviceFind(&GUID_TOUCH_SELFTEST_INTERFACE);
+	CHECK_SUCCESS(ShimDeviceOpen(Device, ShimCallerAdministrator, GENERIC_READ | GENERIC_WRITE, &File));
+	Length = DrainCapture(File, Buffer, sizeof(Buffer));
+	ShimDeviceClose(File);
+
+	TcmHarnessStop(&Harness);
+	ShimRegistryClear();
+
+	CHECK(Captured.Count >= TOUCH_FRAMES);
+	CHECK(Captured.Count <= RTL_NUMBER_OF(Captured.Reports));
+
+	CHECK(BusCaptureLoad(&Capture, Buffer, Length));
+	CHECK_EQ(Capture.Lost, 0);
+	CHECK_EQ(Capture.Faults, 0);
+	CHECK_EQ(Capture.Broken, 0);
+
+	for (i = 0; i < Capture.MessageCount; i++) {
+		if (!Capture.Messages[i].Written && Capture.Messages[i].Code == TCM_REPORT_TOUCH) {
+			Touches++;
+		}
+	}
+
+	CHECK_EQ(Touches, TOUCH_FRAMES + 1);
+
+	//
+	// The replay brings a driver up on what the capture says the
+	// controller was
+	//
+	TcmHarnessInitialize(&Harness);
+	BusCaptureConfigure(&Capture, &Harness.Tcm);
+	CHECK_EQ(Harness.Tcm.IdInfo.BuildId, 0x4321);
+	CHECK_EQ(Harness.Tcm.AppInfo.MaxX, 1079);
+	CHECK_EQ(Harness.Tcm.AppInfo.MaxY, 2159);
+
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+
+	FakeHidReset();
+	FakeHidSetCallback(LogReport, &Replayed);
+
+	CHECK_EQ(BusCaptureQueue(&Capture, &Harness.Tcm, TCM_REPORT_TOUCH, TCM_REPORT_TOUCH), Touches);
+	CHECK(TcmHarnessDrain(&Harness, 1000));
+	FakeHidReset();
+
+	CHECK_EQ(Harness.Controller->RecoveryStats.LostMessages, 0);
+	TcmHarnessStop(&Harness);
+
+	CHECK_EQ(Replayed.Count, Captured.Count);
+
+	for (i = 0; i < min(Replayed.Count, Captured.Count) && i < RTL_NUMBER_OF(Captured.Reports); i++) {
+		CHECK_EQ(Replayed.Reports[i].ReportID, Captured.Reports[i].ReportID);
+		CHECK(memcmp(&Replayed.Reports[i].TouchReport,
+			&Captured.Reports[i].TouchReport,
+			sizeof(HID_TOUCH_REPORT)) == 0);
+	}
+
+	BusCaptureFree(&Capture);
+}
+
+static VOID
+TestCaptureDropsOldest(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	static UINT8 Buffer[64 * 1024];
+	FAKE_TCM_OBJECT Object = { 0, 1, 500, 500 };
+	BUS_CAPTURE Capture;
+	WDFDEVICE Device;
+	WDFFILEOBJECT File = NULL;
+	ULONG Length, i;
+
+	//
+	// A 16 KiB ring overflows long before the reports stop
+	//
+	ShimRegistrySetDword(L"BusCaptureSize", 16 * 1024);
+
+	TcmHarnessInitialize(&Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+	CHECK_SUCCESS(TchSelfTestInitialize(Harness.Device));
+
+	for (i = 0; i < 400; i++) {
+		FakeTcmQueueTouch(&Harness.Tcm, &Object, 1);
+	}
+
+	CHECK(TcmHarnessDrain(&Harness, 2000));
+
+	Device = ShimDeviceFind(&GUID_TOUCH_SELFTEST_INTERFACE);
+	CHECK_SUCCESS(ShimDeviceOpen(Device, ShimCallerAdministrator, GENERIC_READ | GENERIC_WRITE, &File));
+	Length = DrainCapture(File, Buffer, sizeof(Buffer));
+	ShimDeviceClose(File);
+
+	TcmHarnessStop(&Harness);
+	ShimRegistryClear();
+
+	//
+	// What is left still parses, from a header on
+	//
+	CHECK(BusCaptureLoad(&Capture, Buffer, Length));
+	CHECK(Capture.Lost > 0);
+	CHECK(Capture.Records > 0);
+
+	BusCaptureFree(&Capture);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestCaptureReplay);
+	RUN(TestCaptureDropsOldest);
+
+	return TestResult();
+}
@@ -0,0 +1,424 @@
+/*++
+	Module Name:
+
+		command_retry.c
+
+	Abstract:
+
+		Command retries against a controller that answers busy, previous
+		command pending, or not at all. Retries have to follow the
+		command's policy and back off as it says, and a response that
+		turns up late for an attempt that timed out must not complete
+		the retry made after it.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include <unistd.h>
+
+#define STEP_NO_RESPONSE 0xff
+#define MAX_STEPS 8
+
+//
+// The value the controller holds, and the one a stale response carries
+//
+#define VALUE 0x1234
+#define STALE_VALUE 0xdead
+
+typedef struct _STEP
+{
+	UINT8 Code;
+	ULONG DelayUs;
+	UINT16 Value;
+} STEP;
+
+//
+// How the controller answers the attempts at one command, in order.
+// Attempts past the script are answered normally.
+//
+typedef struct _SCRIPT
+{
+	UINT8 Command;
+	STEP Steps[MAX_STEPS];
+	ULONG Count;
+	volatile LONG Next;
+} SCRIPT;
+
+static BOOLEAN
+Scripted(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length,
+	PVOID Context
+)
+{
+	SCRIPT* Script = Context;
+	const STEP* Step;
+	UINT8 Value[2];
+	LONG Attempt;
+
+	UNREFERENCED_PARAMETER(Payload);
+	UNREFERENCED_PARAMETER(Length);
+
+	if (Command != Script->Command) {
+		return FALSE;
+	}
+
+	Attempt = InterlockedIncrement(&Script->Next) - 1;
+
+	if ((ULONG)Attempt >= Script->Count) {
+		return FALSE;
+	}
+
+	Step = &Script->Steps[Attempt];
+
+	if (Step->Code == STEP_NO_RESPONSE) {
+		return TRUE;
+	}
+
+	if (Step->Code == TCM_STATUS_OK) {
+		Value[0] = (UINT8)Step->Value;
+		Value[1] = (UINT8)(Step->Value >> 8);
+		FakeTcmQueue(Tcm, Step->Code, Value, sizeof(Value), Step->DelayUs);
+	}
+	else {
+		FakeTcmQueue(Tcm, Step->Code, NULL, 0, Step->DelayUs);
+	}
+
+	return TRUE;
+}
+
+static VOID
+Start(
+	TCM_HARNESS* Harness,
+	SCRIPT* Script
+)
+{
+	TcmHarnessInitialize(Harness);
+	CHECK_SUCCESS(TcmHarnessStart(Harness, TRUE, 2000));
+
+	Harness->Tcm.DynamicConfig[DC_NO_DOZE] = VALUE;
+	FakeTcmSetHook(&Harness->Tcm, Scripted, Script);
+}
+
+static VOID
+Stop(
+	TCM_HARNESS* Harness
+)
+{
+	FakeTcmSetHook(&Harness->Tcm, NULL, NULL);
+	TcmHarnessStop(Harness);
+}
+
+//
+// The least time Retries retries of a command spend backing off
+//
+static ULONG
+BackoffMs(
+	const TCM_COMMAND_POLICY* Policy,
+	ULONG Retries
+)
+{
+	ULONG Total = 0;
+	ULONG Ms = Policy->Backoff;
+	ULONG i;
+
+	for (i = 0; i < Retries; i++) {
+		Total += MIN(Ms, Policy->BackoffMax);
+		Ms *= 2;
+	}
+
+	return Total;
+}
+
+//
+// Reads DC_NO_DOZE, returning the status and filling in the value read
+// and the time it took in ms
+//
+static NTSTATUS
+ReadValue(
+	TCM_HARNESS* Harness,
+	UINT16* Value,
+	ULONG* Ms
+)
+{
+	TCM_CONTROLLER_CONTEXT* Controller = Harness->Controller;
+	UINT8 Response[sizeof(Controller->ResponseData.Buffer)];
+	UINT8 Id = DC_NO_DOZE;
+	ULONG Length = 0;
+	ULONG64 Start = KeQueryInterruptTime();
+	NTSTATUS status;
+
+	status = TcmWriteMessage(Controller,
+		Harness->Spb,
+		CMD_GET_DYNAMIC_CONFIG,
+		&Id,
+		sizeof(Id),
+		Response,
+		&Length);
+
+	*Ms = (ULONG)((KeQueryInterruptTime() - Start) / 10000);
+	*Value = Length >= 2 ? (UINT16)(Response[0] | (Response[1] << 8)) : 0;
+
+	return status;
+}
+
+static TCM_COMMAND_STATS*
+Stats(
+	TCM_HARNESS* Harness,
+	UINT8 Command,
+	const TCM_COMMAND_POLICY** Policy
+)
+{
+	return &Harness->Controller->CommandStats[TcmGetCommandPolicy(Command, Policy)];
+}
+
+static VOID
+PrintStats(
+	const char* Name,
+	const TCM_COMMAND_STATS* Stats,
+	ULONG Ms
+)
+{
+	printf("  %-20s %u retries (%u busy, %u pending, %u timeouts, %u late), %u ms\n",
+		Name,
+		Stats->Retries,
+		Stats->Busy,
+		Stats->Pending,
+		Stats->Timeouts,
+		Stats->LateResponses,
+		Ms);
+}
+
+static VOID
+TestBusy(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	SCRIPT Script = { CMD_GET_DYNAMIC_CONFIG, {
+		{ TCM_STATUS_BUSY, 0, 0 },
+		{ TCM_STATUS_BUSY, 0, 0 },
+	}, 2 };
+	const TCM_COMMAND_POLICY* Policy;
+	TCM_COMMAND_STATS Before, *After;
+	UINT16 Value;
+	ULONG Ms;
+
+	Start(&Harness, &Script);
+	After = Stats(&Harness, CMD_GET_DYNAMIC_CONFIG, &Policy);
+	Before = *After;
+
+	CHECK_SUCCESS(ReadValue(&Harness, &Value, &Ms));
+	PrintStats("busy", After, Ms);
+
+	CHECK_EQ(Value, VALUE);
+	CHECK_EQ(Script.Next, 3);
+	CHECK_EQ(After->Retries - Before.Retries, 2);
+	CHECK_EQ(After->Busy - Before.Busy, 2);
+	CHECK_EQ(After->Pending, Before.Pending);
+	CHECK_EQ(After->Failed, Before.Failed);
+	CHECK(Ms >= BackoffMs(Policy, 2));
+
+	Stop(&Harness);
+}
+
+static VOID
+TestPending(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	SCRIPT Script = { CMD_GET_DYNAMIC_CONFIG, {
+		{ TCM_STATUS_PREVIOUS_COMMAND_PENDING, 0, 0 },
+	}, 1 };
+	const TCM_COMMAND_POLICY* Policy;
+	TCM_COMMAND_STATS Before, *After;
+	UINT16 Value;
+	ULONG Ms;
+
+	Start(&Harness, &Script);
+	After = Stats(&Harness, CMD_GET_DYNAMIC_CONFIG, &Policy);
+	Before = *After;
+
+	CHECK_SUCCESS(ReadValue(&Harness, &Value, &Ms));
+	PrintStats("pending", After, Ms);
+
+	CHECK_EQ(Value, VALUE);
+	CHECK_EQ(After->Retries - Before.Retries, 1);
+	CHECK_EQ(After->Pending - Before.Pending, 1);
+	CHECK_EQ(After->Busy, Before.Busy);
+	CHECK(Ms >= BackoffMs(Policy, 1));
+
+	Stop(&Harness);
+}
+
+static VOID
+TestRetriesExhausted(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	SCRIPT Script = { CMD_GET_DYNAMIC_CONFIG, {
+		{ TCM_STATUS_BUSY, 0, 0 },
+		{ TCM_STATUS_PREVIOUS_COMMAND_PENDING, 0, 0 },
+		{ TCM_STATUS_BUSY, 0, 0 },
+		{ TCM_STATUS_BUSY, 0, 0 },
+	}, 4 };
+	const TCM_COMMAND_POLICY* Policy;
+	TCM_COMMAND_STATS Before, *After;
+	UINT16 Value;
+	ULONG Ms;
+
+	Start(&Harness, &Script);
+	After = Stats(&Harness, CMD_GET_DYNAMIC_CONFIG, &Policy);
+	Before = *After;
+
+	CHECK(!NT_SUCCESS(ReadValue(&Harness, &Value, &Ms)));
+	PrintStats("retries exhausted", After, Ms);
+
+	CHECK_EQ(Script.Next, Policy->Retries + 1);
+	CHECK_EQ(After->Retries - Before.Retries, Policy->Retries);
+	CHECK_EQ(After->Failed - Before.Failed, 1);
+	CHECK(Ms >= BackoffMs(Policy, Policy->Retries));
+
+	Stop(&Harness);
+}
+
+static VOID
+TestResetNotResent(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	SCRIPT Script = { CMD_RESET, {
+		{ STEP_NO_RESPONSE, 0, 0 },
+	}, 1 };
+	const TCM_COMMAND_POLICY* Policy;
+	TCM_COMMAND_STATS Before, *After;
+	ULONG Resets;
+
+	Start(&Harness, &Script);
+	After = Stats(&Harness, CMD_RESET, &Policy);
+	Before = *After;
+	Resets = Harness.Tcm.CommandCounts[CMD_RESET];
+
+	//
+	// The controller may have reset without saying so, a second reset
+	// is not sent on a timeout. Busy would still be retried.
+	//
+	CHECK(!NT_SUCCESS(TcmWriteMessage(Harness.Controller, Harness.Spb, CMD_RESET, NULL, 0, NULL, NULL)));
+
+	CHECK_EQ(Policy->Flags & TCM_RETRY_TIMEOUT, 0);
+	CHECK(Policy->Flags & TCM_RETRY_BUSY);
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_RESET] - Resets, 1);
+	CHECK_EQ(After->Timeouts - Before.Timeouts, 1);
+	CHECK_EQ(After->Retries, Before.Retries);
+
+	Stop(&Harness);
+}
+
+static VOID
+TestLateResponse(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	const TCM_COMMAND_POLICY* Policy;
+	TCM_COMMAND_STATS Before, *After;
+	SCRIPT Script = { CMD_GET_DYNAMIC_CONFIG };
+	UINT16 Value;
+	ULONG Ms;
+
+	Start(&Harness, &Script);
+	After = Stats(&Harness, CMD_GET_DYNAMIC_CONFIG, &Policy);
+	Before = *After;
+
+	//
+	// The first attempt is answered after it timed out, while the
+	// retry waits for its own response
+	//
+	Script.Steps[0].Code = TCM_STATUS_OK;
+	Script.Steps[0].DelayUs = (Policy->Timeout + Policy->Backoff + 20) * 1000;
+	Script.Steps[0].Value = STALE_VALUE;
+	Script.Steps[1].Code = TCM_STATUS_OK;
+	Script.Steps[1].DelayUs = 60 * 1000;
+	Script.Steps[1].Value = VALUE;
+	Script.Count = 2;
+
+	CHECK_SUCCESS(ReadValue(&Harness, &Value, &Ms));
+	PrintStats("late response", After, Ms);
+
+	CHECK_EQ(Value, VALUE);
+	CHECK_EQ(Script.Next, 2);
+	CHECK_EQ(After->Timeouts - Before.Timeouts, 1);
+	CHECK_EQ(After->Retries - Before.Retries, 1);
+	CHECK_EQ(After->LateResponses - Before.LateResponses, 1);
+	CHECK_EQ(Harness.Controller->ResponseOwed, FALSE);
+
+	//
+	// Nothing is owed any more, the next command is answered right away
+	//
+	CHECK_SUCCESS(ReadValue(&Harness, &Value, &Ms));
+	CHECK_EQ(Value, VALUE);
+	CHECK(Ms < Policy->Timeout);
+
+	Stop(&Harness);
+}
+
+static VOID
+TestLostWrite(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	SCRIPT Script = { CMD_GET_DYNAMIC_CONFIG, {
+		{ STEP_NO_RESPONSE, 0, 0 },
+		{ TCM_STATUS_OK, 1000, VALUE },
+	}, 2 };
+	const TCM_COMMAND_POLICY* Policy;
+	TCM_COMMAND_STATS Before, *After;
+	UINT16 Value;
+	ULONG Ms;
+
+	Start(&Harness, &Script);
+	After = Stats(&Harness, CMD_GET_DYNAMIC_CONFIG, &Policy);
+	Before = *After;
+
+	//
+	// The first attempt never reached the controller. Its answer to
+	// the retry is taken for the late one, which costs another retry
+	// but no more.
+	//
+	CHECK_SUCCESS(ReadValue(&Harness, &Value, &Ms));
+	PrintStats("lost write", After, Ms);
+
+	CHECK_EQ(Value, VALUE);
+	CHECK_EQ(After->Timeouts - Before.Timeouts, 2);
+	CHECK_EQ(After->Retries - Before.Retries, 2);
+	CHECK_EQ(After->LateResponses - Before.LateResponses, 1);
+	CHECK_EQ(Harness.Controller->ResponseOwed, FALSE);
+
+	Stop(&Harness);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestBusy);
+	RUN(TestPending);
+	RUN(TestRetriesExhausted);
+	RUN(TestResetNotResent);
+	RUN(TestLateResponse);
+	RUN(TestLostWrite);
+
+	return TestResult();
+}
@@ -0,0 +1,329 @@
+/*++
+	Module Name:
+
+		deep_sleep.c
+
+	Abstract:
+
+		D0 exit and entry against a controller with deep sleep: a
+		controller that kept its state is resumed without being
+		identified and configured again, one that reset while asleep is
+		brought up from scratch, and one whose bring-up failed is tried
+		again on the next D0 entry. Also reports how long the resume
+		and the first touch after it take.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "hid_sink.h"
+#include <unistd.h>
+
+#define REPORT_TIMEOUT_MS 500
+
+//
+// Command turnaround of the controller, so that the times reported
+// reflect how many commands each path takes
+//
+#define RESPONSE_DELAY_US 1000
+
+typedef struct _BRING_UP_COUNTS
+{
+	ULONG Identify;
+	ULONG Reset;
+	ULONG AppInfo;
+	ULONG GetReportConfig;
+	ULONG SetReportConfig;
+	ULONG EnterSleep;
+	ULONG ExitSleep;
+} BRING_UP_COUNTS;
+
+static VOID
+Count(
+	TCM_HARNESS* Harness,
+	BRING_UP_COUNTS* Counts
+)
+{
+	ULONG* Commands = Harness->Tcm.CommandCounts;
+
+	Counts->Identify = Commands[CMD_IDENTIFY];
+	Counts->Reset = Commands[CMD_RESET];
+	Counts->AppInfo = Commands[CMD_GET_APPLICATION_INFO];
+	Counts->GetReportConfig = Commands[CMD_GET_TOUCH_REPORT_CONFIG];
+	Counts->SetReportConfig = Commands[CMD_SET_TOUCH_REPORT_CONFIG];
+	Counts->EnterSleep = Commands[CMD_ENTER_DEEP_SLEEP];
+	Counts->ExitSleep = Commands[CMD_EXIT_DEEP_SLEEP];
+}
+
+static BOOLEAN
+RejectReportConfig(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length,
+	PVOID Context
+)
+{
+	UNREFERENCED_PARAMETER(Payload);
+	UNREFERENCED_PARAMETER(Length);
+	UNREFERENCED_PARAMETER(Context);
+
+	if (Command == CMD_GET_TOUCH_REPORT_CONFIG) {
+		FakeTcmRespond(Tcm, TCM_STATUS_ERROR, NULL, 0);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static VOID
+Start(
+	TCM_HARNESS* Harness
+)
+{
+	TcmHarnessInitialize(Harness);
+	Harness->Tcm.ResponseDelayUs = RESPONSE_DELAY_US;
+
+	CHECK_SUCCESS(TcmHarnessStart(Harness, TRUE, 2000));
+	FakeHidReset();
+}
+
+//
+// D0 exit: interrupts are disabled before the device is put down
+//
+static VOID
+Standby(
+	TCM_HARNESS* Harness
+)
+{
+	TcmHarnessDisconnectInterrupt(Harness);
+
+	CHECK_SUCCESS(TchStandbyDevice(Harness->Controller,
+		Harness->Spb,
+		&Harness->DevContext->ReportContext));
+	CHECK_EQ(Harness->Controller->DevicePowerState, PowerDeviceD3);
+}
+
+//
+// D0 entry, interrupts are connected once it completes. Returns the
+// time it took in microseconds.
+//
+static ULONG64
+Wake(
+	TCM_HARNESS* Harness
+)
+{
+	ULONG64 Start = KeQueryInterruptTime();
+	ULONG64 Us;
+
+	CHECK_SUCCESS(TchWakeDevice(Harness->Controller, Harness->Spb));
+	Us = (KeQueryInterruptTime() - Start) / 10;
+
+	CHECK_EQ(Harness->Controller->DevicePowerState, PowerDeviceD0);
+	CHECK_SUCCESS(TcmHarnessConnectInterrupt(Harness));
+
+	return Us;
+}
+
+//
+// Returns the time from queueing a touch to its HID report
+//
+static ULONG64
+FirstTouch(
+	TCM_HARNESS* Harness
+)
+{
+	FAKE_TCM_OBJECT Object = { 0, 1, 640, 1280 };
+	HID_INPUT_REPORT Report;
+	ULONG Reports = FakeHidReports();
+	ULONG64 Start = KeQueryInterruptTime();
+	ULONG64 Us;
+	ULONG i;
+
+	FakeTcmQueueTouch(&Harness->Tcm, &Object, 1);
+
+	for (i = 0; i < REPORT_TIMEOUT_MS * 10 && FakeHidReports() == Reports; i++) {
+		usleep(100);
+	}
+
+	Us = (KeQueryInterruptTime() - Start) / 10;
+
+	CHECK(FakeHidReports() != Reports);
+	CHECK(FakeHidRecent(0, &Report));
+	CHECK_EQ(Report.TouchReport.ContactCount, 1);
+	CHECK_EQ(Report.TouchReport.Contacts[0].TipSwitch, 1);
+
+	//
+	// Lift, so the next touch starts from nothing down
+	//
+	FakeTcmQueueTouch(&Harness->Tcm, NULL, 0);
+	CHECK(TcmHarnessDrain(Harness, REPORT_TIMEOUT_MS));
+
+	return Us;
+}
+
+static VOID
+TestResume(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TCM_CONTROLLER_CONTEXT* Controller;
+	BRING_UP_COUNTS Before, After;
+	ULONG64 WakeUs, TouchUs;
+	ULONG Commands;
+
+	Start(&Harness);
+	Controller = Harness.Controller;
+
+	FirstTouch(&Harness);
+
+	Count(&Harness, &Before);
+	Standby(&Harness);
+
+	CHECK_EQ(Harness.Tcm.DeepSleep, TRUE);
+	CHECK_EQ(Controller->ControllerState.Power, TCM_POWER_SLEEP);
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_ENTER_DEEP_SLEEP], Before.EnterSleep + 1);
+
+	//
+	// A sleeping controller turns commands down, and the driver takes
+	// that as being asleep
+	//
+	Controller->PollForResponse = TRUE;
+	CHECK_EQ(TcmWriteMessage(Controller, Harness.Spb, CMD_GET_APPLICATION_INFO, NULL, 0, NULL, NULL),
+		STATUS_DEVICE_NOT_READY);
+	Controller->PollForResponse = FALSE;
+	CHECK_EQ(Controller->ControllerState.Power, TCM_POWER_SLEEP);
+
+	//
+	// The resume is a single command, nothing is identified or
+	// configured again
+	//
+	Count(&Harness, &Before);
+	Commands = Harness.Tcm.Commands;
+
+	WakeUs = Wake(&Harness);
+
+	Count(&Harness, &After);
+	CHECK_EQ(Harness.Tcm.DeepSleep, FALSE);
+	CHECK_EQ(Controller->ControllerState.Power, TCM_POWER_ON);
+	CHECK_EQ(Controller->ControllerState.Init, TRUE);
+	CHECK_EQ(Harness.Tcm.Commands - Commands, 1);
+	CHECK_EQ(After.ExitSleep, Before.ExitSleep + 1);
+	CHECK_EQ(After.Identify, Before.Identify);
+	CHECK_EQ(After.Reset, Before.Reset);
+	CHECK_EQ(After.AppInfo, Before.AppInfo);
+	CHECK_EQ(After.GetReportConfig, Before.GetReportConfig);
+	CHECK_EQ(After.SetReportConfig, Before.SetReportConfig);
+
+	TouchUs = FirstTouch(&Harness);
+
+	printf("  resume %llu us, first touch %llu us after it\n",
+		(unsigned long long)WakeUs,
+		(unsigned long long)TouchUs);
+
+	TcmHarnessStop(&Harness);
+}
+
+static VOID
+TestResetWhileAsleep(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TCM_CONTROLLER_CONTEXT* Controller;
+	BRING_UP_COUNTS Before, After;
+	ULONG64 WakeUs, TouchUs;
+
+	Start(&Harness);
+	Controller = Harness.Controller;
+
+	Standby(&Harness);
+	FakeTcmReset(&Harness.Tcm);
+
+	//
+	// The identify report read on the way up tells the driver the
+	// configuration is gone, it resets and configures the controller
+	//
+	Count(&Harness, &Before);
+	WakeUs = Wake(&Harness);
+	Count(&Harness, &After);
+
+	CHECK_EQ(Controller->ControllerState.Power, TCM_POWER_ON);
+	CHECK_EQ(Controller->ControllerState.Init, TRUE);
+	CHECK_EQ(After.ExitSleep, Before.ExitSleep);
+	CHECK_EQ(After.Reset, Before.Reset + 1);
+	CHECK_EQ(After.GetReportConfig, Before.GetReportConfig + 1);
+	CHECK_EQ(After.SetReportConfig, Before.SetReportConfig + 1);
+	CHECK_EQ(Harness.Tcm.ReportConfigLength, Controller->ConfigData.DataLength);
+	CHECK(memcmp(Harness.Tcm.ReportConfig, Controller->ConfigData.Buffer, Harness.Tcm.ReportConfigLength) == 0);
+
+	TouchUs = FirstTouch(&Harness);
+
+	printf("  reset while asleep: resume %llu us, first touch %llu us after it\n",
+		(unsigned long long)WakeUs,
+		(unsigned long long)TouchUs);
+
+	TcmHarnessStop(&Harness);
+}
+
+static VOID
+TestReinitializeFailure(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TCM_CONTROLLER_CONTEXT* Controller;
+	BRING_UP_COUNTS Before, After;
+
+	Start(&Harness);
+	Controller = Harness.Controller;
+
+	Standby(&Harness);
+	FakeTcmReset(&Harness.Tcm);
+
+	//
+	// A bring-up that could not read the report config leaves the
+	// controller uninitialized
+	//
+	FakeTcmSetHook(&Harness.Tcm, RejectReportConfig, NULL);
+	Wake(&Harness);
+
+	CHECK_EQ(Controller->ControllerState.Init, FALSE);
+
+	//
+	// It is neither put to sleep nor trusted on the next D0 entry, but
+	// brought up again
+	//
+	FakeTcmSetHook(&Harness.Tcm, NULL, NULL);
+
+	Count(&Harness, &Before);
+	Standby(&Harness);
+	Wake(&Harness);
+	Count(&Harness, &After);
+
+	CHECK_EQ(After.EnterSleep, Before.EnterSleep);
+	CHECK_EQ(After.Reset, Before.Reset + 1);
+	CHECK_EQ(After.GetReportConfig, Before.GetReportConfig + 1);
+	CHECK_EQ(Controller->ControllerState.Init, TRUE);
+
+	FirstTouch(&Harness);
+
+	TcmHarnessStop(&Harness);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestResume);
+	RUN(TestResetWhileAsleep);
+	RUN(TestReinitializeFailure);
+
+	return TestResult();
+}
@@ -0,0 +1,289 @@
+/*++
+	Module Name:
+
+		device_start.c
+
+	Abstract:
+
+		Bring-up against a controller that reports touches while it is
+		being configured. Once the device is in D0 the ISR reads every
+		message, so touches that come in between the responses of the
+		last bring-up commands reach HID, and only touches that did are
+		counted as the first touch. A firmware update stopped by a D0
+		exit carries on from the pages it had not written when bring-up
+		resumes.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "hid_sink.h"
+#include "registry.h"
+#include <unistd.h>
+
+#define BRINGUP_TOUCHES 5
+
+#define FLASH_PAGE_WORDS 1024
+#define FLASH_PAGE_SIZE (FLASH_PAGE_WORDS * 2)
+#define FLASH_PAGES 64
+#define FLASH_BLOCK_WORDS 16
+
+typedef struct _TOUCH_HOOK
+{
+	TCM_HARNESS* Harness;
+	BOOLEAN WaitForInterrupt;
+	ULONG Queued;
+} TOUCH_HOOK;
+
+typedef struct _CANCEL_HOOK
+{
+	TCM_HARNESS* Harness;
+	ULONG Erases;
+	ULONG CancelAfterErases;
+} CANCEL_HOOK;
+
+static VOID
+QueueTouches(
+	TOUCH_HOOK* Hook,
+	ULONG Count
+)
+{
+	FAKE_TCM_OBJECT Object = { 0, 1, 0, 0 };
+	ULONG i;
+
+	for (i = 0; i < Count; i++) {
+		Object.X = (UINT16)(300 + Hook->Queued * 10);
+		Object.Y = (UINT16)(600 + Hook->Queued * 10);
+		FakeTcmQueueTouch(&Hook->Harness->Tcm, &Object, 1);
+		Hook->Queued++;
+	}
+}
+
+//
+// Holds bring-up until the device is in D0 with the interrupt
+// connected if asked to, then reports touches ahead of the response
+// to the first command sent with reports enabled
+//
+static BOOLEAN
+TouchDuringBringUp(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length,
+	PVOID Context
+)
+{
+	TOUCH_HOOK* Hook = Context;
+	ULONG Waited;
+
+	UNREFERENCED_PARAMETER(Tcm);
+	UNREFERENCED_PARAMETER(Payload);
+	UNREFERENCED_PARAMETER(Length);
+
+	if (Command == CMD_GET_APPLICATION_INFO && Hook->WaitForInterrupt) {
+		for (Waited = 0; Waited < 1000 && !Hook->Harness->InterruptConnected; Waited++) {
+			usleep(1000);
+		}
+	}
+	else if (Command == CMD_DESCRIBE_DYNAMIC_CONFIG && Hook->Queued == 0) {
+		QueueTouches(Hook, BRINGUP_TOUCHES);
+	}
+
+	return FALSE;
+}
+
+static VOID
+TestBringUpDeliversTouches(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TOUCH_HOOK Hook = { &Harness, TRUE, 0 };
+
+	TcmHarnessInitialize(&Harness);
+	FakeTcmSetHook(&Harness.Tcm, TouchDuringBringUp, &Hook);
+	FakeHidReset();
+
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+	CHECK(TcmHarnessDrain(&Harness, 1000));
+
+	CHECK_EQ(Hook.Queued, BRINGUP_TOUCHES);
+	CHECK_EQ(FakeHidReports(), BRINGUP_TOUCHES);
+	CHECK_EQ(Harness.Controller->DeviceStart.FirstTouchPending, FALSE);
+	CHECK_EQ(Harness.Controller->PollForResponse, FALSE);
+
+	FakeHidReset();
+	TcmHarnessStop(&Harness);
+}
+
+static VOID
+TestFirstTouchIsDelivered(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TOUCH_HOOK Hook = { &Harness, FALSE, 0 };
+
+	//
+	// The whole bring-up in prepare hardware reads responses by
+	// polling, the touches it reads on the way are dropped
+	//
+	ShimRegistrySetDword(L"AsynchronousStart", 0);
+
+	TcmHarnessInitialize(&Harness);
+	FakeTcmSetHook(&Harness.Tcm, TouchDuringBringUp, &Hook);
+	FakeHidReset();
+
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, FALSE, 2000));
+
+	CHECK_EQ(Hook.Queued, BRINGUP_TOUCHES);
+	CHECK_EQ(FakeTcmPending(&Harness.Tcm), 0);
+	CHECK_EQ(FakeHidReports(), 0);
+	CHECK_EQ(Harness.Controller->DeviceStart.FirstTouchPending, TRUE);
+
+	CHECK_SUCCESS(TcmHarnessConnectInterrupt(&Harness));
+	QueueTouches(&Hook, 1);
+	CHECK(TcmHarnessDrain(&Harness, 1000));
+
+	CHECK_EQ(FakeHidReports(), 1);
+	CHECK_EQ(Harness.Controller->DeviceStart.FirstTouchPending, FALSE);
+
+	FakeHidReset();
+	TcmHarnessStop(&Harness);
+	ShimRegistryClear();
+}
+
+static VOID
+FirmwareImage(
+	UINT8* Image,
+	ULONG* Length
+)
+{
+	TCM_IMAGE_HEADER Header = { FIRMWARE_IMAGE_MAGIC, 1 };
+	TCM_AREA_DESCRIPTOR Area = { FIRMWARE_AREA_MAGIC };
+	UINT32 Offset = sizeof(Header) + sizeof(UINT32);
+	UINT8* Data;
+	ULONG i;
+
+	memcpy(Area.IdString, "APP_CODE", 8);
+	Area.FlashAddressWords = 0;
+	Area.Length = FLASH_PAGES * FLASH_PAGE_SIZE;
+
+	memcpy(Image, &Header, sizeof(Header));
+	memcpy(Image + sizeof(Header), &Offset, sizeof(Offset));
+	memcpy(Image + Offset, &Area, sizeof(Area));
+
+	Data = Image + Offset + sizeof(Area);
+
+	for (i = 0; i < Area.Length; i++) {
+		Data[i] = (UINT8)(i * 7 + i / FLASH_PAGE_SIZE);
+	}
+
+	*Length = Offset + sizeof(Area) + Area.Length;
+}
+
+//
+// A D0 exit that arrives while the controller erases
+//
+static BOOLEAN
+CancelDuringErase(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length,
+	PVOID Context
+)
+{
+	CANCEL_HOOK* Hook = Context;
+
+	UNREFERENCED_PARAMETER(Tcm);
+	UNREFERENCED_PARAMETER(Payload);
+	UNREFERENCED_PARAMETER(Length);
+
+	if (Command == CMD_ERASE_FLASH && ++Hook->Erases == Hook->CancelAfterErases) {
+		InterlockedExchange(&Hook->Harness->Controller->DeviceStart.Cancel, TRUE);
+	}
+
+	return FALSE;
+}
+
+static VOID
+TestFirmwareUpdateStopsWithBringUp(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	static UINT8 Image[FLASH_PAGES * FLASH_PAGE_SIZE + 256];
+	CANCEL_HOOK Hook = { &Harness, 0, 1 };
+	FAKE_TCM_OBJECT Object = { 0, 1, 500, 700 };
+	const UINT8* Data;
+	ULONG Length, Waited;
+
+	FirmwareImage(Image, &Length);
+	Data = Image + Length - FLASH_PAGES * FLASH_PAGE_SIZE;
+	ShimFileRegister(L"\\SystemRoot\\System32\\Drivers\\SynapticsTouchFw00.img", Image, Length);
+
+	ShimRegistrySetDword(L"VendorCount", 1);
+	ShimRegistrySetDword(L"Vendor00", 0);
+	ShimRegistrySetDword(L"ReprogramFw00", 1);
+
+	TcmHarnessInitialize(&Harness);
+	FakeTcmSetFlash(&Harness.Tcm, FLASH_BLOCK_WORDS, FLASH_PAGE_WORDS, 256);
+	FakeTcmSetHook(&Harness.Tcm, CancelDuringErase, &Hook);
+
+	//
+	// The update stops after the run it was writing, with bring-up
+	// left where it was
+	//
+	CHECK_EQ(TcmHarnessStart(&Harness, TRUE, 500), STATUS_IO_TIMEOUT);
+	TcmDeviceStartStop(Harness.Controller);
+
+	CHECK_EQ(Harness.Controller->DeviceStart.State, TCM_START_FIRMWARE);
+	CHECK_EQ(Harness.Tcm.IdInfo.Mode, MODE_BOOTLOADER);
+	CHECK_EQ(Harness.Tcm.FlashEraseCommands, 1);
+	CHECK(memcmp(Harness.Tcm.Flash, Data, FIRMWARE_MAX_ERASE_PAGES * FLASH_PAGE_SIZE) == 0);
+	CHECK(Harness.Tcm.FlashErases[FIRMWARE_MAX_ERASE_PAGES] == 0);
+
+	//
+	// Resumed, it only erases and writes what it had not
+	//
+	TcmDeviceStartResume(Harness.Controller);
+
+	for (Waited = 0; Waited < 2000 && TcmDeviceStartPending(Harness.Controller); Waited++) {
+		usleep(1000);
+	}
+
+	CHECK_EQ(Harness.Controller->DeviceStart.State, TCM_START_DONE);
+	CHECK_EQ(Harness.Tcm.IdInfo.Mode, MODE_APPLICATION_FIRMWARE);
+	CHECK_EQ(Harness.Tcm.FlashEraseCommands, FLASH_PAGES / FIRMWARE_MAX_ERASE_PAGES);
+	CHECK(memcmp(Harness.Tcm.Flash, Data, FLASH_PAGES * FLASH_PAGE_SIZE) == 0);
+
+	//
+	// And the controller it left behind reports touches
+	//
+	FakeHidReset();
+	FakeTcmQueueTouch(&Harness.Tcm, &Object, 1);
+	CHECK(TcmHarnessDrain(&Harness, 1000));
+	CHECK_EQ(FakeHidReports(), 1);
+
+	FakeHidReset();
+	TcmHarnessStop(&Harness);
+	ShimFileRegister(L"\\SystemRoot\\System32\\Drivers\\SynapticsTouchFw00.img", NULL, 0);
+	ShimRegistryClear();
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestBringUpDeliversTouches);
+	RUN(TestFirstTouchIsDelivered);
+	RUN(TestFirmwareUpdateStopsWithBringUp);
+
+	return TestResult();
+}
@@ -0,0 +1,236 @@
+/*++
+	Module Name:
+
+		dynamic_config.c
+
+	Abstract:
+
+		The dynamic config schema: CMD_DESCRIBE_DYNAMIC_CONFIG responses
+		as the driver receives them, padding byte included, run through
+		TcmParseDynamicConfigSchema, and a described schema deciding
+		which GET/SET_DYNAMIC_CONFIG commands reach the controller.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+
+#define TEST_FIELD_ID 0x30
+
+typedef struct _SCHEMA_CASE
+{
+	const char* Name;
+	const UINT8* Response;
+	ULONG Length;
+	ULONG DynamicConfigSize;
+	NTSTATUS Status;
+	ULONG Count;
+} SCHEMA_CASE;
+
+//
+// Id, size, offset (little endian), then the 0x5A padding byte
+//
+static const UINT8 SchemaTypical[] = {
+	DC_NO_DOZE,                  1, 0x00, 0x00,
+	DC_DISABLE_NOISE_MITIGATION, 1, 0x01, 0x00,
+	DC_REQUESTED_FREQUENCY,      2, 0x02, 0x00,
+	DC_CHARGER_CONNECTED,        1, 0x04, 0x00,
+	DC_IN_WAKEUP_GESTURE_MODE,   1, 0x05, 0x00,
+	TEST_FIELD_ID,               2, 0x06, 0x00,
+	0x5A
+};
+
+static const UINT8 SchemaHighOffset[] = {
+	DC_NO_DOZE,     1, 0x00, 0x01,
+	TEST_FIELD_ID,  2, 0xFE, 0x01,
+	0x5A
+};
+
+static const UINT8 SchemaDuplicate[] = {
+	DC_NO_DOZE, 1, 0x00, 0x00,
+	DC_NO_DOZE, 1, 0x01, 0x00,
+	0x5A
+};
+
+static const UINT8 SchemaWideField[] = {
+	TEST_FIELD_ID, 4, 0x00, 0x00,
+	0x5A
+};
+
+static const UINT8 SchemaUnknownId[] = {
+	DC_UNKNOWN, 1, 0x00, 0x00,
+	0x5A
+};
+
+static const UINT8 SchemaOutsideConfig[] = {
+	DC_NO_DOZE,    1, 0x00, 0x00,
+	TEST_FIELD_ID, 2, 0x07, 0x00,
+	0x5A
+};
+
+static const UINT8 SchemaTruncatedEntry[] = {
+	DC_NO_DOZE,    1, 0x00, 0x00,
+	TEST_FIELD_ID, 2,
+};
+
+static VOID
+TestParseSchema(
+	VOID
+)
+{
+	static const SCHEMA_CASE Cases[] = {
+		{ "typical", SchemaTypical, sizeof(SchemaTypical), 8, STATUS_SUCCESS, 6 },
+		{ "unknown config size", SchemaTypical, sizeof(SchemaTypical), 0, STATUS_SUCCESS, 6 },
+		{ "high offset", SchemaHighOffset, sizeof(SchemaHighOffset), 512, STATUS_SUCCESS, 2 },
+		{ "duplicate id", SchemaDuplicate, sizeof(SchemaDuplicate), 8, STATUS_INVALID_PARAMETER, 1 },
+		{ "wide field", SchemaWideField, sizeof(SchemaWideField), 8, STATUS_INVALID_PARAMETER, 0 },
+		{ "unknown id", SchemaUnknownId, sizeof(SchemaUnknownId), 8, STATUS_INVALID_PARAMETER, 0 },
+		{ "outside config", SchemaOutsideConfig, sizeof(SchemaOutsideConfig), 8, STATUS_INVALID_PARAMETER, 1 },
+		{ "truncated entry", SchemaTruncatedEntry, sizeof(SchemaTruncatedEntry), 8, STATUS_SUCCESS, 1 },
+		{ "empty", SchemaTypical, 1, 8, STATUS_SUCCESS, 0 },
+	};
+	static TCM_DYNAMIC_CONFIG_SCHEMA Schema;
+	UINT8 Response[64];
+	ULONG i;
+
+	for (i = 0; i < RTL_NUMBER_OF(Cases); i++) {
+		memcpy(Response, Cases[i].Response, Cases[i].Length);
+
+		if (TcmParseDynamicConfigSchema(Response,
+			Cases[i].Length,
+			Cases[i].DynamicConfigSize,
+			&Schema) != Cases[i].Status) {
+			fprintf(stderr, "  %s: unexpected status\n", Cases[i].Name);
+			TestFailures++;
+		}
+
+		if (Schema.Count != Cases[i].Count) {
+			fprintf(stderr, "  %s: %lu fields, expected %lu\n",
+				Cases[i].Name,
+				(unsigned long)Schema.Count,
+				(unsigned long)Cases[i].Count);
+			TestFailures++;
+		}
+	}
+
+	//
+	// Fields keep their place in the blob and are found by id
+	//
+	memcpy(Response, SchemaTypical, sizeof(SchemaTypical));
+	CHECK_SUCCESS(TcmParseDynamicConfigSchema(Response, sizeof(SchemaTypical), 8, &Schema));
+	CHECK_EQ(Schema.FieldIndex[DC_ENABLE_GLOVE], 0);
+	CHECK(Schema.FieldIndex[TEST_FIELD_ID] != 0);
+	CHECK_EQ(Schema.Fields[Schema.FieldIndex[TEST_FIELD_ID] - 1].Offset, 6);
+	CHECK_EQ(Schema.Fields[Schema.FieldIndex[TEST_FIELD_ID] - 1].Size, 2);
+	CHECK_EQ(Schema.Fields[Schema.FieldIndex[DC_REQUESTED_FREQUENCY] - 1].Offset, 2);
+
+	memcpy(Response, SchemaHighOffset, sizeof(SchemaHighOffset));
+	CHECK_SUCCESS(TcmParseDynamicConfigSchema(Response, sizeof(SchemaHighOffset), 512, &Schema));
+	CHECK_EQ(Schema.Fields[1].Offset, 0x1FE);
+}
+
+//
+// Describes SchemaTypical, and answers reads of one byte fields with
+// one byte as the firmware does
+//
+static BOOLEAN
+DescribeSchema(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length,
+	PVOID Context
+)
+{
+	UINT8 Value;
+
+	UNREFERENCED_PARAMETER(Context);
+
+	if (Command == CMD_DESCRIBE_DYNAMIC_CONFIG) {
+		FakeTcmRespond(Tcm, TCM_STATUS_OK, SchemaTypical, sizeof(SchemaTypical) - 1);
+		return TRUE;
+	}
+
+	if (Command == CMD_GET_DYNAMIC_CONFIG && Length >= 1 && Payload[0] == DC_CHARGER_CONNECTED) {
+		Value = (UINT8)Tcm->DynamicConfig[DC_CHARGER_CONNECTED];
+		FakeTcmRespond(Tcm, TCM_STATUS_OK, &Value, sizeof(Value));
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static VOID
+TestSchemaGatesCommands(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TCM_CONTROLLER_CONTEXT* Controller;
+	ULONG Gets, Sets;
+	UINT16 Value;
+
+	TcmHarnessInitialize(&Harness);
+	Harness.Tcm.AppInfo.DynamicConfigSize = 8;
+	Harness.Tcm.DynamicConfig[DC_CHARGER_CONNECTED] = 1;
+	FakeTcmSetHook(&Harness.Tcm, DescribeSchema, NULL);
+
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+	Controller = Harness.Controller;
+
+	CHECK_EQ(Controller->DynamicConfigSchema.Described, TRUE);
+	CHECK_EQ(Controller->DynamicConfigSchema.Count, 6);
+	CHECK_EQ(Controller->DynamicConfigSchema.BuildId, Harness.Tcm.IdInfo.BuildId);
+
+	Gets = Harness.Tcm.CommandCounts[CMD_GET_DYNAMIC_CONFIG];
+	Sets = Harness.Tcm.CommandCounts[CMD_SET_DYNAMIC_CONFIG];
+
+	//
+	// Not described, or too wide for the field: never sent
+	//
+	CHECK_EQ(TcmGetDynamicConfig(Controller, Harness.Spb, DC_ENABLE_GLOVE, &Value), STATUS_NOT_SUPPORTED);
+	CHECK_EQ(TcmSetDynamicConfig(Controller, Harness.Spb, DC_ENABLE_GLOVE, 1), STATUS_NOT_SUPPORTED);
+	CHECK_EQ(TcmSetDynamicConfig(Controller, Harness.Spb, DC_CHARGER_CONNECTED, 0x100), STATUS_INVALID_PARAMETER);
+
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_GET_DYNAMIC_CONFIG], Gets);
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_SET_DYNAMIC_CONFIG], Sets);
+
+	//
+	// A one byte field read back as one byte
+	//
+	CHECK_SUCCESS(TcmGetDynamicConfig(Controller, Harness.Spb, DC_CHARGER_CONNECTED, &Value));
+	CHECK_EQ(Value, 1);
+
+	CHECK_SUCCESS(TcmSetDynamicConfig(Controller, Harness.Spb, TEST_FIELD_ID, 0x1234));
+	CHECK_SUCCESS(TcmGetDynamicConfig(Controller, Harness.Spb, TEST_FIELD_ID, &Value));
+	CHECK_EQ(Value, 0x1234);
+
+	//
+	// Described once per build, a second bring-up asks again only if
+	// the build changed
+	//
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_DESCRIBE_DYNAMIC_CONFIG], 1);
+	CHECK_SUCCESS(TcmDescribeDynamicConfig(Controller, Harness.Spb));
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_DESCRIBE_DYNAMIC_CONFIG], 1);
+
+	Controller->IDInfo.BuildId++;
+	CHECK_SUCCESS(TcmDescribeDynamicConfig(Controller, Harness.Spb));
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_DESCRIBE_DYNAMIC_CONFIG], 2);
+
+	TcmHarnessStop(&Harness);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestParseSchema);
+	RUN(TestSchemaGatesCommands);
+
+	return TestResult();
+}
@@ -0,0 +1,59 @@
+/*++
+	Module Name:
+
+		firmware_image.c
+
+	Abstract:
+
+		Firmware image files for the update and host download tests.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "firmware_image.h"
+#include <string.h>
+
+ULONG
+FakeFirmwareImageBuild(
+	UINT8* Image,
+	ULONG Size,
+	const FAKE_FIRMWARE_AREA* Areas,
+	ULONG Count
+)
+{
+	TCM_IMAGE_HEADER Header = { FIRMWARE_IMAGE_MAGIC, Count };
+	TCM_AREA_DESCRIPTOR Descriptor;
+	ULONG Length = sizeof(Header) + Count * sizeof(UINT32);
+	UINT32 Offset;
+	ULONG i;
+
+	if (Length > Size) {
+		return 0;
+	}
+
+	memcpy(Image, &Header, sizeof(Header));
+
+	for (i = 0; i < Count; i++) {
+		if (Length + sizeof(Descriptor) + Areas[i].Length > Size) {
+			return 0;
+		}
+
+		memset(&Descriptor, 0, sizeof(Descriptor));
+		Descriptor.Magic = FIRMWARE_AREA_MAGIC;
+		memcpy(Descriptor.IdString, Areas[i].Id, min(strlen(Areas[i].Id), sizeof(Descriptor.IdString)));
+		Descriptor.FlashAddressWords = Areas[i].Address / 2;
+		Descriptor.Length = Areas[i].Length;
+
+		Offset = Length;
+		memcpy(Image + sizeof(Header) + i * sizeof(UINT32), &Offset, sizeof(Offset));
+		memcpy(Image + Length, &Descriptor, sizeof(Descriptor));
+		memcpy(Image + Length + sizeof(Descriptor), Areas[i].Data, Areas[i].Length);
+
+		Length += sizeof(Descriptor) + Areas[i].Length;
+	}
+
+	return Length;
+}
@@ -0,0 +1,41 @@
+/*++
+	Module Name:
+
+		firmware_image.h
+
+	Abstract:
+
+		Builds firmware image files in the layout TcmParseFirmwareImage
+		reads: an image header, a table of area offsets and the areas,
+		each behind its descriptor.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <tcm/touch_tcm.h>
+
+typedef struct _FAKE_FIRMWARE_AREA
+{
+	const char* Id;
+	ULONG Address;
+	const UINT8* Data;
+	ULONG Length;
+} FAKE_FIRMWARE_AREA;
+
+//
+// Writes the image into Image and returns its length, 0 if it does not
+// fit into Size bytes
+//
+ULONG
+FakeFirmwareImageBuild(
+	UINT8* Image,
+	ULONG Size,
+	const FAKE_FIRMWARE_AREA* Areas,
+	ULONG Count
+);
@@ -0,0 +1,107 @@
+/*++
+	Module Name:
+
+		hid_sink.c
+
+	Abstract:
+
+		TchSendReport for test builds. Completing the ping-pong requests
+		of the HID class driver is replaced by keeping the report.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "hid_sink.h"
+#include <pthread.h>
+
+static pthread_mutex_t FakeHidLock = PTHREAD_MUTEX_INITIALIZER;
+static HID_INPUT_REPORT FakeHidHistory[FAKE_HID_HISTORY];
+static ULONG FakeHidCount;
+static FAKE_HID_CALLBACK* FakeHidCallback;
+static PVOID FakeHidCallbackContext;
+
+NTSTATUS
+TchSendReport(
+	IN WDFQUEUE PingPongQueue,
+	IN PHID_INPUT_REPORT hidReportFromDriver
+)
+{
+	FAKE_HID_CALLBACK* Callback;
+	PVOID Context;
+
+	UNREFERENCED_PARAMETER(PingPongQueue);
+
+	pthread_mutex_lock(&FakeHidLock);
+	FakeHidHistory[FakeHidCount % FAKE_HID_HISTORY] = *hidReportFromDriver;
+	FakeHidCount++;
+	Callback = FakeHidCallback;
+	Context = FakeHidCallbackContext;
+	pthread_mutex_unlock(&FakeHidLock);
+
+	if (Callback != NULL) {
+		Callback(hidReportFromDriver, Context);
+	}
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+FakeHidReset(
+	VOID
+)
+{
+	pthread_mutex_lock(&FakeHidLock);
+	FakeHidCount = 0;
+	FakeHidCallback = NULL;
+	FakeHidCallbackContext = NULL;
+	pthread_mutex_unlock(&FakeHidLock);
+}
+
+VOID
+FakeHidSetCallback(
+	FAKE_HID_CALLBACK* Callback,
+	PVOID Context
+)
+{
+	pthread_mutex_lock(&FakeHidLock);
+	FakeHidCallback = Callback;
+	FakeHidCallbackContext = Context;
+	pthread_mutex_unlock(&FakeHidLock);
+}
+
+ULONG
+FakeHidReports(
+	VOID
+)
+{
+	ULONG Count;
+
+	pthread_mutex_lock(&FakeHidLock);
+	Count = FakeHidCount;
+	pthread_mutex_unlock(&FakeHidLock);
+
+	return Count;
+}
+
+BOOLEAN
+FakeHidRecent(
+	ULONG Index,
+	HID_INPUT_REPORT* Report
+)
+{
+	BOOLEAN Found = FALSE;
+
+	pthread_mutex_lock(&FakeHidLock);
+
+	if (Index < FakeHidCount && Index < FAKE_HID_HISTORY) {
+		*Report = FakeHidHistory[(FakeHidCount - 1 - Index) % FAKE_HID_HISTORY];
+		Found = TRUE;
+	}
+
+	pthread_mutex_unlock(&FakeHidLock);
+
+	return Found;
+}
@@ -0,0 +1,53 @@
+/*++
+	Module Name:
+
+		hid_sink.h
+
+	Abstract:
+
+		Stands in for the HID class side of hid.c. Reports the driver
+		sends are counted and the most recent ones kept.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include <controller.h>
+#include <hid.h>
+
+#define FAKE_HID_HISTORY 64
+
+typedef VOID FAKE_HID_CALLBACK(
+	const HID_INPUT_REPORT* Report,
+	PVOID Context);
+
+VOID
+FakeHidReset(
+	VOID
+);
+
+VOID
+FakeHidSetCallback(
+	FAKE_HID_CALLBACK* Callback,
+	PVOID Context
+);
+
+ULONG
+FakeHidReports(
+	VOID
+);
+
+//
+// Copies out the Index-th most recent report, 0 being the last one
+//
+BOOLEAN
+FakeHidRecent(
+	ULONG Index,
+	HID_INPUT_REPORT* Report
+);
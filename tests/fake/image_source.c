@@ -0,0 +1,142 @@
+/*++
+	Module Name:
+
+		image_source.c
+
+	Abstract:
+
+		Image reports at a fixed frame rate, see image_source.h
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "image_source.h"
+#include <errno.h>
+#include <time.h>
+
+#define IMAGE_BASELINE 1000
+#define IMAGE_CONTACT_PEAK 600
+#define IMAGE_CONTACT_RADIUS 3
+
+VOID
+ImageSourceFill(
+	ULONG Index,
+	ULONG Rows,
+	ULONG Cols,
+	UINT16* Samples
+)
+{
+	LONG ContactRow = (LONG)((Index / 4) % Rows);
+	LONG ContactCol = (LONG)((Index / 2) % Cols);
+	LONG Row, Col, Distance;
+	ULONG Noise;
+
+	for (Row = 0; Row < (LONG)Rows; Row++) {
+		for (Col = 0; Col < (LONG)Cols; Col++) {
+			Distance = abs(Row - ContactRow) + abs(Col - ContactCol);
+			Samples[Row * Cols + Col] = IMAGE_BASELINE;
+
+			if (Distance <= IMAGE_CONTACT_RADIUS) {
+				Samples[Row * Cols + Col] += (UINT16)(IMAGE_CONTACT_PEAK / (1 + Distance));
+
+				//
+				// Noise only where the contact is, the rest of the
+				// panel stays quiet from frame to frame
+				//
+				Noise = (Index * 2654435761U + (ULONG)(Row * Cols + Col) * 40503U) >> 28;
+				Samples[Row * Cols + Col] += (UINT16)Noise;
+			}
+		}
+	}
+
+	Samples[0] = (UINT16)Index;
+}
+
+static void*
+ImageSourceThread(
+	void* Context
+)
+{
+	IMAGE_SOURCE* Source = Context;
+	ULONG Count = Source->Rows * Source->Cols;
+	UINT16* Samples = malloc(Count * sizeof(UINT16));
+	struct timespec Next, Now;
+	long Period = 1000000000L / (long)Source->RateHz;
+	ULONG Index = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &Next);
+
+	while (!Source->Stop && Samples != NULL) {
+		Next.tv_nsec += Period;
+		if (Next.tv_nsec >= 1000000000L) {
+			Next.tv_sec++;
+			Next.tv_nsec -= 1000000000L;
+		}
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Next, NULL) == EINTR) {
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &Now);
+
+		//
+		// More than a frame behind, the scheduler held us up
+		//
+		if ((Now.tv_sec - Next.tv_sec) * 1000000000L + (Now.tv_nsec - Next.tv_nsec) > Period) {
+			Source->Late++;
+		}
+
+		ImageSourceFill(++Index, Source->Rows, Source->Cols, Samples);
+		FakeTcmQueue(Source->Tcm, Source->ReportType, Samples, Count * sizeof(UINT16), 0);
+		InterlockedIncrement(&Source->Frames);
+	}
+
+	free(Samples);
+
+	return NULL;
+}
+
+NTSTATUS
+ImageSourceStart(
+	IMAGE_SOURCE* Source,
+	FAKE_TCM* Tcm,
+	UINT8 ReportType,
+	ULONG RateHz
+)
+{
+	memset(Source, 0, sizeof(*Source));
+
+	Source->Tcm = Tcm;
+	Source->ReportType = ReportType;
+	Source->RateHz = RateHz;
+	Source->Rows = Tcm->AppInfo.NumOfImageRows;
+	Source->Cols = Tcm->AppInfo.NumOfImageCols;
+
+	if (RateHz == 0 || Source->Rows * Source->Cols == 0) {
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	if (pthread_create(&Source->Thread, NULL, ImageSourceThread, Source) != 0) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Source->Running = TRUE;
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+ImageSourceStop(
+	IMAGE_SOURCE* Source
+)
+{
+	if (!Source->Running) {
+		return;
+	}
+
+	InterlockedExchange(&Source->Stop, TRUE);
+	pthread_join(Source->Thread, NULL);
+	Source->Running = FALSE;
+}
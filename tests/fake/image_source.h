@@ -0,0 +1,65 @@
+/*++
+	Module Name:
+
+		image_source.h
+
+	Abstract:
+
+		Raw or delta image reports from a FAKE_TCM at a fixed frame
+		rate, like a controller with an image report enabled. Frame n
+		is a function of n alone so a reader can check every frame it
+		receives; its first sample holds n.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include "tcm_device.h"
+
+typedef struct _IMAGE_SOURCE
+{
+	FAKE_TCM* Tcm;
+	UINT8 ReportType;
+	ULONG RateHz;
+	ULONG Rows;
+	ULONG Cols;
+
+	pthread_t Thread;
+	BOOLEAN Running;
+	volatile LONG Stop;
+	volatile LONG Frames;
+	ULONG Late;
+} IMAGE_SOURCE;
+
+//
+// Fills Samples with frame Index of a Rows x Cols panel: a baseline,
+// a contact moving across the panel and a little noise around it
+//
+VOID
+ImageSourceFill(
+	ULONG Index,
+	ULONG Rows,
+	ULONG Cols,
+	UINT16* Samples
+);
+
+//
+// Queues frames 1, 2, ... on Tcm every 1 / RateHz seconds. The image
+// size is that of the fake's app info.
+//
+NTSTATUS
+ImageSourceStart(
+	IMAGE_SOURCE* Source,
+	FAKE_TCM* Tcm,
+	UINT8 ReportType,
+	ULONG RateHz
+);
+
+VOID
+ImageSourceStop(
+	IMAGE_SOURCE* Source
+);
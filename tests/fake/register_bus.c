@@ -0,0 +1,133 @@
+/*++
+	Module Name:
+
+		register_bus.c
+
+	Abstract:
+
+		A controller with an RMI4 style register map at the level of the
+		bytes on the bus.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "register_bus.h"
+
+static BOOLEAN
+FakeRegisterBusNak(
+	FAKE_REGISTER_BUS* Bus
+)
+{
+	if (Bus->NakEnabled && Bus->Page == Bus->NakPage && Bus->Address == Bus->NakAddress) {
+		Bus->Naks++;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static NTSTATUS
+FakeRegisterBusWrite(
+	PVOID Context,
+	const UCHAR* Data,
+	ULONG Length
+)
+{
+	FAKE_REGISTER_BUS* Bus = Context;
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG i;
+
+	if (Length == 0) {
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	pthread_mutex_lock(&Bus->Lock);
+
+	Bus->Writes++;
+	Bus->Address = Data[0];
+
+	if (Length > 1 && FakeRegisterBusNak(Bus)) {
+		status = STATUS_NO_SUCH_DEVICE;
+	}
+	else if (Length > 1 && Bus->Address == FAKE_REGISTER_PAGE_SELECT) {
+		Bus->Page = Data[1];
+		Bus->PageSelects++;
+	}
+	else {
+		for (i = 1; i < Length; i++) {
+			Bus->Registers[Bus->Page][Bus->Address++] = Data[i];
+		}
+	}
+
+	pthread_mutex_unlock(&Bus->Lock);
+
+	return status;
+}
+
+static NTSTATUS
+FakeRegisterBusRead(
+	PVOID Context,
+	UCHAR* Data,
+	ULONG Length,
+	ULONG* BytesRead
+)
+{
+	FAKE_REGISTER_BUS* Bus = Context;
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG i;
+
+	pthread_mutex_lock(&Bus->Lock);
+
+	Bus->Reads++;
+
+	if (FakeRegisterBusNak(Bus)) {
+		status = STATUS_NO_SUCH_DEVICE;
+	}
+	else {
+		for (i = 0; i < Length; i++) {
+			Data[i] = Bus->Registers[Bus->Page][Bus->Address++];
+		}
+
+		*BytesRead = Length;
+	}
+
+	pthread_mutex_unlock(&Bus->Lock);
+
+	return status;
+}
+
+VOID
+FakeRegisterBusInitialize(
+	FAKE_REGISTER_BUS* Bus
+)
+{
+	memset(Bus, 0, sizeof(*Bus));
+	pthread_mutex_init(&Bus->Lock, NULL);
+}
+
+VOID
+FakeRegisterBusCleanup(
+	FAKE_REGISTER_BUS* Bus
+)
+{
+	pthread_mutex_destroy(&Bus->Lock);
+}
+
+VOID
+FakeRegisterBusConnect(
+	FAKE_REGISTER_BUS* Bus,
+	WDFIOTARGET IoTarget
+)
+{
+	SHIM_BUS_DEVICE Device;
+
+	Device.Write = FakeRegisterBusWrite;
+	Device.Read = FakeRegisterBusRead;
+	Device.Sequence = NULL;
+	Device.Context = Bus;
+
+	ShimIoTargetConnect(IoTarget, &Device);
+}
@@ -0,0 +1,63 @@
+/*++
+	Module Name:
+
+		register_bus.h
+
+	Abstract:
+
+		A controller with an RMI4 style register map: 256 pages of 256
+		registers, the page selected through register 0xFF. A write sets
+		the register address and stores any data after it, a read
+		returns registers from that address on.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include <pthread.h>
+
+#define FAKE_REGISTER_PAGE_SELECT 0xFF
+
+typedef struct _FAKE_REGISTER_BUS
+{
+	pthread_mutex_t Lock;
+
+	UINT8 Registers[256][256];
+	UINT8 Page;
+	UINT8 Address;
+
+	//
+	// A register that does not acknowledge: transfers that start on it
+	// fail with STATUS_NO_SUCH_DEVICE and change nothing
+	//
+	BOOLEAN NakEnabled;
+	UINT8 NakPage;
+	UINT8 NakAddress;
+
+	ULONG Writes;
+	ULONG Reads;
+	ULONG PageSelects;
+	ULONG Naks;
+} FAKE_REGISTER_BUS;
+
+VOID
+FakeRegisterBusInitialize(
+	FAKE_REGISTER_BUS* Bus
+);
+
+VOID
+FakeRegisterBusCleanup(
+	FAKE_REGISTER_BUS* Bus
+);
+
+VOID
+FakeRegisterBusConnect(
+	FAKE_REGISTER_BUS* Bus,
+	WDFIOTARGET IoTarget
+);
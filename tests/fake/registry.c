@@ -0,0 +1,269 @@
+/*++
+	Module Name:
+
+		registry.c
+
+	Abstract:
+
+		In-memory registry behind the key routines src\registry.c reads
+		values with, and the Rtl query and write routines.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include <wdm.h>
+#include <pthread.h>
+#include "registry.h"
+
+#define SHIM_REGISTRY_VALUES 64
+#define SHIM_REGISTRY_NAME 64
+#define SHIM_REGISTRY_DATA 256
+
+typedef struct _SHIM_REGISTRY_VALUE
+{
+	WCHAR Name[SHIM_REGISTRY_NAME];
+	ULONG Type;
+	ULONG Length;
+	UCHAR Data[SHIM_REGISTRY_DATA];
+} SHIM_REGISTRY_VALUE;
+
+static SHIM_REGISTRY_VALUE ShimRegistry[SHIM_REGISTRY_VALUES];
+static pthread_mutex_t ShimRegistryLock = PTHREAD_MUTEX_INITIALIZER;
+
+static BOOLEAN
+ShimNameEqual(
+	const WCHAR* A,
+	PCWSTR B
+)
+{
+	ULONG i;
+
+	for (i = 0; A[i] != 0 && A[i] == B[i]; i++) {
+	}
+
+	return A[i] == B[i];
+}
+
+static SHIM_REGISTRY_VALUE*
+ShimRegistryFind(
+	PCWSTR Name
+)
+{
+	ULONG i;
+
+	for (i = 0; i < SHIM_REGISTRY_VALUES; i++) {
+		if (ShimRegistry[i].Name[0] != 0 && ShimNameEqual(ShimRegistry[i].Name, Name)) {
+			return &ShimRegistry[i];
+		}
+	}
+
+	return NULL;
+}
+
+VOID
+ShimRegistrySet(
+	PCWSTR Name,
+	ULONG Type,
+	const VOID* Data,
+	ULONG Length
+)
+{
+	SHIM_REGISTRY_VALUE* Value;
+	ULONG i;
+
+	NT_ASSERT(Length <= SHIM_REGISTRY_DATA);
+
+	pthread_mutex_lock(&ShimRegistryLock);
+
+	Value = ShimRegistryFind(Name);
+
+	for (i = 0; Value == NULL && i < SHIM_REGISTRY_VALUES; i++) {
+		if (ShimRegistry[i].Name[0] == 0) {
+			Value = &ShimRegistry[i];
+		}
+	}
+
+	NT_ASSERT(Value != NULL);
+
+	for (i = 0; i + 1 < SHIM_REGISTRY_NAME && Name[i] != 0; i++) {
+		Value->Name[i] = Name[i];
+	}
+
+	Value->Name[i] = 0;
+	Value->Type = Type;
+	Value->Length = Length;
+	RtlCopyMemory(Value->Data, Data, Length);
+
+	pthread_mutex_unlock(&ShimRegistryLock);
+}
+
+VOID
+ShimRegistrySetDword(
+	PCWSTR Name,
+	ULONG Value
+)
+{
+	ShimRegistrySet(Name, REG_DWORD, &Value, sizeof(Value));
+}
+
+BOOLEAN
+ShimRegistryGetDword(
+	PCWSTR Name,
+	ULONG* Value
+)
+{
+	SHIM_REGISTRY_VALUE* Entry;
+	BOOLEAN Found = FALSE;
+
+	pthread_mutex_lock(&ShimRegistryLock);
+
+	Entry = ShimRegistryFind(Name);
+	if (Entry != NULL && Entry->Type == REG_DWORD) {
+		RtlCopyMemory(Value, Entry->Data, sizeof(*Value));
+		Found = TRUE;
+	}
+
+	pthread_mutex_unlock(&ShimRegistryLock);
+
+	return Found;
+}
+
+VOID
+ShimRegistryClear(
+	VOID
+)
+{
+	pthread_mutex_lock(&ShimRegistryLock);
+	RtlZeroMemory(ShimRegistry, sizeof(ShimRegistry));
+	pthread_mutex_unlock(&ShimRegistryLock);
+}
+
+//
+// Keys always open, src\registry.c reads values through them
+//
+static UCHAR ShimRegistryKey;
+
+NTSTATUS
+ZwOpenKey(
+	PHANDLE KeyHandle,
+	ACCESS_MASK DesiredAccess,
+	POBJECT_ATTRIBUTES ObjectAttributes
+)
+{
+	UNREFERENCED_PARAMETER(DesiredAccess);
+	UNREFERENCED_PARAMETER(ObjectAttributes);
+
+	*KeyHandle = &ShimRegistryKey;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+ZwQueryValueKey(
+	HANDLE KeyHandle,
+	PUNICODE_STRING ValueName,
+	KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
+	PVOID KeyValueInformation,
+	ULONG Length,
+	PULONG ResultLength
+)
+{
+	PKEY_VALUE_PARTIAL_INFORMATION Info = KeyValueInformation;
+	SHIM_REGISTRY_VALUE* Value;
+	WCHAR Name[SHIM_REGISTRY_NAME] = { 0 };
+	ULONG Header = FIELD_OFFSET(KEY_VALUE_PARTIAL_INFORMATION, Data);
+	NTSTATUS status;
+
+	UNREFERENCED_PARAMETER(KeyHandle);
+	UNREFERENCED_PARAMETER(KeyValueInformationClass);
+
+	RtlCopyMemory(Name, ValueName->Buffer,
+		min(ValueName->Length, sizeof(Name) - sizeof(WCHAR)));
+
+	pthread_mutex_lock(&ShimRegistryLock);
+
+	Value = ShimRegistryFind(Name);
+
+	if (Value == NULL) {
+		status = STATUS_OBJECT_NAME_NOT_FOUND;
+		*ResultLength = 0;
+	}
+	else if (Length < Header) {
+		status = STATUS_BUFFER_TOO_SMALL;
+		*ResultLength = Header + Value->Length;
+	}
+	else {
+		Info->TitleIndex = 0;
+		Info->Type = Value->Type;
+		Info->DataLength = Value->Length;
+		RtlCopyMemory(Info->Data, Value->Data, min(Value->Length, Length - Header));
+
+		status = Length - Header < Value->Length ? STATUS_BUFFER_OVERFLOW : STATUS_SUCCESS;
+		*ResultLength = Header + Value->Length;
+	}
+
+	pthread_mutex_unlock(&ShimRegistryLock);
+
+	return status;
+}
+
+NTSTATUS
+RtlWriteRegistryValue(
+	ULONG RelativeTo,
+	PCWSTR Path,
+	PCWSTR ValueName,
+	ULONG ValueType,
+	PVOID ValueData,
+	ULONG ValueLength
+)
+{
+	UNREFERENCED_PARAMETER(RelativeTo);
+	UNREFERENCED_PARAMETER(Path);
+
+	ShimRegistrySet(ValueName, ValueType, ValueData, ValueLength);
+
+	return STATUS_SUCCESS;
+}
+
+//
+// Only direct queries are used by the driver
+//
+NTSTATUS
+RtlQueryRegistryValues(
+	ULONG RelativeTo,
+	PCWSTR Path,
+	PRTL_QUERY_REGISTRY_TABLE QueryTable,
+	PVOID Context,
+	PVOID Environment
+)
+{
+	PRTL_QUERY_REGISTRY_TABLE Entry;
+	SHIM_REGISTRY_VALUE* Value;
+
+	UNREFERENCED_PARAMETER(RelativeTo);
+	UNREFERENCED_PARAMETER(Path);
+	UNREFERENCED_PARAMETER(Context);
+	UNREFERENCED_PARAMETER(Environment);
+
+	pthread_mutex_lock(&ShimRegistryLock);
+
+	for (Entry = QueryTable; Entry->QueryRoutine != NULL || Entry->Name != NULL; Entry++) {
+		NT_ASSERT(Entry->Flags & RTL_QUERY_REGISTRY_DIRECT);
+
+		Value = ShimRegistryFind(Entry->Name);
+
+		if (Value != NULL && Value->Type == REG_DWORD) {
+			RtlCopyMemory(Entry->EntryContext, Value->Data, sizeof(ULONG));
+		}
+		else if (Entry->DefaultType == REG_DWORD && Entry->DefaultData != NULL) {
+			RtlCopyMemory(Entry->EntryContext, Entry->DefaultData, sizeof(ULONG));
+		}
+	}
+
+	pthread_mutex_unlock(&ShimRegistryLock);
+
+	return STATUS_SUCCESS;
+}
@@ -0,0 +1,44 @@
+/*++
+	Module Name:
+
+		registry.h
+
+	Abstract:
+
+		In-memory registry for the test builds. Values are looked up by
+		name only, the driver never uses one name under two keys.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+
+VOID
+ShimRegistrySet(
+	PCWSTR Name,
+	ULONG Type,
+	const VOID* Data,
+	ULONG Length
+);
+
+VOID
+ShimRegistrySetDword(
+	PCWSTR Name,
+	ULONG Value
+);
+
+BOOLEAN
+ShimRegistryGetDword(
+	PCWSTR Name,
+	ULONG* Value
+);
+
+VOID
+ShimRegistryClear(
+	VOID
+);
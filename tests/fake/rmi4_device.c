@@ -0,0 +1,368 @@
+/*++
+	Module Name:
+
+		rmi4_device.c
+
+	Abstract:
+
+		An RMI4 controller with packet registers, see rmi4_device.h.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "rmi4_device.h"
+
+#define FAKE_RMI4_FIRST_FUNCTION 0xE9
+#define FAKE_RMI4_FUNCTION_SIZE 6
+
+static FAKE_RMI4_REGISTER*
+FakeRmi4Register(
+	FAKE_RMI4* Rmi4
+)
+{
+	if (Rmi4->Page >= FAKE_RMI4_PAGES) {
+		return NULL;
+	}
+
+	return &Rmi4->Registers[Rmi4->Page][Rmi4->Address];
+}
+
+//
+// Moves past one byte of the current register, onto the next address
+// once all bytes of a packet register went by
+//
+static VOID
+FakeRmi4Advance(
+	FAKE_RMI4* Rmi4,
+	FAKE_RMI4_REGISTER* Register
+)
+{
+	ULONG Length = (Register != NULL && Register->Length != 0) ? Register->Length : 1;
+
+	if (++Rmi4->Offset >= Length) {
+		Rmi4->Offset = 0;
+		Rmi4->Address++;
+	}
+}
+
+static VOID
+FakeRmi4Log(
+	FAKE_RMI4* Rmi4,
+	BOOLEAN Write,
+	ULONG Length
+)
+{
+	FAKE_RMI4_TRANSFER* Transfer;
+
+	if (Rmi4->TransferCount == FAKE_RMI4_MAX_TRANSFERS) {
+		return;
+	}
+
+	Transfer = &Rmi4->Transfers[Rmi4->TransferCount++];
+	Transfer->Write = Write;
+	Transfer->Page = Rmi4->Page;
+	Transfer->Address = Rmi4->Address;
+	Transfer->Length = Length;
+}
+
+//
+// Accounts a transfer to its bus transaction, a sequence started one
+// for all of its transfers
+//
+static VOID
+FakeRmi4Transaction(
+	FAKE_RMI4* Rmi4
+)
+{
+	if (Rmi4->SequenceTransfers != 0) {
+		Rmi4->SequenceTransfers--;
+	}
+	else {
+		Rmi4->Transactions++;
+	}
+}
+
+static NTSTATUS
+FakeRmi4Sequence(
+	PVOID Context,
+	ULONG TransferCount
+)
+{
+	FAKE_RMI4* Rmi4 = Context;
+	NTSTATUS Status;
+
+	pthread_mutex_lock(&Rmi4->Lock);
+
+	Status = Rmi4->SequenceStatus;
+
+	if (NT_SUCCESS(Status)) {
+		Rmi4->SequenceTransfers = TransferCount;
+		Rmi4->Transactions++;
+		Rmi4->Sequences++;
+	}
+	else {
+		Rmi4->SequencesRejected++;
+	}
+
+	pthread_mutex_unlock(&Rmi4->Lock);
+
+	return Status;
+}
+
+static NTSTATUS
+FakeRmi4Write(
+	PVOID Context,
+	const UCHAR* Data,
+	ULONG Length
+)
+{
+	FAKE_RMI4* Rmi4 = Context;
+	FAKE_RMI4_REGISTER* Register;
+	ULONG i;
+
+	if (Length == 0) {
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	pthread_mutex_lock(&Rmi4->Lock);
+
+	FakeRmi4Transaction(Rmi4);
+
+	Rmi4->Address = Data[0];
+	Rmi4->Offset = 0;
+
+	if (Length > 1 && Rmi4->Address == FAKE_RMI4_PAGE_SELECT) {
+		Rmi4->Page = Data[1];
+		Rmi4->PageSelects++;
+	}
+	else if (Length > 1) {
+		FakeRmi4Log(Rmi4, TRUE, Length - 1);
+
+		for (i = 1; i < Length; i++) {
+			Register = FakeRmi4Register(Rmi4);
+
+			if (Register != NULL) {
+				Register->Data[Rmi4->Offset] = Data[i];
+			}
+
+			FakeRmi4Advance(Rmi4, Register);
+		}
+	}
+
+	pthread_mutex_unlock(&Rmi4->Lock);
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+FakeRmi4Read(
+	PVOID Context,
+	UCHAR* Data,
+	ULONG Length,
+	ULONG* BytesRead
+)
+{
+	FAKE_RMI4* Rmi4 = Context;
+	FAKE_RMI4_REGISTER* Register;
+	ULONG i;
+
+	pthread_mutex_lock(&Rmi4->Lock);
+
+	FakeRmi4Transaction(Rmi4);
+	FakeRmi4Log(Rmi4, FALSE, Length);
+	Rmi4->BytesRead += Length;
+
+	for (i = 0; i < Length; i++) {
+		Register = FakeRmi4Register(Rmi4);
+		Data[i] = Register != NULL ? Register->Data[Rmi4->Offset] : 0;
+		FakeRmi4Advance(Rmi4, Register);
+	}
+
+	*BytesRead = Length;
+
+	pthread_mutex_unlock(&Rmi4->Lock);
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+FakeRmi4Initialize(
+	FAKE_RMI4* Rmi4
+)
+{
+	ULONG i;
+
+	memset(Rmi4, 0, sizeof(*Rmi4));
+	pthread_mutex_init(&Rmi4->Lock, NULL);
+
+	for (i = 0; i < FAKE_RMI4_PAGES; i++) {
+		Rmi4->TableAddress[i] = FAKE_RMI4_FIRST_FUNCTION;
+	}
+}
+
+VOID
+FakeRmi4Cleanup(
+	FAKE_RMI4* Rmi4
+)
+{
+	pthread_mutex_destroy(&Rmi4->Lock);
+}
+
+VOID
+FakeRmi4Connect(
+	FAKE_RMI4* Rmi4,
+	WDFIOTARGET IoTarget
+)
+{
+	SHIM_BUS_DEVICE Device;
+
+	Device.Write = FakeRmi4Write;
+	Device.Read = FakeRmi4Read;
+	Device.Sequence = FakeRmi4Sequence;
+	Device.Context = Rmi4;
+
+	ShimIoTargetConnect(IoTarget, &Device);
+}
+
+VOID
+FakeRmi4SetRegister(
+	FAKE_RMI4* Rmi4,
+	UINT8 Page,
+	UINT8 Address,
+	UINT8 Value
+)
+{
+	FAKE_RMI4_REGISTER* Register = &Rmi4->Registers[Page][Address];
+
+	Register->Length = 0;
+	Register->Data[0] = Value;
+}
+
+VOID
+FakeRmi4SetPacket(
+	FAKE_RMI4* Rmi4,
+	UINT8 Page,
+	UINT8 Address,
+	const VOID* Data,
+	ULONG Length
+)
+{
+	FAKE_RMI4_REGISTER* Register = &Rmi4->Registers[Page][Address];
+
+	Register->Length = Length;
+	memset(Register->Data, 0, sizeof(Register->Data));
+
+	if (Data != NULL) {
+		memcpy(Register->Data, Data, Length);
+	}
+}
+
+VOID
+FakeRmi4AddFunction(
+	FAKE_RMI4* Rmi4,
+	UINT8 Page,
+	UINT8 Number,
+	UINT8 QueryBase,
+	UINT8 ControlBase,
+	UINT8 DataBase,
+	UINT8 IrqCount
+)
+{
+	const UINT8 Entry[FAKE_RMI4_FUNCTION_SIZE] = {
+		QueryBase, 0, ControlBase, DataBase, IrqCount & 0x7, Number
+	};
+	UINT8 Address = Rmi4->TableAddress[Page];
+	ULONG i;
+
+	for (i = 0; i < FAKE_RMI4_FUNCTION_SIZE; i++) {
+		FakeRmi4SetRegister(Rmi4, Page, (UINT8)(Address + i), Entry[i]);
+	}
+
+	Rmi4->TableAddress[Page] = (UINT8)(Address - FAKE_RMI4_FUNCTION_SIZE);
+}
+
+VOID
+FakeRmi4SetSequenceStatus(
+	FAKE_RMI4* Rmi4,
+	NTSTATUS Status
+)
+{
+	pthread_mutex_lock(&Rmi4->Lock);
+	Rmi4->SequenceStatus = Status;
+	pthread_mutex_unlock(&Rmi4->Lock);
+}
+
+VOID
+FakeRmi4ClearLog(
+	FAKE_RMI4* Rmi4
+)
+{
+	pthread_mutex_lock(&Rmi4->Lock);
+	Rmi4->TransferCount = 0;
+	Rmi4->BytesRead = 0;
+	Rmi4->PageSelects = 0;
+	Rmi4->Transactions = 0;
+	Rmi4->Sequences = 0;
+	Rmi4->SequencesRejected = 0;
+	pthread_mutex_unlock(&Rmi4->Lock);
+}
+
+ULONG
+FakeRmi4ReadsOf(
+	FAKE_RMI4* Rmi4,
+	UINT8 Page,
+	UINT8 Address,
+	ULONG* Bytes
+)
+{
+	ULONG Count = 0;
+	ULONG i;
+
+	if (Bytes != NULL) {
+		*Bytes = 0;
+	}
+
+	for (i = 0; i < Rmi4->TransferCount; i++) {
+		if (Rmi4->Transfers[i].Write ||
+			Rmi4->Transfers[i].Page != Page ||
+			Rmi4->Transfers[i].Address != Address) {
+			continue;
+		}
+
+		Count++;
+
+		if (Bytes != NULL) {
+			*Bytes += Rmi4->Transfers[i].Length;
+		}
+	}
+
+	return Count;
+}
+
+ULONG
+FakeRmi4Reads(
+	FAKE_RMI4* Rmi4
+)
+{
+	ULONG Count = 0;
+	ULONG i;
+
+	for (i = 0; i < Rmi4->TransferCount; i++) {
+		if (!Rmi4->Transfers[i].Write) {
+			Count++;
+		}
+	}
+
+	return Count;
+}
+
+ULONG
+FakeRmi4Transactions(
+	FAKE_RMI4* Rmi4
+)
+{
+	return Rmi4->Transactions;
+}
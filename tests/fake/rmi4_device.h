@@ -0,0 +1,176 @@
+/*++
+	Module Name:
+
+		rmi4_device.h
+
+	Abstract:
+
+		An RMI4 controller at the level of the bytes on the bus. Every
+		register address holds either one byte or a packet register of
+		several; a block read streams all bytes of one register before it
+		moves on to the next address, the way F12 data and the register
+		descriptors are laid out. The page is selected through 0xFF.
+
+		Every transfer is logged with the page and register it started
+		on, so tests can tell which registers the driver read and how
+		much of them. Bus transactions are counted apart from that, a
+		sequence takes one however many transfers it has, and sequences
+		can be rejected like on a controller that does not support them.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include <pthread.h>
+
+#define FAKE_RMI4_PAGES 2
+#define FAKE_RMI4_PAGE_SELECT 0xFF
+#define FAKE_RMI4_MAX_PACKET 128
+#define FAKE_RMI4_MAX_TRANSFERS 512
+
+typedef struct _FAKE_RMI4_REGISTER
+{
+	//
+	// 0 for a plain register of one byte
+	//
+	ULONG Length;
+	UINT8 Data[FAKE_RMI4_MAX_PACKET];
+} FAKE_RMI4_REGISTER;
+
+typedef struct _FAKE_RMI4_TRANSFER
+{
+	BOOLEAN Write;
+	UINT8 Page;
+	UINT8 Address;
+	ULONG Length;
+} FAKE_RMI4_TRANSFER;
+
+typedef struct _FAKE_RMI4
+{
+	pthread_mutex_t Lock;
+
+	//
+	// Pages past FAKE_RMI4_PAGES read as zero, which ends the page
+	// description table there
+	//
+	FAKE_RMI4_REGISTER Registers[FAKE_RMI4_PAGES][256];
+	UINT8 TableAddress[FAKE_RMI4_PAGES];
+	UINT8 Page;
+	UINT8 Address;
+	ULONG Offset;
+
+	FAKE_RMI4_TRANSFER Transfers[FAKE_RMI4_MAX_TRANSFERS];
+	ULONG TransferCount;
+	ULONG BytesRead;
+	ULONG PageSelects;
+
+	//
+	// Transfers left of the sequence on the bus
+	//
+	ULONG SequenceTransfers;
+	NTSTATUS SequenceStatus;
+	ULONG Transactions;
+	ULONG Sequences;
+	ULONG SequencesRejected;
+} FAKE_RMI4;
+
+VOID
+FakeRmi4Initialize(
+	FAKE_RMI4* Rmi4
+);
+
+VOID
+FakeRmi4Cleanup(
+	FAKE_RMI4* Rmi4
+);
+
+VOID
+FakeRmi4Connect(
+	FAKE_RMI4* Rmi4,
+	WDFIOTARGET IoTarget
+);
+
+//
+// Sets a plain register
+//
+VOID
+FakeRmi4SetRegister(
+	FAKE_RMI4* Rmi4,
+	UINT8 Page,
+	UINT8 Address,
+	UINT8 Value
+);
+
+//
+// Makes Address a packet register holding Length bytes
+//
+VOID
+FakeRmi4SetPacket(
+	FAKE_RMI4* Rmi4,
+	UINT8 Page,
+	UINT8 Address,
+	const VOID* Data,
+	ULONG Length
+);
+
+//
+// Adds an entry to the page description table of a page. Entries are
+// placed from 0xE9 down in the order they are added.
+//
+VOID
+FakeRmi4AddFunction(
+	FAKE_RMI4* Rmi4,
+	UINT8 Page,
+	UINT8 Number,
+	UINT8 QueryBase,
+	UINT8 ControlBase,
+	UINT8 DataBase,
+	UINT8 IrqCount
+);
+
+//
+// Sequences fail with Status from here on, STATUS_SUCCESS executes them
+// again
+//
+VOID
+FakeRmi4SetSequenceStatus(
+	FAKE_RMI4* Rmi4,
+	NTSTATUS Status
+);
+
+VOID
+FakeRmi4ClearLog(
+	FAKE_RMI4* Rmi4
+);
+
+//
+// Reads logged since the last FakeRmi4ClearLog that started on the
+// register, and the bytes they returned
+//
+ULONG
+FakeRmi4ReadsOf(
+	FAKE_RMI4* Rmi4,
+	UINT8 Page,
+	UINT8 Address,
+	ULONG* Bytes
+);
+
+ULONG
+FakeRmi4Reads(
+	FAKE_RMI4* Rmi4
+);
+
+//
+// Bus transactions since the last FakeRmi4ClearLog, page selects and
+// address pointer writes included
+//
+ULONG
+FakeRmi4Transactions(
+	FAKE_RMI4* Rmi4
+);
@@ -0,0 +1,1026 @@
+/*++
+	Module Name:
+
+		tcm_device.c
+
+	Abstract:
+
+		A TCM touch controller at the level of the bytes on the bus.
+
+		Every read while no message is in progress returns a 4 byte
+		header (marker, code, length), IDLE if nothing is ready. After a
+		header with a payload the next read returns the payload behind a
+		continued read marker and code, followed by the padding byte.
+		Writes carry the command byte, the payload length and the
+		payload.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "tcm_device.h"
+
+static ULONG64
+FakeTcmNow(
+	VOID
+)
+{
+	return KeQueryInterruptTime();
+}
+
+static VOID
+FakeTcmBusEnter(
+	FAKE_TCM* Tcm
+)
+{
+	if (InterlockedIncrement(&Tcm->OnBus) != 1) {
+		__atomic_add_fetch(&Tcm->BusOverlaps, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static VOID
+FakeTcmBusLeave(
+	FAKE_TCM* Tcm
+)
+{
+	InterlockedDecrement(&Tcm->OnBus);
+}
+
+static VOID
+FakeTcmRemove(
+	FAKE_TCM* Tcm,
+	ULONG Index
+)
+{
+	free(Tcm->Queue[Index].Payload);
+
+	memmove(&Tcm->Queue[Index],
+		&Tcm->Queue[Index + 1],
+		(Tcm->Count - Index - 1) * sizeof(Tcm->Queue[0]));
+
+	Tcm->Count--;
+}
+
+static LONG
+FakeTcmFirstReady(
+	FAKE_TCM* Tcm,
+	ULONG64 Now
+)
+{
+	ULONG i;
+
+	for (i = 0; i < Tcm->Count; i++) {
+		if (Tcm->Queue[i].ReadyAt <= Now) {
+			return (LONG)i;
+		}
+	}
+
+	return -1;
+}
+
+//
+// Time from now to the scan that sees a touch queued now, in
+// KeQueryInterruptTime units
+//
+static ULONG64
+FakeTcmScanDelay(
+	FAKE_TCM* Tcm
+)
+{
+	ULONG64 Now = FakeTcmNow();
+	ULONG64 Interval = (ULONG64)Tcm->ActiveScanUs * 10;
+	ULONG64 ScanAt;
+
+	if (Interval == 0) {
+		return 0;
+	}
+
+	if (Tcm->DozeScanUs != 0 &&
+		Tcm->DynamicConfig[DC_NO_DOZE] == 0 &&
+		Now >= Tcm->LastScanAt + (ULONG64)Tcm->DozeHoldoffUs * 10) {
+		Interval = (ULONG64)Tcm->DozeScanUs * 10;
+	}
+
+	//
+	// Scans run on a fixed grid, and frames come out in order
+	//
+	ScanAt = (Now / Interval + 1) * Interval;
+	if (ScanAt < Tcm->LastScanAt) {
+		ScanAt = Tcm->LastScanAt;
+	}
+
+	Tcm->LastScanAt = ScanAt;
+
+	return ScanAt - Now;
+}
+
+static VOID
+FakeTcmQueueLocked(
+	FAKE_TCM* Tcm,
+	UINT8 Code,
+	const VOID* Payload,
+	ULONG Length,
+	ULONG DelayUs
+)
+{
+	FAKE_TCM_MESSAGE* Message;
+
+	if (Tcm->Count == FAKE_TCM_QUEUE_SIZE) {
+		Tcm->Dropped++;
+		return;
+	}
+
+	Message = &Tcm->Queue[Tcm->Count++];
+	Message->Code = Code;
+	Message->Length = (UINT16)Length;
+	Message->ReadyAt = FakeTcmNow() + (ULONG64)DelayUs * 10;
+	Message->Payload = NULL;
+
+	if (Code == TCM_REPORT_TOUCH) {
+		Message->ReadyAt += FakeTcmScanDelay(Tcm);
+	}
+
+	if (Length != 0) {
+		Message->Payload = malloc(Length);
+		memcpy(Message->Payload, Payload, Length);
+	}
+
+	if (Code < TCM_REPORT_IDENTIFY) {
+		Tcm->ResponsesPending++;
+	}
+
+	pthread_cond_broadcast(&Tcm->Changed);
+}
+
+VOID
+FakeTcmQueue(
+	FAKE_TCM* Tcm,
+	UINT8 Code,
+	const VOID* Payload,
+	ULONG Length,
+	ULONG DelayUs
+)
+{
+	pthread_mutex_lock(&Tcm->Lock);
+	FakeTcmQueueLocked(Tcm, Code, Payload, Length, DelayUs);
+	pthread_mutex_unlock(&Tcm->Lock);
+}
+
+VOID
+FakeTcmRespond(
+	FAKE_TCM* Tcm,
+	UINT8 Code,
+	const VOID* Payload,
+	ULONG Length
+)
+{
+	pthread_mutex_lock(&Tcm->Lock);
+	FakeTcmQueueLocked(Tcm, Code, Payload, Length, Tcm->ResponseDelayUs);
+	pthread_mutex_unlock(&Tcm->Lock);
+}
+
+VOID
+FakeTcmQueueIdentify(
+	FAKE_TCM* Tcm
+)
+{
+	FakeTcmQueue(Tcm, TCM_REPORT_IDENTIFY, &Tcm->IdInfo, sizeof(Tcm->IdInfo), 0);
+}
+
+//
+// What a reset does to the controller, short of announcing it
+//
+static VOID
+FakeTcmRestartLocked(
+	FAKE_TCM* Tcm
+)
+{
+	Tcm->DeepSleep = FALSE;
+
+	if (Tcm->RomBoot) {
+		Tcm->IdInfo.Mode = MODE_ROMBOOTLOADER;
+		memset(Tcm->ProgramRam, 0, sizeof(Tcm->ProgramRam));
+	}
+}
+
+VOID
+FakeTcmReset(
+	FAKE_TCM* Tcm
+)
+{
+	pthread_mutex_lock(&Tcm->Lock);
+	FakeTcmRestartLocked(Tcm);
+	FakeTcmQueueLocked(Tcm, TCM_REPORT_IDENTIFY, &Tcm->IdInfo, sizeof(Tcm->IdInfo), 0);
+	pthread_mutex_unlock(&Tcm->Lock);
+}
+
+VOID
+FakeTcmSetRomBoot(
+	FAKE_TCM* Tcm,
+	UINT8 WriteBlockSizeWords,
+	UINT16 MaxWritePayloadSize
+)
+{
+	pthread_mutex_lock(&Tcm->Lock);
+	Tcm->RomBoot = TRUE;
+	Tcm->RomBootInfo.PacketVersion = 1;
+	Tcm->RomBootInfo.ASICID = 0x7a01;
+	Tcm->RomBootInfo.WriteBlockSizeWords = WriteBlockSizeWords;
+	Tcm->RomBootInfo.MaxWritePayloadSize = MaxWritePayloadSize;
+	FakeTcmRestartLocked(Tcm);
+	pthread_mutex_unlock(&Tcm->Lock);
+}
+
+VOID
+FakeTcmSetFlash(
+	FAKE_TCM* Tcm,
+	UINT8 WriteBlockSizeWords,
+	UINT16 ErasePageSizeWords,
+	UINT16 MaxWritePayloadSize
+)
+{
+	NT_ASSERT(ErasePageSizeWords * 2 * FAKE_TCM_FLASH_PAGES >= FAKE_TCM_FLASH_SIZE);
+
+	pthread_mutex_lock(&Tcm->Lock);
+	Tcm->HasFlash = TRUE;
+	Tcm->BootInfo.PacketVersion = 1;
+	Tcm->BootInfo.ASICID = 0x7a02;
+	Tcm->BootInfo.WriteBlockSizeWords = WriteBlockSizeWords;
+	Tcm->BootInfo.ErasePageSizeWords = ErasePageSizeWords;
+	Tcm->BootInfo.MaxWritePayloadSize = MaxWritePayloadSize;
+	memset(Tcm->Flash, 0xff, sizeof(Tcm->Flash));
+	pthread_mutex_unlock(&Tcm->Lock);
+}
+
+//
+// Report payloads are packed LSB first, as TcmParseSingleByte reads them
+//
+static VOID
+FakeTcmPutBits(
+	UINT8* Payload,
+	ULONG* BitOffset,
+	ULONG Bits,
+	UINT32 Value
+)
+{
+	ULONG i;
+
+	for (i = 0; i < Bits; i++, (*BitOffset)++) {
+		if (i < 32 && (Value >> i) & 1) {
+			Payload[*BitOffset / 8] |= (UINT8)(1 << (*BitOffset % 8));
+		}
+	}
+}
+
+static UINT32
+FakeTcmObjectField(
+	const FAKE_TCM_OBJECT* Object,
+	UINT8 Code
+)
+{
+	if (Object == NULL) {
+		return 0;
+	}
+
+	switch (Code) {
+	case TOUCH_OBJECT_N_INDEX:
+		return Object->Index;
+	case TOUCH_OBJECT_N_CLASSIFICATION:
+		return Object->Classification;
+	case TOUCH_OBJECT_N_X_POSITION:
+		return Object->X;
+	case TOUCH_OBJECT_N_Y_POSITION:
+		return Object->Y;
+	default:
+		return 0;
+	}
+}
+
+static VOID
+FakeTcmQueueReport(
+	FAKE_TCM* Tcm,
+	const FAKE_TCM_OBJECT* Objects,
+	ULONG Count,
+	UINT8 Gesture,
+	const UINT8* Info,
+	ULONG InfoLength
+)
+{
+	UINT8 Payload[256] = { 0 };
+	const FAKE_TCM_OBJECT* Object = NULL;
+	ULONG Bits = 0, Index = 0, Next = 0, Slot = 0, Width, i;
+	BOOLEAN ActiveOnly = FALSE;
+	UINT8 Code;
+
+	pthread_mutex_lock(&Tcm->Lock);
+
+	while (Index < Tcm->ReportConfigLength) {
+		Code = Tcm->ReportConfig[Index++];
+
+		switch (Code) {
+		case TOUCH_END:
+			goto done;
+
+		case TOUCH_FOREACH_ACTIVE_OBJECT:
+		case TOUCH_FOREACH_OBJECT:
+			ActiveOnly = Code == TOUCH_FOREACH_ACTIVE_OBJECT;
+			Next = Index;
+			Slot = 0;
+
+			//
+			// The driver stops parsing at an empty active object list
+			//
+			if (ActiveOnly && Count == 0) {
+				goto done;
+			}
+			break;
+
+		case TOUCH_FOREACH_END:
+			Slot++;
+			if ((ActiveOnly && Slot < Count) || (!ActiveOnly && Slot < MAX_FINGER)) {
+				Index = Next;
+			}
+			break;
+
+		case TOUCH_PAD_TO_NEXT_BYTE:
+			Bits = ALIGN_UP_BY(Bits, 8);
+			break;
+
+		case TOUCH_NUM_OF_ACTIVE_OBJECTS:
+			FakeTcmPutBits(Payload, &Bits, Tcm->ReportConfig[Index++], Count);
+			break;
+
+		case TOUCH_CUSTOMER_GESTURE_DETECTED:
+			FakeTcmPutBits(Payload, &Bits, Tcm->ReportConfig[Index++], Gesture);
+			break;
+
+		//
+		// Gesture info is a byte string, unused bytes are zero
+		//
+		case TOUCH_CUSTOMER_GESTURE_INFO:
+			Width = Tcm->ReportConfig[Index++];
+			for (i = 0; i < Width / 8; i++) {
+				FakeTcmPutBits(Payload, &Bits, 8, i < InfoLength ? Info[i] : 0);
+			}
+			break;
+
+		default:
+			if (ActiveOnly) {
+				Object = &Objects[Slot];
+			}
+			else {
+				Object = NULL;
+				for (i = 0; i < Count; i++) {
+					if (Objects[i].Index == Slot) {
+						Object = &Objects[i];
+					}
+				}
+			}
+
+			FakeTcmPutBits(Payload,
+				&Bits,
+				Tcm->ReportConfig[Index++],
+				Code == TOUCH_OBJECT_N_INDEX && Object == NULL ? Slot : FakeTcmObjectField(Object, Code));
+			break;
+		}
+	}
+
+done:
+	FakeTcmQueueLocked(Tcm, TCM_REPORT_TOUCH, Payload, ALIGN_UP_BY(Bits, 8) / 8, 0);
+
+	pthread_mutex_unlock(&Tcm->Lock);
+}
+
+VOID
+FakeTcmQueueTouch(
+	FAKE_TCM* Tcm,
+	const FAKE_TCM_OBJECT* Objects,
+	ULONG Count
+)
+{
+	FakeTcmQueueReport(Tcm, Objects, Count, DETECT_NORMAL_TOUCH, NULL, 0);
+}
+
+VOID
+FakeTcmQueueGesture(
+	FAKE_TCM* Tcm,
+	UINT8 Detected,
+	const UINT8* Info,
+	ULONG InfoLength
+)
+{
+	FakeTcmQueueReport(Tcm, NULL, 0, Detected, Info, InfoLength);
+}
+
+//
+// Program RAM write in the ROM bootloader: a block number followed by
+// the data
+//
+static VOID
+FakeTcmWriteProgramRam(
+	FAKE_TCM* Tcm,
+	const UINT8* Payload,
+	ULONG Length
+)
+{
+	ULONG BlockSize = Tcm->RomBootInfo.WriteBlockSizeWords * 2;
+	ULONG Address, DataLength;
+
+	if (Length <= 2 || BlockSize == 0) {
+		Tcm->ProgramRamRejected++;
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+		return;
+	}
+
+	Address = (ULONG)(Payload[0] | (Payload[1] << 8)) * BlockSize;
+	DataLength = Length - 2;
+
+	if (DataLength > Tcm->RomBootInfo.MaxWritePayloadSize ||
+		Address + DataLength > sizeof(Tcm->ProgramRam)) {
+		Tcm->ProgramRamRejected++;
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+		return;
+	}
+
+	if (DataLength % BlockSize != 0) {
+		Tcm->ProgramRamPartialBlocks++;
+	}
+
+	memcpy(Tcm->ProgramRam + Address, Payload + 2, DataLength);
+	Tcm->ProgramRamWrites++;
+	Tcm->ProgramRamMaxPayload = max(Tcm->ProgramRamMaxPayload, DataLength);
+
+	FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, NULL, 0, Tcm->ResponseDelayUs);
+}
+
+//
+// The commands a ROM bootloader takes, everything else is an error
+//
+static BOOLEAN
+FakeTcmRomBootCommand(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length
+)
+{
+	switch (Command) {
+	case CMD_IDENTIFY:
+	case CMD_RESET:
+		return FALSE;
+
+	case CMD_GET_ROMBOOT_INFO:
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, &Tcm->RomBootInfo, sizeof(Tcm->RomBootInfo), Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_WRITE_PROGRAM_RAM:
+		FakeTcmWriteProgramRam(Tcm, Payload, Length);
+		break;
+
+	case CMD_ROMBOOT_RUN_BOOTLOADER_FIRMWARE:
+		Tcm->IdInfo.Mode = MODE_HOSTDOWNLOAD_FIRMWARE;
+		FakeTcmQueueLocked(Tcm, TCM_REPORT_IDENTIFY, &Tcm->IdInfo, sizeof(Tcm->IdInfo), Tcm->ResponseDelayUs);
+		break;
+
+	default:
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+		break;
+	}
+
+	return TRUE;
+}
+
+//
+// Flash erase in the bootloader: the first page and the page count,
+// as bytes or, if either does not fit, as 16 bit values
+//
+static VOID
+FakeTcmEraseFlash(
+	FAKE_TCM* Tcm,
+	const UINT8* Payload,
+	ULONG Length
+)
+{
+	ULONG PageSize = Tcm->BootInfo.ErasePageSizeWords * 2;
+	ULONG Page, Pages, i;
+
+	if (Length == 2) {
+		Page = Payload[0];
+		Pages = Payload[1];
+	}
+	else if (Length == 4) {
+		Page = (ULONG)(Payload[0] | (Payload[1] << 8));
+		Pages = (ULONG)(Payload[2] | (Payload[3] << 8));
+	}
+	else {
+		Page = Pages = 0;
+	}
+
+	if (Pages == 0 || (Page + Pages) * PageSize > sizeof(Tcm->Flash)) {
+		Tcm->FlashRejected++;
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+		return;
+	}
+
+	memset(Tcm->Flash + Page * PageSize, 0xff, Pages * PageSize);
+
+	for (i = Page; i < Page + Pages; i++) {
+		Tcm->FlashErases[i]++;
+	}
+
+	Tcm->FlashEraseCommands++;
+	FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, NULL, 0, Tcm->ResponseDelayUs);
+}
+
+//
+// Flash write in the bootloader: a block number followed by the data
+//
+static VOID
+FakeTcmWriteFlash(
+	FAKE_TCM* Tcm,
+	const UINT8* Payload,
+	ULONG Length
+)
+{
+	ULONG BlockSize = Tcm->BootInfo.WriteBlockSizeWords * 2;
+	ULONG Address, DataLength, i;
+
+	if (Length <= 2) {
+		Tcm->FlashRejected++;
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+		return;
+	}
+
+	Address = (ULONG)(Payload[0] | (Payload[1] << 8)) * BlockSize;
+	DataLength = Length - 2;
+
+	if (DataLength > Tcm->BootInfo.MaxWritePayloadSize ||
+		Address + DataLength > sizeof(Tcm->Flash)) {
+		Tcm->FlashRejected++;
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+		return;
+	}
+
+	for (i = 0; i < DataLength; i++) {
+		if (Tcm->FlashFault && Address + i == Tcm->FlashFaultAddress) {
+			continue;
+		}
+
+		Tcm->Flash[Address + i] &= Payload[2 + i];
+	}
+
+	Tcm->FlashWrites++;
+	Tcm->FlashBytesWritten += DataLength;
+	FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, NULL, 0, Tcm->ResponseDelayUs);
+}
+
+//
+// Flash read in the bootloader: a word address and a word count
+//
+static VOID
+FakeTcmReadFlash(
+	FAKE_TCM* Tcm,
+	const UINT8* Payload,
+	ULONG Length
+)
+{
+	ULONG Address, DataLength;
+
+	if (Length < 6) {
+		Tcm->FlashRejected++;
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+		return;
+	}
+
+	Address = (Payload[0] | (Payload[1] << 8) | (Payload[2] << 16) | ((ULONG)Payload[3] << 24)) * 2;
+	DataLength = (ULONG)(Payload[4] | (Payload[5] << 8)) * 2;
+
+	if (Address >= sizeof(Tcm->Flash) || DataLength > sizeof(Tcm->Flash) - Address) {
+		Tcm->FlashRejected++;
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+		return;
+	}
+
+	Tcm->FlashReads++;
+	FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, Tcm->Flash + Address, DataLength, Tcm->ResponseDelayUs);
+}
+
+//
+// The commands the flash bootloader takes, everything else is an error
+//
+static BOOLEAN
+FakeTcmBootloaderCommand(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length
+)
+{
+	switch (Command) {
+	case CMD_IDENTIFY:
+	case CMD_RESET:
+	case CMD_RUN_BOOTLOADER_FIRMWARE:
+		return FALSE;
+
+	case CMD_GET_BOOT_INFO:
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, &Tcm->BootInfo, sizeof(Tcm->BootInfo), Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_ERASE_FLASH:
+		FakeTcmEraseFlash(Tcm, Payload, Length);
+		break;
+
+	case CMD_WRITE_FLASH:
+		FakeTcmWriteFlash(Tcm, Payload, Length);
+		break;
+
+	case CMD_READ_FLASH:
+		FakeTcmReadFlash(Tcm, Payload, Length);
+		break;
+
+	case CMD_RUN_APPLICATION_FIRMWARE:
+		Tcm->IdInfo.Mode = MODE_APPLICATION_FIRMWARE;
+		FakeTcmQueueLocked(Tcm, TCM_REPORT_IDENTIFY, &Tcm->IdInfo, sizeof(Tcm->IdInfo), Tcm->ResponseDelayUs);
+		break;
+
+	default:
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+		break;
+	}
+
+	return TRUE;
+}
+
+static VOID
+FakeTcmCommand(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length
+)
+{
+	UINT8 Value[2];
+
+	if (Tcm->RomBoot && Tcm->IdInfo.Mode == MODE_ROMBOOTLOADER &&
+		FakeTcmRomBootCommand(Tcm, Command, Payload, Length)) {
+		return;
+	}
+
+	if (Tcm->HasFlash && Tcm->IdInfo.Mode == MODE_BOOTLOADER &&
+		FakeTcmBootloaderCommand(Tcm, Command, Payload, Length)) {
+		return;
+	}
+
+	switch (Command) {
+	case CMD_IDENTIFY:
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, &Tcm->IdInfo, sizeof(Tcm->IdInfo), Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_RESET:
+		FakeTcmRestartLocked(Tcm);
+		FakeTcmQueueLocked(Tcm, TCM_REPORT_IDENTIFY, &Tcm->IdInfo, sizeof(Tcm->IdInfo), Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_RUN_APPLICATION_FIRMWARE:
+		FakeTcmQueueLocked(Tcm, TCM_REPORT_IDENTIFY, &Tcm->IdInfo, sizeof(Tcm->IdInfo), Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_RUN_BOOTLOADER_FIRMWARE:
+		if (!Tcm->HasFlash) {
+			FakeTcmQueueLocked(Tcm, TCM_STATUS_NOT_IMPLEMENTED, NULL, 0, Tcm->ResponseDelayUs);
+			break;
+		}
+		Tcm->IdInfo.Mode = MODE_BOOTLOADER;
+		FakeTcmQueueLocked(Tcm, TCM_REPORT_IDENTIFY, &Tcm->IdInfo, sizeof(Tcm->IdInfo), Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_GET_APPLICATION_INFO:
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, &Tcm->AppInfo, sizeof(Tcm->AppInfo), Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_GET_TOUCH_REPORT_CONFIG:
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, Tcm->ReportConfig, Tcm->ReportConfigLength, Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_SET_TOUCH_REPORT_CONFIG:
+		if (Length > sizeof(Tcm->ReportConfig)) {
+			FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+			break;
+		}
+		memcpy(Tcm->ReportConfig, Payload, Length);
+		Tcm->ReportConfigLength = Length;
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, NULL, 0, Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_GET_DYNAMIC_CONFIG:
+		if (Length < 1) {
+			FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+			break;
+		}
+		Value[0] = (UINT8)Tcm->DynamicConfig[Payload[0]];
+		Value[1] = (UINT8)(Tcm->DynamicConfig[Payload[0]] >> 8);
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, Value, sizeof(Value), Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_SET_DYNAMIC_CONFIG:
+		if (Length < 3) {
+			FakeTcmQueueLocked(Tcm, TCM_STATUS_ERROR, NULL, 0, Tcm->ResponseDelayUs);
+			break;
+		}
+		Tcm->DynamicConfig[Payload[0]] = (UINT16)(Payload[1] | (Payload[2] << 8));
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, NULL, 0, Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_ENTER_DEEP_SLEEP:
+	case CMD_EXIT_DEEP_SLEEP:
+		Tcm->DeepSleep = Command == CMD_ENTER_DEEP_SLEEP;
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, NULL, 0, Tcm->ResponseDelayUs);
+		break;
+
+	case CMD_ENABLE_REPORT:
+	case CMD_DISABLE_REPORT:
+	case CMD_REZERO:
+	case CMD_COMMIT_CONFIG:
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_OK, NULL, 0, Tcm->ResponseDelayUs);
+		break;
+
+	default:
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_NOT_IMPLEMENTED, NULL, 0, Tcm->ResponseDelayUs);
+		break;
+	}
+}
+
+static NTSTATUS
+FakeTcmWrite(
+	PVOID Context,
+	const UCHAR* Data,
+	ULONG Length
+)
+{
+	FAKE_TCM* Tcm = Context;
+	ULONG PayloadLength = 0;
+	BOOLEAN Handled = FALSE;
+
+	FakeTcmBusEnter(Tcm);
+	pthread_mutex_lock(&Tcm->Lock);
+
+	Tcm->Writes++;
+
+	if (Length >= 3) {
+		PayloadLength = min((ULONG)(Data[1] | (Data[2] << 8)), Length - 3);
+	}
+
+	Tcm->Commands++;
+	Tcm->CommandCounts[Data[0]]++;
+
+	if (Tcm->ResponsesPending != 0) {
+		Tcm->CommandOverlaps++;
+	}
+
+	if (Tcm->DeepSleep &&
+		Data[0] != CMD_EXIT_DEEP_SLEEP &&
+		Data[0] != CMD_RESET) {
+		FakeTcmQueueLocked(Tcm, TCM_STATUS_NOT_EXECUTED_IN_DEEP_SLEEP, NULL, 0, Tcm->ResponseDelayUs);
+		Handled = TRUE;
+	}
+	else if (Tcm->Hook != NULL) {
+		pthread_mutex_unlock(&Tcm->Lock);
+		Handled = Tcm->Hook(Tcm, Data[0], Data + 3, PayloadLength, Tcm->HookContext);
+		pthread_mutex_lock(&Tcm->Lock);
+	}
+
+	if (!Handled) {
+		FakeTcmCommand(Tcm, Data[0], Data + 3, PayloadLength);
+	}
+
+	pthread_mutex_unlock(&Tcm->Lock);
+	FakeTcmBusLeave(Tcm);
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+FakeTcmRead(
+	PVOID Context,
+	UCHAR* Data,
+	ULONG Length,
+	ULONG* BytesRead
+)
+{
+	FAKE_TCM* Tcm = Context;
+	FAKE_TCM_MESSAGE* Message;
+	LONG Index;
+	ULONG i;
+
+	FakeTcmBusEnter(Tcm);
+	pthread_mutex_lock(&Tcm->Lock);
+
+	Tcm->Reads++;
+	Tcm->ReadBytes += Length;
+	memset(Data, 0, Length);
+
+	if (Tcm->Continued >= 0) {
+		Message = &Tcm->Queue[Tcm->Continued];
+
+		for (i = 0; i < Length; i++) {
+			if (i == 0) {
+				Data[i] = MESSAGE_MARKER;
+			}
+			else if (i == 1) {
+				Data[i] = TCM_STATUS_CONTINUED_READ;
+			}
+			else if (i - 2 < Message->Length) {
+				Data[i] = Message->Payload[i - 2];
+			}
+			else {
+				Data[i] = MESSAGE_PADDING;
+			}
+		}
+
+		FakeTcmRemove(Tcm, (ULONG)Tcm->Continued);
+		Tcm->Continued = -1;
+	}
+	else if (Length >= MESSAGE_HEADER_SIZE) {
+		Index = FakeTcmFirstReady(Tcm, FakeTcmNow());
+		Data[0] = MESSAGE_MARKER;
+
+		if (Index >= 0) {
+			Message = &Tcm->Queue[Index];
+			Data[1] = Message->Code;
+			Data[2] = (UINT8)Message->Length;
+			Data[3] = (UINT8)(Message->Length >> 8);
+
+			if (Message->Code < TCM_REPORT_IDENTIFY) {
+				Tcm->ResponsesPending--;
+			}
+
+			if (Message->Length == 0) {
+				FakeTcmRemove(Tcm, (ULONG)Index);
+			}
+			else {
+				Tcm->Continued = Index;
+			}
+		}
+		else {
+			Data[1] = TCM_STATUS_IDLE;
+		}
+	}
+
+	pthread_mutex_unlock(&Tcm->Lock);
+	FakeTcmBusLeave(Tcm);
+
+	*BytesRead = Length;
+
+	return STATUS_SUCCESS;
+}
+
+BOOLEAN
+FakeTcmWaitAttention(
+	FAKE_TCM* Tcm,
+	ULONG TimeoutUs
+)
+{
+	ULONG64 Now = FakeTcmNow();
+	ULONG64 Deadline = Now + (ULONG64)TimeoutUs * 10;
+	ULONG64 Wake;
+	struct timespec Until;
+	BOOLEAN Ready = FALSE;
+	ULONG i;
+
+	pthread_mutex_lock(&Tcm->Lock);
+
+	for (;;) {
+		Now = FakeTcmNow();
+
+		if (FakeTcmFirstReady(Tcm, Now) >= 0 || Tcm->Continued >= 0) {
+			Ready = TRUE;
+			break;
+		}
+
+		if (Now >= Deadline) {
+			break;
+		}
+
+		Wake = Deadline;
+		for (i = 0; i < Tcm->Count; i++) {
+			Wake = min(Wake, Tcm->Queue[i].ReadyAt);
+		}
+
+		//
+		// Interrupt time and CLOCK_MONOTONIC are the same clock here
+		//
+		Until.tv_sec = (time_t)(Wake / 10000000);
+		Until.tv_nsec = (long)(Wake % 10000000) * 100;
+		pthread_cond_timedwait(&Tcm->Changed, &Tcm->Lock, &Until);
+	}
+
+	pthread_mutex_unlock(&Tcm->Lock);
+
+	return Ready;
+}
+
+ULONG
+FakeTcmPending(
+	FAKE_TCM* Tcm
+)
+{
+	ULONG Count;
+
+	pthread_mutex_lock(&Tcm->Lock);
+	Count = Tcm->Count;
+	pthread_mutex_unlock(&Tcm->Lock);
+
+	return Count;
+}
+
+VOID
+FakeTcmSetHook(
+	FAKE_TCM* Tcm,
+	FAKE_TCM_COMMAND_HOOK* Hook,
+	PVOID Context
+)
+{
+	pthread_mutex_lock(&Tcm->Lock);
+	Tcm->Hook = Hook;
+	Tcm->HookContext = Context;
+	pthread_mutex_unlock(&Tcm->Lock);
+}
+
+VOID
+FakeTcmInitialize(
+	FAKE_TCM* Tcm
+)
+{
+	static const UINT8 DefaultReportConfig[] = {
+		TOUCH_TIMESTAMP, 32,
+		TOUCH_NUM_OF_ACTIVE_OBJECTS, 8,
+		TOUCH_FOREACH_ACTIVE_OBJECT,
+		TOUCH_OBJECT_N_INDEX, 4,
+		TOUCH_OBJECT_N_CLASSIFICATION, 4,
+		TOUCH_OBJECT_N_X_POSITION, 16,
+		TOUCH_OBJECT_N_Y_POSITION, 16,
+		TOUCH_OBJECT_N_Z, 8,
+		TOUCH_OBJECT_N_X_WIDTH, 8,
+		TOUCH_OBJECT_N_Y_WIDTH, 8,
+		TOUCH_FOREACH_END,
+		TOUCH_END
+	};
+	pthread_condattr_t Attributes;
+
+	memset(Tcm, 0, sizeof(*Tcm));
+
+	pthread_mutex_init(&Tcm->Lock, NULL);
+	pthread_condattr_init(&Attributes);
+	pthread_condattr_setclock(&Attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&Tcm->Changed, &Attributes);
+	pthread_condattr_destroy(&Attributes);
+
+	Tcm->Continued = -1;
+
+	Tcm->IdInfo.Version = 1;
+	Tcm->IdInfo.Mode = MODE_APPLICATION_FIRMWARE;
+	memcpy(Tcm->IdInfo.PartNumber, "FAKE-TCM", 8);
+	Tcm->IdInfo.BuildId = 0x1234;
+	Tcm->IdInfo.MaxWriteSize = 256;
+
+	Tcm->AppInfo.PacketVersion = 1;
+	Tcm->AppInfo.Status = APP_STATUS_OK;
+	Tcm->AppInfo.MaxTouchReportConfigSize = FAKE_TCM_REPORT_CONFIG_SIZE;
+	Tcm->AppInfo.MaxTouchReportPayloadSize = 128;
+	Tcm->AppInfo.MaxX = 1439;
+	Tcm->AppInfo.MaxY = 2879;
+	Tcm->AppInfo.MaxObjects = MAX_FINGER;
+	Tcm->AppInfo.NumOfImageRows = 18;
+	Tcm->AppInfo.NumOfImageCols = 36;
+
+	memcpy(Tcm->ReportConfig, DefaultReportConfig, sizeof(DefaultReportConfig));
+	Tcm->ReportConfigLength = sizeof(DefaultReportConfig);
+}
+
+VOID
+FakeTcmCleanup(
+	FAKE_TCM* Tcm
+)
+{
+	while (Tcm->Count != 0) {
+		FakeTcmRemove(Tcm, Tcm->Count - 1);
+	}
+}
+
+VOID
+FakeTcmConnect(
+	FAKE_TCM* Tcm,
+	WDFIOTARGET IoTarget
+)
+{
+	SHIM_BUS_DEVICE Device;
+
+	Device.Write = FakeTcmWrite;
+	Device.Read = FakeTcmRead;
+	Device.Sequence = NULL;
+	Device.Context = Tcm;
+
+	ShimIoTargetConnect(IoTarget, &Device);
+}
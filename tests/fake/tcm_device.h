@@ -0,0 +1,270 @@
+/*++
+	Module Name:
+
+		tcm_device.h
+
+	Abstract:
+
+		A TCM touch controller at the level of the bytes on the bus. It
+		answers the commands the driver sends during bring-up and
+		operation, queues reports, and keeps count of how the bus and the
+		command protocol were used so tests can check for overlaps.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include <pthread.h>
+#include <controller.h>
+#include <tcm/touch_tcm.h>
+
+#define FAKE_TCM_QUEUE_SIZE 1024
+#define FAKE_TCM_REPORT_CONFIG_SIZE 64
+#define FAKE_TCM_PROGRAM_RAM_SIZE (64 * 1024)
+#define FAKE_TCM_FLASH_SIZE (128 * 1024)
+#define FAKE_TCM_FLASH_PAGES 512
+
+typedef struct _FAKE_TCM FAKE_TCM;
+
+//
+// Called for every command written, before the built-in handling.
+// Returns TRUE if it queued the response itself.
+//
+typedef BOOLEAN FAKE_TCM_COMMAND_HOOK(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length,
+	PVOID Context);
+
+typedef struct _FAKE_TCM_MESSAGE
+{
+	UINT8 Code;
+	UINT16 Length;
+	ULONG64 ReadyAt;
+	UINT8* Payload;
+} FAKE_TCM_MESSAGE;
+
+typedef struct _FAKE_TCM_OBJECT
+{
+	UINT8 Index;
+	UINT8 Classification;
+	UINT16 X;
+	UINT16 Y;
+} FAKE_TCM_OBJECT;
+
+struct _FAKE_TCM
+{
+	pthread_mutex_t Lock;
+	pthread_cond_t Changed;
+
+	FAKE_TCM_MESSAGE Queue[FAKE_TCM_QUEUE_SIZE];
+	ULONG Count;
+	LONG Continued;
+
+	TCM_ID_INFO IdInfo;
+	TCM_APP_INFO AppInfo;
+	UINT8 ReportConfig[FAKE_TCM_REPORT_CONFIG_SIZE];
+	ULONG ReportConfigLength;
+	UINT16 DynamicConfig[256];
+	ULONG ResponseDelayUs;
+
+	//
+	// Entered and left through the deep sleep commands. While asleep
+	// every command but CMD_EXIT_DEEP_SLEEP and CMD_RESET is answered
+	// with TCM_STATUS_NOT_EXECUTED_IN_DEEP_SLEEP, hooks included.
+	//
+	BOOLEAN DeepSleep;
+
+	//
+	// A part without application flash, see FakeTcmSetRomBoot. Every
+	// reset puts it back in its ROM bootloader with program RAM
+	// cleared. There it takes the ROM boot commands only, program RAM
+	// writes of up to MaxWritePayloadSize bytes at block addresses.
+	// PartialBlocks counts writes that did not end on a block.
+	//
+	BOOLEAN RomBoot;
+	TCM_ROMBOOT_INFO RomBootInfo;
+	UINT8 ProgramRam[FAKE_TCM_PROGRAM_RAM_SIZE];
+	ULONG ProgramRamWrites;
+	ULONG ProgramRamMaxPayload;
+	ULONG ProgramRamPartialBlocks;
+	ULONG ProgramRamRejected;
+
+	//
+	// A part with application flash, see FakeTcmSetFlash. Its
+	// bootloader, entered through CMD_RUN_BOOTLOADER_FIRMWARE, takes
+	// the flash commands only. Erases set whole pages to 0xff and
+	// writes can only clear bits, as on the real part. FlashErases
+	// counts the erases of each page. While FlashFault is set the byte
+	// at FlashFaultAddress keeps its erased value through writes.
+	//
+	BOOLEAN HasFlash;
+	TCM_BOOT_INFO BootInfo;
+	UINT8 Flash[FAKE_TCM_FLASH_SIZE];
+	ULONG FlashErases[FAKE_TCM_FLASH_PAGES];
+	ULONG FlashEraseCommands;
+	ULONG FlashWrites;
+	ULONG FlashBytesWritten;
+	ULONG FlashReads;
+	ULONG FlashRejected;
+	BOOLEAN FlashFault;
+	ULONG FlashFaultAddress;
+
+	//
+	// Scanning, off while ActiveScanUs is 0 and touches are reported
+	// as soon as they are queued. Otherwise a touch is reported at the
+	// next scan: every ActiveScanUs, or every DozeScanUs once no touch
+	// was seen for DozeHoldoffUs and DC_NO_DOZE is clear.
+	//
+	ULONG ActiveScanUs;
+	ULONG DozeScanUs;
+	ULONG DozeHoldoffUs;
+	ULONG64 LastScanAt;
+
+	FAKE_TCM_COMMAND_HOOK* Hook;
+	PVOID HookContext;
+
+	//
+	// Traffic. An overlap on the bus is two transfers at once, a
+	// command overlap is a command written before the response to the
+	// previous one was read.
+	//
+	volatile LONG OnBus;
+	ULONG BusOverlaps;
+	ULONG Reads;
+	ULONG64 ReadBytes;
+	ULONG Writes;
+	ULONG Commands;
+	ULONG CommandOverlaps;
+	ULONG ResponsesPending;
+	ULONG Dropped;
+	ULONG CommandCounts[256];
+};
+
+VOID
+FakeTcmInitialize(
+	FAKE_TCM* Tcm
+);
+
+VOID
+FakeTcmCleanup(
+	FAKE_TCM* Tcm
+);
+
+VOID
+FakeTcmConnect(
+	FAKE_TCM* Tcm,
+	WDFIOTARGET IoTarget
+);
+
+VOID
+FakeTcmSetHook(
+	FAKE_TCM* Tcm,
+	FAKE_TCM_COMMAND_HOOK* Hook,
+	PVOID Context
+);
+
+//
+// Queues a message, visible to reads DelayUs from now. Codes below
+// TCM_REPORT_IDENTIFY are responses.
+//
+VOID
+FakeTcmQueue(
+	FAKE_TCM* Tcm,
+	UINT8 Code,
+	const VOID* Payload,
+	ULONG Length,
+	ULONG DelayUs
+);
+
+//
+// Queues a response after the configured ResponseDelayUs
+//
+VOID
+FakeTcmRespond(
+	FAKE_TCM* Tcm,
+	UINT8 Code,
+	const VOID* Payload,
+	ULONG Length
+);
+
+VOID
+FakeTcmQueueIdentify(
+	FAKE_TCM* Tcm
+);
+
+//
+// The controller resetting on its own, from ESD or a brown-out: it
+// leaves deep sleep and announces itself with an identify report
+//
+VOID
+FakeTcmReset(
+	FAKE_TCM* Tcm
+);
+
+//
+// Turns the controller into a ROM boot part, waiting in its ROM
+// bootloader from the next identify report on
+//
+VOID
+FakeTcmSetRomBoot(
+	FAKE_TCM* Tcm,
+	UINT8 WriteBlockSizeWords,
+	UINT16 MaxWritePayloadSize
+);
+
+//
+// Gives the controller application flash, erased, and a bootloader
+// with the given geometry to program it through
+//
+VOID
+FakeTcmSetFlash(
+	FAKE_TCM* Tcm,
+	UINT8 WriteBlockSizeWords,
+	UINT16 ErasePageSizeWords,
+	UINT16 MaxWritePayloadSize
+);
+
+//
+// Encodes a touch report against the report config in use
+//
+VOID
+FakeTcmQueueTouch(
+	FAKE_TCM* Tcm,
+	const FAKE_TCM_OBJECT* Objects,
+	ULONG Count
+);
+
+//
+// Encodes a report without objects carrying a customer gesture and its
+// info bytes, if the report config in use has those fields
+//
+VOID
+FakeTcmQueueGesture(
+	FAKE_TCM* Tcm,
+	UINT8 Detected,
+	const UINT8* Info,
+	ULONG InfoLength
+);
+
+//
+// Waits for the attention line, asserted while a message is ready.
+// Returns FALSE on timeout.
+//
+BOOLEAN
+FakeTcmWaitAttention(
+	FAKE_TCM* Tcm,
+	ULONG TimeoutUs
+);
+
+ULONG
+FakeTcmPending(
+	FAKE_TCM* Tcm
+);
@@ -0,0 +1,223 @@
+/*++
+	Module Name:
+
+		tcm_harness.c
+
+	Abstract:
+
+		Runs the TCM driver core against a FAKE_TCM, see tcm_harness.h
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "tcm_harness.h"
+#include <spb.h>
+#include <resolutions.h>
+#include <unistd.h>
+
+static void*
+TcmHarnessInterruptThread(
+	void* Context
+)
+{
+	TCM_HARNESS* Harness = Context;
+	ULONG Reads;
+
+	while (!Harness->Stop) {
+		if (!FakeTcmWaitAttention(&Harness->Tcm, 1000)) {
+			continue;
+		}
+
+		Reads = Harness->Tcm.Reads;
+		Harness->Interrupts++;
+
+		TcmServiceInterrupts(Harness->Controller,
+			Harness->Spb,
+			&Harness->DevContext->ReportContext);
+
+		//
+		// The line stays asserted while the driver leaves it alone,
+		// before init or after a reset, do not spin on it
+		//
+		if (Harness->Tcm.Reads == Reads) {
+			usleep(200);
+		}
+	}
+
+	return NULL;
+}
+
+VOID
+TcmHarnessInitialize(
+	TCM_HARNESS* Harness
+)
+{
+	memset(Harness, 0, sizeof(*Harness));
+	FakeTcmInitialize(&Harness->Tcm);
+}
+
+NTSTATUS
+TcmHarnessConnectInterrupt(
+	TCM_HARNESS* Harness
+)
+{
+	if (Harness->InterruptConnected) {
+		return STATUS_SUCCESS;
+	}
+
+	Harness->Stop = FALSE;
+
+	if (pthread_create(&Harness->Interrupt, NULL, TcmHarnessInterruptThread, Harness) != 0) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Harness->InterruptConnected = TRUE;
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+TcmHarnessDisconnectInterrupt(
+	TCM_HARNESS* Harness
+)
+{
+	if (!Harness->InterruptConnected) {
+		return;
+	}
+
+	InterlockedExchange(&Harness->Stop, TRUE);
+	pthread_join(Harness->Interrupt, NULL);
+	Harness->InterruptConnected = FALSE;
+}
+
+NTSTATUS
+TcmHarnessStart(
+	TCM_HARNESS* Harness,
+	BOOLEAN ConnectInterrupt,
+	ULONG TimeoutMs
+)
+{
+	WDF_OBJECT_ATTRIBUTES Attributes;
+	VOID* TouchContext = NULL;
+	ULONG Waited;
+	NTSTATUS status;
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&Attributes, DEVICE_EXTENSION);
+
+	Harness->Device = ShimObjectCreate(&Attributes, 0);
+
+	if (Harness->Device == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Harness->DevContext = GetDeviceContext(Harness->Device);
+	Harness->DevContext->FxDevice = Harness->Device;
+	Harness->Spb = &Harness->DevContext->I2CContext;
+
+	status = SpbTargetInitialize(Harness->Device, Harness->Spb);
+
+	if (!NT_SUCCESS(status)) {
+		return status;
+	}
+
+	FakeTcmConnect(&Harness->Tcm, Harness->Spb->SpbIoTarget);
+
+	TchGetScreenProperties(&Harness->DevContext->ReportContext.Props);
+
+	status = TchAllocateContext(&TouchContext, Harness->Device);
+
+	if (!NT_SUCCESS(status)) {
+		return status;
+	}
+
+	Harness->DevContext->TouchContext = TouchContext;
+	Harness->Controller = TouchContext;
+
+	//
+	// The controller announces itself after its reset
+	//
+	FakeTcmQueueIdentify(&Harness->Tcm);
+
+	status = TchStartDevice(TouchContext, Harness->Spb);
+
+	if (!NT_SUCCESS(status)) {
+		return status;
+	}
+
+	//
+	// D0 entry, before the interrupt is connected
+	//
+	status = TchWakeDevice(TouchContext, Harness->Spb);
+
+	if (!NT_SUCCESS(status)) {
+		return status;
+	}
+
+	if (ConnectInterrupt) {
+		status = TcmHarnessConnectInterrupt(Harness);
+
+		if (!NT_SUCCESS(status)) {
+			return status;
+		}
+	}
+
+	for (Waited = 0; Waited < TimeoutMs; Waited++) {
+		if (!TcmDeviceStartPending(Harness->Controller)) {
+			break;
+		}
+
+		usleep(1000);
+	}
+
+	if (Harness->Controller->DeviceStart.State != TCM_START_DONE) {
+		return STATUS_IO_TIMEOUT;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+TcmHarnessStop(
+	TCM_HARNESS* Harness
+)
+{
+	TcmHarnessDisconnectInterrupt(Harness);
+
+	if (Harness->Controller != NULL) {
+		TchStopDevice(Harness->Controller, Harness->Spb);
+		TchFreeContext(Harness->Controller);
+		Harness->Controller = NULL;
+	}
+
+	if (Harness->Spb != NULL) {
+		SpbTargetDeinitialize(Harness->Device, Harness->Spb);
+		Harness->Spb = NULL;
+	}
+
+	WdfObjectDelete(Harness->Device);
+	Harness->Device = NULL;
+
+	FakeTcmCleanup(&Harness->Tcm);
+}
+
+BOOLEAN
+TcmHarnessDrain(
+	TCM_HARNESS* Harness,
+	ULONG TimeoutMs
+)
+{
+	ULONG Waited;
+
+	for (Waited = 0; Waited < TimeoutMs; Waited++) {
+		if (FakeTcmPending(&Harness->Tcm) == 0) {
+			return TRUE;
+		}
+
+		usleep(1000);
+	}
+
+	return FALSE;
+}
@@ -0,0 +1,81 @@
+/*++
+	Module Name:
+
+		tcm_harness.h
+
+	Abstract:
+
+		Runs the TCM driver core against a FAKE_TCM the way the device
+		does: a device with a DEVICE_EXTENSION, the SPB target connected
+		to the fake, prepare hardware through TchStartDevice and an
+		interrupt thread servicing the attention line.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include "tcm_device.h"
+#include <internal.h>
+
+typedef struct _TCM_HARNESS
+{
+	FAKE_TCM Tcm;
+	WDFDEVICE Device;
+	DEVICE_EXTENSION* DevContext;
+	TCM_CONTROLLER_CONTEXT* Controller;
+	SPB_CONTEXT* Spb;
+
+	pthread_t Interrupt;
+	BOOLEAN InterruptConnected;
+	volatile LONG Stop;
+	ULONG Interrupts;
+} TCM_HARNESS;
+
+//
+// Sets up the fake with its defaults, tests adjust it before starting
+//
+VOID
+TcmHarnessInitialize(
+	TCM_HARNESS* Harness
+);
+
+//
+// Prepare hardware and D0 entry. With ConnectInterrupt the interrupt
+// thread runs from the end of TchStartDevice on, like the ISR of a
+// device whose bring-up is still going. Waits up to TimeoutMs for
+// bring-up to finish.
+//
+NTSTATUS
+TcmHarnessStart(
+	TCM_HARNESS* Harness,
+	BOOLEAN ConnectInterrupt,
+	ULONG TimeoutMs
+);
+
+NTSTATUS
+TcmHarnessConnectInterrupt(
+	TCM_HARNESS* Harness
+);
+
+VOID
+TcmHarnessDisconnectInterrupt(
+	TCM_HARNESS* Harness
+);
+
+VOID
+TcmHarnessStop(
+	TCM_HARNESS* Harness
+);
+
+//
+// Waits for the fake to have nothing left to read
+//
+BOOLEAN
+TcmHarnessDrain(
+	TCM_HARNESS* Harness,
+	ULONG TimeoutMs
+);
@@ -0,0 +1,243 @@
+/*++
+	Module Name:
+
+		fault_injection.c
+
+	Abstract:
+
+		Bus faults injected through the self-test device while the
+		controller streams touch reports. For each kind of fault the
+		driver must lose only the messages that were hit, get back in
+		sync, and report the next touch as it was sent.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "hid_sink.h"
+#include <spb.h>
+#include <selftest\selftest.h>
+#include <unistd.h>
+
+#define TOUCH_FRAMES 200
+
+static NTSTATUS
+FaultIoctl(
+	WDFFILEOBJECT File,
+	const TOUCH_TEST_FAULT_INJECTION* Injection,
+	TOUCH_TEST_FAULT_STATS* Stats
+)
+{
+	TOUCH_TEST_FAULT_INJECTION Input;
+	WDFREQUEST Request;
+	NTSTATUS status;
+
+	if (Injection != NULL) {
+		Input = *Injection;
+	}
+
+	Request = ShimRequestCreate(IOCTL_TOUCH_SELFTEST_FAULT_INJECTION,
+		Injection != NULL ? &Input : NULL,
+		Injection != NULL ? sizeof(Input) : 0,
+		Stats,
+		sizeof(*Stats));
+
+	if (Request == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	status = ShimDeviceIoControl(File, Request);
+	WdfObjectDelete(Request);
+
+	return status;
+}
+
+static WDFFILEOBJECT
+OpenSelfTest(
+	TCM_HARNESS* Harness,
+	ACCESS_MASK DesiredAccess
+)
+{
+	WDFDEVICE Device;
+	WDFFILEOBJECT File = NULL;
+
+	Device = ShimDeviceFind(&GUID_TOUCH_SELFTEST_INTERFACE);
+	CHECK(Device != NULL);
+
+	if (Device != NULL) {
+		CHECK_SUCCESS(ShimDeviceOpen(Device, ShimCallerAdministrator, DesiredAccess, &File));
+	}
+
+	return File;
+}
+
+static VOID
+TestFaultInjectionNeedsWriteAccess(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TOUCH_TEST_FAULT_INJECTION Injection = { SPB_FAULT_NAK, 0, 2, 0, 0, 0 };
+	TOUCH_TEST_FAULT_STATS Stats;
+	WDFFILEOBJECT File;
+
+	TcmHarnessInitialize(&Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+	CHECK_SUCCESS(TchSelfTestInitialize(Harness.Device));
+
+	File = OpenSelfTest(&Harness, GENERIC_READ);
+	CHECK_EQ(FaultIoctl(File, &Injection, &Stats), STATUS_ACCESS_DENIED);
+	CHECK_EQ(FaultIoctl(File, NULL, &Stats), STATUS_ACCESS_DENIED);
+	ShimDeviceClose(File);
+
+	CHECK_EQ(Harness.Spb->Fault.Config.Faults, 0);
+
+	TcmHarnessStop(&Harness);
+}
+
+static VOID
+RunFaults(
+	ULONG Faults
+)
+{
+	static TCM_HARNESS Harness;
+	TOUCH_TEST_FAULT_INJECTION Injection = { 0 };
+	TOUCH_TEST_FAULT_STATS Stats;
+	FAKE_TCM_OBJECT Object = { 0, 1, 0, 0 };
+	HID_INPUT_REPORT Report;
+	WDFFILEOBJECT File;
+	ULONG Reports, i;
+
+	TcmHarnessInitialize(&Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+	CHECK_SUCCESS(TchSelfTestInitialize(Harness.Device));
+
+	File = OpenSelfTest(&Harness, GENERIC_READ | GENERIC_WRITE);
+
+	//
+	// Every 7th transfer, so that both header and payload reads are hit
+	//
+	Injection.Faults = Faults;
+	Injection.Period = 7;
+	CHECK_SUCCESS(FaultIoctl(File, &Injection, &Stats));
+	CHECK_EQ(Stats.Injected, 0);
+	CHECK_EQ(Stats.LostMessages, 0);
+
+	FakeHidReset();
+
+	for (i = 0; i < TOUCH_FRAMES; i++) {
+		Object.X = (UINT16)(100 + i);
+		Object.Y = (UINT16)(200 + i);
+		FakeTcmQueueTouch(&Harness.Tcm, &Object, 1);
+		usleep(500);
+	}
+
+	CHECK(TcmHarnessDrain(&Harness, 2000));
+	Reports = FakeHidReports();
+
+	CHECK_SUCCESS(FaultIoctl(File, NULL, &Stats));
+
+	printf("  %lu transfers, %lu faults, %lu messages lost, %lu recoveries, max %lu us, %lu of %d touches reported\n",
+		(unsigned long)Stats.Transfers,
+		(unsigned long)Stats.Injected,
+		(unsigned long)Stats.LostMessages,
+		(unsigned long)Stats.Recoveries,
+		(unsigned long)Stats.MaxRecoveryUs,
+		(unsigned long)Reports,
+		TOUCH_FRAMES);
+
+	CHECK(Stats.Transfers >= TOUCH_FRAMES);
+	CHECK(Stats.Injected >= Stats.Transfers / 7 - 1);
+
+	//
+	// Each fault costs at most the message it hit and the one after,
+	// which starts with the continued read left behind
+	//
+	CHECK(Stats.LostMessages > 0);
+	CHECK(Stats.LostMessages <= 2 * Stats.Injected);
+	CHECK(Reports >= TOUCH_FRAMES - 2 * Stats.Injected);
+	CHECK(Stats.Recoveries > 0);
+	CHECK(Stats.MaxFramesLost <= 2);
+
+	//
+	// A read that was not acknowledged never took the message off the
+	// controller, it is read again
+	//
+	if (Faults == SPB_FAULT_NAK) {
+		CHECK_EQ(Reports, TOUCH_FRAMES);
+	}
+
+	//
+	// With injection off the next touch comes through as sent
+	//
+	memset(&Injection, 0, sizeof(Injection));
+	CHECK_SUCCESS(FaultIoctl(File, &Injection, &Stats));
+	CHECK_EQ(Stats.LostMessages, 0);
+
+	Object.X = 700;
+	Object.Y = 1400;
+	FakeTcmQueueTouch(&Harness.Tcm, &Object, 1);
+	CHECK(TcmHarnessDrain(&Harness, 1000));
+
+	CHECK_EQ(FakeHidReports(), Reports + 1);
+	CHECK(FakeHidRecent(0, &Report));
+	CHECK_EQ(Report.TouchReport.ContactCount, 1);
+	CHECK_EQ(Report.TouchReport.Contacts[0].TipSwitch, 1);
+
+	CHECK_SUCCESS(FaultIoctl(File, NULL, &Stats));
+	CHECK_EQ(Stats.Injected, 0);
+	CHECK_EQ(Stats.FramesLost, 0);
+
+	ShimDeviceClose(File);
+	TcmHarnessStop(&Harness);
+}
+
+static VOID
+TestRecoverFromNak(
+	VOID
+)
+{
+	RunFaults(SPB_FAULT_NAK);
+}
+
+static VOID
+TestRecoverFromTruncatedReads(
+	VOID
+)
+{
+	RunFaults(SPB_FAULT_TRUNCATE);
+}
+
+static VOID
+TestRecoverFromBadMarker(
+	VOID
+)
+{
+	RunFaults(SPB_FAULT_MARKER);
+}
+
+static VOID
+TestRecoverFromBadPadding(
+	VOID
+)
+{
+	RunFaults(SPB_FAULT_PADDING);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestFaultInjectionNeedsWriteAccess);
+	RUN(TestRecoverFromNak);
+	RUN(TestRecoverFromTruncatedReads);
+	RUN(TestRecoverFromBadMarker);
+	RUN(TestRecoverFromBadPadding);
+
+	return TestResult();
+}
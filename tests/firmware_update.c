@@ -0,0 +1,449 @@
+/*++
+	Module Name:
+
+		firmware_update.c
+
+	Abstract:
+
+		Firmware update at bring-up against a fake with application
+		flash. Only the erase pages whose CRC differs from the image are
+		erased and written, a page that does not read back as written
+		fails the update and leaves the controller in its bootloader for
+		the next start, and an image the registry records as flashed
+		onto the running build is not checked again. Also reports how
+		long bring-up takes with a full, an incremental and no update.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "registry.h"
+#include "firmware_image.h"
+
+#define IMAGE_PATH L"\\SystemRoot\\System32\\Drivers\\SynapticsTouchFw00.img"
+
+//
+// Matched against the customer config ID of the application
+//
+#define SUPPLIER 5
+
+#define BLOCK_WORDS 16
+#define PAGE_WORDS 1024
+#define PAGE_SIZE (PAGE_WORDS * 2)
+#define MAX_PAYLOAD 512
+#define MAX_WRITE_SIZE 1024
+
+//
+// Both areas end in a partial page
+//
+#define CODE_ADDRESS 0
+#define CODE_LENGTH (40 * PAGE_SIZE + 1000)
+#define CONFIG_ADDRESS (48 * PAGE_SIZE)
+#define CONFIG_LENGTH 3000
+#define IMAGE_PAGES (41 + 2)
+
+//
+// What the second revision of the image changes, one byte in each of
+// these pages
+//
+#define CHANGED_CODE_PAGE_0 3
+#define CHANGED_CODE_PAGE_1 10
+#define CHANGED_CONFIG_PAGE 1
+#define CHANGED_OFFSET 100
+
+#define RESPONSE_DELAY_US 200
+#define START_TIMEOUT_MS 5000
+
+static UINT8 Code[CODE_LENGTH];
+static UINT8 Config[CONFIG_LENGTH];
+static UINT8 Image[CODE_LENGTH + CONFIG_LENGTH + 512];
+static ULONG ImageLength;
+
+//
+// The flash of the controller, kept across bring-ups
+//
+static UINT8 Flash[FAKE_TCM_FLASH_SIZE];
+
+static VOID
+BuildAreas(
+	ULONG Revision
+)
+{
+	ULONG i;
+
+	for (i = 0; i < CODE_LENGTH; i++) {
+		Code[i] = (UINT8)(i * 7 + i / PAGE_SIZE);
+	}
+
+	for (i = 0; i < CONFIG_LENGTH; i++) {
+		Config[i] = (UINT8)(i * 13 + 1);
+	}
+
+	if (Revision != 0) {
+		Code[CHANGED_CODE_PAGE_0 * PAGE_SIZE + CHANGED_OFFSET] ^= 0x5a;
+		Code[CHANGED_CODE_PAGE_1 * PAGE_SIZE + CHANGED_OFFSET] ^= 0x5a;
+		Config[CHANGED_CONFIG_PAGE * PAGE_SIZE + CHANGED_OFFSET] ^= 0x5a;
+	}
+}
+
+//
+// Puts Revision of the image on disk
+//
+static VOID
+RegisterImage(
+	ULONG Revision
+)
+{
+	FAKE_FIRMWARE_AREA Areas[2] = {
+		{ "APP_CODE", CODE_ADDRESS, Code, CODE_LENGTH },
+		{ "APP_CONFIG", CONFIG_ADDRESS, Config, CONFIG_LENGTH },
+	};
+
+	BuildAreas(Revision);
+	ImageLength = FakeFirmwareImageBuild(Image, sizeof(Image), Areas, ARRAYSIZE(Areas));
+	CHECK(ImageLength != 0);
+	ShimFileRegister(IMAGE_PATH, Image, ImageLength);
+}
+
+//
+// Erases the flash and, unless Revision is negative, programs that
+// revision of the image into it
+//
+static VOID
+ProgramFlash(
+	LONG Revision
+)
+{
+	memset(Flash, 0xff, sizeof(Flash));
+
+	if (Revision >= 0) {
+		BuildAreas((ULONG)Revision);
+		memcpy(Flash + CODE_ADDRESS, Code, CODE_LENGTH);
+		memcpy(Flash + CONFIG_ADDRESS, Config, CONFIG_LENGTH);
+	}
+}
+
+static VOID
+Settings(
+	VOID
+)
+{
+	ShimRegistrySetDword(L"VendorCount", 1);
+	ShimRegistrySetDword(L"Vendor00", SUPPLIER);
+	ShimRegistrySetDword(L"ReprogramFw00", 1);
+}
+
+//
+// A controller in Mode with the flash as the last one left it
+//
+static VOID
+Initialize(
+	TCM_HARNESS* Harness,
+	UINT8 Mode
+)
+{
+	TcmHarnessInitialize(Harness);
+	FakeTcmSetFlash(&Harness->Tcm, BLOCK_WORDS, PAGE_WORDS, MAX_PAYLOAD);
+	memcpy(Harness->Tcm.Flash, Flash, sizeof(Flash));
+	Harness->Tcm.IdInfo.Mode = Mode;
+	Harness->Tcm.IdInfo.MaxWriteSize = MAX_WRITE_SIZE;
+	Harness->Tcm.AppInfo.CustomerConfigID.Supplier = SUPPLIER;
+	Harness->Tcm.ResponseDelayUs = RESPONSE_DELAY_US;
+}
+
+//
+// Brings the controller up and returns how long it took in
+// milliseconds
+//
+static ULONG
+Start(
+	TCM_HARNESS* Harness,
+	NTSTATUS Expected
+)
+{
+	ULONG64 Start = KeQueryInterruptTime();
+
+	CHECK_EQ(TcmHarnessStart(Harness, TRUE, START_TIMEOUT_MS), Expected);
+
+	return (ULONG)((KeQueryInterruptTime() - Start) / 10000);
+}
+
+static VOID
+Stop(
+	TCM_HARNESS* Harness
+)
+{
+	memcpy(Flash, Harness->Tcm.Flash, sizeof(Flash));
+	TcmHarnessStop(Harness);
+}
+
+static BOOLEAN
+IsChangedPage(
+	ULONG Page
+)
+{
+	return Page == CODE_ADDRESS / PAGE_SIZE + CHANGED_CODE_PAGE_0 ||
+		Page == CODE_ADDRESS / PAGE_SIZE + CHANGED_CODE_PAGE_1 ||
+		Page == CONFIG_ADDRESS / PAGE_SIZE + CHANGED_CONFIG_PAGE;
+}
+
+static BOOLEAN
+IsAreaPage(
+	ULONG Page,
+	ULONG Address,
+	ULONG Length
+)
+{
+	return Page * PAGE_SIZE >= Address && Page * PAGE_SIZE < Address + Length;
+}
+
+static BOOLEAN
+IsImagePage(
+	ULONG Page
+)
+{
+	return IsAreaPage(Page, CODE_ADDRESS, CODE_LENGTH) ||
+		IsAreaPage(Page, CONFIG_ADDRESS, CONFIG_LENGTH);
+}
+
+static ULONG
+PagesErased(
+	FAKE_TCM* Tcm
+)
+{
+	ULONG Pages = 0, i;
+
+	for (i = 0; i < FAKE_TCM_FLASH_PAGES; i++) {
+		Pages += Tcm->FlashErases[i];
+	}
+
+	return Pages;
+}
+
+//
+// The flash holds the image on disk, and the controller runs it with
+// the image recorded as flashed
+//
+static VOID
+CheckUpdated(
+	TCM_HARNESS* Harness
+)
+{
+	FAKE_TCM* Tcm = &Harness->Tcm;
+	ULONG Value;
+
+	CHECK_EQ(Tcm->FlashRejected, 0);
+	CHECK(memcmp(Tcm->Flash + CODE_ADDRESS, Code, CODE_LENGTH) == 0);
+	CHECK(memcmp(Tcm->Flash + CONFIG_ADDRESS, Config, CONFIG_LENGTH) == 0);
+
+	CHECK_EQ(Tcm->IdInfo.Mode, MODE_APPLICATION_FIRMWARE);
+	CHECK_EQ(Harness->Controller->DeviceStart.State, TCM_START_DONE);
+	CHECK_EQ(Harness->Controller->ControllerState.Init, TRUE);
+
+	CHECK(ShimRegistryGetDword(L"FirmwareImageCrc", &Value));
+	CHECK_EQ(Value, RtlComputeCrc32(0, Image, ImageLength));
+	CHECK(ShimRegistryGetDword(L"FirmwareBuildId", &Value));
+	CHECK_EQ(Value, Tcm->IdInfo.BuildId);
+}
+
+static VOID
+PrintUpdate(
+	const char* Name,
+	TCM_HARNESS* Harness,
+	ULONG Ms
+)
+{
+	printf("  %-12s %u of %u pages erased, %u writes, %u reads, bring-up %u ms\n",
+		Name,
+		PagesErased(&Harness->Tcm),
+		IMAGE_PAGES,
+		Harness->Tcm.FlashWrites,
+		Harness->Tcm.FlashReads,
+		Ms);
+}
+
+static VOID
+TestFullUpdate(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	ULONG Ms, i;
+
+	Settings();
+	ProgramFlash(-1);
+	RegisterImage(0);
+
+	Initialize(&Harness, MODE_APPLICATION_FIRMWARE);
+	Ms = Start(&Harness, STATUS_SUCCESS);
+	PrintUpdate("full", &Harness, Ms);
+
+	//
+	// Blank flash, every page of the image differs and is erased once
+	//
+	CheckUpdated(&Harness);
+
+	for (i = 0; i < FAKE_TCM_FLASH_PAGES; i++) {
+		CHECK_EQ(Harness.Tcm.FlashErases[i], IsImagePage(i) ? 1 : 0);
+	}
+
+	CHECK_EQ(Harness.Tcm.FlashBytesWritten, CODE_LENGTH + CONFIG_LENGTH);
+
+	Stop(&Harness);
+	ShimRegistryClear();
+}
+
+static VOID
+TestIncrementalUpdate(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	ULONG Ms, i;
+
+	Settings();
+	ProgramFlash(0);
+	RegisterImage(1);
+
+	Initialize(&Harness, MODE_APPLICATION_FIRMWARE);
+	Ms = Start(&Harness, STATUS_SUCCESS);
+	PrintUpdate("incremental", &Harness, Ms);
+
+	//
+	// Only the pages the new revision changed are erased and written
+	//
+	CheckUpdated(&Harness);
+
+	for (i = 0; i < FAKE_TCM_FLASH_PAGES; i++) {
+		CHECK_EQ(Harness.Tcm.FlashErases[i], IsChangedPage(i) ? 1 : 0);
+	}
+
+	CHECK_EQ(Harness.Tcm.FlashBytesWritten, 2 * PAGE_SIZE + CONFIG_LENGTH - PAGE_SIZE);
+
+	Stop(&Harness);
+	ShimRegistryClear();
+}
+
+static VOID
+TestCachedSkipsCheck(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	ULONG Ms;
+
+	Settings();
+	ProgramFlash(0);
+	RegisterImage(1);
+
+	Initialize(&Harness, MODE_APPLICATION_FIRMWARE);
+	Start(&Harness, STATUS_SUCCESS);
+	CheckUpdated(&Harness);
+	Stop(&Harness);
+
+	//
+	// The same image onto the same build, the flash is not looked at
+	//
+	Initialize(&Harness, MODE_APPLICATION_FIRMWARE);
+	Ms = Start(&Harness, STATUS_SUCCESS);
+	PrintUpdate("cached", &Harness, Ms);
+
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_RUN_BOOTLOADER_FIRMWARE], 0);
+	CHECK_EQ(Harness.Tcm.FlashReads, 0);
+	CHECK_EQ(PagesErased(&Harness.Tcm), 0);
+	CHECK_EQ(Harness.Controller->DeviceStart.State, TCM_START_DONE);
+	Stop(&Harness);
+
+	//
+	// A build the registry does not know, as after the firmware was
+	// flashed by other means. The flash is checked and found current.
+	//
+	Initialize(&Harness, MODE_APPLICATION_FIRMWARE);
+	Harness.Tcm.IdInfo.BuildId++;
+
+	Start(&Harness, STATUS_SUCCESS);
+
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_RUN_BOOTLOADER_FIRMWARE], 1);
+	CHECK_EQ(Harness.Tcm.FlashReads, IMAGE_PAGES);
+	CHECK_EQ(PagesErased(&Harness.Tcm), 0);
+	CheckUpdated(&Harness);
+
+	Stop(&Harness);
+	ShimRegistryClear();
+}
+
+static VOID
+TestVerifyFailure(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	ULONG FaultAddress = CODE_ADDRESS + CHANGED_CODE_PAGE_0 * PAGE_SIZE + CHANGED_OFFSET;
+	ULONG Value, Ms, i;
+
+	Settings();
+	ProgramFlash(0);
+	RegisterImage(1);
+
+	//
+	// The first changed page does not take the new byte
+	//
+	CHECK(Code[FaultAddress - CODE_ADDRESS] != 0xff);
+
+	Initialize(&Harness, MODE_APPLICATION_FIRMWARE);
+	Harness.Tcm.FlashFault = TRUE;
+	Harness.Tcm.FlashFaultAddress = FaultAddress;
+
+	//
+	// The update stops at the page that failed and leaves the controller
+	// in its bootloader, where bring-up cannot go on. Nothing is recorded
+	// as flashed.
+	//
+	Start(&Harness, STATUS_IO_TIMEOUT);
+
+	CHECK_EQ(Harness.Controller->DeviceStart.State, TCM_START_FAILED);
+	CHECK_EQ(Harness.Tcm.IdInfo.Mode, MODE_BOOTLOADER);
+	CHECK_EQ(Harness.Tcm.FlashErases[CODE_ADDRESS / PAGE_SIZE + CHANGED_CODE_PAGE_0], 1);
+	CHECK_EQ(PagesErased(&Harness.Tcm), 1);
+	CHECK_EQ(Harness.Tcm.Flash[FaultAddress], 0xff);
+	CHECK(!ShimRegistryGetDword(L"FirmwareImageCrc", &Value));
+
+	Stop(&Harness);
+
+	//
+	// The next start finds the controller in its bootloader and
+	// rewrites what still differs
+	//
+	Initialize(&Harness, MODE_BOOTLOADER);
+	Ms = Start(&Harness, STATUS_SUCCESS);
+	PrintUpdate("retry", &Harness, Ms);
+
+	CheckUpdated(&Harness);
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_RUN_BOOTLOADER_FIRMWARE], 0);
+
+	for (i = 0; i < FAKE_TCM_FLASH_PAGES; i++) {
+		CHECK_EQ(Harness.Tcm.FlashErases[i], IsChangedPage(i) ? 1 : 0);
+	}
+
+	Stop(&Harness);
+	ShimRegistryClear();
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestFullUpdate);
+	RUN(TestIncrementalUpdate);
+	RUN(TestCachedSkipsCheck);
+	RUN(TestVerifyFailure);
+
+	ShimFileRegister(IMAGE_PATH, NULL, 0);
+
+	return TestResult();
+}
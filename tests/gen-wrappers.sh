@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Creates headers named like the Windows include paths used by the
+# driver ("tcm\touch_tcm.h") that forward to the real header.
+#
+
+set -e
+
+out=$1
+here=$(cd "$(dirname "$0")" && pwd)
+root=$(cd "$here/.." && pwd)
+
+wrap() {
+	printf '#include "%s"\n' "$2" > "$out/$1"
+}
+
+wrap 'Cross Platform Shim\compat.h' "$root/include/Cross Platform Shim/compat.h"
+wrap 'Cross Platform Shim\bitops.h' "$root/include/Cross Platform Shim/bitops.h"
+wrap 'Cross Platform Shim\hweight.h' "$root/include/Cross Platform Shim/hweight.h"
+wrap 'selftest\selftest.h' "$root/include/selftest/selftest.h"
+wrap 'selftest\enoselftest.h' "$root/include/selftest/enoselftest.h"
+wrap 'rmi4\rmiinternal.h' "$root/include/rmi4/rmiinternal.h"
+wrap 'rmi4\rmireadplan.h' "$root/include/rmi4/rmireadplan.h"
+wrap 'rmi4\rmiregisters.h' "$root/include/rmi4/rmiregisters.h"
+wrap 'rmi4\f01\function01.h' "$root/include/rmi4/f01/function01.h"
+wrap 'rmi4\f1a\function1a.h' "$root/include/rmi4/f1a/function1a.h"
+wrap 'rmi4\f12\function12.h' "$root/include/rmi4/f12/function12.h"
+wrap 'rmi4\f12\registers.h' "$root/include/rmi4/f12/registers.h"
+wrap 'rmi4\f12\controlregisters.h' "$root/include/rmi4/f12/controlregisters.h"
+wrap 'rmi4\f12\data1\finger.h' "$root/include/rmi4/f12/data1/finger.h"
+wrap 'rmi4\f12\data6\activepen.h' "$root/include/rmi4/f12/data6/activepen.h"
+wrap 'tcm\touch_tcm.h' "$root/include/tcm/touch_tcm.h"
+wrap 'touch_power\touch_power.h' "$root/include/touch_power/touch_power.h"
+wrap '..\km\spb.h' "$here/shim/km/spb.h"
+wrap 'touch_power\public.h' "$root/include/touch_power/public.h"
@@ -0,0 +1,264 @@
+/*++
+	Module Name:
+
+		host_download.c
+
+	Abstract:
+
+		Bring-up of a controller without application flash, against a
+		fake waiting in its ROM bootloader. The firmware has to land in
+		program RAM in writes of whole blocks, each as large as the ROM
+		bootloader and the bus allow, and a reset has to download it
+		again from the image kept in memory rather than from disk. Also
+		reports the time from cold boot to the first touch.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "hid_sink.h"
+#include "firmware_image.h"
+#include <unistd.h>
+
+//
+// Where host_download.c looks for the image
+//
+#define IMAGE_PATH L"\\SystemRoot\\System32\\Drivers\\SynapticsTouchHdl.img"
+
+//
+// Block aligned, and a length that leaves the last block partial
+//
+#define CODE_ADDRESS 0x800
+#define CODE_LENGTH 20002
+
+#define REPORT_TIMEOUT_MS 500
+
+//
+// Command turnaround of the controller, so that the times reported
+// reflect how many writes a download takes
+//
+#define RESPONSE_DELAY_US 200
+
+static UINT8 Code[CODE_LENGTH];
+static UINT8 Image[CODE_LENGTH + 256];
+static UINT8 OtherImage[CODE_LENGTH + 256];
+static ULONG ImageLength;
+
+//
+// Builds the image the driver finds on disk, Pattern tells images
+// apart in program RAM
+//
+static ULONG
+BuildImage(
+	UINT8* Buffer,
+	ULONG Size,
+	UINT8 Pattern
+)
+{
+	FAKE_FIRMWARE_AREA Area = { "ROMBOOT_APP_CODE", CODE_ADDRESS, Code, CODE_LENGTH };
+	ULONG i;
+
+	for (i = 0; i < CODE_LENGTH; i++) {
+		Code[i] = (UINT8)(i * 7 + Pattern);
+	}
+
+	return FakeFirmwareImageBuild(Buffer, Size, &Area, 1);
+}
+
+static ULONG64
+FirstTouch(
+	TCM_HARNESS* Harness
+)
+{
+	FAKE_TCM_OBJECT Object = { 0, 1, 320, 640 };
+	ULONG Reports = FakeHidReports();
+	ULONG64 Start = KeQueryInterruptTime();
+	ULONG64 Us;
+	ULONG i;
+
+	FakeTcmQueueTouch(&Harness->Tcm, &Object, 1);
+
+	for (i = 0; i < REPORT_TIMEOUT_MS * 10 && FakeHidReports() == Reports; i++) {
+		usleep(100);
+	}
+
+	Us = (KeQueryInterruptTime() - Start) / 10;
+	CHECK(FakeHidReports() != Reports);
+
+	FakeTcmQueueTouch(&Harness->Tcm, NULL, 0);
+	CHECK(TcmHarnessDrain(Harness, REPORT_TIMEOUT_MS));
+
+	return Us;
+}
+
+//
+// Boots a ROM boot part and returns the time to the first touch in
+// microseconds. MaxWriteSize is what the identify report announces,
+// it bounds the bus transfers.
+//
+static ULONG64
+Boot(
+	TCM_HARNESS* Harness,
+	UINT8 BlockWords,
+	UINT16 MaxPayload,
+	UINT16 MaxWriteSize
+)
+{
+	ULONG64 Start;
+
+	ImageLength = BuildImage(Image, sizeof(Image), 3);
+	CHECK(ImageLength != 0);
+	ShimFileRegister(IMAGE_PATH, Image, ImageLength);
+
+	TcmHarnessInitialize(Harness);
+	FakeTcmSetRomBoot(&Harness->Tcm, BlockWords, MaxPayload);
+	Harness->Tcm.IdInfo.MaxWriteSize = MaxWriteSize;
+	Harness->Tcm.ResponseDelayUs = RESPONSE_DELAY_US;
+	FakeHidReset();
+
+	Start = KeQueryInterruptTime();
+	CHECK_SUCCESS(TcmHarnessStart(Harness, TRUE, 2000));
+	FirstTouch(Harness);
+
+	return (KeQueryInterruptTime() - Start) / 10;
+}
+
+//
+// The image went into program RAM in Downloads downloads, each in
+// writes of the largest whole number of blocks allowed
+//
+static VOID
+CheckDownload(
+	TCM_HARNESS* Harness,
+	ULONG Downloads
+)
+{
+	TCM_CONTROLLER_CONTEXT* Controller = Harness->Controller;
+	FAKE_TCM* Tcm = &Harness->Tcm;
+	ULONG BlockSize = Tcm->RomBootInfo.WriteBlockSizeWords * 2;
+	ULONG Payload;
+
+	Payload = MIN(Tcm->RomBootInfo.MaxWritePayloadSize, Controller->ChunkSize - 5);
+	Payload -= Payload % BlockSize;
+
+	CHECK_EQ(Tcm->ProgramRamRejected, 0);
+	CHECK_EQ(Tcm->ProgramRamMaxPayload, Payload);
+	CHECK_EQ(Tcm->ProgramRamWrites, Downloads * ceil_div(CODE_LENGTH, Payload));
+	CHECK_EQ(Tcm->ProgramRamPartialBlocks, Downloads * (CODE_LENGTH % BlockSize != 0));
+	CHECK(memcmp(Tcm->ProgramRam + CODE_ADDRESS, Code, CODE_LENGTH) == 0);
+
+	CHECK_EQ(Tcm->IdInfo.Mode, MODE_HOSTDOWNLOAD_FIRMWARE);
+	CHECK_EQ(Controller->IDInfo.Mode, MODE_HOSTDOWNLOAD_FIRMWARE);
+	CHECK_EQ(Controller->HostDownload.Downloads, Downloads);
+	CHECK_EQ(Controller->ControllerState.Init, TRUE);
+}
+
+static VOID
+PrintDownload(
+	const char* Name,
+	TCM_HARNESS* Harness,
+	ULONG64 TouchUs
+)
+{
+	printf("  %-14s %u byte blocks, %u byte payloads in %u writes, download %u ms, to first touch %llu us\n",
+		Name,
+		Harness->Tcm.RomBootInfo.WriteBlockSizeWords * 2,
+		Harness->Tcm.ProgramRamMaxPayload,
+		Harness->Tcm.ProgramRamWrites,
+		Harness->Controller->HostDownload.LastDownloadMs,
+		(unsigned long long)TouchUs);
+}
+
+static VOID
+TestColdBoot(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	ULONG64 TouchUs;
+
+	//
+	// The ROM bootloader takes less than the bus carries
+	//
+	TouchUs = Boot(&Harness, 8, 1000, 1024);
+	CheckDownload(&Harness, 1);
+	PrintDownload("cold boot", &Harness, TouchUs);
+
+	TcmHarnessStop(&Harness);
+}
+
+static VOID
+TestBusLimitsPayload(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	ULONG64 TouchUs;
+
+	//
+	// The bus carries less than the ROM bootloader takes
+	//
+	TouchUs = Boot(&Harness, 32, 4096, 256);
+	CheckDownload(&Harness, 1);
+	PrintDownload("bus limited", &Harness, TouchUs);
+
+	TcmHarnessStop(&Harness);
+}
+
+static VOID
+TestResetReusesImage(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TCM_CONTROLLER_CONTEXT* Controller;
+	ULONG64 Start, WakeUs, TouchUs;
+
+	Boot(&Harness, 8, 1000, 1024);
+	Controller = Harness.Controller;
+
+	//
+	// A different image on disk from here on, a download that went
+	// back to the disk would put it into program RAM
+	//
+	CHECK(BuildImage(OtherImage, sizeof(OtherImage), 0x55) != 0);
+	ShimFileRegister(IMAGE_PATH, OtherImage, ImageLength);
+	BuildImage(Image, sizeof(Image), 3);
+
+	//
+	// Reset while in D3, the downloaded firmware is gone
+	//
+	TcmHarnessDisconnectInterrupt(&Harness);
+	CHECK_SUCCESS(TchStandbyDevice(Controller, Harness.Spb, &Harness.DevContext->ReportContext));
+	FakeTcmReset(&Harness.Tcm);
+	CHECK_EQ(Harness.Tcm.IdInfo.Mode, MODE_ROMBOOTLOADER);
+
+	Start = KeQueryInterruptTime();
+	CHECK_SUCCESS(TchWakeDevice(Controller, Harness.Spb));
+	WakeUs = (KeQueryInterruptTime() - Start) / 10;
+	CHECK_SUCCESS(TcmHarnessConnectInterrupt(&Harness));
+
+	TouchUs = FirstTouch(&Harness);
+
+	CheckDownload(&Harness, 2);
+	PrintDownload("after reset", &Harness, WakeUs + TouchUs);
+
+	TcmHarnessStop(&Harness);
+	ShimFileRegister(IMAGE_PATH, NULL, 0);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestColdBoot);
+	RUN(TestBusLimitsPayload);
+	RUN(TestResetReusesImage);
+
+	return TestResult();
+}
@@ -0,0 +1,300 @@
+/*++
+	Module Name:
+
+		image_stream.c
+
+	Abstract:
+
+		Image streams ended by the three ways a stream request can go
+		away: stop, cancellation and device removal. Each must complete
+		the request once and free everything the stream allocated.
+
+		A stream opened through the self-test device, the way a tuning
+		application opens one, at the 240 Hz a controller reports images
+		at: every frame sent must arrive and decode to what was sent.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "image_source.h"
+#include "image_ring.h"
+#include <selftest\selftest.h>
+#include <unistd.h>
+
+#define RING_SLOTS 8
+
+//
+// A second of frames at 240 Hz. The reader is polled rather than
+// woken, so the ring is given some room
+//
+#define STREAM_RATE_HZ 240
+#define STREAM_SECONDS 1
+#define STREAM_RING_SLOTS 64
+
+static PVOID
+AllocateRing(
+	TCM_HARNESS* Harness,
+	ULONG* Length
+)
+{
+	ULONG FrameLength = Harness->Tcm.AppInfo.NumOfImageRows * Harness->Tcm.AppInfo.NumOfImageCols * sizeof(UINT16);
+	ULONG SlotSize = ALIGN_UP_BY(sizeof(TOUCH_TEST_IMAGE_FRAME) + FrameLength, 8);
+
+	*Length = sizeof(TOUCH_TEST_IMAGE_RING) + RING_SLOTS * SlotSize;
+
+	return calloc(1, *Length);
+}
+
+static WDFREQUEST
+StartStream(
+	TCM_HARNESS* Harness,
+	PVOID Ring,
+	ULONG Length,
+	BOOLEAN Compress
+)
+{
+	WDFREQUEST Request;
+
+	Request = ShimRequestCreate(IOCTL_TOUCH_SELFTEST_IMAGE_STREAM, NULL, 0, Ring, Length);
+	CHECK(Request != NULL);
+
+	CHECK_EQ(TcmImageStreamStart(Harness->Controller, Harness->Spb, Request, TCM_REPORT_DELTA, Compress),
+		STATUS_PENDING);
+	CHECK(Harness->Controller->ImageStream.Request == Request);
+
+	return Request;
+}
+
+static VOID
+TestCancelFreesStream(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	WDFREQUEST Request;
+	PVOID Ring;
+	ULONG Length;
+	LONG Outstanding;
+
+	TcmHarnessInitialize(&Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+
+	Ring = AllocateRing(&Harness, &Length);
+	Outstanding = ShimPoolOutstanding();
+
+	Request = StartStream(&Harness, Ring, Length, TRUE);
+	CHECK(Harness.Controller->ImageStream.Reference != NULL);
+
+	ShimRequestCancel(Request);
+
+	CHECK_EQ(ShimRequestWait(Request, 2000), STATUS_CANCELLED);
+	WdfWorkItemFlush(Harness.Controller->ImageStream.CancelWorkItem);
+
+	CHECK(Harness.Controller->ImageStream.Request == NULL);
+	CHECK(Harness.Controller->ImageStream.Reference == NULL);
+	CHECK_EQ(ShimPoolOutstanding(), Outstanding);
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_DISABLE_REPORT], 1);
+
+	WdfObjectDelete(Request);
+
+	//
+	// The stream can be started again
+	//
+	Request = StartStream(&Harness, Ring, Length, TRUE);
+	CHECK_SUCCESS(TcmImageStreamStop(Harness.Controller, Harness.Spb));
+	CHECK_SUCCESS(ShimRequestWait(Request, 2000));
+	CHECK_EQ(ShimPoolOutstanding(), Outstanding);
+	WdfObjectDelete(Request);
+
+	TcmHarnessStop(&Harness);
+	free(Ring);
+}
+
+static VOID
+TestCancelAfterStop(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	WDFREQUEST Request;
+	PVOID Ring;
+	ULONG Length;
+	LONG Outstanding;
+
+	TcmHarnessInitialize(&Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+
+	Ring = AllocateRing(&Harness, &Length);
+	Outstanding = ShimPoolOutstanding();
+
+	//
+	// Cancellation owns the request before the stop gets to it, the
+	// stop detaches the stream and the work item completes the request
+	//
+	Request = StartStream(&Harness, Ring, Length, TRUE);
+
+	Harness.Controller->ImageStream.CancelledRequest = Request;
+	ShimRequest(Request)->Cancelable = FALSE;
+
+	CHECK_SUCCESS(TcmImageStreamStop(Harness.Controller, Harness.Spb));
+	CHECK(!ShimRequest(Request)->Completed);
+
+	WdfWorkItemEnqueue(Harness.Controller->ImageStream.CancelWorkItem);
+	CHECK_EQ(ShimRequestWait(Request, 2000), STATUS_CANCELLED);
+	WdfWorkItemFlush(Harness.Controller->ImageStream.CancelWorkItem);
+
+	CHECK_EQ(ShimPoolOutstanding(), Outstanding);
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_DISABLE_REPORT], 1);
+
+	WdfObjectDelete(Request);
+
+	TcmHarnessStop(&Harness);
+	free(Ring);
+}
+
+static VOID
+TestRemovalFreesStream(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	WDFREQUEST Request;
+	PVOID Ring;
+	ULONG Length;
+	LONG Outstanding;
+
+	TcmHarnessInitialize(&Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+
+	Ring = AllocateRing(&Harness, &Length);
+	Outstanding = ShimPoolOutstanding();
+
+	Request = StartStream(&Harness, Ring, Length, TRUE);
+
+	TcmImageStreamDeinitialize(Harness.Controller);
+
+	CHECK_EQ(ShimRequestWait(Request, 2000), STATUS_DEVICE_REMOVED);
+	CHECK_EQ(ShimPoolOutstanding(), Outstanding);
+
+	WdfObjectDelete(Request);
+
+	TcmHarnessStop(&Harness);
+	free(Ring);
+}
+
+static VOID
+TestStream240Hz(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TOUCH_TEST_IMAGE_STREAM_CONFIG Config = { TCM_REPORT_DELTA, TOUCH_TEST_IMAGE_STREAM_COMPRESS };
+	TOUCH_TEST_IMAGE_FRAME Frame;
+	TOUCH_TEST_IMAGE_RING* Ring;
+	IMAGE_RING_READER Reader;
+	IMAGE_SOURCE Source;
+	WDFDEVICE Device;
+	WDFFILEOBJECT File = NULL;
+	WDFREQUEST Request, Stop;
+	UINT16* Samples;
+	UINT16* Expected;
+	ULONG FrameLength, SlotSize, Length, Mismatched = 0;
+	ULONG64 Deadline;
+
+	TcmHarnessInitialize(&Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+	CHECK_SUCCESS(TchSelfTestInitialize(Harness.Device));
+
+	Device = ShimDeviceFind(&GUID_TOUCH_SELFTEST_INTERFACE);
+	CHECK(Device != NULL);
+	CHECK_SUCCESS(ShimDeviceOpen(Device, ShimCallerAdministrator, GENERIC_READ | GENERIC_WRITE, &File));
+
+	FrameLength = Harness.Tcm.AppInfo.NumOfImageRows * Harness.Tcm.AppInfo.NumOfImageCols * sizeof(UINT16);
+	SlotSize = ALIGN_UP_BY(sizeof(TOUCH_TEST_IMAGE_FRAME) + FrameLength, 8);
+	Length = sizeof(TOUCH_TEST_IMAGE_RING) + STREAM_RING_SLOTS * SlotSize;
+
+	Ring = calloc(1, Length);
+	Samples = malloc(FrameLength);
+	Expected = malloc(FrameLength);
+
+	Request = ShimRequestCreate(IOCTL_TOUCH_SELFTEST_IMAGE_STREAM, &Config, sizeof(Config), Ring, Length);
+	CHECK_EQ(ShimDeviceIoControl(File, Request), STATUS_PENDING);
+	CHECK(ImageRingReaderInitialize(&Reader, Ring));
+	CHECK_EQ(Ring->SlotCount, STREAM_RING_SLOTS);
+
+	CHECK_SUCCESS(ImageSourceStart(&Source, &Harness.Tcm, TCM_REPORT_DELTA, STREAM_RATE_HZ));
+
+	Deadline = KeQueryInterruptTime() + STREAM_SECONDS * 10000000ULL;
+
+	for (;;) {
+		if (KeQueryInterruptTime() >= Deadline && Source.Running) {
+			ImageSourceStop(&Source);
+			CHECK(TcmHarnessDrain(&Harness, 1000));
+		}
+
+		if (!ImageRingRead(&Reader, Samples, &Frame)) {
+			if (!Source.Running) {
+				break;
+			}
+
+			usleep(500);
+			continue;
+		}
+
+		//
+		// Nothing is dropped here, so frame n of the ring is frame n
+		// of the source
+		//
+		ImageSourceFill(Frame.Sequence, Ring->Rows, Ring->Cols, Expected);
+
+		if (memcmp(Samples, Expected, FrameLength) != 0) {
+			Mismatched++;
+		}
+	}
+
+	CHECK(Source.Frames >= STREAM_RATE_HZ * STREAM_SECONDS / 2);
+	CHECK_EQ(Ring->WriteSequence, Source.Frames);
+	CHECK_EQ(Reader.Read, Source.Frames);
+	CHECK_EQ(Reader.Lost, 0);
+	CHECK_EQ(Reader.Skipped, 0);
+	CHECK_EQ(Reader.Corrupt, 0);
+	CHECK_EQ(Mismatched, 0);
+	CHECK_EQ(Ring->Truncated, 0);
+
+	//
+	// A slowly moving contact compresses to a small part of the image
+	//
+	CHECK(Reader.EncodedBytes < (ULONG64)Reader.Read * FrameLength / 4);
+
+	Stop = ShimRequestCreate(IOCTL_TOUCH_SELFTEST_IMAGE_STREAM_STOP, NULL, 0, NULL, 0);
+	CHECK_SUCCESS(ShimDeviceIoControl(File, Stop));
+	CHECK_SUCCESS(ShimRequestWait(Request, 2000));
+
+	WdfObjectDelete(Stop);
+	WdfObjectDelete(Request);
+	ShimDeviceClose(File);
+	ImageRingReaderCleanup(&Reader);
+	TcmHarnessStop(&Harness);
+
+	free(Ring);
+	free(Samples);
+	free(Expected);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestCancelFreesStream);
+	RUN(TestCancelAfterStop);
+	RUN(TestRemovalFreesStream);
+	RUN(TestStream240Hz);
+
+	return TestResult();
+}
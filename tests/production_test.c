@@ -0,0 +1,498 @@
+/*++
+	Module Name:
+
+		production_test.c
+
+	Abstract:
+
+		Production tests run through the self-test device on an 18 x 36
+		panel. The fake answers CMD_PRODUCTION_TEST with images laid out
+		as the firmware reports them, from a good panel and from one with
+		an open receiver, a shorted pin and an out of range transmitter,
+		and the results are checked against the limits in the registry.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "registry.h"
+#include <selftest\selftest.h>
+#include <unistd.h>
+
+#define ROWS 18
+#define COLS 36
+
+#define OPEN_RX 5
+#define SHORTED_RX 3
+#define SHORTED_TX 6
+#define HIGH_RES_PIXEL_TX 2
+#define HIGH_RES_PIXEL_RX 10
+#define BAD_TX 4
+
+typedef struct _PANEL
+{
+	UINT8 Shorts[16];
+	UINT8 Baseline[ROWS * COLS * 2];
+	UINT8 HighRes[(ROWS * COLS + COLS + ROWS) * 2];
+	UINT8 AbsRaw[(ROWS + COLS) * 4];
+} PANEL;
+
+typedef struct _PANEL_PARAMETERS
+{
+	TCM_HARNESS* Harness;
+	volatile LONG Stop;
+	ULONG Commands;
+} PANEL_PARAMETERS;
+
+static VOID
+PutSample(
+	UINT8* Data,
+	ULONG Index,
+	LONG Value
+)
+{
+	Data[Index * 2] = (UINT8)Value;
+	Data[Index * 2 + 1] = (UINT8)(Value >> 8);
+}
+
+//
+// A panel as it reads on the bench: baselines around 1800, high
+// resistance deltas within +-40 and absolute raw cap around 40000,
+// each with a fixed ripple across the electrodes
+//
+static VOID
+BuildPanel(
+	PANEL* Panel,
+	BOOLEAN Broken
+)
+{
+	ULONG Row, Col, i;
+	LONG Value;
+
+	memset(Panel, 0, sizeof(*Panel));
+
+	for (Row = 0; Row < ROWS; Row++) {
+		for (Col = 0; Col < COLS; Col++) {
+			Value = 1800 + (LONG)((Row * 7 + Col * 13) % 41) - 20;
+			if (Broken && Col == OPEN_RX) {
+				Value = 120;
+			}
+			PutSample(Panel->Baseline, Row * COLS + Col, Value);
+
+			Value = (LONG)((Row * 11 + Col * 5) % 81) - 40;
+			if (Broken && Row == HIGH_RES_PIXEL_TX && Col == HIGH_RES_PIXEL_RX) {
+				Value = -500;
+			}
+			PutSample(Panel->HighRes, Row * COLS + Col, Value);
+		}
+	}
+
+	for (i = 0; i < COLS + ROWS; i++) {
+		Value = 100 + (LONG)(i % 9) * 10;
+		if (Broken && i == COLS + BAD_TX) {
+			Value = 450;
+		}
+		PutSample(Panel->HighRes, ROWS * COLS + i, Value);
+
+		Value = 40000 + (LONG)(i % 13) * 300;
+		if (Broken && i == COLS + BAD_TX) {
+			Value = 60000;
+		}
+		Panel->AbsRaw[i * 4] = (UINT8)Value;
+		Panel->AbsRaw[i * 4 + 1] = (UINT8)(Value >> 8);
+		Panel->AbsRaw[i * 4 + 2] = (UINT8)(Value >> 16);
+		Panel->AbsRaw[i * 4 + 3] = (UINT8)(Value >> 24);
+	}
+
+	if (Broken) {
+		Panel->Shorts[0] = 1 << SHORTED_RX;
+		Panel->Shorts[8] = 1 << SHORTED_TX;
+	}
+}
+
+static BOOLEAN
+AnswerProductionTest(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length,
+	PVOID Context
+)
+{
+	PANEL* Panel = Context;
+
+	if (Command != CMD_PRODUCTION_TEST || Length < 1) {
+		return FALSE;
+	}
+
+	switch (Payload[0]) {
+		case TCM_PT_TRX_TRX_SHORTS:
+			FakeTcmRespond(Tcm, TCM_STATUS_OK, Panel->Shorts, sizeof(Panel->Shorts));
+			break;
+		case TCM_PT_FULL_RAW_CAP:
+			FakeTcmRespond(Tcm, TCM_STATUS_OK, Panel->Baseline, sizeof(Panel->Baseline));
+			break;
+		case TCM_PT_HIGH_RESISTANCE:
+			FakeTcmRespond(Tcm, TCM_STATUS_OK, Panel->HighRes, sizeof(Panel->HighRes));
+			break;
+		case TCM_PT_HYBRID_ABS_RAW:
+			FakeTcmRespond(Tcm, TCM_STATUS_OK, Panel->AbsRaw, sizeof(Panel->AbsRaw));
+			break;
+		default:
+			FakeTcmRespond(Tcm, TCM_STATUS_INVALID, NULL, 0);
+			break;
+	}
+
+	return TRUE;
+}
+
+static VOID
+SetLimits(
+	VOID
+)
+{
+	ShimRegistrySetDword(L"Vendor00IncludeShortTest", 1);
+
+	ShimRegistrySetDword(L"Vendor00IncludeBaselineMinMaxTest", 1);
+	ShimRegistrySetDword(L"Vendor00BaselineMinMaxMinPixelLimit", 1000);
+	ShimRegistrySetDword(L"Vendor00BaselineMinMaxMaxPixelLimit", 3000);
+
+	ShimRegistrySetDword(L"Vendor00IncludeHighResTest", 1);
+	ShimRegistrySetDword(L"Vendor00HighResMinImageLimit", (ULONG)-200);
+	ShimRegistrySetDword(L"Vendor00HighResMaxRxLimit", 300);
+	ShimRegistrySetDword(L"Vendor00HighResMaxTxLimit", 300);
+
+	ShimRegistrySetDword(L"Vendor00IncludeAbsSenseRawCapTest", 1);
+	ShimRegistrySetDword(L"Vendor00AbsSenseRawCapTxRxStart", 0);
+	ShimRegistrySetDword(L"Vendor00AbsSenseRawCapTxRxEnd", ROWS + COLS - 1);
+	ShimRegistrySetDword(L"Vendor00AbsSenseRawCapMinLimit", 30000);
+	ShimRegistrySetDword(L"Vendor00AbsSenseRawCapMaxLimit", 50000);
+}
+
+static NTSTATUS
+RunProductionTest(
+	WDFFILEOBJECT File,
+	ULONG Tests,
+	UINT8* Buffer,
+	ULONG Length,
+	ULONG* Written
+)
+{
+	TOUCH_TEST_PRODUCTION_TEST Input = { 0, Tests };
+	WDFREQUEST Request;
+	NTSTATUS status;
+
+	//
+	// Buffered: the input goes in at the start of the output
+	//
+	memcpy(Buffer, &Input, sizeof(Input));
+
+	Request = ShimRequestCreate(IOCTL_TOUCH_SELFTEST_PRODUCTION_TEST, Buffer, sizeof(Input), Buffer, Length);
+	if (Request == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	status = ShimDeviceIoControl(File, Request);
+	*Written = (ULONG)ShimRequest(Request)->Information;
+	WdfObjectDelete(Request);
+
+	return status;
+}
+
+static const TOUCH_TEST_PRODUCTION_ENTRY*
+FindEntry(
+	const UINT8* Buffer,
+	UINT8 Item
+)
+{
+	const TOUCH_TEST_PRODUCTION_RESULT* Result = (const TOUCH_TEST_PRODUCTION_RESULT*)Buffer;
+	const TOUCH_TEST_PRODUCTION_ENTRY* Entry = (const TOUCH_TEST_PRODUCTION_ENTRY*)(Result + 1);
+	ULONG i;
+
+	for (i = 0; i < Result->TestCount; i++) {
+		if (Entry[i].TestItem == Item) {
+			return &Entry[i];
+		}
+	}
+
+	return NULL;
+}
+
+//
+// The stored image must be the one the controller sent for the test
+//
+static BOOLEAN
+ImageMatches(
+	const UINT8* Buffer,
+	ULONG Written,
+	const TOUCH_TEST_PRODUCTION_ENTRY* Entry,
+	const VOID* Image,
+	ULONG Length
+)
+{
+	return Entry != NULL &&
+		Entry->ImageLength == Length &&
+		Entry->ImageOffset + Length <= Written &&
+		memcmp(Buffer + Entry->ImageOffset, Image, Length) == 0;
+}
+
+static WDFFILEOBJECT
+StartPanel(
+	TCM_HARNESS* Harness,
+	PANEL* Panel
+)
+{
+	WDFDEVICE Device;
+	WDFFILEOBJECT File = NULL;
+
+	SetLimits();
+
+	TcmHarnessInitialize(Harness);
+	FakeTcmSetHook(&Harness->Tcm, AnswerProductionTest, Panel);
+	CHECK_SUCCESS(TcmHarnessStart(Harness, TRUE, 2000));
+	CHECK_SUCCESS(TchSelfTestInitialize(Harness->Device));
+
+	Device = ShimDeviceFind(&GUID_TOUCH_SELFTEST_INTERFACE);
+	CHECK(Device != NULL);
+
+	if (Device != NULL) {
+		CHECK_SUCCESS(ShimDeviceOpen(Device, ShimCallerAdministrator, GENERIC_READ | GENERIC_WRITE, &File));
+	}
+
+	return File;
+}
+
+static VOID
+StopPanel(
+	TCM_HARNESS* Harness,
+	WDFFILEOBJECT File
+)
+{
+	ShimDeviceClose(File);
+	TcmHarnessStop(Harness);
+	ShimRegistryClear();
+}
+
+static VOID
+TestGoodPanelPasses(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	static PANEL Panel;
+	static UINT8 Buffer[8192];
+	const TOUCH_TEST_PRODUCTION_RESULT* Result = (const TOUCH_TEST_PRODUCTION_RESULT*)Buffer;
+	const TOUCH_TEST_PRODUCTION_ENTRY* Entry;
+	WDFFILEOBJECT File;
+	ULONG Written = 0;
+
+	BuildPanel(&Panel, FALSE);
+	File = StartPanel(&Harness, &Panel);
+
+	CHECK_SUCCESS(RunProductionTest(File,
+		TOUCH_TEST_PT_SHORTS | TOUCH_TEST_PT_BASELINE | TOUCH_TEST_PT_HIGH_RES | TOUCH_TEST_PT_ABS_RAW_CAP,
+		Buffer,
+		sizeof(Buffer),
+		&Written));
+
+	CHECK_EQ(Result->Rows, ROWS);
+	CHECK_EQ(Result->Cols, COLS);
+	CHECK_EQ(Result->TestCount, 4);
+	CHECK_EQ(Result->FailedCount, 0);
+
+	Entry = FindEntry(Buffer, TCM_PT_FULL_RAW_CAP);
+	CHECK(Entry != NULL);
+	if (Entry != NULL) {
+		CHECK_EQ(Entry->Status, TOUCH_TEST_PT_PASS);
+		CHECK_EQ(Entry->Min, 1780);
+		CHECK_EQ(Entry->Max, 1820);
+		CHECK(ImageMatches(Buffer, Written, Entry, Panel.Baseline, sizeof(Panel.Baseline)));
+	}
+
+	Entry = FindEntry(Buffer, TCM_PT_HIGH_RESISTANCE);
+	CHECK(Entry != NULL);
+	if (Entry != NULL) {
+		CHECK_EQ(Entry->Status, TOUCH_TEST_PT_PASS);
+		CHECK_EQ(Entry->Min, -40);
+		CHECK_EQ(Entry->Max, 40);
+		CHECK(ImageMatches(Buffer, Written, Entry, Panel.HighRes, sizeof(Panel.HighRes)));
+	}
+
+	Entry = FindEntry(Buffer, TCM_PT_HYBRID_ABS_RAW);
+	CHECK(Entry != NULL);
+	if (Entry != NULL) {
+		CHECK_EQ(Entry->Status, TOUCH_TEST_PT_PASS);
+		CHECK_EQ(Entry->Min, 40000);
+		CHECK_EQ(Entry->Max, 43600);
+	}
+
+	Entry = FindEntry(Buffer, TCM_PT_TRX_TRX_SHORTS);
+	CHECK(Entry != NULL);
+	if (Entry != NULL) {
+		CHECK_EQ(Entry->Status, TOUCH_TEST_PT_PASS);
+		CHECK(ImageMatches(Buffer, Written, Entry, Panel.Shorts, sizeof(Panel.Shorts)));
+	}
+
+	StopPanel(&Harness, File);
+}
+
+static VOID
+TestBrokenPanelFails(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	static PANEL Panel;
+	static UINT8 Buffer[8192];
+	const TOUCH_TEST_PRODUCTION_RESULT* Result = (const TOUCH_TEST_PRODUCTION_RESULT*)Buffer;
+	const TOUCH_TEST_PRODUCTION_ENTRY* Entry;
+	WDFFILEOBJECT File;
+	ULONG Written = 0;
+
+	BuildPanel(&Panel, TRUE);
+	File = StartPanel(&Harness, &Panel);
+
+	CHECK_SUCCESS(RunProductionTest(File,
+		TOUCH_TEST_PT_SHORTS | TOUCH_TEST_PT_BASELINE | TOUCH_TEST_PT_HIGH_RES | TOUCH_TEST_PT_ABS_RAW_CAP,
+		Buffer,
+		sizeof(Buffer),
+		&Written));
+
+	CHECK_EQ(Result->TestCount, 4);
+	CHECK_EQ(Result->FailedCount, 4);
+
+	//
+	// The open receiver fails on every transmitter
+	//
+	Entry = FindEntry(Buffer, TCM_PT_FULL_RAW_CAP);
+	CHECK(Entry != NULL);
+	if (Entry != NULL) {
+		CHECK_EQ(Entry->Status, TOUCH_TEST_PT_FAIL);
+		CHECK_EQ(Entry->FailedPixels, ROWS);
+		CHECK_EQ(Entry->RxFail, 1ULL << OPEN_RX);
+		CHECK_EQ(Entry->TxFail, (1ULL << ROWS) - 1);
+		CHECK_EQ(Entry->Min, 120);
+	}
+
+	Entry = FindEntry(Buffer, TCM_PT_HIGH_RESISTANCE);
+	CHECK(Entry != NULL);
+	if (Entry != NULL) {
+		CHECK_EQ(Entry->Status, TOUCH_TEST_PT_FAIL);
+		CHECK_EQ(Entry->FailedPixels, 1);
+		CHECK_EQ(Entry->RxFail, 1ULL << HIGH_RES_PIXEL_RX);
+		CHECK_EQ(Entry->TxFail, (1ULL << HIGH_RES_PIXEL_TX) | (1ULL << BAD_TX));
+	}
+
+	Entry = FindEntry(Buffer, TCM_PT_HYBRID_ABS_RAW);
+	CHECK(Entry != NULL);
+	if (Entry != NULL) {
+		CHECK_EQ(Entry->Status, TOUCH_TEST_PT_FAIL);
+		CHECK_EQ(Entry->FailedPixels, 1);
+		CHECK_EQ(Entry->RxFail, 0);
+		CHECK_EQ(Entry->TxFail, 1ULL << BAD_TX);
+	}
+
+	Entry = FindEntry(Buffer, TCM_PT_TRX_TRX_SHORTS);
+	CHECK(Entry != NULL);
+	if (Entry != NULL) {
+		CHECK_EQ(Entry->Status, TOUCH_TEST_PT_FAIL);
+		CHECK_EQ(Entry->RxFail, 1ULL << SHORTED_RX);
+		CHECK_EQ(Entry->TxFail, 1ULL << SHORTED_TX);
+	}
+
+	StopPanel(&Harness, File);
+
+	//
+	// A receiver left out of the 2D mask is not judged
+	//
+	ShimRegistrySetDword(L"Vendor00RxElectrodeMaskTouch2D", ~((ULONG)1 << OPEN_RX));
+	File = StartPanel(&Harness, &Panel);
+
+	CHECK_SUCCESS(RunProductionTest(File, TOUCH_TEST_PT_BASELINE, Buffer, sizeof(Buffer), &Written));
+
+	Entry = FindEntry(Buffer, TCM_PT_FULL_RAW_CAP);
+	CHECK(Entry != NULL);
+	if (Entry != NULL) {
+		CHECK_EQ(Entry->Status, TOUCH_TEST_PT_PASS);
+		CHECK_EQ(Entry->FailedPixels, 0);
+	}
+
+	StopPanel(&Harness, File);
+}
+
+static PVOID
+SendCommands(
+	PVOID Context
+)
+{
+	PANEL_PARAMETERS* Parameters = Context;
+
+	while (!Parameters->Stop) {
+		TcmGetAppInfo(Parameters->Harness->Controller, Parameters->Harness->Spb);
+		Parameters->Commands++;
+	}
+
+	return NULL;
+}
+
+static VOID
+TestImageIsTheResponse(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	static PANEL Panel;
+	static UINT8 Buffer[8192];
+	PANEL_PARAMETERS Parameters = { &Harness, 0, 0 };
+	const TOUCH_TEST_PRODUCTION_ENTRY* Entry;
+	WDFFILEOBJECT File;
+	pthread_t Thread;
+	ULONG Written, Mismatches = 0, i;
+
+	BuildPanel(&Panel, FALSE);
+	File = StartPanel(&Harness, &Panel);
+
+	//
+	// Other commands keep replacing ResponseData while the tests run
+	//
+	CHECK_EQ(pthread_create(&Thread, NULL, SendCommands, &Parameters), 0);
+
+	for (i = 0; i < 200; i++) {
+		Written = 0;
+		CHECK_SUCCESS(RunProductionTest(File, TOUCH_TEST_PT_BASELINE, Buffer, sizeof(Buffer), &Written));
+
+		Entry = FindEntry(Buffer, TCM_PT_FULL_RAW_CAP);
+		if (Entry == NULL || Entry->Status != TOUCH_TEST_PT_PASS ||
+			!ImageMatches(Buffer, Written, Entry, Panel.Baseline, sizeof(Panel.Baseline))) {
+			Mismatches++;
+		}
+	}
+
+	Parameters.Stop = 1;
+	pthread_join(Thread, NULL);
+
+	printf("  200 production tests, %lu other commands, %lu images not the response\n",
+		(unsigned long)Parameters.Commands,
+		(unsigned long)Mismatches);
+
+	CHECK(Parameters.Commands > 0);
+	CHECK_EQ(Mismatches, 0);
+
+	StopPanel(&Harness, File);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestGoodPanelPasses);
+	RUN(TestBrokenPanelFails);
+	RUN(TestImageIsTheResponse);
+
+	return TestResult();
+}
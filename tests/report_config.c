@@ -0,0 +1,257 @@
+/*++
+	Module Name:
+
+		report_config.c
+
+	Abstract:
+
+		The minimal touch report config set at bring-up: how many bytes
+		a frame takes on the bus with it and with the firmware default,
+		touches decoded against it, and the default config read back and
+		used when the firmware turns the minimal one down.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "hid_sink.h"
+#include <unistd.h>
+
+#define FRAMES 50
+#define REPORT_TIMEOUT_MS 500
+
+static BOOLEAN
+RejectSetReportConfig(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length,
+	PVOID Context
+)
+{
+	UNREFERENCED_PARAMETER(Payload);
+	UNREFERENCED_PARAMETER(Length);
+	UNREFERENCED_PARAMETER(Context);
+
+	if (Command == CMD_SET_TOUCH_REPORT_CONFIG) {
+		FakeTcmRespond(Tcm, TCM_STATUS_ERROR, NULL, 0);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static VOID
+Start(
+	TCM_HARNESS* Harness,
+	BOOLEAN RejectMinimal
+)
+{
+	TcmHarnessInitialize(Harness);
+
+	if (RejectMinimal) {
+		FakeTcmSetHook(&Harness->Tcm, RejectSetReportConfig, NULL);
+	}
+
+	CHECK_SUCCESS(TcmHarnessStart(Harness, TRUE, 2000));
+	FakeHidReset();
+}
+
+//
+// Sends FRAMES frames with Count fingers down and returns the bytes
+// read from the bus per frame
+//
+static ULONG
+BytesPerFrame(
+	TCM_HARNESS* Harness,
+	ULONG Count
+)
+{
+	FAKE_TCM_OBJECT Objects[MAX_FINGER];
+	ULONG64 Bytes;
+	ULONG i, j;
+
+	CHECK(TcmHarnessDrain(Harness, REPORT_TIMEOUT_MS));
+	Bytes = Harness->Tcm.ReadBytes;
+
+	for (i = 0; i < FRAMES; i++) {
+		for (j = 0; j < Count; j++) {
+			Objects[j].Index = (UINT8)j;
+			Objects[j].Classification = 1;
+			Objects[j].X = (UINT16)(100 + j * 120 + i);
+			Objects[j].Y = (UINT16)(200 + j * 240 + i);
+		}
+
+		FakeTcmQueueTouch(&Harness->Tcm, Objects, Count);
+		CHECK(TcmHarnessDrain(Harness, REPORT_TIMEOUT_MS));
+	}
+
+	Bytes = Harness->Tcm.ReadBytes - Bytes;
+
+	FakeTcmQueueTouch(&Harness->Tcm, NULL, 0);
+	CHECK(TcmHarnessDrain(Harness, REPORT_TIMEOUT_MS));
+
+	return (ULONG)(Bytes / FRAMES);
+}
+
+static BOOLEAN
+WaitReports(
+	ULONG Count
+)
+{
+	ULONG i;
+
+	for (i = 0; i < REPORT_TIMEOUT_MS * 10 && FakeHidReports() < Count; i++) {
+		usleep(100);
+	}
+
+	return FakeHidReports() >= Count;
+}
+
+//
+// Two fingers at the corners of the panel have to come out of the
+// report config in use as they went in, give or take the translation
+// to display coordinates
+//
+static VOID
+CheckDecoding(
+	TCM_HARNESS* Harness
+)
+{
+	FAKE_TCM_OBJECT Objects[2] = {
+		{ 0, 1, 0, 0 },
+		{ 1, 1, 0, 0 },
+	};
+	HID_INPUT_REPORT Report;
+	HID_TOUCH_REPORT* Touch = &Report.TouchReport;
+	USHORT X[2], Y[2];
+	ULONG Reports, i;
+
+	Objects[1].X = Harness->Tcm.AppInfo.MaxX;
+	Objects[1].Y = Harness->Tcm.AppInfo.MaxY;
+
+	for (i = 0; i < 2; i++) {
+		X[i] = Objects[i].X;
+		Y[i] = Objects[i].Y;
+		TchTranslateToDisplayCoordinates(&X[i], &Y[i], &Harness->DevContext->ReportContext.Props);
+	}
+
+	FakeHidReset();
+	Reports = FakeHidReports();
+
+	FakeTcmQueueTouch(&Harness->Tcm, Objects, 2);
+	CHECK(WaitReports(Reports + 1));
+	CHECK(FakeHidRecent(0, &Report));
+
+	CHECK_EQ(Touch->ContactCount, 2);
+
+	for (i = 0; i < 2; i++) {
+		CHECK_EQ(Touch->Contacts[i].TipSwitch, 1);
+		CHECK_EQ(Touch->Contacts[i].X, X[i]);
+		CHECK_EQ(Touch->Contacts[i].Y, Y[i]);
+	}
+
+	Reports = FakeHidReports();
+
+	FakeTcmQueueTouch(&Harness->Tcm, NULL, 0);
+	CHECK(WaitReports(Reports + 1));
+	CHECK(FakeHidRecent(0, &Report));
+	CHECK_EQ(Touch->Contacts[0].TipSwitch, 0);
+	CHECK_EQ(Touch->Contacts[1].TipSwitch, 0);
+}
+
+static VOID
+TestBytesPerFrame(
+	VOID
+)
+{
+	static TCM_HARNESS Minimal, Default;
+	ULONG MinimalBytes[2], DefaultBytes[2];
+
+	Start(&Minimal, FALSE);
+	MinimalBytes[0] = BytesPerFrame(&Minimal, 1);
+	MinimalBytes[1] = BytesPerFrame(&Minimal, MAX_FINGER);
+	TcmHarnessStop(&Minimal);
+
+	Start(&Default, TRUE);
+	DefaultBytes[0] = BytesPerFrame(&Default, 1);
+	DefaultBytes[1] = BytesPerFrame(&Default, MAX_FINGER);
+	TcmHarnessStop(&Default);
+
+	printf("  bytes per frame, 1 / %u fingers: default %u / %u, minimal %u / %u\n",
+		MAX_FINGER,
+		DefaultBytes[0],
+		DefaultBytes[1],
+		MinimalBytes[0],
+		MinimalBytes[1]);
+
+	CHECK(MinimalBytes[0] < DefaultBytes[0]);
+	CHECK(MinimalBytes[1] < DefaultBytes[1]);
+}
+
+static VOID
+TestMinimalDecoding(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TCM_CONTROLLER_CONTEXT* Controller;
+
+	Start(&Harness, FALSE);
+	Controller = Harness.Controller;
+
+	//
+	// The firmware took the minimal config and the driver parses with it
+	//
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_SET_TOUCH_REPORT_CONFIG], 1);
+	CHECK_EQ(Harness.Tcm.ReportConfig[0], TOUCH_NUM_OF_ACTIVE_OBJECTS);
+	CHECK_EQ(Controller->ConfigData.DataLength, Harness.Tcm.ReportConfigLength);
+	CHECK(memcmp(Controller->ConfigData.Buffer, Harness.Tcm.ReportConfig, Harness.Tcm.ReportConfigLength) == 0);
+
+	CheckDecoding(&Harness);
+
+	TcmHarnessStop(&Harness);
+}
+
+static VOID
+TestRejectedFallsBack(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TCM_CONTROLLER_CONTEXT* Controller;
+
+	Start(&Harness, TRUE);
+	Controller = Harness.Controller;
+
+	//
+	// The default config is read again and kept, the bring-up carries
+	// on with it
+	//
+	CHECK_EQ(Controller->ControllerState.Init, TRUE);
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_SET_TOUCH_REPORT_CONFIG], 1);
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_GET_TOUCH_REPORT_CONFIG], 2);
+	CHECK_EQ(Harness.Tcm.ReportConfig[0], TOUCH_TIMESTAMP);
+	CHECK(Controller->ConfigData.DataLength >= Harness.Tcm.ReportConfigLength);
+	CHECK(memcmp(Controller->ConfigData.Buffer, Harness.Tcm.ReportConfig, Harness.Tcm.ReportConfigLength) == 0);
+
+	CheckDecoding(&Harness);
+
+	TcmHarnessStop(&Harness);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestBytesPerFrame);
+	RUN(TestMinimalDecoding);
+	RUN(TestRejectedFallsBack);
+
+	return TestResult();
+}
@@ -0,0 +1,386 @@
+/*++
+	Module Name:
+
+		report_rate.c
+
+	Abstract:
+
+		Report rate scheduling against a controller that dozes: how
+		long the first frame of a touch takes to arrive after idle, and
+		how many DC_NO_DOZE writes each kind of input costs. The idle
+		timeout and scan intervals are scaled down from the defaults so
+		that the scenarios run in well under a second each.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "hid_sink.h"
+#include "registry.h"
+#include <unistd.h>
+
+//
+// Driver quiet period before the idle rate, and the firmware scans
+//
+#define IDLE_TIMEOUT_MS 50
+#define ACTIVE_SCAN_US 4000
+#define DOZE_SCAN_US 40000
+#define DOZE_HOLDOFF_US 10000
+
+#define REPORT_TIMEOUT_MS 500
+
+typedef struct _LATENCY
+{
+	ULONG Count;
+	ULONG64 Total;
+	ULONG64 Max;
+} LATENCY;
+
+static const UINT8 SchemaWithoutDoze[] = {
+	DC_CHARGER_CONNECTED, 1, 0x00, 0x00,
+	0x5A
+};
+
+static BOOLEAN
+DescribeWithoutDoze(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length,
+	PVOID Context
+)
+{
+	UNREFERENCED_PARAMETER(Payload);
+	UNREFERENCED_PARAMETER(Length);
+	UNREFERENCED_PARAMETER(Context);
+
+	if (Command == CMD_DESCRIBE_DYNAMIC_CONFIG) {
+		FakeTcmRespond(Tcm, TCM_STATUS_OK, SchemaWithoutDoze, sizeof(SchemaWithoutDoze) - 1);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static VOID
+StartDozing(
+	TCM_HARNESS* Harness,
+	BOOLEAN DozeControl
+)
+{
+	ShimRegistrySetDword(L"IdleScanTimeout", IDLE_TIMEOUT_MS);
+
+	TcmHarnessInitialize(Harness);
+	Harness->Tcm.AppInfo.DynamicConfigSize = 8;
+	Harness->Tcm.ActiveScanUs = ACTIVE_SCAN_US;
+	Harness->Tcm.DozeScanUs = DOZE_SCAN_US;
+	Harness->Tcm.DozeHoldoffUs = DOZE_HOLDOFF_US;
+
+	if (!DozeControl) {
+		FakeTcmSetHook(&Harness->Tcm, DescribeWithoutDoze, NULL);
+	}
+
+	CHECK_SUCCESS(TcmHarnessStart(Harness, TRUE, 2000));
+	CHECK_EQ(Harness->Controller->ReportRate.IdleTimeout, IDLE_TIMEOUT_MS);
+
+	FakeHidReset();
+}
+
+static VOID
+StopDozing(
+	TCM_HARNESS* Harness
+)
+{
+	TcmHarnessStop(Harness);
+	ShimRegistryClear();
+}
+
+//
+// Queues one frame and waits for its HID report. Returns the time it
+// took in microseconds.
+//
+static ULONG64
+Frame(
+	TCM_HARNESS* Harness,
+	const FAKE_TCM_OBJECT* Objects,
+	ULONG Count
+)
+{
+	ULONG Reports = FakeHidReports();
+	ULONG64 Start = KeQueryInterruptTime();
+	ULONG i;
+
+	FakeTcmQueueTouch(&Harness->Tcm, Objects, Count);
+
+	for (i = 0; i < REPORT_TIMEOUT_MS * 10 && FakeHidReports() == Reports; i++) {
+		usleep(100);
+	}
+
+	CHECK(FakeHidReports() != Reports);
+
+	return (KeQueryInterruptTime() - Start) / 10;
+}
+
+static VOID
+Tap(
+	TCM_HARNESS* Harness,
+	UINT16 X,
+	LATENCY* Landing
+)
+{
+	FAKE_TCM_OBJECT Object = { 0, 1, X, 400 };
+	ULONG64 Us;
+
+	Us = Frame(Harness, &Object, 1);
+	Frame(Harness, NULL, 0);
+
+	if (Landing != NULL) {
+		Landing->Count++;
+		Landing->Total += Us;
+		if (Us > Landing->Max) {
+			Landing->Max = Us;
+		}
+	}
+}
+
+//
+// Waits out the idle timeout and the DC_NO_DOZE write it causes
+//
+static VOID
+Settle(
+	VOID
+)
+{
+	usleep(IDLE_TIMEOUT_MS * 3 * 1000);
+}
+
+static ULONG
+DozeWrites(
+	TCM_HARNESS* Harness
+)
+{
+	return __atomic_load_n(&Harness->Tcm.CommandCounts[CMD_SET_DYNAMIC_CONFIG], __ATOMIC_SEQ_CST);
+}
+
+static VOID
+PrintLatency(
+	const char* Name,
+	const LATENCY* Landing,
+	ULONG Writes
+)
+{
+	printf("  %-26s first frame mean %5llu us, max %5llu us, %lu DC_NO_DOZE writes\n",
+		Name,
+		Landing->Count != 0 ? (unsigned long long)(Landing->Total / Landing->Count) : 0ULL,
+		(unsigned long long)Landing->Max,
+		(unsigned long)Writes);
+}
+
+static VOID
+TestIsolatedTaps(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	LATENCY Landing = { 0 };
+	ULONG Writes, i;
+
+	StartDozing(&Harness, TRUE);
+	Writes = DozeWrites(&Harness);
+
+	//
+	// Every tap finds the controller dozing, and costs a write into
+	// the active rate and one back to idle
+	//
+	for (i = 0; i < 5; i++) {
+		Tap(&Harness, (UINT16)(100 + i * 50), &Landing);
+		Settle();
+	}
+
+	Writes = DozeWrites(&Harness) - Writes;
+	PrintLatency("taps after idle", &Landing, Writes);
+
+	CHECK_EQ(Writes, 10);
+	CHECK_EQ(Harness.Controller->ReportRate.Transitions, 10);
+	CHECK_EQ(Harness.Controller->ReportRate.CurrentRate, REPORT_RATE_IDLE);
+	CHECK_EQ(Harness.Tcm.DynamicConfig[DC_NO_DOZE], 0);
+	CHECK(Landing.Max > ACTIVE_SCAN_US);
+
+	StopDozing(&Harness);
+}
+
+//
+// Taps apart by more than the firmware doze holdoff but well within
+// the idle timeout, like typing. Returns the mean first frame time of
+// all but the first tap.
+//
+static ULONG64
+Typing(
+	BOOLEAN DozeControl,
+	ULONG* Writes
+)
+{
+	static TCM_HARNESS Harness;
+	LATENCY Landing = { 0 };
+	ULONG Start, i;
+
+	StartDozing(&Harness, DozeControl);
+	Start = DozeWrites(&Harness);
+
+	Tap(&Harness, 100, NULL);
+
+	for (i = 0; i < 10; i++) {
+		usleep(DOZE_HOLDOFF_US + DOZE_HOLDOFF_US / 2);
+		Tap(&Harness, (UINT16)(150 + i * 50), &Landing);
+	}
+
+	Settle();
+
+	*Writes = DozeWrites(&Harness) - Start;
+	PrintLatency(DozeControl ? "typing" : "typing, no doze control", &Landing, *Writes);
+
+	if (DozeControl) {
+		CHECK_EQ(Harness.Controller->ReportRate.Transitions, 2);
+		CHECK_EQ(Harness.Controller->ReportRate.Unsupported, FALSE);
+	}
+	else {
+		CHECK_EQ(Harness.Controller->ReportRate.Transitions, 0);
+		CHECK_EQ(Harness.Controller->ReportRate.Unsupported, TRUE);
+	}
+
+	StopDozing(&Harness);
+
+	return Landing.Total / Landing.Count;
+}
+
+static VOID
+TestTyping(
+	VOID
+)
+{
+	ULONG64 Held, Dozing;
+	ULONG Writes;
+
+	//
+	// The whole burst is one write in and one out, and keeps the
+	// controller at its active scan between taps
+	//
+	Held = Typing(TRUE, &Writes);
+	CHECK_EQ(Writes, 2);
+
+	//
+	// Without DC_NO_DOZE in the schema nothing is written, and the
+	// first try is the last one
+	//
+	Dozing = Typing(FALSE, &Writes);
+	CHECK_EQ(Writes, 0);
+
+	CHECK(Held < Dozing);
+}
+
+static VOID
+TestDrag(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	FAKE_TCM_OBJECT Object = { 0, 1, 100, 400 };
+	LATENCY Landing = { 0 };
+	ULONG Writes, i;
+
+	StartDozing(&Harness, TRUE);
+	Writes = DozeWrites(&Harness);
+
+	Landing.Total = Landing.Max = Frame(&Harness, &Object, 1);
+	Landing.Count = 1;
+
+	for (i = 0; i < 60; i++) {
+		Object.X += 10;
+		Frame(&Harness, &Object, 1);
+	}
+
+	Frame(&Harness, NULL, 0);
+	Settle();
+
+	Writes = DozeWrites(&Harness) - Writes;
+	PrintLatency("drag of 60 frames", &Landing, Writes);
+
+	CHECK_EQ(Writes, 2);
+	CHECK_EQ(Harness.Controller->ReportRate.Transitions, 2);
+
+	StopDozing(&Harness);
+}
+
+static VOID
+TestCommandLock(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TCM_CONTROLLER_CONTEXT* Controller;
+	ULONG Writes, Transitions, i;
+
+	StartDozing(&Harness, TRUE);
+	Controller = Harness.Controller;
+
+	Tap(&Harness, 100, NULL);
+	Settle();
+	CHECK_EQ(Controller->ReportRate.CurrentRate, REPORT_RATE_IDLE);
+
+	//
+	// Nothing is written while another sequence holds the commands.
+	// A tap and the idle timeout after it cancel out.
+	//
+	Writes = DozeWrites(&Harness);
+	Transitions = Controller->ReportRate.Transitions;
+
+	TcmLockCommands(Controller);
+	Tap(&Harness, 200, NULL);
+	Settle();
+	CHECK_EQ(DozeWrites(&Harness), Writes);
+	TcmUnlockCommands(Controller);
+
+	usleep(20000);
+	CHECK_EQ(DozeWrites(&Harness), Writes);
+	CHECK_EQ(Controller->ReportRate.CurrentRate, REPORT_RATE_IDLE);
+
+	//
+	// Taps while held come out as a single write once released
+	//
+	TcmLockCommands(Controller);
+	for (i = 0; i < 3; i++) {
+		Tap(&Harness, (UINT16)(300 + i * 50), NULL);
+	}
+	CHECK_EQ(DozeWrites(&Harness), Writes);
+	TcmUnlockCommands(Controller);
+
+	for (i = 0; i < 200 && __atomic_load_n(&Controller->ReportRate.Transitions, __ATOMIC_SEQ_CST) == Transitions; i++) {
+		usleep(100);
+	}
+
+	CHECK_EQ(DozeWrites(&Harness), Writes + 1);
+	CHECK_EQ(Controller->ReportRate.CurrentRate, REPORT_RATE_ACTIVE);
+	CHECK_EQ(Harness.Tcm.DynamicConfig[DC_NO_DOZE], 1);
+
+	Settle();
+	CHECK_EQ(DozeWrites(&Harness), Writes + 2);
+
+	StopDozing(&Harness);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestIsolatedTaps);
+	RUN(TestTyping);
+	RUN(TestDrag);
+	RUN(TestCommandLock);
+
+	return TestResult();
+}
@@ -0,0 +1,572 @@
+/*++
+	Module Name:
+
+		rmi4.c
+
+	Abstract:
+
+		The RMI4 controller code against a simulated F01/F12/F34/F54
+		controller: the function table and the F12 register descriptors
+		and how they are kept across resets, the interrupt read plan, and
+		F12 Data1 read only up to the last object with its attention bit
+		set. Also the bus transactions an interrupt takes with register
+		reads in SPB sequences, and with the separate transfers used on
+		controllers that reject sequences.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "rmi4_device.h"
+#include <rmi4\f01\function01.h>
+#include <rmi4\rmiinternal.h>
+#include <rmi4\rmireadplan.h>
+#include <rmi4\f12\function12.h>
+#include <rmi4\f12\data1\finger.h>
+
+//
+// Register map of page 0, F54 has page 1 to itself
+//
+#define F01_DATA 0x00
+#define F12_DATA 0x02
+#define F34_CONTROL 0x10
+#define F12_CONTROL 0x20
+#define F01_CONTROL 0x30
+#define F01_QUERY 0x40
+#define F12_QUERY 0x60
+#define F34_QUERY 0x70
+
+#define OBJECTS 10
+#define OBJECT_SIZE sizeof(RMI4_F12_FINGER_3D_W_DATA_REGISTER)
+
+#define INTERRUPTS 20
+
+typedef struct _RMI4_TEST
+{
+	TCM_HARNESS Harness;
+	FAKE_RMI4 Rmi4;
+	RMI4_CONTROLLER_CONTEXT Controller;
+	UINT8 Objects[OBJECTS * OBJECT_SIZE];
+} RMI4_TEST;
+
+//
+// Presence map size, presence map and register structure, on three
+// consecutive addresses
+//
+static VOID
+SetDescriptor(
+	FAKE_RMI4* Rmi4,
+	UINT8 Address,
+	const UINT8* Presence,
+	ULONG PresenceLength,
+	const UINT8* Structure,
+	ULONG StructureLength
+)
+{
+	FakeRmi4SetRegister(Rmi4, 0, Address, (UINT8)PresenceLength);
+	FakeRmi4SetPacket(Rmi4, 0, Address + 1, Presence, PresenceLength);
+	FakeRmi4SetPacket(Rmi4, 0, Address + 2, Structure, StructureLength);
+}
+
+static VOID
+SetObject(
+	RMI4_TEST* Test,
+	ULONG Index,
+	UINT8 Type,
+	USHORT X,
+	USHORT Y
+)
+{
+	UINT8* Object = &Test->Objects[Index * OBJECT_SIZE];
+
+	Object[0] = Type;
+	Object[1] = (UINT8)X;
+	Object[2] = (UINT8)(X >> 8);
+	Object[3] = (UINT8)Y;
+	Object[4] = (UINT8)(Y >> 8);
+
+	FakeRmi4SetPacket(&Test->Rmi4, 0, F12_DATA, Test->Objects, sizeof(Test->Objects));
+}
+
+static VOID
+SetAttention(
+	RMI4_TEST* Test,
+	USHORT Mask
+)
+{
+	const UINT8 Attention[2] = { (UINT8)Mask, (UINT8)(Mask >> 8) };
+
+	FakeRmi4SetPacket(&Test->Rmi4, 0, F12_DATA + 1, Attention, sizeof(Attention));
+}
+
+//
+// F12 reports ten 8 byte objects in Data1, with Attention also the
+// object attention bits in Data15
+//
+static VOID
+Rmi4Populate(
+	RMI4_TEST* Test,
+	BOOLEAN Attention
+)
+{
+	static const UINT8 GeneralInfo[4] = { 0x01 };
+	static const UINT8 QueryPresence[] = { 2, 0x01 };
+	static const UINT8 QueryStructure[] = { 1, 0x01 };
+	static const UINT8 ControlPresence[] = { 2, 0x00, 0x01 };
+	static const UINT8 ControlStructure[] = { 14, 0x01 };
+	static const UINT8 DataPresence[] = { 2, 0x02 };
+	static const UINT8 DataStructure[] = { OBJECTS * OBJECT_SIZE, 0x01 };
+	static const UINT8 AttentionPresence[] = { 4, 0x02, 0x80 };
+	static const UINT8 AttentionStructure[] = { OBJECTS * OBJECT_SIZE, 0x01, 2, 0x01 };
+	FAKE_RMI4* Rmi4 = &Test->Rmi4;
+	ULONG i;
+
+	FakeRmi4AddFunction(Rmi4, 0, RMI4_F01_RMI_DEVICE_CONTROL, F01_QUERY, F01_CONTROL, F01_DATA, 1);
+	FakeRmi4AddFunction(Rmi4, 0, RMI4_F34_FLASH_MEMORY_MANAGEMENT, F34_QUERY, F34_CONTROL, 0x72, 1);
+	FakeRmi4AddFunction(Rmi4, 0, RMI4_F12_2D_TOUCHPAD_SENSOR, F12_QUERY, F12_CONTROL, F12_DATA, 2);
+	FakeRmi4AddFunction(Rmi4, 1, RMI4_F54_TEST_REPORTING, 0x00, 0x01, 0x02, 1);
+
+	//
+	// Firmware identity and customer config ID
+	//
+	for (i = 0; i < RMI4_IDENTITY_QUERY_SIZE; i++) {
+		FakeRmi4SetRegister(Rmi4, 0, (UINT8)(F01_QUERY + i), (UINT8)(0xA0 + i));
+	}
+
+	for (i = 0; i < RMI4_CONFIG_ID_SIZE; i++) {
+		FakeRmi4SetRegister(Rmi4, 0, (UINT8)(F34_CONTROL + i), (UINT8)(0xC0 + i));
+	}
+
+	FakeRmi4SetPacket(Rmi4, 0, F12_QUERY, GeneralInfo, sizeof(GeneralInfo));
+	SetDescriptor(Rmi4, F12_QUERY + 1, QueryPresence, sizeof(QueryPresence),
+		QueryStructure, sizeof(QueryStructure));
+	SetDescriptor(Rmi4, F12_QUERY + 4, ControlPresence, sizeof(ControlPresence),
+		ControlStructure, sizeof(ControlStructure));
+
+	if (Attention) {
+		SetDescriptor(Rmi4, F12_QUERY + 7, AttentionPresence, sizeof(AttentionPresence),
+			AttentionStructure, sizeof(AttentionStructure));
+		SetAttention(Test, 0);
+	}
+	else {
+		SetDescriptor(Rmi4, F12_QUERY + 7, DataPresence, sizeof(DataPresence),
+			DataStructure, sizeof(DataStructure));
+	}
+
+	memset(Test->Objects, 0, sizeof(Test->Objects));
+	FakeRmi4SetPacket(Rmi4, 0, F12_DATA, Test->Objects, sizeof(Test->Objects));
+}
+
+//
+// The harness provides the SPB target, the RMI4 controller is put
+// behind it in place of the TCM one
+//
+static VOID
+Rmi4Start(
+	RMI4_TEST* Test,
+	BOOLEAN Attention
+)
+{
+	memset(&Test->Controller, 0, sizeof(Test->Controller));
+
+	TcmHarnessInitialize(&Test->Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Test->Harness, FALSE, 2000));
+
+	FakeRmi4Initialize(&Test->Rmi4);
+	Rmi4Populate(Test, Attention);
+	FakeRmi4Connect(&Test->Rmi4, Test->Harness.Spb->SpbIoTarget);
+}
+
+static VOID
+Rmi4Stop(
+	RMI4_TEST* Test
+)
+{
+	RmiInvalidateFunctionsTable(&Test->Controller);
+
+	FakeTcmConnect(&Test->Harness.Tcm, Test->Harness.Spb->SpbIoTarget);
+	TcmHarnessStop(&Test->Harness);
+	FakeRmi4Cleanup(&Test->Rmi4);
+}
+
+static NTSTATUS
+Rmi4Configure(
+	RMI4_TEST* Test
+)
+{
+	NTSTATUS status;
+
+	status = RmiBuildFunctionsTable(&Test->Controller, Test->Harness.Spb);
+
+	if (NT_SUCCESS(status)) {
+		status = RmiConfigureF12(&Test->Controller, Test->Harness.Spb);
+	}
+
+	if (NT_SUCCESS(status)) {
+		RmiBuildReadPlan(&Test->Controller);
+	}
+
+	return status;
+}
+
+static int
+FunctionIndex(
+	RMI4_CONTROLLER_CONTEXT* Controller,
+	int Number
+)
+{
+	return RmiGetFunctionIndex(Controller->Descriptors, Controller->FunctionCount, Number);
+}
+
+static VOID
+TestFunctionTable(
+	VOID
+)
+{
+	static RMI4_TEST Test;
+	RMI4_CONTROLLER_CONTEXT* Controller = &Test.Controller;
+	int f12;
+
+	Rmi4Start(&Test, TRUE);
+	CHECK_SUCCESS(Rmi4Configure(&Test));
+
+	CHECK_EQ(Controller->FunctionCount, 4);
+	CHECK_EQ(Controller->FunctionOnPage[FunctionIndex(Controller, RMI4_F01_RMI_DEVICE_CONTROL)], 0);
+	CHECK_EQ(Controller->FunctionOnPage[FunctionIndex(Controller, RMI4_F54_TEST_REPORTING)], 1);
+
+	f12 = FunctionIndex(Controller, RMI4_F12_2D_TOUCHPAD_SENSOR);
+	CHECK(f12 < Controller->FunctionCount);
+	CHECK_EQ(Controller->Descriptors[f12].DataBase, F12_DATA);
+
+	CHECK(Controller->HasRegisterDescriptors);
+	CHECK_EQ(Controller->F12QueryRegDesc.NumRegisters, 1);
+	CHECK_EQ(Controller->F12ControlRegDesc.NumRegisters, 1);
+	CHECK_EQ(Controller->F12ControlRegDesc.Registers[0].Register, 8);
+	CHECK_EQ(Controller->F12ControlRegDesc.Registers[0].RegisterSize, 14);
+	CHECK_EQ(Controller->F12DataRegDesc.NumRegisters, 2);
+	CHECK_EQ(Controller->F12DataRegDesc.Registers[0].Register, 1);
+	CHECK_EQ(Controller->F12DataRegDesc.Registers[1].Register, 15);
+	CHECK_EQ(Controller->PacketSize, OBJECTS * OBJECT_SIZE + 2);
+	CHECK_EQ(Controller->MaxFingers, OBJECTS);
+
+	CHECK(Controller->FunctionsCached);
+	CHECK(Controller->F12DescriptorsCached);
+
+	Rmi4Stop(&Test);
+}
+
+static VOID
+TestFunctionTableCached(
+	VOID
+)
+{
+	static RMI4_TEST Test;
+	static RMI4_FUNCTION_DESCRIPTOR Descriptors[RMI4_MAX_FUNCTIONS];
+	RMI4_CONTROLLER_CONTEXT* Controller = &Test.Controller;
+	ULONG ColdReads, WarmReads;
+
+	Rmi4Start(&Test, TRUE);
+
+	CHECK_SUCCESS(Rmi4Configure(&Test));
+	ColdReads = FakeRmi4Reads(&Test.Rmi4);
+	memcpy(Descriptors, Controller->Descriptors, sizeof(Descriptors));
+
+	//
+	// Reset with the same firmware: only the identity is read, F01 query
+	// and F34 control in one sequence, not the page description table
+	// or the F12 descriptors
+	//
+	FakeRmi4ClearLog(&Test.Rmi4);
+	CHECK_SUCCESS(Rmi4Configure(&Test));
+	WarmReads = FakeRmi4Reads(&Test.Rmi4);
+
+	CHECK_EQ(Controller->CacheHits, 1);
+	CHECK_EQ(Controller->CacheMisses, 0);
+	CHECK_EQ(FakeRmi4ReadsOf(&Test.Rmi4, 0, RMI4_FIRST_FUNCTION_ADDRESS, NULL), 0);
+	CHECK_EQ(FakeRmi4ReadsOf(&Test.Rmi4, 0, F12_QUERY, NULL), 0);
+	CHECK_EQ(WarmReads, 2);
+	CHECK(WarmReads < ColdReads);
+	CHECK_EQ(Controller->F12DataRegDesc.NumRegisters, 2);
+	CHECK_EQ(Controller->MaxFingers, OBJECTS);
+
+	//
+	// A new customer config: past the identity check everything is read
+	// again and comes out the same as from a cold start
+	//
+	FakeRmi4SetRegister(&Test.Rmi4, 0, F34_CONTROL, 0x55);
+	FakeRmi4ClearLog(&Test.Rmi4);
+	CHECK_SUCCESS(Rmi4Configure(&Test));
+
+	CHECK_EQ(Controller->CacheHits, 1);
+	CHECK_EQ(Controller->CacheMisses, 1);
+	CHECK_EQ(FakeRmi4ReadsOf(&Test.Rmi4, 0, RMI4_FIRST_FUNCTION_ADDRESS, NULL), 1);
+	CHECK_EQ(FakeRmi4ReadsOf(&Test.Rmi4, 0, F12_QUERY, NULL), 1);
+	CHECK_EQ(FakeRmi4Reads(&Test.Rmi4), WarmReads + ColdReads);
+	CHECK(memcmp(Descriptors, Controller->Descriptors, sizeof(Descriptors)) == 0);
+	CHECK_EQ(Controller->F12DataRegDesc.NumRegisters, 2);
+	CHECK_EQ(Controller->Identity.ConfigId[0], 0x55);
+
+	Rmi4Stop(&Test);
+}
+
+static VOID
+TestReadPlanCoalesces(
+	VOID
+)
+{
+	static RMI4_TEST Test;
+	RMI4_CONTROLLER_CONTEXT* Controller = &Test.Controller;
+	DETECTED_OBJECTS Objects;
+	ULONG Bytes, Length;
+	UINT8* Data;
+
+	//
+	// Without attention bits Data1 is planned, right behind the F01
+	// status and interrupt bytes
+	//
+	Rmi4Start(&Test, FALSE);
+	CHECK_SUCCESS(Rmi4Configure(&Test));
+
+	CHECK_EQ(Controller->ReadPlan.SpanCount, 1);
+	CHECK_EQ(Controller->ReadPlan.Spans[0].Address, F01_DATA);
+	CHECK_EQ(Controller->ReadPlan.Spans[0].Length, 2 + OBJECTS * OBJECT_SIZE);
+
+	FakeRmi4SetRegister(&Test.Rmi4, 0, F01_DATA + 1, 0x06);
+	SetObject(&Test, 0, RMI4_F12_OBJECT_FINGER, 100, 200);
+	SetObject(&Test, 9, RMI4_F12_OBJECT_FINGER, 1000, 2000);
+
+	FakeRmi4ClearLog(&Test.Rmi4);
+	CHECK_SUCCESS(RmiExecuteReadPlan(Controller, Test.Harness.Spb));
+
+	CHECK_EQ(FakeRmi4Reads(&Test.Rmi4), 1);
+	CHECK_EQ(FakeRmi4ReadsOf(&Test.Rmi4, 0, F01_DATA, &Bytes), 1);
+	CHECK_EQ(Bytes, 2 + OBJECTS * OBJECT_SIZE);
+
+	Data = RmiGetReadPlanData(Controller, RMI4_READ_F01_STATUS, &Length);
+	CHECK(Data != NULL);
+	CHECK_EQ(Length, sizeof(RMI4_F01_DATA_REGISTERS));
+	CHECK(Data != NULL && Data[1] == 0x06);
+
+	Data = RmiGetReadPlanData(Controller, RMI4_READ_F12_DATA1, &Length);
+	CHECK(Data != NULL);
+	CHECK_EQ(Length, OBJECTS * OBJECT_SIZE);
+	CHECK(Data != NULL && memcmp(Data, Test.Objects, sizeof(Test.Objects)) == 0);
+
+	//
+	// Objects come from the plan, nothing more goes out on the bus
+	//
+	FakeRmi4ClearLog(&Test.Rmi4);
+	memset(&Objects, 0, sizeof(Objects));
+	CHECK_SUCCESS(RmiGetObjectStatusFromControllerF12(Controller, Test.Harness.Spb, &Objects));
+
+	CHECK_EQ(FakeRmi4Reads(&Test.Rmi4), 0);
+	CHECK_EQ(Objects.States[0], OBJECT_STATE_FINGER_PRESENT_WITH_ACCURATE_POS);
+	CHECK_EQ(Objects.Positions[0].X, 100);
+	CHECK_EQ(Objects.States[9], OBJECT_STATE_FINGER_PRESENT_WITH_ACCURATE_POS);
+	CHECK_EQ(Objects.Positions[9].Y, 2000);
+	CHECK_EQ(Objects.States[5], OBJECT_STATE_NOT_PRESENT);
+
+	Rmi4Stop(&Test);
+}
+
+static VOID
+TestData1UpToLastActive(
+	VOID
+)
+{
+	static RMI4_TEST Test;
+	RMI4_CONTROLLER_CONTEXT* Controller = &Test.Controller;
+	DETECTED_OBJECTS Objects;
+	ULONG Bytes, Length, i;
+
+	//
+	// With attention bits Data1 is left out of the plan, Data15 is too
+	// far behind the F01 bytes to share their read
+	//
+	Rmi4Start(&Test, TRUE);
+	CHECK_SUCCESS(Rmi4Configure(&Test));
+
+	CHECK_EQ(Controller->ReadPlan.SpanCount, 2);
+	CHECK_EQ(Controller->ReadPlan.Items[RMI4_READ_F12_DATA1].Length, 0);
+	CHECK_EQ(Controller->ReadPlan.Items[RMI4_READ_F12_DATA15].Address, F12_DATA + 1);
+
+	SetObject(&Test, 0, RMI4_F12_OBJECT_FINGER, 10, 20);
+	SetObject(&Test, 2, RMI4_F12_OBJECT_HOVERING_FINGER, 30, 40);
+	SetObject(&Test, 7, RMI4_F12_OBJECT_FINGER, 50, 60);
+	SetAttention(&Test, (1 << 0) | (1 << 2));
+
+	FakeRmi4ClearLog(&Test.Rmi4);
+	CHECK_SUCCESS(RmiExecuteReadPlan(Controller, Test.Harness.Spb));
+	CHECK(RmiGetReadPlanData(Controller, RMI4_READ_F12_DATA15, &Length) != NULL);
+
+	//
+	// Data15 came with the plan, Data1 is read up to object 2 and the
+	// stale record of object 7 is not looked at
+	//
+	FakeRmi4ClearLog(&Test.Rmi4);
+	for (i = 0; i < OBJECTS; i++) {
+		Objects.States[i] = OBJECT_STATE_RESERVED;
+	}
+
+	CHECK_SUCCESS(RmiGetObjectStatusFromControllerF12(Controller, Test.Harness.Spb, &Objects));
+
+	CHECK_EQ(FakeRmi4ReadsOf(&Test.Rmi4, 0, F12_DATA + 1, NULL), 0);
+	CHECK_EQ(FakeRmi4ReadsOf(&Test.Rmi4, 0, F12_DATA, &Bytes), 1);
+	CHECK_EQ(Bytes, 3 * OBJECT_SIZE);
+	CHECK_EQ(Objects.States[0], OBJECT_STATE_FINGER_PRESENT_WITH_ACCURATE_POS);
+	CHECK_EQ(Objects.States[1], OBJECT_STATE_NOT_PRESENT);
+	CHECK_EQ(Objects.States[2], OBJECT_STATE_FINGER_PRESENT_WITH_INACCURATE_POS);
+	CHECK_EQ(Objects.Positions[2].X, 30);
+	CHECK_EQ(Objects.Positions[2].Y, 40);
+
+	for (i = 3; i < OBJECTS; i++) {
+		CHECK_EQ(Objects.States[i], OBJECT_STATE_NOT_PRESENT);
+	}
+
+	//
+	// Without a planned read Data15 is read on its own, and with no
+	// object active Data1 is not read at all
+	//
+	SetAttention(&Test, 0);
+	FakeRmi4ClearLog(&Test.Rmi4);
+	Controller->ReadPlan.Fresh = FALSE;
+
+	CHECK_SUCCESS(RmiGetObjectStatusFromControllerF12(Controller, Test.Harness.Spb, &Objects));
+
+	CHECK_EQ(FakeRmi4ReadsOf(&Test.Rmi4, 0, F12_DATA + 1, &Bytes), 1);
+	CHECK_EQ(Bytes, 2);
+	CHECK_EQ(FakeRmi4ReadsOf(&Test.Rmi4, 0, F12_DATA, NULL), 0);
+	CHECK_EQ(Objects.States[0], OBJECT_STATE_NOT_PRESENT);
+
+	Rmi4Stop(&Test);
+}
+
+//
+// Reads what an interrupt reads, returns the bus transactions it took
+//
+static ULONG
+Interrupt(
+	RMI4_TEST* Test
+)
+{
+	DETECTED_OBJECTS Objects;
+
+	FakeRmi4ClearLog(&Test->Rmi4);
+
+	CHECK_SUCCESS(RmiExecuteReadPlan(&Test->Controller, Test->Harness.Spb));
+	CHECK_SUCCESS(RmiGetObjectStatusFromControllerF12(&Test->Controller, Test->Harness.Spb, &Objects));
+
+	CHECK_EQ(Objects.States[0], OBJECT_STATE_FINGER_PRESENT_WITH_ACCURATE_POS);
+	CHECK_EQ(Objects.Positions[0].X, 10);
+	CHECK_EQ(Objects.States[2], OBJECT_STATE_FINGER_PRESENT_WITH_ACCURATE_POS);
+	CHECK_EQ(Objects.Positions[2].Y, 40);
+
+	return FakeRmi4Transactions(&Test->Rmi4);
+}
+
+//
+// Two fingers down, with attention bits, so an interrupt reads the
+// planned F01 and Data15 registers and then Data1 up to object 2
+//
+static VOID
+TestSequenceTransactions(
+	VOID
+)
+{
+	static RMI4_TEST Test;
+	ULONG Transactions = 0;
+	ULONG i;
+
+	Rmi4Start(&Test, TRUE);
+	CHECK_SUCCESS(Rmi4Configure(&Test));
+	CHECK_EQ(Test.Controller.ReadPlan.SpanCount, 2);
+
+	SetObject(&Test, 0, RMI4_F12_OBJECT_FINGER, 10, 20);
+	SetObject(&Test, 2, RMI4_F12_OBJECT_FINGER, 30, 40);
+	SetAttention(&Test, (1 << 0) | (1 << 2));
+
+	for (i = 0; i < INTERRUPTS; i++) {
+		Transactions += Interrupt(&Test);
+	}
+
+	printf("  sequences: %u bus transactions for %u interrupts\n", Transactions, INTERRUPTS);
+
+	//
+	// Both planned registers in one sequence, Data1 in another
+	//
+	CHECK_EQ(Transactions, 2 * INTERRUPTS);
+	CHECK(!Test.Harness.Spb->SequenceUnsupported);
+
+	Rmi4Stop(&Test);
+}
+
+static VOID
+TestSequenceFallback(
+	VOID
+)
+{
+	static const NTSTATUS Rejections[] = { STATUS_NOT_SUPPORTED, STATUS_INVALID_DEVICE_REQUEST };
+	static RMI4_TEST Test;
+	ULONG Transactions, Rejected;
+	ULONG i, j;
+
+	for (i = 0; i < ARRAYSIZE(Rejections); i++) {
+		Rmi4Start(&Test, TRUE);
+		FakeRmi4SetSequenceStatus(&Test.Rmi4, Rejections[i]);
+
+		//
+		// Bring-up reads the identity with the first sequence, it is
+		// turned down and the identity read register by register
+		//
+		CHECK_SUCCESS(Rmi4Configure(&Test));
+		CHECK(Test.Harness.Spb->SequenceUnsupported);
+		CHECK_EQ(Test.Rmi4.SequencesRejected, 1);
+		CHECK_EQ(Test.Controller.Identity.ConfigId[0], 0xC0);
+		CHECK_EQ(Test.Controller.ReadPlan.SpanCount, 2);
+
+		SetObject(&Test, 0, RMI4_F12_OBJECT_FINGER, 10, 20);
+		SetObject(&Test, 2, RMI4_F12_OBJECT_FINGER, 30, 40);
+		SetAttention(&Test, (1 << 0) | (1 << 2));
+
+		Transactions = 0;
+		Rejected = 0;
+
+		for (j = 0; j < INTERRUPTS; j++) {
+			Transactions += Interrupt(&Test);
+			Rejected += Test.Rmi4.SequencesRejected;
+		}
+
+		printf("  fallback, 0x%08x: %u bus transactions for %u interrupts\n",
+			(unsigned int)Rejections[i],
+			Transactions,
+			INTERRUPTS);
+
+		//
+		// An address pointer write and a read for each of the three
+		// registers, and no more sequences tried
+		//
+		CHECK_EQ(Transactions, 6 * INTERRUPTS);
+		CHECK_EQ(Rejected, 0);
+
+		Rmi4Stop(&Test);
+	}
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestFunctionTable);
+	RUN(TestFunctionTableCached);
+	RUN(TestReadPlanCoalesces);
+	RUN(TestData1UpToLastActive);
+	RUN(TestSequenceTransactions);
+	RUN(TestSequenceFallback);
+
+	return TestResult();
+}
@@ -0,0 +1,396 @@
+/*++
+	Module Name:
+
+		selftest_batch.c
+
+	Abstract:
+
+		IOCTL_TOUCH_SELFTEST_BATCH against a controller with a register
+		map. Batches that do not describe their data are refused before
+		anything goes out on the bus, valid ones run in order with a page
+		select only where the page changes, and a failing operation
+		stops the batch when asked to.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "register_bus.h"
+#include <selftest\selftest.h>
+
+#define BATCH_BUFFER_SIZE 4096
+
+typedef struct _BATCH
+{
+	UINT8 Buffer[BATCH_BUFFER_SIZE];
+	TOUCH_TEST_BATCH_HEADER* Header;
+	TOUCH_TEST_BATCH_OP* Ops;
+	ULONG WriteLength;
+} BATCH;
+
+static VOID
+BatchInitialize(
+	BATCH* Batch,
+	ULONG Flags
+)
+{
+	memset(Batch->Buffer, 0, sizeof(Batch->Buffer));
+	Batch->Header = (TOUCH_TEST_BATCH_HEADER*)Batch->Buffer;
+	Batch->Ops = (TOUCH_TEST_BATCH_OP*)(Batch->Header + 1);
+	Batch->Header->Flags = Flags;
+	Batch->WriteLength = 0;
+}
+
+//
+// Write data goes behind the operations, so it is added once they are
+// all known
+//
+static TOUCH_TEST_BATCH_OP*
+BatchAdd(
+	BATCH* Batch,
+	UCHAR Flags,
+	UCHAR Page,
+	UCHAR Address,
+	ULONG Length,
+	ULONG DataOffset
+)
+{
+	TOUCH_TEST_BATCH_OP* Op = &Batch->Ops[Batch->Header->OpCount++];
+
+	Op->Flags = Flags;
+	Op->Page = Page;
+	Op->Address = Address;
+	Op->Length = Length;
+	Op->DataOffset = DataOffset;
+
+	return Op;
+}
+
+static VOID
+BatchAddWriteData(
+	BATCH* Batch,
+	const VOID* Data,
+	ULONG Length
+)
+{
+	memcpy((UINT8*)(Batch->Ops + Batch->Header->OpCount) + Batch->WriteLength, Data, Length);
+	Batch->WriteLength += Length;
+}
+
+static NTSTATUS
+BatchRun(
+	WDFFILEOBJECT File,
+	BATCH* Batch,
+	ULONG InputLength,
+	ULONG OutputLength,
+	ULONG* Written
+)
+{
+	WDFREQUEST Request;
+	NTSTATUS status;
+
+	if (InputLength == 0) {
+		InputLength = sizeof(TOUCH_TEST_BATCH_HEADER) +
+			Batch->Header->OpCount * sizeof(TOUCH_TEST_BATCH_OP) +
+			Batch->WriteLength;
+	}
+
+	//
+	// Buffered: the batch result overlays the batch
+	//
+	Request = ShimRequestCreate(IOCTL_TOUCH_SELFTEST_BATCH,
+		Batch->Buffer,
+		InputLength,
+		Batch->Buffer,
+		OutputLength != 0 ? OutputLength : sizeof(Batch->Buffer));
+
+	if (Request == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	status = ShimDeviceIoControl(File, Request);
+
+	if (Written != NULL) {
+		*Written = (ULONG)ShimRequest(Request)->Information;
+	}
+
+	WdfObjectDelete(Request);
+
+	return status;
+}
+
+static const NTSTATUS*
+BatchStatus(
+	BATCH* Batch
+)
+{
+	return (const NTSTATUS*)((TOUCH_TEST_BATCH_RESULT*)Batch->Buffer + 1);
+}
+
+static const UINT8*
+BatchReadData(
+	BATCH* Batch,
+	ULONG OpCount
+)
+{
+	return (const UINT8*)(BatchStatus(Batch) + OpCount);
+}
+
+static WDFFILEOBJECT
+StartRegisterBus(
+	TCM_HARNESS* Harness,
+	FAKE_REGISTER_BUS* Bus
+)
+{
+	WDFDEVICE Device;
+	WDFFILEOBJECT File = NULL;
+
+	TcmHarnessInitialize(Harness);
+	CHECK_SUCCESS(TcmHarnessStart(Harness, TRUE, 2000));
+	CHECK_SUCCESS(TchSelfTestInitialize(Harness->Device));
+
+	//
+	// The batch sees only the register map from here on
+	//
+	FakeRegisterBusInitialize(Bus);
+	FakeRegisterBusConnect(Bus, Harness->Spb->SpbIoTarget);
+
+	Device = ShimDeviceFind(&GUID_TOUCH_SELFTEST_INTERFACE);
+	CHECK(Device != NULL);
+
+	if (Device != NULL) {
+		CHECK_SUCCESS(ShimDeviceOpen(Device, ShimCallerAdministrator, GENERIC_READ | GENERIC_WRITE, &File));
+	}
+
+	return File;
+}
+
+static VOID
+StopRegisterBus(
+	TCM_HARNESS* Harness,
+	FAKE_REGISTER_BUS* Bus,
+	WDFFILEOBJECT File
+)
+{
+	ShimDeviceClose(File);
+
+	//
+	// Power down talks to the TCM controller again
+	//
+	FakeTcmConnect(&Harness->Tcm, Harness->Spb->SpbIoTarget);
+	TcmHarnessStop(Harness);
+	FakeRegisterBusCleanup(Bus);
+}
+
+static VOID
+TestBatchValidation(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	static FAKE_REGISTER_BUS Bus;
+	static BATCH Batch;
+	static const UINT8 Data[4] = { 1, 2, 3, 4 };
+	ULONG StatusLength = sizeof(TOUCH_TEST_BATCH_RESULT) + 2 * sizeof(NTSTATUS);
+	WDFFILEOBJECT File;
+
+	File = StartRegisterBus(&Harness, &Bus);
+
+	//
+	// No operations, or more than a batch may hold
+	//
+	BatchInitialize(&Batch, 0);
+	CHECK_EQ(BatchRun(File, &Batch, 0, 0, NULL), STATUS_INVALID_PARAMETER);
+
+	BatchInitialize(&Batch, 0);
+	Batch.Header->OpCount = TOUCH_TEST_BATCH_MAX_OPS + 1;
+	CHECK_EQ(BatchRun(File, &Batch, sizeof(TOUCH_TEST_BATCH_HEADER), 0, NULL), STATUS_INVALID_PARAMETER);
+
+	//
+	// Operations cut off by the end of the input
+	//
+	BatchInitialize(&Batch, 0);
+	BatchAdd(&Batch, 0, 0, 0x10, 1, 0);
+	BatchAdd(&Batch, 0, 0, 0x11, 1, 1);
+	CHECK_EQ(BatchRun(File, &Batch, sizeof(TOUCH_TEST_BATCH_HEADER) + sizeof(TOUCH_TEST_BATCH_OP), 0, NULL),
+		STATUS_INVALID_PARAMETER);
+
+	//
+	// No room for the statuses
+	//
+	CHECK_EQ(BatchRun(File, &Batch, 0, StatusLength - 1, NULL), STATUS_BUFFER_TOO_SMALL);
+
+	//
+	// Reads past the end of the output, including an offset that
+	// wraps, and an empty read
+	//
+	BatchInitialize(&Batch, 0);
+	BatchAdd(&Batch, 0, 0, 0x10, 4, 0);
+	BatchAdd(&Batch, 0, 0, 0x10, 4, 1);
+	CHECK_EQ(BatchRun(File, &Batch, 0, StatusLength + 4, NULL), STATUS_INVALID_PARAMETER);
+
+	BatchInitialize(&Batch, 0);
+	BatchAdd(&Batch, 0, 0, 0x10, 4, 0);
+	BatchAdd(&Batch, 0, 0, 0x10, 1, 0xFFFFFFFF);
+	CHECK_EQ(BatchRun(File, &Batch, 0, 0, NULL), STATUS_INVALID_PARAMETER);
+
+	BatchInitialize(&Batch, 0);
+	BatchAdd(&Batch, 0, 0, 0x10, 4, 0);
+	BatchAdd(&Batch, 0, 0, 0x10, 0, 0);
+	CHECK_EQ(BatchRun(File, &Batch, 0, 0, NULL), STATUS_INVALID_PARAMETER);
+
+	//
+	// Writes of more data than the input carries. The last operation
+	// is the bad one, the first must not have gone out either.
+	//
+	BatchInitialize(&Batch, 0);
+	BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_WRITE, 0, 0x10, 2, 0);
+	BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_WRITE, 0, 0x20, 4, 2);
+	BatchAddWriteData(&Batch, Data, sizeof(Data));
+	CHECK_EQ(BatchRun(File, &Batch, 0, 0, NULL), STATUS_INVALID_PARAMETER);
+
+	CHECK_EQ(Bus.Writes, 0);
+	CHECK_EQ(Bus.Reads, 0);
+
+	//
+	// The same batch with the data it describes
+	//
+	BatchInitialize(&Batch, 0);
+	BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_WRITE, 0, 0x10, 2, 0);
+	BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_WRITE, 0, 0x20, 4, 0);
+	BatchAddWriteData(&Batch, Data, sizeof(Data));
+	CHECK_SUCCESS(BatchRun(File, &Batch, 0, 0, NULL));
+	CHECK_EQ(Bus.Writes, 2);
+	CHECK_EQ(Bus.Registers[0][0x11], 2);
+	CHECK_EQ(Bus.Registers[0][0x23], 4);
+
+	StopRegisterBus(&Harness, &Bus, File);
+}
+
+static VOID
+TestBatchRunsInOrder(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	static FAKE_REGISTER_BUS Bus;
+	static BATCH Batch;
+	static const UINT8 Data[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
+	const TOUCH_TEST_BATCH_RESULT* Result = (const TOUCH_TEST_BATCH_RESULT*)Batch.Buffer;
+	const UINT8* ReadData;
+	WDFFILEOBJECT File;
+	ULONG Written = 0, i;
+
+	File = StartRegisterBus(&Harness, &Bus);
+
+	Bus.Registers[0][0x00] = 0x35;
+	Bus.Registers[0][0x01] = 0x12;
+	Bus.Registers[3][0x40] = 0x77;
+
+	//
+	// A write read back on page 1, a read on page 0, a read on the page
+	// left selected, and back to page 1
+	//
+	BatchInitialize(&Batch, 0);
+	BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_WRITE | TOUCH_TEST_BATCH_OP_PAGE, 1, 0x10, 4, 0);
+	BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_PAGE, 1, 0x10, 4, 0);
+	BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_PAGE, 0, 0x00, 2, 4);
+	BatchAdd(&Batch, 0, 0, 0x01, 1, 6);
+	BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_PAGE, 1, 0x12, 2, 8);
+	BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_PAGE, 3, 0x40, 1, 10);
+	BatchAddWriteData(&Batch, Data, sizeof(Data));
+
+	CHECK_SUCCESS(BatchRun(File, &Batch, 0, 0, &Written));
+
+	CHECK_EQ(Result->OpsCompleted, 6);
+	CHECK_EQ(Result->OpsFailed, 0);
+
+	for (i = 0; i < 6; i++) {
+		CHECK_SUCCESS(BatchStatus(&Batch)[i]);
+	}
+
+	CHECK_EQ(Written, sizeof(TOUCH_TEST_BATCH_RESULT) + 6 * sizeof(NTSTATUS) + 11);
+
+	ReadData = BatchReadData(&Batch, 6);
+	CHECK(memcmp(ReadData, Data, sizeof(Data)) == 0);
+	CHECK_EQ(ReadData[4], 0x35);
+	CHECK_EQ(ReadData[5], 0x12);
+	CHECK_EQ(ReadData[6], 0x12);
+	CHECK_EQ(ReadData[8], 0xBE);
+	CHECK_EQ(ReadData[9], 0xEF);
+	CHECK_EQ(ReadData[10], 0x77);
+
+	CHECK(memcmp(&Bus.Registers[1][0x10], Data, sizeof(Data)) == 0);
+
+	//
+	// Pages 1, 0, 1 and 3; the second operation stays on page 1
+	//
+	CHECK_EQ(Bus.PageSelects, 4);
+
+	StopRegisterBus(&Harness, &Bus, File);
+}
+
+static VOID
+TestBatchStopsOnError(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	static FAKE_REGISTER_BUS Bus;
+	static BATCH Batch;
+	static const UINT8 Data[1] = { 0x5A };
+	const TOUCH_TEST_BATCH_RESULT* Result = (const TOUCH_TEST_BATCH_RESULT*)Batch.Buffer;
+	WDFFILEOBJECT File;
+	ULONG Reads, Pass;
+
+	File = StartRegisterBus(&Harness, &Bus);
+
+	Bus.NakEnabled = TRUE;
+	Bus.NakPage = 2;
+	Bus.NakAddress = 0x20;
+
+	for (Pass = 0; Pass < 2; Pass++) {
+		BatchInitialize(&Batch, Pass != 0 ? TOUCH_TEST_BATCH_STOP_ON_ERROR : 0);
+		BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_WRITE | TOUCH_TEST_BATCH_OP_PAGE, 2, 0x10, 1, 0);
+		BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_PAGE, 2, 0x20, 1, 0);
+		BatchAdd(&Batch, TOUCH_TEST_BATCH_OP_PAGE, 2, 0x10, 1, 1);
+		BatchAddWriteData(&Batch, Data, sizeof(Data));
+
+		Reads = Bus.Reads;
+		CHECK_SUCCESS(BatchRun(File, &Batch, 0, 0, NULL));
+
+		CHECK_SUCCESS(BatchStatus(&Batch)[0]);
+		CHECK_EQ(BatchStatus(&Batch)[1], STATUS_NO_SUCH_DEVICE);
+		CHECK_EQ(Result->OpsFailed, 1);
+
+		if (Pass == 0) {
+			CHECK_SUCCESS(BatchStatus(&Batch)[2]);
+			CHECK_EQ(Result->OpsCompleted, 3);
+			CHECK_EQ(BatchReadData(&Batch, 3)[1], 0x5A);
+			CHECK_EQ(Bus.Reads, Reads + 2);
+		}
+		else {
+			CHECK_EQ(BatchStatus(&Batch)[2], STATUS_CANCELLED);
+			CHECK_EQ(Result->OpsCompleted, 2);
+			CHECK_EQ(Bus.Reads, Reads + 1);
+		}
+	}
+
+	StopRegisterBus(&Harness, &Bus, File);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestBatchValidation);
+	RUN(TestBatchRunsInOrder);
+	RUN(TestBatchStopsOnError);
+
+	return TestResult();
+}
@@ -0,0 +1,257 @@
+/*++
+	Module Name:
+
+		selftest_dispatch.c
+
+	Abstract:
+
+		The self-test devices as a test application sees them: found by
+		their interface, opened with the access the device security
+		grants, and sent IOCTLs the dispatch engine looks up in the table
+		of the interface they came in on.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include <selftest\selftest.h>
+#include <selftest\enoselftest.h>
+
+static NTSTATUS
+Ioctl(
+	WDFFILEOBJECT File,
+	ULONG Code,
+	PVOID Input,
+	size_t InputLength,
+	PVOID Output,
+	size_t OutputLength,
+	ULONG_PTR* Information
+)
+{
+	WDFREQUEST Request;
+	NTSTATUS status;
+
+	Request = ShimRequestCreate(Code, Input, InputLength, Output, OutputLength);
+	if (Request == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	status = ShimDeviceIoControl(File, Request);
+
+	if (status == STATUS_PENDING) {
+		status = ShimRequestWait(Request, 2000);
+	}
+
+	if (Information != NULL) {
+		*Information = ShimRequest(Request)->Information;
+	}
+
+	WdfObjectDelete(Request);
+
+	return status;
+}
+
+static const TOUCH_TEST_IOCTL_STATS*
+FindStats(
+	const UCHAR* Buffer,
+	ULONG Code
+)
+{
+	const TOUCH_TEST_STATS* Stats = (const TOUCH_TEST_STATS*)Buffer;
+	const TOUCH_TEST_IOCTL_STATS* Entry = (const TOUCH_TEST_IOCTL_STATS*)(Stats + 1);
+	ULONG i;
+
+	for (i = 0; i < Stats->IoctlCount; i++) {
+		if (Entry[i].IoControlCode == Code) {
+			return &Entry[i];
+		}
+	}
+
+	return NULL;
+}
+
+static VOID
+TestSelfTestDispatch(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	static UCHAR StatsBuffer[sizeof(TOUCH_TEST_STATS) + 16 * sizeof(TOUCH_TEST_IOCTL_STATS)];
+	const TOUCH_TEST_IOCTL_STATS* Entry;
+	WDFDEVICE Device;
+	WDFFILEOBJECT File = NULL;
+	ULONG_PTR Information = 0;
+	BOOLEAN Mode;
+
+	TcmHarnessInitialize(&Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+
+	CHECK_SUCCESS(TchSelfTestInitialize(Harness.Device));
+
+	Device = ShimDeviceFind(&GUID_TOUCH_SELFTEST_INTERFACE);
+	CHECK(Device != NULL);
+	CHECK(WdfPdoGetParent(Device) == Harness.Device);
+
+	CHECK_SUCCESS(ShimDeviceOpen(Device, ShimCallerAdministrator, GENERIC_READ | GENERIC_WRITE, &File));
+	CHECK_EQ(Harness.DevContext->TestSessionRefCnt, 1);
+
+	CHECK_EQ(Ioctl(File, TOUCH_TEST_BUFFER_CTL_CODE(199), NULL, 0, NULL, 0, NULL),
+		STATUS_NOT_IMPLEMENTED);
+
+	//
+	// The mode takes exactly one BOOLEAN
+	//
+	CHECK_EQ(Ioctl(File, IOCTL_TOUCH_SELFTEST_MODE, NULL, 0, NULL, 0, NULL),
+		STATUS_INVALID_PARAMETER);
+
+	Mode = TRUE;
+	CHECK_SUCCESS(Ioctl(File, IOCTL_TOUCH_SELFTEST_MODE, &Mode, sizeof(Mode), NULL, 0, &Information));
+	CHECK_EQ(Information, sizeof(Mode));
+	CHECK_EQ(Harness.DevContext->DiagnosticMode, TRUE);
+
+	Mode = FALSE;
+	CHECK_SUCCESS(Ioctl(File, IOCTL_TOUCH_SELFTEST_MODE, &Mode, sizeof(Mode), NULL, 0, NULL));
+	CHECK_EQ(Harness.DevContext->DiagnosticMode, FALSE);
+
+	CHECK_EQ(Ioctl(File, IOCTL_TOUCH_SELFTEST_STATS, NULL, 0, StatsBuffer, sizeof(TOUCH_TEST_STATS), NULL),
+		STATUS_BUFFER_TOO_SMALL);
+
+	CHECK_SUCCESS(Ioctl(File, IOCTL_TOUCH_SELFTEST_STATS, NULL, 0, StatsBuffer, sizeof(StatsBuffer), &Information));
+	CHECK_EQ(((TOUCH_TEST_STATS*)StatsBuffer)->IoctlCount, 12);
+	CHECK_EQ(Information, sizeof(TOUCH_TEST_STATS) + 12 * sizeof(TOUCH_TEST_IOCTL_STATS));
+
+	Entry = FindStats(StatsBuffer, IOCTL_TOUCH_SELFTEST_MODE);
+	CHECK(Entry != NULL);
+	if (Entry != NULL) {
+		CHECK_EQ(Entry->Calls, 3);
+		CHECK_EQ(Entry->Failures, 1);
+	}
+
+	//
+	// The short stats request was counted before this one ran
+	//
+	Entry = FindStats(StatsBuffer, IOCTL_TOUCH_SELFTEST_STATS);
+	CHECK(Entry != NULL);
+	if (Entry != NULL) {
+		CHECK_EQ(Entry->Calls, 1);
+		CHECK_EQ(Entry->Failures, 1);
+	}
+
+	ShimDeviceClose(File);
+	CHECK_EQ(Harness.DevContext->TestSessionRefCnt, 0);
+
+	TcmHarnessStop(&Harness);
+
+	//
+	// The test devices are children of the touch device
+	//
+	CHECK(ShimDeviceFind(&GUID_TOUCH_SELFTEST_INTERFACE) == NULL);
+	CHECK(ShimDeviceFind(&GUID_TOUCH_ENOSELFTEST_INTERFACE) == NULL);
+}
+
+static VOID
+TestEnoSelfTestTable(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	static UCHAR StatsBuffer[sizeof(TOUCH_TEST_STATS) + 16 * sizeof(TOUCH_TEST_IOCTL_STATS)];
+	WDFDEVICE Device;
+	WDFFILEOBJECT File = NULL;
+	UCHAR Schema[64];
+
+	TcmHarnessInitialize(&Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+
+	CHECK_SUCCESS(TchSelfTestInitialize(Harness.Device));
+
+	Device = ShimDeviceFind(&GUID_TOUCH_ENOSELFTEST_INTERFACE);
+	CHECK(Device != NULL);
+
+	CHECK_SUCCESS(ShimDeviceOpen(Device, ShimCallerAdministrator, GENERIC_READ | GENERIC_WRITE, &File));
+
+	//
+	// Only the I2C pass-through, mode, page and stats codes exist here
+	//
+	CHECK_EQ(Ioctl(File, IOCTL_TOUCH_SELFTEST_DYNAMIC_CONFIG_SCHEMA, NULL, 0, Schema, sizeof(Schema), NULL),
+		STATUS_NOT_IMPLEMENTED);
+
+	CHECK_SUCCESS(Ioctl(File, IOCTL_TOUCH_ENOSELFTEST_STATS, NULL, 0, StatsBuffer, sizeof(StatsBuffer), NULL));
+	CHECK_EQ(((TOUCH_TEST_STATS*)StatsBuffer)->IoctlCount, 5);
+
+	ShimDeviceClose(File);
+
+	TcmHarnessStop(&Harness);
+}
+
+static VOID
+TestSelfTestSecurity(
+	VOID
+)
+{
+	static const GUID* Interfaces[] = {
+		&GUID_TOUCH_SELFTEST_INTERFACE,
+		&GUID_TOUCH_ENOSELFTEST_INTERFACE
+	};
+	static TCM_HARNESS Harness;
+	TOUCH_TEST_BUS_CAPTURE Capture;
+	WDFDEVICE Device;
+	WDFFILEOBJECT File = NULL;
+	ULONG i;
+
+	TcmHarnessInitialize(&Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+
+	CHECK_SUCCESS(TchSelfTestInitialize(Harness.Device));
+
+	//
+	// Both devices reach the bus, users may not open either
+	//
+	for (i = 0; i < RTL_NUMBER_OF(Interfaces); i++) {
+		Device = ShimDeviceFind(Interfaces[i]);
+		CHECK(Device != NULL);
+
+		CHECK_EQ(ShimDeviceOpen(Device, ShimCallerUser, GENERIC_READ, &File), STATUS_ACCESS_DENIED);
+		CHECK_EQ(ShimDeviceOpen(Device, ShimCallerUser, GENERIC_READ | GENERIC_WRITE, &File),
+			STATUS_ACCESS_DENIED);
+
+		CHECK_SUCCESS(ShimDeviceOpen(Device, ShimCallerSystem, GENERIC_READ | GENERIC_WRITE, &File));
+		ShimDeviceClose(File);
+	}
+
+	CHECK_EQ(Harness.DevContext->TestSessionRefCnt, 0);
+
+	//
+	// Bus capture needs a handle opened for writing, and is off unless
+	// the registry turns it on
+	//
+	Device = ShimDeviceFind(&GUID_TOUCH_SELFTEST_INTERFACE);
+
+	CHECK_SUCCESS(ShimDeviceOpen(Device, ShimCallerAdministrator, GENERIC_READ, &File));
+	CHECK_EQ(Ioctl(File, IOCTL_TOUCH_SELFTEST_BUS_CAPTURE, NULL, 0, &Capture, sizeof(Capture), NULL),
+		STATUS_ACCESS_DENIED);
+	ShimDeviceClose(File);
+
+	CHECK_SUCCESS(ShimDeviceOpen(Device, ShimCallerAdministrator, GENERIC_READ | GENERIC_WRITE, &File));
+	CHECK_EQ(Ioctl(File, IOCTL_TOUCH_SELFTEST_BUS_CAPTURE, NULL, 0, &Capture, sizeof(Capture), NULL),
+		STATUS_NOT_SUPPORTED);
+	ShimDeviceClose(File);
+
+	TcmHarnessStop(&Harness);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestSelfTestDispatch);
+	RUN(TestEnoSelfTestTable);
+	RUN(TestSelfTestSecurity);
+
+	return TestResult();
+}
@@ -0,0 +1,356 @@
+/*++
+	Module Name:
+
+		servicing.c
+
+	Abstract:
+
+		The servicing thread against a controller whose attention line
+		storms with empty interrupts or stays silent, in ServicingMode 1
+		(interrupts handed to the thread, polling as a fallback) and 2
+		(polling only). Every frame sent at the poll rate has to come
+		through, and the polls have to keep their deadlines. Also covers
+		handoffs the ISR takes back after timing out, which must not
+		count as empty interrupts.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "hid_sink.h"
+#include "registry.h"
+#include <unistd.h>
+
+#define FRAMES 60
+#define FRAME_US (1000000 / SERVICING_POLL_RATE)
+
+//
+// Ten times the default storm threshold
+//
+#define STORM_US 200
+
+//
+// Covers the watchdog read of a silent line and catching up after it
+//
+#define DRAIN_TIMEOUT_MS (SERVICING_WATCHDOG_INTERVAL * 3)
+
+typedef enum _LINE
+{
+	LINE_STORMING,
+	LINE_SILENT
+} LINE;
+
+typedef struct _STORM
+{
+	TCM_HARNESS* Harness;
+	pthread_t Thread;
+	BOOLEAN Running;
+	volatile LONG Stop;
+	ULONG Interrupts;
+} STORM;
+
+//
+// An attention line that fires whether or not the controller has
+// anything to say. Stands in for the harness interrupt thread, the ISR
+// is never entered twice at once.
+//
+static void*
+StormThread(
+	void* Context
+)
+{
+	STORM* Storm = Context;
+
+	while (!Storm->Stop) {
+		TcmServiceInterrupts(Storm->Harness->Controller,
+			Storm->Harness->Spb,
+			&Storm->Harness->DevContext->ReportContext);
+		Storm->Interrupts++;
+		usleep(STORM_US);
+	}
+
+	return NULL;
+}
+
+static VOID
+Start(
+	TCM_HARNESS* Harness,
+	STORM* Storm,
+	ULONG Mode,
+	LINE Line
+)
+{
+	ShimRegistrySetDword(L"ServicingMode", Mode);
+
+	TcmHarnessInitialize(Harness);
+	CHECK_SUCCESS(TcmHarnessStart(Harness, TRUE, 2000));
+	CHECK(Harness->Controller->Servicing.Thread != NULL);
+
+	//
+	// Bring-up ran with a working line, it goes bad from here on
+	//
+	TcmHarnessDisconnectInterrupt(Harness);
+
+	memset(Storm, 0, sizeof(*Storm));
+	Storm->Harness = Harness;
+
+	if (Line == LINE_STORMING) {
+		Storm->Running = pthread_create(&Storm->Thread, NULL, StormThread, Storm) == 0;
+		CHECK(Storm->Running);
+	}
+
+	FakeHidReset();
+}
+
+static VOID
+Stop(
+	TCM_HARNESS* Harness,
+	STORM* Storm
+)
+{
+	if (Storm->Running) {
+		InterlockedExchange(&Storm->Stop, TRUE);
+		pthread_join(Storm->Thread, NULL);
+	}
+
+	TcmHarnessStop(Harness);
+	ShimRegistryClear();
+}
+
+//
+// Sends FRAMES touch frames at the poll rate and returns how many of
+// them never made it to a HID report
+//
+static ULONG
+Frames(
+	TCM_HARNESS* Harness
+)
+{
+	FAKE_TCM_OBJECT Object = { 0, 1, 100, 1000 };
+	ULONG Reports = FakeHidReports();
+	ULONG i;
+
+	for (i = 0; i < FRAMES; i++) {
+		Object.X = (UINT16)(100 + i * 10);
+		FakeTcmQueueTouch(&Harness->Tcm, &Object, 1);
+		usleep(FRAME_US);
+	}
+
+	CHECK(TcmHarnessDrain(Harness, DRAIN_TIMEOUT_MS));
+	usleep(2 * FRAME_US);
+
+	return FRAMES - (FakeHidReports() - Reports);
+}
+
+static VOID
+PrintServicing(
+	const char* Name,
+	const TCM_SERVICING* Servicing,
+	ULONG Sent,
+	ULONG Received
+)
+{
+	printf("  %-24s %u/%u frames lost, %u handoffs (%u empty), %u fallbacks, %u polls, late avg %u us, max %u us\n",
+		Name,
+		Sent - Received,
+		Sent,
+		Servicing->Handoffs,
+		Servicing->EmptyInterrupts,
+		Servicing->Fallbacks,
+		Servicing->Polls,
+		Servicing->Polls != 0 ? (ULONG)(Servicing->TotalPollLateUs / Servicing->Polls) : 0,
+		Servicing->MaxPollLateUs);
+}
+
+//
+// Polls have to land within a frame of their deadline on average
+//
+static VOID
+CheckPollLateness(
+	const TCM_SERVICING* Servicing
+)
+{
+	CHECK(Servicing->Polls != 0);
+	CHECK(Servicing->TotalPollLateUs / MAX(Servicing->Polls, 1) < FRAME_US);
+}
+
+static VOID
+TestThreadStorming(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	STORM Storm;
+	TCM_SERVICING* Servicing;
+	ULONG Lost;
+
+	Start(&Harness, &Storm, SERVICING_MODE_THREAD, LINE_STORMING);
+	Servicing = &Harness.Controller->Servicing;
+
+	Lost = Frames(&Harness);
+	PrintServicing("thread, storming line", Servicing, FRAMES, FRAMES - Lost);
+
+	CHECK_EQ(Lost, 0);
+	CHECK(Servicing->EmptyInterrupts > Servicing->StormThreshold);
+	CHECK_EQ(Servicing->Fallbacks, 1);
+	CHECK_EQ(Servicing->Polling, TRUE);
+	CheckPollLateness(Servicing);
+
+	Stop(&Harness, &Storm);
+}
+
+static VOID
+TestThreadSilent(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	STORM Storm;
+	TCM_SERVICING* Servicing;
+	ULONG Lost;
+
+	Start(&Harness, &Storm, SERVICING_MODE_THREAD, LINE_SILENT);
+	Servicing = &Harness.Controller->Servicing;
+
+	//
+	// The watchdog finds the frames the line never told us about, and
+	// the polls catch up on the backlog
+	//
+	Lost = Frames(&Harness);
+	PrintServicing("thread, silent line", Servicing, FRAMES, FRAMES - Lost);
+
+	CHECK_EQ(Lost, 0);
+	CHECK_EQ(Servicing->MissedInterrupts, 1);
+	CHECK_EQ(Servicing->Fallbacks, 1);
+	CHECK_EQ(Servicing->Polling, TRUE);
+	CheckPollLateness(Servicing);
+
+	Stop(&Harness, &Storm);
+}
+
+static VOID
+TestPollStorming(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	STORM Storm;
+	TCM_SERVICING* Servicing;
+	ULONG Lost;
+
+	//
+	// Polling from the start, the ISR reads inline and the thread
+	// never gets a handoff
+	//
+	Start(&Harness, &Storm, SERVICING_MODE_POLL, LINE_STORMING);
+	Servicing = &Harness.Controller->Servicing;
+
+	Lost = Frames(&Harness);
+	PrintServicing("poll, storming line", Servicing, FRAMES, FRAMES - Lost);
+
+	CHECK_EQ(Lost, 0);
+	CHECK(Storm.Interrupts != 0);
+	CHECK_EQ(Servicing->Handoffs, 0);
+	CHECK_EQ(Servicing->Fallbacks, 0);
+	CheckPollLateness(Servicing);
+
+	Stop(&Harness, &Storm);
+}
+
+static VOID
+TestPollSilent(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	STORM Storm;
+	TCM_SERVICING* Servicing;
+	ULONG Lost;
+
+	Start(&Harness, &Storm, SERVICING_MODE_POLL, LINE_SILENT);
+	Servicing = &Harness.Controller->Servicing;
+
+	Lost = Frames(&Harness);
+	PrintServicing("poll, silent line", Servicing, FRAMES, FRAMES - Lost);
+
+	CHECK_EQ(Lost, 0);
+	CHECK_EQ(Servicing->MissedInterrupts, 0);
+	CHECK_EQ(Servicing->Fallbacks, 0);
+	CHECK(Servicing->PolledMessages >= FRAMES);
+	CheckPollLateness(Servicing);
+
+	Stop(&Harness, &Storm);
+}
+
+static VOID
+TestHandoffTimeout(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	STORM Storm;
+	TCM_SERVICING* Servicing;
+	TCM_SERVICING Before;
+	FAKE_TCM_OBJECT Object = { 0, 1, 300, 600 };
+	ULONG Reports;
+
+	//
+	// A single empty interrupt would be a storm
+	//
+	ShimRegistrySetDword(L"ServicingStormThreshold", 0);
+
+	Start(&Harness, &Storm, SERVICING_MODE_THREAD, LINE_SILENT);
+	Servicing = &Harness.Controller->Servicing;
+	CHECK_SUCCESS(TcmHarnessConnectInterrupt(&Harness));
+
+	Reports = FakeHidReports();
+	Before = *Servicing;
+
+	//
+	// Hold the bus until the thread is stuck in its watchdog read, then
+	// raise an interrupt it cannot get to. The ISR gives up waiting and
+	// reads the message itself once the bus is free.
+	//
+	WdfWaitLockAcquire(Harness.Controller->ControllerLock, NULL);
+	usleep((SERVICING_WATCHDOG_INTERVAL + 100) * 1000);
+	FakeTcmQueueTouch(&Harness.Tcm, &Object, 1);
+	usleep(SERVICING_HANDOFF_TIMEOUT * 2 * 1000);
+	WdfWaitLockRelease(Harness.Controller->ControllerLock);
+
+	CHECK(TcmHarnessDrain(&Harness, 1000));
+	usleep(20000);
+
+	PrintServicing("handoff timeout", Servicing, 1, FakeHidReports() - Reports);
+
+	//
+	// The thread wakes up to a handoff that is gone, it neither reads
+	// nor counts it
+	//
+	CHECK_EQ(FakeHidReports(), Reports + 1);
+	CHECK_EQ(Servicing->HandoffTimeouts, Before.HandoffTimeouts + 1);
+	CHECK_EQ(Servicing->Handoffs, Before.Handoffs);
+	CHECK_EQ(Servicing->EmptyInterrupts, Before.EmptyInterrupts);
+	CHECK_EQ(Servicing->MissedInterrupts, Before.MissedInterrupts);
+	CHECK_EQ(Servicing->Fallbacks, Before.Fallbacks);
+	CHECK_EQ(Servicing->Polling, FALSE);
+
+	Stop(&Harness, &Storm);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestThreadStorming);
+	RUN(TestThreadSilent);
+	RUN(TestPollStorming);
+	RUN(TestPollSilent);
+	RUN(TestHandoffTimeout);
+
+	return TestResult();
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <wdm.h>
+
+DEFINE_GUID(GUID_DEVCLASS_HIDCLASS,
+	0x745a17a0, 0x74d3, 0x11d0, 0xb6, 0xfe, 0x00, 0xa0, 0xc9, 0x0f, 0x57, 0xda);
@@ -0,0 +1,40 @@
+/*++
+	Module Name:
+
+		evntrace.h
+
+	Abstract:
+
+		Trace levels and a Trace() that takes the place of the one the
+		WPP preprocessor generates. Messages are dropped unless
+		SHIM_TRACE is set in the environment, and the format is not
+		interpreted since it uses the WPP specifiers.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#define TRACE_LEVEL_NONE        0
+#define TRACE_LEVEL_CRITICAL    1
+#define TRACE_LEVEL_FATAL       1
+#define TRACE_LEVEL_ERROR       2
+#define TRACE_LEVEL_WARNING     3
+#define TRACE_LEVEL_INFORMATION 4
+#define TRACE_LEVEL_VERBOSE     5
+
+void
+ShimTrace(
+	int Level,
+	const char* Flag,
+	const char* Format,
+	...
+);
+
+#define Trace(Level, Flag, ...) ShimTrace((Level), #Flag, __VA_ARGS__)
+
+#define WPP_INIT_TRACING(DriverObject, RegistryPath) ((void)0)
+#define WPP_CLEANUP(DriverObject) ((void)0)
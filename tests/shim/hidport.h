@@ -0,0 +1,13 @@
+/*++
+	Module Name:
+
+		hidport.h
+
+	Abstract:
+
+		Nothing of the HID class driver interface is used by the
+		sources built for the tests.
+
+--*/
+
+#pragma once
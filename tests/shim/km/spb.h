@@ -0,0 +1,104 @@
+/*++
+	Module Name:
+
+		spb.h
+
+	Abstract:
+
+		The SPB sequence IOCTL and transfer lists of the WDK header of
+		the same name, as far as the driver's spb.c uses them.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+
+#define IOCTL_SPB_EXECUTE_SEQUENCE CTL_CODE(0x12, 0x0002, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+typedef enum _SPB_TRANSFER_DIRECTION
+{
+	SpbTransferDirectionNone,
+	SpbTransferDirectionFromDevice,
+	SpbTransferDirectionToDevice,
+	SpbTransferDirectionMax
+} SPB_TRANSFER_DIRECTION;
+
+typedef enum _SPB_TRANSFER_BUFFER_FORMAT
+{
+	SpbTransferBufferFormatInvalid,
+	SpbTransferBufferFormatSimple,
+	SpbTransferBufferFormatList,
+	SpbTransferBufferFormatSimpleNonPaged,
+	SpbTransferBufferFormatMdl,
+	SpbTransferBufferFormatMax
+} SPB_TRANSFER_BUFFER_FORMAT;
+
+typedef struct _SPB_TRANSFER_BUFFER
+{
+	SPB_TRANSFER_BUFFER_FORMAT Format;
+	union
+	{
+		struct
+		{
+			PVOID Buffer;
+			ULONG BufferCb;
+		} Simple;
+	};
+} SPB_TRANSFER_BUFFER;
+
+typedef struct _SPB_TRANSFER_LIST_ENTRY
+{
+	SPB_TRANSFER_DIRECTION Direction;
+	ULONG DelayInUs;
+	SPB_TRANSFER_BUFFER Buffer;
+} SPB_TRANSFER_LIST_ENTRY;
+
+typedef struct _SPB_TRANSFER_LIST
+{
+	ULONG Size;
+	ULONG Reserved;
+	ULONG TransferCount;
+	SPB_TRANSFER_LIST_ENTRY Transfers[1];
+} SPB_TRANSFER_LIST;
+
+#define SPB_TRANSFER_LIST_AND_ENTRIES(n) \
+	struct \
+	{ \
+		SPB_TRANSFER_LIST List; \
+		SPB_TRANSFER_LIST_ENTRY MoreEntries[(n) - 1]; \
+	}
+
+FORCEINLINE VOID
+SPB_TRANSFER_LIST_INIT(
+	SPB_TRANSFER_LIST* List,
+	ULONG TransferCount
+)
+{
+	List->Size = sizeof(SPB_TRANSFER_LIST);
+	List->Reserved = 0;
+	List->TransferCount = TransferCount;
+}
+
+FORCEINLINE SPB_TRANSFER_LIST_ENTRY
+SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+	SPB_TRANSFER_DIRECTION Direction,
+	ULONG DelayInUs,
+	PVOID Buffer,
+	ULONG BufferCb
+)
+{
+	SPB_TRANSFER_LIST_ENTRY Entry;
+
+	Entry.Direction = Direction;
+	Entry.DelayInUs = DelayInUs;
+	Entry.Buffer.Format = SpbTransferBufferFormatSimple;
+	Entry.Buffer.Simple.Buffer = Buffer;
+	Entry.Buffer.Simple.BufferCb = BufferCb;
+
+	return Entry;
+}
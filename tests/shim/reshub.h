@@ -0,0 +1,13 @@
+/*++
+	Module Name:
+
+		reshub.h
+
+	Abstract:
+
+		Nothing of the resource hub interface is used by the sources
+		built for the tests.
+
+--*/
+
+#pragma once
@@ -0,0 +1,987 @@
+/*++
+	Module Name:
+
+		wdf.h
+
+	Abstract:
+
+		The part of KMDF the driver sources use, for building them as
+		user mode programs on Linux. Every handle is a SHIM_OBJECT with
+		an optional context. Wait locks, work items and timers run on
+		pthreads; requests and I/O targets are only as deep as the
+		tests need them.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+
+typedef struct _SHIM_OBJECT* WDFOBJECT;
+typedef WDFOBJECT WDFDRIVER;
+typedef WDFOBJECT WDFDEVICE;
+typedef WDFOBJECT WDFWAITLOCK;
+typedef WDFOBJECT WDFSPINLOCK;
+typedef WDFOBJECT WDFWORKITEM;
+typedef WDFOBJECT WDFTIMER;
+typedef WDFOBJECT WDFREQUEST;
+typedef WDFOBJECT WDFQUEUE;
+typedef WDFOBJECT WDFMEMORY;
+typedef WDFOBJECT WDFIOTARGET;
+typedef WDFOBJECT WDFINTERRUPT;
+typedef WDFOBJECT WDFFILEOBJECT;
+typedef WDFOBJECT WDFKEY;
+typedef WDFOBJECT WDFSTRING;
+typedef WDFOBJECT WDFCOLLECTION;
+typedef struct _WDFDEVICE_INIT* PWDFDEVICE_INIT;
+
+typedef VOID EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL(
+	WDFQUEUE Queue,
+	WDFREQUEST Request,
+	size_t OutputBufferLength,
+	size_t InputBufferLength,
+	ULONG IoControlCode);
+
+typedef VOID EVT_WDF_DEVICE_FILE_CREATE(
+	WDFDEVICE Device,
+	WDFREQUEST Request,
+	WDFFILEOBJECT FileObject);
+
+typedef VOID EVT_WDF_FILE_CLOSE(
+	WDFFILEOBJECT FileObject);
+
+typedef size_t WDF_CONTEXT_SIZE;
+
+typedef struct _WDF_OBJECT_CONTEXT_TYPE_INFO
+{
+	const char* ContextName;
+	size_t ContextSize;
+} WDF_OBJECT_CONTEXT_TYPE_INFO, *PWDF_OBJECT_CONTEXT_TYPE_INFO;
+
+typedef const WDF_OBJECT_CONTEXT_TYPE_INFO* PCWDF_OBJECT_CONTEXT_TYPE_INFO;
+
+typedef VOID EVT_WDF_OBJECT_CONTEXT_CLEANUP(WDFOBJECT Object);
+typedef EVT_WDF_OBJECT_CONTEXT_CLEANUP* PFN_WDF_OBJECT_CONTEXT_CLEANUP;
+typedef VOID EVT_WDF_OBJECT_CONTEXT_DESTROY(WDFOBJECT Object);
+typedef EVT_WDF_OBJECT_CONTEXT_DESTROY* PFN_WDF_OBJECT_CONTEXT_DESTROY;
+
+typedef enum _WDF_EXECUTION_LEVEL
+{
+	WdfExecutionLevelInvalid,
+	WdfExecutionLevelInheritFromParent,
+	WdfExecutionLevelPassive,
+	WdfExecutionLevelDispatch
+} WDF_EXECUTION_LEVEL;
+
+typedef enum _WDF_SYNCHRONIZATION_SCOPE
+{
+	WdfSynchronizationScopeInvalid,
+	WdfSynchronizationScopeInheritFromParent,
+	WdfSynchronizationScopeDevice,
+	WdfSynchronizationScopeQueue,
+	WdfSynchronizationScopeNone
+} WDF_SYNCHRONIZATION_SCOPE;
+
+typedef struct _WDF_OBJECT_ATTRIBUTES
+{
+	ULONG Size;
+	PFN_WDF_OBJECT_CONTEXT_CLEANUP EvtCleanupCallback;
+	PFN_WDF_OBJECT_CONTEXT_DESTROY EvtDestroyCallback;
+	WDF_EXECUTION_LEVEL ExecutionLevel;
+	WDF_SYNCHRONIZATION_SCOPE SynchronizationScope;
+	WDFOBJECT ParentObject;
+	size_t ContextSizeOverride;
+	PCWDF_OBJECT_CONTEXT_TYPE_INFO ContextTypeInfo;
+} WDF_OBJECT_ATTRIBUTES, *PWDF_OBJECT_ATTRIBUTES;
+
+#define WDF_NO_OBJECT_ATTRIBUTES NULL
+#define WDF_NO_HANDLE NULL
+#define WDF_NO_EVENT_CALLBACK NULL
+#define WDF_NO_SEND_OPTIONS NULL
+
+FORCEINLINE VOID
+WDF_OBJECT_ATTRIBUTES_INIT(
+	PWDF_OBJECT_ATTRIBUTES Attributes
+)
+{
+	RtlZeroMemory(Attributes, sizeof(*Attributes));
+	Attributes->Size = sizeof(*Attributes);
+	Attributes->ExecutionLevel = WdfExecutionLevelInheritFromParent;
+	Attributes->SynchronizationScope = WdfSynchronizationScopeInheritFromParent;
+}
+
+#define WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(_contexttype, _castingfunction) \
+	static const WDF_OBJECT_CONTEXT_TYPE_INFO \
+		WDF_##_contexttype##_TYPE_INFO = { #_contexttype, sizeof(_contexttype) }; \
+	static inline _contexttype* _castingfunction(WDFOBJECT Handle) \
+	{ \
+		return (_contexttype*)ShimObjectGetContext(Handle, &WDF_##_contexttype##_TYPE_INFO); \
+	}
+
+#define WDF_DECLARE_CONTEXT_TYPE(_contexttype) \
+	WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(_contexttype, WdfObjectGet_##_contexttype)
+
+#define WDF_GET_CONTEXT_TYPE_INFO(_contexttype) (&WDF_##_contexttype##_TYPE_INFO)
+
+#define WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(_attributes, _contexttype) \
+	((_attributes)->ContextTypeInfo = WDF_GET_CONTEXT_TYPE_INFO(_contexttype))
+
+#define WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(_attributes, _contexttype) \
+	(WDF_OBJECT_ATTRIBUTES_INIT(_attributes), \
+	 WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(_attributes, _contexttype))
+
+PVOID
+ShimObjectGetContext(
+	WDFOBJECT Handle,
+	PCWDF_OBJECT_CONTEXT_TYPE_INFO TypeInfo
+);
+
+WDFOBJECT
+ShimObjectCreate(
+	PWDF_OBJECT_ATTRIBUTES Attributes,
+	size_t Extra
+);
+
+PVOID
+ShimObjectExtra(
+	WDFOBJECT Handle
+);
+
+NTSTATUS
+WdfObjectAllocateContext(
+	WDFOBJECT Handle,
+	PWDF_OBJECT_ATTRIBUTES ContextAttributes,
+	PVOID* Context
+);
+
+VOID
+WdfObjectDelete(
+	WDFOBJECT Object
+);
+
+WDFOBJECT
+WdfObjectGetParent(
+	WDFOBJECT Object
+);
+
+//
+// Timeouts, relative ones are negative 100 ns units
+//
+
+#define WDF_REL_TIMEOUT_IN_MS(Time) ((LONGLONG)(Time) * -10000LL)
+#define WDF_REL_TIMEOUT_IN_US(Time) ((LONGLONG)(Time) * -10LL)
+#define WDF_REL_TIMEOUT_IN_SEC(Time) ((LONGLONG)(Time) * -10000000LL)
+
+//
+// Wait locks
+//
+
+NTSTATUS
+WdfWaitLockCreate(
+	PWDF_OBJECT_ATTRIBUTES LockAttributes,
+	WDFWAITLOCK* Lock
+);
+
+NTSTATUS
+WdfWaitLockAcquire(
+	WDFWAITLOCK Lock,
+	PLONGLONG Timeout
+);
+
+VOID
+WdfWaitLockRelease(
+	WDFWAITLOCK Lock
+);
+
+//
+// Work items, each runs on a thread of its own
+//
+
+typedef VOID EVT_WDF_WORKITEM(WDFWORKITEM WorkItem);
+typedef EVT_WDF_WORKITEM* PFN_WDF_WORKITEM;
+
+typedef struct _WDF_WORKITEM_CONFIG
+{
+	ULONG Size;
+	PFN_WDF_WORKITEM EvtWorkItemFunc;
+	BOOLEAN AutomaticSerialization;
+} WDF_WORKITEM_CONFIG, *PWDF_WORKITEM_CONFIG;
+
+FORCEINLINE VOID
+WDF_WORKITEM_CONFIG_INIT(
+	PWDF_WORKITEM_CONFIG Config,
+	PFN_WDF_WORKITEM EvtWorkItemFunc
+)
+{
+	RtlZeroMemory(Config, sizeof(*Config));
+	Config->Size = sizeof(*Config);
+	Config->EvtWorkItemFunc = EvtWorkItemFunc;
+	Config->AutomaticSerialization = TRUE;
+}
+
+NTSTATUS
+WdfWorkItemCreate(
+	PWDF_WORKITEM_CONFIG Config,
+	PWDF_OBJECT_ATTRIBUTES Attributes,
+	WDFWORKITEM* WorkItem
+);
+
+VOID
+WdfWorkItemEnqueue(
+	WDFWORKITEM WorkItem
+);
+
+VOID
+WdfWorkItemFlush(
+	WDFWORKITEM WorkItem
+);
+
+WDFOBJECT
+WdfWorkItemGetParentObject(
+	WDFWORKITEM WorkItem
+);
+
+//
+// Timers, one-shot or periodic on a thread of their own
+//
+
+typedef VOID EVT_WDF_TIMER(WDFTIMER Timer);
+typedef EVT_WDF_TIMER* PFN_WDF_TIMER;
+
+typedef struct _WDF_TIMER_CONFIG
+{
+	ULONG Size;
+	PFN_WDF_TIMER EvtTimerFunc;
+	ULONG Period;
+	BOOLEAN AutomaticSerialization;
+	ULONG TolerableDelay;
+	BOOLEAN UseHighResolutionTimer;
+} WDF_TIMER_CONFIG, *PWDF_TIMER_CONFIG;
+
+FORCEINLINE VOID
+WDF_TIMER_CONFIG_INIT(
+	PWDF_TIMER_CONFIG Config,
+	PFN_WDF_TIMER EvtTimerFunc
+)
+{
+	RtlZeroMemory(Config, sizeof(*Config));
+	Config->Size = sizeof(*Config);
+	Config->EvtTimerFunc = EvtTimerFunc;
+	Config->AutomaticSerialization = TRUE;
+}
+
+FORCEINLINE VOID
+WDF_TIMER_CONFIG_INIT_PERIODIC(
+	PWDF_TIMER_CONFIG Config,
+	PFN_WDF_TIMER EvtTimerFunc,
+	LONG Period
+)
+{
+	WDF_TIMER_CONFIG_INIT(Config, EvtTimerFunc);
+	Config->Period = Period;
+}
+
+NTSTATUS
+WdfTimerCreate(
+	PWDF_TIMER_CONFIG Config,
+	PWDF_OBJECT_ATTRIBUTES Attributes,
+	WDFTIMER* Timer
+);
+
+BOOLEAN
+WdfTimerStart(
+	WDFTIMER Timer,
+	LONGLONG DueTime
+);
+
+BOOLEAN
+WdfTimerStop(
+	WDFTIMER Timer,
+	BOOLEAN Wait
+);
+
+WDFOBJECT
+WdfTimerGetParentObject(
+	WDFTIMER Timer
+);
+
+//
+// Memory objects
+//
+
+NTSTATUS
+WdfMemoryCreate(
+	PWDF_OBJECT_ATTRIBUTES Attributes,
+	POOL_TYPE PoolType,
+	ULONG PoolTag,
+	size_t BufferSize,
+	WDFMEMORY* Memory,
+	PVOID* Buffer
+);
+
+PVOID
+WdfMemoryGetBuffer(
+	WDFMEMORY Memory,
+	size_t* BufferSize
+);
+
+//
+// Memory objects created so far, for allocation counts
+//
+LONG
+ShimMemoryCreated(
+	VOID
+);
+
+typedef enum _WDF_MEMORY_DESCRIPTOR_TYPE
+{
+	WdfMemoryDescriptorTypeInvalid,
+	WdfMemoryDescriptorTypeBuffer,
+	WdfMemoryDescriptorTypeMdl,
+	WdfMemoryDescriptorTypeHandle
+} WDF_MEMORY_DESCRIPTOR_TYPE;
+
+typedef struct _WDF_MEMORY_DESCRIPTOR
+{
+	WDF_MEMORY_DESCRIPTOR_TYPE Type;
+	union
+	{
+		struct
+		{
+			PVOID Buffer;
+			ULONG Length;
+		} BufferType;
+		struct
+		{
+			WDFMEMORY Memory;
+			PVOID Offsets;
+		} HandleType;
+	} u;
+} WDF_MEMORY_DESCRIPTOR, *PWDF_MEMORY_DESCRIPTOR;
+
+FORCEINLINE VOID
+WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
+	PWDF_MEMORY_DESCRIPTOR Descriptor,
+	PVOID Buffer,
+	ULONG BufferLength
+)
+{
+	RtlZeroMemory(Descriptor, sizeof(*Descriptor));
+	Descriptor->Type = WdfMemoryDescriptorTypeBuffer;
+	Descriptor->u.BufferType.Buffer = Buffer;
+	Descriptor->u.BufferType.Length = BufferLength;
+}
+
+FORCEINLINE VOID
+WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
+	PWDF_MEMORY_DESCRIPTOR Descriptor,
+	WDFMEMORY Memory,
+	PVOID Offsets
+)
+{
+	RtlZeroMemory(Descriptor, sizeof(*Descriptor));
+	Descriptor->Type = WdfMemoryDescriptorTypeHandle;
+	Descriptor->u.HandleType.Memory = Memory;
+	Descriptor->u.HandleType.Offsets = Offsets;
+}
+
+//
+// Requests. A test builds one with ShimRequestCreate and finds the
+// status and information it was completed with in the request.
+//
+
+typedef struct _SHIM_REQUEST
+{
+	ULONG IoControlCode;
+	PVOID InputBuffer;
+	size_t InputLength;
+	PVOID OutputBuffer;
+	size_t OutputLength;
+	MDL OutputMdl;
+	WDFQUEUE Queue;
+	BOOLEAN Completed;
+	BOOLEAN Cancelable;
+	BOOLEAN Cancelled;
+	NTSTATUS Status;
+	ULONG_PTR Information;
+	PVOID CancelRoutine;
+	PVOID CompletionRoutine;
+	PVOID CompletionContext;
+	PUCHAR ReadBuffer;
+	ULONG ReadLength;
+	BOOLEAN Sent;
+	WDFFILEOBJECT FileObject;
+	PVOID SystemBuffer;
+	PVOID UserOutputBuffer;
+} SHIM_REQUEST;
+
+WDFREQUEST
+ShimRequestCreate(
+	ULONG IoControlCode,
+	PVOID InputBuffer,
+	size_t InputLength,
+	PVOID OutputBuffer,
+	size_t OutputLength
+);
+
+SHIM_REQUEST*
+ShimRequest(
+	WDFREQUEST Request
+);
+
+typedef VOID EVT_WDF_REQUEST_CANCEL(WDFREQUEST Request);
+typedef EVT_WDF_REQUEST_CANCEL* PFN_WDF_REQUEST_CANCEL;
+
+VOID
+ShimRequestCancel(
+	WDFREQUEST Request
+);
+
+NTSTATUS
+WdfRequestRetrieveInputBuffer(
+	WDFREQUEST Request,
+	size_t MinimumRequiredLength,
+	PVOID* Buffer,
+	size_t* Length
+);
+
+NTSTATUS
+WdfRequestRetrieveOutputBuffer(
+	WDFREQUEST Request,
+	size_t MinimumRequiredSize,
+	PVOID* Buffer,
+	size_t* Length
+);
+
+NTSTATUS
+WdfRequestRetrieveOutputWdmMdl(
+	WDFREQUEST Request,
+	PMDL* Mdl
+);
+
+VOID
+WdfRequestComplete(
+	WDFREQUEST Request,
+	NTSTATUS Status
+);
+
+VOID
+WdfRequestCompleteWithInformation(
+	WDFREQUEST Request,
+	NTSTATUS Status,
+	ULONG_PTR Information
+);
+
+VOID
+WdfRequestSetInformation(
+	WDFREQUEST Request,
+	ULONG_PTR Information
+);
+
+NTSTATUS
+WdfRequestMarkCancelableEx(
+	WDFREQUEST Request,
+	PFN_WDF_REQUEST_CANCEL EvtRequestCancel
+);
+
+NTSTATUS
+WdfRequestUnmarkCancelable(
+	WDFREQUEST Request
+);
+
+WDFQUEUE
+WdfRequestGetIoQueue(
+	WDFREQUEST Request
+);
+
+WDFDEVICE
+WdfIoQueueGetDevice(
+	WDFQUEUE Queue
+);
+
+WDFDEVICE
+WdfFileObjectGetDevice(
+	WDFFILEOBJECT FileObject
+);
+
+WDFDEVICE
+WdfPdoGetParent(
+	WDFDEVICE Device
+);
+
+//
+// Devices and queues. A PDO init becomes a device with WdfDeviceCreate;
+// tests find it by its interface, open it and send it IOCTLs the way
+// the I/O manager does, with the access checks of the device security
+// and the IOCTL code and the buffer handling of its transfer method.
+//
+
+typedef struct _WDF_FILEOBJECT_CONFIG
+{
+	ULONG Size;
+	EVT_WDF_DEVICE_FILE_CREATE* EvtDeviceFileCreate;
+	EVT_WDF_FILE_CLOSE* EvtFileClose;
+	PVOID EvtFileCleanup;
+} WDF_FILEOBJECT_CONFIG, *PWDF_FILEOBJECT_CONFIG;
+
+FORCEINLINE VOID
+WDF_FILEOBJECT_CONFIG_INIT(
+	PWDF_FILEOBJECT_CONFIG Config,
+	EVT_WDF_DEVICE_FILE_CREATE* EvtDeviceFileCreate,
+	EVT_WDF_FILE_CLOSE* EvtFileClose,
+	PVOID EvtFileCleanup
+)
+{
+	RtlZeroMemory(Config, sizeof(*Config));
+	Config->Size = sizeof(*Config);
+	Config->EvtDeviceFileCreate = EvtDeviceFileCreate;
+	Config->EvtFileClose = EvtFileClose;
+	Config->EvtFileCleanup = EvtFileCleanup;
+}
+
+PWDFDEVICE_INIT
+WdfPdoInitAllocate(
+	WDFDEVICE ParentDevice
+);
+
+VOID
+WdfDeviceInitFree(
+	PWDFDEVICE_INIT DeviceInit
+);
+
+NTSTATUS
+WdfDeviceInitAssignSDDLString(
+	PWDFDEVICE_INIT DeviceInit,
+	PCUNICODE_STRING SDDLString
+);
+
+NTSTATUS
+WdfPdoInitAssignRawDevice(
+	PWDFDEVICE_INIT DeviceInit,
+	const GUID* DeviceClassGuid
+);
+
+NTSTATUS
+WdfPdoInitAssignDeviceID(
+	PWDFDEVICE_INIT DeviceInit,
+	PCUNICODE_STRING DeviceID
+);
+
+NTSTATUS
+WdfPdoInitAddHardwareID(
+	PWDFDEVICE_INIT DeviceInit,
+	PCUNICODE_STRING HardwareID
+);
+
+NTSTATUS
+WdfPdoInitAssignInstanceID(
+	PWDFDEVICE_INIT DeviceInit,
+	PCUNICODE_STRING InstanceID
+);
+
+VOID
+WdfDeviceInitSetFileObjectConfig(
+	PWDFDEVICE_INIT DeviceInit,
+	PWDF_FILEOBJECT_CONFIG FileObjectConfig,
+	PWDF_OBJECT_ATTRIBUTES FileObjectAttributes
+);
+
+NTSTATUS
+WdfDeviceCreate(
+	PWDFDEVICE_INIT* DeviceInit,
+	PWDF_OBJECT_ATTRIBUTES DeviceAttributes,
+	WDFDEVICE* Device
+);
+
+NTSTATUS
+WdfDeviceCreateDeviceInterface(
+	WDFDEVICE Device,
+	const GUID* InterfaceClassGUID,
+	PCUNICODE_STRING ReferenceString
+);
+
+NTSTATUS
+WdfFdoAddStaticChild(
+	WDFDEVICE Fdo,
+	WDFDEVICE Child
+);
+
+typedef enum _WDF_IO_QUEUE_DISPATCH_TYPE
+{
+	WdfIoQueueDispatchInvalid = 0,
+	WdfIoQueueDispatchSequential,
+	WdfIoQueueDispatchParallel,
+	WdfIoQueueDispatchManual
+} WDF_IO_QUEUE_DISPATCH_TYPE;
+
+typedef struct _WDF_IO_QUEUE_CONFIG
+{
+	ULONG Size;
+	WDF_IO_QUEUE_DISPATCH_TYPE DispatchType;
+	BOOLEAN DefaultQueue;
+	EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL* EvtIoDeviceControl;
+} WDF_IO_QUEUE_CONFIG, *PWDF_IO_QUEUE_CONFIG;
+
+FORCEINLINE VOID
+WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(
+	PWDF_IO_QUEUE_CONFIG Config,
+	WDF_IO_QUEUE_DISPATCH_TYPE DispatchType
+)
+{
+	RtlZeroMemory(Config, sizeof(*Config));
+	Config->Size = sizeof(*Config);
+	Config->DispatchType = DispatchType;
+	Config->DefaultQueue = TRUE;
+}
+
+NTSTATUS
+WdfIoQueueCreate(
+	WDFDEVICE Device,
+	PWDF_IO_QUEUE_CONFIG Config,
+	PWDF_OBJECT_ATTRIBUTES QueueAttributes,
+	WDFQUEUE* Queue
+);
+
+//
+// Callers of ShimDeviceOpen, matched against the SIDs of the device
+// security: SY, or BA for an administrator, plus BU, AU and WD
+//
+typedef enum _SHIM_CALLER
+{
+	ShimCallerUser = 0,
+	ShimCallerAdministrator,
+	ShimCallerSystem
+} SHIM_CALLER;
+
+//
+// The device created last with the interface, NULL if there is none
+//
+WDFDEVICE
+ShimDeviceFind(
+	const GUID* InterfaceClassGUID
+);
+
+//
+// Checks DesiredAccess (GENERIC_READ, GENERIC_WRITE) against the device
+// security for Caller and runs the file create callback. Devices
+// without an SDDL string get the default security of a device object,
+// which lets everyone read and write.
+//
+NTSTATUS
+ShimDeviceOpen(
+	WDFDEVICE Device,
+	SHIM_CALLER Caller,
+	ULONG DesiredAccess,
+	WDFFILEOBJECT* FileObject
+);
+
+VOID
+ShimDeviceClose(
+	WDFFILEOBJECT FileObject
+);
+
+//
+// Sends a request made by ShimRequestCreate to the default queue of
+// the device. Fails with STATUS_ACCESS_DENIED without dispatching if
+// the code needs access the handle was not opened for. Returns
+// STATUS_PENDING if the driver kept the request, else the status it
+// was completed with.
+//
+NTSTATUS
+ShimDeviceIoControl(
+	WDFFILEOBJECT FileObject,
+	WDFREQUEST Request
+);
+
+//
+// Waits until a pending request is completed
+//
+NTSTATUS
+ShimRequestWait(
+	WDFREQUEST Request,
+	ULONG TimeoutMs
+);
+
+WDFDRIVER
+WdfDeviceGetDriver(
+	WDFDEVICE Device
+);
+
+PDRIVER_OBJECT
+WdfDriverWdmGetDriverObject(
+	WDFDRIVER Driver
+);
+
+typedef enum _WDF_DEVICE_FAILED_ACTION
+{
+	WdfDeviceFailedUndefined = 0,
+	WdfDeviceFailedAttemptRestart,
+	WdfDeviceFailedNoRestart
+} WDF_DEVICE_FAILED_ACTION;
+
+//
+// Recorded for the test, ShimDeviceFailed reports the last call
+//
+VOID
+WdfDeviceSetFailed(
+	WDFDEVICE Device,
+	WDF_DEVICE_FAILED_ACTION FailedAction
+);
+
+LONG
+ShimDeviceFailed(
+	VOID
+);
+
+//
+// I/O targets. A test connects a target to a simulated bus device
+// that sees every write and read, sequences are broken up into them.
+//
+
+typedef PVOID WDFCONTEXT;
+
+typedef struct _SHIM_BUS_DEVICE
+{
+	NTSTATUS (*Write)(PVOID Context, const UCHAR* Data, ULONG Length);
+	NTSTATUS (*Read)(PVOID Context, UCHAR* Data, ULONG Length, ULONG* BytesRead);
+
+	//
+	// Optional, called before the transfers of a sequence. A failure
+	// rejects the sequence before anything goes out on the bus, the way
+	// a controller without sequence support does.
+	//
+	NTSTATUS (*Sequence)(PVOID Context, ULONG TransferCount);
+
+	PVOID Context;
+} SHIM_BUS_DEVICE;
+
+VOID
+ShimIoTargetConnect(
+	WDFIOTARGET IoTarget,
+	const SHIM_BUS_DEVICE* Device
+);
+
+#define GENERIC_READ 0x80000000U
+#define GENERIC_WRITE 0x40000000U
+#define FILE_OPEN 0x00000001
+#define FILE_ATTRIBUTE_NORMAL 0x00000080
+
+#define RESOURCE_HUB_PATH_SIZE 64
+
+#define RESOURCE_HUB_CREATE_PATH_FROM_ID(String, Low, High) \
+	((void)(String), (void)(Low), (void)(High), STATUS_SUCCESS)
+
+typedef struct _WDF_IO_TARGET_OPEN_PARAMS
+{
+	ULONG Size;
+	PCUNICODE_STRING TargetDeviceName;
+	ACCESS_MASK DesiredAccess;
+	ULONG ShareAccess;
+	ULONG FileAttributes;
+	ULONG CreateDisposition;
+} WDF_IO_TARGET_OPEN_PARAMS, *PWDF_IO_TARGET_OPEN_PARAMS;
+
+FORCEINLINE VOID
+WDF_IO_TARGET_OPEN_PARAMS_INIT_OPEN_BY_NAME(
+	PWDF_IO_TARGET_OPEN_PARAMS Params,
+	PCUNICODE_STRING TargetDeviceName,
+	ACCESS_MASK DesiredAccess
+)
+{
+	RtlZeroMemory(Params, sizeof(*Params));
+	Params->Size = sizeof(*Params);
+	Params->TargetDeviceName = TargetDeviceName;
+	Params->DesiredAccess = DesiredAccess;
+}
+
+NTSTATUS
+WdfIoTargetCreate(
+	WDFDEVICE Device,
+	PWDF_OBJECT_ATTRIBUTES IoTargetAttributes,
+	WDFIOTARGET* IoTarget
+);
+
+NTSTATUS
+WdfIoTargetOpen(
+	WDFIOTARGET IoTarget,
+	PWDF_IO_TARGET_OPEN_PARAMS OpenParams
+);
+
+VOID
+WdfIoTargetClose(
+	WDFIOTARGET IoTarget
+);
+
+typedef struct _WDF_REQUEST_SEND_OPTIONS* PWDF_REQUEST_SEND_OPTIONS;
+
+NTSTATUS
+WdfIoTargetSendWriteSynchronously(
+	WDFIOTARGET IoTarget,
+	WDFREQUEST Request,
+	PWDF_MEMORY_DESCRIPTOR InputBuffer,
+	PLONGLONG DeviceOffset,
+	PWDF_REQUEST_SEND_OPTIONS RequestOptions,
+	PULONG_PTR BytesWritten
+);
+
+NTSTATUS
+WdfIoTargetSendReadSynchronously(
+	WDFIOTARGET IoTarget,
+	WDFREQUEST Request,
+	PWDF_MEMORY_DESCRIPTOR OutputBuffer,
+	PLONGLONG DeviceOffset,
+	PWDF_REQUEST_SEND_OPTIONS RequestOptions,
+	PULONG_PTR BytesRead
+);
+
+NTSTATUS
+WdfIoTargetSendIoctlSynchronously(
+	WDFIOTARGET IoTarget,
+	WDFREQUEST Request,
+	ULONG IoctlCode,
+	PWDF_MEMORY_DESCRIPTOR InputBuffer,
+	PWDF_MEMORY_DESCRIPTOR OutputBuffer,
+	PWDF_REQUEST_SEND_OPTIONS RequestOptions,
+	PULONG_PTR BytesReturned
+);
+
+//
+// Asynchronous reads complete before WdfRequestSend returns, unless a
+// test defers them with ShimRequestSetDeferred
+//
+
+typedef struct _WDFMEMORY_OFFSET
+{
+	size_t BufferOffset;
+	size_t BufferLength;
+} WDFMEMORY_OFFSET, *PWDFMEMORY_OFFSET;
+
+typedef struct _WDF_REQUEST_COMPLETION_PARAMS
+{
+	ULONG Size;
+	ULONG Type;
+	IO_STATUS_BLOCK IoStatus;
+} WDF_REQUEST_COMPLETION_PARAMS, *PWDF_REQUEST_COMPLETION_PARAMS;
+
+typedef VOID EVT_WDF_REQUEST_COMPLETION_ROUTINE(
+	WDFREQUEST Request,
+	WDFIOTARGET Target,
+	PWDF_REQUEST_COMPLETION_PARAMS Params,
+	WDFCONTEXT Context);
+
+typedef EVT_WDF_REQUEST_COMPLETION_ROUTINE* PFN_WDF_REQUEST_COMPLETION_ROUTINE;
+
+#define WDF_REQUEST_REUSE_NO_FLAGS 0
+
+typedef struct _WDF_REQUEST_REUSE_PARAMS
+{
+	ULONG Size;
+	ULONG Flags;
+	NTSTATUS Status;
+} WDF_REQUEST_REUSE_PARAMS, *PWDF_REQUEST_REUSE_PARAMS;
+
+FORCEINLINE VOID
+WDF_REQUEST_REUSE_PARAMS_INIT(
+	PWDF_REQUEST_REUSE_PARAMS Params,
+	ULONG Flags,
+	NTSTATUS Status
+)
+{
+	Params->Size = sizeof(*Params);
+	Params->Flags = Flags;
+	Params->Status = Status;
+}
+
+NTSTATUS
+WdfRequestCreate(
+	PWDF_OBJECT_ATTRIBUTES RequestAttributes,
+	WDFIOTARGET IoTarget,
+	WDFREQUEST* Request
+);
+
+NTSTATUS
+WdfRequestReuse(
+	WDFREQUEST Request,
+	PWDF_REQUEST_REUSE_PARAMS ReuseParams
+);
+
+NTSTATUS
+WdfIoTargetFormatRequestForRead(
+	WDFIOTARGET IoTarget,
+	WDFREQUEST Request,
+	WDFMEMORY OutputBuffer,
+	PWDFMEMORY_OFFSET OutputBufferOffset,
+	PLONGLONG DeviceOffset
+);
+
+VOID
+WdfRequestSetCompletionRoutine(
+	WDFREQUEST Request,
+	PFN_WDF_REQUEST_COMPLETION_ROUTINE CompletionRoutine,
+	WDFCONTEXT CompletionContext
+);
+
+BOOLEAN
+WdfRequestSend(
+	WDFREQUEST Request,
+	WDFIOTARGET Target,
+	PWDF_REQUEST_SEND_OPTIONS Options
+);
+
+NTSTATUS
+WdfRequestGetStatus(
+	WDFREQUEST Request
+);
+
+//
+// Deferred, WdfRequestSend only queues the read. The bus transfer and
+// the completion routine run once the test completes the send with
+// ShimRequestCompleteSend, in whatever order it picks and on its own
+// thread, as they would from the bus driver.
+//
+VOID
+ShimRequestSetDeferred(
+	BOOLEAN Deferred
+);
+
+//
+// Waits up to TimeoutMs for Count sends to be queued and not completed.
+// Returns FALSE on timeout.
+//
+BOOLEAN
+ShimRequestWaitSends(
+	ULONG Count,
+	ULONG TimeoutMs
+);
+
+//
+// Completes the Index-th oldest pending send. Returns FALSE if there is
+// no such send.
+//
+BOOLEAN
+ShimRequestCompleteSend(
+	ULONG Index
+);
+
+//
+// The next Count sends fail with Status: WdfRequestSend returns FALSE
+// and the request is never completed
+//
+VOID
+ShimRequestFailSends(
+	ULONG Count,
+	NTSTATUS Status
+);
+
+//
+// The next Count reads transfer Shortfall bytes fewer than asked for
+//
+VOID
+ShimRequestShortReads(
+	ULONG Count,
+	ULONG Shortfall
+);
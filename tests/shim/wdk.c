@@ -0,0 +1,2771 @@
+/*++
+	Module Name:
+
+		wdk.c
+
+	Abstract:
+
+		Runtime behind the kernel and KMDF shim headers. Events and
+		wait locks are pthread based, work items and timers get a
+		thread of their own, pool allocations are counted so tests
+		can check for leaks.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#define _GNU_SOURCE
+#include <wdm.h>
+#include <wdf.h>
+#include <evntrace.h>
+#include <km/spb.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+
+//
+// Trace and assertions
+//
+
+static int ShimTraceLevel = -1;
+
+void
+ShimTrace(
+	int Level,
+	const char* Flag,
+	const char* Format,
+	...
+)
+{
+	const char* Setting;
+
+	if (ShimTraceLevel < 0) {
+		Setting = getenv("SHIM_TRACE");
+		ShimTraceLevel = Setting != NULL ? atoi(Setting) : 0;
+	}
+
+	if (Level > ShimTraceLevel) {
+		return;
+	}
+
+	fprintf(stderr, "[%d %s] %s\n", Level, Flag, Format);
+}
+
+VOID
+ShimAssertFailed(
+	const char* Expression,
+	const char* File,
+	int Line
+)
+{
+	fprintf(stderr, "%s:%d: assertion failed: %s\n", File, Line, Expression);
+	abort();
+}
+
+//
+// IRQL is always passive, code raising it does not run in the tests
+//
+
+KIRQL
+KeGetCurrentIrql(
+	VOID
+)
+{
+	return PASSIVE_LEVEL;
+}
+
+//
+// Pools
+//
+
+static volatile LONG ShimPoolAllocations;
+
+LONG
+ShimPoolOutstanding(
+	VOID
+)
+{
+	return __atomic_load_n(&ShimPoolAllocations, __ATOMIC_SEQ_CST);
+}
+
+PVOID
+ExAllocatePoolWithTag(
+	POOL_TYPE PoolType,
+	SIZE_T NumberOfBytes,
+	ULONG Tag
+)
+{
+	PVOID P;
+
+	UNREFERENCED_PARAMETER(PoolType);
+	UNREFERENCED_PARAMETER(Tag);
+
+	//
+	// Pool contents are undefined, make that visible
+	//
+	P = malloc(NumberOfBytes != 0 ? NumberOfBytes : 1);
+
+	if (P != NULL) {
+		memset(P, 0xcd, NumberOfBytes);
+		InterlockedIncrement(&ShimPoolAllocations);
+	}
+
+	return P;
+}
+
+VOID
+ExFreePoolWithTag(
+	PVOID P,
+	ULONG Tag
+)
+{
+	UNREFERENCED_PARAMETER(Tag);
+
+	if (P != NULL) {
+		InterlockedDecrement(&ShimPoolAllocations);
+		free(P);
+	}
+}
+
+SIZE_T
+RtlCompareMemory(
+	const VOID* Source1,
+	const VOID* Source2,
+	SIZE_T Length
+)
+{
+	const UCHAR* A = Source1;
+	const UCHAR* B = Source2;
+	SIZE_T i;
+
+	for (i = 0; i < Length && A[i] == B[i]; i++) {
+	}
+
+	return i;
+}
+
+ULONG
+RtlComputeCrc32(
+	ULONG PartialCrc,
+	PCVOID Buffer,
+	ULONG Length
+)
+{
+	const UCHAR* Data = Buffer;
+	ULONG Crc = ~PartialCrc;
+	ULONG i, Bit;
+
+	for (i = 0; i < Length; i++) {
+		Crc ^= Data[i];
+		for (Bit = 0; Bit < 8; Bit++) {
+			Crc = (Crc >> 1) ^ (0xEDB88320U & (0U - (Crc & 1)));
+		}
+	}
+
+	return ~Crc;
+}
+
+VOID
+RtlInitUnicodeString(
+	PUNICODE_STRING DestinationString,
+	PCWSTR SourceString
+)
+{
+	USHORT Length = 0;
+
+	if (SourceString != NULL) {
+		while (SourceString[Length / sizeof(WCHAR)] != 0) {
+			Length += sizeof(WCHAR);
+		}
+	}
+
+	DestinationString->Length = Length;
+	DestinationString->MaximumLength = Length + sizeof(WCHAR);
+	DestinationString->Buffer = (PWCHAR)SourceString;
+}
+
+//
+// Time
+//
+
+static ULONG64
+ShimNow100ns(
+	VOID
+)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (ULONG64)Now.tv_sec * 10000000ULL + (ULONG64)Now.tv_nsec / 100;
+}
+
+static struct timespec
+ShimDeadline(
+	LONGLONG Relative100ns
+)
+{
+	struct timespec Deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &Deadline);
+	Deadline.tv_sec += (time_t)(Relative100ns / 10000000);
+	Deadline.tv_nsec += (long)(Relative100ns % 10000000) * 100;
+
+	if (Deadline.tv_nsec >= 1000000000L) {
+		Deadline.tv_sec++;
+		Deadline.tv_nsec -= 1000000000L;
+	}
+
+	return Deadline;
+}
+
+//
+// Relative timeouts are negative, absolute ones are taken as relative
+// to the start of the process which nothing here uses
+//
+static LONGLONG
+ShimRelative(
+	LONGLONG Timeout
+)
+{
+	return Timeout < 0 ? -Timeout : Timeout;
+}
+
+ULONG64
+KeQueryInterruptTime(
+	VOID
+)
+{
+	return ShimNow100ns();
+}
+
+ULONG64
+KeQueryInterruptTimePrecise(
+	PULONG64 QpcTimeStamp
+)
+{
+	ULONG64 Now = ShimNow100ns();
+
+	if (QpcTimeStamp != NULL) {
+		*QpcTimeStamp = Now;
+	}
+
+	return Now;
+}
+
+LARGE_INTEGER
+KeQueryPerformanceCounter(
+	PLARGE_INTEGER PerformanceFrequency
+)
+{
+	LARGE_INTEGER Counter;
+
+	if (PerformanceFrequency != NULL) {
+		PerformanceFrequency->QuadPart = 10000000;
+	}
+
+	Counter.QuadPart = (LONGLONG)ShimNow100ns();
+	return Counter;
+}
+
+VOID
+KeQuerySystemTime(
+	PLARGE_INTEGER CurrentTime
+)
+{
+	CurrentTime->QuadPart = (LONGLONG)ShimNow100ns();
+}
+
+ULONG
+ExSetTimerResolution(
+	ULONG DesiredTime,
+	BOOLEAN SetResolution
+)
+{
+	UNREFERENCED_PARAMETER(SetResolution);
+	return DesiredTime;
+}
+
+NTSTATUS
+KeDelayExecutionThread(
+	KPROCESSOR_MODE WaitMode,
+	BOOLEAN Alertable,
+	PLARGE_INTEGER Interval
+)
+{
+	struct timespec Deadline;
+
+	UNREFERENCED_PARAMETER(WaitMode);
+	UNREFERENCED_PARAMETER(Alertable);
+
+	Deadline = ShimDeadline(ShimRelative(Interval->QuadPart));
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Deadline, NULL) == EINTR) {
+	}
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+KeStallExecutionProcessor(
+	ULONG MicroSeconds
+)
+{
+	ULONG64 End = ShimNow100ns() + (ULONG64)MicroSeconds * 10;
+
+	while (ShimNow100ns() < End) {
+	}
+}
+
+//
+// Threads. A KTHREAD is only an identity.
+//
+
+static __thread UCHAR ShimThreadIdentity;
+
+PKTHREAD
+KeGetCurrentThread(
+	VOID
+)
+{
+	return (PKTHREAD)&ShimThreadIdentity;
+}
+
+KPRIORITY
+KeSetPriorityThread(
+	PKTHREAD Thread,
+	KPRIORITY Priority
+)
+{
+	UNREFERENCED_PARAMETER(Thread);
+	return Priority;
+}
+
+//
+// Events share one mutex, waits are rare enough in the tests
+//
+
+static pthread_mutex_t ShimDispatcherLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ShimDispatcherCond;
+static pthread_once_t ShimDispatcherOnce = PTHREAD_ONCE_INIT;
+
+static void
+ShimDispatcherInitialize(
+	void
+)
+{
+	pthread_condattr_t Attributes;
+
+	pthread_condattr_init(&Attributes);
+	pthread_condattr_setclock(&Attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&ShimDispatcherCond, &Attributes);
+	pthread_condattr_destroy(&Attributes);
+}
+
+VOID
+KeInitializeEvent(
+	PKEVENT Event,
+	EVENT_TYPE Type,
+	BOOLEAN State
+)
+{
+	pthread_once(&ShimDispatcherOnce, ShimDispatcherInitialize);
+
+	Event->Type = Type;
+	Event->State = State;
+	Event->Object = NULL;
+}
+
+LONG
+KeSetEvent(
+	PKEVENT Event,
+	KPRIORITY Increment,
+	BOOLEAN Wait
+)
+{
+	LONG Previous;
+
+	UNREFERENCED_PARAMETER(Increment);
+	UNREFERENCED_PARAMETER(Wait);
+
+	pthread_mutex_lock(&ShimDispatcherLock);
+	Previous = Event->State;
+	Event->State = 1;
+	pthread_cond_broadcast(&ShimDispatcherCond);
+	pthread_mutex_unlock(&ShimDispatcherLock);
+
+	return Previous;
+}
+
+VOID
+KeClearEvent(
+	PKEVENT Event
+)
+{
+	pthread_mutex_lock(&ShimDispatcherLock);
+	Event->State = 0;
+	pthread_mutex_unlock(&ShimDispatcherLock);
+}
+
+LONG
+KeResetEvent(
+	PKEVENT Event
+)
+{
+	LONG Previous;
+
+	pthread_mutex_lock(&ShimDispatcherLock);
+	Previous = Event->State;
+	Event->State = 0;
+	pthread_mutex_unlock(&ShimDispatcherLock);
+
+	return Previous;
+}
+
+LONG
+KeReadStateEvent(
+	PKEVENT Event
+)
+{
+	return __atomic_load_n(&Event->State, __ATOMIC_SEQ_CST);
+}
+
+NTSTATUS
+KeWaitForSingleObject(
+	PVOID Object,
+	KWAIT_REASON WaitReason,
+	KPROCESSOR_MODE WaitMode,
+	BOOLEAN Alertable,
+	PLARGE_INTEGER Timeout
+)
+{
+	PKEVENT Event = Object;
+	struct timespec Deadline;
+	NTSTATUS status = STATUS_SUCCESS;
+
+	UNREFERENCED_PARAMETER(WaitReason);
+	UNREFERENCED_PARAMETER(WaitMode);
+	UNREFERENCED_PARAMETER(Alertable);
+
+	if (Timeout != NULL) {
+		Deadline = ShimDeadline(ShimRelative(Timeout->QuadPart));
+	}
+
+	pthread_mutex_lock(&ShimDispatcherLock);
+
+	while (Event->State == 0) {
+		if (Timeout == NULL) {
+			pthread_cond_wait(&ShimDispatcherCond, &ShimDispatcherLock);
+		}
+		else if (Timeout->QuadPart == 0 ||
+			pthread_cond_timedwait(&ShimDispatcherCond, &ShimDispatcherLock, &Deadline) == ETIMEDOUT) {
+			if (Event->State == 0) {
+				status = STATUS_TIMEOUT;
+				break;
+			}
+		}
+	}
+
+	if (status == STATUS_SUCCESS && Event->Type == SynchronizationEvent) {
+		Event->State = 0;
+	}
+
+	pthread_mutex_unlock(&ShimDispatcherLock);
+
+	return status;
+}
+
+//
+// System threads
+//
+
+static POBJECT_TYPE ShimThreadType;
+POBJECT_TYPE* PsThreadType = &ShimThreadType;
+
+typedef struct _SHIM_THREAD
+{
+	pthread_t Thread;
+	PKSTART_ROUTINE StartRoutine;
+	PVOID StartContext;
+	KEVENT Exited;
+} SHIM_THREAD;
+
+static void*
+ShimThreadStart(
+	void* Context
+)
+{
+	SHIM_THREAD* Thread = Context;
+
+	Thread->StartRoutine(Thread->StartContext);
+	KeSetEvent(&Thread->Exited, IO_NO_INCREMENT, FALSE);
+
+	return NULL;
+}
+
+NTSTATUS
+PsCreateSystemThread(
+	PHANDLE ThreadHandle,
+	ULONG DesiredAccess,
+	POBJECT_ATTRIBUTES ObjectAttributes,
+	HANDLE ProcessHandle,
+	PVOID ClientId,
+	PKSTART_ROUTINE StartRoutine,
+	PVOID StartContext
+)
+{
+	SHIM_THREAD* Thread;
+
+	UNREFERENCED_PARAMETER(DesiredAccess);
+	UNREFERENCED_PARAMETER(ObjectAttributes);
+	UNREFERENCED_PARAMETER(ProcessHandle);
+	UNREFERENCED_PARAMETER(ClientId);
+
+	Thread = calloc(1, sizeof(*Thread));
+	if (Thread == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Thread->StartRoutine = StartRoutine;
+	Thread->StartContext = StartContext;
+	KeInitializeEvent(&Thread->Exited, NotificationEvent, FALSE);
+
+	if (pthread_create(&Thread->Thread, NULL, ShimThreadStart, Thread) != 0) {
+		free(Thread);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	pthread_detach(Thread->Thread);
+	*ThreadHandle = Thread;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+PsTerminateSystemThread(
+	NTSTATUS ExitStatus
+)
+{
+	UNREFERENCED_PARAMETER(ExitStatus);
+	return STATUS_SUCCESS;
+}
+
+//
+// A referenced thread is waited on through its exit event, which is
+// the first member KeWaitForSingleObject looks at
+//
+C_ASSERT(sizeof(KEVENT) > 0);
+
+NTSTATUS
+ZwWaitForSingleObject(
+	HANDLE Handle,
+	BOOLEAN Alertable,
+	PLARGE_INTEGER Timeout
+)
+{
+	return KeWaitForSingleObject(&((SHIM_THREAD*)Handle)->Exited,
+		Executive,
+		KernelMode,
+		Alertable,
+		Timeout);
+}
+
+NTSTATUS
+ObReferenceObjectByHandle(
+	HANDLE Handle,
+	ACCESS_MASK DesiredAccess,
+	POBJECT_TYPE ObjectType,
+	KPROCESSOR_MODE AccessMode,
+	PVOID* Object,
+	PVOID HandleInformation
+)
+{
+	UNREFERENCED_PARAMETER(DesiredAccess);
+	UNREFERENCED_PARAMETER(ObjectType);
+	UNREFERENCED_PARAMETER(AccessMode);
+	UNREFERENCED_PARAMETER(HandleInformation);
+
+	*Object = &((SHIM_THREAD*)Handle)->Exited;
+	return STATUS_SUCCESS;
+}
+
+VOID
+ObDereferenceObject(
+	PVOID Object
+)
+{
+	UNREFERENCED_PARAMETER(Object);
+}
+
+//
+// Files
+//
+
+#define SHIM_MAX_FILES 16
+
+typedef struct _SHIM_FILE
+{
+	WCHAR Path[128];
+	const UCHAR* Data;
+	ULONG Length;
+} SHIM_FILE;
+
+typedef struct _SHIM_FILE_HANDLE
+{
+	SHIM_FILE* File;
+	ULONG Position;
+} SHIM_FILE_HANDLE;
+
+static SHIM_FILE ShimFiles[SHIM_MAX_FILES];
+static SHIM_FILE_HANDLE ShimFileHandles[SHIM_MAX_FILES];
+static pthread_mutex_t ShimFileLock = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// The C library wide string routines assume a 32-bit wchar_t, the
+// shim is built with a 16-bit one
+//
+static BOOLEAN
+ShimPathEqual(
+	PCWSTR A,
+	const WCHAR* B,
+	USHORT Length
+)
+{
+	USHORT i;
+
+	for (i = 0; i < Length / sizeof(WCHAR); i++) {
+		if (A[i] != B[i]) {
+			return FALSE;
+		}
+	}
+
+	return A[i] == 0;
+}
+
+VOID
+ShimFileRegister(
+	PCWSTR Path,
+	const VOID* Data,
+	ULONG Length
+)
+{
+	ULONG i, j;
+
+	pthread_mutex_lock(&ShimFileLock);
+
+	for (i = 0; i < SHIM_MAX_FILES; i++) {
+		for (j = 0; Path[j] != 0 && ShimFiles[i].Path[j] == Path[j]; j++) {
+		}
+
+		if (ShimFiles[i].Path[0] == 0 || (Path[j] == 0 && ShimFiles[i].Path[j] == 0)) {
+			break;
+		}
+	}
+
+	NT_ASSERT(i < SHIM_MAX_FILES);
+
+	for (j = 0; j + 1 < ARRAYSIZE(ShimFiles[i].Path) && Path[j] != 0; j++) {
+		ShimFiles[i].Path[j] = Path[j];
+	}
+
+	ShimFiles[i].Path[j] = 0;
+	ShimFiles[i].Data = Data;
+	ShimFiles[i].Length = Data != NULL ? Length : 0;
+
+	pthread_mutex_unlock(&ShimFileLock);
+}
+
+NTSTATUS
+ZwCreateFile(
+	PHANDLE FileHandle,
+	ACCESS_MASK DesiredAccess,
+	POBJECT_ATTRIBUTES ObjectAttributes,
+	PIO_STATUS_BLOCK IoStatusBlock,
+	PLARGE_INTEGER AllocationSize,
+	ULONG FileAttributes,
+	ULONG ShareAccess,
+	ULONG CreateDisposition,
+	ULONG CreateOptions,
+	PVOID EaBuffer,
+	ULONG EaLength
+)
+{
+	PUNICODE_STRING Name = ObjectAttributes->ObjectName;
+	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+	ULONG i, h;
+
+	pthread_mutex_lock(&ShimFileLock);
+
+	for (i = 0; i < SHIM_MAX_FILES; i++) {
+		if (ShimFiles[i].Data != NULL &&
+			ShimPathEqual(ShimFiles[i].Path, Name->Buffer, Name->Length)) {
+			break;
+		}
+	}
+
+	if (i < SHIM_MAX_FILES) {
+		status = STATUS_INSUFFICIENT_RESOURCES;
+
+		for (h = 0; h < SHIM_MAX_FILES; h++) {
+			if (ShimFileHandles[h].File == NULL) {
+				ShimFileHandles[h].File = &ShimFiles[i];
+				ShimFileHandles[h].Position = 0;
+				*FileHandle = &ShimFileHandles[h];
+				status = STATUS_SUCCESS;
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&ShimFileLock);
+
+	IoStatusBlock->Status = status;
+	IoStatusBlock->Information = 0;
+
+	return status;
+}
+
+NTSTATUS
+ZwQueryInformationFile(
+	HANDLE FileHandle,
+	PIO_STATUS_BLOCK IoStatusBlock,
+	PVOID FileInformation,
+	ULONG Length,
+	FILE_INFORMATION_CLASS FileInformationClass
+)
+{
+	SHIM_FILE_HANDLE* Handle = FileHandle;
+	FILE_STANDARD_INFORMATION* Info = FileInformation;
+
+	if (FileInformationClass != FileStandardInformation || Length < sizeof(*Info)) {
+		return STATUS_INVALID_INFO_CLASS;
+	}
+
+	RtlZeroMemory(Info, sizeof(*Info));
+	Info->EndOfFile.QuadPart = Handle->File->Length;
+	Info->AllocationSize.QuadPart = Handle->File->Length;
+	Info->NumberOfLinks = 1;
+
+	IoStatusBlock->Status = STATUS_SUCCESS;
+	IoStatusBlock->Information = sizeof(*Info);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+ZwReadFile(
+	HANDLE FileHandle,
+	HANDLE Event,
+	PVOID ApcRoutine,
+	PVOID ApcContext,
+	PIO_STATUS_BLOCK IoStatusBlock,
+	PVOID Buffer,
+	ULONG Length,
+	PLARGE_INTEGER ByteOffset,
+	PULONG Key
+)
+{
+	SHIM_FILE_HANDLE* Handle = FileHandle;
+	ULONG Position = ByteOffset != NULL ? ByteOffset->LowPart : Handle->Position;
+	ULONG Count;
+
+	if (Position >= Handle->File->Length) {
+		IoStatusBlock->Status = STATUS_END_OF_FILE;
+		IoStatusBlock->Information = 0;
+		return STATUS_END_OF_FILE;
+	}
+
+	Count = min(Length, Handle->File->Length - Position);
+	RtlCopyMemory(Buffer, Handle->File->Data + Position, Count);
+	Handle->Position = Position + Count;
+
+	IoStatusBlock->Status = STATUS_SUCCESS;
+	IoStatusBlock->Information = Count;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+ZwClose(
+	HANDLE Handle
+)
+{
+	SHIM_FILE_HANDLE* File = Handle;
+
+	//
+	// Thread handles are left to the thread, only files are tracked
+	//
+	if (File >= &ShimFileHandles[0] && File < &ShimFileHandles[SHIM_MAX_FILES]) {
+		pthread_mutex_lock(&ShimFileLock);
+		File->File = NULL;
+		pthread_mutex_unlock(&ShimFileLock);
+	}
+
+	return STATUS_SUCCESS;
+}
+
+//
+// Framework objects
+//
+
+#define SHIM_MAX_CONTEXTS 4
+
+typedef enum _SHIM_OBJECT_TYPE
+{
+	ShimObjectGeneric,
+	ShimObjectWaitLock,
+	ShimObjectWorkItem,
+	ShimObjectTimer,
+	ShimObjectMemory,
+	ShimObjectRequest,
+	ShimObjectIoTarget,
+	ShimObjectDevice,
+	ShimObjectQueue,
+	ShimObjectFile
+} SHIM_OBJECT_TYPE;
+
+typedef struct _SHIM_CONTEXT
+{
+	const char* Name;
+	PVOID Data;
+} SHIM_CONTEXT;
+
+typedef struct _SHIM_WORKITEM
+{
+	WDF_WORKITEM_CONFIG Config;
+	pthread_mutex_t Lock;
+	pthread_cond_t Idle;
+	BOOLEAN Queued;
+	BOOLEAN Running;
+	BOOLEAN Thread;
+} SHIM_WORKITEM;
+
+typedef struct _SHIM_TIMER
+{
+	WDF_TIMER_CONFIG Config;
+	pthread_mutex_t Lock;
+	pthread_cond_t Changed;
+	ULONG Generation;
+	LONGLONG DueTime;
+	BOOLEAN Armed;
+	BOOLEAN Running;
+	BOOLEAN Thread;
+	BOOLEAN Deleted;
+} SHIM_TIMER;
+
+#define SHIM_MAX_SDDL 128
+
+typedef struct _SHIM_DEVICE
+{
+	WDF_FILEOBJECT_CONFIG FileConfig;
+	WDFQUEUE DefaultQueue;
+	BOOLEAN HasSddl;
+	char Sddl[SHIM_MAX_SDDL];
+} SHIM_DEVICE;
+
+typedef struct _SHIM_OBJECT
+{
+	SHIM_OBJECT_TYPE Type;
+	WDFOBJECT Parent;
+	PFN_WDF_OBJECT_CONTEXT_CLEANUP Cleanup;
+	PFN_WDF_OBJECT_CONTEXT_DESTROY Destroy;
+	SHIM_CONTEXT Contexts[SHIM_MAX_CONTEXTS];
+	union
+	{
+		pthread_mutex_t Mutex;
+		SHIM_WORKITEM WorkItem;
+		SHIM_TIMER Timer;
+		struct
+		{
+			PVOID Buffer;
+			size_t Size;
+		} Memory;
+		SHIM_REQUEST Request;
+		SHIM_BUS_DEVICE IoTarget;
+		SHIM_DEVICE Device;
+		EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL* Queue;
+		ULONG FileAccess;
+	} u;
+	UCHAR Extra[];
+} SHIM_OBJECT;
+
+static NTSTATUS
+ShimObjectAddContext(
+	WDFOBJECT Object,
+	PWDF_OBJECT_ATTRIBUTES Attributes,
+	PVOID* Context
+)
+{
+	ULONG i;
+	size_t Size;
+
+	if (Attributes == NULL || Attributes->ContextTypeInfo == NULL) {
+		return STATUS_SUCCESS;
+	}
+
+	for (i = 0; i < SHIM_MAX_CONTEXTS && Object->Contexts[i].Name != NULL; i++) {
+	}
+
+	if (i == SHIM_MAX_CONTEXTS) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Size = Attributes->ContextSizeOverride != 0 ?
+		Attributes->ContextSizeOverride : Attributes->ContextTypeInfo->ContextSize;
+
+	Object->Contexts[i].Data = calloc(1, Size);
+	if (Object->Contexts[i].Data == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Object->Contexts[i].Name = Attributes->ContextTypeInfo->ContextName;
+
+	if (Context != NULL) {
+		*Context = Object->Contexts[i].Data;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+WDFOBJECT
+ShimObjectCreate(
+	PWDF_OBJECT_ATTRIBUTES Attributes,
+	size_t Extra
+)
+{
+	WDFOBJECT Object;
+
+	Object = calloc(1, sizeof(SHIM_OBJECT) + Extra);
+	if (Object == NULL) {
+		return NULL;
+	}
+
+	if (Attributes != NULL) {
+		Object->Parent = Attributes->ParentObject;
+		Object->Cleanup = Attributes->EvtCleanupCallback;
+		Object->Destroy = Attributes->EvtDestroyCallback;
+	}
+
+	if (!NT_SUCCESS(ShimObjectAddContext(Object, Attributes, NULL))) {
+		free(Object);
+		return NULL;
+	}
+
+	return Object;
+}
+
+PVOID
+ShimObjectExtra(
+	WDFOBJECT Handle
+)
+{
+	return Handle->Extra;
+}
+
+PVOID
+ShimObjectGetContext(
+	WDFOBJECT Handle,
+	PCWDF_OBJECT_CONTEXT_TYPE_INFO TypeInfo
+)
+{
+	ULONG i;
+
+	//
+	// Every translation unit has its own copy of the type info, the
+	// name identifies the type
+	//
+	for (i = 0; i < SHIM_MAX_CONTEXTS && Handle->Contexts[i].Name != NULL; i++) {
+		if (strcmp(Handle->Contexts[i].Name, TypeInfo->ContextName) == 0) {
+			return Handle->Contexts[i].Data;
+		}
+	}
+
+	ShimAssertFailed(TypeInfo->ContextName, __FILE__, __LINE__);
+	return NULL;
+}
+
+NTSTATUS
+WdfObjectAllocateContext(
+	WDFOBJECT Handle,
+	PWDF_OBJECT_ATTRIBUTES ContextAttributes,
+	PVOID* Context
+)
+{
+	return ShimObjectAddContext(Handle, ContextAttributes, Context);
+}
+
+WDFOBJECT
+WdfObjectGetParent(
+	WDFOBJECT Object
+)
+{
+	return Object->Parent;
+}
+
+static VOID ShimWorkItemDelete(WDFWORKITEM WorkItem);
+static VOID ShimTimerDelete(WDFTIMER Timer);
+static VOID ShimDeviceDelete(WDFDEVICE Device);
+
+VOID
+WdfObjectDelete(
+	WDFOBJECT Object
+)
+{
+	ULONG i;
+
+	if (Object == NULL) {
+		return;
+	}
+
+	switch (Object->Type) {
+	case ShimObjectWorkItem:
+		ShimWorkItemDelete(Object);
+		break;
+	case ShimObjectTimer:
+		ShimTimerDelete(Object);
+		break;
+	case ShimObjectMemory:
+		free(Object->u.Memory.Buffer);
+		break;
+	case ShimObjectRequest:
+		free(Object->u.Request.SystemBuffer);
+		break;
+	default:
+		break;
+	}
+
+	ShimDeviceDelete(Object);
+
+	if (Object->Cleanup != NULL) {
+		Object->Cleanup(Object);
+	}
+
+	if (Object->Destroy != NULL) {
+		Object->Destroy(Object);
+	}
+
+	for (i = 0; i < SHIM_MAX_CONTEXTS; i++) {
+		free(Object->Contexts[i].Data);
+	}
+
+	//
+	// Timer and work item threads are gone by now
+	//
+	free(Object);
+}
+
+//
+// Wait locks
+//
+
+NTSTATUS
+WdfWaitLockCreate(
+	PWDF_OBJECT_ATTRIBUTES LockAttributes,
+	WDFWAITLOCK* Lock
+)
+{
+	WDFWAITLOCK Object = ShimObjectCreate(LockAttributes, 0);
+
+	if (Object == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Object->Type = ShimObjectWaitLock;
+	pthread_mutex_init(&Object->u.Mutex, NULL);
+	*Lock = Object;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfWaitLockAcquire(
+	WDFWAITLOCK Lock,
+	PLONGLONG Timeout
+)
+{
+	struct timespec Deadline;
+
+	if (Timeout == NULL) {
+		pthread_mutex_lock(&Lock->u.Mutex);
+		return STATUS_SUCCESS;
+	}
+
+	if (*Timeout == 0) {
+		return pthread_mutex_trylock(&Lock->u.Mutex) == 0 ? STATUS_SUCCESS : STATUS_TIMEOUT;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &Deadline);
+	Deadline.tv_sec += (time_t)(ShimRelative(*Timeout) / 10000000);
+	Deadline.tv_nsec += (long)(ShimRelative(*Timeout) % 10000000) * 100;
+	if (Deadline.tv_nsec >= 1000000000L) {
+		Deadline.tv_sec++;
+		Deadline.tv_nsec -= 1000000000L;
+	}
+
+	return pthread_mutex_timedlock(&Lock->u.Mutex, &Deadline) == 0 ? STATUS_SUCCESS : STATUS_TIMEOUT;
+}
+
+VOID
+WdfWaitLockRelease(
+	WDFWAITLOCK Lock
+)
+{
+	pthread_mutex_unlock(&Lock->u.Mutex);
+}
+
+//
+// Work items. An enqueued work item runs once on a thread of its own,
+// enqueueing it again while it is queued has no effect.
+//
+
+static void*
+ShimWorkItemThread(
+	void* Context
+)
+{
+	WDFWORKITEM Object = Context;
+	SHIM_WORKITEM* WorkItem = &Object->u.WorkItem;
+
+	pthread_mutex_lock(&WorkItem->Lock);
+
+	while (WorkItem->Queued) {
+		WorkItem->Queued = FALSE;
+		WorkItem->Running = TRUE;
+		pthread_mutex_unlock(&WorkItem->Lock);
+
+		WorkItem->Config.EvtWorkItemFunc(Object);
+
+		pthread_mutex_lock(&WorkItem->Lock);
+		WorkItem->Running = FALSE;
+	}
+
+	WorkItem->Thread = FALSE;
+	pthread_cond_broadcast(&WorkItem->Idle);
+	pthread_mutex_unlock(&WorkItem->Lock);
+
+	return NULL;
+}
+
+NTSTATUS
+WdfWorkItemCreate(
+	PWDF_WORKITEM_CONFIG Config,
+	PWDF_OBJECT_ATTRIBUTES Attributes,
+	WDFWORKITEM* WorkItem
+)
+{
+	WDFWORKITEM Object = ShimObjectCreate(Attributes, 0);
+
+	if (Object == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Object->Type = ShimObjectWorkItem;
+	Object->u.WorkItem.Config = *Config;
+	pthread_mutex_init(&Object->u.WorkItem.Lock, NULL);
+	pthread_cond_init(&Object->u.WorkItem.Idle, NULL);
+	*WorkItem = Object;
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+WdfWorkItemEnqueue(
+	WDFWORKITEM Object
+)
+{
+	SHIM_WORKITEM* WorkItem = &Object->u.WorkItem;
+	pthread_t Thread;
+
+	pthread_mutex_lock(&WorkItem->Lock);
+
+	WorkItem->Queued = TRUE;
+
+	if (!WorkItem->Thread) {
+		WorkItem->Thread = TRUE;
+		pthread_create(&Thread, NULL, ShimWorkItemThread, Object);
+		pthread_detach(Thread);
+	}
+
+	pthread_mutex_unlock(&WorkItem->Lock);
+}
+
+VOID
+WdfWorkItemFlush(
+	WDFWORKITEM Object
+)
+{
+	SHIM_WORKITEM* WorkItem = &Object->u.WorkItem;
+
+	pthread_mutex_lock(&WorkItem->Lock);
+
+	while (WorkItem->Thread) {
+		pthread_cond_wait(&WorkItem->Idle, &WorkItem->Lock);
+	}
+
+	pthread_mutex_unlock(&WorkItem->Lock);
+}
+
+WDFOBJECT
+WdfWorkItemGetParentObject(
+	WDFWORKITEM WorkItem
+)
+{
+	return WorkItem->Parent;
+}
+
+static VOID
+ShimWorkItemDelete(
+	WDFWORKITEM WorkItem
+)
+{
+	WdfWorkItemFlush(WorkItem);
+}
+
+//
+// Timers. Each armed timer has a thread waiting for its due time; a
+// stop or restart bumps the generation so the waiting thread lets go.
+//
+
+static void*
+ShimTimerThread(
+	void* Context
+)
+{
+	WDFTIMER Object = Context;
+	SHIM_TIMER* Timer = &Object->u.Timer;
+	struct timespec Deadline;
+	ULONG Generation;
+	BOOLEAN Fire;
+
+	pthread_mutex_lock(&Timer->Lock);
+
+	while (!Timer->Deleted) {
+		if (!Timer->Armed) {
+			pthread_cond_wait(&Timer->Changed, &Timer->Lock);
+			continue;
+		}
+
+		Generation = Timer->Generation;
+		Deadline = ShimDeadline(Timer->DueTime);
+		Fire = TRUE;
+
+		while (Timer->Generation == Generation && !Timer->Deleted) {
+			if (pthread_cond_timedwait(&Timer->Changed, &Timer->Lock, &Deadline) == ETIMEDOUT) {
+				break;
+			}
+		}
+
+		if (Timer->Generation != Generation || Timer->Deleted) {
+			Fire = FALSE;
+		}
+
+		if (!Fire) {
+			continue;
+		}
+
+		if (Timer->Config.Period != 0) {
+			Timer->DueTime = (LONGLONG)Timer->Config.Period * 10000;
+			Timer->Generation++;
+		}
+		else {
+			Timer->Armed = FALSE;
+		}
+
+		Timer->Running = TRUE;
+		pthread_mutex_unlock(&Timer->Lock);
+
+		Timer->Config.EvtTimerFunc(Object);
+
+		pthread_mutex_lock(&Timer->Lock);
+		Timer->Running = FALSE;
+		pthread_cond_broadcast(&Timer->Changed);
+	}
+
+	Timer->Thread = FALSE;
+	pthread_cond_broadcast(&Timer->Changed);
+	pthread_mutex_unlock(&Timer->Lock);
+
+	return NULL;
+}
+
+NTSTATUS
+WdfTimerCreate(
+	PWDF_TIMER_CONFIG Config,
+	PWDF_OBJECT_ATTRIBUTES Attributes,
+	WDFTIMER* Timer
+)
+{
+	WDFTIMER Object = ShimObjectCreate(Attributes, 0);
+	pthread_condattr_t CondAttributes;
+	pthread_t Thread;
+
+	if (Object == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Object->Type = ShimObjectTimer;
+	Object->u.Timer.Config = *Config;
+	pthread_mutex_init(&Object->u.Timer.Lock, NULL);
+	pthread_condattr_init(&CondAttributes);
+	pthread_condattr_setclock(&CondAttributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&Object->u.Timer.Changed, &CondAttributes);
+	pthread_condattr_destroy(&CondAttributes);
+
+	Object->u.Timer.Thread = TRUE;
+	pthread_create(&Thread, NULL, ShimTimerThread, Object);
+	pthread_detach(Thread);
+
+	*Timer = Object;
+
+	return STATUS_SUCCESS;
+}
+
+BOOLEAN
+WdfTimerStart(
+	WDFTIMER Object,
+	LONGLONG DueTime
+)
+{
+	SHIM_TIMER* Timer = &Object->u.Timer;
+	BOOLEAN WasArmed;
+
+	pthread_mutex_lock(&Timer->Lock);
+	WasArmed = Timer->Armed;
+	Timer->Armed = TRUE;
+	Timer->DueTime = ShimRelative(DueTime);
+	Timer->Generation++;
+	pthread_cond_broadcast(&Timer->Changed);
+	pthread_mutex_unlock(&Timer->Lock);
+
+	return WasArmed;
+}
+
+BOOLEAN
+WdfTimerStop(
+	WDFTIMER Object,
+	BOOLEAN Wait
+)
+{
+	SHIM_TIMER* Timer = &Object->u.Timer;
+	BOOLEAN WasArmed;
+
+	pthread_mutex_lock(&Timer->Lock);
+	WasArmed = Timer->Armed;
+	Timer->Armed = FALSE;
+	Timer->Generation++;
+	pthread_cond_broadcast(&Timer->Changed);
+
+	while (Wait && Timer->Running) {
+		pthread_cond_wait(&Timer->Changed, &Timer->Lock);
+	}
+
+	pthread_mutex_unlock(&Timer->Lock);
+
+	return WasArmed;
+}
+
+WDFOBJECT
+WdfTimerGetParentObject(
+	WDFTIMER Timer
+)
+{
+	return Timer->Parent;
+}
+
+static VOID
+ShimTimerDelete(
+	WDFTIMER Object
+)
+{
+	SHIM_TIMER* Timer = &Object->u.Timer;
+
+	WdfTimerStop(Object, TRUE);
+
+	pthread_mutex_lock(&Timer->Lock);
+	Timer->Deleted = TRUE;
+	pthread_cond_broadcast(&Timer->Changed);
+
+	while (Timer->Thread) {
+		pthread_cond_wait(&Timer->Changed, &Timer->Lock);
+	}
+
+	pthread_mutex_unlock(&Timer->Lock);
+}
+
+//
+// Memory
+//
+
+static volatile LONG ShimMemoryCreations;
+
+LONG
+ShimMemoryCreated(
+	VOID
+)
+{
+	return __atomic_load_n(&ShimMemoryCreations, __ATOMIC_SEQ_CST);
+}
+
+NTSTATUS
+WdfMemoryCreate(
+	PWDF_OBJECT_ATTRIBUTES Attributes,
+	POOL_TYPE PoolType,
+	ULONG PoolTag,
+	size_t BufferSize,
+	WDFMEMORY* Memory,
+	PVOID* Buffer
+)
+{
+	WDFMEMORY Object;
+
+	UNREFERENCED_PARAMETER(PoolType);
+	UNREFERENCED_PARAMETER(PoolTag);
+
+	Object = ShimObjectCreate(Attributes, 0);
+	if (Object == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Object->Type = ShimObjectMemory;
+	Object->u.Memory.Buffer = calloc(1, BufferSize);
+	Object->u.Memory.Size = BufferSize;
+
+	if (Object->u.Memory.Buffer == NULL) {
+		free(Object);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	__atomic_add_fetch(&ShimMemoryCreations, 1, __ATOMIC_SEQ_CST);
+	*Memory = Object;
+
+	if (Buffer != NULL) {
+		*Buffer = Object->u.Memory.Buffer;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+PVOID
+WdfMemoryGetBuffer(
+	WDFMEMORY Memory,
+	size_t* BufferSize
+)
+{
+	if (BufferSize != NULL) {
+		*BufferSize = Memory->u.Memory.Size;
+	}
+
+	return Memory->u.Memory.Buffer;
+}
+
+//
+// Requests
+//
+
+WDFREQUEST
+ShimRequestCreate(
+	ULONG IoControlCode,
+	PVOID InputBuffer,
+	size_t InputLength,
+	PVOID OutputBuffer,
+	size_t OutputLength
+)
+{
+	WDFREQUEST Object = ShimObjectCreate(NULL, 0);
+	SHIM_REQUEST* Request;
+
+	pthread_once(&ShimDispatcherOnce, ShimDispatcherInitialize);
+
+	if (Object == NULL) {
+		return NULL;
+	}
+
+	Object->Type = ShimObjectRequest;
+	Request = &Object->u.Request;
+	Request->IoControlCode = IoControlCode;
+	Request->InputBuffer = InputBuffer;
+	Request->InputLength = InputLength;
+	Request->OutputBuffer = OutputBuffer;
+	Request->OutputLength = OutputLength;
+	Request->OutputMdl.Buffer = OutputBuffer;
+	Request->OutputMdl.ByteCount = (ULONG)OutputLength;
+	Request->Status = STATUS_PENDING;
+
+	return Object;
+}
+
+SHIM_REQUEST*
+ShimRequest(
+	WDFREQUEST Request
+)
+{
+	return &Request->u.Request;
+}
+
+VOID
+ShimRequestCancel(
+	WDFREQUEST Object
+)
+{
+	SHIM_REQUEST* Request = &Object->u.Request;
+	PFN_WDF_REQUEST_CANCEL Cancel = NULL;
+
+	pthread_mutex_lock(&ShimDispatcherLock);
+	Request->Cancelled = TRUE;
+	if (Request->Cancelable) {
+		Request->Cancelable = FALSE;
+		Cancel = (PFN_WDF_REQUEST_CANCEL)Request->CancelRoutine;
+	}
+	pthread_mutex_unlock(&ShimDispatcherLock);
+
+	if (Cancel != NULL) {
+		Cancel(Object);
+	}
+}
+
+NTSTATUS
+WdfRequestRetrieveInputBuffer(
+	WDFREQUEST Object,
+	size_t MinimumRequiredLength,
+	PVOID* Buffer,
+	size_t* Length
+)
+{
+	SHIM_REQUEST* Request = &Object->u.Request;
+
+	if (Request->InputBuffer == NULL || Request->InputLength < MinimumRequiredLength) {
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	*Buffer = Request->InputBuffer;
+	if (Length != NULL) {
+		*Length = Request->InputLength;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfRequestRetrieveOutputBuffer(
+	WDFREQUEST Object,
+	size_t MinimumRequiredSize,
+	PVOID* Buffer,
+	size_t* Length
+)
+{
+	SHIM_REQUEST* Request = &Object->u.Request;
+
+	if (Request->OutputBuffer == NULL || Request->OutputLength < MinimumRequiredSize) {
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	*Buffer = Request->OutputBuffer;
+	if (Length != NULL) {
+		*Length = Request->OutputLength;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfRequestRetrieveOutputWdmMdl(
+	WDFREQUEST Object,
+	PMDL* Mdl
+)
+{
+	SHIM_REQUEST* Request = &Object->u.Request;
+
+	if (Request->OutputBuffer == NULL) {
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	*Mdl = &Request->OutputMdl;
+	return STATUS_SUCCESS;
+}
+
+VOID
+WdfRequestCompleteWithInformation(
+	WDFREQUEST Object,
+	NTSTATUS Status,
+	ULONG_PTR Information
+)
+{
+	SHIM_REQUEST* Request = &Object->u.Request;
+
+	if (Request->Completed) {
+		ShimAssertFailed("request completed twice", __FILE__, __LINE__);
+	}
+
+	//
+	// Buffered output goes back to the caller on completion, as much
+	// of it as the driver said it returned
+	//
+	if (Request->UserOutputBuffer != NULL && NT_SUCCESS(Status)) {
+		memcpy(Request->UserOutputBuffer,
+			Request->SystemBuffer,
+			min(Information, Request->OutputLength));
+	}
+
+	pthread_mutex_lock(&ShimDispatcherLock);
+	Request->Information = Information;
+	Request->Status = Status;
+	Request->Completed = TRUE;
+	pthread_cond_broadcast(&ShimDispatcherCond);
+	pthread_mutex_unlock(&ShimDispatcherLock);
+}
+
+VOID
+WdfRequestComplete(
+	WDFREQUEST Object,
+	NTSTATUS Status
+)
+{
+	WdfRequestCompleteWithInformation(Object, Status, Object->u.Request.Information);
+}
+
+VOID
+WdfRequestSetInformation(
+	WDFREQUEST Object,
+	ULONG_PTR Information
+)
+{
+	Object->u.Request.Information = Information;
+}
+
+NTSTATUS
+WdfRequestMarkCancelableEx(
+	WDFREQUEST Object,
+	PFN_WDF_REQUEST_CANCEL EvtRequestCancel
+)
+{
+	SHIM_REQUEST* Request = &Object->u.Request;
+	NTSTATUS status = STATUS_SUCCESS;
+
+	pthread_mutex_lock(&ShimDispatcherLock);
+
+	if (Request->Cancelled) {
+		status = STATUS_CANCELLED;
+	}
+	else {
+		Request->Cancelable = TRUE;
+		Request->CancelRoutine = (PVOID)EvtRequestCancel;
+	}
+
+	pthread_mutex_unlock(&ShimDispatcherLock);
+
+	return status;
+}
+
+NTSTATUS
+WdfRequestUnmarkCancelable(
+	WDFREQUEST Object
+)
+{
+	SHIM_REQUEST* Request = &Object->u.Request;
+	NTSTATUS status = STATUS_SUCCESS;
+
+	pthread_mutex_lock(&ShimDispatcherLock);
+
+	if (!Request->Cancelable) {
+		status = STATUS_CANCELLED;
+	}
+
+	Request->Cancelable = FALSE;
+
+	pthread_mutex_unlock(&ShimDispatcherLock);
+
+	return status;
+}
+
+WDFQUEUE
+WdfRequestGetIoQueue(
+	WDFREQUEST Request
+)
+{
+	return Request->u.Request.Queue;
+}
+
+WDFDEVICE
+WdfIoQueueGetDevice(
+	WDFQUEUE Queue
+)
+{
+	return Queue->Parent;
+}
+
+WDFDEVICE
+WdfFileObjectGetDevice(
+	WDFFILEOBJECT FileObject
+)
+{
+	return FileObject->Parent;
+}
+
+WDFDEVICE
+WdfPdoGetParent(
+	WDFDEVICE Device
+)
+{
+	return Device->Parent;
+}
+
+//
+// Devices, queues and file objects
+//
+
+struct _WDFDEVICE_INIT
+{
+	WDFDEVICE Parent;
+	BOOLEAN HasSddl;
+	char Sddl[SHIM_MAX_SDDL];
+	WDF_FILEOBJECT_CONFIG FileConfig;
+};
+
+#define SHIM_MAX_DEVICES 16
+
+typedef struct _SHIM_DEVICE_ENTRY
+{
+	WDFDEVICE Device;
+	BOOLEAN HasInterface;
+	GUID Interface;
+} SHIM_DEVICE_ENTRY;
+
+static pthread_mutex_t ShimDeviceLock = PTHREAD_MUTEX_INITIALIZER;
+static SHIM_DEVICE_ENTRY ShimDevices[SHIM_MAX_DEVICES];
+
+PWDFDEVICE_INIT
+WdfPdoInitAllocate(
+	WDFDEVICE ParentDevice
+)
+{
+	PWDFDEVICE_INIT DeviceInit = calloc(1, sizeof(*DeviceInit));
+
+	if (DeviceInit != NULL) {
+		DeviceInit->Parent = ParentDevice;
+	}
+
+	return DeviceInit;
+}
+
+VOID
+WdfDeviceInitFree(
+	PWDFDEVICE_INIT DeviceInit
+)
+{
+	free(DeviceInit);
+}
+
+NTSTATUS
+WdfDeviceInitAssignSDDLString(
+	PWDFDEVICE_INIT DeviceInit,
+	PCUNICODE_STRING SDDLString
+)
+{
+	ULONG i, Length = SDDLString->Length / sizeof(WCHAR);
+
+	if (Length >= SHIM_MAX_SDDL) {
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	for (i = 0; i < Length; i++) {
+		DeviceInit->Sddl[i] = (char)SDDLString->Buffer[i];
+	}
+
+	DeviceInit->Sddl[Length] = '\0';
+	DeviceInit->HasSddl = TRUE;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfPdoInitAssignRawDevice(
+	PWDFDEVICE_INIT DeviceInit,
+	const GUID* DeviceClassGuid
+)
+{
+	UNREFERENCED_PARAMETER(DeviceInit);
+	UNREFERENCED_PARAMETER(DeviceClassGuid);
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfPdoInitAssignDeviceID(
+	PWDFDEVICE_INIT DeviceInit,
+	PCUNICODE_STRING DeviceID
+)
+{
+	UNREFERENCED_PARAMETER(DeviceInit);
+	UNREFERENCED_PARAMETER(DeviceID);
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfPdoInitAddHardwareID(
+	PWDFDEVICE_INIT DeviceInit,
+	PCUNICODE_STRING HardwareID
+)
+{
+	UNREFERENCED_PARAMETER(DeviceInit);
+	UNREFERENCED_PARAMETER(HardwareID);
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfPdoInitAssignInstanceID(
+	PWDFDEVICE_INIT DeviceInit,
+	PCUNICODE_STRING InstanceID
+)
+{
+	UNREFERENCED_PARAMETER(DeviceInit);
+	UNREFERENCED_PARAMETER(InstanceID);
+	return STATUS_SUCCESS;
+}
+
+VOID
+WdfDeviceInitSetFileObjectConfig(
+	PWDFDEVICE_INIT DeviceInit,
+	PWDF_FILEOBJECT_CONFIG FileObjectConfig,
+	PWDF_OBJECT_ATTRIBUTES FileObjectAttributes
+)
+{
+	UNREFERENCED_PARAMETER(FileObjectAttributes);
+	DeviceInit->FileConfig = *FileObjectConfig;
+}
+
+NTSTATUS
+WdfDeviceCreate(
+	PWDFDEVICE_INIT* DeviceInit,
+	PWDF_OBJECT_ATTRIBUTES DeviceAttributes,
+	WDFDEVICE* Device
+)
+{
+	WDFDEVICE Object;
+	ULONG i;
+
+	Object = ShimObjectCreate(DeviceAttributes, 0);
+	if (Object == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Object->Type = ShimObjectDevice;
+	Object->Parent = (*DeviceInit)->Parent;
+	Object->u.Device.FileConfig = (*DeviceInit)->FileConfig;
+	Object->u.Device.HasSddl = (*DeviceInit)->HasSddl;
+	memcpy(Object->u.Device.Sddl, (*DeviceInit)->Sddl, sizeof(Object->u.Device.Sddl));
+
+	pthread_mutex_lock(&ShimDeviceLock);
+
+	for (i = 0; i < SHIM_MAX_DEVICES && ShimDevices[i].Device != NULL; i++) {
+	}
+
+	if (i < SHIM_MAX_DEVICES) {
+		ShimDevices[i].Device = Object;
+		ShimDevices[i].HasInterface = FALSE;
+	}
+
+	pthread_mutex_unlock(&ShimDeviceLock);
+
+	if (i == SHIM_MAX_DEVICES) {
+		WdfObjectDelete(Object);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	//
+	// The framework owns the init structure from here on
+	//
+	WdfDeviceInitFree(*DeviceInit);
+	*DeviceInit = NULL;
+	*Device = Object;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfDeviceCreateDeviceInterface(
+	WDFDEVICE Device,
+	const GUID* InterfaceClassGUID,
+	PCUNICODE_STRING ReferenceString
+)
+{
+	NTSTATUS status = STATUS_INVALID_DEVICE_REQUEST;
+	ULONG i;
+
+	UNREFERENCED_PARAMETER(ReferenceString);
+
+	pthread_mutex_lock(&ShimDeviceLock);
+
+	for (i = 0; i < SHIM_MAX_DEVICES; i++) {
+		if (ShimDevices[i].Device == Device) {
+			ShimDevices[i].Interface = *InterfaceClassGUID;
+			ShimDevices[i].HasInterface = TRUE;
+			status = STATUS_SUCCESS;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&ShimDeviceLock);
+
+	return status;
+}
+
+NTSTATUS
+WdfFdoAddStaticChild(
+	WDFDEVICE Fdo,
+	WDFDEVICE Child
+)
+{
+	return Child->Parent == Fdo ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+}
+
+//
+// Devices go away with their parent, their default queue with them
+//
+static VOID
+ShimDeviceDelete(
+	WDFOBJECT Object
+)
+{
+	WDFDEVICE Children[SHIM_MAX_DEVICES];
+	ULONG i, Count = 0;
+
+	pthread_mutex_lock(&ShimDeviceLock);
+
+	for (i = 0; i < SHIM_MAX_DEVICES; i++) {
+		if (ShimDevices[i].Device == Object) {
+			ShimDevices[i].Device = NULL;
+		}
+		else if (ShimDevices[i].Device != NULL && ShimDevices[i].Device->Parent == Object) {
+			Children[Count++] = ShimDevices[i].Device;
+		}
+	}
+
+	pthread_mutex_unlock(&ShimDeviceLock);
+
+	for (i = 0; i < Count; i++) {
+		WdfObjectDelete(Children[i]);
+	}
+
+	if (Object->Type == ShimObjectDevice) {
+		WdfObjectDelete(Object->u.Device.DefaultQueue);
+	}
+}
+
+NTSTATUS
+WdfIoQueueCreate(
+	WDFDEVICE Device,
+	PWDF_IO_QUEUE_CONFIG Config,
+	PWDF_OBJECT_ATTRIBUTES QueueAttributes,
+	WDFQUEUE* Queue
+)
+{
+	WDFQUEUE Object;
+
+	if (!Config->DefaultQueue || Device->u.Device.DefaultQueue != NULL) {
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	Object = ShimObjectCreate(QueueAttributes, 0);
+	if (Object == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Object->Type = ShimObjectQueue;
+	Object->Parent = Device;
+	Object->u.Queue = Config->EvtIoDeviceControl;
+	Device->u.Device.DefaultQueue = Object;
+
+	if (Queue != NULL) {
+		*Queue = Object;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+WDFDEVICE
+ShimDeviceFind(
+	const GUID* InterfaceClassGUID
+)
+{
+	WDFDEVICE Device = NULL;
+	ULONG i;
+
+	pthread_mutex_lock(&ShimDeviceLock);
+
+	for (i = 0; i < SHIM_MAX_DEVICES; i++) {
+		if (ShimDevices[i].Device != NULL &&
+			ShimDevices[i].HasInterface &&
+			memcmp(&ShimDevices[i].Interface, InterfaceClassGUID, sizeof(GUID)) == 0) {
+			Device = ShimDevices[i].Device;
+		}
+	}
+
+	pthread_mutex_unlock(&ShimDeviceLock);
+
+	return Device;
+}
+
+//
+// Access an SDDL string of allow ACEs, "D:P(A;;GRGW;;;BA)...", grants
+// Caller. The SIDs of a caller are the groups its token would have.
+//
+static ULONG
+ShimSddlAccess(
+	const char* Sddl,
+	SHIM_CALLER Caller
+)
+{
+	static const char* const UserSids[] = { "WD", "AU", "BU", NULL };
+	static const char* const AdministratorSids[] = { "WD", "AU", "BU", "BA", NULL };
+	static const char* const SystemSids[] = { "WD", "AU", "BA", "SY", NULL };
+	const char* const* Sids;
+	const char* Ace;
+	const char* Rights;
+	const char* Sid;
+	const char* End;
+	ULONG Access = 0, AceAccess, i;
+
+	Sids = Caller == ShimCallerSystem ? SystemSids :
+		Caller == ShimCallerAdministrator ? AdministratorSids : UserSids;
+
+	for (Ace = strchr(Sddl, '('); Ace != NULL; Ace = strchr(End, '(')) {
+		End = strchr(Ace, ')');
+		if (End == NULL) {
+			break;
+		}
+
+		//
+		// (type;flags;rights;object;inherited object;sid)
+		//
+		if (strncmp(Ace, "(A;", 3) != 0) {
+			continue;
+		}
+
+		Rights = strchr(Ace + 3, ';') + 1;
+		Sid = End;
+		while (Sid[-1] != ';') {
+			Sid--;
+		}
+
+		for (i = 0; Sids[i] != NULL; i++) {
+			if ((size_t)(End - Sid) == strlen(Sids[i]) && strncmp(Sid, Sids[i], End - Sid) == 0) {
+				break;
+			}
+		}
+
+		if (Sids[i] == NULL) {
+			continue;
+		}
+
+		AceAccess = 0;
+
+		for (; Rights[0] != ';' && Rights[1] != ';'; Rights += 2) {
+			if (strncmp(Rights, "GA", 2) == 0) {
+				AceAccess |= GENERIC_READ | GENERIC_WRITE;
+			}
+			else if (strncmp(Rights, "GR", 2) == 0) {
+				AceAccess |= GENERIC_READ;
+			}
+			else if (strncmp(Rights, "GW", 2) == 0) {
+				AceAccess |= GENERIC_WRITE;
+			}
+		}
+
+		Access |= AceAccess;
+	}
+
+	return Access;
+}
+
+NTSTATUS
+ShimDeviceOpen(
+	WDFDEVICE Device,
+	SHIM_CALLER Caller,
+	ULONG DesiredAccess,
+	WDFFILEOBJECT* FileObject
+)
+{
+	WDFFILEOBJECT File;
+	WDFREQUEST Request;
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG Granted;
+
+	Granted = Device->u.Device.HasSddl ?
+		ShimSddlAccess(Device->u.Device.Sddl, Caller) :
+		GENERIC_READ | GENERIC_WRITE;
+
+	if ((DesiredAccess & ~Granted) != 0) {
+		return STATUS_ACCESS_DENIED;
+	}
+
+	File = ShimObjectCreate(NULL, 0);
+	if (File == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	File->Type = ShimObjectFile;
+	File->Parent = Device;
+	File->u.FileAccess = DesiredAccess;
+
+	if (Device->u.Device.FileConfig.EvtDeviceFileCreate != NULL) {
+		Request = ShimRequestCreate(0, NULL, 0, NULL, 0);
+		if (Request == NULL) {
+			WdfObjectDelete(File);
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		Device->u.Device.FileConfig.EvtDeviceFileCreate(Device, Request, File);
+
+		status = Request->u.Request.Completed ? Request->u.Request.Status : STATUS_PENDING;
+		WdfObjectDelete(Request);
+	}
+
+	if (!NT_SUCCESS(status) || status == STATUS_PENDING) {
+		WdfObjectDelete(File);
+		return status == STATUS_PENDING ? STATUS_NOT_SUPPORTED : status;
+	}
+
+	*FileObject = File;
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+ShimDeviceClose(
+	WDFFILEOBJECT FileObject
+)
+{
+	WDFDEVICE Device = FileObject->Parent;
+
+	if (Device->u.Device.FileConfig.EvtFileClose != NULL) {
+		Device->u.Device.FileConfig.EvtFileClose(FileObject);
+	}
+
+	WdfObjectDelete(FileObject);
+}
+
+NTSTATUS
+ShimDeviceIoControl(
+	WDFFILEOBJECT FileObject,
+	WDFREQUEST Object
+)
+{
+	WDFDEVICE Device = FileObject->Parent;
+	WDFQUEUE Queue = Device->u.Device.DefaultQueue;
+	SHIM_REQUEST* Request = &Object->u.Request;
+	ULONG Access = ACCESS_FROM_CTL_CODE(Request->IoControlCode);
+	BOOLEAN Completed;
+	size_t Length;
+
+	if (((Access & FILE_READ_ACCESS) != 0 && (FileObject->u.FileAccess & GENERIC_READ) == 0) ||
+		((Access & FILE_WRITE_ACCESS) != 0 && (FileObject->u.FileAccess & GENERIC_WRITE) == 0)) {
+		return STATUS_ACCESS_DENIED;
+	}
+
+	if (Queue == NULL || Queue->u.Queue == NULL) {
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	//
+	// Buffered codes share one system buffer for input and output,
+	// direct ones buffer the input and map the output
+	//
+	switch (METHOD_FROM_CTL_CODE(Request->IoControlCode)) {
+	case METHOD_BUFFERED:
+		Length = max(Request->InputLength, Request->OutputLength);
+		Request->SystemBuffer = calloc(1, Length != 0 ? Length : 1);
+		if (Request->SystemBuffer == NULL) {
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		if (Request->InputLength != 0) {
+			memcpy(Request->SystemBuffer, Request->InputBuffer, Request->InputLength);
+		}
+
+		Request->UserOutputBuffer = Request->OutputLength != 0 ? Request->OutputBuffer : NULL;
+		Request->InputBuffer = Request->InputLength != 0 ? Request->SystemBuffer : NULL;
+		Request->OutputBuffer = Request->OutputLength != 0 ? Request->SystemBuffer : NULL;
+		break;
+	case METHOD_IN_DIRECT:
+	case METHOD_OUT_DIRECT:
+		if (Request->InputLength != 0) {
+			Request->SystemBuffer = malloc(Request->InputLength);
+			if (Request->SystemBuffer == NULL) {
+				return STATUS_INSUFFICIENT_RESOURCES;
+			}
+
+			memcpy(Request->SystemBuffer, Request->InputBuffer, Request->InputLength);
+			Request->InputBuffer = Request->SystemBuffer;
+		}
+		break;
+	default:
+		break;
+	}
+
+	Request->Queue = Queue;
+	Request->FileObject = FileObject;
+
+	Queue->u.Queue(Queue,
+		Object,
+		Request->OutputLength,
+		Request->InputLength,
+		Request->IoControlCode);
+
+	pthread_mutex_lock(&ShimDispatcherLock);
+	Completed = Request->Completed;
+	pthread_mutex_unlock(&ShimDispatcherLock);
+
+	return Completed ? Request->Status : STATUS_PENDING;
+}
+
+NTSTATUS
+ShimRequestWait(
+	WDFREQUEST Object,
+	ULONG TimeoutMs
+)
+{
+	SHIM_REQUEST* Request = &Object->u.Request;
+	struct timespec Deadline = ShimDeadline((LONGLONG)TimeoutMs * 10000);
+	NTSTATUS status;
+
+	pthread_mutex_lock(&ShimDispatcherLock);
+
+	while (!Request->Completed) {
+		if (pthread_cond_timedwait(&ShimDispatcherCond, &ShimDispatcherLock, &Deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+
+	status = Request->Completed ? Request->Status : STATUS_TIMEOUT;
+
+	pthread_mutex_unlock(&ShimDispatcherLock);
+
+	return status;
+}
+
+WDFDRIVER
+WdfDeviceGetDriver(
+	WDFDEVICE Device
+)
+{
+	UNREFERENCED_PARAMETER(Device);
+	return NULL;
+}
+
+PDRIVER_OBJECT
+WdfDriverWdmGetDriverObject(
+	WDFDRIVER Driver
+)
+{
+	UNREFERENCED_PARAMETER(Driver);
+	return NULL;
+}
+
+NTSTATUS
+IoRegisterPlugPlayNotification(
+	IO_NOTIFICATION_EVENT_CATEGORY EventCategory,
+	ULONG EventCategoryFlags,
+	PVOID EventCategoryData,
+	PDRIVER_OBJECT DriverObject,
+	PDRIVER_NOTIFICATION_CALLBACK_ROUTINE CallbackRoutine,
+	PVOID Context,
+	PVOID* NotificationEntry
+)
+{
+	UNREFERENCED_PARAMETER(EventCategory);
+	UNREFERENCED_PARAMETER(EventCategoryFlags);
+	UNREFERENCED_PARAMETER(EventCategoryData);
+	UNREFERENCED_PARAMETER(DriverObject);
+	UNREFERENCED_PARAMETER(CallbackRoutine);
+	UNREFERENCED_PARAMETER(Context);
+
+	*NotificationEntry = NULL;
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+IoUnregisterPlugPlayNotificationEx(
+	PVOID NotificationEntry
+)
+{
+	UNREFERENCED_PARAMETER(NotificationEntry);
+	return STATUS_SUCCESS;
+}
+
+static volatile LONG ShimFailedAction = -1;
+
+VOID
+WdfDeviceSetFailed(
+	WDFDEVICE Device,
+	WDF_DEVICE_FAILED_ACTION FailedAction
+)
+{
+	UNREFERENCED_PARAMETER(Device);
+	InterlockedExchange(&ShimFailedAction, (LONG)FailedAction);
+}
+
+LONG
+ShimDeviceFailed(
+	VOID
+)
+{
+	return InterlockedExchange(&ShimFailedAction, -1);
+}
+
+//
+// I/O targets
+//
+
+NTSTATUS
+WdfIoTargetCreate(
+	WDFDEVICE Device,
+	PWDF_OBJECT_ATTRIBUTES IoTargetAttributes,
+	WDFIOTARGET* IoTarget
+)
+{
+	WDFIOTARGET Object = ShimObjectCreate(IoTargetAttributes, 0);
+
+	UNREFERENCED_PARAMETER(Device);
+
+	if (Object == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Object->Type = ShimObjectIoTarget;
+	*IoTarget = Object;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfIoTargetOpen(
+	WDFIOTARGET IoTarget,
+	PWDF_IO_TARGET_OPEN_PARAMS OpenParams
+)
+{
+	UNREFERENCED_PARAMETER(IoTarget);
+	UNREFERENCED_PARAMETER(OpenParams);
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+WdfIoTargetClose(
+	WDFIOTARGET IoTarget
+)
+{
+	UNREFERENCED_PARAMETER(IoTarget);
+}
+
+VOID
+ShimIoTargetConnect(
+	WDFIOTARGET IoTarget,
+	const SHIM_BUS_DEVICE* Device
+)
+{
+	IoTarget->u.IoTarget = *Device;
+}
+
+static NTSTATUS
+ShimBusWrite(
+	WDFIOTARGET IoTarget,
+	const UCHAR* Data,
+	ULONG Length
+)
+{
+	if (IoTarget->u.IoTarget.Write == NULL) {
+		return STATUS_NO_SUCH_DEVICE;
+	}
+
+	return IoTarget->u.IoTarget.Write(IoTarget->u.IoTarget.Context, Data, Length);
+}
+
+static NTSTATUS
+ShimBusRead(
+	WDFIOTARGET IoTarget,
+	UCHAR* Data,
+	ULONG Length,
+	ULONG* BytesRead
+)
+{
+	*BytesRead = 0;
+
+	if (IoTarget->u.IoTarget.Read == NULL) {
+		return STATUS_NO_SUCH_DEVICE;
+	}
+
+	return IoTarget->u.IoTarget.Read(IoTarget->u.IoTarget.Context, Data, Length, BytesRead);
+}
+
+NTSTATUS
+WdfIoTargetSendWriteSynchronously(
+	WDFIOTARGET IoTarget,
+	WDFREQUEST Request,
+	PWDF_MEMORY_DESCRIPTOR InputBuffer,
+	PLONGLONG DeviceOffset,
+	PWDF_REQUEST_SEND_OPTIONS RequestOptions,
+	PULONG_PTR BytesWritten
+)
+{
+	NTSTATUS status;
+
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(DeviceOffset);
+	UNREFERENCED_PARAMETER(RequestOptions);
+
+	status = ShimBusWrite(IoTarget,
+		InputBuffer->u.BufferType.Buffer,
+		InputBuffer->u.BufferType.Length);
+
+	if (BytesWritten != NULL) {
+		*BytesWritten = NT_SUCCESS(status) ? InputBuffer->u.BufferType.Length : 0;
+	}
+
+	return status;
+}
+
+NTSTATUS
+WdfIoTargetSendReadSynchronously(
+	WDFIOTARGET IoTarget,
+	WDFREQUEST Request,
+	PWDF_MEMORY_DESCRIPTOR OutputBuffer,
+	PLONGLONG DeviceOffset,
+	PWDF_REQUEST_SEND_OPTIONS RequestOptions,
+	PULONG_PTR BytesRead
+)
+{
+	NTSTATUS status;
+	ULONG Read;
+
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(DeviceOffset);
+	UNREFERENCED_PARAMETER(RequestOptions);
+
+	status = ShimBusRead(IoTarget,
+		OutputBuffer->u.BufferType.Buffer,
+		OutputBuffer->u.BufferType.Length,
+		&Read);
+
+	if (BytesRead != NULL) {
+		*BytesRead = Read;
+	}
+
+	return status;
+}
+
+NTSTATUS
+WdfIoTargetSendIoctlSynchronously(
+	WDFIOTARGET IoTarget,
+	WDFREQUEST Request,
+	ULONG IoctlCode,
+	PWDF_MEMORY_DESCRIPTOR InputBuffer,
+	PWDF_MEMORY_DESCRIPTOR OutputBuffer,
+	PWDF_REQUEST_SEND_OPTIONS RequestOptions,
+	PULONG_PTR BytesReturned
+)
+{
+	SPB_TRANSFER_LIST* List;
+	SPB_TRANSFER_LIST_ENTRY* Entry;
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG_PTR Transferred = 0;
+	ULONG i, Read;
+
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(OutputBuffer);
+	UNREFERENCED_PARAMETER(RequestOptions);
+
+	if (IoctlCode != IOCTL_SPB_EXECUTE_SEQUENCE) {
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	List = InputBuffer->u.BufferType.Buffer;
+
+	if (IoTarget->u.IoTarget.Sequence != NULL) {
+		status = IoTarget->u.IoTarget.Sequence(IoTarget->u.IoTarget.Context, List->TransferCount);
+	}
+
+	for (i = 0; i < List->TransferCount && NT_SUCCESS(status); i++) {
+		Entry = &List->Transfers[i];
+
+		if (Entry->Direction == SpbTransferDirectionToDevice) {
+			status = ShimBusWrite(IoTarget,
+				Entry->Buffer.Simple.Buffer,
+				Entry->Buffer.Simple.BufferCb);
+			Transferred += NT_SUCCESS(status) ? Entry->Buffer.Simple.BufferCb : 0;
+		}
+		else {
+			status = ShimBusRead(IoTarget,
+				Entry->Buffer.Simple.Buffer,
+				Entry->Buffer.Simple.BufferCb,
+				&Read);
+			Transferred += Read;
+		}
+	}
+
+	if (BytesReturned != NULL) {
+		*BytesReturned = Transferred;
+	}
+
+	return status;
+}
+
+NTSTATUS
+WdfRequestCreate(
+	PWDF_OBJECT_ATTRIBUTES RequestAttributes,
+	WDFIOTARGET IoTarget,
+	WDFREQUEST* Request
+)
+{
+	WDFREQUEST Object = ShimObjectCreate(RequestAttributes, 0);
+
+	UNREFERENCED_PARAMETER(IoTarget);
+
+	if (Object == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	Object->Type = ShimObjectRequest;
+	*Request = Object;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfRequestReuse(
+	WDFREQUEST Request,
+	PWDF_REQUEST_REUSE_PARAMS ReuseParams
+)
+{
+	//
+	// Reusing a request the target still owns is a driver bug
+	//
+	NT_ASSERT(!Request->u.Request.Sent);
+
+	Request->u.Request.Status = ReuseParams->Status;
+	Request->u.Request.Information = 0;
+	Request->u.Request.Completed = FALSE;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfIoTargetFormatRequestForRead(
+	WDFIOTARGET IoTarget,
+	WDFREQUEST Request,
+	WDFMEMORY OutputBuffer,
+	PWDFMEMORY_OFFSET OutputBufferOffset,
+	PLONGLONG DeviceOffset
+)
+{
+	UNREFERENCED_PARAMETER(IoTarget);
+	UNREFERENCED_PARAMETER(DeviceOffset);
+
+	Request->u.Request.ReadBuffer = (PUCHAR)OutputBuffer->u.Memory.Buffer + OutputBufferOffset->BufferOffset;
+	Request->u.Request.ReadLength = (ULONG)OutputBufferOffset->BufferLength;
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+WdfRequestSetCompletionRoutine(
+	WDFREQUEST Request,
+	PFN_WDF_REQUEST_COMPLETION_ROUTINE CompletionRoutine,
+	WDFCONTEXT CompletionContext
+)
+{
+	Request->u.Request.CompletionRoutine = (PVOID)CompletionRoutine;
+	Request->u.Request.CompletionContext = CompletionContext;
+}
+
+#define SHIM_SENDS_MAX 16
+
+typedef struct _SHIM_SEND
+{
+	WDFREQUEST Request;
+	WDFIOTARGET Target;
+} SHIM_SEND;
+
+static pthread_mutex_t ShimSendLock = PTHREAD_MUTEX_INITIALIZER;
+static BOOLEAN ShimSendDeferred;
+static SHIM_SEND ShimSends[SHIM_SENDS_MAX];
+static ULONG ShimSendCount;
+static ULONG ShimSendFailures;
+static NTSTATUS ShimSendFailStatus;
+static ULONG ShimShortReads;
+static ULONG ShimShortfall;
+
+//
+// The bus transfer of a send and its completion
+//
+static VOID
+ShimSendComplete(
+	WDFREQUEST Request,
+	WDFIOTARGET Target
+)
+{
+	SHIM_REQUEST* Shim = &Request->u.Request;
+	WDF_REQUEST_COMPLETION_PARAMS Params;
+	PFN_WDF_REQUEST_COMPLETION_ROUTINE Completion;
+	ULONG Length = Shim->ReadLength;
+	ULONG Read;
+
+	pthread_mutex_lock(&ShimSendLock);
+
+	if (ShimShortReads != 0) {
+		ShimShortReads--;
+		Length -= min(Length, ShimShortfall);
+	}
+
+	pthread_mutex_unlock(&ShimSendLock);
+
+	RtlZeroMemory(&Params, sizeof(Params));
+	Params.Size = sizeof(Params);
+	Params.IoStatus.Status = ShimBusRead(Target, Shim->ReadBuffer, Length, &Read);
+	Params.IoStatus.Information = Read;
+
+	Shim->Status = Params.IoStatus.Status;
+	Shim->Information = Read;
+
+	//
+	// Back with the driver, the completion routine may send it again
+	//
+	Shim->Sent = FALSE;
+
+	Completion = (PFN_WDF_REQUEST_COMPLETION_ROUTINE)Shim->CompletionRoutine;
+	Completion(Request, Target, &Params, Shim->CompletionContext);
+}
+
+BOOLEAN
+WdfRequestSend(
+	WDFREQUEST Request,
+	WDFIOTARGET Target,
+	PWDF_REQUEST_SEND_OPTIONS Options
+)
+{
+	SHIM_REQUEST* Shim = &Request->u.Request;
+
+	UNREFERENCED_PARAMETER(Options);
+
+	pthread_mutex_lock(&ShimSendLock);
+
+	NT_ASSERT(!Shim->Sent);
+
+	if (ShimSendFailures != 0) {
+		ShimSendFailures--;
+		Shim->Status = ShimSendFailStatus;
+		pthread_mutex_unlock(&ShimSendLock);
+		return FALSE;
+	}
+
+	Shim->Sent = TRUE;
+
+	if (ShimSendDeferred) {
+		NT_ASSERT(ShimSendCount < SHIM_SENDS_MAX);
+		ShimSends[ShimSendCount].Request = Request;
+		ShimSends[ShimSendCount].Target = Target;
+		ShimSendCount++;
+		pthread_mutex_unlock(&ShimSendLock);
+		return TRUE;
+	}
+
+	pthread_mutex_unlock(&ShimSendLock);
+
+	ShimSendComplete(Request, Target);
+
+	return TRUE;
+}
+
+VOID
+ShimRequestSetDeferred(
+	BOOLEAN Deferred
+)
+{
+	pthread_mutex_lock(&ShimSendLock);
+	NT_ASSERT(ShimSendCount == 0);
+	ShimSendDeferred = Deferred;
+	pthread_mutex_unlock(&ShimSendLock);
+}
+
+BOOLEAN
+ShimRequestWaitSends(
+	ULONG Count,
+	ULONG TimeoutMs
+)
+{
+	ULONG Waited;
+	BOOLEAN Queued = FALSE;
+
+	for (Waited = 0; Waited <= TimeoutMs && !Queued; Waited++) {
+		pthread_mutex_lock(&ShimSendLock);
+		Queued = ShimSendCount >= Count;
+		pthread_mutex_unlock(&ShimSendLock);
+
+		if (!Queued) {
+			usleep(1000);
+		}
+	}
+
+	return Queued;
+}
+
+BOOLEAN
+ShimRequestCompleteSend(
+	ULONG Index
+)
+{
+	SHIM_SEND Send;
+
+	pthread_mutex_lock(&ShimSendLock);
+
+	if (Index >= ShimSendCount) {
+		pthread_mutex_unlock(&ShimSendLock);
+		return FALSE;
+	}
+
+	Send = ShimSends[Index];
+	memmove(&ShimSends[Index],
+		&ShimSends[Index + 1],
+		(ShimSendCount - Index - 1) * sizeof(ShimSends[0]));
+	ShimSendCount--;
+
+	pthread_mutex_unlock(&ShimSendLock);
+
+	ShimSendComplete(Send.Request, Send.Target);
+
+	return TRUE;
+}
+
+VOID
+ShimRequestFailSends(
+	ULONG Count,
+	NTSTATUS Status
+)
+{
+	pthread_mutex_lock(&ShimSendLock);
+	ShimSendFailures = Count;
+	ShimSendFailStatus = Status;
+	pthread_mutex_unlock(&ShimSendLock);
+}
+
+VOID
+ShimRequestShortReads(
+	ULONG Count,
+	ULONG Shortfall
+)
+{
+	pthread_mutex_lock(&ShimSendLock);
+	ShimShortReads = Count;
+	ShimShortfall = Shortfall;
+	pthread_mutex_unlock(&ShimSendLock);
+}
+
+NTSTATUS
+WdfRequestGetStatus(
+	WDFREQUEST Request
+)
+{
+	return Request->u.Request.Status;
+}
@@ -0,0 +1,853 @@
+/*++
+	Module Name:
+
+		wdm.h
+
+	Abstract:
+
+		The part of the kernel API the driver sources use, for building
+		them as user mode programs on Linux. Dispatcher objects are
+		pthread based, IRQLs and pools are only bookkeeping.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define FORCEINLINE static inline
+#define NTAPI
+#define NTSYSAPI
+#define __forceinline inline
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _In_z_
+#define _Use_decl_annotations_
+#define _IRQL_requires_(x)
+#define _IRQL_requires_max_(x)
+#define _In_reads_(x)
+#define _In_reads_opt_(x)
+#define _In_reads_bytes_(x)
+#define _In_reads_bytes_opt_(x)
+#define _Out_writes_(x)
+#define _Out_writes_bytes_(x)
+#define _Out_writes_bytes_opt_(x)
+#define _Out_writes_bytes_to_(x, y)
+#define _Inout_updates_bytes_(x)
+#define _When_(x, y)
+#define _Must_inspect_result_
+#define _Function_class_(x)
+#define _Analysis_assume_(x)
+
+#define __int64 long long
+
+typedef void VOID, *PVOID, *LPVOID;
+typedef const void* PCVOID;
+typedef char CHAR, *PCHAR;
+typedef unsigned char UCHAR, *PUCHAR, BYTE, *PBYTE, UINT8, *PUINT8, BOOLEAN, *PBOOLEAN;
+typedef signed char INT8;
+typedef short SHORT, CSHORT, INT16;
+typedef unsigned short USHORT, *PUSHORT, WORD, UINT16, *PUINT16;
+
+//
+// Built with -fshort-wchar so L"" literals match the 16-bit WCHAR
+//
+typedef wchar_t WCHAR, *PWCHAR, *PWSTR;
+typedef const wchar_t* PCWSTR;
+
+//
+// The C library wide string routines assume a 32-bit wchar_t
+//
+#define wcslen ShimWcslen
+
+FORCEINLINE size_t
+ShimWcslen(
+	const wchar_t* String
+)
+{
+	size_t Length = 0;
+
+	while (String[Length] != 0) {
+		Length++;
+	}
+
+	return Length;
+}
+typedef int INT, LONG, *PLONG, INT32, NTSTATUS;
+typedef unsigned int UINT, ULONG, *PULONG, DWORD, UINT32, *PUINT32;
+typedef long long LONGLONG, LONG64, INT64, *PLONGLONG;
+typedef unsigned long long ULONGLONG, ULONG64, *PULONG64, UINT64, DWORD64;
+typedef uintptr_t ULONG_PTR, SIZE_T, *PSIZE_T, *PULONG_PTR;
+typedef intptr_t LONG_PTR;
+typedef PVOID HANDLE, *PHANDLE;
+typedef const char* PCSTR;
+typedef UCHAR KIRQL, *PKIRQL;
+typedef LONG KPRIORITY;
+
+typedef union _LARGE_INTEGER
+{
+	struct
+	{
+		ULONG LowPart;
+		LONG HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _GUID
+{
+	ULONG Data1;
+	USHORT Data2;
+	USHORT Data3;
+	UCHAR Data4[8];
+} GUID, *LPGUID;
+
+typedef const GUID* LPCGUID;
+
+#define EXTERN_C
+#define DECLSPEC_SELECTANY __attribute__((weak))
+
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+	EXTERN_C const GUID DECLSPEC_SELECTANY name \
+		= { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+#define IsEqualGUID(a, b) (memcmp((a), (b), sizeof(GUID)) == 0)
+
+#define REG_SZ 1
+#define REG_BINARY 3
+#define REG_DWORD 4
+typedef const GUID* PCGUID;
+
+typedef struct _UNICODE_STRING
+{
+	USHORT Length;
+	USHORT MaximumLength;
+	PWCHAR Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+#define DECLARE_CONST_UNICODE_STRING(_var, _string) \
+	const WCHAR _var##_buffer[] = _string; \
+	const UNICODE_STRING _var = { sizeof(_string) - sizeof(WCHAR), sizeof(_string), (PWCHAR)_var##_buffer }
+
+#define TRUE 1
+#define FALSE 0
+
+#define VOID void
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+
+#define C_ASSERT(e) _Static_assert(e, #e)
+#define FIELD_OFFSET(type, field) ((LONG)offsetof(type, field))
+#define RTL_FIELD_SIZE(type, field) (sizeof(((type*)0)->field))
+#define RTL_NUMBER_OF(A) (sizeof(A) / sizeof((A)[0]))
+#define ARRAYSIZE(A) RTL_NUMBER_OF(A)
+#define CONTAINING_RECORD(address, type, field) \
+	((type*)((PCHAR)(address) - offsetof(type, field)))
+#define ALIGN_UP_BY(length, alignment) \
+	(((ULONG_PTR)(length) + (alignment) - 1) & ~((ULONG_PTR)(alignment) - 1))
+#define ALIGN_DOWN_BY(length, alignment) \
+	((ULONG_PTR)(length) & ~((ULONG_PTR)(alignment) - 1))
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define MAXUCHAR 0xff
+#define MAXUSHORT 0xffff
+#define MAXULONG 0xffffffffU
+#define MAXLONG 0x7fffffff
+#define MINLONG (~0x7fffffff)
+#define MAXSHORT 0x7fff
+#define MINSHORT (~0x7fff)
+#define MAXULONG64 (~0ULL)
+
+//
+// Status codes
+//
+
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+
+#define STATUS_SUCCESS                   ((NTSTATUS)0x00000000L)
+#define STATUS_WAIT_0                    ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                   ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING                   ((NTSTATUS)0x00000103L)
+#define STATUS_MORE_ENTRIES              ((NTSTATUS)0x00000105L)
+#define STATUS_BUFFER_OVERFLOW           ((NTSTATUS)0x80000005L)
+#define STATUS_NO_MORE_ENTRIES           ((NTSTATUS)0x8000001AL)
+#define STATUS_UNSUCCESSFUL              ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED           ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_INFO_CLASS        ((NTSTATUS)0xC0000003L)
+#define STATUS_INFO_LENGTH_MISMATCH      ((NTSTATUS)0xC0000004L)
+#define STATUS_INVALID_HANDLE            ((NTSTATUS)0xC0000008L)
+#define STATUS_INVALID_PARAMETER         ((NTSTATUS)0xC000000DL)
+#define STATUS_NO_SUCH_DEVICE            ((NTSTATUS)0xC000000EL)
+#define STATUS_INVALID_DEVICE_REQUEST    ((NTSTATUS)0xC0000010L)
+#define STATUS_END_OF_FILE               ((NTSTATUS)0xC0000011L)
+#define STATUS_ACCESS_DENIED             ((NTSTATUS)0xC0000022L)
+#define STATUS_BUFFER_TOO_SMALL          ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_NAME_NOT_FOUND     ((NTSTATUS)0xC0000034L)
+#define STATUS_DATA_ERROR                ((NTSTATUS)0xC000003EL)
+#define STATUS_INSUFFICIENT_RESOURCES    ((NTSTATUS)0xC000009AL)
+#define STATUS_DEVICE_NOT_READY          ((NTSTATUS)0xC00000A3L)
+#define STATUS_IO_TIMEOUT                ((NTSTATUS)0xC00000B5L)
+#define STATUS_NOT_SUPPORTED             ((NTSTATUS)0xC00000BBL)
+#define STATUS_INTERNAL_ERROR            ((NTSTATUS)0xC00000E5L)
+#define STATUS_INVALID_PARAMETER_1       ((NTSTATUS)0xC00000EFL)
+#define STATUS_INVALID_PARAMETER_2       ((NTSTATUS)0xC00000F0L)
+#define STATUS_CANCELLED                 ((NTSTATUS)0xC0000120L)
+#define STATUS_NOT_FOUND                 ((NTSTATUS)0xC0000225L)
+#define STATUS_INVALID_DEVICE_STATE      ((NTSTATUS)0xC0000184L)
+#define STATUS_DEVICE_BUSY               ((NTSTATUS)0x80000011L)
+#define STATUS_NO_DATA_DETECTED          ((NTSTATUS)0x80000022L)
+#define STATUS_DEVICE_PROTOCOL_ERROR     ((NTSTATUS)0xC0000186L)
+#define STATUS_DEVICE_CONFIGURATION_ERROR ((NTSTATUS)0xC0000182L)
+#define STATUS_DEVICE_DATA_ERROR         ((NTSTATUS)0xC000009CL)
+#define STATUS_INVALID_BUFFER_SIZE       ((NTSTATUS)0xC0000206L)
+#define STATUS_IMAGE_CHECKSUM_MISMATCH   ((NTSTATUS)0xC0000221L)
+#define STATUS_INVALID_IMAGE_FORMAT      ((NTSTATUS)0xC000007BL)
+#define STATUS_FILE_TOO_LARGE            ((NTSTATUS)0xC0000904L)
+#define STATUS_RETRY                     ((NTSTATUS)0xC000022DL)
+#define STATUS_REQUEST_ABORTED           ((NTSTATUS)0xC0000240L)
+#define STATUS_ALERTED                   ((NTSTATUS)0x00000101L)
+#define STATUS_DEVICE_REMOVED            ((NTSTATUS)0xC00002B6L)
+
+//
+// IRQL
+//
+
+#define PASSIVE_LEVEL 0
+#define APC_LEVEL 1
+#define DISPATCH_LEVEL 2
+
+KIRQL
+KeGetCurrentIrql(
+	VOID
+);
+
+//
+// Pools
+//
+
+typedef enum _POOL_TYPE
+{
+	NonPagedPool,
+	PagedPool,
+	NonPagedPoolNx = 512,
+} POOL_TYPE;
+
+PVOID
+ExAllocatePoolWithTag(
+	POOL_TYPE PoolType,
+	SIZE_T NumberOfBytes,
+	ULONG Tag
+);
+
+VOID
+ExFreePoolWithTag(
+	PVOID P,
+	ULONG Tag
+);
+
+//
+// Pool allocations not freed yet, for leak checks
+//
+LONG
+ShimPoolOutstanding(
+	VOID
+);
+
+#define RtlCopyMemory(d, s, l) memcpy((d), (s), (l))
+#define RtlMoveMemory(d, s, l) memmove((d), (s), (l))
+#define RtlZeroMemory(d, l) memset((d), 0, (l))
+#define RtlFillMemory(d, l, f) memset((d), (f), (l))
+#define RtlEqualMemory(a, b, l) (memcmp((a), (b), (l)) == 0)
+
+SIZE_T
+RtlCompareMemory(
+	const VOID* Source1,
+	const VOID* Source2,
+	SIZE_T Length
+);
+
+ULONG
+RtlComputeCrc32(
+	ULONG PartialCrc,
+	PCVOID Buffer,
+	ULONG Length
+);
+
+VOID
+RtlInitUnicodeString(
+	PUNICODE_STRING DestinationString,
+	PCWSTR SourceString
+);
+
+#define RtlInitEmptyUnicodeString(s, b, l) \
+	((s)->Length = 0, (s)->MaximumLength = (USHORT)(l), (s)->Buffer = (b))
+
+//
+// Interlocked operations
+//
+
+#define InterlockedIncrement(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p) __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedAdd(p, v) __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedAdd64(p, v) __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedOr(p, v) __atomic_fetch_or((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedAnd(p, v) __atomic_fetch_and((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangePointer(p, v) ShimExchangePointer((PVOID*)(p), (PVOID)(v))
+
+FORCEINLINE PVOID
+ShimExchangePointer(
+	PVOID* Target,
+	PVOID Value
+)
+{
+	return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE LONG
+InterlockedCompareExchange(
+	volatile LONG* Destination,
+	LONG Exchange,
+	LONG Comperand
+)
+{
+	__atomic_compare_exchange_n(Destination, &Comperand, Exchange, 0,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return Comperand;
+}
+
+FORCEINLINE LONG64
+InterlockedCompareExchange64(
+	volatile LONG64* Destination,
+	LONG64 Exchange,
+	LONG64 Comperand
+)
+{
+	__atomic_compare_exchange_n(Destination, &Comperand, Exchange, 0,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return Comperand;
+}
+
+FORCEINLINE PVOID
+ShimCompareExchangePointer(
+	PVOID volatile* Destination,
+	PVOID Exchange,
+	PVOID Comperand
+)
+{
+	__atomic_compare_exchange_n(Destination, &Comperand, Exchange, 0,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return Comperand;
+}
+
+#define InterlockedCompareExchangePointer(p, e, c) \
+	ShimCompareExchangePointer((PVOID volatile*)(p), (PVOID)(e), (PVOID)(c))
+
+#define KeMemoryBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define ReadNoFence(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+
+//
+// Dispatcher objects
+//
+
+typedef enum _EVENT_TYPE
+{
+	NotificationEvent,
+	SynchronizationEvent
+} EVENT_TYPE;
+
+typedef enum _KWAIT_REASON
+{
+	Executive
+} KWAIT_REASON;
+
+typedef enum _MODE
+{
+	KernelMode,
+	UserMode
+} KPROCESSOR_MODE, MODE;
+
+typedef struct _KEVENT
+{
+	EVENT_TYPE Type;
+	volatile LONG State;
+	PVOID Object;
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+typedef struct _KTHREAD* PKTHREAD;
+typedef struct _KTHREAD* PETHREAD;
+typedef struct _KDPC* PKDPC;
+
+#define IO_NO_INCREMENT 0
+#define LOW_REALTIME_PRIORITY 16
+#define HIGH_PRIORITY 31
+
+VOID
+KeInitializeEvent(
+	PKEVENT Event,
+	EVENT_TYPE Type,
+	BOOLEAN State
+);
+
+LONG
+KeSetEvent(
+	PKEVENT Event,
+	KPRIORITY Increment,
+	BOOLEAN Wait
+);
+
+VOID
+KeClearEvent(
+	PKEVENT Event
+);
+
+LONG
+KeResetEvent(
+	PKEVENT Event
+);
+
+LONG
+KeReadStateEvent(
+	PKEVENT Event
+);
+
+NTSTATUS
+KeWaitForSingleObject(
+	PVOID Object,
+	KWAIT_REASON WaitReason,
+	KPROCESSOR_MODE WaitMode,
+	BOOLEAN Alertable,
+	PLARGE_INTEGER Timeout
+);
+
+NTSTATUS
+KeDelayExecutionThread(
+	KPROCESSOR_MODE WaitMode,
+	BOOLEAN Alertable,
+	PLARGE_INTEGER Interval
+);
+
+PKTHREAD
+KeGetCurrentThread(
+	VOID
+);
+
+KPRIORITY
+KeSetPriorityThread(
+	PKTHREAD Thread,
+	KPRIORITY Priority
+);
+
+VOID
+KeStallExecutionProcessor(
+	ULONG MicroSeconds
+);
+
+//
+// Time, in 100 ns units like the kernel's
+//
+
+ULONG64
+KeQueryInterruptTime(
+	VOID
+);
+
+ULONG64
+KeQueryInterruptTimePrecise(
+	PULONG64 QpcTimeStamp
+);
+
+LARGE_INTEGER
+KeQueryPerformanceCounter(
+	PLARGE_INTEGER PerformanceFrequency
+);
+
+VOID
+KeQuerySystemTime(
+	PLARGE_INTEGER CurrentTime
+);
+
+ULONG
+ExSetTimerResolution(
+	ULONG DesiredTime,
+	BOOLEAN SetResolution
+);
+
+//
+// Threads
+//
+
+typedef VOID KSTART_ROUTINE(PVOID StartContext);
+typedef KSTART_ROUTINE* PKSTART_ROUTINE;
+
+typedef struct _OBJECT_ATTRIBUTES* POBJECT_ATTRIBUTES;
+typedef struct _OBJECT_TYPE* POBJECT_TYPE;
+typedef ULONG ACCESS_MASK;
+
+extern POBJECT_TYPE* PsThreadType;
+
+#define THREAD_ALL_ACCESS 0x1fffff
+#define OBJ_KERNEL_HANDLE 0x00000200L
+
+#define OBJ_CASE_INSENSITIVE 0x00000040L
+
+typedef struct _OBJECT_ATTRIBUTES
+{
+	ULONG Length;
+	PUNICODE_STRING ObjectName;
+	ULONG Attributes;
+} OBJECT_ATTRIBUTES;
+
+#define InitializeObjectAttributes(p, n, a, r, s) \
+	do { (p)->Length = sizeof(OBJECT_ATTRIBUTES); (p)->ObjectName = (n); \
+	     (p)->Attributes = (a); (void)(r); (void)(s); } while (0)
+
+NTSTATUS
+PsCreateSystemThread(
+	PHANDLE ThreadHandle,
+	ULONG DesiredAccess,
+	POBJECT_ATTRIBUTES ObjectAttributes,
+	HANDLE ProcessHandle,
+	PVOID ClientId,
+	PKSTART_ROUTINE StartRoutine,
+	PVOID StartContext
+);
+
+NTSTATUS
+PsTerminateSystemThread(
+	NTSTATUS ExitStatus
+);
+
+NTSTATUS
+ZwWaitForSingleObject(
+	HANDLE Handle,
+	BOOLEAN Alertable,
+	PLARGE_INTEGER Timeout
+);
+
+NTSTATUS
+ObReferenceObjectByHandle(
+	HANDLE Handle,
+	ACCESS_MASK DesiredAccess,
+	POBJECT_TYPE ObjectType,
+	KPROCESSOR_MODE AccessMode,
+	PVOID* Object,
+	PVOID HandleInformation
+);
+
+VOID
+ObDereferenceObject(
+	PVOID Object
+);
+
+NTSTATUS
+ZwClose(
+	HANDLE Handle
+);
+
+//
+// Power
+//
+
+typedef enum _DEVICE_POWER_STATE
+{
+	PowerDeviceUnspecified = 0,
+	PowerDeviceD0,
+	PowerDeviceD1,
+	PowerDeviceD2,
+	PowerDeviceD3,
+	PowerDeviceMaximum
+} DEVICE_POWER_STATE, *PDEVICE_POWER_STATE;
+
+typedef enum _SYSTEM_POWER_CONDITION
+{
+	PoAc,
+	PoDc,
+	PoHot,
+	PoConditionMaximum
+} SYSTEM_POWER_CONDITION;
+
+//
+// Plug and Play notifications. Nothing arrives in the tests, there is
+// no other driver to announce an interface.
+//
+
+#define STANDARD_RIGHTS_ALL 0x001F0000
+
+typedef enum _IO_NOTIFICATION_EVENT_CATEGORY
+{
+	EventCategoryReserved,
+	EventCategoryHardwareProfileChange,
+	EventCategoryDeviceInterfaceChange,
+	EventCategoryTargetDeviceChange
+} IO_NOTIFICATION_EVENT_CATEGORY;
+
+#define PNPNOTIFY_DEVICE_INTERFACE_INCLUDE_EXISTING_INTERFACES 0x00000001
+
+typedef struct _DEVICE_INTERFACE_CHANGE_NOTIFICATION
+{
+	USHORT Version;
+	USHORT Size;
+	GUID Event;
+	GUID InterfaceClassGuid;
+	PUNICODE_STRING SymbolicLinkName;
+} DEVICE_INTERFACE_CHANGE_NOTIFICATION, *PDEVICE_INTERFACE_CHANGE_NOTIFICATION;
+
+typedef struct _DRIVER_OBJECT* PDRIVER_OBJECT;
+
+typedef NTSTATUS DRIVER_NOTIFICATION_CALLBACK_ROUTINE(
+	PVOID NotificationStructure,
+	PVOID Context);
+typedef DRIVER_NOTIFICATION_CALLBACK_ROUTINE* PDRIVER_NOTIFICATION_CALLBACK_ROUTINE;
+
+NTSTATUS
+IoRegisterPlugPlayNotification(
+	IO_NOTIFICATION_EVENT_CATEGORY EventCategory,
+	ULONG EventCategoryFlags,
+	PVOID EventCategoryData,
+	PDRIVER_OBJECT DriverObject,
+	PDRIVER_NOTIFICATION_CALLBACK_ROUTINE CallbackRoutine,
+	PVOID Context,
+	PVOID* NotificationEntry
+);
+
+NTSTATUS
+IoUnregisterPlugPlayNotificationEx(
+	PVOID NotificationEntry
+);
+
+//
+// MDLs describe a flat buffer here
+//
+
+typedef struct _MDL
+{
+	PVOID Buffer;
+	ULONG ByteCount;
+} MDL, *PMDL;
+
+#define MmGetMdlByteCount(Mdl) ((Mdl)->ByteCount)
+#define MmGetSystemAddressForMdlSafe(Mdl, Priority) ((Mdl)->Buffer)
+#define NormalPagePriority 16
+#define MdlMappingNoExecute 0x40000000
+
+//
+// I/O control codes
+//
+
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+	(((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+#define METHOD_BUFFERED 0
+#define METHOD_IN_DIRECT 1
+#define METHOD_OUT_DIRECT 2
+#define METHOD_NEITHER 3
+
+#define FILE_ANY_ACCESS 0
+#define FILE_READ_ACCESS 0x0001
+#define FILE_WRITE_ACCESS 0x0002
+
+#define FILE_DEVICE_KEYBOARD 0x0000000b
+#define FILE_DEVICE_UNKNOWN 0x00000022
+
+#define DEVICE_TYPE_FROM_CTL_CODE(c) (((ULONG)((c) & 0xffff0000)) >> 16)
+#define METHOD_FROM_CTL_CODE(c) ((ULONG)((c) & 3))
+#define ACCESS_FROM_CTL_CODE(c) ((ULONG)(((c) >> 14) & 3))
+
+typedef struct _IO_STATUS_BLOCK
+{
+	NTSTATUS Status;
+	ULONG_PTR Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+//
+// Debug
+//
+
+#define DPFLTR_IHVDRIVER_ID 77
+#define DPFLTR_ERROR_LEVEL 0
+#define DPFLTR_INFO_LEVEL 3
+
+#define DbgPrint(...) ((void)0)
+#define DbgPrintEx(...) ((void)0)
+#define KdPrint(x) ((void)0)
+#define DbgBreakPoint() ((void)0)
+
+VOID
+ShimAssertFailed(
+	const char* Expression,
+	const char* File,
+	int Line
+);
+
+#define NT_ASSERT(e) ((e) ? (void)0 : ShimAssertFailed(#e, __FILE__, __LINE__))
+#define ASSERT(e) NT_ASSERT(e)
+#define NT_VERIFY(e) NT_ASSERT(e)
+
+#define PAGED_CODE()
+
+//
+// Files. Tests register in-memory files by NT path, see ShimFileRegister.
+//
+
+#define FILE_SHARE_READ 0x00000001
+#define FILE_SYNCHRONOUS_IO_NONALERT 0x00000020
+#define FILE_NON_DIRECTORY_FILE 0x00000040
+
+typedef enum _FILE_INFORMATION_CLASS
+{
+	FileStandardInformation = 5
+} FILE_INFORMATION_CLASS;
+
+typedef struct _FILE_STANDARD_INFORMATION
+{
+	LARGE_INTEGER AllocationSize;
+	LARGE_INTEGER EndOfFile;
+	ULONG NumberOfLinks;
+	BOOLEAN DeletePending;
+	BOOLEAN Directory;
+} FILE_STANDARD_INFORMATION;
+
+VOID
+ShimFileRegister(
+	PCWSTR Path,
+	const VOID* Data,
+	ULONG Length
+);
+
+NTSTATUS
+ZwCreateFile(
+	PHANDLE FileHandle,
+	ACCESS_MASK DesiredAccess,
+	POBJECT_ATTRIBUTES ObjectAttributes,
+	PIO_STATUS_BLOCK IoStatusBlock,
+	PLARGE_INTEGER AllocationSize,
+	ULONG FileAttributes,
+	ULONG ShareAccess,
+	ULONG CreateDisposition,
+	ULONG CreateOptions,
+	PVOID EaBuffer,
+	ULONG EaLength
+);
+
+NTSTATUS
+ZwQueryInformationFile(
+	HANDLE FileHandle,
+	PIO_STATUS_BLOCK IoStatusBlock,
+	PVOID FileInformation,
+	ULONG Length,
+	FILE_INFORMATION_CLASS FileInformationClass
+);
+
+NTSTATUS
+ZwReadFile(
+	HANDLE FileHandle,
+	HANDLE Event,
+	PVOID ApcRoutine,
+	PVOID ApcContext,
+	PIO_STATUS_BLOCK IoStatusBlock,
+	PVOID Buffer,
+	ULONG Length,
+	PLARGE_INTEGER ByteOffset,
+	PULONG Key
+);
+
+//
+// Registry queries, served by the test's registry stub
+//
+
+#define RTL_REGISTRY_ABSOLUTE 0
+#define RTL_QUERY_REGISTRY_DIRECT 0x00000020
+
+typedef NTSTATUS RTL_QUERY_REGISTRY_ROUTINE(
+	PWSTR ValueName,
+	ULONG ValueType,
+	PVOID ValueData,
+	ULONG ValueLength,
+	PVOID Context,
+	PVOID EntryContext);
+
+typedef struct _RTL_QUERY_REGISTRY_TABLE
+{
+	RTL_QUERY_REGISTRY_ROUTINE* QueryRoutine;
+	ULONG Flags;
+	PWSTR Name;
+	PVOID EntryContext;
+	ULONG DefaultType;
+	PVOID DefaultData;
+	ULONG DefaultLength;
+} RTL_QUERY_REGISTRY_TABLE, *PRTL_QUERY_REGISTRY_TABLE;
+
+#define KEY_QUERY_VALUE 0x0001
+
+typedef enum _KEY_VALUE_INFORMATION_CLASS
+{
+	KeyValuePartialInformation = 2
+} KEY_VALUE_INFORMATION_CLASS;
+
+typedef struct _KEY_VALUE_PARTIAL_INFORMATION
+{
+	ULONG TitleIndex;
+	ULONG Type;
+	ULONG DataLength;
+	UCHAR Data[1];
+} KEY_VALUE_PARTIAL_INFORMATION, *PKEY_VALUE_PARTIAL_INFORMATION;
+
+NTSTATUS
+ZwOpenKey(
+	PHANDLE KeyHandle,
+	ACCESS_MASK DesiredAccess,
+	POBJECT_ATTRIBUTES ObjectAttributes
+);
+
+NTSTATUS
+ZwQueryValueKey(
+	HANDLE KeyHandle,
+	PUNICODE_STRING ValueName,
+	KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
+	PVOID KeyValueInformation,
+	ULONG Length,
+	PULONG ResultLength
+);
+
+NTSTATUS
+RtlWriteRegistryValue(
+	ULONG RelativeTo,
+	PCWSTR Path,
+	PCWSTR ValueName,
+	ULONG ValueType,
+	PVOID ValueData,
+	ULONG ValueLength
+);
+
+NTSTATUS
+RtlQueryRegistryValues(
+	ULONG RelativeTo,
+	PCWSTR Path,
+	PRTL_QUERY_REGISTRY_TABLE QueryTable,
+	PVOID Context,
+	PVOID Environment
+);
@@ -0,0 +1,362 @@
+/*++
+	Module Name:
+
+		soft_touch.c
+
+	Abstract:
+
+		The host side touch detector on synthetic delta images, 18 x 36
+		and 32 x 64: finger shaped blobs at known sub-cell positions over
+		noise must come back where they were put, keep their slots while
+		they move, and stay apart or drop out as the detector promises.
+		Built against soft_touch_detect.c alone, without the shim.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include <tcm/soft_touch_detect.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_X 1439
+#define MAX_Y 2879
+
+typedef struct _PANEL_SIZE
+{
+	uint32_t Rows;
+	uint32_t Cols;
+} PANEL_SIZE;
+
+typedef struct _FINGER
+{
+	double Col;     // in cells, 0 is the left edge of the panel
+	double Row;
+	double Peak;
+	double Sigma;
+} FINGER;
+
+static const PANEL_SIZE Sizes[] = {
+	{ 18, 36 },
+	{ 32, 64 },
+};
+
+static int16_t Image[SOFT_TOUCH_MAX_PIXELS];
+static TCM_SOFT_TOUCH_DETECTOR Detector;
+
+//
+// Same sequence on every run
+//
+static uint32_t NoiseState;
+
+static int32_t
+Noise(
+	int32_t Amplitude
+)
+{
+	NoiseState = NoiseState * 1103515245 + 12345;
+
+	return (int32_t)((NoiseState >> 16) % (2 * Amplitude + 1)) - Amplitude;
+}
+
+static void
+Render(
+	const PANEL_SIZE* Size,
+	const FINGER* Fingers,
+	uint32_t Count,
+	int32_t NoiseAmplitude
+)
+{
+	uint32_t Row, Col, i;
+	double Value, dx, dy;
+
+	for (Row = 0; Row < Size->Rows; Row++) {
+		for (Col = 0; Col < Size->Cols; Col++) {
+			Value = 0;
+
+			for (i = 0; i < Count; i++) {
+				dx = Col + 0.5 - Fingers[i].Col;
+				dy = Row + 0.5 - Fingers[i].Row;
+				Value += Fingers[i].Peak *
+					exp(-(dx * dx + dy * dy) / (2 * Fingers[i].Sigma * Fingers[i].Sigma));
+			}
+
+			Value += NoiseAmplitude != 0 ? Noise(NoiseAmplitude) : 0;
+			Image[Row * Size->Cols + Col] = (int16_t)fmax(-32768, fmin(32767, lrint(Value)));
+		}
+	}
+}
+
+//
+// Distance from a finger to the nearest contact, in cells
+//
+static double
+ErrorCells(
+	const PANEL_SIZE* Size,
+	const TCM_SOFT_TOUCH_CONTACT* Contacts,
+	const FINGER* Finger
+)
+{
+	double Best = 1e9, dx, dy;
+	uint32_t i;
+
+	for (i = 0; i < SOFT_TOUCH_MAX_CONTACTS; i++) {
+		if (!Contacts[i].Present) {
+			continue;
+		}
+
+		dx = Contacts[i].X * (double)Size->Cols / MAX_X - Finger->Col;
+		dy = Contacts[i].Y * (double)Size->Rows / MAX_Y - Finger->Row;
+		Best = fmin(Best, sqrt(dx * dx + dy * dy));
+	}
+
+	return Best;
+}
+
+static void
+TestQuietPanel(
+	void
+)
+{
+	TCM_SOFT_TOUCH_CONTACT Contacts[SOFT_TOUCH_MAX_CONTACTS];
+	uint32_t s, Frame;
+
+	for (s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++) {
+		TcmSoftTouchDetectorInitialize(&Detector, SOFT_TOUCH_THRESHOLD, 0);
+		NoiseState = 1;
+
+		for (Frame = 0; Frame < 100; Frame++) {
+			Render(&Sizes[s], NULL, 0, SOFT_TOUCH_THRESHOLD - 1);
+			CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, Sizes[s].Rows, Sizes[s].Cols, MAX_X, MAX_Y, Contacts), 0);
+		}
+	}
+
+	//
+	// Images the detector has no room for are not looked at
+	//
+	CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, 0, 36, MAX_X, MAX_Y, Contacts), 0);
+	CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, 64, 65, MAX_X, MAX_Y, Contacts), 0);
+}
+
+static void
+TestCentroidAccuracy(
+	void
+)
+{
+	TCM_SOFT_TOUCH_CONTACT Contacts[SOFT_TOUCH_MAX_CONTACTS];
+	FINGER Finger;
+	double Error, MaxError, SumError;
+	uint32_t s, Samples, i, j;
+
+	for (s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++) {
+		MaxError = 0;
+		SumError = 0;
+		Samples = 0;
+		NoiseState = 7;
+
+		//
+		// A finger stepped through the cell in eighths, away from the
+		// edges where part of it is off the panel
+		//
+		for (i = 0; i < 8; i++) {
+			for (j = 0; j < 8; j++) {
+				Finger.Col = Sizes[s].Cols / 3 + i / 8.0;
+				Finger.Row = Sizes[s].Rows / 2 + j / 8.0;
+				Finger.Peak = 1200;
+				Finger.Sigma = 1.0;
+
+				TcmSoftTouchDetectorInitialize(&Detector, SOFT_TOUCH_THRESHOLD, 0);
+				Render(&Sizes[s], &Finger, 1, 40);
+
+				CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, Sizes[s].Rows, Sizes[s].Cols,
+					MAX_X, MAX_Y, Contacts), 1);
+
+				Error = ErrorCells(&Sizes[s], Contacts, &Finger);
+				MaxError = fmax(MaxError, Error);
+				SumError += Error;
+				Samples++;
+			}
+		}
+
+		printf("  %ux%u: mean error %.3f cells, max %.3f cells\n",
+			Sizes[s].Rows,
+			Sizes[s].Cols,
+			SumError / Samples,
+			MaxError);
+
+		//
+		// The threshold cuts the tails off unevenly as the finger
+		// moves within a cell, which is most of the error
+		//
+		CHECK(SumError / Samples < 0.08);
+		CHECK(MaxError < 0.2);
+	}
+}
+
+static void
+TestTransposedPanel(
+	void
+)
+{
+	static const PANEL_SIZE Size = { 18, 36 };
+	TCM_SOFT_TOUCH_CONTACT Contacts[SOFT_TOUCH_MAX_CONTACTS];
+	FINGER Finger = { 9.5, 4.5, 1200, 1.0 };
+
+	//
+	// Rows map to X: the finger in row 4.5 of 18 is a quarter across
+	//
+	TcmSoftTouchDetectorInitialize(&Detector, SOFT_TOUCH_THRESHOLD, 1);
+	Render(&Size, &Finger, 1, 0);
+
+	CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, Size.Rows, Size.Cols, MAX_X, MAX_Y, Contacts), 1);
+	CHECK(Contacts[0].Present);
+	CHECK(abs(Contacts[0].X - MAX_X / 4) < MAX_X / 36);
+	CHECK(abs(Contacts[0].Y - (int32_t)(MAX_Y * 9.5 / 36)) < MAX_Y / 72);
+}
+
+static void
+TestSlotsFollowFingers(
+	void
+)
+{
+	TCM_SOFT_TOUCH_CONTACT Contacts[SOFT_TOUCH_MAX_CONTACTS];
+	FINGER Fingers[3];
+	uint32_t s, Frame, i, Slot[3] = { 0 };
+	uint32_t Moves = 0;
+
+	for (s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++) {
+		TcmSoftTouchDetectorInitialize(&Detector, SOFT_TOUCH_THRESHOLD, 0);
+		NoiseState = 3;
+
+		//
+		// Three fingers crossing the panel diagonally, under a third of a
+		// cell per frame
+		//
+		for (Frame = 0; Frame < 40; Frame++) {
+			for (i = 0; i < 3; i++) {
+				Fingers[i].Col = 3 + i * (Sizes[s].Cols / 3.0) + Frame / 3.0 * 0.5;
+				Fingers[i].Row = 3 + Frame / 3.0 * (Sizes[s].Rows - 6) / 14.0;
+				Fingers[i].Peak = 1000 + 100 * i;
+				Fingers[i].Sigma = 0.9;
+			}
+
+			Render(&Sizes[s], Fingers, 3, 40);
+			CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, Sizes[s].Rows, Sizes[s].Cols,
+				MAX_X, MAX_Y, Contacts), 3);
+
+			for (i = 0; i < 3; i++) {
+				uint32_t j, Nearest = SOFT_TOUCH_MAX_CONTACTS;
+				double Best = 1e9, dx, dy;
+
+				for (j = 0; j < SOFT_TOUCH_MAX_CONTACTS; j++) {
+					if (!Contacts[j].Present) {
+						continue;
+					}
+					dx = Contacts[j].X * (double)Sizes[s].Cols / MAX_X - Fingers[i].Col;
+					dy = Contacts[j].Y * (double)Sizes[s].Rows / MAX_Y - Fingers[i].Row;
+					if (dx * dx + dy * dy < Best) {
+						Best = dx * dx + dy * dy;
+						Nearest = j;
+					}
+				}
+
+				if (Frame != 0 && Nearest != Slot[i]) {
+					Moves++;
+				}
+
+				Slot[i] = Nearest;
+			}
+		}
+
+		CHECK(Slot[0] != Slot[1] && Slot[1] != Slot[2] && Slot[0] != Slot[2]);
+	}
+
+	CHECK_EQ(Moves, 0);
+
+	//
+	// Lifted and put down elsewhere, the contact takes the first free
+	// slot
+	//
+	Render(&Sizes[0], NULL, 0, 0);
+	CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, Sizes[0].Rows, Sizes[0].Cols, MAX_X, MAX_Y, Contacts), 0);
+
+	Fingers[0].Col = 30;
+	Fingers[0].Row = 15;
+	Render(&Sizes[0], Fingers, 1, 0);
+	CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, Sizes[0].Rows, Sizes[0].Cols, MAX_X, MAX_Y, Contacts), 1);
+	CHECK(Contacts[0].Present);
+}
+
+static void
+TestSeparationAndLimits(
+	void
+)
+{
+	static const PANEL_SIZE Size = { 32, 64 };
+	TCM_SOFT_TOUCH_CONTACT Contacts[SOFT_TOUCH_MAX_CONTACTS];
+	FINGER Fingers[12];
+	uint32_t i;
+
+	//
+	// Two fingers with a quiet cell between them stay two, two that
+	// touch become one in between
+	//
+	Fingers[0] = (FINGER){ 20.5, 16.5, 1200, 0.8 };
+	Fingers[1] = (FINGER){ 25.5, 16.5, 1200, 0.8 };
+	TcmSoftTouchDetectorInitialize(&Detector, SOFT_TOUCH_THRESHOLD, 0);
+	Render(&Size, Fingers, 2, 0);
+	CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, Size.Rows, Size.Cols, MAX_X, MAX_Y, Contacts), 2);
+	CHECK(ErrorCells(&Size, Contacts, &Fingers[0]) < 0.2);
+	CHECK(ErrorCells(&Size, Contacts, &Fingers[1]) < 0.2);
+
+	Fingers[1].Col = 22.5;
+	TcmSoftTouchDetectorInitialize(&Detector, SOFT_TOUCH_THRESHOLD, 0);
+	Render(&Size, Fingers, 2, 0);
+	CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, Size.Rows, Size.Cols, MAX_X, MAX_Y, Contacts), 1);
+
+	//
+	// A single hot cell is noise, not a finger
+	//
+	TcmSoftTouchDetectorInitialize(&Detector, SOFT_TOUCH_THRESHOLD, 0);
+	memset(Image, 0, sizeof(Image));
+	Image[10 * Size.Cols + 10] = 3000;
+	CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, Size.Rows, Size.Cols, MAX_X, MAX_Y, Contacts), 0);
+
+	//
+	// Twelve fingers, ten slots: the first ten in scan order are kept
+	//
+	for (i = 0; i < 12; i++) {
+		Fingers[i] = (FINGER){ 4.5 + (i % 6) * 10, 8.5 + (i / 6) * 12, 1000, 0.8 };
+	}
+
+	TcmSoftTouchDetectorInitialize(&Detector, SOFT_TOUCH_THRESHOLD, 0);
+	Render(&Size, Fingers, 12, 0);
+	CHECK_EQ(TcmSoftTouchDetect(&Detector, Image, Size.Rows, Size.Cols, MAX_X, MAX_Y, Contacts),
+		SOFT_TOUCH_MAX_CONTACTS);
+
+	for (i = 0; i < SOFT_TOUCH_MAX_CONTACTS; i++) {
+		CHECK(Contacts[i].Present);
+		CHECK(ErrorCells(&Size, Contacts, &Fingers[i]) < 0.2);
+	}
+
+	CHECK(ErrorCells(&Size, Contacts, &Fingers[10]) > 5);
+	CHECK(ErrorCells(&Size, Contacts, &Fingers[11]) > 5);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestQuietPanel);
+	RUN(TestCentroidAccuracy);
+	RUN(TestTransposedPanel);
+	RUN(TestSlotsFollowFingers);
+	RUN(TestSeparationAndLimits);
+
+	return TestResult();
+}
@@ -0,0 +1,310 @@
+/*++
+	Module Name:
+
+		spb_buffers.c
+
+	Abstract:
+
+		WDF memory objects created by the SPB transfer buffers, counted
+		per 10,000 touch frames and a hundred command writes. Without a
+		reservation each buffer is grown once, on the first transfer
+		that does not fit, and never again. Once SpbReserveTransferBuffers
+		sized them, as bring-up does from the application info, regular
+		traffic creates none.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "hid_sink.h"
+
+#define FRAMES 10000
+#define WRITES 100
+
+//
+// Frames queued at a time, well within the queue of the fake
+//
+#define BATCH 500
+
+#define DRAIN_TIMEOUT_MS 2000
+
+//
+// Larger than the buffers an SPB target starts with
+//
+#define WRITE_PAYLOAD 64
+
+//
+// The SPB target alone, connected to the fake, for transfers made by
+// hand where nothing reserved buffers
+//
+typedef struct _SPB_TARGET
+{
+	FAKE_TCM Tcm;
+	WDFDEVICE Device;
+	SPB_CONTEXT* Spb;
+} SPB_TARGET;
+
+static VOID
+Open(
+	SPB_TARGET* Target
+)
+{
+	WDF_OBJECT_ATTRIBUTES Attributes;
+
+	FakeTcmInitialize(&Target->Tcm);
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&Attributes, DEVICE_EXTENSION);
+	Target->Device = ShimObjectCreate(&Attributes, 0);
+	CHECK(Target->Device != NULL);
+
+	Target->Spb = &GetDeviceContext(Target->Device)->I2CContext;
+	CHECK_SUCCESS(SpbTargetInitialize(Target->Device, Target->Spb));
+	FakeTcmConnect(&Target->Tcm, Target->Spb->SpbIoTarget);
+}
+
+static VOID
+Close(
+	SPB_TARGET* Target
+)
+{
+	SpbTargetDeinitialize(Target->Device, Target->Spb);
+	WdfObjectDelete(Target->Device);
+	FakeTcmCleanup(&Target->Tcm);
+}
+
+static VOID
+FillObjects(
+	FAKE_TCM_OBJECT* Objects,
+	ULONG Frame
+)
+{
+	ULONG i;
+
+	for (i = 0; i < MAX_FINGER; i++) {
+		Objects[i].Index = (UINT8)i;
+		Objects[i].Classification = 1;
+		Objects[i].X = (UINT16)(100 + i * 120 + Frame % 100);
+		Objects[i].Y = (UINT16)(200 + i * 240 + Frame % 100);
+	}
+}
+
+//
+// Reads a message the way the TCM core does, its header and then the
+// payload behind the continued read marker. Returns the bytes read for
+// the payload.
+//
+static ULONG
+ReadMessage(
+	SPB_TARGET* Target,
+	UINT8 Code
+)
+{
+	UINT8 Header[MESSAGE_HEADER_SIZE];
+	UINT8 Payload[MESSAGE_BUFFER_SIZE];
+	ULONG Length;
+
+	CHECK_SUCCESS(SpbReadContinuedData(Target->Spb, Header, sizeof(Header)));
+	CHECK_EQ(Header[1], Code);
+
+	Length = Header[2] | (Header[3] << 8);
+	if (Length == 0) {
+		return 0;
+	}
+
+	CHECK_SUCCESS(SpbReadContinuedData(Target->Spb, Payload, Length + 3));
+
+	return Length + 3;
+}
+
+//
+// A dynamic config write padded out past the initial write buffer,
+// the fake looks at the first three bytes only
+//
+static VOID
+WriteMessage(
+	SPB_TARGET* Target
+)
+{
+	UINT8 Message[2 + WRITE_PAYLOAD] = { WRITE_PAYLOAD, 0, DC_NO_DOZE, 1, 0 };
+
+	CHECK_SUCCESS(SpbWriteDataSynchronously(Target->Spb, CMD_SET_DYNAMIC_CONFIG, Message, sizeof(Message)));
+	ReadMessage(Target, TCM_STATUS_OK);
+}
+
+//
+// FRAMES touch frames with every finger down and WRITES writes in
+// between, by hand. Returns the memory objects created for them.
+//
+static LONG
+SpbTraffic(
+	SPB_TARGET* Target
+)
+{
+	FAKE_TCM_OBJECT Touch[MAX_FINGER];
+	LONG Created = ShimMemoryCreated();
+	ULONG i;
+
+	for (i = 0; i < FRAMES; i++) {
+		FillObjects(Touch, i);
+		FakeTcmQueueTouch(&Target->Tcm, Touch, MAX_FINGER);
+		CHECK(ReadMessage(Target, TCM_REPORT_TOUCH) > DEFAULT_SPB_BUFFER_SIZE);
+
+		if (i % (FRAMES / WRITES) == 0) {
+			WriteMessage(Target);
+		}
+	}
+
+	return ShimMemoryCreated() - Created;
+}
+
+//
+// The same through the driver: frames read by the ISR and report
+// config writes through the command path
+//
+static LONG
+DriverTraffic(
+	TCM_HARNESS* Harness
+)
+{
+	FAKE_TCM_OBJECT Touch[MAX_FINGER];
+	LONG Created = ShimMemoryCreated();
+	ULONG Reports = FakeHidReports();
+	ULONG i, j;
+
+	for (i = 0; i < FRAMES; i += BATCH) {
+		for (j = 0; j < BATCH; j++) {
+			FillObjects(Touch, i + j);
+			FakeTcmQueueTouch(&Harness->Tcm, Touch, MAX_FINGER);
+		}
+
+		CHECK(TcmHarnessDrain(Harness, DRAIN_TIMEOUT_MS));
+
+		for (j = 0; j < WRITES * BATCH / FRAMES; j++) {
+			CHECK_SUCCESS(TcmWriteMessage(Harness->Controller,
+				Harness->Spb,
+				CMD_SET_TOUCH_REPORT_CONFIG,
+				Harness->Tcm.ReportConfig,
+				Harness->Tcm.ReportConfigLength,
+				NULL,
+				NULL));
+		}
+	}
+
+	CHECK(FakeHidReports() > Reports);
+
+	return ShimMemoryCreated() - Created;
+}
+
+static VOID
+TestGrowsOnDemand(
+	VOID
+)
+{
+	static SPB_TARGET Target;
+	LONG First, Steady;
+
+	Open(&Target);
+
+	//
+	// One larger read buffer and one larger write buffer, on the first
+	// frame and the first write
+	//
+	First = SpbTraffic(&Target);
+	Steady = SpbTraffic(&Target);
+
+	printf("  on demand: %d memory objects for %u frames and %u writes, then %d\n",
+		First,
+		FRAMES,
+		WRITES,
+		Steady);
+
+	CHECK_EQ(First, 2);
+	CHECK_EQ(Steady, 0);
+
+	Close(&Target);
+}
+
+static VOID
+TestReserved(
+	VOID
+)
+{
+	static SPB_TARGET Target;
+	LONG Created, Steady;
+
+	Open(&Target);
+
+	Created = ShimMemoryCreated();
+	CHECK_SUCCESS(SpbReserveTransferBuffers(Target.Spb, MESSAGE_BUFFER_SIZE, 2 + WRITE_PAYLOAD));
+	Created = ShimMemoryCreated() - Created;
+
+	Steady = SpbTraffic(&Target);
+
+	printf("  reserved: %d memory objects for the reservation, %d for %u frames and %u writes\n",
+		Created,
+		Steady,
+		FRAMES,
+		WRITES);
+
+	CHECK_EQ(Created, 2);
+	CHECK_EQ(Steady, 0);
+
+	//
+	// Buffers do not shrink for a smaller reservation
+	//
+	Created = ShimMemoryCreated();
+	CHECK_SUCCESS(SpbReserveTransferBuffers(Target.Spb, DEFAULT_SPB_BUFFER_SIZE, DEFAULT_SPB_BUFFER_SIZE));
+	CHECK_EQ(ShimMemoryCreated(), Created);
+	CHECK(Target.Spb->ReadMemorySize >= MESSAGE_BUFFER_SIZE);
+
+	Close(&Target);
+}
+
+static VOID
+TestReservedAtBringUp(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	LONG Steady;
+
+	TcmHarnessInitialize(&Harness);
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+	FakeHidReset();
+
+	//
+	// Sized for the largest touch report the application info allows
+	// and for a whole chunk, not just for what bring-up read and wrote
+	//
+	CHECK(Harness.Spb->ReadMemorySize >=
+		MESSAGE_HEADER_SIZE + Harness.Tcm.AppInfo.MaxTouchReportPayloadSize + 3);
+	CHECK(Harness.Spb->WriteMemorySize >= Harness.Controller->ChunkSize + 1);
+
+	Steady = DriverTraffic(&Harness);
+
+	printf("  after bring-up: %d memory objects for %u frames and %u writes\n",
+		Steady,
+		FRAMES,
+		WRITES);
+
+	CHECK_EQ(Steady, 0);
+
+	FakeHidReset();
+	TcmHarnessStop(&Harness);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestGrowsOnDemand);
+	RUN(TestReserved);
+	RUN(TestReservedAtBringUp);
+
+	return TestResult();
+}
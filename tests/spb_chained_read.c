@@ -0,0 +1,431 @@
+/*++
+	Module Name:
+
+		spb_chained_read.c
+
+	Abstract:
+
+		Chained reads with the shim completing sends the way the bus
+		driver does, later and from another thread, rather than before
+		WdfRequestSend returns. Each read of a chain has to be sent from
+		the completion of the one before and the reader woken once, when
+		the chain is done. Reads of two targets completing out of order
+		must not mix, and sends that fail or come back short must end
+		the chain with an error instead of leaving the reader waiting.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include <unistd.h>
+
+#define SEND_TIMEOUT_MS 2000
+#define READER_TIMEOUT_MS 2000
+
+//
+// Long enough for a reader that is about to be woken wrongly to run
+//
+#define SETTLE_US 20000
+
+//
+// The SPB target alone, connected to the fake
+//
+typedef struct _SPB_TARGET
+{
+	FAKE_TCM Tcm;
+	WDFDEVICE Device;
+	SPB_CONTEXT* Spb;
+} SPB_TARGET;
+
+//
+// A thread reading one message with a chained read
+//
+typedef struct _READER
+{
+	SPB_TARGET* Target;
+	pthread_t Thread;
+	NTSTATUS Status;
+	UINT8 Data[MESSAGE_BUFFER_SIZE];
+	ULONG Length;
+	volatile LONG Done;
+} READER;
+
+static VOID
+Open(
+	SPB_TARGET* Target
+)
+{
+	WDF_OBJECT_ATTRIBUTES Attributes;
+
+	FakeTcmInitialize(&Target->Tcm);
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&Attributes, DEVICE_EXTENSION);
+	Target->Device = ShimObjectCreate(&Attributes, 0);
+	CHECK(Target->Device != NULL);
+
+	Target->Spb = &GetDeviceContext(Target->Device)->I2CContext;
+	CHECK_SUCCESS(SpbTargetInitialize(Target->Device, Target->Spb));
+	FakeTcmConnect(&Target->Tcm, Target->Spb->SpbIoTarget);
+}
+
+static VOID
+Close(
+	SPB_TARGET* Target
+)
+{
+	ShimRequestFailSends(0, STATUS_SUCCESS);
+	ShimRequestShortReads(0, 0);
+	ShimRequestSetDeferred(FALSE);
+
+	SpbTargetDeinitialize(Target->Device, Target->Spb);
+	WdfObjectDelete(Target->Device);
+	FakeTcmCleanup(&Target->Tcm);
+}
+
+//
+// Queues a touch frame with Count fingers down
+//
+static VOID
+QueueTouch(
+	SPB_TARGET* Target,
+	ULONG Count
+)
+{
+	FAKE_TCM_OBJECT Objects[MAX_FINGER];
+	ULONG i;
+
+	for (i = 0; i < Count; i++) {
+		Objects[i].Index = (UINT8)i;
+		Objects[i].Classification = 1;
+		Objects[i].X = (UINT16)(100 + i * 120);
+		Objects[i].Y = (UINT16)(200 + i * 240);
+	}
+
+	FakeTcmQueueTouch(&Target->Tcm, Objects, Count);
+}
+
+//
+// After the header, the payload with the continued read marker in
+// front of it and the padding byte behind it, as TcmReadMessageNext
+//
+static ULONG
+ReadNext(
+	PVOID Context,
+	PUCHAR Data,
+	ULONG Length
+)
+{
+	ULONG Payload;
+
+	UNREFERENCED_PARAMETER(Context);
+
+	if (Length != MESSAGE_HEADER_SIZE) {
+		return 0;
+	}
+
+	Payload = Data[2] | (Data[3] << 8);
+
+	return Payload != 0 ? Payload + 3 : 0;
+}
+
+//
+// The length of a chained read of a frame with Count fingers down,
+// read with sends completing inline
+//
+static ULONG
+FrameLength(
+	SPB_TARGET* Target,
+	ULONG Count
+)
+{
+	UINT8 Data[MESSAGE_BUFFER_SIZE];
+	ULONG Length = 0;
+
+	QueueTouch(Target, Count);
+	CHECK_SUCCESS(SpbReadContinuedDataChained(Target->Spb,
+		MESSAGE_HEADER_SIZE,
+		ReadNext,
+		NULL,
+		Data,
+		sizeof(Data),
+		&Length));
+
+	return Length;
+}
+
+static PVOID
+ReaderThread(
+	PVOID Parameter
+)
+{
+	READER* Reader = (READER*)Parameter;
+
+	Reader->Status = SpbReadContinuedDataChained(Reader->Target->Spb,
+		MESSAGE_HEADER_SIZE,
+		ReadNext,
+		NULL,
+		Reader->Data,
+		sizeof(Reader->Data),
+		&Reader->Length);
+
+	InterlockedExchange(&Reader->Done, 1);
+
+	return NULL;
+}
+
+static VOID
+StartReader(
+	READER* Reader,
+	SPB_TARGET* Target
+)
+{
+	Reader->Target = Target;
+	Reader->Length = 0;
+	Reader->Done = 0;
+	CHECK_EQ(pthread_create(&Reader->Thread, NULL, ReaderThread, Reader), 0);
+}
+
+static BOOLEAN
+WaitReader(
+	READER* Reader
+)
+{
+	ULONG i;
+
+	for (i = 0; i < READER_TIMEOUT_MS * 10 && !Reader->Done; i++) {
+		usleep(100);
+	}
+
+	if (!Reader->Done) {
+		return FALSE;
+	}
+
+	pthread_join(Reader->Thread, NULL);
+
+	return TRUE;
+}
+
+//
+// A touch frame of Length bytes read whole, header and payload
+//
+static VOID
+CheckTouch(
+	READER* Reader,
+	ULONG Length
+)
+{
+	CHECK_SUCCESS(Reader->Status);
+	CHECK_EQ(Reader->Length, Length);
+	CHECK_EQ(Reader->Data[0], MESSAGE_MARKER);
+	CHECK_EQ(Reader->Data[1], TCM_REPORT_TOUCH);
+	CHECK_EQ(Reader->Data[MESSAGE_HEADER_SIZE], MESSAGE_MARKER);
+	CHECK_EQ(Reader->Data[MESSAGE_HEADER_SIZE + 1], TCM_STATUS_CONTINUED_READ);
+}
+
+static VOID
+TestDeferredCompletion(
+	VOID
+)
+{
+	static SPB_TARGET Target;
+	static READER Reader;
+	ULONG Length;
+
+	Open(&Target);
+	Length = FrameLength(&Target, 2);
+
+	ShimRequestSetDeferred(TRUE);
+	QueueTouch(&Target, 2);
+	StartReader(&Reader, &Target);
+
+	//
+	// The header read goes out and the reader waits for it
+	//
+	CHECK(ShimRequestWaitSends(1, SEND_TIMEOUT_MS));
+	usleep(SETTLE_US);
+	CHECK_EQ(Reader.Done, 0);
+
+	//
+	// Its completion sends the payload read, the reader keeps waiting
+	//
+	CHECK(ShimRequestCompleteSend(0));
+	CHECK(ShimRequestWaitSends(1, SEND_TIMEOUT_MS));
+	usleep(SETTLE_US);
+	CHECK_EQ(Reader.Done, 0);
+
+	CHECK(ShimRequestCompleteSend(0));
+	CHECK(WaitReader(&Reader));
+	CheckTouch(&Reader, Length);
+
+	//
+	// Nothing else was sent
+	//
+	CHECK(!ShimRequestCompleteSend(0));
+
+	Close(&Target);
+}
+
+static VOID
+TestOutOfOrder(
+	VOID
+)
+{
+	static SPB_TARGET Targets[2];
+	static READER Readers[2];
+	ULONG Lengths[2];
+	ULONG i;
+
+	for (i = 0; i < 2; i++) {
+		Open(&Targets[i]);
+	}
+
+	//
+	// Messages of different lengths, a read landing on the wrong chain
+	// would show
+	//
+	Lengths[0] = FrameLength(&Targets[0], 1);
+	Lengths[1] = FrameLength(&Targets[1], MAX_FINGER);
+	CHECK(Lengths[0] != Lengths[1]);
+
+	ShimRequestSetDeferred(TRUE);
+	QueueTouch(&Targets[0], 1);
+	QueueTouch(&Targets[1], MAX_FINGER);
+
+	for (i = 0; i < 2; i++) {
+		StartReader(&Readers[i], &Targets[i]);
+	}
+
+	//
+	// Both header reads, then both payload reads, newest first
+	//
+	for (i = 0; i < 2; i++) {
+		CHECK(ShimRequestWaitSends(2, SEND_TIMEOUT_MS));
+		CHECK(ShimRequestCompleteSend(1));
+		CHECK(ShimRequestCompleteSend(0));
+	}
+
+	for (i = 0; i < 2; i++) {
+		CHECK(WaitReader(&Readers[i]));
+		CheckTouch(&Readers[i], Lengths[i]);
+	}
+
+	CHECK(!ShimRequestCompleteSend(0));
+
+	for (i = 0; i < 2; i++) {
+		Close(&Targets[i]);
+	}
+}
+
+static VOID
+TestSendFailure(
+	VOID
+)
+{
+	static SPB_TARGET Target;
+	static READER Reader;
+	UINT8 Data[MESSAGE_BUFFER_SIZE];
+	ULONG Length = 1;
+
+	Open(&Target);
+	ShimRequestSetDeferred(TRUE);
+	QueueTouch(&Target, 2);
+
+	//
+	// The first send fails, the caller gets the error without waiting
+	//
+	ShimRequestFailSends(1, STATUS_INSUFFICIENT_RESOURCES);
+	CHECK_EQ(SpbReadContinuedDataChained(Target.Spb,
+		MESSAGE_HEADER_SIZE,
+		ReadNext,
+		NULL,
+		Data,
+		sizeof(Data),
+		&Length), STATUS_INSUFFICIENT_RESOURCES);
+	CHECK_EQ(Length, 0);
+	CHECK(!ShimRequestCompleteSend(0));
+
+	//
+	// The send of the payload read fails in the completion of the
+	// header read, the reader is woken with the error
+	//
+	StartReader(&Reader, &Target);
+	CHECK(ShimRequestWaitSends(1, SEND_TIMEOUT_MS));
+
+	ShimRequestFailSends(1, STATUS_DEVICE_BUSY);
+	CHECK(ShimRequestCompleteSend(0));
+
+	CHECK(WaitReader(&Reader));
+	CHECK_EQ(Reader.Status, STATUS_DEVICE_BUSY);
+	CHECK_EQ(Reader.Length, 0);
+	CHECK(!ShimRequestCompleteSend(0));
+
+	Close(&Target);
+}
+
+static VOID
+TestShortRead(
+	VOID
+)
+{
+	static SPB_TARGET Target;
+	static READER Reader;
+	UINT8 Data[MESSAGE_BUFFER_SIZE];
+	ULONG Length;
+
+	//
+	// A short header, completed inline
+	//
+	Open(&Target);
+	QueueTouch(&Target, 2);
+
+	ShimRequestShortReads(1, 1);
+	CHECK_EQ(SpbReadContinuedDataChained(Target.Spb,
+		MESSAGE_HEADER_SIZE,
+		ReadNext,
+		NULL,
+		Data,
+		sizeof(Data),
+		&Length), STATUS_DEVICE_PROTOCOL_ERROR);
+	CHECK_EQ(Length, 0);
+
+	Close(&Target);
+
+	//
+	// A short payload, completed later
+	//
+	Open(&Target);
+	ShimRequestSetDeferred(TRUE);
+	QueueTouch(&Target, 2);
+
+	StartReader(&Reader, &Target);
+	CHECK(ShimRequestWaitSends(1, SEND_TIMEOUT_MS));
+	CHECK(ShimRequestCompleteSend(0));
+	CHECK(ShimRequestWaitSends(1, SEND_TIMEOUT_MS));
+
+	ShimRequestShortReads(1, 2);
+	CHECK(ShimRequestCompleteSend(0));
+
+	CHECK(WaitReader(&Reader));
+	CHECK_EQ(Reader.Status, STATUS_DEVICE_PROTOCOL_ERROR);
+	CHECK_EQ(Reader.Length, 0);
+	CHECK(!ShimRequestCompleteSend(0));
+
+	Close(&Target);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestDeferredCompletion);
+	RUN(TestOutOfOrder);
+	RUN(TestSendFailure);
+	RUN(TestShortRead);
+
+	return TestResult();
+}
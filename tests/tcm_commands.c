@@ -0,0 +1,345 @@
+/*++
+	Module Name:
+
+		tcm_commands.c
+
+	Abstract:
+
+		Commands from several threads against touch frames serviced by
+		the interrupt thread. Every command reads or writes a dynamic
+		config value its thread owns, so a response handed to the wrong
+		command shows up as a wrong value. The fake counts commands
+		written while a response was still unread, which the command
+		lock rules out.
+
+		The time message reads hold the ControllerLock and the time
+		submitters wait for the CommandLock are reported as histograms.
+		The reads must stay short while submitters queue behind each
+		other's commands.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "hid_sink.h"
+#include <unistd.h>
+
+#define COMMAND_THREADS 4
+#define COMMAND_ITERATIONS 300
+#define IDS_PER_THREAD 32
+
+//
+// Ids below this are left to the driver, it writes DC_NO_DOZE itself
+// when touch frames change the report rate
+//
+#define FIRST_TEST_ID 0x20
+
+typedef struct _COMMAND_THREAD
+{
+	TCM_HARNESS* Harness;
+	ULONG Index;
+	ULONG Commands;
+	ULONG Mismatches;
+	ULONG Failures;
+	ULONG MaxLatencyUs;
+} COMMAND_THREAD;
+
+//
+// Message reads hold the ControllerLock for the bus transfers and the
+// dispatch only, never for a command response
+//
+#define ISR_HOLD_P99_US 1024
+
+static volatile LONG FramesStop;
+
+//
+// Responses to dynamic config reads come back after a delay that
+// varies from command to command
+//
+static BOOLEAN
+DelayDynamicConfig(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length,
+	PVOID Context
+)
+{
+	UINT8 Value[2];
+	UINT16 Stored;
+
+	UNREFERENCED_PARAMETER(Context);
+
+	if (Command != CMD_GET_DYNAMIC_CONFIG || Length < 1) {
+		return FALSE;
+	}
+
+	Stored = __atomic_load_n(&Tcm->DynamicConfig[Payload[0]], __ATOMIC_SEQ_CST);
+	Value[0] = (UINT8)Stored;
+	Value[1] = (UINT8)(Stored >> 8);
+
+	FakeTcmQueue(Tcm, TCM_STATUS_OK, Value, sizeof(Value), 50 + (Payload[0] * 37) % 400);
+
+	return TRUE;
+}
+
+static void*
+CommandThread(
+	void* Context
+)
+{
+	COMMAND_THREAD* Thread = Context;
+	TCM_CONTROLLER_CONTEXT* Controller = Thread->Harness->Controller;
+	SPB_CONTEXT* Spb = Thread->Harness->Spb;
+	UINT16 Expected[IDS_PER_THREAD];
+	UINT16 Value;
+	ULONG64 Start;
+	ULONG i, LatencyUs;
+	UINT8 Id;
+
+	for (i = 0; i < IDS_PER_THREAD; i++) {
+		Expected[i] = Thread->Harness->Tcm.DynamicConfig[FIRST_TEST_ID + Thread->Index * IDS_PER_THREAD + i];
+	}
+
+	for (i = 0; i < COMMAND_ITERATIONS; i++) {
+		Id = (UINT8)(FIRST_TEST_ID + Thread->Index * IDS_PER_THREAD + i % IDS_PER_THREAD);
+		Start = KeQueryInterruptTime();
+
+		if (i % 3 == 2) {
+			Value = (UINT16)(Thread->Index << 12 | i);
+
+			if (NT_SUCCESS(TcmSetDynamicConfig(Controller, Spb, Id, Value))) {
+				Expected[i % IDS_PER_THREAD] = Value;
+			}
+			else {
+				Thread->Failures++;
+			}
+		}
+		else if (NT_SUCCESS(TcmGetDynamicConfig(Controller, Spb, Id, &Value))) {
+			if (Value != Expected[i % IDS_PER_THREAD]) {
+				Thread->Mismatches++;
+			}
+		}
+		else {
+			Thread->Failures++;
+		}
+
+		LatencyUs = (ULONG)((KeQueryInterruptTime() - Start) / 10);
+		Thread->MaxLatencyUs = max(Thread->MaxLatencyUs, LatencyUs);
+		Thread->Commands++;
+	}
+
+	return NULL;
+}
+
+static void*
+FrameThread(
+	void* Context
+)
+{
+	TCM_HARNESS* Harness = Context;
+	FAKE_TCM_OBJECT Object = { 0, 1, 0, 0 };
+	ULONG Frame = 0;
+
+	while (!FramesStop) {
+		Object.X = (UINT16)(100 + Frame % 1000);
+		Object.Y = (UINT16)(200 + Frame % 2000);
+		FakeTcmQueueTouch(&Harness->Tcm, &Object, 1);
+		Frame++;
+		usleep(1000);
+	}
+
+	return NULL;
+}
+
+static ULONG
+HistogramSum(
+	const TCM_LOCK_TIME_STATS* Stats
+)
+{
+	ULONG Sum = 0;
+	ULONG i;
+
+	for (i = 0; i < TCM_LOCK_HISTOGRAM_BUCKETS; i++) {
+		Sum += Stats->Histogram[i];
+	}
+
+	return Sum;
+}
+
+//
+// Smallest bucket bound that at least Percent of the times are under
+//
+static ULONG
+HistogramPercentileUs(
+	const TCM_LOCK_TIME_STATS* Stats,
+	ULONG Percent
+)
+{
+	ULONG Sum = 0;
+	ULONG i;
+
+	for (i = 0; i < TCM_LOCK_HISTOGRAM_BUCKETS - 1; i++) {
+		Sum += Stats->Histogram[i];
+
+		if ((ULONG64)Sum * 100 >= (ULONG64)Stats->Count * Percent) {
+			break;
+		}
+	}
+
+	return 1UL << i;
+}
+
+static VOID
+PrintLockTime(
+	const char* Name,
+	const TCM_LOCK_TIME_STATS* Stats
+)
+{
+	ULONG i;
+
+	printf("  %s: %lu times, avg %lu us, p50 < %lu us, p99 < %lu us, max %lu us\n",
+		Name,
+		(unsigned long)Stats->Count,
+		Stats->Count != 0 ? (unsigned long)(Stats->TotalUs / Stats->Count) : 0UL,
+		(unsigned long)HistogramPercentileUs(Stats, 50),
+		(unsigned long)HistogramPercentileUs(Stats, 99),
+		(unsigned long)Stats->MaxUs);
+
+	printf("   ");
+	for (i = 0; i < TCM_LOCK_HISTOGRAM_BUCKETS; i++) {
+		if (Stats->Histogram[i] != 0) {
+			printf(" <%luus:%lu", 1UL << i, (unsigned long)Stats->Histogram[i]);
+		}
+	}
+	printf("\n");
+}
+
+static VOID
+TestCommandsMatchResponses(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	TCM_LOCK_STATS* Locks;
+	COMMAND_THREAD Threads[COMMAND_THREADS];
+	pthread_t Handles[COMMAND_THREADS];
+	pthread_t Frames;
+	ULONG i, Mismatches = 0, Failures = 0, Commands = 0, MaxLatencyUs = 0;
+	ULONG Reports;
+
+	TcmHarnessInitialize(&Harness);
+
+	for (i = 0; i < 256; i++) {
+		Harness.Tcm.DynamicConfig[i] = (UINT16)(0x1000 + i * 7);
+	}
+
+	Harness.Tcm.ResponseDelayUs = 100;
+
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+
+	FakeTcmSetHook(&Harness.Tcm, DelayDynamicConfig, NULL);
+	FakeHidReset();
+
+	Locks = &Harness.Controller->LockStats;
+	RtlZeroMemory(Locks, sizeof(*Locks));
+
+	FramesStop = FALSE;
+	CHECK(pthread_create(&Frames, NULL, FrameThread, &Harness) == 0);
+
+	for (i = 0; i < COMMAND_THREADS; i++) {
+		memset(&Threads[i], 0, sizeof(Threads[i]));
+		Threads[i].Harness = &Harness;
+		Threads[i].Index = i;
+		CHECK(pthread_create(&Handles[i], NULL, CommandThread, &Threads[i]) == 0);
+	}
+
+	for (i = 0; i < COMMAND_THREADS; i++) {
+		pthread_join(Handles[i], NULL);
+		Mismatches += Threads[i].Mismatches;
+		Failures += Threads[i].Failures;
+		Commands += Threads[i].Commands;
+		MaxLatencyUs = max(MaxLatencyUs, Threads[i].MaxLatencyUs);
+	}
+
+	InterlockedExchange(&FramesStop, TRUE);
+	pthread_join(Frames, NULL);
+	CHECK(TcmHarnessDrain(&Harness, 1000));
+
+	Reports = FakeHidReports();
+
+	printf("  %lu commands, %lu mismatched, %lu failed, max latency %lu us, %lu touch reports\n",
+		(unsigned long)Commands,
+		(unsigned long)Mismatches,
+		(unsigned long)Failures,
+		(unsigned long)MaxLatencyUs,
+		(unsigned long)Reports);
+
+	CHECK_EQ(Commands, COMMAND_THREADS * COMMAND_ITERATIONS);
+	CHECK_EQ(Mismatches, 0);
+	CHECK_EQ(Failures, 0);
+	CHECK_EQ(Harness.Tcm.CommandOverlaps, 0);
+	CHECK_EQ(Harness.Tcm.BusOverlaps, 0);
+	CHECK_EQ(Harness.Controller->CommandOwner, NULL);
+	CHECK(Reports > 0);
+
+	PrintLockTime("ControllerLock hold per message", &Locks->IsrHold);
+	PrintLockTime("CommandLock wait", &Locks->CommandWait);
+
+	CHECK_EQ(HistogramSum(&Locks->IsrHold), Locks->IsrHold.Count);
+	CHECK_EQ(HistogramSum(&Locks->CommandWait), Locks->CommandWait.Count);
+	CHECK(Locks->IsrHold.Count >= Reports);
+	CHECK(Locks->CommandWait.Count >= Commands);
+
+	//
+	// Submitters queue behind each other's responses, the reads that
+	// service frames and responses do not
+	//
+	CHECK(HistogramPercentileUs(&Locks->IsrHold, 99) <= ISR_HOLD_P99_US);
+	CHECK(Locks->CommandWait.MaxUs > HistogramPercentileUs(&Locks->IsrHold, 50));
+
+	TcmHarnessStop(&Harness);
+}
+
+static VOID
+TestNestedCommandLock(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	UINT16 Value = 0;
+
+	TcmHarnessInitialize(&Harness);
+	Harness.Tcm.DynamicConfig[DC_NO_DOZE] = 1;
+
+	CHECK_SUCCESS(TcmHarnessStart(&Harness, TRUE, 2000));
+
+	//
+	// Callers that read ResponseData hold the lock around
+	// TcmWriteMessage, which takes it once more
+	//
+	TcmLockCommands(Harness.Controller);
+	CHECK_SUCCESS(TcmGetDynamicConfig(Harness.Controller, Harness.Spb, DC_NO_DOZE, &Value));
+	CHECK_EQ(Harness.Controller->CommandDepth, 1);
+	TcmUnlockCommands(Harness.Controller);
+
+	CHECK_EQ(Value, 1);
+	CHECK_EQ(Harness.Controller->CommandOwner, NULL);
+
+	TcmHarnessStop(&Harness);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestNestedCommandLock);
+	RUN(TestCommandsMatchResponses);
+
+	return TestResult();
+}
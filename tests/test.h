@@ -0,0 +1,59 @@
+/*++
+	Module Name:
+
+		test.h
+
+	Abstract:
+
+		Checks for the Linux test programs. A failed check is reported
+		with its location and fails the program, the test carries on.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include <stdio.h>
+
+static int TestFailures;
+
+#define CHECK(e) \
+	((e) ? (void)0 : (void)(fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #e), TestFailures++))
+
+#define CHECK_EQ(a, b) \
+	do { \
+		long long _a = (long long)(a), _b = (long long)(b); \
+		if (_a != _b) { \
+			fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", \
+				__FILE__, __LINE__, #a, #b, _a, _b); \
+			TestFailures++; \
+		} \
+	} while (0)
+
+#define CHECK_SUCCESS(e) \
+	do { \
+		long _s = (long)(e); \
+		if (_s < 0) { \
+			fprintf(stderr, "%s:%d: %s failed - 0x%08lX\n", \
+				__FILE__, __LINE__, #e, (unsigned long)_s & 0xffffffffUL); \
+			TestFailures++; \
+		} \
+	} while (0)
+
+#define RUN(t) \
+	do { \
+		int _f = TestFailures; \
+		t(); \
+		printf("%s %s\n", TestFailures == _f ? "ok  " : "FAIL", #t); \
+	} while (0)
+
+static inline int
+TestResult(
+	void
+)
+{
+	return TestFailures != 0;
+}
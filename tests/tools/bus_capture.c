@@ -0,0 +1,299 @@
+/*++
+	Module Name:
+
+		bus_capture.c
+
+	Abstract:
+
+		Parses and replays bus captures, see bus_capture.h
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "bus_capture.h"
+#include <spb.h>
+#include <selftest\selftest.h>
+#include <time.h>
+
+static BOOLEAN
+BusCaptureAppend(
+	BUS_CAPTURE* Capture,
+	const BUS_CAPTURE_MESSAGE* Message,
+	const UINT8* Payload
+)
+{
+	BUS_CAPTURE_MESSAGE* Messages;
+	BUS_CAPTURE_MESSAGE* Copy;
+
+	if ((Capture->MessageCount & (Capture->MessageCount - 1)) == 0) {
+		Messages = realloc(Capture->Messages,
+			max(Capture->MessageCount * 2, 16) * sizeof(BUS_CAPTURE_MESSAGE));
+
+		if (Messages == NULL) {
+			return FALSE;
+		}
+
+		Capture->Messages = Messages;
+	}
+
+	Copy = &Capture->Messages[Capture->MessageCount];
+	*Copy = *Message;
+	Copy->Payload = NULL;
+
+	if (Message->Length != 0) {
+		Copy->Payload = malloc(Message->Length);
+
+		if (Copy->Payload == NULL) {
+			return FALSE;
+		}
+
+		memcpy(Copy->Payload, Payload, Message->Length);
+	}
+
+	Capture->MessageCount++;
+
+	return TRUE;
+}
+
+BOOLEAN
+BusCaptureLoad(
+	BUS_CAPTURE* Capture,
+	const UINT8* Data,
+	ULONG Length
+)
+{
+	const TOUCH_TEST_BUS_CAPTURE* Header;
+	const SPB_CAPTURE_RECORD* Record;
+	const UINT8* Bytes;
+	BUS_CAPTURE_MESSAGE Pending = { 0 };
+	BOOLEAN HavePending = FALSE;
+	UINT8 Command = 0;
+	ULONG Offset = 0, End, i;
+
+	memset(Capture, 0, sizeof(*Capture));
+
+	while (Offset < Length) {
+		if (Length - Offset < sizeof(TOUCH_TEST_BUS_CAPTURE)) {
+			return FALSE;
+		}
+
+		Header = (const TOUCH_TEST_BUS_CAPTURE*)(Data + Offset);
+		Offset += sizeof(TOUCH_TEST_BUS_CAPTURE);
+
+		if (Header->Length > Length - Offset) {
+			return FALSE;
+		}
+
+		Capture->Lost += Header->Lost;
+		End = Offset + Header->Length;
+
+		for (i = 0; i < Header->RecordCount; i++) {
+			if (End - Offset < sizeof(SPB_CAPTURE_RECORD)) {
+				return FALSE;
+			}
+
+			Record = (const SPB_CAPTURE_RECORD*)(Data + Offset);
+
+			if (SPB_CAPTURE_RECORD_SIZE(Record->Length) > End - Offset) {
+				return FALSE;
+			}
+
+			Offset += SPB_CAPTURE_RECORD_SIZE(Record->Length);
+			Capture->Records++;
+
+			Bytes = (const UINT8*)(Record + 1);
+
+			if (!NT_SUCCESS(Record->Status) ||
+				(Record->Flags & (SPB_CAPTURE_FAULT | SPB_CAPTURE_TRUNCATED)) != 0) {
+				Capture->Faults++;
+				HavePending = FALSE;
+				continue;
+			}
+
+			//
+			// A command is its code as the address, then its length and
+			// payload
+			//
+			if (Record->Flags & SPB_CAPTURE_WRITE) {
+				Command = Record->Address;
+				HavePending = FALSE;
+
+				Pending.TimeUs = Record->TimeUs;
+				Pending.Written = TRUE;
+				Pending.Command = Command;
+				Pending.Code = Command;
+				Pending.Length = 0;
+
+				if (Record->Length >= 2) {
+					Pending.Length = (UINT16)min((ULONG)(Bytes[0] | (Bytes[1] << 8)), Record->Length - 2);
+				}
+
+				if (!BusCaptureAppend(Capture, &Pending, Bytes + 2)) {
+					return FALSE;
+				}
+
+				continue;
+			}
+
+			//
+			// Messages are read as a header, then as a continued read
+			// of the payload and the padding byte
+			//
+			if ((Record->Flags & (SPB_CAPTURE_READ | SPB_CAPTURE_CONTINUED)) !=
+				(SPB_CAPTURE_READ | SPB_CAPTURE_CONTINUED) ||
+				Record->Length < 2 ||
+				Bytes[0] != MESSAGE_MARKER) {
+				continue;
+			}
+
+			if (Bytes[1] == TCM_STATUS_CONTINUED_READ) {
+				if (!HavePending) {
+					continue;
+				}
+
+				HavePending = FALSE;
+
+				if (Record->Length < (ULONG)Pending.Length + 3) {
+					Capture->Broken++;
+					continue;
+				}
+
+				if (!BusCaptureAppend(Capture, &Pending, Bytes + 2)) {
+					return FALSE;
+				}
+
+				continue;
+			}
+
+			if (HavePending) {
+				Capture->Broken++;
+				HavePending = FALSE;
+			}
+
+			if (Record->Length != MESSAGE_HEADER_SIZE ||
+				Bytes[1] == TCM_STATUS_IDLE ||
+				Bytes[1] == TCM_STATUS_BUSY) {
+				continue;
+			}
+
+			Pending.TimeUs = Record->TimeUs;
+			Pending.Written = FALSE;
+			Pending.Command = Command;
+			Pending.Code = Bytes[1];
+			Pending.Length = (UINT16)(Bytes[2] | (Bytes[3] << 8));
+
+			if (Pending.Length == 0) {
+				if (!BusCaptureAppend(Capture, &Pending, NULL)) {
+					return FALSE;
+				}
+			}
+			else {
+				HavePending = TRUE;
+			}
+		}
+
+		if (Offset != End) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+VOID
+BusCaptureFree(
+	BUS_CAPTURE* Capture
+)
+{
+	ULONG i;
+
+	for (i = 0; i < Capture->MessageCount; i++) {
+		free(Capture->Messages[i].Payload);
+	}
+
+	free(Capture->Messages);
+	memset(Capture, 0, sizeof(*Capture));
+}
+
+VOID
+BusCaptureConfigure(
+	const BUS_CAPTURE* Capture,
+	FAKE_TCM* Tcm
+)
+{
+	const BUS_CAPTURE_MESSAGE* Message;
+	ULONG i;
+
+	//
+	// Reports were encoded with the last touch report config set or
+	// read back
+	//
+	for (i = 0; i < Capture->MessageCount; i++) {
+		Message = &Capture->Messages[i];
+
+		if (Message->Written) {
+			if (Message->Command == CMD_SET_TOUCH_REPORT_CONFIG) {
+				Tcm->ReportConfigLength = min(Message->Length, sizeof(Tcm->ReportConfig));
+				memcpy(Tcm->ReportConfig, Message->Payload, Tcm->ReportConfigLength);
+			}
+		}
+		else if (Message->Code == TCM_REPORT_IDENTIFY ||
+			(Message->Code == TCM_STATUS_OK && Message->Command == CMD_IDENTIFY)) {
+			memcpy(&Tcm->IdInfo, Message->Payload, min(Message->Length, sizeof(Tcm->IdInfo)));
+		}
+		else if (Message->Code == TCM_STATUS_OK && Message->Command == CMD_GET_APPLICATION_INFO) {
+			memcpy(&Tcm->AppInfo, Message->Payload, min(Message->Length, sizeof(Tcm->AppInfo)));
+		}
+		else if (Message->Code == TCM_STATUS_OK && Message->Command == CMD_GET_TOUCH_REPORT_CONFIG) {
+			Tcm->ReportConfigLength = min(Message->Length, sizeof(Tcm->ReportConfig));
+			memcpy(Tcm->ReportConfig, Message->Payload, Tcm->ReportConfigLength);
+		}
+	}
+}
+
+ULONG
+BusCaptureQueue(
+	const BUS_CAPTURE* Capture,
+	FAKE_TCM* Tcm,
+	UINT8 FirstCode,
+	UINT8 LastCode
+)
+{
+	const BUS_CAPTURE_MESSAGE* Message;
+	struct timespec Start, Due;
+	ULONG64 FirstUs = 0, OffsetNs;
+	ULONG Queued = 0, i;
+
+	clock_gettime(CLOCK_MONOTONIC, &Start);
+
+	for (i = 0; i < Capture->MessageCount; i++) {
+		Message = &Capture->Messages[i];
+
+		if (Message->Written || Message->Code < FirstCode || Message->Code > LastCode) {
+			continue;
+		}
+
+		if (Queued == 0) {
+			FirstUs = Message->TimeUs;
+		}
+
+		OffsetNs = (Message->TimeUs - FirstUs) * 1000;
+		Due.tv_sec = Start.tv_sec + (time_t)(OffsetNs / 1000000000ULL);
+		Due.tv_nsec = Start.tv_nsec + (long)(OffsetNs % 1000000000ULL);
+
+		if (Due.tv_nsec >= 1000000000L) {
+			Due.tv_sec++;
+			Due.tv_nsec -= 1000000000L;
+		}
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Due, NULL);
+
+		FakeTcmQueue(Tcm, Message->Code, Message->Payload, Message->Length, 0);
+		Queued++;
+	}
+
+	return Queued;
+}
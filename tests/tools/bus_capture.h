@@ -0,0 +1,94 @@
+/*++
+	Module Name:
+
+		bus_capture.h
+
+	Abstract:
+
+		Reads the output of IOCTL_TOUCH_SELFTEST_BUS_CAPTURE back into
+		the TCM messages the driver read, and replays them: the identity,
+		application info and touch report config of the captured
+		controller are given to a FAKE_TCM, and its touch reports are
+		queued on it so that the driver reads them again.
+
+		A capture file is the output of one or more capture requests
+		written one after the other.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include "tcm_device.h"
+
+//
+// A message the driver read, or a command it wrote. Command is the last
+// command written before the message, or the command itself.
+//
+typedef struct _BUS_CAPTURE_MESSAGE
+{
+	ULONG64 TimeUs;
+	BOOLEAN Written;
+	UINT8 Command;
+	UINT8 Code;
+	UINT16 Length;
+	UINT8* Payload;
+} BUS_CAPTURE_MESSAGE;
+
+typedef struct _BUS_CAPTURE
+{
+	BUS_CAPTURE_MESSAGE* Messages;
+	ULONG MessageCount;
+
+	//
+	// Records read, records the driver lost before they were drained,
+	// failed or truncated transfers, and message headers whose payload
+	// read is missing
+	//
+	ULONG Records;
+	ULONG Lost;
+	ULONG Faults;
+	ULONG Broken;
+} BUS_CAPTURE;
+
+//
+// Parses Length bytes of capture requests output. Returns FALSE if the
+// data is not laid out as such.
+//
+BOOLEAN
+BusCaptureLoad(
+	BUS_CAPTURE* Capture,
+	const UINT8* Data,
+	ULONG Length
+);
+
+VOID
+BusCaptureFree(
+	BUS_CAPTURE* Capture
+);
+
+//
+// Gives Tcm what the captured controller answered during bring-up, to
+// be called before the driver is started on it
+//
+VOID
+BusCaptureConfigure(
+	const BUS_CAPTURE* Capture,
+	FAKE_TCM* Tcm
+);
+
+//
+// Queues every captured message read with a code in [FirstCode,
+// LastCode] on Tcm, spaced out as they were captured. Returns the
+// number queued.
+//
+ULONG
+BusCaptureQueue(
+	const BUS_CAPTURE* Capture,
+	FAKE_TCM* Tcm,
+	UINT8 FirstCode,
+	UINT8 LastCode
+);
@@ -0,0 +1,180 @@
+/*++
+	Module Name:
+
+		bus_replay.c
+
+	Abstract:
+
+		Replays a bus capture taken on a device through the driver's own
+		touch_tcm.c, report.c and resolutions.c, and prints the HID
+		reports they produce:
+
+		  bus_replay [-q] [-a] capture.bin
+
+		capture.bin holds the output of IOCTL_TOUCH_SELFTEST_BUS_CAPTURE.
+		Only touch reports are replayed, -a replays every report.
+		-q prints the totals only.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "tcm_harness.h"
+#include "hid_sink.h"
+#include "bus_capture.h"
+#include <getopt.h>
+#include <stdio.h>
+
+static VOID
+PrintReport(
+	const HID_INPUT_REPORT* Report,
+	PVOID Context
+)
+{
+	const HID_TOUCH_REPORT* Touch = &Report->TouchReport;
+	ULONG i;
+
+	UNREFERENCED_PARAMETER(Context);
+
+	if (Report->ReportID != REPORTID_FINGER) {
+		printf("report %u\n", Report->ReportID);
+		return;
+	}
+
+	printf("touch %u:", Touch->ContactCount);
+
+	for (i = 0; i < RTL_NUMBER_OF(Touch->Contacts); i++) {
+		printf(" [%u %s %u,%u]",
+			Touch->Contacts[i].ContactID,
+			Touch->Contacts[i].TipSwitch ? "down" : "up",
+			Touch->Contacts[i].X,
+			Touch->Contacts[i].Y);
+	}
+
+	printf("\n");
+}
+
+static UINT8*
+ReadFile(
+	const char* Path,
+	ULONG* Length
+)
+{
+	FILE* File = fopen(Path, "rb");
+	UINT8* Data = NULL;
+	long Size;
+
+	if (File == NULL) {
+		return NULL;
+	}
+
+	if (fseek(File, 0, SEEK_END) == 0 && (Size = ftell(File)) >= 0 &&
+		fseek(File, 0, SEEK_SET) == 0) {
+		Data = malloc((size_t)Size + 1);
+
+		if (Data != NULL && fread(Data, 1, (size_t)Size, File) != (size_t)Size) {
+			free(Data);
+			Data = NULL;
+		}
+
+		*Length = (ULONG)Size;
+	}
+
+	fclose(File);
+
+	return Data;
+}
+
+int
+main(
+	int argc,
+	char** argv
+)
+{
+	static TCM_HARNESS Harness;
+	BUS_CAPTURE Capture;
+	BOOLEAN Quiet = FALSE;
+	UINT8 LastCode = TCM_REPORT_TOUCH;
+	UINT8* Data;
+	ULONG Length = 0, Queued, Reports;
+	NTSTATUS status;
+	int Option;
+
+	while ((Option = getopt(argc, argv, "qa")) != -1) {
+		switch (Option) {
+		case 'q':
+			Quiet = TRUE;
+			break;
+		case 'a':
+			LastCode = 0xFF;
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-q] [-a] capture.bin\n", argv[0]);
+		return 2;
+	}
+
+	Data = ReadFile(argv[optind], &Length);
+	if (Data == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (!BusCaptureLoad(&Capture, Data, Length)) {
+		fprintf(stderr, "%s: not a bus capture\n", argv[optind]);
+		return 1;
+	}
+
+	printf("%u records, %u lost, %u failed, %u messages, %u incomplete\n",
+		Capture.Records,
+		Capture.Lost,
+		Capture.Faults,
+		Capture.MessageCount,
+		Capture.Broken);
+
+	//
+	// Bring the driver up on a controller that looks like the captured
+	// one, then feed it what that controller reported
+	//
+	TcmHarnessInitialize(&Harness);
+	BusCaptureConfigure(&Capture, &Harness.Tcm);
+
+	status = TcmHarnessStart(&Harness, TRUE, 2000);
+	if (!NT_SUCCESS(status)) {
+		fprintf(stderr, "driver start failed - 0x%08X\n", (unsigned)status);
+		return 1;
+	}
+
+	FakeHidReset();
+
+	if (!Quiet) {
+		FakeHidSetCallback(PrintReport, NULL);
+	}
+
+	Queued = BusCaptureQueue(&Capture, &Harness.Tcm, TCM_REPORT_TOUCH, LastCode);
+
+	if (!TcmHarnessDrain(&Harness, 2000)) {
+		fprintf(stderr, "driver did not read every report\n");
+	}
+
+	Reports = FakeHidReports();
+	FakeHidReset();
+
+	printf("%u reports replayed, %u HID reports, %u lost by the driver\n",
+		Queued,
+		Reports,
+		Harness.Controller->RecoveryStats.LostMessages);
+
+	TcmHarnessStop(&Harness);
+	BusCaptureFree(&Capture);
+	free(Data);
+
+	return 0;
+}
@@ -0,0 +1,338 @@
+/*++
+	Module Name:
+
+		image_codec_bench.c
+
+	Abstract:
+
+		Measures the image stream codec on a recorded image sequence:
+		the compression ratio, and how fast the driver's encoder and the
+		application side decoder of image_ring.c get through it.
+
+		  image_codec_bench [-r rows] [-c cols] [-p passes] [frames.bin]
+
+		frames.bin holds Rows x Cols little endian 16-bit samples per
+		frame, as image_reader -o writes them. Without it the frames the
+		fake image source sends are used. Frames are coded the way the
+		stream does, a key frame every IMAGE_STREAM_KEYFRAME_INTERVAL + 1
+		and frames that do not compress stored as they are. Exits with 1
+		if a frame does not decode back to what was encoded.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "image_source.h"
+#include "image_ring.h"
+#include <tcm/touch_tcm.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_FRAMES 1000
+#define DEFAULT_PASSES 20
+
+typedef struct _CODED_FRAME
+{
+	UINT8* Data;
+	ULONG Length;
+	BOOLEAN Key;
+	BOOLEAN Compressed;
+} CODED_FRAME;
+
+static int
+Usage(
+	const char* Program
+)
+{
+	fprintf(stderr, "usage: %s [-r rows] [-c cols] [-p passes] [frames.bin]\n", Program);
+	return 2;
+}
+
+static double
+Now(
+	void
+)
+{
+	struct timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return Time.tv_sec + Time.tv_nsec / 1e9;
+}
+
+//
+// Reads a recording, returns the number of whole frames in it
+//
+static ULONG
+ReadRecording(
+	const char* Path,
+	ULONG FrameLength,
+	UINT16** Frames
+)
+{
+	FILE* Input = fopen(Path, "rb");
+	long Size;
+	ULONG Count;
+
+	if (Input == NULL) {
+		perror(Path);
+		return 0;
+	}
+
+	fseek(Input, 0, SEEK_END);
+	Size = ftell(Input);
+	fseek(Input, 0, SEEK_SET);
+
+	Count = Size > 0 ? (ULONG)(Size / FrameLength) : 0;
+	*Frames = malloc((size_t)Count * FrameLength + 1);
+
+	if (*Frames == NULL || fread(*Frames, FrameLength, Count, Input) != Count) {
+		fprintf(stderr, "%s: could not read %u frames\n", Path, Count);
+		Count = 0;
+	}
+
+	fclose(Input);
+
+	return Count;
+}
+
+//
+// Codes every frame as the stream does, the one before it being the
+// reference unless a key frame is due
+//
+static VOID
+Encode(
+	UINT16* Frames,
+	ULONG Count,
+	ULONG Samples,
+	CODED_FRAME* Coded
+)
+{
+	ULONG FrameLength = Samples * sizeof(UINT16);
+	ULONG Countdown = 0;
+	UINT16* Frame;
+	ULONG i;
+
+	for (i = 0; i < Count; i++) {
+		Frame = Frames + (size_t)i * Samples;
+
+		Coded[i].Key = i == 0 || Countdown == 0;
+		Coded[i].Length = TcmImageEncode(Frame,
+			Coded[i].Key ? NULL : Frame - Samples,
+			Samples,
+			Coded[i].Data,
+			FrameLength);
+		Coded[i].Compressed = Coded[i].Length != 0;
+
+		if (!Coded[i].Compressed) {
+			memcpy(Coded[i].Data, Frame, FrameLength);
+			Coded[i].Length = FrameLength;
+			Coded[i].Key = TRUE;
+		}
+
+		Countdown = Coded[i].Key ? IMAGE_STREAM_KEYFRAME_INTERVAL : Countdown - 1;
+	}
+}
+
+//
+// Decodes every frame against the one decoded before it, returns the
+// frames that did not come out as they went in
+//
+static ULONG
+Decode(
+	UINT16* Frames,
+	ULONG Count,
+	ULONG Samples,
+	CODED_FRAME* Coded,
+	UINT16* Output,
+	BOOLEAN Check
+)
+{
+	ULONG FrameLength = Samples * sizeof(UINT16);
+	UINT16* Reference = NULL;
+	UINT16* Decoded;
+	ULONG Bad = 0;
+	ULONG i;
+
+	for (i = 0; i < Count; i++) {
+		Decoded = Output + (size_t)(i % 2) * Samples;
+
+		if (!Coded[i].Compressed) {
+			memcpy(Decoded, Coded[i].Data, FrameLength);
+		}
+		else if (!ImageDecode(Coded[i].Data,
+			Coded[i].Length,
+			Coded[i].Key ? NULL : Reference,
+			Decoded,
+			Samples)) {
+			Bad++;
+		}
+
+		if (Check && memcmp(Decoded, Frames + (size_t)i * Samples, FrameLength) != 0) {
+			Bad++;
+		}
+
+		Reference = Decoded;
+	}
+
+	return Bad;
+}
+
+int
+main(
+	int argc,
+	char** argv
+)
+{
+	ULONG Rows = 18, Cols = 36, Passes = DEFAULT_PASSES;
+	ULONG Samples, FrameLength, Count, Pass, Bad, Keys = 0, Raw = 0, i;
+	ULONG64 RawBytes, EncodedBytes = 0, KeyBytes = 0, DeltaBytes = 0;
+	const char* Path = NULL;
+	UINT16* Frames = NULL;
+	UINT16* Output;
+	CODED_FRAME* Coded;
+	double Start, EncodeSeconds, DecodeSeconds;
+	int Option;
+
+	while ((Option = getopt(argc, argv, "r:c:p:")) != -1) {
+		switch (Option) {
+		case 'r':
+			Rows = (ULONG)strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			Cols = (ULONG)strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			Passes = (ULONG)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			return Usage(argv[0]);
+		}
+	}
+
+	if (optind < argc - 1 || Rows == 0 || Cols == 0 || Passes == 0) {
+		return Usage(argv[0]);
+	}
+
+	Samples = Rows * Cols;
+	FrameLength = Samples * sizeof(UINT16);
+
+	if (optind < argc) {
+		Path = argv[optind];
+		Count = ReadRecording(Path, FrameLength, &Frames);
+	}
+	else {
+		Count = DEFAULT_FRAMES;
+		Frames = malloc((size_t)Count * FrameLength);
+
+		for (i = 0; Frames != NULL && i < Count; i++) {
+			ImageSourceFill(i + 1, Rows, Cols, Frames + (size_t)i * Samples);
+		}
+	}
+
+	if (Frames == NULL || Count == 0) {
+		fprintf(stderr, "no frames\n");
+		return 1;
+	}
+
+	Coded = calloc(Count, sizeof(CODED_FRAME));
+	Output = malloc(2 * (size_t)FrameLength);
+
+	for (i = 0; Coded != NULL && i < Count; i++) {
+		Coded[i].Data = malloc(FrameLength);
+
+		if (Coded[i].Data == NULL) {
+			return 1;
+		}
+	}
+
+	if (Coded == NULL || Output == NULL) {
+		return 1;
+	}
+
+	Start = Now();
+
+	for (Pass = 0; Pass < Passes; Pass++) {
+		Encode(Frames, Count, Samples, Coded);
+	}
+
+	EncodeSeconds = Now() - Start;
+
+	Bad = Decode(Frames, Count, Samples, Coded, Output, TRUE);
+
+	Start = Now();
+
+	for (Pass = 0; Pass < Passes; Pass++) {
+		Decode(Frames, Count, Samples, Coded, Output, FALSE);
+	}
+
+	DecodeSeconds = Now() - Start;
+
+	for (i = 0; i < Count; i++) {
+		EncodedBytes += Coded[i].Length;
+		Keys += Coded[i].Key;
+		Raw += !Coded[i].Compressed;
+
+		if (Coded[i].Key) {
+			KeyBytes += Coded[i].Length;
+		}
+		else {
+			DeltaBytes += Coded[i].Length;
+		}
+	}
+
+	RawBytes = (ULONG64)Count * FrameLength;
+
+	printf("%s: %u frames of %ux%u, %u key frames, %u stored raw\n",
+		Path != NULL ? Path : "image source",
+		Count,
+		Rows,
+		Cols,
+		Keys,
+		Raw);
+
+	printf("%-8s %12s %12s %8s\n", "frames", "raw bytes", "coded bytes", "ratio");
+	printf("%-8s %12llu %12llu %8.2f\n",
+		"key",
+		(unsigned long long)Keys * FrameLength,
+		(unsigned long long)KeyBytes,
+		KeyBytes != 0 ? (double)Keys * FrameLength / KeyBytes : 0);
+	printf("%-8s %12llu %12llu %8.2f\n",
+		"delta",
+		(unsigned long long)(Count - Keys) * FrameLength,
+		(unsigned long long)DeltaBytes,
+		DeltaBytes != 0 ? (double)(Count - Keys) * FrameLength / DeltaBytes : 0);
+	printf("%-8s %12llu %12llu %8.2f\n",
+		"all",
+		(unsigned long long)RawBytes,
+		(unsigned long long)EncodedBytes,
+		(double)RawBytes / EncodedBytes);
+
+	//
+	// Throughput in raw image bytes, what the stream has to keep up with
+	//
+	printf("encode %8.1f MB/s, %8.0f frames/s\n",
+		RawBytes * Passes / EncodeSeconds / 1e6,
+		Count * Passes / EncodeSeconds);
+	printf("decode %8.1f MB/s, %8.0f frames/s\n",
+		RawBytes * Passes / DecodeSeconds / 1e6,
+		Count * Passes / DecodeSeconds);
+
+	if (Bad != 0) {
+		fprintf(stderr, "%u frames did not decode back\n", Bad);
+	}
+
+	for (i = 0; i < Count; i++) {
+		free(Coded[i].Data);
+	}
+
+	free(Coded);
+	free(Output);
+	free(Frames);
+
+	return Bad != 0;
+}
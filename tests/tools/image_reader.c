@@ -0,0 +1,305 @@
+/*++
+	Module Name:
+
+		image_reader.c
+
+	Abstract:
+
+		Streams images from the driver running against a fake controller
+		that produces them at a fixed rate, through the self-test device
+		the way a tuning application does, and reports what arrived:
+
+		  image_reader [-r rate_hz] [-s seconds] [-n slots] [-p poll_us]
+		               [-t raw|delta] [-c] [-o frames.bin]
+
+		-c streams with the inter-frame codec, -o writes every decoded
+		frame as Rows x Cols little endian 16-bit samples. Exits with 1
+		if a frame did not decode or did not match what was sent.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "tcm_harness.h"
+#include "image_source.h"
+#include "image_ring.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <unistd.h>
+
+typedef struct _READER_OPTIONS
+{
+	ULONG RateHz;
+	ULONG Seconds;
+	ULONG Slots;
+	ULONG PollUs;
+	UINT8 ReportType;
+	BOOLEAN Compress;
+	const char* Output;
+} READER_OPTIONS;
+
+static int
+Usage(
+	const char* Program
+)
+{
+	fprintf(stderr,
+		"usage: %s [-r rate_hz] [-s seconds] [-n slots] [-p poll_us] [-t raw|delta] [-c] [-o frames.bin]\n",
+		Program);
+	return 2;
+}
+
+static NTSTATUS
+Ioctl(
+	WDFFILEOBJECT File,
+	ULONG Code,
+	PVOID Input,
+	size_t InputLength,
+	PVOID Output,
+	size_t OutputLength,
+	WDFREQUEST* Pending
+)
+{
+	WDFREQUEST Request;
+	NTSTATUS status;
+
+	Request = ShimRequestCreate(Code, Input, InputLength, Output, OutputLength);
+	if (Request == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	status = ShimDeviceIoControl(File, Request);
+
+	if (status == STATUS_PENDING && Pending != NULL) {
+		*Pending = Request;
+		return status;
+	}
+
+	if (status == STATUS_PENDING) {
+		status = ShimRequestWait(Request, 2000);
+	}
+
+	WdfObjectDelete(Request);
+
+	return status;
+}
+
+int
+main(
+	int argc,
+	char** argv
+)
+{
+	static TCM_HARNESS Harness;
+	READER_OPTIONS Options = { 240, 5, 16, 1000, TCM_REPORT_DELTA, FALSE, NULL };
+	TOUCH_TEST_IMAGE_STREAM_CONFIG Config;
+	TOUCH_TEST_IMAGE_FRAME Frame;
+	IMAGE_RING_READER Reader;
+	IMAGE_SOURCE Source;
+	WDFDEVICE Device;
+	WDFFILEOBJECT File = NULL;
+	WDFREQUEST Stream = NULL;
+	TOUCH_TEST_IMAGE_RING* Ring;
+	UINT16* Samples;
+	UINT16* Expected;
+	FILE* Output = NULL;
+	ULONG64 Deadline, Latency, TotalLatency = 0, MaxLatency = 0;
+	ULONG FrameLength, SlotSize, RingLength, Index, Mismatched = 0, Sent;
+	NTSTATUS status;
+	int Option;
+
+	while ((Option = getopt(argc, argv, "r:s:n:p:t:co:")) != -1) {
+		switch (Option) {
+		case 'r':
+			Options.RateHz = (ULONG)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			Options.Seconds = (ULONG)strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			Options.Slots = (ULONG)strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			Options.PollUs = (ULONG)strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			if (strcmp(optarg, "raw") == 0) {
+				Options.ReportType = TCM_REPORT_RAW;
+			}
+			else if (strcmp(optarg, "delta") == 0) {
+				Options.ReportType = TCM_REPORT_DELTA;
+			}
+			else {
+				return Usage(argv[0]);
+			}
+			break;
+		case 'c':
+			Options.Compress = TRUE;
+			break;
+		case 'o':
+			Options.Output = optarg;
+			break;
+		default:
+			return Usage(argv[0]);
+		}
+	}
+
+	if (Options.RateHz == 0 || Options.Slots < 2) {
+		return Usage(argv[0]);
+	}
+
+	TcmHarnessInitialize(&Harness);
+
+	status = TcmHarnessStart(&Harness, TRUE, 2000);
+	if (NT_SUCCESS(status)) {
+		status = TchSelfTestInitialize(Harness.Device);
+	}
+
+	if (!NT_SUCCESS(status)) {
+		fprintf(stderr, "driver start failed - 0x%08X\n", (unsigned)status);
+		return 1;
+	}
+
+	Device = ShimDeviceFind(&GUID_TOUCH_SELFTEST_INTERFACE);
+
+	status = Device != NULL ?
+		ShimDeviceOpen(Device, ShimCallerAdministrator, GENERIC_READ | GENERIC_WRITE, &File) :
+		STATUS_NO_SUCH_DEVICE;
+
+	if (!NT_SUCCESS(status)) {
+		fprintf(stderr, "cannot open the self-test device - 0x%08X\n", (unsigned)status);
+		return 1;
+	}
+
+	FrameLength = Harness.Tcm.AppInfo.NumOfImageRows * Harness.Tcm.AppInfo.NumOfImageCols * sizeof(UINT16);
+	SlotSize = ALIGN_UP_BY(sizeof(TOUCH_TEST_IMAGE_FRAME) + FrameLength, 8);
+	RingLength = sizeof(TOUCH_TEST_IMAGE_RING) + Options.Slots * SlotSize;
+
+	Ring = calloc(1, RingLength);
+	Samples = malloc(FrameLength);
+	Expected = malloc(FrameLength);
+
+	if (Ring == NULL || Samples == NULL || Expected == NULL) {
+		return 1;
+	}
+
+	if (Options.Output != NULL) {
+		Output = fopen(Options.Output, "wb");
+		if (Output == NULL) {
+			perror(Options.Output);
+			return 1;
+		}
+	}
+
+	Config.ReportType = Options.ReportType;
+	Config.Flags = Options.Compress ? TOUCH_TEST_IMAGE_STREAM_COMPRESS : 0;
+
+	status = Ioctl(File, IOCTL_TOUCH_SELFTEST_IMAGE_STREAM, &Config, sizeof(Config), Ring, RingLength, &Stream);
+
+	if (status != STATUS_PENDING) {
+		fprintf(stderr, "stream start failed - 0x%08X\n", (unsigned)status);
+		return 1;
+	}
+
+	if (!ImageRingReaderInitialize(&Reader, Ring)) {
+		fprintf(stderr, "unexpected ring layout\n");
+		return 1;
+	}
+
+	printf("%ux%u %s images at %u Hz for %u s, %u slots%s\n",
+		Ring->Rows,
+		Ring->Cols,
+		Options.ReportType == TCM_REPORT_RAW ? "raw" : "delta",
+		Options.RateHz,
+		Options.Seconds,
+		Ring->SlotCount,
+		Options.Compress ? ", compressed" : "");
+
+	status = ImageSourceStart(&Source, &Harness.Tcm, Options.ReportType, Options.RateHz);
+	if (!NT_SUCCESS(status)) {
+		return 1;
+	}
+
+	Deadline = KeQueryInterruptTime() + (ULONG64)Options.Seconds * 10000000;
+
+	for (;;) {
+		if (KeQueryInterruptTime() >= Deadline && Source.Running) {
+			ImageSourceStop(&Source);
+			TcmHarnessDrain(&Harness, 1000);
+		}
+
+		if (!ImageRingRead(&Reader, Samples, &Frame)) {
+			if (!Source.Running) {
+				break;
+			}
+
+			usleep(Options.PollUs);
+			continue;
+		}
+
+		Latency = KeQueryInterruptTime() - Frame.Timestamp;
+		TotalLatency += Latency;
+		MaxLatency = max(MaxLatency, Latency);
+
+		//
+		// The ring numbers the frames it stored, the source every frame
+		// it sent; the driver can only have dropped some in between
+		//
+		Index = Frame.Sequence + (UINT16)(Samples[0] - (UINT16)Frame.Sequence);
+		ImageSourceFill(Index, Ring->Rows, Ring->Cols, Expected);
+
+		if (memcmp(Samples, Expected, FrameLength) != 0) {
+			Mismatched++;
+		}
+
+		if (Output != NULL) {
+			fwrite(Samples, 1, FrameLength, Output);
+		}
+	}
+
+	Sent = (ULONG)Source.Frames;
+
+	status = Ioctl(File, IOCTL_TOUCH_SELFTEST_IMAGE_STREAM_STOP, NULL, 0, NULL, 0, NULL);
+	if (NT_SUCCESS(status)) {
+		status = ShimRequestWait(Stream, 2000);
+	}
+
+	printf("  sent %u, read %u, lost %u, skipped %u, corrupt %u, mismatched %u, truncated %u\n",
+		Sent,
+		Reader.Read,
+		Reader.Lost,
+		Reader.Skipped,
+		Reader.Corrupt,
+		Mismatched,
+		Ring->Truncated);
+
+	if (Reader.Read != 0) {
+		printf("  %.1f bytes per frame (%.1f%%), latency avg %llu us max %llu us, %u late source frames\n",
+			(double)Reader.EncodedBytes / Reader.Read,
+			100.0 * (double)Reader.EncodedBytes / ((double)Reader.Read * FrameLength),
+			(unsigned long long)(TotalLatency / Reader.Read / 10),
+			(unsigned long long)(MaxLatency / 10),
+			Source.Late);
+	}
+
+	if (!NT_SUCCESS(status)) {
+		fprintf(stderr, "stream stop failed - 0x%08X\n", (unsigned)status);
+	}
+
+	if (Output != NULL) {
+		fclose(Output);
+	}
+
+	WdfObjectDelete(Stream);
+	ShimDeviceClose(File);
+	ImageRingReaderCleanup(&Reader);
+	TcmHarnessStop(&Harness);
+
+	free(Ring);
+	free(Samples);
+	free(Expected);
+
+	return Reader.Corrupt != 0 || Mismatched != 0 || !NT_SUCCESS(status);
+}
@@ -0,0 +1,189 @@
+/*++
+	Module Name:
+
+		image_ring.c
+
+	Abstract:
+
+		Reads and decodes image stream frames, see image_ring.h
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "image_ring.h"
+
+BOOLEAN
+ImageDecode(
+	const UINT8* Data,
+	ULONG Length,
+	const UINT16* Reference,
+	UINT16* Samples,
+	ULONG Count
+)
+{
+	ULONG Offset = 0, Index = 0, Token, Shift, Run, ZigZag;
+	UINT16 Delta;
+
+	while (Offset < Length) {
+		Token = 0;
+		Shift = 0;
+
+		do {
+			if (Offset >= Length || Shift > 28) {
+				return FALSE;
+			}
+
+			Token |= (ULONG)(Data[Offset] & 0x7F) << Shift;
+			Shift += 7;
+		} while (Data[Offset++] & 0x80);
+
+		if ((Token & 1) == 0) {
+			Run = (Token >> 1) + 1;
+
+			if (Run > Count - Index) {
+				return FALSE;
+			}
+
+			while (Run-- != 0) {
+				Samples[Index] = Reference != NULL ? Reference[Index] : 0;
+				Index++;
+			}
+		}
+		else {
+			if (Index >= Count) {
+				return FALSE;
+			}
+
+			ZigZag = Token >> 1;
+			Delta = (UINT16)((ZigZag >> 1) ^ (0U - (ZigZag & 1)));
+			Samples[Index] = (UINT16)((Reference != NULL ? Reference[Index] : 0) + Delta);
+			Index++;
+		}
+	}
+
+	return Index == Count;
+}
+
+BOOLEAN
+ImageRingReaderInitialize(
+	IMAGE_RING_READER* Reader,
+	TOUCH_TEST_IMAGE_RING* Ring
+)
+{
+	memset(Reader, 0, sizeof(*Reader));
+
+	if (Ring->Version != TOUCH_TEST_IMAGE_RING_VERSION || Ring->SlotCount < 2 ||
+		Ring->SlotSize < sizeof(TOUCH_TEST_IMAGE_FRAME)) {
+		return FALSE;
+	}
+
+	Reader->Ring = Ring;
+	Reader->Samples = Ring->Rows * Ring->Cols;
+	Reader->Slot = malloc(Ring->SlotSize);
+	Reader->Reference = calloc(Reader->Samples, sizeof(UINT16));
+
+	if (Reader->Slot == NULL || Reader->Reference == NULL) {
+		ImageRingReaderCleanup(Reader);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+VOID
+ImageRingReaderCleanup(
+	IMAGE_RING_READER* Reader
+)
+{
+	free(Reader->Slot);
+	free(Reader->Reference);
+	Reader->Slot = NULL;
+	Reader->Reference = NULL;
+}
+
+BOOLEAN
+ImageRingRead(
+	IMAGE_RING_READER* Reader,
+	UINT16* Samples,
+	TOUCH_TEST_IMAGE_FRAME* Frame
+)
+{
+	TOUCH_TEST_IMAGE_RING* Ring = Reader->Ring;
+	TOUCH_TEST_IMAGE_FRAME* Slot;
+	TOUCH_TEST_IMAGE_FRAME* Copy = (TOUCH_TEST_IMAGE_FRAME*)Reader->Slot;
+	ULONG Write, Next, Before, After, Capacity, Length;
+
+	Capacity = Ring->SlotSize - sizeof(TOUCH_TEST_IMAGE_FRAME);
+
+	for (;;) {
+		Write = __atomic_load_n(&Ring->WriteSequence, __ATOMIC_ACQUIRE);
+
+		if (Write == Reader->Last) {
+			return FALSE;
+		}
+
+		//
+		// The oldest slot may be the one the driver is writing next
+		//
+		Next = Reader->Last + 1;
+
+		if (Write - Reader->Last > Ring->SlotCount - 1) {
+			Next = Write - (Ring->SlotCount - 2);
+			Reader->Lost += Next - (Reader->Last + 1);
+			Reader->ReferenceValid = FALSE;
+		}
+
+		Reader->Last = Next;
+
+		Slot = (TOUCH_TEST_IMAGE_FRAME*)((UINT8*)(Ring + 1) + (Next % Ring->SlotCount) * Ring->SlotSize);
+
+		Before = __atomic_load_n(&Slot->Sequence, __ATOMIC_ACQUIRE);
+		memcpy(Copy, Slot, Ring->SlotSize);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		After = __atomic_load_n(&Slot->Sequence, __ATOMIC_ACQUIRE);
+
+		if (Before != Next || After != Next) {
+			Reader->Lost++;
+			Reader->ReferenceValid = FALSE;
+			continue;
+		}
+
+		Length = min(Copy->Length, Capacity);
+
+		if (Copy->Flags & TOUCH_TEST_IMAGE_FRAME_COMPRESSED) {
+			if (!(Copy->Flags & TOUCH_TEST_IMAGE_FRAME_KEY) && !Reader->ReferenceValid) {
+				Reader->Skipped++;
+				continue;
+			}
+
+			if (!ImageDecode((UINT8*)(Copy + 1),
+				Length,
+				(Copy->Flags & TOUCH_TEST_IMAGE_FRAME_KEY) ? NULL : Reader->Reference,
+				Samples,
+				Reader->Samples)) {
+				Reader->Corrupt++;
+				Reader->ReferenceValid = FALSE;
+				continue;
+			}
+		}
+		else {
+			Length = min(Length, Reader->Samples * sizeof(UINT16));
+			memset(Samples, 0, Reader->Samples * sizeof(UINT16));
+			memcpy(Samples, Copy + 1, Length);
+		}
+
+		memcpy(Reader->Reference, Samples, Reader->Samples * sizeof(UINT16));
+		Reader->ReferenceValid = TRUE;
+		Reader->Read++;
+		Reader->EncodedBytes += Length;
+
+		if (Frame != NULL) {
+			*Frame = *Copy;
+		}
+
+		return TRUE;
+	}
+}
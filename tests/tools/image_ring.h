@@ -0,0 +1,79 @@
+/*++
+	Module Name:
+
+		image_ring.h
+
+	Abstract:
+
+		The application side of IOCTL_TOUCH_SELFTEST_IMAGE_STREAM: reads
+		frames out of the shared ring and decodes compressed ones, as
+		described for TOUCH_TEST_IMAGE_RING in selftest.h.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include <selftest\selftest.h>
+
+typedef struct _IMAGE_RING_READER
+{
+	TOUCH_TEST_IMAGE_RING* Ring;
+	ULONG Samples;
+	ULONG Last;
+
+	UINT8* Slot;
+	UINT16* Reference;
+	BOOLEAN ReferenceValid;
+
+	//
+	// Frames decoded, frames overwritten before they were read,
+	// delta frames dropped while waiting for a key frame, and frames
+	// whose token stream did not decode
+	//
+	ULONG Read;
+	ULONG Lost;
+	ULONG Skipped;
+	ULONG Corrupt;
+	ULONG64 EncodedBytes;
+} IMAGE_RING_READER;
+
+BOOLEAN
+ImageRingReaderInitialize(
+	IMAGE_RING_READER* Reader,
+	TOUCH_TEST_IMAGE_RING* Ring
+);
+
+VOID
+ImageRingReaderCleanup(
+	IMAGE_RING_READER* Reader
+);
+
+//
+// Decodes the next frame into Samples, Rows * Cols of them. Returns
+// FALSE if no frame is ready.
+//
+BOOLEAN
+ImageRingRead(
+	IMAGE_RING_READER* Reader,
+	UINT16* Samples,
+	TOUCH_TEST_IMAGE_FRAME* Frame
+);
+
+//
+// Decodes a token stream against Reference, or against zero if it is
+// NULL. Returns FALSE unless it covers exactly Count samples.
+//
+BOOLEAN
+ImageDecode(
+	const UINT8* Data,
+	ULONG Length,
+	const UINT16* Reference,
+	UINT16* Samples,
+	ULONG Count
+);
@@ -0,0 +1,135 @@
+/*++
+	Module Name:
+
+		soft_touch_bench.c
+
+	Abstract:
+
+		Times the host side touch detector per frame on 18 x 36 and
+		32 x 64 delta images, from a quiet panel to ten fingers:
+
+		  soft_touch_bench [frames]
+
+		The images are made up front, only TcmSoftTouchDetect is timed.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include <tcm/soft_touch_detect.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_X 1439
+#define MAX_Y 2879
+#define SEQUENCE_LENGTH 64
+
+typedef struct _PANEL_SIZE
+{
+	uint32_t Rows;
+	uint32_t Cols;
+} PANEL_SIZE;
+
+static int16_t Images[SEQUENCE_LENGTH][SOFT_TOUCH_MAX_PIXELS];
+static TCM_SOFT_TOUCH_DETECTOR Detector;
+
+//
+// A sequence of frames with Fingers fingers moving over noise just
+// below the threshold, the same on every run
+//
+static void
+BuildSequence(
+	const PANEL_SIZE* Size,
+	uint32_t Fingers
+)
+{
+	uint32_t State = 1, Frame, Row, Col, i;
+	double Value, dx, dy, FingerCol, FingerRow;
+
+	for (Frame = 0; Frame < SEQUENCE_LENGTH; Frame++) {
+		for (Row = 0; Row < Size->Rows; Row++) {
+			for (Col = 0; Col < Size->Cols; Col++) {
+				State = State * 1103515245 + 12345;
+				Value = (double)((State >> 16) % 301) - 150;
+
+				for (i = 0; i < Fingers; i++) {
+					FingerCol = 2 + (i % 5) * (Size->Cols - 4) / 5.0 + Frame * 0.1;
+					FingerRow = 2 + (i / 5) * (Size->Rows - 4) / 2.0 + Frame * 0.05;
+					dx = Col + 0.5 - FingerCol;
+					dy = Row + 0.5 - FingerRow;
+					Value += 1200 * exp(-(dx * dx + dy * dy) / 2);
+				}
+
+				Images[Frame][Row * Size->Cols + Col] = (int16_t)lrint(Value);
+			}
+		}
+	}
+}
+
+static double
+Now(
+	void
+)
+{
+	struct timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+
+	return Time.tv_sec + Time.tv_nsec / 1e9;
+}
+
+int
+main(
+	int argc,
+	char** argv
+)
+{
+	static const PANEL_SIZE Sizes[] = { { 18, 36 }, { 32, 64 } };
+	static const uint32_t Fingers[] = { 0, 1, 5, 10 };
+	TCM_SOFT_TOUCH_CONTACT Contacts[SOFT_TOUCH_MAX_CONTACTS];
+	uint32_t Frames = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 200000;
+	uint32_t s, f, Frame, Found;
+	double Start, Elapsed;
+
+	printf("%-8s %-8s %12s %14s\n", "panel", "fingers", "ns/frame", "frames/s");
+
+	for (s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++) {
+		for (f = 0; f < sizeof(Fingers) / sizeof(Fingers[0]); f++) {
+			BuildSequence(&Sizes[s], Fingers[f]);
+			TcmSoftTouchDetectorInitialize(&Detector, SOFT_TOUCH_THRESHOLD, 0);
+			Found = 0;
+
+			Start = Now();
+
+			for (Frame = 0; Frame < Frames; Frame++) {
+				Found += TcmSoftTouchDetect(&Detector,
+					Images[Frame % SEQUENCE_LENGTH],
+					Sizes[s].Rows,
+					Sizes[s].Cols,
+					MAX_X,
+					MAX_Y,
+					Contacts);
+			}
+
+			Elapsed = Now() - Start;
+
+			if (Found != Frames * Fingers[f]) {
+				fprintf(stderr, "%ux%u, %u fingers: found %u contacts in %u frames\n",
+					Sizes[s].Rows, Sizes[s].Cols, Fingers[f], Found, Frames);
+			}
+
+			printf("%2ux%-5u %-8u %12.1f %14.0f\n",
+				Sizes[s].Rows,
+				Sizes[s].Cols,
+				Fingers[f],
+				Elapsed * 1e9 / Frames,
+				Frames / Elapsed);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,395 @@
+/*++
+	Module Name:
+
+		wake_gesture.c
+
+	Abstract:
+
+		Wake gestures against a controller reporting them through the
+		customer gesture fields: which gestures wake for which modes,
+		that rejected ones fetch their fail reason, that nothing wakes
+		while disarmed or once triggered, and that a gesture picked up
+		by a polled command response still wakes on the next interrupt.
+
+	Environment:
+
+		Linux user mode, test builds only
+
+--*/
+
+#include "test.h"
+#include "tcm_harness.h"
+#include "hid_sink.h"
+#include "registry.h"
+#include <unistd.h>
+
+#define ALL_MODES (LGE_GESTURE_KNOCK_ON | LGE_GESTURE_SWIPE | LGE_GESTURE_LONG_PRESS)
+
+#define REPORT_TIMEOUT_MS 500
+
+static const UINT8 GestureReportConfig[] = {
+	TOUCH_CUSTOMER_GESTURE_DETECTED, 8,
+	TOUCH_CUSTOMER_GESTURE_INFO, 32,
+	TOUCH_NUM_OF_ACTIVE_OBJECTS, 8,
+	TOUCH_FOREACH_ACTIVE_OBJECT,
+	TOUCH_OBJECT_N_INDEX, 4,
+	TOUCH_OBJECT_N_CLASSIFICATION, 4,
+	TOUCH_OBJECT_N_X_POSITION, 16,
+	TOUCH_OBJECT_N_Y_POSITION, 16,
+	TOUCH_FOREACH_END,
+	TOUCH_END
+};
+
+static const UINT8 FailReason[] = { 0x03, 0x00, 0x02, 0x00 };
+
+static const UINT8 Point[] = { 0xd0, 0x02, 0xa0, 0x05 };
+
+typedef struct _GESTURE_FIRMWARE
+{
+	TCM_LGE_GESTURE_CONFIG Config;
+	ULONG Configs;
+} GESTURE_FIRMWARE;
+
+static BOOLEAN
+GestureCommands(
+	FAKE_TCM* Tcm,
+	UINT8 Command,
+	const UINT8* Payload,
+	ULONG Length,
+	PVOID Context
+)
+{
+	GESTURE_FIRMWARE* Firmware = Context;
+
+	switch (Command) {
+	case CMD_SET_LGE_GESTURE_CONFIG:
+		memcpy(&Firmware->Config, Payload, min(Length, sizeof(Firmware->Config)));
+		Firmware->Configs++;
+		FakeTcmRespond(Tcm, TCM_STATUS_OK, NULL, 0);
+		return TRUE;
+
+	case CMD_GET_LGE_GESTURE_FAILREASON:
+		FakeTcmRespond(Tcm, TCM_STATUS_OK, FailReason, sizeof(FailReason));
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+static VOID
+StartArmed(
+	TCM_HARNESS* Harness,
+	GESTURE_FIRMWARE* Firmware,
+	ULONG Modes
+)
+{
+	ShimRegistrySetDword(L"Enabled", 1);
+	ShimRegistrySetDword(L"Modes", Modes);
+
+	memset(Firmware, 0, sizeof(*Firmware));
+
+	TcmHarnessInitialize(Harness);
+	memcpy(Harness->Tcm.ReportConfig, GestureReportConfig, sizeof(GestureReportConfig));
+	Harness->Tcm.ReportConfigLength = sizeof(GestureReportConfig);
+	FakeTcmSetHook(&Harness->Tcm, GestureCommands, Firmware);
+
+	CHECK_SUCCESS(TcmHarnessStart(Harness, TRUE, 2000));
+	CHECK_EQ(Harness->Controller->GesturesEnabled, TRUE);
+	CHECK_EQ(Harness->Controller->WakeGesture.Modes, Modes);
+
+	CHECK_SUCCESS(TcmWakeGestureArm(Harness->Controller, Harness->Spb));
+	CHECK_EQ(Harness->Controller->WakeGesture.State, WAKE_GESTURE_ARMED);
+	CHECK_EQ(Firmware->Configs, 1);
+	CHECK_EQ(Firmware->Config.Enable, 1);
+	CHECK_EQ(Firmware->Config.Modes, Modes);
+	CHECK_EQ(Harness->Tcm.DynamicConfig[DC_IN_WAKEUP_GESTURE_MODE], 1);
+
+	FakeHidReset();
+}
+
+static VOID
+Stop(
+	TCM_HARNESS* Harness
+)
+{
+	TcmHarnessStop(Harness);
+	ShimRegistryClear();
+}
+
+//
+// The wake is a power key press and release, the last two reports
+//
+static VOID
+CheckWakeKey(
+	VOID
+)
+{
+	HID_INPUT_REPORT Report;
+
+	CHECK(FakeHidRecent(1, &Report));
+	CHECK_EQ(Report.ReportID, REPORTID_KEYPAD);
+	CHECK_EQ(Report.KeyReport.SystemPowerDown, 1);
+
+	CHECK(FakeHidRecent(0, &Report));
+	CHECK_EQ(Report.ReportID, REPORTID_KEYPAD);
+	CHECK_EQ(Report.KeyReport.SystemPowerDown, 0);
+}
+
+//
+// Queues a gesture report and waits for the interrupt to be done with
+// it. Returns whether the system was woken for it.
+//
+static BOOLEAN
+Gesture(
+	TCM_HARNESS* Harness,
+	UINT8 Detected
+)
+{
+	ULONG Reports = FakeHidReports();
+
+	FakeTcmQueueGesture(&Harness->Tcm, Detected, Point, sizeof(Point));
+
+	CHECK(TcmHarnessDrain(Harness, REPORT_TIMEOUT_MS));
+	usleep(5000);
+
+	if (FakeHidReports() == Reports) {
+		return FALSE;
+	}
+
+	CHECK_EQ(FakeHidReports(), Reports + 2);
+	CheckWakeKey();
+
+	return TRUE;
+}
+
+static VOID
+WaitFailReason(
+	TCM_HARNESS* Harness,
+	ULONG Reads
+)
+{
+	ULONG i;
+
+	for (i = 0; i < REPORT_TIMEOUT_MS && Harness->Controller->WakeGesture.FailReasonLength == 0; i++) {
+		usleep(1000);
+	}
+
+	CHECK_EQ(Harness->Tcm.CommandCounts[CMD_GET_LGE_GESTURE_FAILREASON], Reads);
+	CHECK_EQ(Harness->Controller->WakeGesture.FailReasonLength, sizeof(FailReason));
+	CHECK(memcmp(Harness->Controller->WakeGesture.FailReason, FailReason, sizeof(FailReason)) == 0);
+}
+
+static VOID
+TestKnockOn(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	GESTURE_FIRMWARE Firmware;
+	TCM_WAKE_GESTURE* WakeGesture;
+
+	StartArmed(&Harness, &Firmware, ALL_MODES);
+	WakeGesture = &Harness.Controller->WakeGesture;
+
+	CHECK(Gesture(&Harness, DETECT_KNOCK_ON));
+	CHECK_EQ(WakeGesture->State, WAKE_GESTURE_TRIGGERED);
+	CHECK_EQ(WakeGesture->Wakeups, 1);
+	CHECK_EQ(WakeGesture->LastGesture, DETECT_KNOCK_ON);
+	CHECK_EQ(WakeGesture->InfoLength, sizeof(Point));
+	CHECK(memcmp(WakeGesture->Info, Point, sizeof(Point)) == 0);
+
+	//
+	// Triggered swallows everything until the display comes back on
+	//
+	CHECK(!Gesture(&Harness, DETECT_KNOCK_ON));
+	CHECK(!Gesture(&Harness, DETECT_SWIPE));
+	CHECK_EQ(WakeGesture->Wakeups, 1);
+	CHECK_EQ(WakeGesture->Rejected, 0);
+
+	//
+	// So does disarmed
+	//
+	CHECK_SUCCESS(TcmWakeGestureDisarm(Harness.Controller, Harness.Spb));
+	CHECK_EQ(WakeGesture->State, WAKE_GESTURE_DISARMED);
+	CHECK_EQ(Firmware.Configs, 2);
+	CHECK_EQ(Firmware.Config.Enable, 0);
+	CHECK_EQ(Harness.Tcm.DynamicConfig[DC_IN_WAKEUP_GESTURE_MODE], 0);
+
+	CHECK(!Gesture(&Harness, DETECT_KNOCK_ON));
+	CHECK_EQ(WakeGesture->Wakeups, 1);
+	CHECK_EQ(WakeGesture->Rejected, 0);
+	CHECK_EQ(Harness.Tcm.CommandCounts[CMD_GET_LGE_GESTURE_FAILREASON], 0);
+
+	//
+	// Arming again wakes once more
+	//
+	CHECK_SUCCESS(TcmWakeGestureArm(Harness.Controller, Harness.Spb));
+	CHECK(Gesture(&Harness, DETECT_KNOCK_ON));
+	CHECK_EQ(WakeGesture->Wakeups, 2);
+
+	Stop(&Harness);
+}
+
+static VOID
+TestSwipe(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	GESTURE_FIRMWARE Firmware;
+
+	StartArmed(&Harness, &Firmware, LGE_GESTURE_SWIPE);
+
+	CHECK(Gesture(&Harness, DETECT_SWIPE));
+	CHECK_EQ(Harness.Controller->WakeGesture.State, WAKE_GESTURE_TRIGGERED);
+	CHECK_EQ(Harness.Controller->WakeGesture.Wakeups, 1);
+	CHECK_EQ(Harness.Controller->WakeGesture.Rejected, 0);
+
+	Stop(&Harness);
+}
+
+static VOID
+TestLongPress(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	GESTURE_FIRMWARE Firmware;
+	TCM_WAKE_GESTURE* WakeGesture;
+
+	StartArmed(&Harness, &Firmware, LGE_GESTURE_LONG_PRESS);
+	WakeGesture = &Harness.Controller->WakeGesture;
+
+	//
+	// A release without its press is rejected
+	//
+	CHECK(!Gesture(&Harness, DETECT_LONG_PRESS_UP));
+	CHECK_EQ(WakeGesture->State, WAKE_GESTURE_ARMED);
+	CHECK_EQ(WakeGesture->Rejected, 1);
+	WaitFailReason(&Harness, 1);
+
+	CHECK(!Gesture(&Harness, DETECT_LONG_PRESS_DOWN));
+	CHECK_EQ(WakeGesture->State, WAKE_GESTURE_LONG_PRESS);
+	CHECK_EQ(WakeGesture->Wakeups, 0);
+
+	CHECK(Gesture(&Harness, DETECT_LONG_PRESS_UP));
+	CHECK_EQ(WakeGesture->State, WAKE_GESTURE_TRIGGERED);
+	CHECK_EQ(WakeGesture->Wakeups, 1);
+	CHECK_EQ(WakeGesture->Rejected, 1);
+
+	Stop(&Harness);
+}
+
+static VOID
+TestRejectedModes(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	GESTURE_FIRMWARE Firmware;
+	TCM_WAKE_GESTURE* WakeGesture;
+
+	StartArmed(&Harness, &Firmware, LGE_GESTURE_KNOCK_ON);
+	WakeGesture = &Harness.Controller->WakeGesture;
+
+	//
+	// Gestures outside of the armed modes stay armed and read back why
+	// the firmware reported them
+	//
+	CHECK(!Gesture(&Harness, DETECT_SWIPE));
+	CHECK_EQ(WakeGesture->State, WAKE_GESTURE_ARMED);
+	CHECK_EQ(WakeGesture->Rejected, 1);
+	CHECK_EQ(WakeGesture->LastGesture, DETECT_SWIPE);
+	WaitFailReason(&Harness, 1);
+
+	//
+	// A press outside of the modes does not start a long press
+	//
+	CHECK(!Gesture(&Harness, DETECT_LONG_PRESS_DOWN));
+	CHECK_EQ(WakeGesture->State, WAKE_GESTURE_ARMED);
+	CHECK_EQ(WakeGesture->Rejected, 2);
+
+	CHECK(!Gesture(&Harness, DETECT_LONG_PRESS));
+	CHECK_EQ(WakeGesture->Rejected, 3);
+	CHECK_EQ(WakeGesture->Wakeups, 0);
+
+	CHECK(Gesture(&Harness, DETECT_KNOCK_ON));
+	CHECK_EQ(WakeGesture->Wakeups, 1);
+
+	Stop(&Harness);
+}
+
+static VOID
+TestPolledWake(
+	VOID
+)
+{
+	static TCM_HARNESS Harness;
+	GESTURE_FIRMWARE Firmware;
+	TCM_WAKE_GESTURE* WakeGesture;
+	FAKE_TCM_OBJECT Object = { 0, 1, 500, 900 };
+	HID_INPUT_REPORT Report;
+	ULONG i;
+
+	StartArmed(&Harness, &Firmware, ALL_MODES);
+	WakeGesture = &Harness.Controller->WakeGesture;
+
+	//
+	// Read the way a command waiting for its response reads, without a
+	// report context to send the wake with
+	//
+	TcmHarnessDisconnectInterrupt(&Harness);
+
+	FakeTcmQueueGesture(&Harness.Tcm, DETECT_KNOCK_ON, Point, sizeof(Point));
+	CHECK_SUCCESS(TcmReadMessage(Harness.Controller, Harness.Spb, NULL));
+
+	CHECK_EQ(WakeGesture->State, WAKE_GESTURE_WAKE_PENDING);
+	CHECK_EQ(WakeGesture->Wakeups, 0);
+	CHECK_EQ(FakeHidReports(), 0);
+
+	//
+	// Later gestures do not queue up a second wake
+	//
+	FakeTcmQueueGesture(&Harness.Tcm, DETECT_SWIPE, Point, sizeof(Point));
+	CHECK_SUCCESS(TcmReadMessage(Harness.Controller, Harness.Spb, NULL));
+	CHECK_EQ(WakeGesture->State, WAKE_GESTURE_WAKE_PENDING);
+	CHECK_EQ(WakeGesture->Rejected, 0);
+
+	//
+	// The next interrupt pass sends it, after whatever it read
+	//
+	CHECK_SUCCESS(TcmHarnessConnectInterrupt(&Harness));
+	FakeTcmQueueTouch(&Harness.Tcm, &Object, 1);
+
+	for (i = 0; i < REPORT_TIMEOUT_MS && WakeGesture->Wakeups == 0; i++) {
+		usleep(1000);
+	}
+
+	CHECK(TcmHarnessDrain(&Harness, REPORT_TIMEOUT_MS));
+	usleep(5000);
+
+	CHECK_EQ(WakeGesture->State, WAKE_GESTURE_TRIGGERED);
+	CHECK_EQ(WakeGesture->Wakeups, 1);
+	CHECK_EQ(FakeHidReports(), 3);
+	CheckWakeKey();
+
+	CHECK(FakeHidRecent(2, &Report));
+	CHECK(Report.ReportID != REPORTID_KEYPAD);
+
+	Stop(&Harness);
+}
+
+int
+main(
+	void
+)
+{
+	RUN(TestKnockOn);
+	RUN(TestSwipe);
+	RUN(TestLongPress);
+	RUN(TestRejectedModes);
+	RUN(TestPolledWake);
+
+	return TestResult();
+}